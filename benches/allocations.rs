@@ -0,0 +1,121 @@
+//! Heap allocations of lexing, parsing, visiting and printing.
+//!
+//! For every input of the benchmark suite, reports the number of allocations
+//! and bytes allocated by each phase, in total and per token, after the sizes
+//! of the token and tree types that most of those bytes hold, and the bytes
+//! that the tokens and trees still hold afterwards, by [`HeapSize`].
+//!
+//! Usage: `cargo bench --all-features --bench allocations`
+
+mod common;
+
+use std::hint::black_box;
+
+use cgrammar::*;
+use common::{
+    alloc::{Allocations, CountingAllocator, count_allocations},
+    count_tokens, inputs,
+};
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// A visitor that only walks the tree.
+struct NoopVisitor;
+
+impl<'a> Visitor<'a> for NoopVisitor {
+    type Result = ();
+}
+
+fn report(input: &str, phase: &str, tokens: u64, allocations: Allocations) {
+    println!(
+        "{input:16}  {phase:6}  {:>12}  {:>14}  {:>10.3}  {:>12.1}",
+        allocations.count,
+        allocations.bytes,
+        allocations.count as f64 / tokens as f64,
+        allocations.bytes as f64 / tokens as f64,
+    );
+}
+
+/// Report the bytes held by the results of a phase.
+fn report_held(input: &str, phase: &str, tokens: u64, bytes: usize) {
+    println!(
+        "{input:16}  {phase:6}  {:>12}  {bytes:>14}  {:>10}  {:>12.1}",
+        "",
+        "",
+        bytes as f64 / tokens as f64,
+    );
+}
+
+fn main() {
+    // Tests run benchmarks with `--test`, which has nothing to check here
+    if std::env::args().any(|arg| arg == "--test") {
+        return;
+    }
+
+    for (name, size) in [
+        ("Spanned<BalancedToken>", size_of::<span::Spanned<BalancedToken>>()),
+        ("Constant", size_of::<Constant>()),
+        ("Expression", size_of::<Expression>()),
+        ("Statement", size_of::<Statement>()),
+        ("Declaration", size_of::<Declaration>()),
+        ("DeclarationSpecifier", size_of::<DeclarationSpecifier>()),
+        ("Declarator", size_of::<Declarator>()),
+        ("TypeName", size_of::<TypeName>()),
+    ] {
+        println!("{name:24}  {size:>4} bytes");
+    }
+    println!();
+
+    println!(
+        "{:16}  {:6}  {:>12}  {:>14}  {:>10}  {:>12}",
+        "input", "phase", "allocations", "bytes", "per token", "bytes/token"
+    );
+    let parser = translation_unit();
+    for input in inputs() {
+        let (lexed, lex_allocations) = count_allocations(|| {
+            input
+                .sources
+                .iter()
+                .map(|source| lex(source, None).0)
+                .collect::<Vec<_>>()
+        });
+        let tokens = lexed.iter().map(count_tokens).sum();
+        report(&input.name, "lex", tokens, lex_allocations);
+
+        let (units, parse_allocations) = count_allocations(|| {
+            lexed
+                .iter()
+                .map(|tokens| parser.parse(tokens.as_input()).into_output().unwrap_or_default())
+                .collect::<Vec<_>>()
+        });
+        report(&input.name, "parse", tokens, parse_allocations);
+        report_held(
+            &input.name,
+            "tokens",
+            tokens,
+            lexed.iter().map(HeapSize::deep_size).sum(),
+        );
+        report_held(&input.name, "tree", tokens, units.iter().map(HeapSize::deep_size).sum());
+
+        let ((), visit_allocations) = count_allocations(|| {
+            for unit in &units {
+                NoopVisitor.visit_translation_unit(black_box(unit));
+            }
+        });
+        report(&input.name, "visit", tokens, visit_allocations);
+
+        #[cfg(feature = "printer")]
+        {
+            use cgrammar::printer::{Context, Printer};
+            let ((), print_allocations) = count_allocations(|| {
+                for unit in &units {
+                    let mut printer = Printer::new_extra(String::new(), 80, Context::default());
+                    printer.visit_translation_unit(unit).unwrap();
+                    black_box(printer.finish().unwrap());
+                }
+            });
+            report(&input.name, "print", tokens, print_allocations);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+//! A global allocator that counts the allocations of the current thread.
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+};
+
+/// Counts allocations, and delegates them to the system allocator.
+///
+/// Install it in a benchmark with
+/// `#[global_allocator] static ALLOCATOR: CountingAllocator = CountingAllocator;`.
+pub struct CountingAllocator;
+
+/// Number and total size of heap allocations.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Allocations {
+    /// Number of allocations, including reallocations.
+    pub count: u64,
+    /// Bytes allocated, counting the new size of each reallocation.
+    pub bytes: u64,
+}
+
+thread_local! {
+    static ALLOCATIONS: Cell<Allocations> = const { Cell::new(Allocations { count: 0, bytes: 0 }) };
+}
+
+fn record(size: usize) {
+    let _ = ALLOCATIONS.try_with(|allocations| {
+        let Allocations { count, bytes } = allocations.get();
+        allocations.set(Allocations {
+            count: count + 1,
+            bytes: bytes + size as u64,
+        });
+    });
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        record(layout.size());
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        record(layout.size());
+        unsafe { System.alloc_zeroed(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        record(new_size);
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+/// Run `f`, and count the allocations it made on the current thread.
+///
+/// Only counts anything if [`CountingAllocator`] is the global allocator.
+pub fn count_allocations<T>(f: impl FnOnce() -> T) -> (T, Allocations) {
+    let before = ALLOCATIONS.with(Cell::get);
+    let output = f();
+    let after = ALLOCATIONS.with(Cell::get);
+    let allocations = Allocations {
+        count: after.count - before.count,
+        bytes: after.bytes - before.bytes,
+    };
+    (output, allocations)
+}
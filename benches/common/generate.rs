@@ -0,0 +1,590 @@
+//! Seeded random C23 programs, for inputs of shapes the test corpus lacks.
+//!
+//! The operators, type specifiers and type qualifiers are read from the
+//! productions of `src/grammar.txt`, and declarations, statements and
+//! expressions are built along its productions. Every name is declared before
+//! it is used and typedef names are never redeclared, so the programs parse
+//! without errors; they are not meant to type check.
+//!
+//! This module only uses `std`, so that tests can include it with `#[path]`.
+
+use std::fmt::Write;
+
+/// The shape of a generated program.
+///
+/// The depths and lengths are upper bounds: each declarator and expression
+/// draws its own, uniformly, so that a program mixes small and large ones.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Config {
+    /// Seed of the random generator. The same configuration always gives the
+    /// same program.
+    pub seed: u64,
+    /// External declarations of the program.
+    pub declarations: usize,
+    /// Statements of each function body, counting nested statements.
+    pub statements: usize,
+    /// Deepest nesting of statements, and of parenthesized expressions.
+    pub max_depth: usize,
+    /// Chance of each declaration being a typedef, from 0 to 1.
+    pub typedef_density: f64,
+    /// Most operands of an expression.
+    pub expression_terms: usize,
+    /// Most pointer, array and function declarators around a declared name.
+    pub declarator_depth: usize,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            seed: 0,
+            declarations: 100,
+            statements: 20,
+            max_depth: 6,
+            typedef_density: 0.2,
+            expression_terms: 8,
+            declarator_depth: 3,
+        }
+    }
+}
+
+/// Generate a translation unit of the shape of `config`.
+pub fn generate(config: &Config) -> String {
+    let mut generator = Generator {
+        config: *config,
+        grammar: Grammar::new(include_str!("../../src/grammar.txt")),
+        rng: Rng(config.seed),
+        out: String::new(),
+        next_name: 0,
+        variables: Vec::new(),
+        typedef_names: Vec::new(),
+        functions: Vec::new(),
+        loops: 0,
+        switches: 0,
+    };
+    for _ in 0..config.declarations {
+        generator.external_declaration();
+    }
+    generator.out
+}
+
+/// The terminals of the grammar that the generator picks from.
+struct Grammar {
+    binary_operators: Vec<&'static str>,
+    assignment_operators: Vec<&'static str>,
+    unary_operators: Vec<&'static str>,
+    type_specifiers: Vec<&'static str>,
+    type_qualifiers: Vec<&'static str>,
+}
+
+impl Grammar {
+    fn new(grammar: &'static str) -> Self {
+        let productions = productions(grammar);
+        let alternatives = |name: &str| {
+            productions
+                .iter()
+                .find(|(production, _)| *production == name)
+                .map(|(_, alternatives)| alternatives.as_slice())
+                .unwrap_or_else(|| panic!("No {name} in the grammar"))
+        };
+        // Single keywords, without their quotes
+        let keywords = |name: &str| -> Vec<&'static str> {
+            alternatives(name)
+                .iter()
+                .filter_map(|alternative| match alternative[..] {
+                    [keyword] => keyword.strip_prefix('"')?.strip_suffix('"'),
+                    _ => None,
+                })
+                .collect()
+        };
+
+        // The left-recursive `name: name operator operand` alternatives of
+        // the binary expressions, but not the comma of `expression`, which
+        // would split the arguments of calls
+        let binary_operators = productions
+            .iter()
+            .filter(|(name, _)| name.ends_with("-expression") && *name != "expression")
+            .flat_map(|(name, alternatives)| {
+                alternatives
+                    .iter()
+                    .filter_map(move |alternative| match alternative[..] {
+                        [left, operator, right] if left == *name && right.ends_with("-expression") => Some(operator),
+                        _ => None,
+                    })
+            })
+            .collect();
+        // `void` only declares functions here, `_Complex` needs a floating
+        // type, and `_Atomic (` would start an atomic type specifier after a
+        // pointer
+        let type_specifiers = keywords("type-specifier")
+            .into_iter()
+            .filter(|&keyword| keyword != "void" && keyword != "_Complex")
+            .collect();
+        let type_qualifiers = keywords("type-qualifier")
+            .into_iter()
+            .filter(|&keyword| keyword != "_Atomic")
+            .collect();
+        Self {
+            binary_operators,
+            assignment_operators: alternatives("assignment-operator").iter().flatten().copied().collect(),
+            unary_operators: alternatives("unary-operator").iter().flatten().copied().collect(),
+            type_specifiers,
+            type_qualifiers,
+        }
+    }
+}
+
+/// The productions of the grammar, each a name and its alternatives, as
+/// `build.rs` reads them.
+fn productions(grammar: &str) -> Vec<(&str, Vec<Vec<&str>>)> {
+    let mut productions = Vec::new();
+    let mut lines = grammar.lines();
+    while let Some(line) = lines.next() {
+        let Some((_, header)) = line.strip_prefix('(').and_then(|line| line.split_once(") ")) else {
+            continue;
+        };
+        let Some(name) = header.strip_suffix(':').or_else(|| header.strip_suffix(": one of")) else {
+            continue;
+        };
+        let alternatives = lines
+            .by_ref()
+            .take_while(|line| !line.trim().is_empty())
+            .map(|line| line.split_whitespace().collect())
+            .collect();
+        productions.push((name, alternatives));
+    }
+    productions
+}
+
+/// The SplitMix64 generator: small, fast, and the same on every platform.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        z ^ (z >> 31)
+    }
+
+    /// A number in `0..n`, for a non-zero `n`.
+    fn below(&mut self, n: usize) -> usize {
+        (self.next() % n as u64) as usize
+    }
+
+    /// A number in `1..=max`, or 1 if `max` is 0.
+    fn up_to(&mut self, max: usize) -> usize {
+        1 + self.below(max.max(1))
+    }
+
+    fn chance(&mut self, p: f64) -> bool {
+        ((self.next() >> 11) as f64 / (1u64 << 53) as f64) < p
+    }
+
+    fn pick<'a, T>(&mut self, items: &'a [T]) -> &'a T {
+        &items[self.below(items.len())]
+    }
+}
+
+struct Generator {
+    config: Config,
+    grammar: Grammar,
+    rng: Rng,
+    out: String,
+    next_name: usize,
+    /// Ordinary identifiers in scope.
+    variables: Vec<String>,
+    /// Typedef names in scope.
+    typedef_names: Vec<String>,
+    /// Functions defined so far.
+    functions: Vec<String>,
+    /// Loops around the statement being generated.
+    loops: usize,
+    /// Switch statements around the statement being generated.
+    switches: usize,
+}
+
+impl Generator {
+    /// A name never used before.
+    fn name(&mut self, prefix: &str) -> String {
+        self.next_name += 1;
+        format!("{prefix}{}", self.next_name)
+    }
+
+    fn indent(&mut self, depth: usize) {
+        self.out.push('\n');
+        for _ in 0..depth {
+            self.out.push_str("    ");
+        }
+    }
+
+    fn external_declaration(&mut self) {
+        match self.rng.below(8) {
+            0..4 => self.function_definition(),
+            4 => self.enum_declaration(),
+            _ => self.declaration(0),
+        }
+        self.out.push('\n');
+    }
+
+    fn function_definition(&mut self) {
+        let name = self.name("f");
+        self.out.push_str("static ");
+        match self.rng.chance(0.2) {
+            true => self.out.push_str("void"),
+            false => self.declaration_specifiers(),
+        }
+        write!(self.out, " {name}(").unwrap();
+        let (variables, typedef_names) = (self.variables.len(), self.typedef_names.len());
+        let parameters = self.rng.below(4);
+        if parameters == 0 {
+            self.out.push_str("void");
+        }
+        for i in 0..parameters {
+            if i > 0 {
+                self.out.push_str(", ");
+            }
+            self.declaration_specifiers();
+            let parameter = self.name("p");
+            write!(self.out, " {parameter}").unwrap();
+            self.variables.push(parameter);
+        }
+        self.out.push_str(") {");
+        // Functions may call themselves
+        self.functions.push(name);
+        let statements = self.config.statements;
+        self.block_items(statements, 1);
+        self.out.push_str("\n}");
+        self.variables.truncate(variables);
+        self.typedef_names.truncate(typedef_names);
+    }
+
+    fn enum_declaration(&mut self) {
+        let name = self.name("e");
+        write!(self.out, "enum {name} {{").unwrap();
+        for i in 0..self.rng.up_to(4) {
+            if i > 0 {
+                self.out.push_str(", ");
+            }
+            let constant = self.name("E");
+            self.out.push_str(&constant);
+            if self.rng.chance(0.5) {
+                self.out.push_str(" = ");
+                self.expression(3, 0);
+            }
+            self.variables.push(constant);
+        }
+        self.out.push_str("};");
+    }
+
+    /// A declaration or typedef, whose names are in scope after it.
+    fn declaration(&mut self, depth: usize) {
+        let typedef = self.rng.chance(self.config.typedef_density);
+        if typedef {
+            self.out.push_str("typedef ");
+        } else if depth == 0 && self.rng.chance(0.3) {
+            self.out.push_str("static ");
+        }
+        self.declaration_specifiers();
+        let mut names = Vec::new();
+        for i in 0..self.rng.up_to(2) {
+            self.out.push_str(if i == 0 { " " } else { ", " });
+            let name = self.name(if typedef { "t" } else { "v" });
+            let plain = self.declarator(&name);
+            if !typedef && plain && self.rng.chance(0.5) {
+                self.out.push_str(" = ");
+                let terms = self.rng.up_to(self.config.expression_terms);
+                self.expression(terms, 0);
+            }
+            names.push(name);
+        }
+        self.out.push(';');
+        match typedef {
+            true => self.typedef_names.extend(names),
+            false => self.variables.extend(names),
+        }
+    }
+
+    /// A type qualifier and a type specifier: a typedef name or a keyword.
+    fn declaration_specifiers(&mut self) {
+        if self.rng.chance(0.2) {
+            // Only pointers may be `restrict`
+            let qualifier = *self.rng.pick(&self.grammar.type_qualifiers);
+            if qualifier != "restrict" {
+                write!(self.out, "{qualifier} ").unwrap();
+            }
+        }
+        if !self.typedef_names.is_empty() && self.rng.chance(0.5) {
+            let name = self.rng.pick(&self.typedef_names);
+            self.out.push_str(name);
+            return;
+        }
+        let specifier = *self.rng.pick(&self.grammar.type_specifiers);
+        self.out.push_str(specifier);
+    }
+
+    /// A declarator of `name`, returning whether it is the name alone.
+    fn declarator(&mut self, name: &str) -> bool {
+        let depth = self.rng.below(self.config.declarator_depth + 1);
+        let mut declarator = name.to_string();
+        let mut pointer = false;
+        for _ in 0..depth {
+            let suffix = match self.rng.below(3) {
+                0 => {
+                    let qualifier = match self.rng.chance(0.3) {
+                        true => format!("{} ", self.rng.pick(&self.grammar.type_qualifiers)),
+                        false => String::new(),
+                    };
+                    declarator = format!("*{qualifier}{declarator}");
+                    pointer = true;
+                    continue;
+                }
+                1 => format!("[{}]", self.rng.up_to(16)),
+                _ => "(int)".to_string(),
+            };
+            // Arrays and functions bind tighter than pointers
+            if pointer {
+                declarator = format!("({declarator})");
+                pointer = false;
+            }
+            declarator.push_str(&suffix);
+        }
+        self.out.push_str(&declarator);
+        depth == 0
+    }
+
+    /// `n` block items, counting the statements nested in them, whose
+    /// declarations go out of scope after them.
+    fn block_items(&mut self, n: usize, depth: usize) {
+        let (variables, typedef_names) = (self.variables.len(), self.typedef_names.len());
+        let mut left = n;
+        while left > 0 {
+            self.indent(depth);
+            let size = match depth < self.config.max_depth && left > 1 && self.rng.chance(0.3) {
+                true => self.rng.up_to(left - 1) + 1,
+                false => 1,
+            };
+            match size {
+                1 if self.rng.chance(0.3) => self.declaration(depth),
+                1 => self.simple_statement(),
+                _ => self.compound_statement(size, depth),
+            }
+            left -= size;
+        }
+        self.variables.truncate(variables);
+        self.typedef_names.truncate(typedef_names);
+    }
+
+    /// A statement without nested statements or declarations.
+    fn simple_statement(&mut self) {
+        let terms = self.rng.up_to(self.config.expression_terms);
+        match self.rng.below(8) {
+            0 if self.loops > 0 => self.out.push_str("continue;"),
+            0 | 1 if self.loops + self.switches > 0 => self.out.push_str("break;"),
+            0..3 => {
+                self.out.push_str("return ");
+                self.expression(terms, 0);
+                self.out.push(';');
+            }
+            3 => self.out.push(';'),
+            _ if !self.variables.is_empty() => {
+                let variable = self.rng.pick(&self.variables).clone();
+                let operator = *self.rng.pick(&self.grammar.assignment_operators);
+                write!(self.out, "{variable} {operator} ").unwrap();
+                self.expression(terms, 0);
+                self.out.push(';');
+            }
+            _ => {
+                self.expression(terms, 0);
+                self.out.push(';');
+            }
+        }
+    }
+
+    /// A statement of `n` statements, counting itself, with nested ones.
+    fn compound_statement(&mut self, n: usize, depth: usize) {
+        let terms = self.rng.up_to(self.config.expression_terms);
+        match self.rng.below(7) {
+            0 => {
+                self.out.push('{');
+                self.block_items(n - 1, depth + 1);
+                self.indent(depth);
+                self.out.push('}');
+            }
+            1 if n > 2 => {
+                self.out.push_str("if (");
+                self.expression(terms, 0);
+                self.out.push_str(") ");
+                let then = self.rng.up_to(n - 2);
+                self.secondary_block(then, depth);
+                self.out.push_str(" else ");
+                self.secondary_block(n - 1 - then, depth);
+            }
+            1 | 2 => {
+                self.out.push_str("if (");
+                self.expression(terms, 0);
+                self.out.push_str(") ");
+                self.secondary_block(n - 1, depth);
+            }
+            3 => {
+                self.out.push_str("while (");
+                self.expression(terms, 0);
+                self.out.push_str(") ");
+                self.loops += 1;
+                self.secondary_block(n - 1, depth);
+                self.loops -= 1;
+            }
+            4 => {
+                self.out.push_str("do ");
+                self.loops += 1;
+                self.secondary_block(n - 1, depth);
+                self.loops -= 1;
+                self.out.push_str(" while (");
+                self.expression(terms, 0);
+                self.out.push_str(");");
+            }
+            5 => {
+                let variables = self.variables.len();
+                let counter = self.name("i");
+                write!(self.out, "for (int {counter} = 0; ").unwrap();
+                self.variables.push(counter.clone());
+                self.expression(terms, 0);
+                write!(self.out, "; {counter}++) ").unwrap();
+                self.loops += 1;
+                self.secondary_block(n - 1, depth);
+                self.loops -= 1;
+                self.variables.truncate(variables);
+            }
+            _ => {
+                self.out.push_str("switch (");
+                self.expression(terms, 0);
+                self.out.push_str(") {");
+                self.switches += 1;
+                let mut left = n - 1;
+                let mut case = 0;
+                while left > 0 {
+                    self.indent(depth);
+                    let size = self.rng.up_to(left);
+                    match left == size && case > 0 {
+                        true => self.out.push_str("default:"),
+                        false => write!(self.out, "case {case}:").unwrap(),
+                    }
+                    self.block_items(size, depth + 1);
+                    left -= size;
+                    case += 1;
+                }
+                self.switches -= 1;
+                self.indent(depth);
+                self.out.push('}');
+            }
+        }
+    }
+
+    /// The body of a selection or iteration statement, of `n` statements.
+    fn secondary_block(&mut self, n: usize, depth: usize) {
+        if n == 1 && self.rng.chance(0.5) {
+            self.simple_statement();
+            return;
+        }
+        self.out.push('{');
+        self.block_items(n, depth + 1);
+        self.indent(depth);
+        self.out.push('}');
+    }
+
+    /// An expression of `terms` operands, counting those of its nested
+    /// expressions.
+    fn expression(&mut self, terms: usize, depth: usize) {
+        let mut left = terms;
+        while left > 0 {
+            let size = match depth < self.config.max_depth && left > 1 && self.rng.chance(0.2) {
+                true => self.rng.up_to(left),
+                false => 1,
+            };
+            self.operand(size, depth);
+            left -= size;
+            if left > 0 {
+                let operator = *self.rng.pick(&self.grammar.binary_operators);
+                write!(self.out, " {operator} ").unwrap();
+            }
+        }
+    }
+
+    /// An operand of `terms` operands.
+    fn operand(&mut self, terms: usize, depth: usize) {
+        if terms == 1 {
+            return self.primary();
+        }
+        match self.rng.below(5) {
+            0 if !self.functions.is_empty() => {
+                let function = self.rng.pick(&self.functions).clone();
+                write!(self.out, "{function}(").unwrap();
+                let first = self.rng.up_to(terms - 1);
+                self.expression(first, depth + 1);
+                self.out.push_str(", ");
+                self.expression(terms - first, depth + 1);
+                self.out.push(')');
+            }
+            1 if terms > 2 => {
+                self.out.push('(');
+                let condition = self.rng.up_to(terms - 2);
+                let then = self.rng.up_to(terms - 1 - condition);
+                self.expression(condition, depth + 1);
+                self.out.push_str(" ? ");
+                self.expression(then, depth + 1);
+                self.out.push_str(" : ");
+                self.expression(terms - condition - then, depth + 1);
+                self.out.push(')');
+            }
+            2 => {
+                self.out.push('(');
+                self.type_name();
+                self.out.push_str(")(");
+                self.expression(terms, depth + 1);
+                self.out.push(')');
+            }
+            3 => {
+                let operator = *self.rng.pick(&self.grammar.unary_operators);
+                write!(self.out, "{operator}(").unwrap();
+                self.expression(terms, depth + 1);
+                self.out.push(')');
+            }
+            _ => {
+                self.out.push('(');
+                self.expression(terms, depth + 1);
+                self.out.push(')');
+            }
+        }
+    }
+
+    fn primary(&mut self) {
+        match self.rng.below(8) {
+            0 => write!(self.out, "{}", self.rng.below(1000)).unwrap(),
+            1 => write!(self.out, "0x{:x}u", self.rng.next() as u32).unwrap(),
+            2 => write!(self.out, "{}.{}f", self.rng.below(100), self.rng.below(100)).unwrap(),
+            3 => write!(self.out, "'{}'", (b'a' + self.rng.below(26) as u8) as char).unwrap(),
+            4 => {
+                self.out.push_str("sizeof(");
+                self.type_name();
+                self.out.push(')');
+            }
+            _ if self.variables.is_empty() => self.out.push('0'),
+            5 => {
+                let variable = self.rng.pick(&self.variables).clone();
+                write!(self.out, "{variable}[{}]", self.rng.below(16)).unwrap();
+            }
+            _ => {
+                let variable = self.rng.pick(&self.variables).clone();
+                self.out.push_str(&variable);
+            }
+        }
+    }
+
+    /// Specifiers, and maybe a pointer.
+    fn type_name(&mut self) {
+        self.declaration_specifiers();
+        if self.rng.chance(0.3) {
+            self.out.push_str(" *");
+        }
+    }
+}
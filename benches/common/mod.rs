@@ -0,0 +1,229 @@
+//! Shared inputs for the benchmark suite.
+#![allow(dead_code)]
+
+pub mod alloc;
+pub mod generate;
+
+use std::{
+    fmt::Write as _,
+    io::Write as _,
+    path::{Path, PathBuf},
+    process::{Command, Stdio},
+};
+
+use cgrammar::*;
+
+/// A named benchmark input, made of one or more translation units.
+pub struct Input {
+    /// The name used in benchmark IDs.
+    pub name: String,
+    /// The preprocessed sources of each translation unit.
+    pub sources: Vec<String>,
+}
+
+impl Input {
+    /// Total size of all sources in bytes.
+    pub fn bytes(&self) -> u64 {
+        self.sources.iter().map(|s| s.len() as u64).sum()
+    }
+}
+
+/// Preprocess a C source with the same flags as the parse tests.
+///
+/// Returns `None` if no C compiler is available or preprocessing fails.
+pub fn preprocess(source: &str) -> Option<String> {
+    let mut preprocessor = Command::new("cc")
+        .args([
+            "-E",
+            "-C",
+            "-x",
+            "c",
+            "--std=c2x",
+            "-D__extension__=",
+            "-U__GNUC__",
+            "-",
+        ])
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .stderr(Stdio::null())
+        .spawn()
+        .ok()?;
+    preprocessor.stdin.take()?.write_all(source.as_bytes()).ok()?;
+    let output = preprocessor.wait_with_output().ok()?;
+    if !output.status.success() {
+        return None;
+    }
+    String::from_utf8(output.stdout).ok()
+}
+
+fn collect_c_files(dir: &Path, files: &mut Vec<PathBuf>) {
+    let Ok(entries) = std::fs::read_dir(dir) else {
+        return;
+    };
+    for entry in entries.flatten() {
+        let path = entry.path();
+        if path.is_dir() {
+            collect_c_files(&path, files);
+        } else if path.extension().is_some_and(|ext| ext == "c") {
+            files.push(path);
+        }
+    }
+}
+
+/// The preprocessed `tests/test-cases/**` corpus.
+///
+/// Test cases listed in `tests/failed-tests.txt` and test cases which do not
+/// parse cleanly are skipped, so that the benchmarks only measure the success
+/// path. The corpus is empty if no C compiler is available.
+pub fn corpus() -> Input {
+    let root = Path::new(env!("CARGO_MANIFEST_DIR"));
+    let failed = std::fs::read_to_string(root.join("tests/failed-tests.txt")).unwrap_or_default();
+
+    let mut files = Vec::new();
+    collect_c_files(&root.join("tests/test-cases"), &mut files);
+    files.sort();
+
+    let parser = translation_unit();
+    let sources = files
+        .iter()
+        .filter(|path| {
+            let relative = path.strip_prefix(root).unwrap_or(path);
+            !failed.contains(relative.to_string_lossy().as_ref())
+        })
+        .filter_map(|path| std::fs::read_to_string(path).ok())
+        .filter_map(|source| preprocess(&source))
+        .filter(|source| {
+            let (tokens, _) = lex(source, None);
+            !parser.parse(tokens.as_input()).has_errors()
+        })
+        .collect();
+
+    Input { name: "corpus".to_string(), sources }
+}
+
+/// A synthetic translation unit of roughly `target_bytes` bytes.
+///
+/// The unit is made of repeated typedefs, enums and function definitions with
+/// distinct names, mixing declarations, statements and expressions in roughly
+/// the proportions found in real preprocessed code.
+pub fn synthetic(name: &str, target_bytes: usize) -> Input {
+    let mut source = String::with_capacity(target_bytes + 1024);
+    let mut i = 0;
+    while source.len() < target_bytes {
+        write!(
+            source,
+            r#"
+typedef struct node_{i} {{
+    int key;
+    struct node_{i} *next;
+    unsigned long flags[4];
+}} node_{i}_t;
+
+enum color_{i} {{ RED_{i}, GREEN_{i} = 2, BLUE_{i} = GREEN_{i} << 1 }};
+
+/* Look up a key in the list, skipping nodes without the first flag set. */
+static int lookup_{i}(node_{i}_t *head, int key) {{
+    for (node_{i}_t *n = head; n != 0; n = n->next) {{
+        if (n->key == key && (n->flags[0] & 0x1u) != 0)
+            return n->key * 3 + BLUE_{i};
+    }}
+    switch (key) {{
+    case RED_{i}:
+        return -1;
+    default:
+        break;
+    }}
+    return (int)(sizeof(node_{i}_t) / sizeof(int));
+}}
+"#
+        )
+        .unwrap();
+        i += 1;
+    }
+    Input {
+        name: name.to_string(),
+        sources: vec![source],
+    }
+}
+
+/// A synthetic translation unit of roughly `target_bytes` bytes made of long
+/// chains of binary operators, like the arithmetic left by macro expansion in
+/// generated code.
+pub fn expressions(name: &str, target_bytes: usize) -> Input {
+    const OPERATORS: &[&str] = &["+", "*", "-", "<<", "&", "|", "/", "^", "%", ">>"];
+    let mut source = String::with_capacity(target_bytes + 1024);
+    let mut i = 0;
+    while source.len() < target_bytes {
+        write!(source, "unsigned long expr_{i}(unsigned long x) {{\n    return x").unwrap();
+        for term in 0..256 {
+            let operator = OPERATORS[(i + term) % OPERATORS.len()];
+            write!(source, " {operator} (x {} {term}u)", OPERATORS[term % 3]).unwrap();
+        }
+        source.push_str(" && x || !x;\n}\n");
+        i += 1;
+    }
+    Input {
+        name: name.to_string(),
+        sources: vec![source],
+    }
+}
+
+/// A random translation unit of the shape of `config`.
+pub fn generated(name: &str, config: generate::Config) -> Input {
+    Input {
+        name: name.to_string(),
+        sources: vec![generate::generate(&config)],
+    }
+}
+
+/// The standard set of inputs: the test corpus plus synthetic units of
+/// increasing size, the largest being about the size of a preprocessed
+/// `sqlite3.c`, a unit of long expressions, and random units of about 1 MiB,
+/// of mixed code, of expressions of up to 10000 terms and of declarators up
+/// to 500 deep.
+pub fn inputs() -> Vec<Input> {
+    let mut inputs = vec![corpus()];
+    inputs.retain(|input| !input.sources.is_empty());
+    inputs.push(synthetic("synthetic-64k", 64 << 10));
+    inputs.push(synthetic("synthetic-1m", 1 << 20));
+    inputs.push(synthetic("synthetic-8m", 8 << 20));
+    inputs.push(expressions("expressions-1m", 1 << 20));
+    let config = generate::Config {
+        seed: 1,
+        declarations: 2000,
+        ..Default::default()
+    };
+    inputs.push(generated("generated-1m", config));
+    let config = generate::Config {
+        seed: 2,
+        declarations: 24,
+        statements: 4,
+        expression_terms: 10_000,
+        ..Default::default()
+    };
+    inputs.push(generated("generated-expressions", config));
+    let config = generate::Config {
+        seed: 3,
+        declarations: 400,
+        statements: 4,
+        declarator_depth: 500,
+        ..Default::default()
+    };
+    inputs.push(generated("generated-declarators", config));
+    inputs
+}
+
+/// Count the tokens of a balanced token sequence, including the tokens of
+/// nested groups. Each group counts as one token for its delimiters.
+pub fn count_tokens(tokens: &BalancedTokenSequence) -> u64 {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| match &token.value {
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                1 + count_tokens(inner)
+            }
+            _ => 1,
+        })
+        .sum()
+}
@@ -0,0 +1,106 @@
+//! Benchmarks of interning identifiers from many threads at once.
+//!
+//! Each thread interns the same number of names: nine in ten are names of the
+//! corpus, most of them common header identifiers that every thread interns,
+//! and the rest are new names, as the local names of each translation unit
+//! are. The benchmarks run from 1 to 64 threads with the total number of
+//! names as throughput, so that criterion reports how the rate scales with
+//! the threads.
+//!
+//! Usage: `cargo bench --bench interner`
+
+mod common;
+
+use std::{
+    hint::black_box,
+    sync::atomic::{AtomicU64, Ordering},
+    thread,
+    time::{Duration, Instant},
+};
+
+use cgrammar::{symbol::Symbol, *};
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+
+/// Number of names interned by each thread in an iteration.
+const NAMES_PER_THREAD: usize = 100_000;
+
+/// Thread counts benchmarked.
+const THREADS: [usize; 7] = [1, 2, 4, 8, 16, 32, 64];
+
+fn collect_identifiers(tokens: &BalancedTokenSequence, names: &mut Vec<String>) {
+    for token in &tokens.tokens {
+        match &token.value {
+            BalancedToken::Identifier(identifier) => names.push(identifier.0.to_string()),
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                collect_identifiers(inner, names)
+            }
+            _ => {}
+        }
+    }
+}
+
+/// The identifiers of the corpus, in order and with repeats, or of a
+/// synthetic unit if the corpus is empty.
+fn corpus_names() -> Vec<String> {
+    let mut input = common::corpus();
+    if input.sources.is_empty() {
+        input = common::synthetic("synthetic", 1 << 20);
+    }
+    let mut names = Vec::new();
+    for source in &input.sources {
+        let (tokens, _) = lex(source, None);
+        collect_identifiers(&tokens, &mut names);
+    }
+    names
+}
+
+/// The names one thread interns: every tenth is new to the process.
+fn workload(names: &[String], thread: usize) -> Vec<String> {
+    static FRESH: AtomicU64 = AtomicU64::new(0);
+    (0..NAMES_PER_THREAD)
+        .map(|i| {
+            if i % 10 == 9 {
+                format!("fresh_{}", FRESH.fetch_add(1, Ordering::Relaxed))
+            } else {
+                names[(i * 7 + thread * 1009) % names.len()].clone()
+            }
+        })
+        .collect()
+}
+
+/// Time to intern the workloads, one per thread, started together.
+fn intern_on_threads(workloads: &[Vec<String>]) -> Duration {
+    let start = Instant::now();
+    thread::scope(|scope| {
+        for workload in workloads {
+            scope.spawn(|| {
+                for name in workload {
+                    black_box(Symbol::intern(name));
+                }
+            });
+        }
+    });
+    start.elapsed()
+}
+
+fn bench_interner(c: &mut Criterion) {
+    let names = corpus_names();
+    let mut group = c.benchmark_group("interner");
+    for threads in THREADS {
+        group.throughput(Throughput::Elements((threads * NAMES_PER_THREAD) as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(threads), &threads, |b, &threads| {
+            b.iter_custom(|iters| {
+                (0..iters)
+                    .map(|_| {
+                        let workloads: Vec<_> = (0..threads).map(|thread| workload(&names, thread)).collect();
+                        intern_on_threads(&workloads)
+                    })
+                    .sum()
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_interner);
+criterion_main!(benches);
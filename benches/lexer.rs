@@ -0,0 +1,91 @@
+//! Micro-benchmarks of the sub-scanners of the lexer.
+//!
+//! Each input is about 1 MiB of one token class, separated by single spaces
+//! and newlines, so that lexing it is dominated by the sub-scanner of that
+//! class: `identifier`, `integer_constant`, `floating_constant`,
+//! `string_literal`, `character_constant`, `punctuator`,
+//! `skip_block_comment` and `skip_line_directive`. The `whitespace` input
+//! holds the separators alone, for the cost they add to the others.
+//!
+//! Usage: `cargo bench --bench lexer`
+
+use std::hint::black_box;
+
+use cgrammar::*;
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+
+/// Size of each input.
+const TARGET_BYTES: usize = 1 << 20;
+
+/// Repeat the line made by `line` from its index until the input is large enough.
+fn generate(line: impl Fn(usize) -> String) -> String {
+    let mut source = String::with_capacity(TARGET_BYTES + 256);
+    let mut i = 0;
+    while source.len() < TARGET_BYTES {
+        source.push_str(&line(i));
+        source.push('\n');
+        i += 1;
+    }
+    source
+}
+
+/// The inputs, named by the sub-scanner they exercise.
+fn inputs() -> Vec<(&'static str, String)> {
+    vec![
+        ("whitespace", generate(|_| " ".repeat(63))),
+        (
+            "identifier",
+            generate(|i| format!("name_{i} _x{i}y counter value_t end_{i:x}")),
+        ),
+        (
+            "identifier_unicode",
+            generate(|i| format!("café_{i} größe ναι_{i} 変数{i}")),
+        ),
+        (
+            "integer_constant",
+            generate(|i| format!("{i} 0x{i:x}u 0{i:o} 0b{i:b}ull {i}L 0X{i:X}lu")),
+        ),
+        (
+            "floating_constant",
+            generate(|i| format!("{i}.5 .{i}e-3 {i}e+10f 0x{i:x}.8p-2 {i}.25L 1.{i}")),
+        ),
+        (
+            "string_literal",
+            generate(|i| format!(r#""plain text {i}" u8"esc\n\t\x41 {i}" L"wide {i}" "\"quoted\"""#)),
+        ),
+        (
+            "character_constant",
+            generate(|i| format!(r"'a' '\n' L'\x{:x}' u'é' '\'' '{}'", i % 128, i % 10)),
+        ),
+        // No brackets, which are lexed as groups, and no `#` at the start of a line
+        (
+            "punctuator",
+            generate(|_| "x -> ++ -- <<= >>= ... && || != == ## += . ; , ? : * & ~ ! % ^ |= <: %>".to_string()),
+        ),
+        (
+            "skip_block_comment",
+            generate(|i| format!("/* comment {i}, with * stars ** and / slashes */ /**/")),
+        ),
+        (
+            "skip_line_directive",
+            generate(|i| match i % 2 {
+                0 => format!("# {i} \"include/dir/file_{}.h\" 1 3 4", i % 64),
+                _ => "#pragma GCC diagnostic push".to_string(),
+            }),
+        ),
+    ]
+}
+
+fn benchmarks(c: &mut Criterion) {
+    let mut group = c.benchmark_group("lexer");
+    for (name, source) in inputs() {
+        group.throughput(Throughput::Bytes(source.len() as u64));
+        group.bench_function(BenchmarkId::new("lex", name), |b| {
+            b.iter(|| black_box(lex(black_box(&source), None)))
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, benchmarks);
+criterion_main!(benches);
@@ -0,0 +1,151 @@
+//! Micro-benchmarks of single rules of the parser.
+//!
+//! Each rule is parsed on its own, on synthetic inputs that stress one part
+//! of its grammar: long chains for the binary operators, casts and `sizeof`
+//! that need backtracking to tell a type name from an expression, and deeply
+//! nested declarators, whose parentheses may start a parameter list or a
+//! nested declarator. `T` is a typedef name in all inputs.
+//!
+//! Usage: `cargo bench --bench rules`
+
+mod common;
+
+use std::hint::black_box;
+
+use cgrammar::{parser_utils::Extra, span::Tokens, *};
+use common::count_tokens;
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+
+/// Approximate size of the inputs made of repeated pieces.
+const TARGET_BYTES: usize = 64 << 10;
+
+/// Depth of the nested declarators.
+const DEPTH: usize = 48;
+
+/// `first`, followed by the pieces made by `piece` from their index, until
+/// the input is large enough.
+fn repeat(first: &str, piece: impl Fn(usize) -> String) -> String {
+    let mut source = first.to_string();
+    let mut i = 0;
+    while source.len() < TARGET_BYTES {
+        source.push_str(&piece(i));
+        i += 1;
+    }
+    source
+}
+
+/// An abstract declarator of `depth` pointers to functions, each nested in
+/// the parentheses of the previous one: `*(*(...)(int))(int)`.
+fn nested_declarator(depth: usize, name: &str) -> String {
+    (0..depth).fold(format!("*{name}"), |inner, _| format!("*({inner})(int)"))
+}
+
+/// A prepared benchmark case.
+struct Case {
+    name: &'static str,
+    bytes: u64,
+    tokens: BalancedTokenSequence,
+}
+
+impl Case {
+    fn new(name: &'static str, source: String) -> Self {
+        let (tokens, _) = lex(&source, None);
+        Self { name, bytes: source.len() as u64, tokens }
+    }
+}
+
+fn bench_rule<'a, O>(
+    c: &mut Criterion,
+    rule: &str,
+    parser: impl Parser<'a, Tokens<'a>, O, Extra<'a>>,
+    cases: &'a [Case],
+) {
+    let mut state = State::new();
+    state.ctx_mut().add_typedef_names([Identifier::from("T")]);
+
+    let mut group = c.benchmark_group(rule);
+    group.sample_size(20);
+    for case in cases {
+        let result = parser.parse_with_state(case.tokens.as_input(), &mut state.clone());
+        assert!(!result.has_errors(), "{rule}/{} does not parse", case.name);
+
+        group.throughput(Throughput::Bytes(case.bytes));
+        group.bench_function(BenchmarkId::new("bytes", case.name), |b| {
+            b.iter(|| black_box(parser.parse_with_state(case.tokens.as_input(), &mut state.clone())))
+        });
+        group.throughput(Throughput::Elements(count_tokens(&case.tokens)));
+        group.bench_function(BenchmarkId::new("tokens", case.name), |b| {
+            b.iter(|| black_box(parser.parse_with_state(case.tokens.as_input(), &mut state.clone())))
+        });
+    }
+    group.finish();
+}
+
+fn benchmarks(c: &mut Criterion) {
+    const OPERATORS: &[&str] = &[
+        "+", "*", "-", "<<", "&", "|", "/", "^", "%", ">>", "<", "==", "&&", "||",
+    ];
+    let expressions = [
+        Case::new(
+            "binary_chain",
+            repeat("x", |i| format!(" {} a{i}", OPERATORS[i % OPERATORS.len()])),
+        ),
+        Case::new(
+            "casts",
+            repeat("(T)x", |i| format!(" + (T)a{i} * (a{i}) - (T)(a{i}) + (a{i})(x)")),
+        ),
+        Case::new(
+            "sizeof",
+            repeat("sizeof x", |i| {
+                format!(" + sizeof(T) * sizeof (a{i}) - sizeof a{i} + sizeof(T[{i}]) + sizeof(struct s{i} *)")
+            }),
+        ),
+        Case::new(
+            "nested_parentheses",
+            format!("{}x{}", "(".repeat(DEPTH), " + 1)".repeat(DEPTH)),
+        ),
+    ];
+    bench_rule(c, "expression", expression(), &expressions);
+
+    let type_names = [
+        Case::new("nested_abstract", format!("int {}", nested_declarator(DEPTH, ""))),
+        Case::new(
+            "nested_parentheses",
+            format!("int {}*{}", "(".repeat(DEPTH), ")[1]".repeat(DEPTH)),
+        ),
+    ];
+    bench_rule(c, "type_name", type_name(), &type_names);
+
+    let declarators = [Case::new("nested", nested_declarator(DEPTH, "f"))];
+    bench_rule(c, "declarator", declarator(), &declarators);
+
+    let declarations = [
+        Case::new(
+            "declarators",
+            repeat("int x", |i| {
+                format!(", *a{i}[{i}] = {{ {i} }}, (*f{i})(T, int), b{i} = (T)a{i}")
+            }) + ";",
+        ),
+        Case::new(
+            "nested",
+            format!(
+                "T {}, {};",
+                nested_declarator(DEPTH, "f"),
+                nested_declarator(DEPTH, "g")
+            ),
+        ),
+    ];
+    bench_rule(c, "declaration", declaration(), &declarations);
+
+    // Each statement can start like a declaration or an expression
+    let statements = [Case::new(
+        "ambiguous",
+        repeat("{", |i| {
+            format!(" T *p{i} = 0; a * b{i}; (T)x; (a)(b{i}); sizeof(T) + sizeof(a); T (f{i}); l{i}: x = (T){{ {i} }};")
+        }) + " }",
+    )];
+    bench_rule(c, "statement", statement(), &statements);
+}
+
+criterion_group!(benches, benchmarks);
+criterion_main!(benches);
@@ -0,0 +1,203 @@
+//! Benchmarks that check that parse time grows linearly with the input size.
+//!
+//! Each family of synthetic translation units is parsed at sizes doubling
+//! from `N` to `8N`, and benchmarked with the size as throughput, so that
+//! criterion reports the time per unit of size. Before a family is
+//! benchmarked, its time per unit at the largest size is checked to be at
+//! most [`MAX_SLOWDOWN`] times that at the smallest size: quadratic behaviour
+//! in the parsing state or the combinators fails the run instead of only
+//! showing up as a slower benchmark. The allocations per unit are checked in
+//! the same way.
+//!
+//! Usage: `cargo bench --bench scaling`, or `cargo bench --bench scaling --
+//! --test` to only run the checks.
+
+mod common;
+
+use std::{fmt::Write, hint::black_box, time::Instant};
+
+use cgrammar::*;
+use common::{
+    alloc::{CountingAllocator, count_allocations},
+    generate::{self, Config},
+};
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+/// Sizes of each family, as multiples of its base size.
+const SCALES: [usize; 4] = [1, 2, 4, 8];
+
+/// Largest allowed ratio of the time or allocations per unit at the largest
+/// size to those at the smallest size. Linear growth gives about 1, quadratic
+/// growth 8.
+const MAX_SLOWDOWN: f64 = 2.5;
+
+/// Number of timed parses of each size in the check, keeping the fastest.
+const CHECK_RUNS: usize = 5;
+
+/// A family of translation units, generated from their size.
+struct Family {
+    name: &'static str,
+    base: usize,
+    generate: fn(usize) -> String,
+}
+
+/// `n` typedefs, each used by the next declaration.
+fn typedefs(n: usize) -> String {
+    let mut source = String::from("typedef int type_0;\n");
+    for i in 1..=n {
+        writeln!(source, "typedef type_{} type_{i}; type_{i} value_{i};", i - 1).unwrap();
+    }
+    source
+}
+
+/// `n` function definitions, each calling the previous one.
+fn functions(n: usize) -> String {
+    let mut source = String::from("int function_0(int x) { return x; }\n");
+    for i in 1..=n {
+        writeln!(
+            source,
+            "static int function_{i}(int x) {{ int y = x * {i}; if (y > 0) return function_{}(y - 1); return y; }}",
+            i - 1
+        )
+        .unwrap();
+    }
+    source
+}
+
+/// A function with `n` nested parentheses and `n` nested blocks.
+fn nesting(n: usize) -> String {
+    format!(
+        "int f(int x) {{ {}return {}x{}; {} }}",
+        "{ ".repeat(n),
+        "(".repeat(n),
+        ")".repeat(n),
+        "} ".repeat(n)
+    )
+}
+
+/// A function returning an expression of `n` binary operators.
+fn expression(n: usize) -> String {
+    const OPERATORS: &[&str] = &["+", "*", "-", "<<", "&", "|", "/", "^", "%", ">>"];
+    let mut source = String::from("unsigned long f(unsigned long x) { return x");
+    for i in 0..n {
+        write!(source, " {} x", OPERATORS[i % OPERATORS.len()]).unwrap();
+    }
+    source.push_str("; }\n");
+    source
+}
+
+/// A random program of `n` external declarations. Programs of the same seed
+/// share their first declarations, so each size extends the smaller ones.
+fn generated(n: usize) -> String {
+    generate::generate(&Config {
+        seed: 0,
+        declarations: n,
+        ..Default::default()
+    })
+}
+
+const FAMILIES: &[Family] = &[
+    Family {
+        name: "typedefs",
+        base: 2000,
+        generate: typedefs,
+    },
+    Family {
+        name: "functions",
+        base: 1000,
+        generate: functions,
+    },
+    Family {
+        name: "nesting",
+        base: 64,
+        generate: nesting,
+    },
+    Family {
+        name: "expression",
+        base: 4000,
+        generate: expression,
+    },
+    Family {
+        name: "generated",
+        base: 250,
+        generate: generated,
+    },
+];
+
+fn parse(tokens: &BalancedTokenSequence) {
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut State::new());
+    assert!(!result.has_errors(), "Synthetic input has parse errors");
+    black_box(result.into_output());
+}
+
+/// Fastest parse time of `tokens`, in nanoseconds.
+fn parse_time(tokens: &BalancedTokenSequence) -> f64 {
+    (0..CHECK_RUNS)
+        .map(|_| {
+            let start = Instant::now();
+            parse(tokens);
+            start.elapsed().as_nanos()
+        })
+        .min()
+        .unwrap() as f64
+}
+
+/// Allocations of a parse of `tokens`.
+fn parse_allocations(tokens: &BalancedTokenSequence) -> f64 {
+    count_allocations(|| parse(tokens)).1.count as f64
+}
+
+fn check_linear(
+    family: &Family,
+    cases: &[(usize, BalancedTokenSequence)],
+    what: &str,
+    measure: fn(&BalancedTokenSequence) -> f64,
+) {
+    let per_unit: Vec<f64> = cases.iter().map(|(n, tokens)| measure(tokens) / *n as f64).collect();
+    let slowdown = per_unit.last().unwrap() / per_unit.first().unwrap();
+    eprintln!(
+        "{}: {what} per unit {}, slowdown {slowdown:.2}",
+        family.name,
+        per_unit
+            .iter()
+            .zip(cases)
+            .map(|(value, (n, _))| format!("{value:.1} at {n}"))
+            .collect::<Vec<_>>()
+            .join(", ")
+    );
+    assert!(
+        slowdown <= MAX_SLOWDOWN,
+        "{what} of {} grow faster than linearly: {slowdown:.2} times more per unit at {} than at {}",
+        family.name,
+        cases.last().unwrap().0,
+        cases[0].0,
+    );
+}
+
+fn benchmarks(c: &mut Criterion) {
+    for family in FAMILIES {
+        let cases: Vec<_> = SCALES
+            .iter()
+            .map(|scale| {
+                let n = family.base * scale;
+                (n, lex(&(family.generate)(n), None).0)
+            })
+            .collect();
+        check_linear(family, &cases, "nanoseconds", parse_time);
+        check_linear(family, &cases, "allocations", parse_allocations);
+
+        let mut group = c.benchmark_group(format!("scaling/{}", family.name));
+        group.sample_size(10);
+        for (n, tokens) in &cases {
+            group.throughput(Throughput::Elements(*n as u64));
+            group.bench_function(BenchmarkId::from_parameter(n), |b| b.iter(|| parse(tokens)));
+        }
+        group.finish();
+    }
+}
+
+criterion_group!(benches, benchmarks);
+criterion_main!(benches);
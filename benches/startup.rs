@@ -0,0 +1,63 @@
+//! Benchmarks of the time to the first parse on a thread.
+//!
+//! The recursive rules of the parser are built on first use on each thread,
+//! so the first parse on a new thread also pays for building them. Each
+//! iteration runs on a new thread, and only the work on that thread is
+//! timed. The patterns of the lexer are compiled once per process, and the
+//! time of that first compilation is printed before the benchmarks.
+//!
+//! Usage: `cargo bench --bench startup`
+
+use std::{
+    hint::black_box,
+    thread,
+    time::{Duration, Instant},
+};
+
+use cgrammar::*;
+use criterion::{Criterion, criterion_group, criterion_main};
+
+/// A small request, as parsed by a short-lived worker.
+const SOURCE: &str = "int add(int a, int b) { return a + b; }";
+
+/// Total time of `f` over `iters` new threads.
+fn on_new_threads(iters: u64, f: fn() -> Duration) -> Duration {
+    (0..iters).map(|_| thread::spawn(f).join().unwrap()).sum()
+}
+
+fn parse() {
+    let (tokens, _) = lex(SOURCE, None);
+    black_box(translation_unit().parse(tokens.as_input()));
+}
+
+fn timed(f: impl FnOnce()) -> Duration {
+    let start = Instant::now();
+    f();
+    start.elapsed()
+}
+
+fn bench_startup(c: &mut Criterion) {
+    let first = thread::spawn(|| timed(warm_up)).join().unwrap();
+    println!("First warm-up in the process, compiling the lexer patterns: {first:.3?}");
+
+    let mut group = c.benchmark_group("startup");
+    group.bench_function("warm_up", |b| {
+        b.iter_custom(|iters| on_new_threads(iters, || timed(warm_up)))
+    });
+    group.bench_function("cold_parse", |b| {
+        b.iter_custom(|iters| on_new_threads(iters, || timed(parse)))
+    });
+    group.bench_function("parse_after_warm_up", |b| {
+        b.iter_custom(|iters| {
+            on_new_threads(iters, || {
+                warm_up();
+                timed(parse)
+            })
+        })
+    });
+    group.bench_function("warm_parse", |b| b.iter(parse));
+    group.finish();
+}
+
+criterion_group!(benches, bench_startup);
+criterion_main!(benches);
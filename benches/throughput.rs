@@ -0,0 +1,194 @@
+//! Throughput benchmarks for lexing, parsing, visiting and printing.
+//!
+//! Every phase is measured twice per input, once reporting bytes per second
+//! and once reporting tokens per second.
+//!
+//! Usage: `cargo bench --all-features --bench throughput`
+
+mod common;
+
+use std::hint::black_box;
+
+use cgrammar::*;
+use common::{Input, count_tokens, inputs};
+use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+
+/// A prepared benchmark case.
+struct Case<T> {
+    name: String,
+    bytes: u64,
+    tokens: u64,
+    data: T,
+}
+
+/// A visitor that only walks the tree.
+struct NoopVisitor;
+
+impl<'a> Visitor<'a> for NoopVisitor {
+    type Result = ();
+}
+
+/// A visitor that counts variable names, walking every subtree.
+struct VariableCounter(usize);
+
+impl<'a> Visitor<'a> for VariableCounter {
+    type Result = ();
+
+    fn visit_variable_name(&mut self, _: &'a Identifier) {
+        self.0 += 1;
+    }
+}
+
+/// A visitor that counts variable names, walking only the subtrees that can
+/// hold expressions or declarators.
+struct PrunedVariableCounter(usize);
+
+impl<'a> Visitor<'a> for PrunedVariableCounter {
+    type Result = ();
+
+    const INTERESTS: NodeKinds = NodeKinds::of(NodeKind::Expression).with(NodeKind::Declarator);
+
+    fn visit_variable_name(&mut self, _: &'a Identifier) {
+        self.0 += 1;
+    }
+}
+
+fn prepare(inputs: &[Input]) -> Vec<Case<(&Input, Vec<BalancedTokenSequence>)>> {
+    inputs
+        .iter()
+        .map(|input| {
+            let tokens: Vec<_> = input.sources.iter().map(|source| lex(source, None).0).collect();
+            Case {
+                name: input.name.clone(),
+                bytes: input.bytes(),
+                tokens: tokens.iter().map(count_tokens).sum(),
+                data: (input, tokens),
+            }
+        })
+        .collect()
+}
+
+fn with_data<'c, T, U>(cases: &'c [Case<T>], f: impl Fn(&'c T) -> U) -> Vec<Case<U>> {
+    cases
+        .iter()
+        .map(|case| Case {
+            name: case.name.clone(),
+            bytes: case.bytes,
+            tokens: case.tokens,
+            data: f(&case.data),
+        })
+        .collect()
+}
+
+fn bench_group<'c, T>(c: &mut Criterion, group: &str, cases: &'c [Case<T>], mut routine: impl FnMut(&'c T)) {
+    let mut group = c.benchmark_group(group);
+    group.sample_size(10);
+    for case in cases {
+        group.throughput(Throughput::Bytes(case.bytes));
+        group.bench_function(BenchmarkId::new("bytes", &case.name), |b| {
+            b.iter(|| routine(&case.data))
+        });
+        group.throughput(Throughput::Elements(case.tokens));
+        group.bench_function(BenchmarkId::new("tokens", &case.name), |b| {
+            b.iter(|| routine(&case.data))
+        });
+    }
+    group.finish();
+}
+
+fn benchmarks(c: &mut Criterion) {
+    let inputs = inputs();
+    let lexed = prepare(&inputs);
+
+    bench_group(c, "lex", &lexed, |(input, _)| {
+        for source in &input.sources {
+            black_box(lex(source, None));
+        }
+    });
+
+    bench_group(c, "lex_parallel", &lexed, |(input, _)| {
+        for source in &input.sources {
+            black_box(lex_parallel(source, None));
+        }
+    });
+
+    let parser = translation_unit();
+    bench_group(c, "parse", &lexed, |(_, tokens)| {
+        for tokens in tokens {
+            black_box(parser.parse(tokens.as_input()).into_output());
+        }
+    });
+
+    bench_group(c, "parse_unlabelled", &lexed, |(_, tokens)| {
+        let mut state = State::new();
+        state.set_rule_labels(false);
+        for tokens in tokens {
+            black_box(
+                parser
+                    .parse_with_state(tokens.as_input(), &mut state.clone())
+                    .into_output(),
+            );
+        }
+    });
+
+    bench_group(c, "validate", &lexed, |(_, tokens)| {
+        let mut state = State::new();
+        state.set_rule_labels(false);
+        for tokens in tokens {
+            let _ = black_box(validate(tokens, &mut state.clone()));
+        }
+    });
+
+    let parsed = with_data(&lexed, |(_, tokens)| {
+        tokens
+            .iter()
+            .map(|tokens| parser.parse(tokens.as_input()).into_output().unwrap_or_default())
+            .collect::<Vec<_>>()
+    });
+
+    bench_group(c, "visit", &parsed, |units| {
+        for unit in units {
+            NoopVisitor.visit_translation_unit(black_box(unit));
+        }
+    });
+
+    // The pruned walk must find every name the full walk finds
+    for case in &parsed {
+        let mut full = VariableCounter(0);
+        let mut pruned = PrunedVariableCounter(0);
+        for unit in &case.data {
+            full.visit_translation_unit(unit);
+            pruned.visit_translation_unit(unit);
+        }
+        assert_eq!(pruned.0, full.0, "Pruned walk missed variable names in {}", case.name);
+    }
+
+    bench_group(c, "visit_variables", &parsed, |units| {
+        let mut counter = VariableCounter(0);
+        for unit in units {
+            counter.visit_translation_unit(black_box(unit));
+        }
+        black_box(counter.0);
+    });
+
+    bench_group(c, "visit_variables_pruned", &parsed, |units| {
+        let mut counter = PrunedVariableCounter(0);
+        for unit in units {
+            counter.visit_translation_unit(black_box(unit));
+        }
+        black_box(counter.0);
+    });
+
+    #[cfg(feature = "printer")]
+    bench_group(c, "print", &parsed, |units| {
+        use cgrammar::printer::{Context, Printer};
+        for unit in units {
+            let mut printer = Printer::new_extra(String::new(), 80, Context::default());
+            printer.visit_translation_unit(unit).unwrap();
+            black_box(printer.finish().unwrap());
+        }
+    });
+}
+
+criterion_group!(benches, benchmarks);
+criterion_main!(benches);
@@ -0,0 +1,130 @@
+//! Compiles the regexes of the lexer to sparse DFAs, so that the lexer loads
+//! them from static data instead of compiling them on first use, and derives
+//! the operator precedence table of the expression parser from the grammar.
+
+use std::{env, fmt::Write, fs, path::Path};
+
+use regex_automata::dfa::{StartKind, dense};
+
+macro_rules! patterns {
+    ($( $( #[$attrs:meta] )* $name:ident = $pattern:literal; )*) => {
+        const PATTERNS: &[(&str, &str)] = &[$( (stringify!($name), $pattern) ),*];
+    };
+}
+
+include!("src/lexer_patterns.rs");
+
+fn main() {
+    println!("cargo::rerun-if-changed=build.rs");
+    println!("cargo::rerun-if-changed=src/lexer_patterns.rs");
+    println!("cargo::rerun-if-changed=src/grammar.txt");
+    println!("cargo::rerun-if-changed=src/ast.rs");
+
+    let out_dir = env::var_os("OUT_DIR").expect("OUT_DIR is set by cargo");
+    // The DFAs are read in place, in the byte order of the target
+    let big_endian = env::var("CARGO_CFG_TARGET_ENDIAN").is_ok_and(|endian| endian == "big");
+    for (name, pattern) in PATTERNS {
+        // The lexer only matches at the cursor
+        let dfa = dense::Builder::new()
+            .configure(dense::Config::new().start_kind(StartKind::Anchored))
+            .build(pattern)
+            .unwrap_or_else(|error| panic!("Invalid pattern {name}: {error}"));
+        let dfa = dfa.to_sparse().expect("Sparse DFA");
+        let bytes = match big_endian {
+            true => dfa.to_bytes_big_endian(),
+            false => dfa.to_bytes_little_endian(),
+        };
+        fs::write(Path::new(&out_dir).join(format!("{name}.dfa")), bytes).expect("Write DFA");
+    }
+
+    let grammar = fs::read_to_string("src/grammar.txt").expect("Read grammar");
+    let ast = fs::read_to_string("src/ast.rs").expect("Read syntax tree");
+    let table = precedence_table(&productions(&grammar), &punctuators(&ast));
+    fs::write(Path::new(&out_dir).join("precedence.rs"), table).expect("Write precedence table");
+}
+
+/// The productions of the grammar, each a name and its alternatives, which
+/// are lists of symbols.
+///
+/// A production is a header line `(6.5.5) name:`, optionally followed by `one
+/// of`, then an alternative per line, up to the next empty line.
+fn productions(grammar: &str) -> Vec<(&str, Vec<Vec<&str>>)> {
+    let mut productions = Vec::new();
+    let mut lines = grammar.lines();
+    while let Some(line) = lines.next() {
+        let Some((_, header)) = line.strip_prefix('(').and_then(|line| line.split_once(") ")) else {
+            continue;
+        };
+        let Some(name) = header.strip_suffix(':').or_else(|| header.strip_suffix(": one of")) else {
+            continue;
+        };
+        let alternatives = lines
+            .by_ref()
+            .take_while(|line| !line.trim().is_empty())
+            .map(|line| line.split_whitespace().collect())
+            .collect();
+        productions.push((name, alternatives));
+    }
+    productions
+}
+
+/// The spelling and the name of each `Punctuator`, from the arms
+/// `Punctuator::Name => "spelling",` of `Punctuator::as_str`.
+fn punctuators(ast: &str) -> Vec<(&str, &str)> {
+    let punctuators: Vec<_> = ast
+        .lines()
+        .filter_map(|line| {
+            let (name, spelling) = line.trim().strip_prefix("Punctuator::")?.split_once(" => \"")?;
+            Some((spelling.strip_suffix("\",")?, name))
+        })
+        .collect();
+    assert!(!punctuators.is_empty(), "No punctuator spellings in the syntax tree");
+    punctuators
+}
+
+/// The binding power of each binary operator, as a Rust constant.
+///
+/// The binary operators are those of the chain of left-recursive productions
+/// from `cast-expression` up, each `name: operand | name operator operand`,
+/// whose operand is the production before it. Each binds tighter than the
+/// productions after it.
+fn precedence_table(productions: &[(&str, Vec<Vec<&str>>)], punctuators: &[(&str, &str)]) -> String {
+    let mut levels = Vec::new();
+    let mut operand = "cast-expression";
+    while let Some((name, alternatives)) = productions
+        .iter()
+        .find(|(_, alternatives)| alternatives.first().is_some_and(|first| first[..] == [operand]))
+    {
+        let operators: Vec<_> = alternatives[1..]
+            .iter()
+            .filter_map(|alternative| match alternative[..] {
+                [left, operator, right] if left == *name && right == operand => Some(operator),
+                _ => None,
+            })
+            .collect();
+        if operators.is_empty() || operators.len() != alternatives.len() - 1 {
+            break;
+        }
+        levels.push(operators);
+        operand = name;
+    }
+    assert!(!levels.is_empty(), "No binary operators in the grammar");
+
+    let mut table = String::from("// Generated by build.rs from src/grammar.txt and src/ast.rs\n\n");
+    table.push_str(
+        "/// Binding power of each binary operator punctuator; operators with a\n\
+         /// higher binding power bind tighter.\n\
+         const BINARY_OPERATOR_POWERS: &[(Punctuator, u8)] = &[\n",
+    );
+    for (level, operators) in levels.iter().enumerate() {
+        let power = levels.len() - level;
+        for operator in operators {
+            let (_, name) = (punctuators.iter())
+                .find(|(spelling, _)| spelling == operator)
+                .unwrap_or_else(|| panic!("`{operator}` is not a punctuator"));
+            writeln!(table, "    (Punctuator::{name}, {power}),").unwrap();
+        }
+    }
+    table.push_str("];\n");
+    table
+}
@@ -0,0 +1,649 @@
+//! Parse the translation units of a project from its `compile_commands.json`.
+//!
+//! Each command of the compilation database is preprocessed, by running its
+//! compiler with `-E` in its directory, or with the built-in [`Preprocessor`]
+//! and the `-I`, `-D` and `-U` flags of the command, then lexed and parsed on
+//! `--jobs` worker threads. What is written depends on `--emit`:
+//!
+//! - `errors`, the default: the syntax errors of each unit, as reports;
+//! - `symbols`: the names with external linkage of the project, with their
+//!   numbers of declarations and definitions, and whether they conflict;
+//! - `ast`: the syntax tree of each unit, as JSON in the `--out` directory.
+//!
+//! With `--cache <dir>`, the units that parse without errors are stored by the
+//! hash of their preprocessed text, and read back instead of being parsed on
+//! later runs, as long as the text is the same. A summary of the files and of
+//! the time spent in each phase, summed over the workers, ends the output on
+//! stderr.
+//!
+//! With `--workers <address>,...`, the units are lexed and parsed by workers,
+//! possibly on other machines, started with `cgrammar --serve <address>`:
+//! each job thread connects to one of the workers in turn, and sends it the
+//! units it takes, after preprocessing them and looking them up in the cache
+//! itself. See the [`remote`] module for the protocol.
+//!
+//! Usage:
+//!
+//! ```text
+//! cgrammar [--jobs N] [--preprocessor cc|builtin] [--emit errors|symbols|ast]
+//!          [--out <dir>] [--cache <dir>] [--workers <address>,...] <compile_commands.json>
+//! cgrammar --serve <address>
+//! ```
+
+use std::{
+    env, fs,
+    hash::{DefaultHasher, Hash, Hasher},
+    io::{self, BufWriter, Write},
+    path::{Path, PathBuf},
+    process::{Command, ExitCode, Stdio},
+    sync::{
+        Arc, Mutex,
+        atomic::{AtomicUsize, Ordering},
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+use cgrammar::{
+    BalancedTokenSequence, HeaderCache, Parser, Preprocessed, Preprocessor, State, SymbolDatabase, TranslationUnit,
+    UnitSymbols, lex, report_all,
+    serialize::{self, ExportOptions, FORMAT_VERSION},
+    span::ContextMapping,
+    translation_unit,
+};
+use serde_json::Value;
+
+use crate::remote::{Request, Worker};
+
+mod remote;
+
+const USAGE: &str = "Usage: cgrammar [--jobs N] [--preprocessor cc|builtin] [--emit errors|symbols|ast] \
+                     [--out <dir>] [--cache <dir>] [--workers <address>,...] <compile_commands.json>\n       \
+                     cgrammar --serve <address>";
+
+fn main() -> ExitCode {
+    let options = match Options::parse(env::args().skip(1)) {
+        Ok(options) => options,
+        Err(message) => {
+            eprintln!("{message}");
+            eprintln!("{USAGE}");
+            return ExitCode::FAILURE;
+        }
+    };
+    if let Some(address) = &options.serve {
+        return match remote::serve(address) {
+            Ok(_) => ExitCode::SUCCESS,
+            Err(error) => {
+                eprintln!("{address}: {error}");
+                ExitCode::FAILURE
+            }
+        };
+    }
+    match run(&options) {
+        Ok(true) => ExitCode::SUCCESS,
+        Ok(false) => ExitCode::FAILURE,
+        Err(error) => {
+            eprintln!("{}: {error}", options.database.display());
+            ExitCode::FAILURE
+        }
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+enum Preprocess {
+    /// The compiler of each command, with `-E`.
+    Cc,
+    /// The built-in [`Preprocessor`].
+    Builtin,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Emit {
+    Errors,
+    Symbols,
+    Ast,
+}
+
+struct Options {
+    jobs: usize,
+    preprocess: Preprocess,
+    emit: Emit,
+    out: Option<PathBuf>,
+    cache: Option<PathBuf>,
+    /// The addresses of the workers to parse on.
+    workers: Vec<String>,
+    /// The address to serve as a worker on.
+    serve: Option<String>,
+    database: PathBuf,
+}
+
+impl Options {
+    fn parse(mut args: impl Iterator<Item = String>) -> Result<Self, String> {
+        let mut jobs = thread::available_parallelism().map_or(1, usize::from);
+        let (mut preprocess, mut emit) = (Preprocess::Cc, Emit::Errors);
+        let (mut out, mut cache, mut database) = (None, None, None);
+        let (mut workers, mut serve) = (Vec::new(), None);
+        while let Some(arg) = args.next() {
+            let mut value = || args.next().ok_or_else(|| format!("{arg} expects a value"));
+            match arg.as_str() {
+                "--jobs" | "-j" => {
+                    jobs = (value()?.parse().ok().filter(|&jobs| jobs > 0)).ok_or("--jobs expects a positive number")?
+                }
+                "--preprocessor" => {
+                    preprocess = match value()?.as_str() {
+                        "cc" => Preprocess::Cc,
+                        "builtin" => Preprocess::Builtin,
+                        other => return Err(format!("unknown preprocessor {other}, expected cc or builtin")),
+                    }
+                }
+                "--emit" => {
+                    emit = match value()?.as_str() {
+                        "errors" => Emit::Errors,
+                        "symbols" => Emit::Symbols,
+                        "ast" => Emit::Ast,
+                        other => return Err(format!("unknown output {other}, expected errors, symbols or ast")),
+                    }
+                }
+                "--out" => out = Some(PathBuf::from(value()?)),
+                "--cache" => cache = Some(PathBuf::from(value()?)),
+                "--workers" => workers = value()?.split(',').map(String::from).collect(),
+                "--serve" => serve = Some(value()?),
+                _ if arg.starts_with('-') => return Err(format!("unknown option {arg}")),
+                _ if database.is_some() => return Err("more than one compilation database".to_string()),
+                _ => database = Some(PathBuf::from(&arg)),
+            }
+        }
+        if emit == Emit::Ast && out.is_none() {
+            return Err("--emit ast needs an --out directory".to_string());
+        }
+        // A worker is given its units by coordinators
+        let database = match serve {
+            Some(_) => database.unwrap_or_default(),
+            None => database.ok_or("no compilation database")?,
+        };
+        Ok(Self {
+            jobs,
+            preprocess,
+            emit,
+            out,
+            cache,
+            workers,
+            serve,
+            database,
+        })
+    }
+
+    /// The directory to write syntax trees to, if they are asked for.
+    fn ast_dir(&self) -> Option<&Path> {
+        self.out.as_deref().filter(|_| self.emit == Emit::Ast)
+    }
+}
+
+/// A command of the compilation database.
+struct Entry {
+    directory: PathBuf,
+    file: PathBuf,
+    /// The compiler and its arguments.
+    arguments: Vec<String>,
+}
+
+/// Read the commands of a `compile_commands.json`, with their arguments given
+/// as `arguments` or as a `command` line.
+fn read_database(path: &Path) -> io::Result<Vec<Entry>> {
+    let invalid = |message: &str| io::Error::new(io::ErrorKind::InvalidData, message.to_string());
+    let value: Value = serde_json::from_str(&fs::read_to_string(path)?).map_err(io::Error::other)?;
+    let entries = value
+        .as_array()
+        .ok_or_else(|| invalid("expected an array of commands"))?;
+    entries
+        .iter()
+        .map(|entry| {
+            let field = |name: &str| entry.get(name).and_then(Value::as_str);
+            let directory = PathBuf::from(field("directory").ok_or_else(|| invalid("command without a directory"))?);
+            // Joining keeps absolute paths as they are
+            let file = directory.join(field("file").ok_or_else(|| invalid("command without a file"))?);
+            let arguments = match (entry.get("arguments").and_then(Value::as_array), field("command")) {
+                (Some(arguments), _) => arguments.iter().filter_map(Value::as_str).map(String::from).collect(),
+                (None, Some(command)) => split_command(command),
+                (None, None) => return Err(invalid("command without arguments")),
+            };
+            Ok(Entry { directory, file, arguments })
+        })
+        .collect()
+}
+
+/// Split a command line into arguments, with the quotes and backslashes of a
+/// POSIX shell.
+fn split_command(command: &str) -> Vec<String> {
+    let mut arguments = Vec::new();
+    let mut current: Option<String> = None;
+    let mut quote = None;
+    let mut chars = command.chars();
+    while let Some(c) = chars.next() {
+        match (quote, c) {
+            (None, c) if c.is_whitespace() => arguments.extend(current.take()),
+            (None, '\'' | '"') => {
+                quote = Some(c);
+                current.get_or_insert_default();
+            }
+            (Some(q), c) if c == q => quote = None,
+            (None | Some('"'), '\\') => current.get_or_insert_default().extend(chars.next()),
+            (_, c) => current.get_or_insert_default().push(c),
+        }
+    }
+    arguments.extend(current);
+    arguments
+}
+
+/// Run the compiler of `entry` with `-E` instead of `-c`, `-o` and the flags
+/// that write dependency files, returning the preprocessed text.
+fn run_compiler(entry: &Entry) -> io::Result<String> {
+    let (compiler, arguments) = (entry.arguments.split_first()).ok_or_else(|| io::Error::other("empty command"))?;
+    let mut command = Command::new(compiler);
+    let mut arguments = arguments.iter();
+    while let Some(arg) = arguments.next() {
+        match arg.as_str() {
+            "-c" | "-E" | "-MD" | "-MMD" => {}
+            "-o" | "-MF" | "-MT" | "-MQ" => {
+                arguments.next();
+            }
+            _ => {
+                command.arg(arg);
+            }
+        }
+    }
+    let output = (command.arg("-E").current_dir(&entry.directory))
+        .stdin(Stdio::null())
+        .output()?;
+    if !output.status.success() {
+        let stderr = String::from_utf8_lossy(&output.stderr);
+        return Err(io::Error::other(format!("{compiler} -E failed: {}", stderr.trim_end())));
+    }
+    String::from_utf8(output.stdout).map_err(io::Error::other)
+}
+
+/// Preprocess `entry` with the built-in preprocessor, with the include paths
+/// and macros of its arguments.
+fn run_builtin(entry: &Entry, headers: &Arc<HeaderCache>) -> io::Result<Preprocessed> {
+    let mut preprocessor = Preprocessor::new();
+    preprocessor.set_header_cache(headers.clone());
+    let mut arguments = entry.arguments.iter().skip(1);
+    while let Some(arg) = arguments.next() {
+        // Flags take their value in the same argument, or in the next one
+        let mut value = |flag: &str| {
+            let rest = arg.strip_prefix(flag)?;
+            if rest.is_empty() {
+                arguments.next().cloned()
+            } else {
+                Some(rest.to_string())
+            }
+        };
+        if let Some(path) = value("-I").or_else(|| value("-isystem")).or_else(|| value("-iquote")) {
+            preprocessor.add_include_path(entry.directory.join(path));
+        } else if let Some(definition) = value("-D") {
+            let (name, body) = definition.split_once('=').unwrap_or((definition.as_str(), "1"));
+            preprocessor.define(name, body);
+        } else if let Some(name) = value("-U") {
+            preprocessor.undefine(&name);
+        }
+    }
+    preprocessor.preprocess_file(&entry.file)
+}
+
+/// Time spent in each phase.
+#[derive(Clone, Copy, Default)]
+struct Times {
+    preprocess: Duration,
+    lex: Duration,
+    parse: Duration,
+    cache: Duration,
+    output: Duration,
+}
+
+impl Times {
+    fn add(&mut self, other: &Times) {
+        self.preprocess += other.preprocess;
+        self.lex += other.lex;
+        self.parse += other.parse;
+        self.cache += other.cache;
+        self.output += other.output;
+    }
+}
+
+/// What was found in a unit.
+#[derive(Default)]
+struct Unit {
+    /// Number of preprocessing and syntax errors.
+    errors: usize,
+    /// The reports of the errors.
+    report: Vec<u8>,
+    /// The names with external linkage, if asked for.
+    symbols: UnitSymbols,
+    /// Whether the unit was read from the cache.
+    cached: bool,
+    times: Times,
+}
+
+/// Where the unit of `entry` is cached, by the hash of its preprocessed text.
+fn cache_path(dir: &Path, preprocess: Preprocess, text: &str, extension: &str) -> PathBuf {
+    let mut hasher = DefaultHasher::new();
+    (FORMAT_VERSION, preprocess, text).hash(&mut hasher);
+    dir.join(format!("{:016x}.{extension}", hasher.finish()))
+}
+
+/// Write `bytes` to `path` through a temporary file, so that other processes
+/// sharing the cache never read a partial file.
+fn write_cached(path: &Path, bytes: &[u8]) -> io::Result<()> {
+    static NEXT: AtomicUsize = AtomicUsize::new(0);
+    let temp = path.with_extension(format!(
+        "tmp{}-{}",
+        std::process::id(),
+        NEXT.fetch_add(1, Ordering::Relaxed)
+    ));
+    fs::write(&temp, bytes)?;
+    fs::rename(&temp, path)
+}
+
+/// Preprocess, lex and parse the unit of `entry`, or read it from the cache.
+/// With a `worker`, the unit is lexed and parsed there.
+fn process(
+    entry: &Entry,
+    options: &Options,
+    headers: &Arc<HeaderCache>,
+    worker: Option<&mut Worker>,
+) -> io::Result<Unit> {
+    let mut unit = Unit::default();
+    let start = Instant::now();
+    let (text, preprocessed) = match options.preprocess {
+        Preprocess::Cc => (run_compiler(entry)?, None),
+        Preprocess::Builtin => {
+            let preprocessed = run_builtin(entry, headers)?;
+            (String::new(), Some(preprocessed))
+        }
+    };
+    let text = preprocessed
+        .as_ref()
+        .map_or(text.as_str(), |preprocessed| preprocessed.source());
+    unit.times.preprocess = start.elapsed();
+
+    // Only units without errors are cached, so a hit has no reports to write
+    let start = Instant::now();
+    let cached = options.cache.as_deref().map(|dir| {
+        let tree = cache_path(dir, options.preprocess, text, "cgrm");
+        let symbols = cache_path(dir, options.preprocess, text, "sym");
+        (tree, symbols)
+    });
+    if let Some((tree, symbols)) = &cached
+        && preprocessed
+            .as_ref()
+            .is_none_or(|preprocessed| preprocessed.errors.is_empty())
+        && let Ok(bytes) = fs::read(tree)
+        && let Ok((_, tree, _)) = serialize::decode(&bytes, text)
+    {
+        let symbols = match options.emit {
+            Emit::Symbols => fs::read(symbols)
+                .ok()
+                .and_then(|bytes| serialize::decode_tree(&bytes).ok()),
+            _ => Some(UnitSymbols::default()),
+        };
+        if let Some(symbols) = symbols {
+            unit.symbols = symbols;
+            unit.cached = true;
+            unit.times.cache = start.elapsed();
+            if let Some(out) = options.ast_dir() {
+                let start = Instant::now();
+                write_ast(out, entry, &tree)?;
+                unit.times.output = start.elapsed();
+            }
+            return Ok(unit);
+        }
+    }
+    unit.times.cache = start.elapsed();
+
+    let filename = entry.file.to_string_lossy();
+    let preprocess_errors = preprocessed
+        .as_ref()
+        .map_or(&[][..], |preprocessed| &preprocessed.errors);
+    let ctx_map = preprocessed.as_ref().map(|preprocessed| {
+        // The cache and reports take the text of the unit as one string
+        let mut ctx_map = preprocessed.ctx_map();
+        ctx_map.source = text;
+        ctx_map
+    });
+    for error in preprocess_errors {
+        let ctx_map = ctx_map.as_ref().expect("Only the built-in preprocessor has errors");
+        let (context, _) = error.span.at_context(ctx_map);
+        let file = context.map_or_else(|| filename.clone(), |context| context.filename.as_ref().into());
+        let line = error.span.line_col(ctx_map).line;
+        writeln!(unit.report, "{file}:{line}: {}", error.message)?;
+    }
+    // The encoded unit is only needed to be cached
+    let encode = cached.is_some() && preprocess_errors.is_empty();
+
+    let (tree, encoded, errors) = match worker {
+        Some(worker) => {
+            let start = Instant::now();
+            let mut flags = 0;
+            if options.emit == Emit::Symbols {
+                flags |= remote::SYMBOLS;
+            }
+            if encode || options.ast_dir().is_some() {
+                flags |= remote::TREE;
+            }
+            let request = Request {
+                flags,
+                filename: &filename,
+                text,
+                tokens: (ctx_map.as_ref()).zip(preprocessed.as_ref().map(|preprocessed| &preprocessed.tokens)),
+            };
+            let response = worker.parse(&request)?;
+            unit.times.parse = start.elapsed();
+            if options.emit == Emit::Symbols {
+                unit.symbols = serialize::decode_tree(&response.symbols).map_err(io::Error::other)?;
+            }
+            let tree = match options.ast_dir() {
+                Some(_) if !response.tree.is_empty() => {
+                    Some(serialize::decode(&response.tree, text).map_err(io::Error::other)?.1)
+                }
+                _ => None,
+            };
+            unit.report.extend_from_slice(&response.report);
+            let encoded = (!response.tree.is_empty()).then_some(response.tree);
+            (tree, encoded, response.errors)
+        }
+        None => {
+            let start = Instant::now();
+            let lexed;
+            let (tokens, mut ctx_map) = match (&preprocessed, ctx_map) {
+                (Some(preprocessed), Some(ctx_map)) => (&preprocessed.tokens, ctx_map),
+                _ => {
+                    let (tokens, ctx_map) = lex(text, Some(filename.as_ref()));
+                    lexed = tokens;
+                    (&lexed, ctx_map)
+                }
+            };
+            unit.times.lex = start.elapsed();
+
+            let start = Instant::now();
+            let parsed = parse_unit(tokens, &mut ctx_map, options.emit == Emit::Symbols)?;
+            unit.times.parse = start.elapsed();
+            unit.symbols = parsed.symbols;
+            unit.report.extend_from_slice(&parsed.report);
+            let encoded = match &parsed.tree {
+                Some(tree) if encode && parsed.errors == 0 => {
+                    Some(serialize::encode(tokens, tree, &ctx_map).map_err(io::Error::other)?)
+                }
+                _ => None,
+            };
+            (parsed.tree, encoded, parsed.errors)
+        }
+    };
+
+    unit.errors = preprocess_errors.len() + errors;
+    if let (Some(bytes), Some((tree_path, symbols_path)), 0) = (&encoded, &cached, unit.errors) {
+        let start = Instant::now();
+        write_cached(tree_path, bytes)?;
+        if options.emit == Emit::Symbols {
+            write_cached(
+                symbols_path,
+                &serialize::encode_tree(&unit.symbols).map_err(io::Error::other)?,
+            )?;
+        }
+        unit.times.cache += start.elapsed();
+    }
+
+    let start = Instant::now();
+    if let (Some(tree), Some(out)) = (&tree, options.ast_dir()) {
+        write_ast(out, entry, tree)?;
+    }
+    unit.times.output = start.elapsed();
+    Ok(unit)
+}
+
+/// What parsing a unit found.
+struct Parsed {
+    tree: Option<TranslationUnit>,
+    /// Number of syntax errors.
+    errors: usize,
+    /// The reports of the syntax errors.
+    report: Vec<u8>,
+    /// The names with external linkage, if asked for.
+    symbols: UnitSymbols,
+}
+
+/// Parse `tokens`, and report the syntax errors in the contexts of `ctx_map`.
+fn parse_unit(tokens: &BalancedTokenSequence, ctx_map: &mut ContextMapping, symbols: bool) -> io::Result<Parsed> {
+    let mut state = State::new();
+    state.set_declaration_index(symbols);
+    let (tree, errors) = (translation_unit().parse_with_state(tokens.as_input(), &mut state)).into_output_errors();
+    let mut parsed = Parsed {
+        errors: errors.len(),
+        report: Vec::new(),
+        symbols: UnitSymbols::default(),
+        tree: None,
+    };
+    if let (Some(tree), Some(index)) = (&tree, state.take_declaration_index()) {
+        parsed.symbols = UnitSymbols::new(tree, &index);
+    }
+    report_all(errors, ctx_map, &mut parsed.report)?;
+    parsed.tree = tree;
+    Ok(parsed)
+}
+
+/// Write the syntax tree of `entry` to `out`, named after its file.
+fn write_ast(out: &Path, entry: &Entry, tree: &TranslationUnit) -> io::Result<()> {
+    let name: String = (entry.file.to_string_lossy().chars())
+        .map(|c| {
+            if c.is_alphanumeric() || c == '.' || c == '-' {
+                c
+            } else {
+                '_'
+            }
+        })
+        .collect();
+    let writer = BufWriter::new(fs::File::create(out.join(name + ".json"))?);
+    serialize::export_json(tree, writer, ExportOptions { spans: true, errors: true })
+}
+
+/// Process every entry on `options.jobs` threads, and write what was asked and
+/// the summary. Returns whether all units were processed without errors.
+fn run(options: &Options) -> io::Result<bool> {
+    let wall = Instant::now();
+    let entries = read_database(&options.database)?;
+    for dir in options.out.iter().chain(&options.cache) {
+        fs::create_dir_all(dir)?;
+    }
+
+    let headers = Arc::new(HeaderCache::new());
+    let next = AtomicUsize::new(0);
+    let units: Vec<Mutex<Option<io::Result<Unit>>>> = entries.iter().map(|_| Mutex::new(None)).collect();
+    let jobs = options.jobs.min(entries.len());
+    // Each thread has its own connection, to the workers in turn
+    let mut workers: Vec<Option<Worker>> = (0..jobs).map(|_| None).collect();
+    if !options.workers.is_empty() {
+        for (i, worker) in workers.iter_mut().enumerate() {
+            let address = &options.workers[i % options.workers.len()];
+            let connected = Worker::connect(address.as_str());
+            *worker = Some(connected.map_err(|error| io::Error::new(error.kind(), format!("{address}: {error}")))?);
+        }
+    }
+    thread::scope(|scope| {
+        for mut worker in workers {
+            let (next, units, entries, headers) = (&next, &units, &entries, &headers);
+            scope.spawn(move || {
+                loop {
+                    let i = next.fetch_add(1, Ordering::Relaxed);
+                    let Some(entry) = entries.get(i) else { break };
+                    *units[i].lock().unwrap() = Some(process(entry, options, headers, worker.as_mut()));
+                }
+            });
+        }
+    });
+
+    let mut out = BufWriter::new(io::stdout().lock());
+    let (mut times, mut failed, mut cached) = (Times::default(), 0, 0);
+    let mut symbols = Vec::with_capacity(entries.len());
+    for (entry, unit) in entries.iter().zip(units) {
+        match unit.into_inner().unwrap().expect("Every entry is processed") {
+            Ok(unit) => {
+                out.write_all(&unit.report)?;
+                times.add(&unit.times);
+                failed += (unit.errors > 0) as usize;
+                cached += unit.cached as usize;
+                symbols.push(unit.symbols);
+            }
+            Err(error) => {
+                eprintln!("{}: {error}", entry.file.display());
+                failed += 1;
+                symbols.push(UnitSymbols::default());
+            }
+        }
+    }
+    if options.emit == Emit::Symbols {
+        let start = Instant::now();
+        write_symbols(&mut out, &entries, &SymbolDatabase::merge(&symbols))?;
+        times.output += start.elapsed();
+    }
+    out.flush()?;
+
+    let millis = |duration: Duration| format!("{:.3} ms", duration.as_secs_f64() * 1e3);
+    eprintln!(
+        "{} files, {failed} with errors, {cached} from the cache, in {} on {} threads",
+        entries.len(),
+        millis(wall.elapsed()),
+        options.jobs,
+    );
+    let phases = [
+        ("preprocess", times.preprocess),
+        ("lex", times.lex),
+        ("parse", times.parse),
+        ("cache", times.cache),
+        ("output", times.output),
+    ];
+    for (name, time) in phases {
+        eprintln!("  {name:<10} {:>12}", millis(time));
+    }
+    Ok(failed == 0)
+}
+
+/// Write a line per name with external linkage: its name, numbers of
+/// declarations and definitions, and the files defining it, marking those with
+/// conflicting declarations.
+fn write_symbols(out: &mut impl Write, entries: &[Entry], database: &SymbolDatabase) -> io::Result<()> {
+    for symbol in database.symbols() {
+        let sites = database.sites(symbol);
+        let defined: Vec<String> = (sites.iter().filter(|site| site.defined))
+            .map(|site| entries[site.unit as usize].file.display().to_string())
+            .collect();
+        let conflicting = if symbol.conflicting { " conflicting" } else { "" };
+        writeln!(
+            out,
+            "{} {} {}{conflicting} {}",
+            symbol.name,
+            sites.len(),
+            symbol.definitions,
+            defined.join(",")
+        )?;
+    }
+    Ok(())
+}
@@ -0,0 +1,264 @@
+//! Parsing units on other machines.
+//!
+//! A worker, started with `--serve <address>`, accepts connections from
+//! coordinators and answers each request on a connection in turn. The
+//! messages are frames of a little-endian `u32` length and that many bytes;
+//! within a frame, byte strings are written the same way, after their
+//! length.
+//!
+//! A request is a flags byte, [`SYMBOLS`] and [`TREE`], then the kind of the
+//! unit and its filename and text. A [`SOURCE`] unit is lexed by the worker;
+//! a [`TOKENS`] unit, such as the output of the built-in preprocessor, whose
+//! tokens are not those of its text, is followed by its source contexts and
+//! by its tokens, in the format of [`serialize::encode_tree`]. The response
+//! is a status byte, then either a message or the number of syntax errors,
+//! their reports, the names of the unit with external linkage if asked for,
+//! and the unit as written by [`serialize::encode`] if asked for.
+
+use std::{
+    io::{self, BufReader, BufWriter, Read, Write},
+    net::{TcpListener, TcpStream, ToSocketAddrs},
+    thread,
+};
+
+use cgrammar::{
+    BalancedTokenSequence, lex, serialize,
+    span::{ContextMapping, SourceContext},
+};
+
+use crate::parse_unit;
+
+/// Request the names with external linkage of the unit.
+pub const SYMBOLS: u8 = 1;
+/// Request the encoded unit.
+pub const TREE: u8 = 2;
+
+/// A unit given by its text, to be lexed.
+pub const SOURCE: u8 = 0;
+/// A unit given by its text, source contexts and tokens.
+pub const TOKENS: u8 = 1;
+
+/// A unit to parse on a worker.
+pub struct Request<'a> {
+    pub flags: u8,
+    pub filename: &'a str,
+    pub text: &'a str,
+    /// The source contexts and tokens of a [`TOKENS`] unit.
+    pub tokens: Option<(&'a ContextMapping<'a>, &'a BalancedTokenSequence)>,
+}
+
+/// What a worker found in a unit.
+#[derive(Default)]
+pub struct Response {
+    pub errors: usize,
+    pub report: Vec<u8>,
+    /// The encoded names with external linkage, if asked for.
+    pub symbols: Vec<u8>,
+    /// The encoded unit, if asked for and parsing produced a tree.
+    pub tree: Vec<u8>,
+}
+
+fn write_frame(out: &mut impl Write, frame: &[u8]) -> io::Result<()> {
+    out.write_all(&(frame.len() as u32).to_le_bytes())?;
+    out.write_all(frame)?;
+    out.flush()
+}
+
+/// Read a frame, or `None` at the end of the input.
+fn read_frame(input: &mut impl Read) -> io::Result<Option<Vec<u8>>> {
+    let mut len = [0; 4];
+    match input.read_exact(&mut len) {
+        Ok(()) => {}
+        Err(error) if error.kind() == io::ErrorKind::UnexpectedEof => return Ok(None),
+        Err(error) => return Err(error),
+    }
+    let mut frame = vec![0; u32::from_le_bytes(len) as usize];
+    input.read_exact(&mut frame)?;
+    Ok(Some(frame))
+}
+
+fn put_bytes(out: &mut Vec<u8>, bytes: &[u8]) {
+    out.extend_from_slice(&(bytes.len() as u32).to_le_bytes());
+    out.extend_from_slice(bytes);
+}
+
+fn invalid(message: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, message.to_string())
+}
+
+/// Reads the fields of a frame in order.
+struct Fields<'a>(&'a [u8]);
+
+impl<'a> Fields<'a> {
+    fn take(&mut self, len: usize) -> io::Result<&'a [u8]> {
+        if self.0.len() < len {
+            return Err(invalid("truncated frame"));
+        }
+        let (field, rest) = self.0.split_at(len);
+        self.0 = rest;
+        Ok(field)
+    }
+
+    fn u8(&mut self) -> io::Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn u32(&mut self) -> io::Result<u32> {
+        Ok(u32::from_le_bytes(self.take(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> io::Result<u64> {
+        Ok(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn bytes(&mut self) -> io::Result<&'a [u8]> {
+        let len = self.u32()? as usize;
+        self.take(len)
+    }
+
+    fn str(&mut self) -> io::Result<&'a str> {
+        std::str::from_utf8(self.bytes()?).map_err(|_| invalid("text is not UTF-8"))
+    }
+}
+
+impl Request<'_> {
+    fn encode(&self) -> io::Result<Vec<u8>> {
+        let mut frame = vec![self.flags];
+        frame.push(if self.tokens.is_some() { TOKENS } else { SOURCE });
+        put_bytes(&mut frame, self.filename.as_bytes());
+        put_bytes(&mut frame, self.text.as_bytes());
+        if let Some((ctx_map, tokens)) = self.tokens {
+            let starts: Vec<_> = ctx_map.context_starts().collect();
+            frame.extend_from_slice(&(starts.len() as u32).to_le_bytes());
+            for (offset, context) in starts {
+                frame.extend_from_slice(&(offset as u64).to_le_bytes());
+                put_bytes(&mut frame, context.filename.as_bytes());
+                frame.extend_from_slice(&context.line_offset.to_le_bytes());
+            }
+            put_bytes(&mut frame, &serialize::encode_tree(tokens).map_err(io::Error::other)?);
+        }
+        Ok(frame)
+    }
+}
+
+/// Parse the unit of a request frame.
+fn answer(frame: &[u8]) -> io::Result<Response> {
+    let mut fields = Fields(frame);
+    let flags = fields.u8()?;
+    let kind = fields.u8()?;
+    let filename = fields.str()?;
+    let text = fields.str()?;
+    let (tokens, mut ctx_map) = match kind {
+        SOURCE => lex(text, Some(filename)),
+        TOKENS => {
+            let mut ctx_map = ContextMapping::new(text);
+            for _ in 0..fields.u32()? {
+                let offset = fields.u64()? as usize;
+                let filename = fields.str()?.into();
+                let line_offset = fields.u32()? as i32;
+                ctx_map.start_context(offset, SourceContext { filename, line_offset });
+            }
+            let tokens = serialize::decode_tree(fields.bytes()?).map_err(io::Error::other)?;
+            (tokens, ctx_map)
+        }
+        _ => return Err(invalid("unknown kind of unit")),
+    };
+
+    let parsed = parse_unit(&tokens, &mut ctx_map, flags & SYMBOLS != 0)?;
+    let mut response = Response {
+        errors: parsed.errors,
+        report: parsed.report,
+        ..Response::default()
+    };
+    if flags & SYMBOLS != 0 {
+        response.symbols = serialize::encode_tree(&parsed.symbols).map_err(io::Error::other)?;
+    }
+    if flags & TREE != 0
+        && let Some(tree) = &parsed.tree
+    {
+        response.tree = serialize::encode(&tokens, tree, &ctx_map).map_err(io::Error::other)?;
+    }
+    Ok(response)
+}
+
+impl Response {
+    fn encode(&self) -> Vec<u8> {
+        let mut frame = vec![0];
+        frame.extend_from_slice(&(self.errors as u32).to_le_bytes());
+        put_bytes(&mut frame, &self.report);
+        put_bytes(&mut frame, &self.symbols);
+        put_bytes(&mut frame, &self.tree);
+        frame
+    }
+
+    fn decode(frame: &[u8]) -> io::Result<Self> {
+        let mut fields = Fields(frame);
+        if fields.u8()? != 0 {
+            return Err(io::Error::other(format!("worker failed: {}", fields.str()?)));
+        }
+        Ok(Self {
+            errors: fields.u32()? as usize,
+            report: fields.bytes()?.to_vec(),
+            symbols: fields.bytes()?.to_vec(),
+            tree: fields.bytes()?.to_vec(),
+        })
+    }
+}
+
+/// Answer the requests of each connection to `address`, on a thread per
+/// connection, until the process is stopped.
+pub fn serve(address: &str) -> io::Result<bool> {
+    let listener = TcpListener::bind(address)?;
+    eprintln!("listening on {}", listener.local_addr()?);
+    for stream in listener.incoming() {
+        let stream = stream?;
+        thread::spawn(move || {
+            let peer = (stream.peer_addr()).map_or_else(|_| "unknown peer".to_string(), |peer| peer.to_string());
+            if let Err(error) = serve_connection(stream) {
+                eprintln!("{peer}: {error}");
+            }
+        });
+    }
+    Ok(true)
+}
+
+fn serve_connection(stream: TcpStream) -> io::Result<()> {
+    let mut input = BufReader::new(stream.try_clone()?);
+    let mut output = BufWriter::new(stream);
+    while let Some(frame) = read_frame(&mut input)? {
+        let response = match answer(&frame) {
+            Ok(response) => response.encode(),
+            Err(error) => {
+                let mut frame = vec![1];
+                put_bytes(&mut frame, error.to_string().as_bytes());
+                frame
+            }
+        };
+        write_frame(&mut output, &response)?;
+    }
+    Ok(())
+}
+
+/// A connection to a worker.
+pub struct Worker {
+    input: BufReader<TcpStream>,
+    output: BufWriter<TcpStream>,
+}
+
+impl Worker {
+    pub fn connect(address: impl ToSocketAddrs) -> io::Result<Self> {
+        let stream = TcpStream::connect(address)?;
+        stream.set_nodelay(true)?;
+        Ok(Self {
+            input: BufReader::new(stream.try_clone()?),
+            output: BufWriter::new(stream),
+        })
+    }
+
+    /// Parse a unit on the worker.
+    pub fn parse(&mut self, request: &Request) -> io::Result<Response> {
+        write_frame(&mut self.output, &request.encode()?)?;
+        let frame = read_frame(&mut self.input)?.ok_or_else(|| invalid("worker closed the connection"))?;
+        Response::decode(&frame)
+    }
+}
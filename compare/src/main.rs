@@ -0,0 +1,262 @@
+//! Compare cgrammar with other C front ends on the same preprocessed corpus.
+//!
+//! Each front end parses every file of the corpus in a process of its own, so
+//! that its peak resident set size does not include the others:
+//!
+//! - `cgrammar`: [`lex`] then [`translation_unit`], also timed separately;
+//! - `lang-c`: `lang_c::driver::parse_preprocessed`, with the GNU flavor;
+//! - `tree-sitter`: the tree-sitter-c grammar;
+//! - `clang`: `clang -fsyntax-only` on each file. This includes starting the
+//!   process and semantic analysis, so it bounds the parse from above.
+//!
+//! For each front end, the report gives the files it parsed without errors,
+//! the throughput over the whole corpus, the percentiles of the latency per
+//! file and the peak RSS. The corpus is read before any timing, and counts in
+//! the RSS of the in-process front ends alike.
+//!
+//! Usage: `cargo run --release -p cgrammar-compare -- <dir> [front end]...`,
+//! where `<dir>` holds preprocessed `.i` files, e.g. from `cc -E`, and all
+//! front ends run unless some are given.
+
+use std::{
+    env,
+    io::{self, BufWriter, Write},
+    path::{Path, PathBuf},
+    process::{Command, ExitCode, Stdio},
+    time::{Duration, Instant},
+};
+
+use cgrammar::{Parser, lex, translation_unit};
+
+const FRONT_ENDS: &[&str] = &["cgrammar", "lang-c", "tree-sitter", "clang"];
+
+fn main() -> ExitCode {
+    let args: Vec<String> = env::args().skip(1).collect();
+    match args.as_slice() {
+        [flag, front_end, dir] if flag == "--run" => match run(front_end, Path::new(dir)) {
+            Ok(()) => ExitCode::SUCCESS,
+            Err(error) => {
+                eprintln!("{front_end}: {error}");
+                ExitCode::FAILURE
+            }
+        },
+        [dir, front_ends @ ..] => compare(Path::new(dir), front_ends),
+        [] => {
+            eprintln!("Usage: cgrammar-compare <dir> [front end]...");
+            eprintln!("Front ends: {}", FRONT_ENDS.join(", "));
+            ExitCode::FAILURE
+        }
+    }
+}
+
+/// Run each front end in a child process, and print their reports.
+fn compare(dir: &Path, front_ends: &[String]) -> ExitCode {
+    let front_ends: Vec<&str> = match front_ends {
+        [] => FRONT_ENDS.to_vec(),
+        front_ends => front_ends.iter().map(String::as_str).collect(),
+    };
+    let Ok(exe) = env::current_exe() else {
+        eprintln!("Cannot find the path of this executable");
+        return ExitCode::FAILURE;
+    };
+
+    println!(
+        "{:<12} {:>7} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9} {:>10}",
+        "front end", "files", "errors", "MB/s", "p50 ms", "p90 ms", "p99 ms", "max ms", "peak RSS"
+    );
+    for front_end in front_ends {
+        let output = Command::new(&exe)
+            .arg("--run")
+            .arg(front_end)
+            .arg(dir)
+            .stderr(Stdio::inherit())
+            .output();
+        match output {
+            Ok(output) if output.status.success() => {
+                Report::parse(&String::from_utf8_lossy(&output.stdout)).print(front_end);
+            }
+            Ok(_) => println!("{front_end:<12} failed"),
+            Err(error) => println!("{front_end:<12} failed: {error}"),
+        }
+    }
+    ExitCode::SUCCESS
+}
+
+/// What a child process measured, see [`run`] for the lines it writes.
+#[derive(Default)]
+struct Report {
+    bytes: u64,
+    latencies: Vec<Duration>,
+    errors: usize,
+    phases: Vec<(String, Duration)>,
+    /// Peak resident set size, in kilobytes.
+    peak_rss: u64,
+}
+
+impl Report {
+    fn parse(output: &str) -> Self {
+        let mut report = Report::default();
+        for line in output.lines() {
+            let fields: Vec<&str> = line.split_whitespace().collect();
+            let number = |i: usize| fields.get(i).and_then(|field| field.parse::<u64>().ok()).unwrap_or(0);
+            match fields.first() {
+                Some(&"bytes") => report.bytes = number(1),
+                Some(&"file") => {
+                    report.latencies.push(Duration::from_nanos(number(1)));
+                    report.errors += (number(2) == 0) as usize;
+                }
+                Some(&"phase") => {
+                    let name = fields.get(1).unwrap_or(&"?").to_string();
+                    report.phases.push((name, Duration::from_nanos(number(2))));
+                }
+                Some(&"rss") => report.peak_rss = number(1),
+                _ => {}
+            }
+        }
+        report.latencies.sort_unstable();
+        report
+    }
+
+    fn print(&self, front_end: &str) {
+        let total: Duration = self.latencies.iter().sum();
+        let throughput = self.bytes as f64 / total.as_secs_f64() / 1e6;
+        let millis = |duration: Duration| format!("{:.3}", duration.as_secs_f64() * 1e3);
+        println!(
+            "{:<12} {:>7} {:>7} {:>9.1} {:>9} {:>9} {:>9} {:>9} {:>7} MB",
+            front_end,
+            self.latencies.len(),
+            self.errors,
+            throughput,
+            millis(self.percentile(50.0)),
+            millis(self.percentile(90.0)),
+            millis(self.percentile(99.0)),
+            millis(self.percentile(100.0)),
+            self.peak_rss / 1024,
+        );
+        for (name, time) in &self.phases {
+            let share = time.as_secs_f64() / total.as_secs_f64() * 100.0;
+            println!("  {name:<10} {share:>5.1}% of the time, {} ms", millis(*time));
+        }
+    }
+
+    /// The latency that `p` percent of the files take at most, by nearest rank.
+    fn percentile(&self, p: f64) -> Duration {
+        let rank = (p / 100.0 * self.latencies.len() as f64).ceil() as usize;
+        (self.latencies.get(rank.max(1) - 1).copied()).unwrap_or_default()
+    }
+}
+
+/// Parse the corpus in `dir` with `front_end`, writing one line per file,
+/// `file <nanoseconds> <1 if parsed without errors, else 0>`, then a line
+/// `phase <name> <nanoseconds>` per phase timed separately, and the peak RSS
+/// as `rss <kilobytes>`.
+fn run(front_end: &str, dir: &Path) -> io::Result<()> {
+    let files = corpus(dir)?;
+    let mut out = BufWriter::new(io::stdout().lock());
+    let bytes: usize = files.iter().map(|(_, source)| source.len()).sum();
+    writeln!(out, "bytes {bytes}")?;
+
+    let mut who = libc::RUSAGE_SELF;
+    match front_end {
+        "cgrammar" => {
+            let parser = translation_unit();
+            let (mut lex_time, mut parse_time) = (Duration::ZERO, Duration::ZERO);
+            for (_, source) in &files {
+                let start = Instant::now();
+                let (tokens, _) = lex(source, None);
+                let lexed = start.elapsed();
+                let result = parser.parse(tokens.as_input());
+                let total = start.elapsed();
+                lex_time += lexed;
+                parse_time += total - lexed;
+                write_file(&mut out, total, !result.has_errors())?;
+            }
+            writeln!(out, "phase lex {}", lex_time.as_nanos())?;
+            writeln!(out, "phase parse {}", parse_time.as_nanos())?;
+        }
+        "lang-c" => {
+            let config = lang_c::driver::Config::default();
+            for (_, source) in &files {
+                // The parser takes the source by value
+                let source = source.clone();
+                let start = Instant::now();
+                let result = lang_c::driver::parse_preprocessed(&config, source);
+                write_file(&mut out, start.elapsed(), result.is_ok())?;
+            }
+        }
+        "tree-sitter" => {
+            let mut parser = tree_sitter::Parser::new();
+            (parser.set_language(&tree_sitter_c::LANGUAGE.into())).map_err(io::Error::other)?;
+            for (_, source) in &files {
+                let start = Instant::now();
+                let tree = parser.parse(source, None);
+                let time = start.elapsed();
+                write_file(&mut out, time, tree.is_some_and(|tree| !tree.root_node().has_error()))?;
+            }
+        }
+        "clang" => {
+            who = libc::RUSAGE_CHILDREN;
+            for (path, _) in &files {
+                let start = Instant::now();
+                let status = Command::new("clang")
+                    .args(["-fsyntax-only", "-w", "-x", "cpp-output"])
+                    .arg(path)
+                    .stdout(Stdio::null())
+                    .stderr(Stdio::null())
+                    .status()?;
+                write_file(&mut out, start.elapsed(), status.success())?;
+            }
+        }
+        _ => {
+            let message = format!("unknown front end, expected one of {}", FRONT_ENDS.join(", "));
+            return Err(io::Error::new(io::ErrorKind::InvalidInput, message));
+        }
+    }
+    writeln!(out, "rss {}", peak_rss(who))?;
+    out.flush()
+}
+
+fn write_file(out: &mut impl Write, time: Duration, ok: bool) -> io::Result<()> {
+    writeln!(out, "file {} {}", time.as_nanos(), ok as u8)
+}
+
+/// The `.i` files under `dir`, sorted by path, with their contents.
+fn corpus(dir: &Path) -> io::Result<Vec<(PathBuf, String)>> {
+    let mut paths = Vec::new();
+    collect_files(dir, &mut paths)?;
+    if paths.is_empty() {
+        return Err(io::Error::new(io::ErrorKind::NotFound, "no .i files in the corpus"));
+    }
+    paths.sort();
+    paths
+        .into_iter()
+        .map(|path| std::fs::read_to_string(&path).map(|source| (path, source)))
+        .collect()
+}
+
+fn collect_files(dir: &Path, paths: &mut Vec<PathBuf>) -> io::Result<()> {
+    for entry in std::fs::read_dir(dir)? {
+        let path = entry?.path();
+        if path.is_dir() {
+            collect_files(&path, paths)?;
+        } else if path.extension().is_some_and(|ext| ext == "i") {
+            paths.push(path);
+        }
+    }
+    Ok(())
+}
+
+/// Peak resident set size of this process, or of its largest child, in
+/// kilobytes.
+fn peak_rss(who: libc::c_int) -> u64 {
+    let mut usage = std::mem::MaybeUninit::<libc::rusage>::zeroed();
+    // SAFETY: `getrusage` only writes the usage it is given, which is zeroed
+    // if the call fails
+    let usage = unsafe {
+        libc::getrusage(who, usage.as_mut_ptr());
+        usage.assume_init()
+    };
+    let max = usage.ru_maxrss as u64;
+    // In bytes on macOS, and in kilobytes elsewhere
+    if cfg!(target_os = "macos") { max / 1024 } else { max }
+}
@@ -5,27 +5,19 @@
 #[cfg(feature = "dbg-pls")]
 fn main() {
     use cgrammar::*;
-    use chumsky::Parser;
 
     let file = std::env::args().nth(1).unwrap();
     let src = std::fs::read_to_string(file.as_str()).unwrap();
 
-    let (tokens, mut ctx_map) = lex(src.as_str(), Some(&file));
-
-    let parser = translation_unit();
-    let mut init_state = State::new();
-    init_state.ctx_mut().add_typedef_name("term".into());
-    init_state.ctx_mut().add_typedef_name("thm".into());
-    let ast = parser.parse_with_state(tokens.as_input(), &mut init_state);
-    if ast.has_output() {
-        println!("{}", dbg_pls::pretty(&ast.output().unwrap()));
+    let mut session = ParseSession::with_typedef_names(["term", "thm"]);
+    let mut unit = session.parse(src.as_str(), Some(&file));
+    if let Some(ast) = &unit.output {
+        println!("{}", dbg_pls::pretty(ast));
     } else {
         eprintln!("Parse failed!");
     }
-    if ast.has_errors() {
-        for error in ast.into_errors() {
-            report(error).eprint(&mut ctx_map).unwrap();
-        }
+    if unit.has_errors() {
+        report_all(unit.errors, &mut unit.ctx_map, std::io::stderr().lock()).unwrap();
         std::process::exit(1);
     }
 }
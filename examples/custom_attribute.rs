@@ -11,19 +11,25 @@ fn main() {
     let file = std::env::args().nth(1).unwrap();
     let src = std::fs::read_to_string(file.as_str()).unwrap();
 
-    let mut init_state = State::new();
-    init_state.ctx_mut().add_typedef_name("term".into());
-    init_state.ctx_mut().add_typedef_name("thm".into());
-    let init_state = init_state;
+    // The arguments of `[[cst::gl(...)]]` are parsed as statements during the
+    // main parse, with its state
+    let mut parsers = AttributeParsers::new();
+    parsers.register(Some("cst"), "gl", |tokens, state| {
+        statement().parse_with_state(tokens, state)
+    });
+    let mut state = State::new();
+    state.ctx_mut().add_typedef_name("term".into());
+    state.ctx_mut().add_typedef_name("thm".into());
+    state.set_attribute_parsers(Some(parsers));
 
     let (tokens, mut ctx_map) = lex(src.as_str(), Some(&file));
 
     let parser = translation_unit();
-    let ast = parser.parse_with_state(tokens.as_input(), &mut init_state.clone());
+    let ast = parser.parse_with_state(tokens.as_input(), &mut state);
     let (ast, errors) = ast.into_output_errors();
 
     for error in errors {
-        report(error).eprint(&mut ctx_map).unwrap();
+        report(error, &ctx_map).eprint(&mut ctx_map).unwrap();
     }
 
     let ast = ast.expect("Parse failed!");
@@ -42,21 +48,8 @@ fn main() {
             _ => None,
         })
         .flatten()
-        .filter(|attr| attr.token.get_identifier("cst").is_some_and(|n| n.as_ref() == "gl"))
-        .filter_map(|attr| attr.arguments.as_ref())
-        .for_each(|gl| {
-            let parser = statement();
-            let parsed = parser.parse_with_state(gl.as_input(), &mut init_state.clone());
-            let (stmt, errors) = parsed.into_output_errors();
-            for error in errors {
-                report(error).eprint(&mut ctx_map).unwrap();
-            }
-            let Some(stmt) = stmt else {
-                eprintln!("Failed to parse gl statement");
-                return;
-            };
-            println!("{}", dbg_pls::pretty(&stmt));
-        });
+        .filter_map(|attr| attr.value.as_ref()?.downcast_ref::<Statement>())
+        .for_each(|stmt| println!("{}", dbg_pls::pretty(stmt)));
 }
 
 #[cfg(not(feature = "dbg-pls"))]
@@ -9,13 +9,22 @@ fn main() {
         }};
         ($parser:path : $code:expr, $($name:ident => $value:expr),* $(,)?) => {{
             let (mut tokens, _) = lex($code, None);
-            tokens.interpolate(&interpolate! { $($name => $value),* }).unwrap();
+            tokens.interpolate_owned(interpolate! { $($name => $value),* }).unwrap();
             $parser().parse(tokens.as_input()).unwrap()
         }};
     }
 
     let items = ["foo", "bar", "baz"];
 
+    // Parsed once, and instantiated for each item without parsing it again
+    let item = quasi_quote::CompiledTemplate::compile("@s", |tokens| {
+        designated_initializer()
+            .parse(tokens.as_input())
+            .into_result()
+            .map_err(|errors| format!("{errors:?}"))
+    })
+    .unwrap();
+
     let ast = quote! {
         translation_unit:
         r#"
@@ -26,15 +35,15 @@ fn main() {
             }
         "#,
         var => Identifier("bar".into()),
-        args => Expression::dummy(ExpressionKind::Postfix(PostfixExpression::CompoundLiteral(CompoundLiteral {
+        args => Expression::dummy(ExpressionKind::Postfix(PostfixExpression::CompoundLiteral(Box::new(CompoundLiteral {
             storage_class_specifiers: vec![],
             type_name: quote!(type_name: "const char*[]"),
             initializer: BracedInitializer {
                 initializers: items.into_iter().map(|s| {
-                    quote!{designated_initializer: "@s", s => StringLiterals::from(s.to_string())}
+                    item.instantiate(interpolate!{ s => StringLiterals::from(s.to_string()) }).unwrap()
                 }).collect()
             }
-        }))),
+        })))),
         len => Constant::Integer((items.len() as i128).into()),
     };
 
@@ -1,21 +1,45 @@
-//! Dump the AST of a C source file.
+//! Shrink a C source file to a small input that still fails to parse, or that
+//! still parses slowly.
 //!
 //! Usage:
 //!
 //! ```sh
 //! cargo run --example shrink_test_case --all-features -- path/to/source.c
+//! cargo run --release --example shrink_test_case --all-features -- --slow 2000 path/to/source.c
+//! cargo run --release --example shrink_test_case --all-features -- --slow 2000 path/to/spool
 //! ```
+//!
+//! By default the input is shrunk while it has parse errors. With `--slow
+//! <ns>`, it is shrunk while parsing it takes more than `<ns>` nanoseconds per
+//! token, to find the smallest input that hits a performance cliff.
+//!
+//! Given a directory, e.g. the spool directory of a `SlowInputCapture`, every
+//! `.c` file in it is shrunk in turn, and the result written next to it as a
+//! `.min.c` file. Inputs that no longer fail, e.g. because they were only
+//! slow on a loaded machine, are skipped.
+//!
+//! The input is first truncated by bisecting on lines, then reduced by delta
+//! debugging on balanced token groups: runs of top-level tokens are removed
+//! while the input keeps failing, then runs of tokens inside each remaining
+//! group, so that brackets always stay balanced.
+
+use std::{path::Path, time::Instant};
 
 use cgrammar::*;
 use chumsky::Parser;
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
-enum ParseResult {
-    Success,
+enum Property {
+    /// The input has parse errors.
     ParseError,
+    /// Parsing the input takes more than the given nanoseconds per token.
+    Slow(u128),
 }
 
-fn can_parse(file: &str, src: &str) -> ParseResult {
+/// Number of times a slow input is timed, keeping the fastest.
+const TIMING_RUNS: usize = 3;
+
+fn parse(file: &str, src: &str) -> (bool, u64) {
     let (tokens, _) = lex(src, Some(file));
 
     let parser = translation_unit();
@@ -23,16 +47,127 @@ fn can_parse(file: &str, src: &str) -> ParseResult {
     init_state.ctx_mut().add_typedef_name("term".into());
     init_state.ctx_mut().add_typedef_name("thm".into());
     let ast = parser.parse_with_state(tokens.as_input(), &mut init_state);
-    if ast.has_errors() {
-        ParseResult::ParseError
-    } else {
-        ParseResult::Success
+    (ast.has_errors(), count_tokens(&tokens))
+}
+
+fn has_property(property: Property, file: &str, src: &str) -> bool {
+    match property {
+        Property::ParseError => parse(file, src).0,
+        Property::Slow(max_nanos) => {
+            let (nanos, tokens) = (0..TIMING_RUNS)
+                .map(|_| {
+                    let start = Instant::now();
+                    let (_, tokens) = parse(file, src);
+                    (start.elapsed().as_nanos(), tokens)
+                })
+                .min()
+                .unwrap();
+            tokens > 0 && nanos / tokens as u128 > max_nanos
+        }
     }
 }
 
-fn main() {
-    let file = std::env::args().nth(1).unwrap();
-    let src = std::fs::read_to_string(file.as_str()).unwrap();
+fn count_tokens(tokens: &BalancedTokenSequence) -> u64 {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| match &token.value {
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                1 + count_tokens(inner)
+            }
+            _ => 1,
+        })
+        .sum()
+}
+
+/// A token, or a balanced group of tokens.
+#[derive(Debug, Clone)]
+enum Node {
+    Token(String),
+    Group(&'static str, &'static str, Vec<Node>),
+}
+
+fn nodes(src: &str, tokens: &BalancedTokenSequence) -> Vec<Node> {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| match &token.value {
+            BalancedToken::Parenthesized(inner) => Node::Group("(", ")", nodes(src, inner)),
+            BalancedToken::Bracketed(inner) => Node::Group("[", "]", nodes(src, inner)),
+            BalancedToken::Braced(inner) => Node::Group("{", "}", nodes(src, inner)),
+            _ => Node::Token(src[token.span.range()].to_string()),
+        })
+        .collect()
+}
+
+fn render(nodes: &[Node], out: &mut String) {
+    for node in nodes {
+        if !out.is_empty() {
+            out.push(' ');
+        }
+        match node {
+            Node::Token(text) => out.push_str(text),
+            Node::Group(open, close, inner) => {
+                out.push_str(open);
+                render(inner, out);
+                out.push_str(close);
+            }
+        }
+    }
+}
+
+fn to_source(nodes: &[Node]) -> String {
+    let mut out = String::new();
+    render(nodes, &mut out);
+    out
+}
+
+/// The tokens of the group at `path`.
+fn group_mut<'n>(nodes: &'n mut Vec<Node>, path: &[usize]) -> &'n mut Vec<Node> {
+    match path.split_first() {
+        None => nodes,
+        Some((&index, rest)) => match &mut nodes[index] {
+            Node::Group(_, _, inner) => group_mut(inner, rest),
+            Node::Token(_) => unreachable!("Path leads to a group"),
+        },
+    }
+}
+
+/// Remove runs of tokens from the group at `path`, halving the length of the
+/// runs down to single tokens, while the input keeps failing; then do the
+/// same inside each group that is left.
+fn shrink_group(tree: &mut Vec<Node>, path: &mut Vec<usize>, fails: &mut impl FnMut(&[Node]) -> bool) {
+    let mut run = group_mut(tree, path).len().div_ceil(2);
+    while run > 0 {
+        let mut start = 0;
+        while start < group_mut(tree, path).len() {
+            let mut candidate = tree.clone();
+            let group = group_mut(&mut candidate, path);
+            let end = (start + run).min(group.len());
+            group.drain(start..end);
+            if fails(&candidate) {
+                *tree = candidate;
+            } else {
+                start += run;
+            }
+        }
+        run /= 2;
+    }
+
+    for index in 0..group_mut(tree, path).len() {
+        if matches!(group_mut(tree, path)[index], Node::Group(..)) {
+            path.push(index);
+            shrink_group(tree, path, fails);
+            path.pop();
+        }
+    }
+}
+
+/// Shrink `src` while it has `property`, returning `None` if it does not.
+fn shrink(property: Property, file: &str, src: &str) -> Option<String> {
+    if !has_property(property, file, src) {
+        return None;
+    }
 
     // shrink 1: trim half the lines from the end
     let mut low = 0;
@@ -41,14 +176,83 @@ fn main() {
         let mid = (low + high) / 2;
         eprint!("{}...", mid);
         let truncated_src = src.lines().take(mid).collect::<Vec<_>>().join("\n");
-        if can_parse(&file, &truncated_src) == ParseResult::ParseError {
-            low = mid + 1;
-        } else {
+        if has_property(property, file, &truncated_src) {
             high = mid;
+        } else {
+            low = mid + 1;
         }
     }
     eprintln!();
+    let truncated_src = src.lines().take(low).collect::<Vec<_>>().join("\n");
 
-    let minimal_src = src.lines().take(low + 1).collect::<Vec<_>>().join("\n");
-    println!("{}", minimal_src);
+    // shrink 2: remove balanced token groups
+    let (tokens, _) = lex(&truncated_src, Some(file));
+    let mut tree = nodes(&truncated_src, &tokens);
+    let mut tests = 0;
+    let mut fails = |nodes: &[Node]| {
+        tests += 1;
+        if tests % 100 == 0 {
+            eprint!("{}...", tests);
+        }
+        has_property(property, file, &to_source(nodes))
+    };
+    if fails(&tree) {
+        shrink_group(&mut tree, &mut Vec::new(), &mut fails);
+        eprintln!();
+        Some(to_source(&tree))
+    } else {
+        // Joining the tokens with spaces changed the result, e.g. because of
+        // line markers
+        eprintln!();
+        Some(truncated_src)
+    }
+}
+
+/// Shrink each `.c` file of `dir` that is not already shrunk.
+fn shrink_dir(property: Property, dir: &Path) {
+    let mut paths: Vec<_> = std::fs::read_dir(dir)
+        .unwrap()
+        .map(|entry| entry.unwrap().path())
+        .filter(|path| path.extension().is_some_and(|extension| extension == "c"))
+        .filter(|path| !path.to_string_lossy().ends_with(".min.c"))
+        .collect();
+    paths.sort();
+    for path in paths {
+        let file = path.to_string_lossy();
+        let src = std::fs::read_to_string(&path).unwrap();
+        eprintln!("{file}:");
+        match shrink(property, &file, &src) {
+            Some(shrunk) => std::fs::write(path.with_extension("min.c"), shrunk + "\n").unwrap(),
+            None => eprintln!("The input does not fail"),
+        }
+    }
+}
+
+fn main() {
+    let mut args = std::env::args().skip(1);
+    let mut property = Property::ParseError;
+    let mut file = args
+        .next()
+        .expect("Usage: shrink_test_case [--slow <ns>] <file or directory>");
+    if file == "--slow" {
+        let max_nanos = args
+            .next()
+            .and_then(|arg| arg.parse().ok())
+            .expect("--slow takes nanoseconds");
+        property = Property::Slow(max_nanos);
+        file = args
+            .next()
+            .expect("Usage: shrink_test_case [--slow <ns>] <file or directory>");
+    }
+    if Path::new(&file).is_dir() {
+        return shrink_dir(property, Path::new(&file));
+    }
+    let src = std::fs::read_to_string(file.as_str()).unwrap();
+    match shrink(property, &file, &src) {
+        Some(shrunk) => println!("{shrunk}"),
+        None => {
+            eprintln!("The input does not fail");
+            std::process::exit(1);
+        }
+    }
 }
@@ -0,0 +1,68 @@
+//! Lex and parse arbitrary input, failing on panics and on inputs that parse
+//! super-linearly slowly.
+//!
+//! Usage: `cargo fuzz run parse`
+//!
+//! Inputs that fail the time check are minimized by `cargo fuzz tmin`, or by
+//! `examples/shrink_test_case.rs --slow`, which reduces balanced token groups.
+
+#![no_main]
+
+use std::time::Instant;
+
+use cgrammar::*;
+use libfuzzer_sys::fuzz_target;
+
+/// Parse time per token above which an input is reported.
+///
+/// Can be overridden with the `CGRAMMAR_FUZZ_NS_PER_TOKEN` environment
+/// variable.
+const MAX_NANOS_PER_TOKEN: u128 = 20_000;
+
+/// Inputs with fewer tokens are too short to time reliably.
+const MIN_TOKENS: u64 = 256;
+
+fn count_tokens(tokens: &BalancedTokenSequence) -> u64 {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| match &token.value {
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                1 + count_tokens(inner)
+            }
+            _ => 1,
+        })
+        .sum()
+}
+
+fn max_nanos_per_token() -> u128 {
+    static MAX: std::sync::OnceLock<u128> = std::sync::OnceLock::new();
+    *MAX.get_or_init(|| {
+        std::env::var("CGRAMMAR_FUZZ_NS_PER_TOKEN")
+            .ok()
+            .and_then(|value| value.parse().ok())
+            .unwrap_or(MAX_NANOS_PER_TOKEN)
+    })
+}
+
+fuzz_target!(|data: &[u8]| {
+    let Ok(source) = std::str::from_utf8(data) else {
+        return;
+    };
+    let start = Instant::now();
+    let (tokens, _) = lex(source, None);
+    let mut state = State::new();
+    // Deep nesting is rejected in production, not a bug
+    state.set_max_nesting_depth(Some(256));
+    let _ = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    let elapsed = start.elapsed().as_nanos();
+
+    let tokens = count_tokens(&tokens);
+    if tokens >= MIN_TOKENS {
+        let nanos_per_token = elapsed / tokens as u128;
+        assert!(
+            nanos_per_token <= max_nanos_per_token(),
+            "parsing took {nanos_per_token} ns per token over {tokens} tokens"
+        );
+    }
+});
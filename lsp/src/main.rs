@@ -0,0 +1,465 @@
+//! A language server for C sources, over the standard input and output.
+//!
+//! Each open document is an [`IncrementalUnit`], edited by the changes the
+//! client sends, so that an edit reparses only the external declarations it
+//! touches. The server publishes the syntax errors of a document after its
+//! changes, and answers `textDocument/documentSymbol` with the file-scope
+//! names and members of the [`DeclarationIndex`] kept by the unit, and
+//! `textDocument/definition` by looking up the identifier under the cursor in
+//! the top-level tokens and its name in the index.
+//!
+//! Messages are read on their own thread and handled in order; before a
+//! request is answered, the messages already queued are read too, so that
+//! requests cancelled by `$/cancelRequest` are answered as cancelled without
+//! being run, and the diagnostics of a run of changes are published once,
+//! after the last of them.
+//!
+//! With `--bench <file>`, the server instead opens `file` as a document, edits
+//! it `--edits` times at lines spread over it, and prints the percentiles of
+//! the time taken by each edit with its diagnostics, by the document symbols
+//! and by a definition lookup, as a measure of the latency an editor would
+//! see.
+//!
+//! Usage: `cgrammar-lsp [--bench <file> [--edits N]]`
+
+use std::{
+    collections::{HashMap, HashSet},
+    env, fs,
+    io::{self, BufRead, Write},
+    ops::Range,
+    process::ExitCode,
+    sync::mpsc,
+    thread,
+    time::{Duration, Instant},
+};
+
+use cgrammar::{
+    BalancedToken, BalancedTokenSequence, DeclarationIndex, DeclaredKind, ExternalDeclaration, IncrementalUnit,
+    Punctuator, State, TextEdit, error_message, index::Declared, span::Span,
+};
+use serde_json::{Value, json};
+
+const USAGE: &str = "Usage: cgrammar-lsp [--bench <file> [--edits N]]";
+
+/// The error code of a request cancelled by the client.
+const REQUEST_CANCELLED: i64 = -32800;
+/// The error code of a request the server does not know.
+const METHOD_NOT_FOUND: i64 = -32601;
+
+fn main() -> ExitCode {
+    let mut args = env::args().skip(1);
+    let (mut bench, mut edits) = (None, 1000);
+    while let Some(arg) = args.next() {
+        let mut value = || args.next().ok_or_else(|| format!("{arg} expects a value"));
+        let parsed = match arg.as_str() {
+            "--bench" => value().map(|file| bench = Some(file)),
+            "--edits" => value().and_then(|n| {
+                edits = n
+                    .parse()
+                    .ok()
+                    .filter(|&n: &usize| n > 0)
+                    .ok_or("--edits expects a positive number")?;
+                Ok(())
+            }),
+            _ => Err(format!("unknown argument {arg}")),
+        };
+        if let Err(message) = parsed {
+            eprintln!("{message}");
+            eprintln!("{USAGE}");
+            return ExitCode::FAILURE;
+        }
+    }
+    let result = match bench {
+        Some(file) => run_bench(&file, edits),
+        None => Server::default().run(),
+    };
+    match result {
+        Ok(true) => ExitCode::SUCCESS,
+        Ok(false) => ExitCode::FAILURE,
+        Err(error) => {
+            eprintln!("{error}");
+            ExitCode::FAILURE
+        }
+    }
+}
+
+/// An open document.
+struct Document {
+    unit: IncrementalUnit,
+    /// The offset of the start of each line.
+    lines: Vec<usize>,
+    /// The names declared in the document.
+    declarations: DeclarationIndex,
+}
+
+impl Document {
+    fn new(text: String, filename: &str) -> Self {
+        let mut state = State::new();
+        state.set_declaration_index(true);
+        let unit = IncrementalUnit::new(text, Some(filename), state);
+        let mut document = Self {
+            unit,
+            lines: Vec::new(),
+            declarations: DeclarationIndex::default(),
+        };
+        document.update();
+        document
+    }
+
+    /// Replace `range` of the text, or the whole text, by `text`.
+    fn edit(&mut self, range: Option<Range<usize>>, text: &str) {
+        let range = range.unwrap_or(0..self.unit.source().len());
+        self.unit.edit(&TextEdit::new(range, text));
+        self.update();
+    }
+
+    fn update(&mut self) {
+        let source = self.unit.source();
+        self.lines.clear();
+        self.lines.push(0);
+        self.lines.extend(
+            source
+                .bytes()
+                .enumerate()
+                .filter(|&(_, b)| b == b'\n')
+                .map(|(i, _)| i + 1),
+        );
+        self.declarations = self.unit.declaration_index().unwrap_or_default();
+    }
+
+    /// The offset of an LSP position, a line and a UTF-16 column, clamped to
+    /// the text.
+    fn offset(&self, position: &Value) -> Option<usize> {
+        let line = position["line"].as_u64()? as usize;
+        let character = position["character"].as_u64()? as usize;
+        let source = self.unit.source();
+        let Some(&start) = self.lines.get(line) else {
+            return Some(source.len());
+        };
+        let end = self.lines.get(line + 1).map_or(source.len(), |&next| next - 1);
+        let mut units = 0;
+        let column = (source[start..end].char_indices())
+            .find(|&(_, c)| {
+                units += c.len_utf16();
+                units > character
+            })
+            .map_or(end - start, |(i, _)| i);
+        Some(start + column)
+    }
+
+    /// The LSP position of `offset`.
+    fn position(&self, offset: usize) -> Value {
+        let line = self.lines.partition_point(|&start| start <= offset) - 1;
+        let source = self.unit.source();
+        let start = self.lines[line];
+        let character: usize = source[start..offset.min(source.len())]
+            .chars()
+            .map(char::len_utf16)
+            .sum();
+        json!({ "line": line, "character": character })
+    }
+
+    fn range(&self, span: Span) -> Value {
+        let range = span.range();
+        json!({ "start": self.position(range.start), "end": self.position(range.end) })
+    }
+
+    fn diagnostics(&self) -> Value {
+        let diagnostics: Vec<_> = (self.unit.errors())
+            .map(|error| {
+                json!({
+                    "range": self.range(*error.span()),
+                    "severity": 1,
+                    "source": "cgrammar",
+                    "message": error_message(error),
+                })
+            })
+            .collect();
+        Value::Array(diagnostics)
+    }
+
+    /// The file-scope names and the members of the document.
+    fn symbols(&self, uri: &str) -> Value {
+        let symbols: Vec<_> = (self.declarations.iter())
+            .filter(|declared| declared.depth == 0 || declared.kind == DeclaredKind::Member)
+            .map(|declared| {
+                let kind = match declared.kind {
+                    DeclaredKind::Function => 12,
+                    DeclaredKind::Object => 13,
+                    DeclaredKind::Typedef => 26,
+                    DeclaredKind::Tag => 23,
+                    DeclaredKind::Enumerator => 22,
+                    DeclaredKind::Member => 8,
+                };
+                json!({
+                    "name": declared.name.as_str(),
+                    "kind": kind,
+                    "location": { "uri": uri, "range": self.range(declared.span) },
+                })
+            })
+            .collect();
+        Value::Array(symbols)
+    }
+
+    /// The declaration of the identifier at `offset`: the last one before it
+    /// in the same external declaration, or else the first at file scope.
+    /// After `.` or `->`, only members are looked for.
+    fn definition(&self, offset: usize) -> Option<Declared> {
+        let (name, member) = identifier_at(self.unit.tokens(), offset)?;
+        let candidates: Vec<_> = (self.declarations.lookup(name.0))
+            .filter(|declared| !member || declared.kind == DeclaredKind::Member)
+            .collect();
+        let enclosing = (self.unit.external_declarations())
+            .map(|d| match d {
+                ExternalDeclaration::Function(f) => f.span,
+                ExternalDeclaration::Declaration(d) => d.span,
+            })
+            .find(|span| span.range().contains(&offset));
+        let local = enclosing.and_then(|enclosing| {
+            (candidates.iter())
+                .filter(|declared| declared.depth > 0 && enclosing.range().contains(&declared.span.range().start))
+                .take_while(|declared| declared.span.range().start <= offset)
+                .last()
+        });
+        local
+            .or_else(|| candidates.iter().find(|declared| declared.depth == 0 || member))
+            .copied()
+    }
+}
+
+/// The identifier whose token contains `offset`, at any depth of `tokens`,
+/// and whether it follows `.` or `->`.
+fn identifier_at(tokens: &BalancedTokenSequence, offset: usize) -> Option<(cgrammar::Identifier, bool)> {
+    let mut tokens = tokens.tokens.as_slice();
+    loop {
+        let i = tokens.partition_point(|token| token.span.range().end < offset);
+        let token = tokens.get(i).filter(|token| token.span.range().start <= offset)?;
+        match &token.value {
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                tokens = &inner.tokens
+            }
+            BalancedToken::Identifier(identifier) => {
+                let member = i.checked_sub(1).is_some_and(|prev| {
+                    matches!(
+                        tokens[prev].value,
+                        BalancedToken::Punctuator(Punctuator::Dot | Punctuator::Arrow)
+                    )
+                });
+                return Some((*identifier, member));
+            }
+            _ => return None,
+        }
+    }
+}
+
+#[derive(Default)]
+struct Server {
+    documents: HashMap<String, Document>,
+    shutdown: bool,
+}
+
+impl Server {
+    /// Serve the messages of the standard input until `exit`. Returns whether
+    /// `shutdown` came first.
+    fn run(mut self) -> io::Result<bool> {
+        let (sender, receiver) = mpsc::channel();
+        thread::spawn(move || {
+            let mut stdin = io::stdin().lock();
+            while let Ok(Some(message)) = read_message(&mut stdin) {
+                if sender.send(message).is_err() {
+                    break;
+                }
+            }
+        });
+
+        let mut out = io::stdout().lock();
+        while let Ok(first) = receiver.recv() {
+            let messages: Vec<_> = [first].into_iter().chain(receiver.try_iter()).collect();
+            let cancelled: HashSet<String> = (messages.iter())
+                .filter(|message| message["method"] == "$/cancelRequest")
+                .map(|message| message["params"]["id"].to_string())
+                .collect();
+            let mut changed = Vec::new();
+            for message in &messages {
+                let method = message["method"].as_str().unwrap_or("");
+                if method == "exit" {
+                    return Ok(self.shutdown);
+                }
+                let params = &message["params"];
+                let Some(id) = message.get("id") else {
+                    if let Some(uri) = self.notify(method, params) {
+                        changed.push(uri);
+                    }
+                    continue;
+                };
+                let response = if cancelled.contains(&id.to_string()) {
+                    json!({ "jsonrpc": "2.0", "id": id, "error": { "code": REQUEST_CANCELLED, "message": "cancelled" } })
+                } else {
+                    match self.request(method, params) {
+                        Some(result) => json!({ "jsonrpc": "2.0", "id": id, "result": result }),
+                        None => json!({
+                            "jsonrpc": "2.0",
+                            "id": id,
+                            "error": { "code": METHOD_NOT_FOUND, "message": format!("unknown method {method}") },
+                        }),
+                    }
+                };
+                write_message(&mut out, &response)?;
+            }
+            changed.sort();
+            changed.dedup();
+            for uri in changed {
+                let diagnostics = self.documents.get(&uri).map_or(json!([]), Document::diagnostics);
+                let notification = json!({
+                    "jsonrpc": "2.0",
+                    "method": "textDocument/publishDiagnostics",
+                    "params": { "uri": uri, "diagnostics": diagnostics },
+                });
+                write_message(&mut out, &notification)?;
+            }
+        }
+        Ok(false)
+    }
+
+    /// Handle a notification. Returns the document it changed, if any.
+    fn notify(&mut self, method: &str, params: &Value) -> Option<String> {
+        let uri = params["textDocument"]["uri"].as_str()?.to_string();
+        match method {
+            "textDocument/didOpen" => {
+                let text = params["textDocument"]["text"].as_str()?.to_string();
+                let filename = uri.strip_prefix("file://").unwrap_or(&uri);
+                let document = Document::new(text, filename);
+                self.documents.insert(uri.clone(), document);
+            }
+            "textDocument/didChange" => {
+                let document = self.documents.get_mut(&uri)?;
+                for change in params["contentChanges"].as_array()? {
+                    let range = change.get("range").and_then(|range| {
+                        let start = document.offset(&range["start"])?;
+                        Some(start..document.offset(&range["end"])?.max(start))
+                    });
+                    document.edit(range, change["text"].as_str()?);
+                }
+            }
+            "textDocument/didClose" => {
+                self.documents.remove(&uri);
+            }
+            _ => return None,
+        }
+        Some(uri)
+    }
+
+    /// Answer a request, or `None` if the method is unknown.
+    fn request(&mut self, method: &str, params: &Value) -> Option<Value> {
+        let document = || self.documents.get(params["textDocument"]["uri"].as_str()?);
+        Some(match method {
+            "initialize" => json!({
+                "capabilities": {
+                    "textDocumentSync": { "openClose": true, "change": 2 },
+                    "documentSymbolProvider": true,
+                    "definitionProvider": true,
+                },
+                "serverInfo": { "name": "cgrammar-lsp", "version": env!("CARGO_PKG_VERSION") },
+            }),
+            "shutdown" => {
+                self.shutdown = true;
+                Value::Null
+            }
+            "textDocument/documentSymbol" => {
+                let uri = params["textDocument"]["uri"].as_str().unwrap_or("");
+                document().map_or(Value::Null, |document| document.symbols(uri))
+            }
+            "textDocument/definition" => document()
+                .and_then(|document| {
+                    let offset = document.offset(&params["position"])?;
+                    let declared = document.definition(offset)?;
+                    let uri = &params["textDocument"]["uri"];
+                    Some(json!({ "uri": uri, "range": document.range(declared.span) }))
+                })
+                .unwrap_or(Value::Null),
+            _ => return None,
+        })
+    }
+}
+
+/// Read one message, or `None` at the end of the input.
+fn read_message(input: &mut impl BufRead) -> io::Result<Option<Value>> {
+    let mut length = None;
+    let mut line = String::new();
+    loop {
+        line.clear();
+        if input.read_line(&mut line)? == 0 {
+            return Ok(None);
+        }
+        let line = line.trim_end();
+        if line.is_empty() {
+            break;
+        }
+        if let Some((name, value)) = line.split_once(':')
+            && name.eq_ignore_ascii_case("content-length")
+        {
+            length = value.trim().parse().ok();
+        }
+    }
+    let length = length.ok_or_else(|| io::Error::new(io::ErrorKind::InvalidData, "no Content-Length"))?;
+    let mut body = vec![0; length];
+    input.read_exact(&mut body)?;
+    serde_json::from_slice(&body).map(Some).map_err(io::Error::other)
+}
+
+fn write_message(out: &mut impl Write, message: &Value) -> io::Result<()> {
+    let body = message.to_string();
+    write!(out, "Content-Length: {}\r\n\r\n{body}", body.len())?;
+    out.flush()
+}
+
+/// Open `file` and time `edits` edits of it and requests on it.
+fn run_bench(file: &str, edits: usize) -> io::Result<bool> {
+    let text = fs::read_to_string(file)?;
+    let start = Instant::now();
+    let mut document = Document::new(text, file);
+    println!(
+        "{file}: {} lines, {} names, opened in {:.2?}",
+        document.lines.len(),
+        document.declarations.len(),
+        start.elapsed()
+    );
+
+    let (mut edit_times, mut symbol_times, mut definition_times) = (Vec::new(), Vec::new(), Vec::new());
+    let lines = document.lines.len();
+    for i in 0..edits {
+        // Insert a space at the start of a line spread over the file, and
+        // remove it again with the next edit
+        let line = (i / 2).wrapping_mul(7919) % lines;
+        let offset = document.lines[line];
+        let range = if i % 2 == 0 { offset..offset } else { offset..offset + 1 };
+        let text = if i % 2 == 0 { " " } else { "" };
+        let start = Instant::now();
+        document.edit(Some(range), text);
+        std::hint::black_box(document.diagnostics());
+        edit_times.push(start.elapsed());
+
+        let start = Instant::now();
+        std::hint::black_box(document.symbols("file:///bench.c"));
+        symbol_times.push(start.elapsed());
+
+        let start = Instant::now();
+        std::hint::black_box(document.definition(offset + 1));
+        definition_times.push(start.elapsed());
+    }
+    for (name, times) in [
+        ("edit", &mut edit_times),
+        ("symbols", &mut symbol_times),
+        ("definition", &mut definition_times),
+    ] {
+        times.sort();
+        let at = |p: usize| times[(times.len() - 1) * p / 100];
+        println!(
+            "{name:>10}: p50 {:.2?}, p99 {:.2?}, max {:.2?}",
+            at(50),
+            at(99),
+            times.last().copied().unwrap_or(Duration::ZERO)
+        );
+    }
+    Ok(!document.unit.has_errors())
+}
@@ -0,0 +1,171 @@
+//! Compile-time quasi-quoting of C syntax trees for [`cgrammar`].
+//!
+//! [`quote!`] lexes and parses a C snippet when the crate using it is
+//! compiled, so syntax errors in templates are compile errors, and embeds the
+//! parsed template in the binary. At run time, the template is decoded once
+//! per thread and each use only substitutes its `@name` slots, without lexing
+//! or parsing:
+//!
+//! ```ignore
+//! use cgrammar::*;
+//! use cgrammar_quote::quote;
+//!
+//! let unit: TranslationUnit = quote!(translation_unit: "int @name = @value;",
+//!     name => Identifier("x".into()),
+//!     value => Constant::Integer(1.into()),
+//! );
+//! ```
+//!
+//! The expansion refers to `cgrammar`, which must be a dependency of the
+//! crate using the macro, with the `quasi-quote` and `serde` features.
+
+use cgrammar::{Parser, quasi_quote::CompiledTemplate, serialize};
+use proc_macro::TokenStream;
+use syn::{
+    Expr, Ident, LitStr, Token,
+    parse::{Parse, ParseStream},
+    parse_macro_input,
+    punctuated::Punctuated,
+};
+
+/// A slot of the template and the Rust expression of its value.
+struct Binding {
+    name: Ident,
+    value: Expr,
+}
+
+impl Parse for Binding {
+    fn parse(input: ParseStream) -> syn::Result<Self> {
+        let name = input.parse()?;
+        input.parse::<Token![=>]>()?;
+        let value = input.parse()?;
+        Ok(Self { name, value })
+    }
+}
+
+/// `parser: "code", name => value, ...`
+struct Quote {
+    parser: Ident,
+    code: LitStr,
+    bindings: Punctuated<Binding, Token![,]>,
+}
+
+impl Parse for Quote {
+    fn parse(input: ParseStream) -> syn::Result<Self> {
+        let parser = input.parse()?;
+        input.parse::<Token![:]>()?;
+        let code = input.parse()?;
+        let bindings = if input.parse::<Option<Token![,]>>()?.is_some() {
+            Punctuated::parse_terminated(input)?
+        } else {
+            Punctuated::new()
+        };
+        Ok(Self { parser, code, bindings })
+    }
+}
+
+/// A template compiled by the macro.
+struct Compiled {
+    /// The template, encoded by [`serialize::encode_tree`].
+    bytes: Vec<u8>,
+    slots: Vec<&'static str>,
+    /// The type of the syntax tree.
+    ty: proc_macro2::TokenStream,
+}
+
+/// Compile `code` as a template of the syntax tree parsed by `parser`.
+fn compile(parser: &str, code: &str) -> Result<Compiled, String> {
+    macro_rules! parsers {
+        ($($name:ident => $ty:ident),* $(,)?) => {
+            match parser {
+                $(stringify!($name) => {
+                    let template = CompiledTemplate::<cgrammar::$ty>::compile(code, |tokens| {
+                        cgrammar::$name()
+                            .parse(tokens.as_input())
+                            .into_result()
+                            .map_err(|errors| errors.iter().map(ToString::to_string).collect::<Vec<_>>().join("; "))
+                    })?;
+                    Ok(Compiled {
+                        bytes: serialize::encode_tree(&template).map_err(|err| err.to_string())?,
+                        slots: template.slots().collect(),
+                        ty: quote::quote!(::cgrammar::$ty),
+                    })
+                })*
+                _ => Err(format!(
+                    "unknown parser `{parser}`, expected one of {}",
+                    [$(stringify!($name)),*].join(", ")
+                )),
+            }
+        };
+    }
+
+    parsers! {
+        translation_unit => TranslationUnit,
+        external_declaration => ExternalDeclaration,
+        function_definition => FunctionDefinition,
+        declaration => Declaration,
+        block_item => BlockItem,
+        statement => Statement,
+        expression => Expression,
+        initializer => Initializer,
+        designated_initializer => DesignatedInitializer,
+        type_name => TypeName,
+    }
+}
+
+/// Build a C syntax tree from a template parsed at compile time.
+///
+/// The input is the name of a `cgrammar` parser, the template, and a value
+/// for each `@name` slot of the template, as for
+/// [`CompiledTemplate`](cgrammar::quasi_quote::CompiledTemplate):
+/// `quote!(statement: "return @value;", value => expression)`. Templates that
+/// do not parse, and slots without a value or values without a slot, are
+/// compile errors. The macro panics if a value cannot fill its slot.
+#[proc_macro]
+pub fn quote(input: TokenStream) -> TokenStream {
+    let Quote { parser, code, bindings } = parse_macro_input!(input as Quote);
+    let compiled = match compile(&parser.to_string(), &code.value()) {
+        Ok(compiled) => compiled,
+        Err(message) => return syn::Error::new(code.span(), message).to_compile_error().into(),
+    };
+
+    let mut errors = Vec::new();
+    for slot in &compiled.slots {
+        if !bindings.iter().any(|binding| binding.name == *slot) {
+            errors.push(syn::Error::new(
+                code.span(),
+                format!("template slot `{slot}` not given"),
+            ));
+        }
+    }
+    for binding in &bindings {
+        if !compiled.slots.iter().any(|slot| binding.name == *slot) {
+            errors.push(syn::Error::new(
+                binding.name.span(),
+                format!("no template slot `{}`", binding.name),
+            ));
+        }
+    }
+    if let Some(error) = errors.into_iter().reduce(|mut all, error| {
+        all.combine(error);
+        all
+    }) {
+        return error.to_compile_error().into();
+    }
+
+    let Compiled { bytes, ty, .. } = compiled;
+    let bytes = proc_macro2::Literal::byte_string(&bytes);
+    let names = bindings.iter().map(|binding| &binding.name);
+    let values = bindings.iter().map(|binding| &binding.value);
+    quote::quote! {{
+        ::std::thread_local! {
+            static TEMPLATE: ::cgrammar::quasi_quote::CompiledTemplate<#ty> =
+                ::cgrammar::serialize::decode_tree(#bytes)
+                    .expect("Template is encoded by the same version of cgrammar");
+        }
+        TEMPLATE
+            .with(|template| template.instantiate(::cgrammar::interpolate! { #(#names => #values),* }))
+            .unwrap_or_else(|err| panic!("{err}"))
+    }}
+    .into()
+}
@@ -0,0 +1,34 @@
+use cgrammar::{quasi_quote::CompiledTemplate, *};
+use cgrammar_quote::quote;
+
+#[test]
+fn test_quote() {
+    const CODE: &str = "int @name = @value; int g(void) { return @name + 1; }";
+    let runtime = CompiledTemplate::compile(CODE, |tokens| {
+        translation_unit()
+            .parse(tokens.as_input())
+            .into_result()
+            .map_err(|errors| format!("{errors:?}"))
+    })
+    .unwrap();
+
+    for value in 0..3i128 {
+        let unit: TranslationUnit = quote!(translation_unit: "int @name = @value; int g(void) { return @name + 1; }",
+            name => Identifier("x".into()),
+            value => Constant::Integer(value.into()),
+        );
+        let expected = runtime
+            .instantiate(interpolate! { name => Identifier("x".into()), value => Constant::Integer(value.into()) })
+            .unwrap();
+        assert_eq!(unit, expected);
+    }
+}
+
+#[test]
+fn test_quote_without_slots() {
+    let statement: Statement = quote!(statement: "return 0;");
+    assert!(matches!(
+        statement.kind,
+        StatementKind::Unlabeled(UnlabeledStatement::Jump { .. })
+    ));
+}
@@ -0,0 +1,358 @@
+//! A chunked bump allocator for parsing and discarding many syntax trees.
+//!
+//! The AST is made of many small boxes and vectors, so when translation units
+//! are parsed and dropped in a loop, the allocator dominates. [`ArenaAlloc`]
+//! serves small allocations by bumping a pointer in a chunk owned by the
+//! current thread, and frees memory a whole chunk at a time: freeing an
+//! allocation only decrements the live count of its chunk. Once every
+//! allocation in the current chunk is freed, e.g. after a translation unit is
+//! dropped, the chunk is reset and reused in place.
+//!
+//! Install it as the global allocator:
+//!
+//! ```
+//! use cgrammar::arena::ArenaAlloc;
+//!
+//! #[global_allocator]
+//! static ALLOC: ArenaAlloc = ArenaAlloc::new();
+//! # fn main() {}
+//! ```
+//!
+//! A chunk stays alive while any allocation in it does, so long-lived
+//! allocations mixed with short-lived ones keep their whole chunk around.
+//! Work whose allocations are all short-lived, such as the errors and
+//! discarded alternatives of a parse that is only validated, can run in
+//! [`scratch`], which keeps them in a chunk of their own:
+//!
+//! ```ignore
+//! let ok = cgrammar::arena::scratch(|| cgrammar::validate(&tokens, &mut state).is_ok());
+//! ```
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+    ptr,
+    sync::atomic::{AtomicUsize, Ordering, fence},
+};
+
+/// Size and alignment of a chunk.
+const CHUNK_SIZE: usize = 256 * 1024;
+
+const CHUNK_LAYOUT: Layout = match Layout::from_size_align(CHUNK_SIZE, CHUNK_SIZE) {
+    Ok(layout) => layout,
+    Err(_) => panic!("Invalid chunk layout"),
+};
+
+/// Allocations larger than this, or more aligned, go to the system allocator.
+const MAX_SMALL_SIZE: usize = CHUNK_SIZE / 16;
+const MAX_SMALL_ALIGN: usize = 4096;
+
+/// Offset of the first allocation in a chunk.
+const DATA_START: usize = size_of::<Header>();
+
+/// A global allocator that bump-allocates small allocations in chunks.
+///
+/// See the [module documentation](self).
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ArenaAlloc;
+
+impl ArenaAlloc {
+    /// Create the allocator.
+    pub const fn new() -> Self {
+        Self
+    }
+}
+
+/// Header at the start of each chunk.
+struct Header {
+    /// Live allocations in the chunk, plus one while it is the current chunk
+    /// of its thread.
+    live: AtomicUsize,
+}
+
+/// The chunk the current thread allocates from.
+struct Current {
+    chunk: Cell<*mut Header>,
+    /// End of the allocated part of the chunk.
+    offset: Cell<usize>,
+}
+
+impl Drop for Current {
+    fn drop(&mut self) {
+        let chunk = self.chunk.replace(ptr::null_mut());
+        if !chunk.is_null() {
+            unsafe { release(chunk) }
+        }
+    }
+}
+
+thread_local! {
+    static CURRENT: Current = const {
+        Current {
+            chunk: Cell::new(ptr::null_mut()),
+            offset: Cell::new(0),
+        }
+    };
+    /// The chunk allocated from in [`scratch`].
+    static SCRATCH: Current = const {
+        Current {
+            chunk: Cell::new(ptr::null_mut()),
+            offset: Cell::new(0),
+        }
+    };
+    /// Set while `CURRENT` is in use, in case registering its destructor allocates.
+    static BUSY: Cell<bool> = const { Cell::new(false) };
+    /// Set while the thread is in [`scratch`].
+    static IN_SCRATCH: Cell<bool> = const { Cell::new(false) };
+}
+
+/// Run `f`, taking the small allocations it makes on this thread from a
+/// scratch chunk, apart from the chunk of other allocations.
+///
+/// A scratch region starts again at the beginning of the scratch chunk if
+/// everything allocated in earlier regions has been freed, so a loop of
+/// short-lived work, e.g. validating a file after each keystroke, reuses the
+/// same memory. Allocations that outlive the region are still valid; they
+/// only keep their chunk from being reused. Without [`ArenaAlloc`] as the
+/// global allocator, this only runs `f`.
+pub fn scratch<R>(f: impl FnOnce() -> R) -> R {
+    struct Leave(bool);
+
+    impl Drop for Leave {
+        fn drop(&mut self) {
+            let _ = IN_SCRATCH.try_with(|in_scratch| in_scratch.set(self.0));
+        }
+    }
+
+    let _leave = Leave(IN_SCRATCH.with(|in_scratch| in_scratch.replace(true)));
+    let _ = SCRATCH.try_with(|scratch| {
+        let chunk = scratch.chunk.get();
+        if !chunk.is_null() && unsafe { (*chunk).live.load(Ordering::Acquire) } == 1 {
+            scratch.offset.set(DATA_START);
+        }
+    });
+    f()
+}
+
+fn is_small(layout: Layout) -> bool {
+    layout.size() <= MAX_SMALL_SIZE && layout.align() <= MAX_SMALL_ALIGN
+}
+
+fn chunk_of(ptr: *mut u8) -> *mut Header {
+    ptr.map_addr(|addr| addr & !(CHUNK_SIZE - 1)).cast()
+}
+
+/// Allocate a chunk holding `live` references.
+unsafe fn new_chunk(live: usize) -> *mut Header {
+    let chunk = unsafe { System.alloc(CHUNK_LAYOUT) }.cast::<Header>();
+    if !chunk.is_null() {
+        unsafe { chunk.write(Header { live: AtomicUsize::new(live) }) }
+    }
+    chunk
+}
+
+/// Drop one reference to `chunk`, freeing it if it was the last.
+unsafe fn release(chunk: *mut Header) {
+    if unsafe { (*chunk).live.fetch_sub(1, Ordering::Release) } == 1 {
+        fence(Ordering::Acquire);
+        unsafe { System.dealloc(chunk.cast(), CHUNK_LAYOUT) }
+    }
+}
+
+/// Allocate in a chunk of its own, for when the thread-local chunk cannot be
+/// used.
+unsafe fn alloc_alone(layout: Layout) -> *mut u8 {
+    let chunk = unsafe { new_chunk(1) };
+    if chunk.is_null() {
+        return ptr::null_mut();
+    }
+    unsafe { chunk.cast::<u8>().add(DATA_START.next_multiple_of(layout.align())) }
+}
+
+/// Run `f` on the current chunk, or the scratch chunk in [`scratch`], unless
+/// it is unavailable or already in use.
+fn with_current<R>(f: impl FnOnce(&Current) -> R) -> Option<R> {
+    if BUSY.replace(true) {
+        return None;
+    }
+    let current = if IN_SCRATCH.get() { &SCRATCH } else { &CURRENT };
+    let result = current.try_with(f).ok();
+    BUSY.set(false);
+    result
+}
+
+impl Current {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let chunk = self.chunk.get();
+        if !chunk.is_null()
+            && let Some(ptr) = unsafe { self.bump(chunk, layout) }
+        {
+            return ptr;
+        }
+        // Reuse the chunk in place if all its allocations are freed
+        if chunk.is_null() || unsafe { (*chunk).live.load(Ordering::Acquire) } != 1 {
+            if !chunk.is_null() {
+                unsafe { release(chunk) }
+            }
+            let chunk = unsafe { new_chunk(1) };
+            self.chunk.set(chunk);
+            if chunk.is_null() {
+                return ptr::null_mut();
+            }
+        }
+        self.offset.set(DATA_START);
+        unsafe { self.bump(self.chunk.get(), layout) }.unwrap_or(ptr::null_mut())
+    }
+
+    unsafe fn bump(&self, chunk: *mut Header, layout: Layout) -> Option<*mut u8> {
+        let start = self.offset.get().next_multiple_of(layout.align());
+        let end = start + layout.size();
+        if end > CHUNK_SIZE {
+            return None;
+        }
+        self.offset.set(end);
+        unsafe { (*chunk).live.fetch_add(1, Ordering::Relaxed) };
+        Some(unsafe { chunk.cast::<u8>().add(start) })
+    }
+
+    /// Offset of `ptr` in the current chunk, if it is the last allocation.
+    fn last_offset(&self, ptr: *mut u8, size: usize) -> Option<usize> {
+        let chunk = self.chunk.get();
+        if chunk.is_null() || chunk_of(ptr) != chunk {
+            return None;
+        }
+        let start = ptr.addr() - chunk.addr();
+        (start + size == self.offset.get()).then_some(start)
+    }
+
+    /// Resize the last allocation in place.
+    fn resize_last(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> bool {
+        match self.last_offset(ptr, layout.size()) {
+            Some(start) if start + new_size <= CHUNK_SIZE => {
+                self.offset.set(start + new_size);
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Give the space of the last allocation back to the chunk.
+    fn unbump(&self, ptr: *mut u8, layout: Layout) {
+        if let Some(start) = self.last_offset(ptr, layout.size()) {
+            self.offset.set(start);
+        }
+    }
+}
+
+unsafe impl GlobalAlloc for ArenaAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        if !is_small(layout) {
+            return unsafe { System.alloc(layout) };
+        }
+        with_current(|current| unsafe { current.alloc(layout) }).unwrap_or_else(|| unsafe { alloc_alone(layout) })
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        if !is_small(layout) {
+            return unsafe { System.dealloc(ptr, layout) };
+        }
+        with_current(|current| current.unbump(ptr, layout));
+        unsafe { release(chunk_of(ptr)) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let new_layout = unsafe { Layout::from_size_align_unchecked(new_size, layout.align()) };
+        if is_small(layout) && is_small(new_layout) {
+            if with_current(|current| current.resize_last(ptr, layout, new_size)) == Some(true) {
+                return ptr;
+            }
+        } else if !is_small(layout) && !is_small(new_layout) {
+            return unsafe { System.realloc(ptr, layout, new_size) };
+        }
+        let new_ptr = unsafe { self.alloc(new_layout) };
+        if !new_ptr.is_null() {
+            unsafe {
+                ptr::copy_nonoverlapping(ptr, new_ptr, layout.size().min(new_size));
+                self.dealloc(ptr, layout);
+            }
+        }
+        new_ptr
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use std::alloc::{GlobalAlloc, Layout};
+
+    use super::{ArenaAlloc, chunk_of, scratch};
+
+    #[test]
+    fn test_bump_and_reuse() {
+        let alloc = ArenaAlloc::new();
+        let layout = Layout::new::<[u64; 4]>();
+        unsafe {
+            let a = alloc.alloc(layout);
+            let b = alloc.alloc(layout);
+            assert_eq!(chunk_of(a), chunk_of(b));
+            assert_eq!(b, a.add(layout.size()));
+            a.write_bytes(1, layout.size());
+            b.write_bytes(2, layout.size());
+
+            // The last allocation grows in place
+            let b = alloc.realloc(b, layout, 64);
+            assert_eq!(b, a.add(layout.size()));
+            assert_eq!(*b, 2);
+
+            alloc.dealloc(b, Layout::from_size_align(64, layout.align()).unwrap());
+            let c = alloc.alloc(layout);
+            assert_eq!(c, a.add(layout.size()));
+            alloc.dealloc(c, layout);
+            alloc.dealloc(a, layout);
+        }
+    }
+
+    #[test]
+    fn test_scratch() {
+        let alloc = ArenaAlloc::new();
+        let layout = Layout::new::<[u64; 4]>();
+        unsafe {
+            let a = alloc.alloc(layout);
+            let first = scratch(|| alloc.alloc(layout));
+            assert_ne!(chunk_of(a), chunk_of(first));
+            let b = alloc.alloc(layout);
+            assert_eq!(b, a.add(layout.size()));
+
+            // Once freed, the next region starts the scratch chunk again
+            let held = scratch(|| alloc.alloc(layout));
+            alloc.dealloc(first, layout);
+            let second = scratch(|| alloc.alloc(layout));
+            assert_eq!(second, held.add(layout.size()));
+            alloc.dealloc(held, layout);
+            alloc.dealloc(second, layout);
+            let third = scratch(|| alloc.alloc(layout));
+            assert_eq!(third, first);
+
+            alloc.dealloc(third, layout);
+            alloc.dealloc(b, layout);
+            alloc.dealloc(a, layout);
+        }
+    }
+
+    struct SendPtr(*mut u8);
+
+    unsafe impl Send for SendPtr {}
+
+    #[test]
+    fn test_free_on_other_thread() {
+        let alloc = ArenaAlloc::new();
+        let layout = Layout::new::<[u8; 1024]>();
+        let ptrs: Vec<_> = (0..1000).map(|_| SendPtr(unsafe { alloc.alloc(layout) })).collect();
+        std::thread::spawn(move || {
+            for SendPtr(ptr) in ptrs {
+                unsafe { alloc.dealloc(ptr, layout) }
+            }
+        })
+        .join()
+        .unwrap();
+    }
+}
@@ -1,13 +1,27 @@
 //! <https://www.open-std.org/jtc1/sc22/wg14/www/docs/n3096.pdf>
 #![allow(missing_docs)]
 
-use std::{fmt, sync::Arc};
+use std::{
+    borrow::Cow,
+    fmt,
+    hash::{Hash, Hasher},
+    sync::{Arc, OnceLock},
+};
 
 #[cfg(feature = "dbg-pls")]
 use dbg_pls::DebugPls;
 use ordered_float::NotNan;
-
-use crate::span::{Span, Spanned};
+#[cfg(feature = "serde")]
+use serde::{Deserialize, Serialize};
+
+use crate::{
+    attributes::AttributeValue,
+    context::State,
+    parser::Dialect,
+    parser_utils::Error,
+    span::{Span, Spanned},
+    symbol::Symbol,
+};
 
 // =============================================================================
 // Spanned Type Aliases
@@ -36,9 +50,10 @@ pub type Ident = Spanned<Identifier>;
 // =============================================================================
 
 /// Identifier (6.4.2.1)
-#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
-pub struct Identifier(pub Arc<str>);
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct Identifier(pub Symbol);
 
 impl fmt::Display for Identifier {
     fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
@@ -54,13 +69,20 @@ impl From<&str> for Identifier {
 
 impl AsRef<str> for Identifier {
     fn as_ref(&self) -> &str {
-        &self.0
+        self.0.as_str()
     }
 }
 
 /// Constants (6.4.4)
-#[derive(Debug, Clone, PartialEq, Eq)]
-#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+///
+/// Numeric constants hold their parsed values. A constant is 32 bytes on
+/// 64-bit targets, which is what a [`BalancedToken`] takes anyway for the
+/// string of [`BalancedToken::QuotedString`], so keeping only the kind of a
+/// constant and parsing its value from the source on demand would not make
+/// tokens smaller, and would make the tree depend on the source.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Constant {
     Integer(IntegerConstant),
     Floating(FloatingConstant),
@@ -69,22 +91,103 @@ pub enum Constant {
 }
 
 /// Integer constants (6.4.4.1)
-#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct IntegerConstant {
-    pub value: i128,
+    pub value: IntegerValue,
     pub suffix: Option<IntegerSuffix>,
 }
 
 impl From<i128> for IntegerConstant {
+    /// The constant of `value`, or of 0 if it is negative, as no constant is.
     fn from(value: i128) -> Self {
+        let value = match u64::try_from(value) {
+            Ok(value) => IntegerValue::Narrow(value),
+            Err(_) if value < 0 => IntegerValue::Narrow(0),
+            Err(_) => IntegerValue::Wide(value.to_string().into()),
+        };
         Self { value, suffix: None }
     }
 }
 
+/// The value of an integer constant.
+///
+/// Only bit-precise constants can be wider than a `u64`, so the value is
+/// inline up to `u64::MAX` and kept as text beyond it, which loses no bits
+/// whatever the width of the constant. A `u64` rather than a `u128` keeps
+/// the constant 8-byte aligned, so that it does not widen every token and
+/// expression to 16 bytes of alignment.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub enum IntegerValue {
+    /// A value up to `u64::MAX`.
+    Narrow(u64),
+    /// A wider value, as written without its suffix, e.g.
+    /// `0x1'0000'0000'0000'0000`. Values of this form are never at most
+    /// `u64::MAX`, and compare by their text.
+    Wide(Box<str>),
+}
+
+impl Default for IntegerValue {
+    fn default() -> Self {
+        Self::Narrow(0)
+    }
+}
+
+impl From<u64> for IntegerValue {
+    fn from(value: u64) -> Self {
+        Self::Narrow(value)
+    }
+}
+
+impl IntegerValue {
+    /// The value, if it is at most `u64::MAX`.
+    pub fn as_u64(&self) -> Option<u64> {
+        match self {
+            Self::Narrow(value) => Some(*value),
+            Self::Wide(_) => None,
+        }
+    }
+
+    /// The value, if it is at most `u128::MAX`.
+    pub fn to_u128(&self) -> Option<u128> {
+        let text = match self {
+            Self::Narrow(value) => return Some((*value).into()),
+            Self::Wide(text) => &**text,
+        };
+        let (digits, radix) = match text.as_bytes() {
+            [b'0', b'x' | b'X', ..] => (&text[2..], 16),
+            [b'0', b'b' | b'B', ..] => (&text[2..], 2),
+            [b'0', b'o' | b'O', ..] => (&text[2..], 8),
+            [b'0', ..] => (text, 8),
+            _ => (text, 10),
+        };
+        digits
+            .bytes()
+            .filter(|&byte| byte != b'\'')
+            .try_fold(0u128, |value, byte| {
+                let digit = (byte as char).to_digit(radix)?;
+                value.checked_mul(radix.into())?.checked_add(digit.into())
+            })
+    }
+}
+
+impl fmt::Display for IntegerValue {
+    /// Narrow values in decimal, and wide ones as written.
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            Self::Narrow(value) => write!(f, "{value}"),
+            Self::Wide(text) => f.write_str(text),
+        }
+    }
+}
+
 /// Integer suffixes (6.4.4.1)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum IntegerSuffix {
     Unsigned,
     Long,
@@ -96,7 +199,8 @@ pub enum IntegerSuffix {
 }
 
 /// Floating-point constants (6.4.4.2)
-#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct FloatingConstant {
     pub value: NotNan<f64>,
     pub suffix: Option<FloatingSuffix>,
@@ -122,8 +226,9 @@ impl DebugPls for FloatingConstant {
 }
 
 /// Floating-point suffixes (6.4.4.2)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum FloatingSuffix {
     F,
     L,
@@ -133,8 +238,9 @@ pub enum FloatingSuffix {
 }
 
 /// Character constants (6.4.4.4)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct CharacterConstant {
     pub encoding_prefix: Option<EncodingPrefix>,
     pub value: String,
@@ -150,8 +256,9 @@ impl From<char> for CharacterConstant {
 }
 
 /// Encoding prefixes (6.4.4.4)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum EncodingPrefix {
     U8,
     U,
@@ -160,8 +267,9 @@ pub enum EncodingPrefix {
 }
 
 /// Predefined constants (6.4.4.5)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum PredefinedConstant {
     False,
     True,
@@ -175,13 +283,91 @@ impl From<bool> for PredefinedConstant {
 }
 
 /// Concatenation of string literals (6.4.5)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct StringLiterals(pub Vec<StringLiteral>);
 
 impl StringLiterals {
+    /// The value of the concatenation, in a new string.
     pub fn to_joined(&self) -> String {
-        self.0.iter().map(|s| s.value.as_str()).collect::<Vec<_>>().join("")
+        self.concatenated().into_value().into_owned()
+    }
+
+    /// The value of the concatenation, laid out once in one buffer, with the
+    /// boundaries of the pieces kept.
+    ///
+    /// A single piece, the common case, is borrowed rather than copied, and
+    /// the pieces of a longer concatenation, e.g. a format string built from
+    /// `PRIx64`-style macros, are copied once into a buffer of the total size.
+    pub fn concatenated(&self) -> Concatenated<'_> {
+        let prefix = self.0.iter().find_map(|literal| literal.encoding_prefix);
+        match self.0.as_slice() {
+            [] => Concatenated {
+                value: Cow::Borrowed(""),
+                pieces: 0,
+                ends: Vec::new(),
+                prefix,
+            },
+            [literal] => Concatenated {
+                value: Cow::Borrowed(&literal.value),
+                pieces: 1,
+                ends: Vec::new(),
+                prefix,
+            },
+            literals => {
+                let mut value = String::with_capacity(literals.iter().map(|literal| literal.value.len()).sum());
+                let mut ends = Vec::with_capacity(literals.len());
+                for literal in literals {
+                    value.push_str(&literal.value);
+                    ends.push(value.len());
+                }
+                Concatenated {
+                    value: Cow::Owned(value),
+                    pieces: literals.len(),
+                    ends,
+                    prefix,
+                }
+            }
+        }
+    }
+}
+
+/// The value of a concatenation of string literals, from
+/// [`StringLiterals::concatenated`].
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Concatenated<'a> {
+    value: Cow<'a, str>,
+    pieces: usize,
+    /// The end of each piece in `value`, if there are several.
+    ends: Vec<usize>,
+    prefix: Option<EncodingPrefix>,
+}
+
+impl<'a> Concatenated<'a> {
+    /// The value of the whole concatenation.
+    pub fn as_str(&self) -> &str {
+        &self.value
+    }
+
+    /// The value, without copying it if it is borrowed.
+    pub fn into_value(self) -> Cow<'a, str> {
+        self.value
+    }
+
+    /// The encoding prefix of the concatenation, that of the first piece with
+    /// one.
+    pub fn encoding_prefix(&self) -> Option<EncodingPrefix> {
+        self.prefix
+    }
+
+    /// The values of the pieces, in order, as slices of the value.
+    pub fn pieces(&self) -> impl ExactSizeIterator<Item = &str> + '_ {
+        (0..self.pieces).map(|i| {
+            let start = i.checked_sub(1).map_or(0, |i| self.ends[i]);
+            let end = self.ends.get(i).copied().unwrap_or(self.value.len());
+            &self.value[start..end]
+        })
     }
 }
 
@@ -192,16 +378,28 @@ impl From<String> for StringLiterals {
 }
 
 /// String literal (6.4.5)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct StringLiteral {
     pub encoding_prefix: Option<EncodingPrefix>,
     pub value: String,
 }
 
+impl StringLiteral {
+    /// Decode the escape sequences of `body`, the text between the quotes of a
+    /// string literal, as the lexer does for [`StringLiteral::value`].
+    ///
+    /// A body without escape sequences is returned as is, without copying it.
+    pub fn unescape(body: &str) -> Cow<'_, str> {
+        crate::lexer::unescape(body)
+    }
+}
+
 /// Punctuators (6.4.6)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Punctuator {
     // Brackets
     LeftBracket,
@@ -261,8 +459,73 @@ pub enum Punctuator {
     HashHash,
 }
 
+impl Punctuator {
+    /// The spelling of the punctuator.
+    pub fn as_str(self) -> &'static str {
+        match self {
+            // Brackets
+            Punctuator::LeftBracket => "[",
+            Punctuator::RightBracket => "]",
+            Punctuator::LeftParen => "(",
+            Punctuator::RightParen => ")",
+            Punctuator::LeftBrace => "{",
+            Punctuator::RightBrace => "}",
+
+            // Operators
+            Punctuator::Dot => ".",
+            Punctuator::Arrow => "->",
+            Punctuator::Increment => "++",
+            Punctuator::Decrement => "--",
+            Punctuator::Ampersand => "&",
+            Punctuator::Star => "*",
+            Punctuator::Plus => "+",
+            Punctuator::Minus => "-",
+            Punctuator::Tilde => "~",
+            Punctuator::Bang => "!",
+            Punctuator::Slash => "/",
+            Punctuator::Percent => "%",
+            Punctuator::LeftShift => "<<",
+            Punctuator::RightShift => ">>",
+            Punctuator::Less => "<",
+            Punctuator::Greater => ">",
+            Punctuator::LessEqual => "<=",
+            Punctuator::GreaterEqual => ">=",
+            Punctuator::Equal => "==",
+            Punctuator::NotEqual => "!=",
+            Punctuator::Caret => "^",
+            Punctuator::Pipe => "|",
+            Punctuator::LogicalAnd => "&&",
+            Punctuator::LogicalOr => "||",
+            Punctuator::Question => "?",
+            Punctuator::Colon => ":",
+            Punctuator::Scope => "::",
+            Punctuator::Semicolon => ";",
+            Punctuator::Ellipsis => "...",
+
+            // Assignment
+            Punctuator::Assign => "=",
+            Punctuator::MulAssign => "*=",
+            Punctuator::DivAssign => "/=",
+            Punctuator::ModAssign => "%=",
+            Punctuator::AddAssign => "+=",
+            Punctuator::SubAssign => "-=",
+            Punctuator::LeftShiftAssign => "<<=",
+            Punctuator::RightShiftAssign => ">>=",
+            Punctuator::AndAssign => "&=",
+            Punctuator::XorAssign => "^=",
+            Punctuator::OrAssign => "|=",
+
+            // Other
+            Punctuator::Comma => ",",
+            Punctuator::Hash => "#",
+            Punctuator::HashHash => "##",
+        }
+    }
+}
+
 /// Balanced token sequence (6.4.4.3)
 #[derive(Debug, Clone, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct BalancedTokenSequence {
     pub tokens: Vec<Spanned<BalancedToken>>,
     pub closed: bool,
@@ -277,14 +540,19 @@ impl DebugPls for BalancedTokenSequence {
 }
 
 /// Balanced tokens (6.4.4.3)
-#[derive(Debug, Clone, PartialEq, Eq)]
+///
+/// Groups and string literals are shared, so that the syntax tree refers to
+/// the lexer's copy of attribute arguments and asm labels instead of copying
+/// them, and clones of the tokens are shallow.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum BalancedToken {
-    Parenthesized(BalancedTokenSequence),
-    Bracketed(BalancedTokenSequence),
-    Braced(BalancedTokenSequence),
+    Parenthesized(Arc<BalancedTokenSequence>),
+    Bracketed(Arc<BalancedTokenSequence>),
+    Braced(Arc<BalancedTokenSequence>),
     Identifier(Identifier),
-    StringLiteral(StringLiterals),
+    StringLiteral(Arc<StringLiterals>),
     /// extension syntax: `xxx` for quoted strings
     QuotedString(String),
     Constant(Constant),
@@ -292,6 +560,7 @@ pub enum BalancedToken {
     #[cfg(feature = "quasi-quote")]
     Template(quasi_quote::Template),
     #[cfg(feature = "quasi-quote")]
+    #[cfg_attr(feature = "serde", serde(skip))]
     Interpolation(Box<dyn quasi_quote::Interpolate + 'static>),
     Unknown, // For any other tokens not explicitly defined
 }
@@ -303,10 +572,12 @@ pub enum BalancedToken {
 /// Expression
 #[derive(Debug, Clone, PartialEq, Eq)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Expression {
     /// The kind of expression.
     pub kind: ExpressionKind,
     /// The source span of the expression.
+    #[cfg_attr(feature = "serde", serde(skip_serializing_if = "crate::serialize::omit_span"))]
     pub span: Span,
 }
 
@@ -320,11 +591,84 @@ impl Expression {
     pub fn dummy(kind: ExpressionKind) -> Self {
         Self { kind, span: Span::default() }
     }
+
+    /// Move the expression out, leaving an [`ExpressionKind::Error`] with the
+    /// same span in its place.
+    ///
+    /// Rewrites move subexpressions into the nodes that replace them with
+    /// this, instead of cloning them.
+    pub fn take(&mut self) -> Expression {
+        let placeholder = Self::new(ExpressionKind::Error, self.span);
+        std::mem::replace(self, placeholder)
+    }
+
+    /// Replace the expression with the result of `f` on it, moving it instead
+    /// of cloning it.
+    pub fn replace_with(&mut self, f: impl FnOnce(Expression) -> Expression) {
+        *self = f(self.take());
+    }
+
+    /// The postfix expression this expression is, through any cast or unary
+    /// wrappers standing for no operator.
+    pub fn as_postfix(&self) -> Option<&PostfixExpression> {
+        match &self.kind {
+            ExpressionKind::Postfix(p) => Some(p),
+            ExpressionKind::Unary(u) => u.as_postfix(),
+            ExpressionKind::Cast(c) => c.as_postfix(),
+            _ => None,
+        }
+    }
+
+    /// The primary expression this expression is, e.g. an identifier or a
+    /// constant.
+    pub fn as_primary(&self) -> Option<&PrimaryExpression> {
+        match self.as_postfix()? {
+            PostfixExpression::Primary(p) => Some(p),
+            _ => None,
+        }
+    }
+
+    /// The identifier this expression is.
+    pub fn as_identifier(&self) -> Option<&Identifier> {
+        match self.as_primary()? {
+            PrimaryExpression::Identifier(id) => Some(id),
+            _ => None,
+        }
+    }
+
+    /// The constant this expression is.
+    pub fn as_constant(&self) -> Option<&Constant> {
+        match self.as_primary()? {
+            PrimaryExpression::Constant(c) => Some(c),
+            _ => None,
+        }
+    }
+}
+
+impl ExpressionKind {
+    /// The kind of a cast expression, without the wrappers standing for no
+    /// operator, so that a bare operand is one [`ExpressionKind::Postfix`].
+    pub fn from_cast(c: CastExpression) -> Self {
+        match c {
+            CastExpression::Unary(u) => Self::from_unary(u),
+            c => Self::Cast(c),
+        }
+    }
+
+    /// The kind of a unary expression, without the wrapper of a postfix
+    /// expression.
+    pub fn from_unary(u: UnaryExpression) -> Self {
+        match u {
+            UnaryExpression::Postfix(p) => Self::Postfix(p),
+            u => Self::Unary(u),
+        }
+    }
 }
 
 /// Expression kinds
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ExpressionKind {
     Postfix(PostfixExpression),
     Unary(UnaryExpression),
@@ -337,8 +681,9 @@ pub enum ExpressionKind {
 }
 
 /// Primary expressions (6.5.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum PrimaryExpression {
     Identifier(Identifier),
     Constant(Constant),
@@ -351,16 +696,18 @@ pub enum PrimaryExpression {
 }
 
 /// Generic selection (6.5.1.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct GenericSelection {
     pub controlling_expression: Box<Expression>,
     pub associations: Vec<GenericAssociation>,
 }
 
 /// Generic association (6.5.1.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum GenericAssociation {
     Type {
         type_name: TypeName,
@@ -372,8 +719,9 @@ pub enum GenericAssociation {
 }
 
 /// Postfix expressions (6.5.2)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum PostfixExpression {
     Primary(PrimaryExpression),
     ArrayAccess {
@@ -394,12 +742,14 @@ pub enum PostfixExpression {
     },
     PostIncrement(Box<PostfixExpression>),
     PostDecrement(Box<PostfixExpression>),
-    CompoundLiteral(CompoundLiteral),
+    /// Boxed, as the largest and one of the rarest postfix expressions.
+    CompoundLiteral(Box<CompoundLiteral>),
 }
 
 /// Compound literals (6.5.2.5)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct CompoundLiteral {
     pub storage_class_specifiers: Vec<StorageClassSpecifier>,
     pub type_name: TypeName,
@@ -407,8 +757,9 @@ pub struct CompoundLiteral {
 }
 
 /// Unary expressions (6.5.3)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum UnaryExpression {
     Postfix(PostfixExpression),
     PreIncrement(Box<UnaryExpression>),
@@ -418,13 +769,26 @@ pub enum UnaryExpression {
         operand: Box<CastExpression>,
     },
     Sizeof(Box<UnaryExpression>),
-    SizeofType(TypeName),
-    Alignof(TypeName),
+    // Type names are boxed, as they are several times larger than the other
+    // variants, and every expression would have their size
+    SizeofType(Box<TypeName>),
+    Alignof(Box<TypeName>),
+}
+
+impl UnaryExpression {
+    /// The postfix expression this unary expression wraps without an operator.
+    pub fn as_postfix(&self) -> Option<&PostfixExpression> {
+        match self {
+            UnaryExpression::Postfix(p) => Some(p),
+            _ => None,
+        }
+    }
 }
 
 /// Unary operators (6.5.3)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum UnaryOperator {
     Address,
     Dereference,
@@ -435,19 +799,31 @@ pub enum UnaryOperator {
 }
 
 /// Cast expressions (6.5.4)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum CastExpression {
     Unary(UnaryExpression),
     Cast {
-        type_name: TypeName,
+        type_name: Box<TypeName>,
         expression: Box<CastExpression>,
     },
 }
 
+impl CastExpression {
+    /// The postfix expression this cast expression wraps without an operator.
+    pub fn as_postfix(&self) -> Option<&PostfixExpression> {
+        match self {
+            CastExpression::Unary(u) => u.as_postfix(),
+            CastExpression::Cast { .. } => None,
+        }
+    }
+}
+
 /// Binary expressions (6.5.14)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct BinaryExpression {
     pub left: Box<Expression>,
     pub operator: BinaryOperator,
@@ -455,8 +831,9 @@ pub struct BinaryExpression {
 }
 
 /// Binary operators (6.5.14)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum BinaryOperator {
     // Arithmetic
     Multiply,
@@ -486,8 +863,9 @@ pub enum BinaryOperator {
 }
 
 /// Conditional expressions (6.5.15)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct ConditionalExpression {
     pub condition: Box<Expression>,
     pub then_expr: Box<Expression>,
@@ -495,8 +873,9 @@ pub struct ConditionalExpression {
 }
 
 /// Assignment expressions (6.5.16)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct AssignmentExpression {
     pub left: Box<Expression>,
     pub operator: AssignmentOperator,
@@ -504,8 +883,9 @@ pub struct AssignmentExpression {
 }
 
 /// Assignment operators (6.5.16)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum AssignmentOperator {
     Assign,
     MulAssign,
@@ -521,15 +901,17 @@ pub enum AssignmentOperator {
 }
 
 /// Comma expressions (6.5.17)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct CommaExpression {
     pub expressions: Vec<Expression>,
 }
 
 /// Constant expressions (6.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ConstantExpression {
     Expression(Box<Expression>),
     Error,
@@ -542,10 +924,12 @@ pub enum ConstantExpression {
 /// Declarations (6.7)
 #[derive(Debug, Clone, PartialEq, Eq)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Declaration {
     /// The kind of declaration.
     pub kind: DeclarationKind,
     /// The source span of the declaration.
+    #[cfg_attr(feature = "serde", serde(skip_serializing_if = "crate::serialize::omit_span"))]
     pub span: Span,
 }
 
@@ -562,8 +946,9 @@ impl Declaration {
 }
 
 /// Declaration kinds
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum DeclarationKind {
     Normal {
         attributes: Vec<AttributeSpecifier>,
@@ -581,16 +966,18 @@ pub enum DeclarationKind {
 }
 
 /// Declaration specifiers (6.7)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct DeclarationSpecifiers {
     pub specifiers: Vec<DeclarationSpecifier>,
     pub attributes: Vec<AttributeSpecifier>,
 }
 
 /// Declaration specifiers (6.7)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum DeclarationSpecifier {
     StorageClass(StorageClassSpecifier),
     TypeSpecifierQualifier(TypeSpecifierQualifier),
@@ -598,16 +985,18 @@ pub enum DeclarationSpecifier {
 }
 
 /// Init declarators (6.7)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct InitDeclarator {
     pub declarator: Declarator,
     pub initializer: Option<Initializer>,
 }
 
 /// Storage class specifiers (6.7.1)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum StorageClassSpecifier {
     Auto,
     Constexpr,
@@ -619,8 +1008,9 @@ pub enum StorageClassSpecifier {
 }
 
 /// Type specifiers (6.7.2)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeSpecifier {
     Void,
     Char,
@@ -637,16 +1027,19 @@ pub enum TypeSpecifier {
     Decimal32,
     Decimal64,
     Decimal128,
-    Atomic(AtomicTypeSpecifier),
-    Struct(StructOrUnionSpecifier),
-    Enum(EnumSpecifier),
+    // Specifiers with a payload are boxed, so that the lists of specifiers
+    // of every declaration stay small
+    Atomic(Box<AtomicTypeSpecifier>),
+    Struct(Box<StructOrUnionSpecifier>),
+    Enum(Box<EnumSpecifier>),
     TypedefName(Identifier),
-    Typeof(TypeofSpecifier),
+    Typeof(Box<TypeofSpecifier>),
 }
 
 /// Struct or union specifiers (6.7.2.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct StructOrUnionSpecifier {
     pub kind: StructOrUnion,
     pub attributes: Vec<AttributeSpecifier>,
@@ -655,37 +1048,55 @@ pub struct StructOrUnionSpecifier {
 }
 
 /// Struct or union (6.7.2.1)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum StructOrUnion {
     Struct,
     Union,
 }
 
 /// Member declarations (6.7.2.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum MemberDeclaration {
     Normal {
         attributes: Vec<AttributeSpecifier>,
         specifiers: SpecifierQualifierList,
         declarators: Vec<MemberDeclarator>,
+        /// The source span of the member declaration.
+        #[cfg_attr(feature = "serde", serde(skip_serializing_if = "crate::serialize::omit_span"))]
+        span: Span,
     },
     StaticAssert(StaticAssertDeclaration),
     Error,
 }
 
+impl MemberDeclaration {
+    /// The source span of the member declaration, unless it is a static
+    /// assertion or an error.
+    pub fn span(&self) -> Option<Span> {
+        match self {
+            MemberDeclaration::Normal { span, .. } => Some(*span),
+            _ => None,
+        }
+    }
+}
+
 /// Specifier qualifier lists (6.7.2.1)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct SpecifierQualifierList {
     pub items: Vec<TypeSpecifierQualifier>,
     pub attributes: Vec<AttributeSpecifier>,
 }
 
 /// Type specifier qualifiers (6.7.2.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeSpecifierQualifier {
     TypeSpecifier(TypeSpecifier),
     TypeQualifier(TypeQualifier),
@@ -693,8 +1104,9 @@ pub enum TypeSpecifierQualifier {
 }
 
 /// Member declarators (6.7.2.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum MemberDeclarator {
     Declarator(Declarator),
     BitField {
@@ -704,8 +1116,9 @@ pub enum MemberDeclarator {
 }
 
 /// Enum specifiers (6.7.2.2)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct EnumSpecifier {
     pub attributes: Vec<AttributeSpecifier>,
     pub identifier: Option<Identifier>,
@@ -714,8 +1127,9 @@ pub struct EnumSpecifier {
 }
 
 /// Enumerator (6.7.2.2)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Enumerator {
     pub name: Identifier,
     pub attributes: Vec<AttributeSpecifier>,
@@ -723,22 +1137,25 @@ pub struct Enumerator {
 }
 
 /// Atomic type specifiers (6.7.2.4)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct AtomicTypeSpecifier {
     pub type_name: TypeName,
 }
 
 /// typeof specifiers (6.7.2.5)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeofSpecifier {
     Typeof(TypeofSpecifierArgument),
     TypeofUnqual(TypeofSpecifierArgument),
 }
 
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeofSpecifierArgument {
     Expression(Box<Expression>),
     TypeName(TypeName),
@@ -746,8 +1163,9 @@ pub enum TypeofSpecifierArgument {
 }
 
 /// Type qualifiers (6.7.3)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeQualifier {
     Const,
     Restrict,
@@ -759,24 +1177,27 @@ pub enum TypeQualifier {
 }
 
 /// Function specifiers (6.7.4)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum FunctionSpecifier {
     Inline,
     Noreturn,
 }
 
 /// Alignment specifiers (6.7.5)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum AlignmentSpecifier {
-    Type(TypeName),
+    Type(Box<TypeName>),
     Expression(ConstantExpression),
 }
 
 /// Declarators (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Declarator {
     Direct(DirectDeclarator),
     Pointer {
@@ -805,11 +1226,22 @@ impl Declarator {
             Declarator::Error => None,
         }
     }
+
+    /// Check whether the declarator declares a function, rather than e.g. a
+    /// pointer to a function.
+    pub fn is_function(&self) -> bool {
+        match self {
+            Declarator::Direct(direct) => direct.is_function(),
+            Declarator::Pointer { declarator, .. } => declarator.is_function(),
+            Declarator::Error => false,
+        }
+    }
 }
 
 /// Direct declarators (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum DirectDeclarator {
     Identifier {
         identifier: Identifier,
@@ -849,11 +1281,35 @@ impl DirectDeclarator {
             DirectDeclarator::Identifier { .. } => None,
         }
     }
+
+    /// Check whether the direct declarator declares a function, see
+    /// [`Declarator::is_function`].
+    pub fn is_function(&self) -> bool {
+        match self {
+            DirectDeclarator::Identifier { .. } => false,
+            DirectDeclarator::Parenthesized(declarator) => declarator.is_function(),
+            DirectDeclarator::Array { declarator, .. } => declarator.is_function(),
+            DirectDeclarator::Function { declarator, .. } => declarator.is_name() || declarator.is_function(),
+        }
+    }
+
+    /// Check whether the direct declarator is an identifier, possibly
+    /// parenthesized.
+    fn is_name(&self) -> bool {
+        match self {
+            DirectDeclarator::Identifier { .. } => true,
+            DirectDeclarator::Parenthesized(declarator) => {
+                matches!(&**declarator, Declarator::Direct(direct) if direct.is_name())
+            }
+            _ => false,
+        }
+    }
 }
 
 /// Array declarators (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ArrayDeclarator {
     Normal {
         type_qualifiers: Vec<TypeQualifier>,
@@ -870,8 +1326,9 @@ pub enum ArrayDeclarator {
 }
 
 /// Pointers (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Pointer {
     pub pointer_or_block: PointerOrBlock,
     pub attributes: Vec<AttributeSpecifier>,
@@ -879,16 +1336,18 @@ pub struct Pointer {
 }
 
 /// Pointer or block (clang extension)
-#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum PointerOrBlock {
     Pointer,
     Block,
 }
 
 /// Parameter type lists (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ParameterTypeList {
     Parameters(Vec<ParameterDeclaration>),
     Variadic(Vec<ParameterDeclaration>),
@@ -896,8 +1355,9 @@ pub enum ParameterTypeList {
 }
 
 /// Parameter declarations (6.7.6)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct ParameterDeclaration {
     pub attributes: Vec<AttributeSpecifier>,
     pub specifiers: DeclarationSpecifiers,
@@ -905,16 +1365,18 @@ pub struct ParameterDeclaration {
 }
 
 /// Parameter declaration kinds (6.7.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ParameterDeclarationKind {
     Declarator(Declarator),
     Abstract(AbstractDeclarator),
 }
 
 /// Type names (6.7.7)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum TypeName {
     TypeName {
         specifiers: SpecifierQualifierList,
@@ -924,8 +1386,9 @@ pub enum TypeName {
 }
 
 /// Abstract declarators (6.7.7)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum AbstractDeclarator {
     Direct(DirectAbstractDeclarator),
     Pointer {
@@ -936,8 +1399,9 @@ pub enum AbstractDeclarator {
 }
 
 /// Direct abstract declarators (6.7.7)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum DirectAbstractDeclarator {
     Parenthesized(Box<AbstractDeclarator>),
     Array {
@@ -953,58 +1417,94 @@ pub enum DirectAbstractDeclarator {
 }
 
 /// Initializers (6.7.10)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Initializer {
     Expression(Box<Expression>),
     Braced(BracedInitializer),
+    Constants(ConstantInitializer),
 }
 
 /// Braced initializers (6.7.10)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct BracedInitializer {
     pub initializers: Vec<DesignatedInitializer>,
 }
 
+/// Braced initializer of constants only, e.g. `{ 0x12, 0x34 }`, kept as the
+/// list of its constants rather than an expression per constant when
+/// [`State::compact_initializers`](crate::State::compact_initializers) is set.
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct ConstantInitializer {
+    pub constants: Vec<Spanned<Constant>>,
+}
+
+impl ConstantInitializer {
+    /// The braced initializer the constants stand for, as the parser builds
+    /// it without [`State::compact_initializers`](crate::State::compact_initializers).
+    pub fn to_braced(&self) -> BracedInitializer {
+        let initializers = self.constants.iter().map(|constant| {
+            let primary = PrimaryExpression::Constant(constant.value.clone());
+            let kind = ExpressionKind::Postfix(PostfixExpression::Primary(primary));
+            DesignatedInitializer {
+                designation: None,
+                initializer: Initializer::Expression(Box::new(Expression::new(kind, constant.span))),
+            }
+        });
+        BracedInitializer { initializers: initializers.collect() }
+    }
+}
+
 /// Designated initializers (6.7.10)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct DesignatedInitializer {
     pub designation: Option<Designation>,
     pub initializer: Initializer,
 }
 
 /// Designation (6.7.10)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Designation {
     pub designator: Designator,
     pub designation: Option<Box<Designation>>,
 }
 
 /// Designators (6.7.10)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Designator {
     Array(ConstantExpression),
     Member(Identifier),
 }
 
 /// Static assert declarations (6.7.11)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct StaticAssertDeclaration {
     pub condition: ConstantExpression,
     pub message: Option<StringLiterals>,
 }
 
 /// Attribute specifiers (6.7.12.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum AttributeSpecifier {
     Attributes(Vec<Attribute>),
-    Asm(StringLiterals),
+    /// The string of an asm label, shared with the token of the input it was
+    /// parsed from.
+    Asm(Arc<StringLiterals>),
     Error,
 }
 
@@ -1016,7 +1516,7 @@ impl AttributeSpecifier {
         }
     }
 
-    pub fn try_into_asm(self) -> Option<StringLiterals> {
+    pub fn try_into_asm(self) -> Option<Arc<StringLiterals>> {
         match self {
             AttributeSpecifier::Asm(asm) => Some(asm),
             _ => None,
@@ -1025,16 +1525,25 @@ impl AttributeSpecifier {
 }
 
 /// Attribute (6.7.12.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Attribute {
     pub token: AttributeToken,
-    pub arguments: Option<BalancedTokenSequence>,
+    /// The tokens of the argument clause, shared with the group of the input
+    /// they were parsed from.
+    pub arguments: Option<Arc<BalancedTokenSequence>>,
+    /// The arguments as parsed by the parser registered for the attribute in
+    /// the [`AttributeParsers`](crate::AttributeParsers) of the state, if
+    /// any. Values are not serialized.
+    #[cfg_attr(feature = "serde", serde(skip))]
+    pub value: Option<AttributeValue>,
 }
 
 /// Attribute tokens (6.7.12.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum AttributeToken {
     Standard(Identifier),
     Prefixed { prefix: Identifier, identifier: Identifier },
@@ -1088,10 +1597,12 @@ impl AttributeToken {
 /// Statements (6.8)
 #[derive(Debug, Clone, PartialEq, Eq)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct Statement {
     /// The kind of statement.
     pub kind: StatementKind,
     /// The source span of the statement.
+    #[cfg_attr(feature = "serde", serde(skip_serializing_if = "crate::serialize::omit_span"))]
     pub span: Span,
 }
 
@@ -1105,19 +1616,38 @@ impl Statement {
     pub fn dummy(kind: StatementKind) -> Self {
         Self { kind, span: Span::default() }
     }
+
+    /// Move the statement out, leaving an empty expression statement with the
+    /// same span in its place.
+    pub fn take(&mut self) -> Statement {
+        let empty = StatementKind::Unlabeled(UnlabeledStatement::Expression(ExpressionStatement {
+            attributes: Vec::new(),
+            expression: None,
+        }));
+        let placeholder = Self::new(empty, self.span);
+        std::mem::replace(self, placeholder)
+    }
+
+    /// Replace the statement with the result of `f` on it, moving it instead
+    /// of cloning it.
+    pub fn replace_with(&mut self, f: impl FnOnce(Statement) -> Statement) {
+        *self = f(self.take());
+    }
 }
 
 /// Statement kinds
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum StatementKind {
     Labeled(LabeledStatement),
     Unlabeled(UnlabeledStatement),
 }
 
 /// Unlabeled statements (6.8)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum UnlabeledStatement {
     Expression(ExpressionStatement),
     Primary {
@@ -1131,17 +1661,19 @@ pub enum UnlabeledStatement {
 }
 
 /// Primary blocks (6.8.4)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum PrimaryBlock {
-    Compound(CompoundStatement),
+    Compound(Block),
     Selection(SelectionStatement),
     Iteration(IterationStatement),
 }
 
 /// Labels (6.8.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum Label {
     Identifier {
         attributes: Vec<AttributeSpecifier>,
@@ -1157,40 +1689,55 @@ pub enum Label {
 }
 
 /// Labeled statements (6.8.1)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct LabeledStatement {
     pub label: Label,
     pub statement: Box<Statement>,
 }
 
 /// Compound statements (6.8.2)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct CompoundStatement {
+    #[cfg_attr(feature = "serde", serde(serialize_with = "crate::serialize::serialize_items"))]
     pub items: Vec<BlockItem>,
 }
 
 /// Block items (6.8.2)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum BlockItem {
     Declaration(Declaration),
     Statement(UnlabeledStatement),
     Label(Label),
 }
 
+impl BlockItem {
+    /// Move the block item out, leaving an empty expression statement in its
+    /// place.
+    pub fn take(&mut self) -> BlockItem {
+        let empty = UnlabeledStatement::Expression(ExpressionStatement { attributes: Vec::new(), expression: None });
+        std::mem::replace(self, BlockItem::Statement(empty))
+    }
+}
+
 /// Expression statements (6.8.3)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct ExpressionStatement {
     pub attributes: Vec<AttributeSpecifier>,
     pub expression: Option<Box<Expression>>,
 }
 
 /// Selection statements (6.8.4)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum SelectionStatement {
     If {
         condition: Box<Expression>,
@@ -1204,8 +1751,9 @@ pub enum SelectionStatement {
 }
 
 /// Iteration statements (6.8.5)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum IterationStatement {
     While {
         condition: Box<Expression>,
@@ -1225,16 +1773,18 @@ pub enum IterationStatement {
 }
 
 /// For initialization subclause (6.8.5)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ForInit {
     Expression(Box<Expression>),
     Declaration(Declaration),
 }
 
 /// Jump statements (6.8.6)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum JumpStatement {
     Goto(Identifier),
     Continue,
@@ -1247,28 +1797,469 @@ pub enum JumpStatement {
 // =============================================================================
 
 /// Translation units (6.9)
-#[derive(Debug, Default, Clone, PartialEq, Eq)]
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct TranslationUnit {
+    #[cfg_attr(feature = "serde", serde(serialize_with = "crate::serialize::serialize_items"))]
     pub external_declarations: Vec<ExternalDeclaration>,
 }
 
 /// External declarations (6.9)
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub enum ExternalDeclaration {
     Function(FunctionDefinition),
     Declaration(Declaration),
 }
 
+impl ExternalDeclaration {
+    /// The source span of the external declaration.
+    pub fn span(&self) -> Span {
+        match self {
+            ExternalDeclaration::Function(function) => function.span,
+            ExternalDeclaration::Declaration(declaration) => declaration.span,
+        }
+    }
+}
+
 /// Function definitions (6.9.1)
 #[derive(Debug, Clone, PartialEq, Eq)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct FunctionDefinition {
     pub attributes: Vec<AttributeSpecifier>,
     pub specifiers: DeclarationSpecifiers,
     pub declarator: Declarator,
-    pub body: CompoundStatement,
+    pub body: FunctionBody,
+    /// The source span of the function definition.
+    #[cfg_attr(feature = "serde", serde(skip_serializing_if = "crate::serialize::omit_span"))]
+    pub span: Span,
+}
+
+/// Function bodies (6.9.1), possibly not parsed yet.
+///
+/// When [`State::lazy_function_bodies`] is set, the parser keeps the braced
+/// tokens of the body together with a snapshot of the parsing state, and the
+/// body is parsed on first access through [`Deref`](std::ops::Deref). Errors
+/// found at that point are available from [`Block::errors`]. Typedef
+/// names declared inside a lazy body are not visible to later declarations.
+pub type FunctionBody = Block;
+
+/// Compound statements (6.8.2) of function bodies and of primary blocks,
+/// possibly not parsed yet.
+///
+/// Function bodies are lazy when [`State::lazy_function_bodies`] is set, and
+/// the compound statements nested in them when [`State::lazy_blocks`] is
+/// set, see [`FunctionBody`].
+#[derive(Clone)]
+pub struct Block {
+    parsed: OnceLock<(CompoundStatement, Vec<Error<'static>>)>,
+    unparsed: Option<Arc<(BalancedTokenSequence, State, Dialect)>>,
+}
+
+impl Block {
+    /// Create a body that is parsed from `tokens` on first access, in the
+    /// [current dialect](Dialect::current).
+    pub fn lazy(tokens: BalancedTokenSequence, state: State) -> Self {
+        Self::lazy_in(tokens, state, Dialect::current())
+    }
+
+    /// Create a body that is parsed from `tokens` on first access, in
+    /// `dialect`.
+    pub fn lazy_in(tokens: BalancedTokenSequence, mut state: State, dialect: Dialect) -> Self {
+        state.commit();
+        Self {
+            parsed: OnceLock::new(),
+            unparsed: Some(Arc::new((tokens, state, dialect))),
+        }
+    }
+
+    /// Check whether the body has been parsed.
+    pub fn is_parsed(&self) -> bool {
+        self.parsed.get().is_some()
+    }
+
+    /// Get the errors found while parsing the body, parsing it if needed.
+    pub fn errors(&self) -> &[Error<'static>] {
+        &self.force().1
+    }
+
+    /// The tokens of a body that has not been parsed yet.
+    pub(crate) fn unparsed_tokens_mut(&mut self) -> Option<&mut BalancedTokenSequence> {
+        if self.is_parsed() {
+            return None;
+        }
+        self.unparsed.as_mut().map(|unparsed| &mut Arc::make_mut(unparsed).0)
+    }
+
+    /// The parsed body and its errors, once parsed.
+    pub(crate) fn parsed(&self) -> Option<&(CompoundStatement, Vec<Error<'static>>)> {
+        self.parsed.get()
+    }
+
+    /// The parsed body, once parsed, without discarding the tokens of a lazy
+    /// body, e.g. to take its items apart when it is dropped.
+    fn parsed_mut(&mut self) -> Option<&mut CompoundStatement> {
+        self.parsed.get_mut().map(|(body, _)| body)
+    }
+
+    /// The tokens and state a lazy body is parsed from.
+    pub(crate) fn unparsed(&self) -> Option<&Arc<(BalancedTokenSequence, State, Dialect)>> {
+        self.unparsed.as_ref()
+    }
+
+    fn force(&self) -> &(CompoundStatement, Vec<Error<'static>>) {
+        self.parsed.get_or_init(|| {
+            let (tokens, state, dialect) = self.unparsed.as_deref().expect("Eager block is always parsed");
+            crate::parser::parse_function_body(tokens, &mut state.clone(), *dialect)
+        })
+    }
+}
+
+impl From<CompoundStatement> for Block {
+    fn from(body: CompoundStatement) -> Self {
+        Self {
+            parsed: OnceLock::from((body, Vec::new())),
+            unparsed: None,
+        }
+    }
+}
+
+impl std::ops::Deref for Block {
+    type Target = CompoundStatement;
+
+    fn deref(&self) -> &CompoundStatement {
+        &self.force().0
+    }
+}
+
+impl std::ops::DerefMut for Block {
+    fn deref_mut(&mut self) -> &mut CompoundStatement {
+        self.force();
+        // The tokens no longer describe the body once it is modified
+        self.unparsed = None;
+        &mut self.parsed.get_mut().expect("Block is parsed").0
+    }
+}
+
+impl fmt::Debug for Block {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(&**self, f)
+    }
+}
+
+#[cfg(feature = "dbg-pls")]
+impl DebugPls for Block {
+    fn fmt(&self, f: dbg_pls::Formatter<'_>) {
+        DebugPls::fmt(&**self, f)
+    }
+}
+
+impl PartialEq for Block {
+    fn eq(&self, other: &Self) -> bool {
+        // Clones of an unmodified lazy body share its tokens, so they are
+        // equal without parsing them
+        if let (Some(a), Some(b)) = (&self.unparsed, &other.unparsed)
+            && Arc::ptr_eq(a, b)
+        {
+            return true;
+        }
+        **self == **other
+    }
+}
+
+impl Eq for Block {}
+
+// =============================================================================
+// Structural Hashing
+// =============================================================================
+
+// Hashes ignore spans, like those of `Spanned`, so that the same code hashes
+// the same wherever it appears. Expressions and statements take the hash of
+// their subtree from `StructuralHashes` when one is being built, so that
+// building it hashes each node once instead of once per enclosing node.
+
+impl Hash for BalancedTokenSequence {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.tokens.hash(state);
+        self.closed.hash(state);
+    }
+}
+
+impl Hash for Block {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        (**self).hash(state);
+    }
+}
+
+impl Hash for Expression {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        match crate::index::memoized_hash(crate::index::Node::Expression(self)) {
+            Some(hash) => hash.hash(state),
+            None => self.kind.hash(state),
+        }
+    }
+}
+
+impl Hash for Declaration {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.kind.hash(state);
+    }
+}
+
+impl Hash for Statement {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        match crate::index::memoized_hash(crate::index::Node::Statement(self)) {
+            Some(hash) => hash.hash(state),
+            None => self.kind.hash(state),
+        }
+    }
+}
+
+impl Hash for FunctionDefinition {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        self.attributes.hash(state);
+        self.specifiers.hash(state);
+        self.declarator.hash(state);
+        self.body.hash(state);
+    }
+}
+
+impl Hash for FunctionBody {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        (**self).hash(state);
+    }
+}
+
+// =============================================================================
+// Dropping Deep Trees
+// =============================================================================
+
+// Expressions and statements nest without bound, e.g. in long operator chains
+// and `else if` chains, so dropping them recursively can overflow the stack.
+// Instead, their `Drop` moves the nested nodes to a work list, leaving empty
+// nodes in their place, and drops them one at a time.
+
+/// Frees nested expressions with a work list instead of recursion.
+impl Drop for Expression {
+    fn drop(&mut self) {
+        let mut pending = Vec::new();
+        take_subexpressions(&mut self.kind, &mut pending);
+        while let Some(mut kind) = pending.pop() {
+            take_subexpressions(&mut kind, &mut pending);
+        }
+    }
+}
+
+/// Frees nested statements with a work list instead of recursion.
+impl Drop for Statement {
+    fn drop(&mut self) {
+        let mut pending = Vec::new();
+        take_substatements(&mut self.kind, &mut pending);
+        drop_statements(pending);
+    }
+}
+
+/// Frees nested statements with a work list instead of recursion.
+impl Drop for CompoundStatement {
+    fn drop(&mut self) {
+        let mut pending = Vec::new();
+        take_block_items(&mut self.items, &mut pending);
+        drop_statements(pending);
+    }
+}
+
+fn take_expression(e: &mut Expression, pending: &mut Vec<ExpressionKind>) {
+    if !matches!(e.kind, ExpressionKind::Error) {
+        pending.push(std::mem::replace(&mut e.kind, ExpressionKind::Error));
+    }
+}
+
+/// An empty postfix expression, left in place of a detached operand.
+fn empty_postfix() -> PostfixExpression {
+    PostfixExpression::Primary(PrimaryExpression::Error)
+}
+
+/// Move the operand of a chain link to `pending`, so that the chain is freed
+/// link by link.
+fn take_postfix(p: &mut PostfixExpression, pending: &mut Vec<ExpressionKind>) {
+    pending.push(ExpressionKind::Postfix(std::mem::replace(p, empty_postfix())));
+}
+
+fn take_unary(u: &mut UnaryExpression, pending: &mut Vec<ExpressionKind>) {
+    pending.push(ExpressionKind::Unary(std::mem::replace(
+        u,
+        UnaryExpression::Postfix(empty_postfix()),
+    )));
+}
+
+fn take_cast(c: &mut CastExpression, pending: &mut Vec<ExpressionKind>) {
+    let empty = CastExpression::Unary(UnaryExpression::Postfix(empty_postfix()));
+    pending.push(ExpressionKind::Cast(std::mem::replace(c, empty)));
+}
+
+/// Moves the kinds of the outermost expressions it visits to a work list,
+/// for the expressions in type names and initializers.
+struct TakeExpressions<'p> {
+    pending: &'p mut Vec<ExpressionKind>,
+}
+
+impl<'a> crate::visitor::VisitorMut<'a> for TakeExpressions<'_> {
+    type Result = ();
+
+    fn visit_expression_mut(&mut self, e: &'a mut Expression) {
+        take_expression(e, self.pending);
+    }
+}
+
+fn take_type_name(tn: &mut TypeName, pending: &mut Vec<ExpressionKind>) {
+    if !matches!(tn, TypeName::Error) {
+        crate::visitor::VisitorMut::visit_type_name_mut(&mut TakeExpressions { pending }, tn);
+    }
+}
+
+/// Move the kinds of the nearest nested expressions of `kind` to `pending`.
+fn take_subexpressions(kind: &mut ExpressionKind, pending: &mut Vec<ExpressionKind>) {
+    match kind {
+        ExpressionKind::Postfix(p) => take_postfix_operands(p, pending),
+        ExpressionKind::Unary(u) => take_unary_operands(u, pending),
+        ExpressionKind::Cast(c) => take_cast_operands(c, pending),
+        ExpressionKind::Binary(b) => {
+            take_expression(&mut b.left, pending);
+            take_expression(&mut b.right, pending);
+        }
+        ExpressionKind::Conditional(c) => {
+            take_expression(&mut c.condition, pending);
+            take_expression(&mut c.then_expr, pending);
+            take_expression(&mut c.else_expr, pending);
+        }
+        ExpressionKind::Assignment(a) => {
+            take_expression(&mut a.left, pending);
+            take_expression(&mut a.right, pending);
+        }
+        ExpressionKind::Comma(c) => {
+            for e in &mut c.expressions {
+                take_expression(e, pending);
+            }
+        }
+        ExpressionKind::Error => {}
+    }
+}
+
+// Casts, unary and postfix expressions nest without an `Expression` in
+// between, so their boxed operands are detached one link at a time.
+
+fn take_cast_operands(c: &mut CastExpression, pending: &mut Vec<ExpressionKind>) {
+    match c {
+        CastExpression::Cast { type_name, expression } => {
+            take_type_name(type_name, pending);
+            take_cast(expression, pending);
+        }
+        CastExpression::Unary(u) => take_unary_operands(u, pending),
+    }
+}
+
+fn take_unary_operands(u: &mut UnaryExpression, pending: &mut Vec<ExpressionKind>) {
+    match u {
+        UnaryExpression::Postfix(p) => take_postfix_operands(p, pending),
+        UnaryExpression::PreIncrement(u) | UnaryExpression::PreDecrement(u) | UnaryExpression::Sizeof(u) => {
+            take_unary(u, pending)
+        }
+        UnaryExpression::Unary { operand, .. } => take_cast(operand, pending),
+        UnaryExpression::SizeofType(type_name) | UnaryExpression::Alignof(type_name) => {
+            take_type_name(type_name, pending)
+        }
+    }
+}
+
+fn take_postfix_operands(p: &mut PostfixExpression, pending: &mut Vec<ExpressionKind>) {
+    match p {
+        PostfixExpression::ArrayAccess { array, index } => {
+            take_expression(index, pending);
+            take_postfix(array, pending);
+        }
+        PostfixExpression::FunctionCall { function, arguments } => {
+            for e in arguments {
+                take_expression(e, pending);
+            }
+            take_postfix(function, pending);
+        }
+        PostfixExpression::MemberAccess { object, .. }
+        | PostfixExpression::MemberAccessPtr { object, .. }
+        | PostfixExpression::PostIncrement(object)
+        | PostfixExpression::PostDecrement(object) => take_postfix(object, pending),
+        PostfixExpression::CompoundLiteral(cl) => {
+            crate::visitor::VisitorMut::visit_compound_literal_mut(&mut TakeExpressions { pending }, cl);
+        }
+        PostfixExpression::Primary(PrimaryExpression::Parenthesized(e)) => take_expression(e, pending),
+        PostfixExpression::Primary(PrimaryExpression::Generic(g)) => {
+            take_expression(&mut g.controlling_expression, pending);
+            for association in &mut g.associations {
+                match association {
+                    GenericAssociation::Type { type_name, expression } => {
+                        take_type_name(type_name, pending);
+                        take_expression(expression, pending);
+                    }
+                    GenericAssociation::Default { expression } => take_expression(expression, pending),
+                }
+            }
+        }
+        PostfixExpression::Primary(_) => {}
+    }
+}
+
+fn take_statement(s: &mut Statement, pending: &mut Vec<StatementKind>) {
+    let empty = StatementKind::Unlabeled(UnlabeledStatement::Expression(ExpressionStatement {
+        attributes: Vec::new(),
+        expression: None,
+    }));
+    pending.push(std::mem::replace(&mut s.kind, empty));
+}
+
+fn take_block_items(items: &mut Vec<BlockItem>, pending: &mut Vec<StatementKind>) {
+    for item in std::mem::take(items) {
+        if let BlockItem::Statement(s) = item {
+            pending.push(StatementKind::Unlabeled(s));
+        }
+    }
+}
+
+/// Move the kinds of the nearest nested statements of `kind` to `pending`.
+fn take_substatements(kind: &mut StatementKind, pending: &mut Vec<StatementKind>) {
+    let block = match kind {
+        StatementKind::Labeled(ls) => return take_statement(&mut ls.statement, pending),
+        StatementKind::Unlabeled(UnlabeledStatement::Primary { block, .. }) => block,
+        StatementKind::Unlabeled(_) => return,
+    };
+    match block {
+        // An unparsed block has no statements to take apart
+        PrimaryBlock::Compound(c) => {
+            if let Some(c) = c.parsed_mut() {
+                take_block_items(&mut c.items, pending);
+            }
+        }
+        PrimaryBlock::Selection(SelectionStatement::If { then_stmt, else_stmt, .. }) => {
+            take_statement(then_stmt, pending);
+            if let Some(else_stmt) = else_stmt {
+                take_statement(else_stmt, pending);
+            }
+        }
+        PrimaryBlock::Selection(SelectionStatement::Switch { statement: body, .. })
+        | PrimaryBlock::Iteration(
+            IterationStatement::While { body, .. }
+            | IterationStatement::DoWhile { body, .. }
+            | IterationStatement::For { body, .. },
+        ) => take_statement(body, pending),
+        PrimaryBlock::Iteration(IterationStatement::Error) => {}
+    }
+}
+
+fn drop_statements(mut pending: Vec<StatementKind>) {
+    while let Some(mut kind) = pending.pop() {
+        take_substatements(&mut kind, &mut pending);
+    }
 }
 
 #[cfg(feature = "quasi-quote")]
@@ -1279,6 +2270,7 @@ pub mod quasi_quote {
     use dyn_eq::DynEq;
 
     use super::*;
+    use crate::visitor::{VisitorMut, walk_expression_mut};
 
     pub trait NamedAny: Any {
         fn type_name(&self) -> &'static str;
@@ -1296,6 +2288,14 @@ pub mod quasi_quote {
     dyn_clone::clone_trait_object!(Interpolate);
     dyn_eq::eq_trait_object!(Interpolate);
 
+    impl Hash for Box<dyn Interpolate> {
+        fn hash<H: Hasher>(&self, state: &mut H) {
+            // Values can only be compared through `DynEq`, so equal values
+            // hash alike by their type alone
+            self.as_ref().type_name().hash(state);
+        }
+    }
+
     impl std::fmt::Debug for Box<dyn Interpolate> {
         fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
             if let Some(template) = (self.as_ref() as &dyn Any).downcast_ref::<Template>() {
@@ -1321,10 +2321,11 @@ pub mod quasi_quote {
         }
     }
 
-    #[derive(Debug, Clone, PartialEq, Eq)]
+    #[derive(Debug, Clone, PartialEq, Eq, Hash)]
     #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+    #[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
     pub struct Template {
-        pub name: Arc<str>,
+        pub name: Symbol,
     }
 
     impl BalancedTokenSequence {
@@ -1332,18 +2333,334 @@ pub mod quasi_quote {
             for token in &mut self.tokens {
                 match &mut token.value {
                     BalancedToken::Template(template) => {
-                        let name = template.name.as_ref();
+                        let name = template.name.as_str();
                         let value = mapping.get(&name).ok_or(format!("template slot `{name}` not given"))?;
                         token.value = BalancedToken::Interpolation(value.clone());
                     }
-                    BalancedToken::Parenthesized(tokens) => tokens.interpolate(mapping)?,
-                    BalancedToken::Bracketed(tokens) => tokens.interpolate(mapping)?,
-                    BalancedToken::Braced(tokens) => tokens.interpolate(mapping)?,
+                    BalancedToken::Parenthesized(tokens)
+                    | BalancedToken::Bracketed(tokens)
+                    | BalancedToken::Braced(tokens) => Arc::make_mut(tokens).interpolate(mapping)?,
                     _ => {}
                 }
             }
             Ok(())
         }
+
+        /// Interpolate the template slots, taking ownership of the values.
+        ///
+        /// Unlike [`BalancedTokenSequence::interpolate`], each value is moved
+        /// into its last use and only cloned for the uses before it, and the
+        /// tokens after the last slot are not visited.
+        pub fn interpolate_owned(
+            &mut self,
+            mut mapping: HashMap<&'static str, Box<dyn Interpolate>>,
+        ) -> Result<(), String> {
+            let mut uses = Vec::new();
+            count_templates(&self.tokens, &mut uses);
+            let mut remaining: usize = uses.iter().map(|(_, uses)| uses).sum();
+            move_templates(&mut self.tokens, &mut mapping, &mut uses, &mut remaining)
+        }
+    }
+
+    /// Count the uses of each template slot in `tokens`.
+    fn count_templates(tokens: &[Spanned<BalancedToken>], uses: &mut Vec<(Symbol, usize)>) {
+        for token in tokens {
+            match &token.value {
+                BalancedToken::Template(template) => match uses.iter_mut().find(|(slot, _)| *slot == template.name) {
+                    Some((_, count)) => *count += 1,
+                    None => uses.push((template.name, 1)),
+                },
+                BalancedToken::Parenthesized(inner)
+                | BalancedToken::Bracketed(inner)
+                | BalancedToken::Braced(inner) => count_templates(&inner.tokens, uses),
+                _ => {}
+            }
+        }
+    }
+
+    /// Interpolate the template slots of `tokens`, with `uses` the uses left of
+    /// each slot and `remaining` the total.
+    fn move_templates(
+        tokens: &mut [Spanned<BalancedToken>],
+        mapping: &mut HashMap<&'static str, Box<dyn Interpolate>>,
+        uses: &mut [(Symbol, usize)],
+        remaining: &mut usize,
+    ) -> Result<(), String> {
+        for token in tokens {
+            if *remaining == 0 {
+                break;
+            }
+            match &mut token.value {
+                BalancedToken::Template(template) => {
+                    let name = template.name.as_str();
+                    let (_, left) = uses
+                        .iter_mut()
+                        .find(|(slot, _)| *slot == template.name)
+                        .expect("Slots are counted before moving");
+                    *left -= 1;
+                    *remaining -= 1;
+                    let value = if *left == 0 {
+                        mapping.remove(name)
+                    } else {
+                        mapping.get(name).cloned()
+                    };
+                    token.value =
+                        BalancedToken::Interpolation(value.ok_or(format!("template slot `{name}` not given"))?);
+                }
+                BalancedToken::Parenthesized(inner)
+                | BalancedToken::Bracketed(inner)
+                | BalancedToken::Braced(inner) => {
+                    move_templates(&mut Arc::make_mut(inner).tokens, mapping, uses, remaining)?
+                }
+                _ => {}
+            }
+        }
+        Ok(())
+    }
+
+    /// A template parsed once, to be instantiated many times without lexing
+    /// and parsing it again.
+    ///
+    /// Each `@name` slot of the template stands for an identifier or an
+    /// expression. Instantiating substitutes the slots in a copy of the
+    /// parsed tree, moving the values in, and only cloning a value for slots
+    /// used more than once.
+    #[derive(Debug, Clone)]
+    #[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+    pub struct CompiledTemplate<T> {
+        ast: T,
+        /// Placeholders of the slots, with the number of times each is used.
+        slots: Vec<(Symbol, usize)>,
+    }
+
+    impl<T: Instantiate + Clone> CompiledTemplate<T> {
+        /// Compile the template `code`, parsing its tokens with `parse`.
+        ///
+        /// The slots are parsed as identifiers, so a slot can only be used
+        /// where an identifier or an expression is expected.
+        pub fn compile(
+            code: &str,
+            parse: impl FnOnce(&BalancedTokenSequence) -> Result<T, String>,
+        ) -> Result<Self, String> {
+            let (mut tokens, _) = crate::lex(code, None);
+            let mut lexed = Vec::new();
+            placeholders(&mut tokens, &mut lexed);
+            let mut ast = parse(&tokens)?;
+
+            let mut counting = Substitution { slots: Vec::new(), values: None };
+            ast.substitute(&mut counting)?;
+            for (placeholder, uses) in &lexed {
+                let parsed = counting.uses(*placeholder);
+                if parsed != *uses {
+                    let name = &placeholder.as_str()[1..];
+                    return Err(format!(
+                        "template slot `{name}` is not used as an identifier or expression"
+                    ));
+                }
+            }
+            Ok(Self { ast, slots: counting.slots })
+        }
+
+        /// The names of the slots of the template.
+        pub fn slots(&self) -> impl Iterator<Item = &'static str> + '_ {
+            self.slots.iter().map(|(placeholder, _)| &placeholder.as_str()[1..])
+        }
+
+        /// Instantiate the template, substituting the slots by `values`.
+        pub fn instantiate(&self, values: HashMap<&'static str, Box<dyn Interpolate>>) -> Result<T, String> {
+            let mut ast = self.ast.clone();
+            ast.substitute(&mut Substitution {
+                slots: self.slots.clone(),
+                values: Some(values),
+            })?;
+            Ok(ast)
+        }
+    }
+
+    /// Replace template slot tokens by placeholder identifiers, counting them.
+    fn placeholders(tokens: &mut BalancedTokenSequence, slots: &mut Vec<(Symbol, usize)>) {
+        for token in &mut tokens.tokens {
+            match &mut token.value {
+                BalancedToken::Template(template) => {
+                    let placeholder = Symbol::intern(&format!("@{}", template.name));
+                    match slots.iter_mut().find(|(slot, _)| *slot == placeholder) {
+                        Some((_, uses)) => *uses += 1,
+                        None => slots.push((placeholder, 1)),
+                    }
+                    token.value = BalancedToken::Identifier(Identifier(placeholder));
+                }
+                BalancedToken::Parenthesized(tokens)
+                | BalancedToken::Bracketed(tokens)
+                | BalancedToken::Braced(tokens) => placeholders(Arc::make_mut(tokens), slots),
+                _ => {}
+            }
+        }
+    }
+
+    /// Substitutes the placeholders of a [`CompiledTemplate`], or only counts
+    /// them without values.
+    pub struct Substitution {
+        slots: Vec<(Symbol, usize)>,
+        values: Option<HashMap<&'static str, Box<dyn Interpolate>>>,
+    }
+
+    impl Substitution {
+        fn uses(&self, placeholder: Symbol) -> usize {
+            self.slots
+                .iter()
+                .find(|(slot, _)| *slot == placeholder)
+                .map_or(0, |(_, uses)| *uses)
+        }
+
+        /// The value of the slot of `placeholder`, if there are values.
+        fn take(&mut self, placeholder: Symbol) -> Result<Option<Box<dyn Any>>, String> {
+            let Some(values) = &mut self.values else {
+                match self.slots.iter_mut().find(|(slot, _)| *slot == placeholder) {
+                    Some((_, uses)) => *uses += 1,
+                    None => self.slots.push((placeholder, 1)),
+                }
+                return Ok(None);
+            };
+            let name = &placeholder.as_str()[1..];
+            let (_, uses) = self
+                .slots
+                .iter_mut()
+                .find(|(slot, _)| *slot == placeholder)
+                .expect("Slots are counted when compiling");
+            *uses -= 1;
+            // The last use takes the value instead of cloning it
+            let value = if *uses == 0 {
+                values.remove(name)
+            } else {
+                values.get(name).cloned()
+            };
+            let value = value.ok_or_else(|| format!("template slot `{name}` not given"))?;
+            Ok(Some(value as Box<dyn Any>))
+        }
+
+        fn identifier(&mut self, id: &mut Identifier) -> Result<(), String> {
+            if !is_placeholder(id) {
+                return Ok(());
+            }
+            let placeholder = id.0;
+            if let Some(value) = self.take(placeholder)? {
+                *id = *value
+                    .downcast::<Identifier>()
+                    .map_err(|_| mismatch(placeholder, "an identifier"))?;
+            }
+            Ok(())
+        }
+    }
+
+    fn is_placeholder(id: &Identifier) -> bool {
+        id.0.as_str().starts_with('@')
+    }
+
+    fn mismatch(placeholder: Symbol, expected: &str) -> String {
+        format!("template slot `{}` expects {expected}", &placeholder.as_str()[1..])
+    }
+
+    impl<'a> VisitorMut<'a> for Substitution {
+        type Result = Result<(), String>;
+
+        fn visit_expression_mut(&mut self, e: &'a mut Expression) -> Self::Result {
+            let ExpressionKind::Postfix(PostfixExpression::Primary(PrimaryExpression::Identifier(id))) = &e.kind else {
+                return walk_expression_mut(self, e);
+            };
+            if !is_placeholder(id) {
+                return Ok(());
+            }
+            let placeholder = id.0;
+            let Some(value) = self.take(placeholder)? else {
+                return Ok(());
+            };
+            let primary = match value.downcast::<Expression>() {
+                Ok(expression) => {
+                    *e = *expression;
+                    return Ok(());
+                }
+                Err(value) => value
+                    .downcast::<PrimaryExpression>()
+                    .map(|primary| *primary)
+                    .or_else(|value| {
+                        value
+                            .downcast::<Identifier>()
+                            .map(|id| PrimaryExpression::Identifier(*id))
+                    })
+                    .or_else(|value| value.downcast::<Constant>().map(|c| PrimaryExpression::Constant(*c)))
+                    .or_else(|value| {
+                        value
+                            .downcast::<StringLiterals>()
+                            .map(|s| PrimaryExpression::StringLiteral(*s))
+                    })
+                    .map_err(|_| mismatch(placeholder, "an expression"))?,
+            };
+            e.kind = ExpressionKind::Postfix(PostfixExpression::Primary(primary));
+            Ok(())
+        }
+
+        fn visit_variable_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_type_name_identifier_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_enum_constant_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_label_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_member_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_struct_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_enum_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+
+        fn visit_enumerator_name_mut(&mut self, id: &'a mut Identifier) -> Self::Result {
+            self.identifier(id)
+        }
+    }
+
+    /// Syntax trees that a [`CompiledTemplate`] can be parsed into.
+    pub trait Instantiate {
+        /// Substitute the template slots in the tree.
+        fn substitute(&mut self, substitution: &mut Substitution) -> Result<(), String>;
+    }
+
+    macro_rules! instantiate {
+        ($($ty:ty => $visit:ident),* $(,)?) => {
+            $(
+                impl Instantiate for $ty {
+                    fn substitute(&mut self, substitution: &mut Substitution) -> Result<(), String> {
+                        substitution.$visit(self)
+                    }
+                }
+            )*
+        };
+    }
+
+    instantiate! {
+        TranslationUnit => visit_translation_unit_mut,
+        ExternalDeclaration => visit_external_declaration_mut,
+        FunctionDefinition => visit_function_definition_mut,
+        Declaration => visit_declaration_mut,
+        BlockItem => visit_block_item_mut,
+        Statement => visit_statement_mut,
+        Expression => visit_expression_mut,
+        Initializer => visit_initializer_mut,
+        DesignatedInitializer => visit_designated_initializer_mut,
+        TypeName => visit_type_name_mut,
     }
 
     #[macro_export]
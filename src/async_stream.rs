@@ -0,0 +1,312 @@
+//! Parsing a translation unit as it is read from an asynchronous reader.
+
+use std::{
+    collections::VecDeque,
+    future::Future,
+    io,
+    pin::Pin,
+    task::{Context, Poll},
+};
+
+use blocking::Task;
+use chumsky::prelude::*;
+use futures_core::Stream;
+use futures_io::AsyncRead;
+
+use crate::{
+    BalancedTokenSequence, ExternalDeclaration, State,
+    lexer::{lex_region, lex_rest},
+    parallel::declaration_end,
+    parser::{external_declaration, no_recover, translation_unit},
+    parser_utils::Error,
+    span::{ContextMapping, ContextTable, SourceContext, Span},
+};
+
+/// Size of the buffer each read fills.
+const READ_LEN: usize = 1 << 16;
+
+/// Smallest amount of text read before it is handed to the blocking pool,
+/// unless the input ended or the reader is waiting for more.
+const MIN_CHUNK_LEN: usize = 1 << 14;
+
+/// Largest amount of text read ahead while a chunk is being parsed.
+const MAX_READ_AHEAD: usize = 1 << 22;
+
+/// The result of a parsed piece of the input, as yielded by [`ParseIter`](crate::ParseIter).
+type Parsed = Result<ExternalDeclaration, Vec<Error<'static>>>;
+
+/// Parse the external declarations of the source read from `reader`, as it
+/// is read, starting from `state`.
+///
+/// The stream yields the same results as [`parse_iter`](crate::parse_iter)
+/// on the tokens of the whole source, but it does not wait for the end of
+/// the input: while more text is read, the text received so far is lexed up
+/// to the last line starting with an identifier, and the external
+/// declarations it completes are parsed. Lexing and parsing run on the
+/// blocking thread pool of [`blocking`], one chunk at a time, so they overlap
+/// with reading and do not stall the executor. The reader is polled on the
+/// task that polls the stream, and works with any executor.
+///
+/// A read error ends the stream after it is yielded, as does input that is
+/// not UTF-8, with an [`io::ErrorKind::InvalidData`] error.
+///
+/// ```ignore
+/// let mut declarations = parse_async(socket, Some("input.i"), State::new());
+/// while let Some(result) = declarations.next().await {
+///     match result? {
+///         Ok(external_declaration) => { /* ... */ }
+///         Err(errors) => { /* ... */ }
+///     }
+/// }
+/// ```
+pub fn parse_async<R: AsyncRead + Unpin>(reader: R, filename: Option<&str>, state: State) -> DeclarationStream<R> {
+    let mut ctx_map = ContextMapping::new("");
+    if let Some(filename) = filename {
+        let filename = ctx_map.intern_filename(filename);
+        ctx_map.start_context(0, SourceContext { filename, line_offset: 0 });
+    }
+    let work = Work {
+        source: String::new(),
+        contexts: ctx_map.into_table(),
+        cursor: 0,
+        pending: BalancedTokenSequence {
+            tokens: Vec::new(),
+            closed: true,
+            eoi: Span::new_eoi(0),
+        },
+        tried: 0,
+        state,
+        finished: false,
+    };
+    DeclarationStream {
+        reader,
+        buffer: vec![0; READ_LEN].into_boxed_slice(),
+        incoming: Vec::new(),
+        work: Some(work),
+        task: None,
+        ready: VecDeque::new(),
+        eof: false,
+        failed: false,
+    }
+}
+
+/// Stream of the external declarations of a source read asynchronously, see
+/// [`parse_async`].
+pub struct DeclarationStream<R> {
+    reader: R,
+    buffer: Box<[u8]>,
+    /// Bytes read and not handed to the parser yet.
+    incoming: Vec<u8>,
+    /// The source and parser, unless a chunk is being parsed on the pool.
+    work: Option<Work>,
+    task: Option<Task<(Work, Vec<Parsed>)>>,
+    /// Results parsed and not yielded yet.
+    ready: VecDeque<Parsed>,
+    /// Whether the reader reached the end of the input.
+    eof: bool,
+    /// Whether the stream ended with an error.
+    failed: bool,
+}
+
+impl<R> DeclarationStream<R> {
+    /// The source read so far, or `None` while a chunk is being parsed.
+    pub fn source(&self) -> Option<&str> {
+        self.work.as_ref().map(|work| work.source.as_str())
+    }
+
+    /// Source contexts of the line directives lexed so far, for reporting
+    /// the errors, or `None` while a chunk is being parsed.
+    pub fn ctx_map(&self) -> Option<ContextMapping<'_>> {
+        (self.work.as_ref()).map(|work| ContextMapping::with_table(&work.source, work.contexts.clone()))
+    }
+
+    /// The state after the declarations parsed so far, or `None` while a
+    /// chunk is being parsed.
+    pub fn state(&self) -> Option<&State> {
+        self.work.as_ref().map(|work| &work.state)
+    }
+
+    /// Take the state after the declarations parsed so far, e.g. once the
+    /// stream ended, or `None` while a chunk is being parsed.
+    pub fn into_state(self) -> Option<State> {
+        self.work.map(|work| work.state)
+    }
+
+    /// Move the valid UTF-8 text read so far to the source of `work`.
+    fn take_incoming(&mut self, work: &mut Work) -> io::Result<()> {
+        let len = match std::str::from_utf8(&self.incoming) {
+            Ok(text) => text.len(),
+            // A character may be split between reads
+            Err(error) if error.error_len().is_none() && !self.eof => error.valid_up_to(),
+            Err(error) => return Err(io::Error::new(io::ErrorKind::InvalidData, error)),
+        };
+        let text = std::str::from_utf8(&self.incoming[..len]).expect("Validated above");
+        work.source.push_str(text);
+        self.incoming.drain(..len);
+        Ok(())
+    }
+}
+
+impl<R: AsyncRead + Unpin> Stream for DeclarationStream<R> {
+    type Item = io::Result<Parsed>;
+
+    fn poll_next(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
+        let this = self.get_mut();
+        loop {
+            if this.failed {
+                return Poll::Ready(None);
+            }
+            if let Some(task) = &mut this.task
+                && let Poll::Ready((work, results)) = Pin::new(task).poll(cx)
+            {
+                this.task = None;
+                this.work = Some(work);
+                this.ready.extend(results);
+            }
+
+            // Read ahead while a chunk is being parsed
+            let mut progress = false;
+            if !this.eof && this.incoming.len() < MAX_READ_AHEAD {
+                progress = true;
+                match Pin::new(&mut this.reader).poll_read(cx, &mut this.buffer) {
+                    Poll::Ready(Ok(0)) => this.eof = true,
+                    Poll::Ready(Ok(len)) => this.incoming.extend_from_slice(&this.buffer[..len]),
+                    Poll::Ready(Err(error)) if error.kind() == io::ErrorKind::Interrupted => {}
+                    Poll::Ready(Err(error)) => {
+                        this.failed = true;
+                        return Poll::Ready(Some(Err(error)));
+                    }
+                    Poll::Pending => progress = false,
+                }
+            }
+
+            let idle = !progress && !this.incoming.is_empty();
+            if let Some(mut work) = this
+                .work
+                .take_if(|work| !work.finished && (this.eof || idle || this.incoming.len() >= MIN_CHUNK_LEN))
+            {
+                if let Err(error) = this.take_incoming(&mut work) {
+                    this.work = Some(work);
+                    this.failed = true;
+                    return Poll::Ready(Some(Err(error)));
+                }
+                let eof = this.eof;
+                this.task = Some(blocking::unblock(move || {
+                    let results = work.advance(eof);
+                    (work, results)
+                }));
+                continue;
+            }
+
+            if let Some(result) = this.ready.pop_front() {
+                return Poll::Ready(Some(Ok(result)));
+            }
+            if this.work.as_ref().is_some_and(|work| work.finished) {
+                return Poll::Ready(None);
+            }
+            // Otherwise the reader or the task wakes the stream
+            if !progress {
+                return Poll::Pending;
+            }
+        }
+    }
+}
+
+/// The source read so far and the parser's progress through it.
+struct Work {
+    source: String,
+    contexts: ContextTable,
+    /// Offset of the first byte of the source not lexed yet.
+    cursor: usize,
+    /// Top-level tokens lexed and not parsed yet.
+    pending: BalancedTokenSequence,
+    /// End of the pending tokens that failed to parse as declarations.
+    tried: usize,
+    state: State,
+    /// Whether the whole input was parsed.
+    finished: bool,
+}
+
+impl Work {
+    /// Lex the source read so far, up to the last line it can be split at or
+    /// to its end if `eof`, and parse the declarations that are complete.
+    fn advance(&mut self, eof: bool) -> Vec<Parsed> {
+        let table = std::mem::replace(&mut self.contexts, ContextTable::new());
+        let mut ctx_map = ContextMapping::with_table(&self.source, table);
+        if eof {
+            let (tokens, eoi) = lex_rest(&self.source, self.cursor, &mut ctx_map);
+            self.pending.tokens.extend(tokens);
+            self.pending.eoi = eoi;
+            self.cursor = self.source.len();
+        } else if let Some(split) = last_split(&self.source, self.cursor) {
+            // A comment or a bracketed group running past the split is lexed
+            // again with the next chunk
+            let starts = ctx_map.starts_len();
+            match lex_region(&self.source, self.cursor..split, &mut ctx_map) {
+                Some(tokens) => {
+                    self.pending.tokens.extend(tokens);
+                    self.cursor = split;
+                }
+                None => ctx_map.truncate_starts(starts),
+            }
+        }
+        self.contexts = ctx_map.into_table();
+
+        // Without recovery, pieces that are not whole declarations fail fast
+        // and are joined with the following ones, as in `parse_iter`
+        let parser = no_recover(external_declaration()).then_ignore(end());
+        let mut results = Vec::new();
+        let tokens = &self.pending.tokens;
+        let mut start = 0;
+        while self.tried < tokens.len() {
+            let end = declaration_end(tokens, self.tried);
+            // The input of a piece ends at the token after it
+            if end == tokens.len() && !eof {
+                break;
+            }
+            let mark = self.state.mark();
+            let result = parser.parse_with_state(self.pending.slice_as_input(start..end), &mut self.state);
+            if !result.has_errors()
+                && let Some(external_declaration) = result.into_output()
+            {
+                // Nothing rewinds into a completed external declaration
+                self.state.commit();
+                results.push(Ok(external_declaration));
+                start = end;
+            } else {
+                self.state.rewind_to(&mark);
+            }
+            self.tried = end;
+        }
+        self.pending.tokens.drain(..start);
+        self.tried -= start;
+
+        if eof {
+            if !self.pending.tokens.is_empty() {
+                let (output, errors) = translation_unit()
+                    .parse_with_state(self.pending.as_input(), &mut self.state)
+                    .into_output_errors();
+                if !errors.is_empty() {
+                    results.push(Err(errors.into_iter().map(|error| error.into_owned()).collect()));
+                }
+                let external_declarations = output.into_iter().flat_map(|unit| unit.external_declarations);
+                results.extend(external_declarations.map(Ok));
+                self.pending.tokens.clear();
+            }
+            self.finished = true;
+        }
+        results
+    }
+}
+
+/// The start of the last line of `source` after `from` that starts with an
+/// identifier, where the tokens before it can be lexed without the rest.
+///
+/// Lines starting with a `#` are not split at, since the whitespace before a
+/// directive is skipped together with it.
+fn last_split(source: &str, from: usize) -> Option<usize> {
+    let bytes = source.as_bytes();
+    memchr::memrchr_iter(b'\n', &bytes[from..])
+        .map(|i| from + i + 1)
+        .find(|&start| bytes.get(start).is_some_and(|&b| b.is_ascii_alphabetic() || b == b'_'))
+}
@@ -0,0 +1,181 @@
+//! Parsers of the arguments of custom attributes, run during the main parse.
+
+use std::{
+    any::Any,
+    fmt,
+    hash::{Hash, Hasher},
+    sync::Arc,
+};
+
+use chumsky::ParseResult;
+use rustc_hash::FxHashMap;
+
+use crate::{AttributeToken, BalancedTokenSequence, Identifier, State, parser_utils::Error, span::Tokens};
+
+/// A registered parser, with its output erased.
+type ArgumentParser = dyn for<'a> Fn(Tokens<'a>, &mut State) -> (Option<AttributeValue>, Vec<Error<'a>>) + Send + Sync;
+
+/// Parsers of the argument clauses of attributes, by the name of the
+/// attribute.
+///
+/// Once set with [`State::set_attribute_parsers`], the parser of a name runs
+/// on the arguments of every attribute of that name as the attribute is
+/// parsed, with the state of the main parse, so the arguments see the names
+/// declared before them and the names they declare are visible after them.
+/// Its output is kept in [`Attribute::value`](crate::Attribute::value), and
+/// its errors are reported with those of the main parse. Attribute-driven
+/// languages embedded in C are then parsed in one pass:
+///
+/// ```ignore
+/// let mut parsers = AttributeParsers::new();
+/// parsers.register(Some("cst"), "gl", |tokens, state| statement().parse_with_state(tokens, state));
+/// state.set_attribute_parsers(Some(parsers));
+/// ```
+///
+/// A name registered without a prefix is the name of a standard attribute or
+/// of an `__attribute__` one.
+#[derive(Clone, Default)]
+pub struct AttributeParsers {
+    parsers: FxHashMap<(Option<Identifier>, Identifier), Arc<ArgumentParser>>,
+}
+
+impl fmt::Debug for AttributeParsers {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_set().entries(self.parsers.keys()).finish()
+    }
+}
+
+impl AttributeParsers {
+    /// Create a registry with no parsers.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Parse the arguments of the attributes named `prefix::name`, or `name`
+    /// with no prefix, with `parser`, replacing the parser registered before.
+    ///
+    /// The parser is given the tokens between the parentheses and the state
+    /// of the main parse.
+    pub fn register<O, F>(&mut self, prefix: Option<&str>, name: &str, parser: F)
+    where
+        O: Any + fmt::Debug + PartialEq + Send + Sync,
+        F: for<'a> Fn(Tokens<'a>, &mut State) -> ParseResult<O, Error<'a>> + Send + Sync + 'static,
+    {
+        let parser = erase(move |tokens, state| {
+            let (output, errors) = parser(tokens, state).into_output_errors();
+            (output.map(AttributeValue::new), errors)
+        });
+        self.parsers
+            .insert((prefix.map(Identifier::from), Identifier::from(name)), parser);
+    }
+
+    /// Number of parsers registered.
+    pub fn len(&self) -> usize {
+        self.parsers.len()
+    }
+
+    /// Whether no parser is registered.
+    pub fn is_empty(&self) -> bool {
+        self.parsers.is_empty()
+    }
+
+    /// Run the parser of `token` on `arguments`, if one is registered.
+    pub(crate) fn parse<'a>(
+        &self,
+        token: &AttributeToken,
+        arguments: &'a BalancedTokenSequence,
+        state: &mut State,
+    ) -> Option<(Option<AttributeValue>, Vec<Error<'a>>)> {
+        let key = match token {
+            AttributeToken::Standard(name) => (None, *name),
+            AttributeToken::Prefixed { prefix, identifier } => (Some(*prefix), *identifier),
+        };
+        let parser = self.parsers.get(&key)?;
+        Some(parser(arguments.as_input(), state))
+    }
+}
+
+/// Give `parser` the higher-ranked signature of an [`ArgumentParser`].
+fn erase<F>(parser: F) -> Arc<ArgumentParser>
+where
+    F: for<'a> Fn(Tokens<'a>, &mut State) -> (Option<AttributeValue>, Vec<Error<'a>>) + Send + Sync + 'static,
+{
+    Arc::new(parser)
+}
+
+/// The output of a parser of [`AttributeParsers`], kept in an
+/// [`Attribute`](crate::Attribute).
+///
+/// Values are shared by the clones of the tree, and compare equal when they
+/// are of the same type and equal as that type.
+#[derive(Clone)]
+pub struct AttributeValue(Arc<dyn Value>);
+
+impl AttributeValue {
+    /// Wrap `value`.
+    pub fn new<T: Any + fmt::Debug + PartialEq + Send + Sync>(value: T) -> Self {
+        Self(Arc::new(value))
+    }
+
+    /// The value, if it is a `T`.
+    pub fn downcast_ref<T: Any>(&self) -> Option<&T> {
+        self.0.as_any().downcast_ref()
+    }
+
+    /// The name of the type of the value.
+    pub fn type_name(&self) -> &'static str {
+        self.0.type_name()
+    }
+}
+
+impl PartialEq for AttributeValue {
+    fn eq(&self, other: &Self) -> bool {
+        self.0.dyn_eq(other.0.as_any())
+    }
+}
+
+impl Eq for AttributeValue {}
+
+impl Hash for AttributeValue {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        // Values can only be compared through `Value::dyn_eq`, so equal
+        // values hash alike by their type alone
+        self.type_name().hash(state);
+    }
+}
+
+impl fmt::Debug for AttributeValue {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        self.0.fmt(f)
+    }
+}
+
+#[cfg(feature = "dbg-pls")]
+impl dbg_pls::DebugPls for AttributeValue {
+    fn fmt(&self, f: dbg_pls::Formatter<'_>) {
+        f.debug_struct("AttributeValue")
+            .field("type_name", &self.type_name())
+            .finish();
+    }
+}
+
+/// Values of any type that can be compared and printed.
+trait Value: Any + fmt::Debug + Send + Sync {
+    fn as_any(&self) -> &dyn Any;
+    fn dyn_eq(&self, other: &dyn Any) -> bool;
+    fn type_name(&self) -> &'static str;
+}
+
+impl<T: Any + fmt::Debug + PartialEq + Send + Sync> Value for T {
+    fn as_any(&self) -> &dyn Any {
+        self
+    }
+
+    fn dyn_eq(&self, other: &dyn Any) -> bool {
+        other.downcast_ref::<T>().is_some_and(|other| self == other)
+    }
+
+    fn type_name(&self) -> &'static str {
+        std::any::type_name::<T>()
+    }
+}
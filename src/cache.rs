@@ -0,0 +1,267 @@
+//! A cache of parsed translation units on disk.
+
+use std::{
+    fs::{self, File},
+    hash::{Hash, Hasher},
+    io,
+    path::{Path, PathBuf},
+    sync::{
+        Mutex, PoisonError,
+        atomic::{AtomicU64, Ordering},
+    },
+    time::SystemTime,
+};
+
+use memmap2::Mmap;
+use rustc_hash::FxHasher;
+
+use crate::{
+    BalancedTokenSequence, ParsedUnit, State, TranslationUnit, lex,
+    parallel::parse_unit,
+    serialize::{self, FORMAT_VERSION},
+    span::ContextMapping,
+};
+
+/// Extension of the files of the cache. Temporary files have another one, so
+/// they are never read or counted.
+const EXTENSION: &str = "cgrm";
+
+/// A content-addressed cache of parsed translation units in a directory.
+///
+/// Each unit is stored in [`serialize::encode`] format, in a file named by the
+/// hash of its source and filename, the version of this crate and of the
+/// format, and the names and options of the initial [`State`] it was parsed
+/// with. Unchanged sources are then read back with [`ParseCache::get`] instead
+/// of lexed and parsed again, e.g. on incremental builds or by a service
+/// answering repeated queries. Files are memory-mapped to be decoded, so
+/// nothing but the decoded tree is copied onto the heap.
+///
+/// The files are written to a temporary file and renamed into place, and never
+/// changed once written, so many processes can share a directory, and a file
+/// mapped by one is never seen half-written or modified under its mapping.
+///
+/// The cache is bounded by the total size of its files: after an insertion
+/// takes it over the bound, the files least recently read or written are
+/// removed. Reading a file sets its modification time, which orders them.
+///
+/// How often the cache was hit is counted in [`ParseCache::stats`].
+#[derive(Debug)]
+pub struct ParseCache {
+    dir: PathBuf,
+    max_bytes: u64,
+    /// Size of the files of the cache, counted when it is opened or trimmed,
+    /// and updated on the writes of this cache.
+    bytes: Mutex<u64>,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    stores: AtomicU64,
+    evictions: AtomicU64,
+}
+
+/// Lookups and changes of a [`ParseCache`] since it was opened.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct CacheStats {
+    /// Number of lookups that found their unit.
+    pub hits: u64,
+    /// Number of lookups that did not, including those finding a file that
+    /// could not be decoded.
+    pub misses: u64,
+    /// Number of units written.
+    pub stores: u64,
+    /// Number of files removed to keep the cache in its bound.
+    pub evictions: u64,
+}
+
+impl CacheStats {
+    /// Fraction of lookups that found their unit.
+    pub fn hit_rate(&self) -> f64 {
+        let total = self.hits + self.misses;
+        if total == 0 {
+            0.0
+        } else {
+            self.hits as f64 / total as f64
+        }
+    }
+}
+
+impl ParseCache {
+    /// Open the cache in `dir`, creating the directory if needed, bounded to
+    /// `max_bytes` of files.
+    pub fn open(dir: impl Into<PathBuf>, max_bytes: u64) -> io::Result<Self> {
+        let dir = dir.into();
+        fs::create_dir_all(&dir)?;
+        let bytes = cached_files(&dir)?.iter().map(|file| file.len).sum();
+        Ok(Self {
+            dir,
+            max_bytes,
+            bytes: Mutex::new(bytes),
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            stores: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+        })
+    }
+
+    /// The directory of the cache.
+    pub fn dir(&self) -> &Path {
+        &self.dir
+    }
+
+    /// How often the cache was hit, and what it wrote and removed.
+    pub fn stats(&self) -> CacheStats {
+        CacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            stores: self.stores.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+        }
+    }
+
+    /// The path of the unit of `source`, lexed with `filename` and parsed from
+    /// `state`.
+    fn path(&self, source: &str, filename: Option<&str>, state: &State) -> PathBuf {
+        let mut hasher = FxHasher::default();
+        (env!("CARGO_PKG_VERSION"), FORMAT_VERSION, state.seed_hash()).hash(&mut hasher);
+        (filename, source).hash(&mut hasher);
+        self.dir.join(format!("{:016x}.{EXTENSION}", hasher.finish()))
+    }
+
+    /// Look up the tokens, tree and source contexts of `source`, lexed with
+    /// `filename` and parsed from `state`.
+    pub fn get<'a>(
+        &self,
+        source: &'a str,
+        filename: Option<&str>,
+        state: &State,
+    ) -> Option<(BalancedTokenSequence, TranslationUnit, ContextMapping<'a>)> {
+        let file = File::open(self.path(source, filename, state)).ok();
+        let decoded = file.as_ref().and_then(|file| {
+            // SAFETY: files are renamed into place once complete and never
+            // modified, see the type documentation
+            let map = unsafe { Mmap::map(file) }.ok()?;
+            serialize::decode(&map, source).ok()
+        });
+        match (&decoded, file) {
+            (Some(_), Some(file)) => {
+                self.hits.fetch_add(1, Ordering::Relaxed);
+                // Setting the time is an optimization of the eviction order
+                let _ = file.set_modified(SystemTime::now());
+            }
+            _ => {
+                self.misses.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+        decoded
+    }
+
+    /// Store the tokens and tree of `ctx_map.source`, lexed with `filename`
+    /// and parsed from `state` as it was before the parse, then remove the
+    /// least recently used files if the cache is over its bound.
+    pub fn insert(
+        &self,
+        tokens: &BalancedTokenSequence,
+        unit: &TranslationUnit,
+        ctx_map: &ContextMapping<'_>,
+        filename: Option<&str>,
+        state: &State,
+    ) -> io::Result<()> {
+        let bytes = serialize::encode(tokens, unit, ctx_map).map_err(io::Error::other)?;
+        let path = self.path(ctx_map.source, filename, state);
+        let replaced = fs::metadata(&path).map_or(0, |metadata| metadata.len());
+        // Threads and processes writing the same unit have a file each
+        static NEXT: AtomicU64 = AtomicU64::new(0);
+        let id = NEXT.fetch_add(1, Ordering::Relaxed);
+        let temp = path.with_extension(format!("tmp{}-{id}", std::process::id()));
+        fs::write(&temp, &bytes)?;
+        fs::rename(&temp, &path)?;
+        self.stores.fetch_add(1, Ordering::Relaxed);
+
+        let total = {
+            let mut total = self.bytes.lock().unwrap_or_else(PoisonError::into_inner);
+            *total = (*total + bytes.len() as u64).saturating_sub(replaced);
+            *total
+        };
+        if total > self.max_bytes {
+            self.trim()?;
+        }
+        Ok(())
+    }
+
+    /// Remove the files least recently used until the cache is in its bound.
+    /// The files are counted again first, since other processes may share the
+    /// directory.
+    pub fn trim(&self) -> io::Result<()> {
+        let mut total = self.bytes.lock().unwrap_or_else(PoisonError::into_inner);
+        let mut files = cached_files(&self.dir)?;
+        *total = files.iter().map(|file| file.len).sum();
+        files.sort_by_key(|file| file.used);
+        for file in files {
+            if *total <= self.max_bytes {
+                break;
+            }
+            // Another process may have removed it first
+            if fs::remove_file(&file.path).is_ok() {
+                self.evictions.fetch_add(1, Ordering::Relaxed);
+            }
+            *total -= file.len;
+        }
+        Ok(())
+    }
+
+    /// Lex and parse `source` from a clone of `init_state`, as in
+    /// [`parse_many`](crate::parse_many), or read it from the cache.
+    ///
+    /// Units parsed without errors are stored, on a best-effort basis: an
+    /// error writing to the cache leaves it as it was. Units read from the
+    /// cache have no [`ParsedUnit::declarations`], so the cache is bypassed
+    /// if `init_state` collects them or a dependency graph, which are not
+    /// stored, or if it has [`AttributeParsers`](crate::AttributeParsers),
+    /// whose values are not stored either.
+    pub fn parse<'a>(&self, source: &'a str, filename: Option<&str>, init_state: &State) -> ParsedUnit<'a> {
+        let cacheable = init_state.declaration_index().is_none()
+            && init_state.dependency_graph().is_none()
+            && init_state.attribute_parsers().is_none();
+        if cacheable && let Some((_, output, ctx_map)) = self.get(source, filename, init_state) {
+            return ParsedUnit {
+                output: Some(output),
+                errors: Vec::new(),
+                ctx_map,
+                declarations: None,
+            };
+        }
+        let (tokens, ctx_map) = lex(source, filename);
+        let unit = parse_unit(&tokens, ctx_map, init_state);
+        if cacheable
+            && !unit.has_errors()
+            && let Some(output) = &unit.output
+        {
+            let _ = self.insert(&tokens, output, &unit.ctx_map, filename, init_state);
+        }
+        unit
+    }
+}
+
+/// A file of the cache.
+struct CachedFile {
+    path: PathBuf,
+    len: u64,
+    /// When the file was last read or written.
+    used: SystemTime,
+}
+
+/// The files of the cache in `dir`.
+fn cached_files(dir: &Path) -> io::Result<Vec<CachedFile>> {
+    let mut files = Vec::new();
+    for entry in fs::read_dir(dir)? {
+        let entry = entry?;
+        let path = entry.path();
+        if path.extension().is_none_or(|extension| extension != EXTENSION) {
+            continue;
+        }
+        // Files removed since the directory was read are skipped
+        let Ok(metadata) = entry.metadata() else { continue };
+        let used = metadata.modified().unwrap_or(SystemTime::UNIX_EPOCH);
+        files.push(CachedFile { path, len: metadata.len(), used });
+    }
+    Ok(files)
+}
@@ -0,0 +1,291 @@
+//! Call graphs of translation units.
+//!
+//! A [`CallGraph`] names every function that is defined or called by a
+//! compact [`FunctionId`], and stores the callees of each function
+//! contiguously in one flat vector, sorted and without duplicates. The calls
+//! of each function definition are collected by its own visitor, in parallel,
+//! and graphs of several translation units can be [merged](CallGraph::merge)
+//! into the graph of the whole program, joining functions by name.
+//!
+//! Only calls of a function by its name are edges of the graph: calls
+//! through function pointers, including local variables and parameters that
+//! shadow a function, are counted as unresolved calls of the caller.
+//!
+//! ```ignore
+//! let mut graph = cgrammar::callgraph::CallGraph::from_unit(&first);
+//! graph.merge(&cgrammar::callgraph::CallGraph::from_unit(&second));
+//! let main = graph.id("main".into()).unwrap();
+//! let reachable = graph.reachable([main]);
+//! ```
+
+use rustc_hash::{FxHashMap, FxHashSet};
+
+use crate::{
+    ast::*,
+    parallel::par_map,
+    symbol::Symbol,
+    visitor::{Visitor, walk_declarator, walk_postfix_expression},
+};
+
+/// A handle to a function of a [`CallGraph`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct FunctionId(u32);
+
+impl FunctionId {
+    /// The index of the function in its graph.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// The call graph of one or more translation units.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct CallGraph {
+    names: Vec<Symbol>,
+    ids: FxHashMap<Symbol, FunctionId>,
+    defined: Vec<bool>,
+    /// The number of unresolved calls of each function.
+    indirect: Vec<u32>,
+    /// The callees of function `i` are `callees[starts[i]..starts[i + 1]]`.
+    starts: Vec<u32>,
+    callees: Vec<FunctionId>,
+}
+
+impl Default for CallGraph {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl CallGraph {
+    /// Create an empty call graph.
+    pub fn new() -> Self {
+        Builder::default().finish()
+    }
+
+    /// Build the call graph of the function definitions of `unit`.
+    pub fn from_unit(unit: &TranslationUnit) -> Self {
+        let functions: Vec<_> = (unit.external_declarations.iter())
+            .filter_map(|d| match d {
+                ExternalDeclaration::Function(f) => Some(f),
+                ExternalDeclaration::Declaration(_) => None,
+            })
+            .collect();
+        let calls = par_map(&functions, |&f| Calls::of(f));
+
+        let mut builder = Builder::default();
+        for calls in &calls {
+            let Some(name) = calls.name else { continue };
+            let caller = builder.function(name);
+            builder.defined[caller.index()] = true;
+            builder.indirect[caller.index()] += calls.indirect;
+            for &callee in &calls.callees {
+                let callee = builder.function(callee);
+                builder.edges.push((caller, callee));
+            }
+        }
+        builder.finish()
+    }
+
+    /// The number of functions in the graph.
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    /// Whether the graph has no functions.
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+
+    /// The number of distinct caller-callee edges in the graph.
+    pub fn edges(&self) -> usize {
+        self.callees.len()
+    }
+
+    /// The functions of the graph, in order.
+    pub fn functions(&self) -> impl ExactSizeIterator<Item = FunctionId> + use<> {
+        (0..self.names.len() as u32).map(FunctionId)
+    }
+
+    /// Find the function named `name`.
+    pub fn id(&self, name: Symbol) -> Option<FunctionId> {
+        self.ids.get(&name).copied()
+    }
+
+    /// The name of function `id`.
+    pub fn name(&self, id: FunctionId) -> Symbol {
+        self.names[id.index()]
+    }
+
+    /// Whether function `id` is defined, rather than only called, in the
+    /// graph.
+    pub fn is_defined(&self, id: FunctionId) -> bool {
+        self.defined[id.index()]
+    }
+
+    /// The functions called by name from function `id`, sorted.
+    pub fn callees(&self, id: FunctionId) -> &[FunctionId] {
+        let (start, end) = (self.starts[id.index()], self.starts[id.index() + 1]);
+        &self.callees[start as usize..end as usize]
+    }
+
+    /// The number of calls from function `id` that do not name their
+    /// callee, e.g. calls through function pointers.
+    pub fn indirect_calls(&self, id: FunctionId) -> u32 {
+        self.indirect[id.index()]
+    }
+
+    /// Merge `other` into this graph, e.g. the graph of another translation
+    /// unit of the same program. Functions are joined by name; the functions
+    /// of this graph keep their ids.
+    pub fn merge(&mut self, other: &CallGraph) {
+        let mut builder = Builder {
+            names: std::mem::take(&mut self.names),
+            ids: std::mem::take(&mut self.ids),
+            defined: std::mem::take(&mut self.defined),
+            indirect: std::mem::take(&mut self.indirect),
+            edges: Vec::with_capacity(self.callees.len() + other.callees.len()),
+        };
+        for caller in 0..builder.names.len() {
+            let (start, end) = (self.starts[caller], self.starts[caller + 1]);
+            let edges = self.callees[start as usize..end as usize].iter();
+            builder
+                .edges
+                .extend(edges.map(|&callee| (FunctionId(caller as u32), callee)));
+        }
+        let remap: Vec<_> = other.names.iter().map(|&name| builder.function(name)).collect();
+        for id in other.functions() {
+            let caller = remap[id.index()];
+            builder.defined[caller.index()] |= other.is_defined(id);
+            builder.indirect[caller.index()] += other.indirect_calls(id);
+            let edges = other.callees(id).iter();
+            builder
+                .edges
+                .extend(edges.map(|&callee| (caller, remap[callee.index()])));
+        }
+        *self = builder.finish();
+    }
+
+    /// Which functions are reachable from `roots` by calls by name, by
+    /// [`FunctionId::index`].
+    pub fn reachable(&self, roots: impl IntoIterator<Item = FunctionId>) -> Vec<bool> {
+        let mut reachable = vec![false; self.len()];
+        let mut stack: Vec<_> = roots.into_iter().collect();
+        while let Some(id) = stack.pop() {
+            if !std::mem::replace(&mut reachable[id.index()], true) {
+                stack.extend(self.callees(id).iter().filter(|callee| !reachable[callee.index()]));
+            }
+        }
+        reachable
+    }
+}
+
+/// Functions and edges in no particular order, before they are grouped by
+/// caller.
+#[derive(Default)]
+struct Builder {
+    names: Vec<Symbol>,
+    ids: FxHashMap<Symbol, FunctionId>,
+    defined: Vec<bool>,
+    indirect: Vec<u32>,
+    edges: Vec<(FunctionId, FunctionId)>,
+}
+
+impl Builder {
+    /// The id of the function named `name`, added if it is new.
+    fn function(&mut self, name: Symbol) -> FunctionId {
+        *self.ids.entry(name).or_insert_with(|| {
+            self.names.push(name);
+            self.defined.push(false);
+            self.indirect.push(0);
+            FunctionId(self.names.len() as u32 - 1)
+        })
+    }
+
+    fn finish(mut self) -> CallGraph {
+        self.edges.sort_unstable();
+        self.edges.dedup();
+        let mut starts = Vec::with_capacity(self.names.len() + 1);
+        let mut edges = self.edges.iter().peekable();
+        for caller in 0..self.names.len() as u32 {
+            starts.push((self.edges.len() - edges.len()) as u32);
+            while edges.next_if(|(from, _)| from.0 == caller).is_some() {}
+        }
+        starts.push(self.edges.len() as u32);
+        CallGraph {
+            names: self.names,
+            ids: self.ids,
+            defined: self.defined,
+            indirect: self.indirect,
+            starts,
+            callees: self.edges.into_iter().map(|(_, callee)| callee).collect(),
+        }
+    }
+}
+
+/// The calls of one function definition.
+#[derive(Default)]
+struct Calls {
+    name: Option<Symbol>,
+    /// The names of functions called by name, including names that turn out
+    /// to be locals.
+    callees: Vec<Symbol>,
+    /// Names of the parameters and local variables of the function.
+    locals: FxHashSet<Symbol>,
+    indirect: u32,
+}
+
+impl Calls {
+    fn of(f: &FunctionDefinition) -> Self {
+        let mut calls = Calls {
+            name: f.declarator.identifier().map(|name| name.0),
+            ..Calls::default()
+        };
+        calls.visit_function_definition(f);
+        // Calls of locals are through function pointers
+        let Calls { callees, locals, indirect, .. } = &mut calls;
+        let before = callees.len();
+        callees.retain(|callee| !locals.contains(callee));
+        *indirect += (before - callees.len()) as u32;
+        calls
+    }
+}
+
+/// The name of the function called by `function`, if it is an identifier,
+/// possibly parenthesized.
+fn callee(mut function: &PostfixExpression) -> Option<Symbol> {
+    loop {
+        match function {
+            PostfixExpression::Primary(PrimaryExpression::Identifier(name)) => return Some(name.0),
+            PostfixExpression::Primary(PrimaryExpression::Parenthesized(e)) => match &e.kind {
+                ExpressionKind::Postfix(inner) => function = inner,
+                _ => return None,
+            },
+            _ => return None,
+        }
+    }
+}
+
+impl<'a> Visitor<'a> for Calls {
+    type Result = ();
+
+    fn visit_declarator(&mut self, d: &'a Declarator) {
+        // Declarations of functions in the body do not shadow them
+        if !d.is_function()
+            && let Some(name) = d.identifier()
+        {
+            self.locals.insert(name.0);
+        }
+        walk_declarator(self, d)
+    }
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) {
+        if let PostfixExpression::FunctionCall { function, .. } = p {
+            match callee(function) {
+                Some(name) => self.callees.push(name),
+                None => self.indirect += 1,
+            }
+        }
+        walk_postfix_expression(self, p)
+    }
+}
@@ -0,0 +1,502 @@
+//! Control-flow graphs of function bodies.
+//!
+//! A [`Cfg`] splits the body of a function into basic blocks of declarations
+//! and expressions evaluated in order, joined by edges for the branches of
+//! `if`, `switch` and loops and for jumps. The graph of a function is stored
+//! in a few flat vectors, with blocks named by compact [`BlockId`]s and the
+//! edges of each block contiguous, so building and walking it touches little
+//! memory. `goto`s are recorded as the body is walked and joined to their
+//! labels once the walk is over, so the body is walked once.
+//!
+//! ```ignore
+//! for (function, cfg) in cgrammar::cfg::build_all(&unit) {
+//!     let unreachable = cfg.reachable().iter().filter(|&&reachable| !reachable).count();
+//!     println!("{:?}: {} blocks, {unreachable} unreachable", function.declarator.identifier(), cfg.len());
+//! }
+//! ```
+
+use std::ops::Range;
+
+use rustc_hash::FxHashMap;
+
+use crate::{ast::*, parallel::par_map, symbol::Symbol, visitor::grow};
+
+/// A handle to a basic block of a [`Cfg`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct BlockId(u32);
+
+impl BlockId {
+    /// The index of the block in its graph.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// What a block of a [`Cfg`] evaluates, in order.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Element<'a> {
+    /// A declaration, with its initializers.
+    Declaration(&'a Declaration),
+    /// An expression: of an expression statement, a `return`, the update of a
+    /// `for`, or the condition of the branch that ends the block.
+    Expression(&'a Expression),
+}
+
+/// Why control goes along an edge.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum EdgeKind {
+    /// Unconditionally, falling through or by a jump.
+    Next,
+    /// When the condition that ends the block is true.
+    True,
+    /// When the condition that ends the block is false.
+    False,
+    /// From a `switch` to one of its `case` labels.
+    Case,
+    /// From a `switch` to its `default` label, or past its body if it has
+    /// none.
+    Default,
+}
+
+/// An edge of a [`Cfg`], as a successor or a predecessor of a block.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct Edge {
+    /// The block at the other end.
+    pub block: BlockId,
+    /// Why control goes along the edge.
+    pub kind: EdgeKind,
+}
+
+/// The control-flow graph of a function body.
+///
+/// The entry block [`Cfg::ENTRY`] holds the first statements of the body,
+/// and every `return`, and the end of the body, leads to the empty exit block
+/// [`Cfg::EXIT`]. The statements after a jump are in a block of their own,
+/// with no predecessors unless they are labeled.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Cfg<'a> {
+    elements: Vec<Element<'a>>,
+    /// The range of elements of each block.
+    blocks: Vec<Range<u32>>,
+    /// The edges of all blocks, those of each block contiguous from the
+    /// start of the block in `*_starts`.
+    successors: Vec<Edge>,
+    successor_starts: Vec<u32>,
+    predecessors: Vec<Edge>,
+    predecessor_starts: Vec<u32>,
+    labels: FxHashMap<Symbol, BlockId>,
+    unresolved: Vec<(BlockId, Identifier)>,
+}
+
+impl<'a> Cfg<'a> {
+    /// The block control enters the function at.
+    pub const ENTRY: BlockId = BlockId(0);
+    /// The block control leaves the function from.
+    pub const EXIT: BlockId = BlockId(1);
+
+    /// Build the graph of the body of `f`.
+    pub fn new(f: &'a FunctionDefinition) -> Self {
+        Self::from_body(&f.body)
+    }
+
+    /// Build the graph of a function body.
+    pub fn from_body(body: &'a CompoundStatement) -> Self {
+        let mut builder = Builder::default();
+        let entry = builder.new_block();
+        let exit = builder.new_block();
+        debug_assert_eq!((entry, exit), (Self::ENTRY, Self::EXIT));
+        builder.start(entry);
+        builder.compound_statement(body);
+        builder.edge(exit, EdgeKind::Next);
+        builder.start(exit);
+        builder.finish()
+    }
+
+    /// Number of blocks.
+    pub fn len(&self) -> usize {
+        self.blocks.len()
+    }
+
+    /// Whether there are no blocks, only for a default graph.
+    pub fn is_empty(&self) -> bool {
+        self.blocks.is_empty()
+    }
+
+    /// The blocks, in the order they were created.
+    pub fn blocks(&self) -> impl ExactSizeIterator<Item = BlockId> + use<> {
+        (0..self.blocks.len() as u32).map(BlockId)
+    }
+
+    /// What `block` evaluates, in order.
+    pub fn elements(&self, block: BlockId) -> &[Element<'a>] {
+        let range = &self.blocks[block.index()];
+        &self.elements[range.start as usize..range.end as usize]
+    }
+
+    /// The edges from `block`, each to its successor.
+    pub fn successors(&self, block: BlockId) -> &[Edge] {
+        edges(&self.successors, &self.successor_starts, block)
+    }
+
+    /// The edges to `block`, each from its predecessor.
+    pub fn predecessors(&self, block: BlockId) -> &[Edge] {
+        edges(&self.predecessors, &self.predecessor_starts, block)
+    }
+
+    /// The block starting at the label `name`.
+    pub fn label(&self, name: Symbol) -> Option<BlockId> {
+        self.labels.get(&name).copied()
+    }
+
+    /// The `goto`s to labels that are not in the body, with the blocks they
+    /// end.
+    pub fn unresolved_gotos(&self) -> &[(BlockId, Identifier)] {
+        &self.unresolved
+    }
+
+    /// Whether each block, by index, is reachable from the entry.
+    pub fn reachable(&self) -> Vec<bool> {
+        let mut reachable = vec![false; self.len()];
+        let mut stack = vec![Self::ENTRY];
+        while let Some(block) = stack.pop() {
+            if std::mem::replace(&mut reachable[block.index()], true) {
+                continue;
+            }
+            stack.extend(self.successors(block).iter().map(|edge| edge.block));
+        }
+        reachable
+    }
+}
+
+fn edges<'e>(edges: &'e [Edge], starts: &[u32], block: BlockId) -> &'e [Edge] {
+    let (start, end) = (starts[block.index()], starts[block.index() + 1]);
+    &edges[start as usize..end as usize]
+}
+
+/// Build the graphs of the function definitions of `unit` on all available
+/// cores, in the order of the unit.
+pub fn build_all<'a>(unit: &'a TranslationUnit) -> Vec<(&'a FunctionDefinition, Cfg<'a>)> {
+    let functions: Vec<_> = (unit.external_declarations.iter())
+        .filter_map(|d| match d {
+            ExternalDeclaration::Function(f) => Some(f),
+            ExternalDeclaration::Declaration(_) => None,
+        })
+        .collect();
+    par_map(&functions, |&f| (f, Cfg::new(f)))
+}
+
+/// Where `break` and `continue` go in the innermost loop or `switch`.
+#[derive(Debug, Clone, Copy)]
+struct Targets {
+    break_to: BlockId,
+    /// `None` for a `switch`, whose `continue`s go to the enclosing loop.
+    continue_to: Option<BlockId>,
+}
+
+/// The innermost `switch`, that its labels are edges from.
+#[derive(Debug, Clone, Copy)]
+struct Switch {
+    block: BlockId,
+    has_default: bool,
+}
+
+/// Builds a [`Cfg`], appending the elements of the current block as the
+/// body is walked. A block is current once, so the elements of each block are
+/// contiguous.
+#[derive(Debug, Default)]
+struct Builder<'a> {
+    cfg: Cfg<'a>,
+    current: Option<BlockId>,
+    edges: Vec<(BlockId, Edge)>,
+    targets: Vec<Targets>,
+    switches: Vec<Switch>,
+    gotos: Vec<(BlockId, Identifier)>,
+}
+
+impl<'a> Builder<'a> {
+    fn new_block(&mut self) -> BlockId {
+        let id = BlockId(self.cfg.blocks.len().try_into().expect("Too many blocks"));
+        self.cfg.blocks.push(0..0);
+        id
+    }
+
+    /// Make `block` the current block.
+    fn start(&mut self, block: BlockId) {
+        let start = self.cfg.elements.len() as u32;
+        self.cfg.blocks[block.index()] = start..start;
+        self.current = Some(block);
+    }
+
+    fn current(&self) -> BlockId {
+        self.current.expect("A block is always current")
+    }
+
+    fn push(&mut self, element: Element<'a>) {
+        self.cfg.elements.push(element);
+        let block = self.current();
+        self.cfg.blocks[block.index()].end = self.cfg.elements.len() as u32;
+    }
+
+    /// Add an edge from the current block to `to`.
+    fn edge(&mut self, to: BlockId, kind: EdgeKind) {
+        let from = self.current();
+        self.edge_from(from, to, kind);
+    }
+
+    fn edge_from(&mut self, from: BlockId, to: BlockId, kind: EdgeKind) {
+        self.edges.push((from, Edge { block: to, kind }));
+    }
+
+    /// Continue in a new block after a jump, unreachable unless labeled.
+    fn after_jump(&mut self) {
+        let block = self.new_block();
+        self.start(block);
+    }
+
+    /// Continue in a new block that the current one falls through to.
+    fn fall_through(&mut self) -> BlockId {
+        let block = self.new_block();
+        self.edge(block, EdgeKind::Next);
+        self.start(block);
+        block
+    }
+
+    fn compound_statement(&mut self, c: &'a CompoundStatement) {
+        for item in &c.items {
+            match item {
+                BlockItem::Declaration(d) => self.push(Element::Declaration(d)),
+                BlockItem::Statement(s) => self.unlabeled_statement(s),
+                BlockItem::Label(label) => self.label(label),
+            }
+        }
+    }
+
+    fn statement(&mut self, s: &'a Statement) {
+        grow(|| match &s.kind {
+            StatementKind::Labeled(ls) => {
+                self.label(&ls.label);
+                self.statement(&ls.statement);
+            }
+            StatementKind::Unlabeled(u) => self.unlabeled_statement(u),
+        })
+    }
+
+    /// Start the block of a label.
+    fn label(&mut self, label: &'a Label) {
+        let block = self.fall_through();
+        match label {
+            Label::Identifier { identifier, .. } => {
+                self.cfg.labels.insert(identifier.0, block);
+            }
+            Label::Case { .. } => {
+                if let Some(&switch) = self.switches.last() {
+                    self.edge_from(switch.block, block, EdgeKind::Case);
+                }
+            }
+            Label::Default { .. } => {
+                if let Some(switch) = self.switches.last_mut() {
+                    switch.has_default = true;
+                    let from = switch.block;
+                    self.edge_from(from, block, EdgeKind::Default);
+                }
+            }
+        }
+    }
+
+    fn unlabeled_statement(&mut self, s: &'a UnlabeledStatement) {
+        match s {
+            UnlabeledStatement::Expression(e) => {
+                if let Some(e) = &e.expression {
+                    self.push(Element::Expression(e));
+                }
+            }
+            UnlabeledStatement::Primary { block, .. } => match block {
+                PrimaryBlock::Compound(c) => self.compound_statement(c),
+                PrimaryBlock::Selection(s) => self.selection_statement(s),
+                PrimaryBlock::Iteration(i) => self.iteration_statement(i),
+            },
+            UnlabeledStatement::Jump { statement, .. } => self.jump_statement(statement),
+        }
+    }
+
+    fn selection_statement(&mut self, s: &'a SelectionStatement) {
+        match s {
+            SelectionStatement::If { condition, then_stmt, else_stmt } => {
+                self.push(Element::Expression(condition));
+                let branch = self.current();
+                let join = self.new_block();
+
+                let then_block = self.new_block();
+                self.edge(then_block, EdgeKind::True);
+                self.start(then_block);
+                self.statement(then_stmt);
+                self.edge(join, EdgeKind::Next);
+
+                match else_stmt {
+                    Some(else_stmt) => {
+                        let else_block = self.new_block();
+                        self.edge_from(branch, else_block, EdgeKind::False);
+                        self.start(else_block);
+                        self.statement(else_stmt);
+                        self.edge(join, EdgeKind::Next);
+                    }
+                    None => self.edge_from(branch, join, EdgeKind::False),
+                }
+                self.start(join);
+            }
+            SelectionStatement::Switch { expression, statement } => {
+                self.push(Element::Expression(expression));
+                let block = self.current();
+                let join = self.new_block();
+                self.switches.push(Switch { block, has_default: false });
+                self.targets.push(Targets { break_to: join, continue_to: None });
+
+                // The statements before the first label are unreachable
+                self.after_jump();
+                self.statement(statement);
+                self.edge(join, EdgeKind::Next);
+
+                self.targets.pop();
+                if let Some(switch) = self.switches.pop()
+                    && !switch.has_default
+                {
+                    self.edge_from(block, join, EdgeKind::Default);
+                }
+                self.start(join);
+            }
+        }
+    }
+
+    fn iteration_statement(&mut self, i: &'a IterationStatement) {
+        match i {
+            IterationStatement::While { condition, body } => {
+                let head = self.fall_through();
+                self.push(Element::Expression(condition));
+                let join = self.new_block();
+                self.edge(join, EdgeKind::False);
+                self.loop_body(body, EdgeKind::True, join, head);
+                self.edge(head, EdgeKind::Next);
+                self.start(join);
+            }
+            IterationStatement::DoWhile { body, condition } => {
+                let join = self.new_block();
+                let tail = self.new_block();
+                let first = self.loop_body(body, EdgeKind::Next, join, tail);
+                self.edge(tail, EdgeKind::Next);
+                self.start(tail);
+                self.push(Element::Expression(condition));
+                self.edge(first, EdgeKind::True);
+                self.edge(join, EdgeKind::False);
+                self.start(join);
+            }
+            IterationStatement::For { init, condition, update, body } => {
+                match init {
+                    Some(ForInit::Declaration(d)) => self.push(Element::Declaration(d)),
+                    Some(ForInit::Expression(e)) => self.push(Element::Expression(e)),
+                    None => {}
+                }
+                let head = self.fall_through();
+                let join = self.new_block();
+                let kind = match condition {
+                    Some(condition) => {
+                        self.push(Element::Expression(condition));
+                        self.edge(join, EdgeKind::False);
+                        EdgeKind::True
+                    }
+                    None => EdgeKind::Next,
+                };
+                let tail = self.new_block();
+                self.loop_body(body, kind, join, tail);
+                self.edge(tail, EdgeKind::Next);
+                self.start(tail);
+                if let Some(update) = update {
+                    self.push(Element::Expression(update));
+                }
+                self.edge(head, EdgeKind::Next);
+                self.start(join);
+            }
+            IterationStatement::Error => {}
+        }
+    }
+
+    /// Build the body of a loop in a new block, entered from the current
+    /// one along a `kind` edge, returning the new block. The body is left
+    /// current.
+    fn loop_body(&mut self, body: &'a Statement, kind: EdgeKind, break_to: BlockId, continue_to: BlockId) -> BlockId {
+        let first = self.new_block();
+        self.edge(first, kind);
+        self.start(first);
+        self.targets.push(Targets { break_to, continue_to: Some(continue_to) });
+        self.statement(body);
+        self.targets.pop();
+        first
+    }
+
+    fn jump_statement(&mut self, j: &'a JumpStatement) {
+        match j {
+            JumpStatement::Goto(label) => {
+                let from = self.current();
+                self.gotos.push((from, *label));
+            }
+            JumpStatement::Continue => {
+                if let Some(to) = self.targets.iter().rev().find_map(|targets| targets.continue_to) {
+                    self.edge(to, EdgeKind::Next);
+                }
+            }
+            JumpStatement::Break => {
+                if let Some(targets) = self.targets.last() {
+                    let to = targets.break_to;
+                    self.edge(to, EdgeKind::Next);
+                }
+            }
+            JumpStatement::Return(e) => {
+                if let Some(e) = e {
+                    self.push(Element::Expression(e));
+                }
+                self.edge(Cfg::EXIT, EdgeKind::Next);
+            }
+        }
+        self.after_jump();
+    }
+
+    /// Resolve the `goto`s and group the edges by block.
+    fn finish(mut self) -> Cfg<'a> {
+        for (from, label) in std::mem::take(&mut self.gotos) {
+            match self.cfg.label(label.0) {
+                Some(to) => self.edge_from(from, to, EdgeKind::Next),
+                None => self.cfg.unresolved.push((from, label)),
+            }
+        }
+
+        let blocks = self.cfg.blocks.len();
+        let (successors, successor_starts) = group(blocks, self.edges.iter().copied());
+        let reversed = (self.edges.iter()).map(|&(from, edge)| (edge.block, Edge { block: from, kind: edge.kind }));
+        let (predecessors, predecessor_starts) = group(blocks, reversed);
+        Cfg {
+            successors,
+            successor_starts,
+            predecessors,
+            predecessor_starts,
+            ..self.cfg
+        }
+    }
+}
+
+/// The edges by block, in a counting sort that keeps the order of the edges
+/// of each block, with the start of each block's edges.
+fn group(blocks: usize, edges: impl Iterator<Item = (BlockId, Edge)> + Clone) -> (Vec<Edge>, Vec<u32>) {
+    let mut starts = vec![0u32; blocks + 1];
+    for (block, _) in edges.clone() {
+        starts[block.index() + 1] += 1;
+    }
+    for index in 0..blocks {
+        starts[index + 1] += starts[index];
+    }
+    let mut next = starts.clone();
+    let mut grouped = vec![Edge { block: BlockId(0), kind: EdgeKind::Next }; starts[blocks] as usize];
+    for (block, edge) in edges {
+        grouped[next[block.index()] as usize] = edge;
+        next[block.index()] += 1;
+    }
+    (grouped, starts)
+}
@@ -0,0 +1,354 @@
+//! Detection of copied code by fingerprints of its tokens.
+//!
+//! A [`CloneIndex`] works on the tokens of translation units, without parsing
+//! them. The tokens of each top-level declaration are normalized, with every
+//! identifier that is not a keyword replaced by a placeholder and every
+//! constant by its kind, so that code copied and then renamed, or with other
+//! constants, still matches. The declaration is fingerprinted by winnowing:
+//! of the hashes of its runs of [`CloneIndex::k`] tokens, the smallest of each
+//! [`CloneIndex::window`] consecutive hashes is kept. Two declarations that
+//! share a run of at least `k + window - 1` tokens are then guaranteed to
+//! share a fingerprint, and an inverted index from fingerprints to
+//! declarations finds the pairs that share many.
+//!
+//! ```ignore
+//! let index = cgrammar::clones::CloneIndex::from_sources(&files);
+//! for pair in index.clone_pairs(0.8) {
+//!     println!("{:?} {:?}: {:.0}%", pair.first, pair.second, pair.similarity * 100.0);
+//! }
+//! ```
+//!
+//! Units are fingerprinted in parallel, and their tokens are dropped once
+//! fingerprinted.
+
+use std::hash::BuildHasher;
+
+use rustc_hash::{FxBuildHasher, FxHashMap};
+
+use crate::{
+    BalancedToken, BalancedTokenSequence, Constant, Punctuator, lex,
+    parallel::{par_map, split_external_declarations},
+    span::{Span, Spanned},
+};
+
+/// Default length of the runs of tokens hashed.
+const DEFAULT_K: usize = 24;
+
+/// Default number of consecutive hashes of which the smallest is kept.
+const DEFAULT_WINDOW: usize = 8;
+
+/// Fingerprints shared by more declarations than this are boilerplate, e.g.
+/// the same run of prototypes in every header, and are not used to pair
+/// declarations, which would take time quadratic in their number.
+const MAX_POSTINGS: usize = 64;
+
+/// Multiplier of the rolling hash.
+const BASE: u64 = 0x100_0000_01b3;
+
+/// A top-level declaration of a unit of a [`CloneIndex`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct DeclarationRef {
+    /// The index of the unit, in the order the units were added.
+    pub unit: usize,
+    /// The span of the declaration in its unit.
+    pub span: Span,
+}
+
+impl DeclarationRef {
+    /// The order of the declarations: by unit, then in their unit.
+    fn key(&self) -> (usize, usize) {
+        (self.unit, self.span.range().start)
+    }
+}
+
+/// Two declarations that share fingerprints.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct ClonePair {
+    pub first: DeclarationRef,
+    pub second: DeclarationRef,
+    /// Number of distinct fingerprints the declarations share.
+    pub shared: usize,
+    /// The shared fingerprints over those of the smaller declaration, from 0
+    /// to 1.
+    pub similarity: f64,
+}
+
+/// A declaration with its distinct fingerprints, sorted.
+#[derive(Debug, Clone)]
+struct Fingerprinted {
+    declaration: DeclarationRef,
+    fingerprints: Vec<u64>,
+}
+
+/// An index of the fingerprints of the top-level declarations of many units.
+///
+/// See the [module documentation](self).
+#[derive(Debug, Clone)]
+pub struct CloneIndex {
+    k: usize,
+    window: usize,
+    units: usize,
+    declarations: Vec<Fingerprinted>,
+    /// The declarations of each fingerprint, by index in `declarations`.
+    postings: FxHashMap<u64, Vec<u32>>,
+}
+
+impl Default for CloneIndex {
+    fn default() -> Self {
+        Self::new(DEFAULT_K, DEFAULT_WINDOW)
+    }
+}
+
+impl CloneIndex {
+    /// Create an empty index hashing runs of `k` tokens and keeping the
+    /// smallest of each `window` consecutive hashes.
+    ///
+    /// Declarations of fewer than `k` tokens have no fingerprints.
+    pub fn new(k: usize, window: usize) -> Self {
+        assert!(k > 0 && window > 0, "runs and windows must not be empty");
+        Self {
+            k,
+            window,
+            units: 0,
+            declarations: Vec::new(),
+            postings: FxHashMap::default(),
+        }
+    }
+
+    /// Lex `files`, each a source and an optional filename, on all available
+    /// cores, and index the fingerprints of their declarations with the
+    /// default parameters.
+    pub fn from_sources(files: &[(&str, Option<&str>)]) -> Self {
+        let mut index = Self::default();
+        let (k, window) = (index.k, index.window);
+        let units = par_map(files, |&(source, filename)| {
+            let (tokens, _) = lex(source, filename);
+            fingerprint_unit(&tokens, k, window)
+        });
+        for unit in units {
+            index.add_fingerprinted(unit);
+        }
+        index
+    }
+
+    /// Index the fingerprints of the declarations of `units`, on all
+    /// available cores.
+    pub fn add_units(&mut self, units: &[&BalancedTokenSequence]) {
+        let (k, window) = (self.k, self.window);
+        for unit in par_map(units, |tokens| fingerprint_unit(tokens, k, window)) {
+            self.add_fingerprinted(unit);
+        }
+    }
+
+    /// Index the fingerprints of the declarations of one unit, returning the
+    /// index of the unit.
+    pub fn add_unit(&mut self, tokens: &BalancedTokenSequence) -> usize {
+        self.add_fingerprinted(fingerprint_unit(tokens, self.k, self.window))
+    }
+
+    fn add_fingerprinted(&mut self, unit: Vec<(Span, Vec<u64>)>) -> usize {
+        let index = self.units;
+        self.units += 1;
+        for (span, fingerprints) in unit {
+            let id = self.declarations.len() as u32;
+            for &fingerprint in &fingerprints {
+                self.postings.entry(fingerprint).or_default().push(id);
+            }
+            let declaration = DeclarationRef { unit: index, span };
+            self.declarations.push(Fingerprinted { declaration, fingerprints });
+        }
+        index
+    }
+
+    /// The length of the runs of tokens hashed.
+    pub fn k(&self) -> usize {
+        self.k
+    }
+
+    /// The number of consecutive hashes of which the smallest is kept.
+    pub fn window(&self) -> usize {
+        self.window
+    }
+
+    /// The number of units indexed.
+    pub fn units(&self) -> usize {
+        self.units
+    }
+
+    /// The number of declarations indexed with at least one fingerprint.
+    pub fn declarations(&self) -> usize {
+        self.declarations.len()
+    }
+
+    /// The pairs of distinct declarations whose shared fingerprints are at
+    /// least `min_similarity` of those of the smaller one, most similar
+    /// first, then in the order of the declarations.
+    pub fn clone_pairs(&self, min_similarity: f64) -> Vec<ClonePair> {
+        let mut shared: FxHashMap<(u32, u32), u32> = FxHashMap::default();
+        for postings in self.postings.values() {
+            if postings.len() > MAX_POSTINGS {
+                continue;
+            }
+            for (i, &first) in postings.iter().enumerate() {
+                for &second in &postings[i + 1..] {
+                    *shared.entry((first, second)).or_default() += 1;
+                }
+            }
+        }
+
+        let mut pairs: Vec<_> = shared
+            .into_iter()
+            .filter_map(|((first, second), shared)| {
+                let (first, second) = (&self.declarations[first as usize], &self.declarations[second as usize]);
+                let smaller = first.fingerprints.len().min(second.fingerprints.len());
+                let similarity = shared as f64 / smaller as f64;
+                (similarity >= min_similarity).then_some(ClonePair {
+                    first: first.declaration,
+                    second: second.declaration,
+                    shared: shared as usize,
+                    similarity,
+                })
+            })
+            .collect();
+        pairs.sort_by(|a, b| {
+            (b.similarity.total_cmp(&a.similarity))
+                .then_with(|| a.first.key().cmp(&b.first.key()))
+                .then_with(|| a.second.key().cmp(&b.second.key()))
+        });
+        pairs
+    }
+}
+
+/// The span and distinct fingerprints of each top-level declaration of
+/// `tokens` that has any.
+fn fingerprint_unit(tokens: &BalancedTokenSequence, k: usize, window: usize) -> Vec<(Span, Vec<u64>)> {
+    let mut codes = Vec::new();
+    let mut hashes = Vec::new();
+    let mut declarations = Vec::new();
+    for range in split_external_declarations(&tokens.tokens) {
+        let declaration = &tokens.tokens[range];
+        codes.clear();
+        normalize(declaration, &mut codes);
+        rolling_hashes(&codes, k, &mut hashes);
+        let fingerprints = winnow(&hashes, window);
+        if fingerprints.is_empty() {
+            continue;
+        }
+        let (first, last) = (
+            declaration[0].span.range(),
+            declaration[declaration.len() - 1].span.range(),
+        );
+        declarations.push((Span::new(first.start..last.end), fingerprints));
+    }
+    declarations
+}
+
+/// A token as it is compared: identifiers that are not keywords, and
+/// constants of the same kind, are all the same.
+#[derive(Hash)]
+enum Normalized {
+    Open(u8),
+    Close(u8),
+    Keyword(u32),
+    Identifier,
+    Constant(u8),
+    String,
+    Punctuator(Punctuator),
+    Other,
+}
+
+/// Append the hashes of the normalized tokens of `tokens`, at every depth,
+/// to `codes`.
+fn normalize(tokens: &[Spanned<BalancedToken>], codes: &mut Vec<u64>) {
+    let push = |codes: &mut Vec<u64>, token: Normalized| codes.push(FxBuildHasher.hash_one(token));
+    for token in tokens {
+        let group = match &token.value {
+            BalancedToken::Parenthesized(inner) => Some((0, inner)),
+            BalancedToken::Bracketed(inner) => Some((1, inner)),
+            BalancedToken::Braced(inner) => Some((2, inner)),
+            _ => None,
+        };
+        if let Some((kind, inner)) = group {
+            push(codes, Normalized::Open(kind));
+            normalize(&inner.tokens, codes);
+            push(codes, Normalized::Close(kind));
+            continue;
+        }
+        let normalized = match &token.value {
+            BalancedToken::Identifier(identifier) if identifier.0.is_reserved() => {
+                Normalized::Keyword(identifier.0.as_u32())
+            }
+            BalancedToken::Identifier(_) => Normalized::Identifier,
+            BalancedToken::Constant(constant) => Normalized::Constant(match constant {
+                Constant::Integer(_) => 0,
+                Constant::Floating(_) => 1,
+                Constant::Character(_) => 2,
+                Constant::Predefined(_) => 3,
+            }),
+            BalancedToken::StringLiteral(_) | BalancedToken::QuotedString(_) => Normalized::String,
+            BalancedToken::Punctuator(punctuator) => Normalized::Punctuator(*punctuator),
+            _ => Normalized::Other,
+        };
+        push(codes, normalized);
+    }
+}
+
+/// Set `hashes` to the rolling hashes of the runs of `k` codes of `codes`.
+fn rolling_hashes(codes: &[u64], k: usize, hashes: &mut Vec<u64>) {
+    hashes.clear();
+    if codes.len() < k {
+        return;
+    }
+    // The weight of the code leaving the run
+    let top = (1..k).fold(1u64, |power, _| power.wrapping_mul(BASE));
+    let mut hash = 0u64;
+    for (i, &code) in codes.iter().enumerate() {
+        if i >= k {
+            hash = hash.wrapping_sub(codes[i - k].wrapping_mul(top));
+        }
+        hash = hash.wrapping_mul(BASE).wrapping_add(code);
+        if i + 1 >= k {
+            hashes.push(hash);
+        }
+    }
+}
+
+/// The distinct smallest hashes of each `window` consecutive `hashes`,
+/// sorted, or the smallest of all if there are fewer.
+fn winnow(hashes: &[u64], window: usize) -> Vec<u64> {
+    let mut fingerprints: Vec<u64> = if hashes.len() <= window {
+        hashes.iter().min().copied().into_iter().collect()
+    } else {
+        hashes
+            .windows(window)
+            .map(|window| *window.iter().min().expect("windows are not empty"))
+            .collect()
+    };
+    fingerprints.sort_unstable();
+    fingerprints.dedup();
+    fingerprints
+}
+
+#[cfg(test)]
+mod test {
+    use super::{rolling_hashes, winnow};
+
+    #[test]
+    fn test_rolling_hashes() {
+        let codes = [3, 1, 4, 1, 5, 9, 2, 6];
+        let mut hashes = Vec::new();
+        rolling_hashes(&codes, 3, &mut hashes);
+        assert_eq!(hashes.len(), codes.len() - 2);
+        // The hash of a run does not depend on what precedes it
+        let mut shifted = Vec::new();
+        rolling_hashes(&codes[2..], 3, &mut shifted);
+        assert_eq!(hashes[2..], shifted[..]);
+    }
+
+    #[test]
+    fn test_winnow() {
+        assert_eq!(winnow(&[5, 3, 8, 3, 9, 1], 3), vec![1, 3]);
+        assert_eq!(winnow(&[5, 3], 3), vec![3]);
+        assert!(winnow(&[], 3).is_empty());
+    }
+}
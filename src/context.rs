@@ -1,21 +1,105 @@
 use std::{
-    cell::{Ref, RefCell, RefMut},
-    rc::Rc,
+    any::Any,
+    cell::Cell,
+    sync::{
+        Arc,
+        atomic::{AtomicBool, AtomicU64, Ordering},
+    },
+    time::{Duration, Instant},
 };
 
 use chumsky::{
     input::{Checkpoint, Cursor, Input},
     inspector::Inspector,
 };
-use rustc_hash::FxHashSet;
+use rustc_hash::FxHashMap;
 
-use crate::{Identifier, utils::Slab};
+#[cfg(feature = "profile")]
+use crate::profile::Profile;
+use crate::{
+    AttributeParsers, Identifier,
+    index::{DeclarationIndex, DeclaredKind, DependencyGraph},
+    span::Span,
+    symbol::Symbol,
+};
 
 /// Parsing state.
+///
+/// Every change to the registered names is recorded in a trail, and rewinding
+/// to a checkpoint undoes the changes made since, most recent first. This
+/// relies on checkpoints being restored in stack order, as chumsky does.
+///
+/// Cloning a state is cheap: the scopes are shared until either copy is
+/// modified.
+///
+/// A state is `Send` and `Sync`, so a parse can be moved to another thread
+/// between external declarations, e.g. a [`ParseIter`](crate::ParseIter) or a
+/// [`PrefixSnapshot`](crate::PrefixSnapshot). The scopes are shared through an
+/// [`Arc`], whose count only changes on clones and on the first change after
+/// one, never on lookups.
 #[derive(Clone)]
 pub struct State {
-    current: usize,
-    contexts: RefCell<Slab<Context>>,
+    scopes: Arc<Scopes>,
+    /// Changes to the scopes, each with the version before it.
+    trail: Vec<(Change, u64)>,
+    /// Number of changes dropped from the front of the trail by [`State::commit`].
+    committed: usize,
+    /// Identifies the contents of the scopes: two states with the same version
+    /// have the same names registered.
+    version: u64,
+    /// Number of scopes pushed onto the innermost one in `scopes` that have
+    /// no names yet, and are only pushed there when a name is bound in them.
+    pending_scopes: usize,
+    /// Kinds of the names looked up recently, by the version they were
+    /// looked up in.
+    lookups: LookupCache,
+    /// Number of error recoveries so far, including rewound ones.
+    recoveries: u64,
+    memo: Option<Memo>,
+    two_pass: Option<TwoPassStats>,
+    resynchronize: bool,
+    /// Current nesting depth, and the maximum allowed.
+    depth: usize,
+    max_depth: Option<usize>,
+    /// Whether the maximum nesting depth was exceeded.
+    depth_exceeded: bool,
+    /// Deepest nesting, most bindings in the live scopes and number of
+    /// rewinds so far, for [`ParseStats`](crate::ParseStats).
+    peak_nesting: usize,
+    peak_bindings: usize,
+    rewinds: u64,
+    /// Deepest nesting since it was last taken, for the `tracing` spans.
+    #[cfg(feature = "tracing")]
+    peak_depth: usize,
+    /// Tokens read so far, including tokens read again after backtracking,
+    /// and the maximum allowed.
+    token_work: u64,
+    max_token_work: Option<u64>,
+    /// Errors recovered from so far, and the maximum allowed.
+    errors: usize,
+    max_errors: Option<usize>,
+    deadline: Option<Instant>,
+    cancellation: Option<CancellationToken>,
+    /// Bytes of the external declarations finished so far, and the maximum
+    /// allowed with the errors.
+    memory: usize,
+    max_memory: Option<usize>,
+    /// Whether the token work, error count, memory or deadline was exceeded,
+    /// or the parse was cancelled.
+    budget_exceeded: bool,
+    cancelled: bool,
+    memory_exceeded: bool,
+    #[cfg(feature = "profile")]
+    profile: Option<Box<Profile>>,
+    lazy_function_bodies: bool,
+    lazy_blocks: bool,
+    compact_initializers: bool,
+    declarations: Option<DeclarationIndex>,
+    dependencies: Option<DependencyCollector>,
+    attribute_parsers: Option<Arc<AttributeParsers>>,
+    /// Number of enclosing compound statements and parameter lists.
+    scope_depth: u32,
+    rule_labels: bool,
 }
 
 impl Default for State {
@@ -27,155 +111,1561 @@ impl Default for State {
 impl State {
     /// Create a new parsing state.
     pub fn new() -> Self {
-        let mut contexts = Slab::new();
-        let current = contexts.insert(Context::default());
-        let contexts = RefCell::new(contexts);
-        Self { current, contexts }
+        Self {
+            scopes: Arc::default(),
+            trail: Vec::new(),
+            committed: 0,
+            version: 0,
+            pending_scopes: 0,
+            lookups: LookupCache::default(),
+            recoveries: 0,
+            memo: None,
+            two_pass: None,
+            resynchronize: false,
+            depth: 0,
+            max_depth: None,
+            depth_exceeded: false,
+            peak_nesting: 0,
+            peak_bindings: 0,
+            rewinds: 0,
+            #[cfg(feature = "tracing")]
+            peak_depth: 0,
+            token_work: 0,
+            max_token_work: None,
+            errors: 0,
+            max_errors: None,
+            deadline: None,
+            cancellation: None,
+            memory: 0,
+            max_memory: None,
+            budget_exceeded: false,
+            cancelled: false,
+            memory_exceeded: false,
+            #[cfg(feature = "profile")]
+            profile: None,
+            lazy_function_bodies: false,
+            lazy_blocks: false,
+            compact_initializers: false,
+            declarations: None,
+            dependencies: None,
+            attribute_parsers: None,
+            scope_depth: 0,
+            rule_labels: true,
+        }
+    }
+
+    /// Whether function bodies are kept unparsed until first accessed.
+    pub fn lazy_function_bodies(&self) -> bool {
+        self.lazy_function_bodies
+    }
+
+    /// Set whether function bodies are kept unparsed until first accessed.
+    ///
+    /// See [`FunctionBody`](crate::FunctionBody) for details.
+    pub fn set_lazy_function_bodies(&mut self, lazy: bool) {
+        self.lazy_function_bodies = lazy;
+    }
+
+    /// Whether compound statements nested in function bodies are kept
+    /// unparsed until first accessed.
+    pub fn lazy_blocks(&self) -> bool {
+        self.lazy_blocks
+    }
+
+    /// Set whether compound statements nested in function bodies are kept
+    /// unparsed until first accessed.
+    ///
+    /// The statements around a block are parsed, so the control structure of
+    /// a body is there to look at, while each block, e.g. each case of a large
+    /// generated `switch`, is parsed when a tool first descends into it, with
+    /// the blocks nested in it left unparsed in turn. See
+    /// [`Block`](crate::Block) for details.
+    pub fn set_lazy_blocks(&mut self, lazy: bool) {
+        self.lazy_blocks = lazy;
+    }
+
+    /// Whether braced initializers of constants only are kept as a
+    /// [`ConstantInitializer`](crate::ConstantInitializer).
+    pub fn compact_initializers(&self) -> bool {
+        self.compact_initializers
+    }
+
+    /// Set whether braced initializers of constants only, e.g. the tables of
+    /// generated code, are kept as a [`ConstantInitializer`](crate::ConstantInitializer)
+    /// instead of an expression per constant.
+    pub fn set_compact_initializers(&mut self, compact: bool) {
+        self.compact_initializers = compact;
+    }
+
+    /// Set whether the parser collects the names declared into a
+    /// [`DeclarationIndex`].
+    ///
+    /// Names are entered as their declarations are parsed, and removed again
+    /// when the parser backtracks out of them, so the index has the names of
+    /// the declarations in the result, without a separate walk of the tree.
+    /// Names declared in lazy function bodies are not collected.
+    ///
+    /// Enabling the index discards the names collected so far.
+    pub fn set_declaration_index(&mut self, collect: bool) {
+        self.declarations = collect.then(DeclarationIndex::default);
+    }
+
+    /// The names declared since the index was enabled.
+    pub fn declaration_index(&self) -> Option<&DeclarationIndex> {
+        self.declarations.as_ref()
+    }
+
+    /// Take the names declared since the index was enabled, leaving it
+    /// enabled and empty.
+    pub fn take_declaration_index(&mut self) -> Option<DeclarationIndex> {
+        self.declarations.as_mut().map(std::mem::take)
+    }
+
+    /// Enter `name` into the declaration index, if enabled.
+    pub(crate) fn declare(&mut self, name: Identifier, kind: DeclaredKind, span: Span) {
+        if let Some(index) = &mut self.declarations {
+            index.push(name.0, kind, span, self.scope_depth);
+        }
+    }
+
+    /// Set the kind of `name` declared by the declarator at `span`, which is
+    /// entered as an object.
+    pub(crate) fn declare_as(&mut self, name: Identifier, kind: DeclaredKind, span: Span) {
+        if let Some(index) = &mut self.declarations {
+            index.set_kind(name.0, span.range().start, kind);
+        }
+    }
+
+    /// Set whether the parser collects a [`DependencyGraph`] of the external
+    /// declarations parsed.
+    ///
+    /// For each external declaration, the graph has the names the parser
+    /// looked up as typedef names or enumeration constants, including in the
+    /// alternatives it backtracked out of, since the lookups chose between
+    /// those too, and the typedef names and enumeration constants it bound
+    /// at file scope. Names looked up in lazy function bodies are not
+    /// collected.
+    ///
+    /// Enabling the graph discards the declarations collected so far.
+    pub fn set_dependency_graph(&mut self, collect: bool) {
+        self.dependencies = collect.then(|| DependencyCollector {
+            graph: DependencyGraph::default(),
+            lookups: Vec::new(),
+            bindings: self.bindings_len(),
+        });
+    }
+
+    /// The dependencies of the external declarations parsed since the graph
+    /// was enabled.
+    pub fn dependency_graph(&self) -> Option<&DependencyGraph> {
+        self.dependencies.as_ref().map(|collector| &collector.graph)
+    }
+
+    /// Take the dependencies collected since the graph was enabled, leaving
+    /// it enabled and empty.
+    pub fn take_dependency_graph(&mut self) -> Option<DependencyGraph> {
+        let collector = self.dependencies.as_mut()?;
+        Some(std::mem::take(&mut collector.graph))
+    }
+
+    /// Check whether `name` is a typedef name, noting the lookup in the
+    /// dependency graph, if enabled.
+    pub(crate) fn lookup_typedef_name(&mut self, name: &Identifier) -> bool {
+        if let Some(collector) = &mut self.dependencies {
+            collector.lookups.push(name.0);
+        }
+        self.lookup(Kind::TypedefName, name)
+    }
+
+    /// Check whether `name` is an enumeration constant, noting the lookup in
+    /// the dependency graph, if enabled.
+    pub(crate) fn lookup_enum_constant(&mut self, name: &Identifier) -> bool {
+        if let Some(collector) = &mut self.dependencies {
+            collector.lookups.push(name.0);
+        }
+        self.lookup(Kind::EnumConstant, name)
+    }
+
+    /// Check whether `name` is bound as `kind`, through the lookup cache.
+    ///
+    /// The parser classifies the same identifiers again whenever it
+    /// backtracks over them, so the kind of each name is kept with the
+    /// version it was looked up in, and found again with one read while the
+    /// version is the same, or is restored by a rewind.
+    fn lookup(&mut self, kind: Kind, name: &Identifier) -> bool {
+        let slot = &mut self.lookups.entries[name.0.as_u32() as usize % LOOKUP_CACHE_SIZE];
+        if slot.version != self.version || slot.name != name.0 {
+            *slot = LookupEntry {
+                version: self.version,
+                name: name.0,
+                kind: self.scopes.names.get(name).copied(),
+            };
+        }
+        slot.kind == Some(kind)
+    }
+
+    /// Enter the external declaration just parsed into the dependency graph,
+    /// if enabled.
+    pub(crate) fn finish_external_declaration(&mut self) {
+        let Some(collector) = &mut self.dependencies else {
+            return;
+        };
+        let bindings = &self.scopes.bindings;
+        let (mut typedef_names, mut enum_constants) = (Vec::new(), Vec::new());
+        for &(kind, name) in &bindings[collector.bindings.min(bindings.len())..] {
+            match kind {
+                Kind::TypedefName => typedef_names.push(name.0),
+                Kind::EnumConstant => enum_constants.push(name.0),
+            }
+        }
+        collector.graph.push(&collector.lookups, typedef_names, enum_constants);
+        collector.lookups.clear();
+        collector.bindings = bindings.len();
+    }
+
+    fn lookups_len(&self) -> usize {
+        self.dependencies
+            .as_ref()
+            .map_or(0, |collector| collector.lookups.len())
+    }
+
+    fn declarations_len(&self) -> usize {
+        self.declarations.as_ref().map_or(0, DeclarationIndex::len)
+    }
+
+    /// Enter a compound statement or parameter list.
+    pub(crate) fn enter_scope(&mut self) {
+        self.scope_depth += 1;
+    }
+
+    /// Leave a scope entered with [`State::enter_scope`].
+    pub(crate) fn exit_scope(&mut self) {
+        self.scope_depth -= 1;
+    }
+
+    /// Whether grammar rules label the errors inside them.
+    pub fn rule_labels(&self) -> bool {
+        self.rule_labels
+    }
+
+    /// Set whether grammar rules label the errors inside them, on by default.
+    ///
+    /// With labels, an error expects the rule it is in, e.g. "expected
+    /// expression", and lists the enclosing rules as its context. Without
+    /// them, errors list the tokens expected and have no context, and failed
+    /// alternatives cost less to track, e.g. when only checking whether the
+    /// input is valid.
+    pub fn set_rule_labels(&mut self, labels: bool) {
+        self.rule_labels = labels;
+    }
+
+    /// Whether the results of the rules that backtrack most are memoized.
+    pub fn memoize(&self) -> bool {
+        self.memo.is_some()
+    }
+
+    /// Set whether the results of the rules that backtrack most are memoized.
+    ///
+    /// Rules such as declaration specifiers and type names are parsed again
+    /// whenever an alternative that contains them fails, e.g. a declaration
+    /// that was first tried as a function definition. With memoization, a
+    /// successful parse of such a rule is recorded by its first token and the
+    /// version of the registered names, and replayed when the rule is tried
+    /// again at the same token with the same names. Parses that recovered
+    /// from an error are not recorded.
+    ///
+    /// Records are dropped by [`State::commit`], which [`translation_unit`]
+    /// calls after each external declaration. A memoizing state used with
+    /// other parsers must not be reused for another token sequence before
+    /// calling [`State::commit`].
+    ///
+    /// Clones of the state start with no records.
+    ///
+    /// [`translation_unit`]: crate::translation_unit
+    pub fn set_memoize(&mut self, memoize: bool) {
+        self.memo = memoize.then(Memo::default);
+    }
+
+    /// Statistics of memoized rules since memoization was enabled.
+    pub fn memo_stats(&self) -> MemoStats {
+        self.memo.as_ref().map_or_else(MemoStats::default, |memo| memo.stats)
+    }
+
+    /// Whether external declarations are parsed without error recovery first.
+    pub fn two_pass(&self) -> bool {
+        self.two_pass.is_some()
+    }
+
+    /// Set whether external declarations are parsed without error recovery
+    /// first.
+    ///
+    /// In this mode, [`translation_unit`] parses each external declaration
+    /// with error recovery disabled, which fails fast on invalid input, and
+    /// only parses a declaration again with error recovery if that fails. The
+    /// result is the same as with error recovery throughout, except that a
+    /// declaration that has a valid parse is never parsed with a recovered
+    /// error instead.
+    ///
+    /// Enabling the mode resets [`State::two_pass_stats`].
+    ///
+    /// [`translation_unit`]: crate::translation_unit
+    pub fn set_two_pass(&mut self, two_pass: bool) {
+        self.two_pass = two_pass.then(TwoPassStats::default);
+    }
+
+    /// Time spent in each pass since two-pass parsing was enabled.
+    pub fn two_pass_stats(&self) -> TwoPassStats {
+        self.two_pass.unwrap_or_default()
+    }
+
+    pub(crate) fn two_pass_stats_mut(&mut self) -> Option<&mut TwoPassStats> {
+        self.two_pass.as_mut()
+    }
+
+    /// Whether a failed external declaration is skipped to the next
+    /// declaration boundary.
+    pub fn resynchronize(&self) -> bool {
+        self.resynchronize
+    }
+
+    /// Set whether a failed external declaration is skipped to the next
+    /// declaration boundary, rather than recovered from inside.
+    ///
+    /// In this mode, [`translation_unit`] parses each external declaration
+    /// with error recovery disabled, and if that fails, skips its top-level
+    /// tokens up to and including the next `;`, or the next braced group and
+    /// a `;` after it, as an erroneous declaration. Each failure costs at most
+    /// one parse of the declaration and one scan of its tokens, however broken
+    /// the input, at the price of coarser errors and of the valid parts of the
+    /// declaration. The mode takes precedence over
+    /// [`two-pass parsing`](State::set_two_pass).
+    ///
+    /// [`translation_unit`]: crate::translation_unit
+    pub fn set_resynchronize(&mut self, resynchronize: bool) {
+        self.resynchronize = resynchronize;
+    }
+
+    /// Set whether the parser records statistics of each rule.
+    ///
+    /// Enabling profiling discards the statistics recorded so far. See the
+    /// [`profile`](crate::profile) module for details.
+    #[cfg(feature = "profile")]
+    pub fn set_profile(&mut self, profile: bool) {
+        self.profile = profile.then(Box::default);
+    }
+
+    /// Statistics of each rule since profiling was enabled.
+    #[cfg(feature = "profile")]
+    pub fn profile(&self) -> Option<&Profile> {
+        self.profile.as_deref()
+    }
+
+    #[cfg(feature = "profile")]
+    pub(crate) fn profile_mut(&mut self) -> Option<&mut Profile> {
+        self.profile.as_deref_mut()
+    }
+
+    /// The maximum nesting depth, if limited.
+    pub fn max_nesting_depth(&self) -> Option<usize> {
+        self.max_depth
+    }
+
+    /// Limit the nesting depth of the parse.
+    ///
+    /// The parser recurses once per nested bracketed group, statement and
+    /// cast or unary operator, so deeply nested input can overflow the native
+    /// stack. With a limit, a construct nested deeper than `max_depth` fails
+    /// with a "nesting too deep" error instead. Once the limit is exceeded,
+    /// every nested construct fails for the rest of the parse, so that the
+    /// parse stops with an error rather than backtracking through every
+    /// level.
+    ///
+    /// The limit is unset by default. The C standard requires at least 63
+    /// levels of nested parentheses and 127 of nested blocks.
+    ///
+    /// Changing the limit clears [`State::nesting_depth_exceeded`].
+    pub fn set_max_nesting_depth(&mut self, max_depth: Option<usize>) {
+        self.max_depth = max_depth;
+        self.reset_nesting();
+    }
+
+    /// Whether the maximum nesting depth was exceeded in the last parse with
+    /// this state.
+    pub fn nesting_depth_exceeded(&self) -> bool {
+        self.depth_exceeded
+    }
+
+    /// Tokens read so far, including tokens read again after backtracking.
+    pub fn token_work(&self) -> u64 {
+        self.token_work
+    }
+
+    /// The maximum number of tokens read, if limited.
+    pub fn max_token_work(&self) -> Option<u64> {
+        self.max_token_work
+    }
+
+    /// Limit the number of tokens read by the parse, counting tokens read
+    /// again after backtracking.
+    ///
+    /// See [`State::budget_exceeded`] for what happens when the limit is
+    /// exceeded.
+    pub fn set_max_token_work(&mut self, max_token_work: Option<u64>) {
+        self.max_token_work = max_token_work;
+    }
+
+    /// The maximum number of errors recovered from, if limited.
+    pub fn max_errors(&self) -> Option<usize> {
+        self.max_errors
+    }
+
+    /// Limit the number of errors the parser recovers from.
+    ///
+    /// Errors in alternatives that were abandoned, and so are not reported,
+    /// are not counted. See [`State::budget_exceeded`] for what happens when
+    /// the limit is exceeded.
+    pub fn set_max_errors(&mut self, max_errors: Option<usize>) {
+        self.max_errors = max_errors;
+    }
+
+    /// The time by which the parse must end, if limited.
+    pub fn deadline(&self) -> Option<Instant> {
+        self.deadline
+    }
+
+    /// Set a time by which the parse must end.
+    ///
+    /// The deadline is checked before each external declaration and every
+    /// few thousand tokens. See [`State::budget_exceeded`] for what happens
+    /// when it passes.
+    pub fn set_deadline(&mut self, deadline: Option<Instant>) {
+        self.deadline = deadline;
+    }
+
+    /// Bytes taken by the parse so far: the external declarations finished,
+    /// inline and on the heap as counted by [`HeapSize`](crate::HeapSize),
+    /// and the errors recovered from.
+    ///
+    /// The declarations are only counted with a memory limit.
+    pub fn memory(&self) -> usize {
+        self.memory + self.errors * size_of::<crate::parser::parser_utils::Error<'static>>()
+    }
+
+    /// The maximum number of bytes taken by the parse, if limited.
+    pub fn max_memory(&self) -> Option<usize> {
+        self.max_memory
+    }
+
+    /// Limit the bytes taken by the parse, as counted by [`State::memory`],
+    /// e.g. to keep a worker serving many clients from running out of memory
+    /// on a huge generated file.
+    ///
+    /// The limit is checked as each external declaration is finished and
+    /// each error recovered from, so a single declaration may go over it;
+    /// limit the token work too to bound that. The tokens are the caller's,
+    /// and are not counted. A parse over the limit ends as when the budget
+    /// is exceeded, see [`State::budget_exceeded`], but with a "resource
+    /// limit exceeded" error.
+    pub fn set_max_memory(&mut self, max_memory: Option<usize>) {
+        self.max_memory = max_memory;
+    }
+
+    /// Whether the parse went over its memory limit.
+    pub fn memory_exceeded(&self) -> bool {
+        self.memory_exceeded
+    }
+
+    /// Count `bytes` of a finished external declaration.
+    pub(crate) fn record_memory(&mut self, bytes: usize) {
+        self.memory += bytes;
+        self.check_memory();
+    }
+
+    fn check_memory(&mut self) {
+        if !self.budget_exceeded && self.max_memory.is_some_and(|max| self.memory() > max) {
+            self.memory_exceeded = true;
+            self.budget_exceeded = true;
+        }
+    }
+
+    /// The parsers of the arguments of custom attributes, if any.
+    pub fn attribute_parsers(&self) -> Option<&Arc<AttributeParsers>> {
+        self.attribute_parsers.as_ref()
+    }
+
+    /// Set the parsers run on the arguments of custom attributes as they are
+    /// parsed, see [`AttributeParsers`].
+    ///
+    /// The parsers are shared with the clones of the state.
+    pub fn set_attribute_parsers(&mut self, parsers: Option<AttributeParsers>) {
+        self.attribute_parsers = parsers.map(Arc::new);
+    }
+
+    /// The token that cancels the parse, if any.
+    pub fn cancellation(&self) -> Option<&CancellationToken> {
+        self.cancellation.as_ref()
+    }
+
+    /// Set a token that cancels the parse from another thread or task, e.g.
+    /// when the input changes before the parse ends.
+    ///
+    /// The token is checked with the deadline, before each external
+    /// declaration and every few thousand tokens, so cancelling it stops the
+    /// parse within a few microseconds. A cancelled parse ends as when the
+    /// budget is exceeded, see [`State::budget_exceeded`], but with a "parse
+    /// cancelled" error.
+    pub fn set_cancellation(&mut self, token: Option<CancellationToken>) {
+        self.cancellation = token;
+    }
+
+    /// Whether the parse was cancelled by its [`CancellationToken`].
+    pub fn cancelled(&self) -> bool {
+        self.cancelled
+    }
+
+    /// Whether the maximum token work, error count or memory, or the
+    /// deadline, was exceeded, or the parse was cancelled.
+    ///
+    /// Once a limit is exceeded, every nested construct fails, as when the
+    /// maximum nesting depth is exceeded, and [`translation_unit`] parses no
+    /// further external declarations: it skips the rest of the input with a
+    /// "parse budget exceeded" error, and returns the declarations parsed so
+    /// far. All limits are unset by default.
+    ///
+    /// [`translation_unit`]: crate::translation_unit
+    pub fn budget_exceeded(&self) -> bool {
+        self.budget_exceeded
+    }
+
+    /// Check the deadline and the cancellation, returning whether any limit
+    /// was exceeded.
+    pub(crate) fn check_budget(&mut self) -> bool {
+        if !self.budget_exceeded && self.cancellation.as_ref().is_some_and(CancellationToken::is_cancelled) {
+            self.cancelled = true;
+            self.budget_exceeded = true;
+        }
+        if !self.budget_exceeded && self.deadline.is_some_and(|deadline| Instant::now() >= deadline) {
+            self.budget_exceeded = true;
+        }
+        self.budget_exceeded
+    }
+
+    /// The message of the errors of a parse that exceeded the budget.
+    pub(crate) fn budget_message(&self) -> &'static str {
+        if self.cancelled {
+            "parse cancelled"
+        } else if self.memory_exceeded {
+            "resource limit exceeded"
+        } else {
+            "parse budget exceeded"
+        }
+    }
+
+    /// Enter a level of nesting, returning `false` if that exceeds the limit
+    /// or the budget was exceeded.
+    pub(crate) fn enter_nesting(&mut self) -> bool {
+        if self.budget_exceeded {
+            return false;
+        }
+        if self.depth_exceeded || self.max_depth.is_some_and(|max| self.depth >= max) {
+            self.depth_exceeded = true;
+            return false;
+        }
+        self.depth += 1;
+        self.peak_nesting = self.peak_nesting.max(self.depth);
+        #[cfg(feature = "tracing")]
+        {
+            self.peak_depth = self.peak_depth.max(self.depth);
+        }
+        true
+    }
+
+    /// The deepest nesting since the last call.
+    #[cfg(feature = "tracing")]
+    pub(crate) fn take_peak_depth(&mut self) -> usize {
+        std::mem::take(&mut self.peak_depth)
+    }
+
+    /// Error recoveries so far, including those in alternatives the parser
+    /// backtracked out of.
+    pub fn recoveries(&self) -> u64 {
+        self.recoveries
+    }
+
+    /// The deepest nesting of the parse so far.
+    pub fn peak_nesting_depth(&self) -> usize {
+        self.peak_nesting
+    }
+
+    /// The most typedef names and enumeration constants bound at once in the
+    /// live scopes so far.
+    pub fn peak_bindings(&self) -> usize {
+        self.peak_bindings.max(self.scopes.bindings.len())
+    }
+
+    /// How often the parser rewound to a checkpoint so far, to backtrack out
+    /// of an alternative or after looking ahead.
+    pub fn rewinds(&self) -> u64 {
+        self.rewinds
+    }
+
+    /// Forget the nesting of a previous parse, when a parse starts.
+    pub(crate) fn reset_nesting(&mut self) {
+        self.depth = 0;
+        self.depth_exceeded = false;
+    }
+
+    /// Leave a level of nesting entered with [`State::enter_nesting`].
+    pub(crate) fn exit_nesting(&mut self) {
+        self.depth -= 1;
     }
 
     /// Get a reference to the current context.
     pub fn ctx(&self) -> ContextRef<'_> {
-        ContextRef {
-            handle: self.current,
-            contexts: &self.contexts,
-        }
+        ContextRef { state: self }
     }
 
     /// Get a mutable reference to the current context.
     pub fn ctx_mut(&mut self) -> ContextRefMut<'_> {
-        ContextRefMut {
-            handle: &mut self.current,
-            contexts: &self.contexts,
+        ContextRefMut { state: self }
+    }
+
+    /// Hash of what decides the tree parsed from a source with this state:
+    /// the names registered in its scopes, by their text, and the options that
+    /// change the shape of the tree. Equal across processes, for the keys of
+    /// caches on disk.
+    #[cfg(all(feature = "serde", feature = "mmap"))]
+    pub(crate) fn seed_hash(&self) -> u64 {
+        use std::hash::{Hash, Hasher};
+
+        let mut hasher = rustc_hash::FxHasher::default();
+        for (kind, name) in &self.scopes.bindings {
+            kind.hash(&mut hasher);
+            name.0.as_str().hash(&mut hasher);
+        }
+        (&self.scopes.starts, self.pending_scopes).hash(&mut hasher);
+        (self.lazy_function_bodies, self.compact_initializers).hash(&mut hasher);
+        hasher.finish()
+    }
+
+    /// Make all changes so far permanent, dropping their undo history.
+    ///
+    /// Must only be called when no live checkpoint precedes the current
+    /// position, e.g. between committed external declarations. Rewinding to
+    /// an earlier checkpoint afterwards leaves the committed names in place.
+    pub fn commit(&mut self) {
+        self.committed += self.trail.len();
+        self.trail.clear();
+        if let Some(memo) = &mut self.memo {
+            memo.entries.clear();
+        }
+    }
+
+    /// Mark the state between external declarations, to undo a failed attempt
+    /// at parsing the next ones with [`State::rewind_to`].
+    ///
+    /// Unlike parsing on a clone, this leaves the scopes unshared, so the
+    /// first name bound in an attempt does not copy them all.
+    pub(crate) fn mark(&self) -> StateMark {
+        StateMark {
+            position: self.position(),
+            errors: self.errors,
+            recoveries: self.recoveries,
+            declarations: self.declarations_len(),
+            depth: self.depth,
+            depth_exceeded: self.depth_exceeded,
+            scope_depth: self.scope_depth,
+        }
+    }
+
+    /// Undo the changes made since `mark`, except the budget spent on them.
+    pub(crate) fn rewind_to(&mut self, mark: &StateMark) {
+        self.rewind(mark.position);
+        self.errors = mark.errors;
+        self.recoveries = mark.recoveries;
+        if let Some(index) = &mut self.declarations {
+            index.truncate(mark.declarations);
+        }
+        self.depth = mark.depth;
+        self.depth_exceeded = mark.depth_exceeded;
+        self.scope_depth = mark.scope_depth;
+        // Memoized for the input of the failed attempt
+        if let Some(memo) = &mut self.memo {
+            memo.entries.clear();
+        }
+    }
+
+    /// Make this state a copy of `template`, keeping the buffers it has grown,
+    /// e.g. to parse many inputs in turn with the same initial state.
+    ///
+    /// The scopes are shared with `template` until either is modified, as
+    /// with [`Clone::clone`], and memoized results are discarded.
+    pub fn reset_from(&mut self, template: &State) {
+        let State {
+            scopes,
+            trail: _,
+            committed,
+            version,
+            pending_scopes,
+            lookups: _,
+            recoveries,
+            memo,
+            two_pass,
+            resynchronize,
+            depth: _,
+            max_depth,
+            depth_exceeded: _,
+            peak_nesting,
+            peak_bindings,
+            rewinds,
+            #[cfg(feature = "tracing")]
+            peak_depth,
+            token_work,
+            max_token_work,
+            errors,
+            max_errors,
+            deadline,
+            cancellation,
+            memory,
+            max_memory,
+            budget_exceeded,
+            cancelled,
+            memory_exceeded,
+            #[cfg(feature = "profile")]
+            profile,
+            lazy_function_bodies,
+            lazy_blocks,
+            compact_initializers,
+            declarations,
+            dependencies,
+            attribute_parsers,
+            scope_depth,
+            rule_labels,
+        } = template;
+        self.scopes = scopes.clone();
+        self.trail.clone_from(&template.trail);
+        self.committed = *committed;
+        self.version = *version;
+        self.pending_scopes = *pending_scopes;
+        self.recoveries = *recoveries;
+        match (&mut self.memo, memo) {
+            (Some(mine), Some(_)) => {
+                mine.entries.clear();
+                mine.stats = MemoStats::default();
+            }
+            (mine, memo) => *mine = memo.clone(),
+        }
+        self.two_pass = *two_pass;
+        self.resynchronize = *resynchronize;
+        // The nesting of a parse with the template is not carried over
+        self.reset_nesting();
+        self.max_depth = *max_depth;
+        self.peak_nesting = *peak_nesting;
+        self.peak_bindings = *peak_bindings;
+        self.rewinds = *rewinds;
+        #[cfg(feature = "tracing")]
+        {
+            self.peak_depth = *peak_depth;
+        }
+        self.token_work = *token_work;
+        self.max_token_work = *max_token_work;
+        self.errors = *errors;
+        self.max_errors = *max_errors;
+        self.deadline = *deadline;
+        self.cancellation.clone_from(cancellation);
+        self.memory = *memory;
+        self.max_memory = *max_memory;
+        self.budget_exceeded = *budget_exceeded;
+        self.cancelled = *cancelled;
+        self.memory_exceeded = *memory_exceeded;
+        #[cfg(feature = "profile")]
+        {
+            self.profile = profile.clone();
+        }
+        self.lazy_function_bodies = *lazy_function_bodies;
+        self.lazy_blocks = *lazy_blocks;
+        self.compact_initializers = *compact_initializers;
+        match (&mut self.declarations, declarations) {
+            (Some(mine), Some(index)) => {
+                mine.truncate(0);
+                mine.extend(index);
+            }
+            (mine, index) => *mine = index.clone(),
+        }
+        self.dependencies.clone_from(dependencies);
+        self.attribute_parsers.clone_from(attribute_parsers);
+        self.scope_depth = *scope_depth;
+        self.rule_labels = *rule_labels;
+    }
+
+    fn position(&self) -> usize {
+        self.committed + self.trail.len()
+    }
+
+    /// Number of bindings in the live scopes, to pass to [`State::bindings_since`].
+    pub(crate) fn bindings_len(&self) -> usize {
+        self.scopes.bindings.len()
+    }
+
+    /// Number of live scopes, including those with no names yet.
+    fn scopes_len(&self) -> usize {
+        self.scopes.starts.len() + self.pending_scopes
+    }
+
+    /// Bindings added since the live scopes had `len` bindings.
+    pub(crate) fn bindings_since(&self, len: usize) -> &[Binding] {
+        &self.scopes.bindings[len.min(self.scopes.bindings.len())..]
+    }
+
+    /// Bind all names in the innermost scope.
+    pub(crate) fn extend_bindings(&mut self, bindings: &[Binding]) {
+        self.ctx_mut().bind_all(bindings.iter().copied());
+    }
+
+    fn rewind(&mut self, position: usize) {
+        let len = position.saturating_sub(self.committed).min(self.trail.len());
+        if len == self.trail.len() {
+            return;
+        }
+        for (change, version) in self.trail.drain(len..).rev() {
+            // Scopes with no names are undone without touching the shared ones
+            match change {
+                Change::Push => self.pending_scopes -= 1,
+                Change::PopPending => self.pending_scopes += 1,
+                Change::Bind => Arc::make_mut(&mut self.scopes).unbind(),
+                Change::BindAll(count) => {
+                    let scopes = Arc::make_mut(&mut self.scopes);
+                    (0..count).for_each(|_| scopes.unbind());
+                }
+                Change::Materialize(count) => {
+                    let scopes = Arc::make_mut(&mut self.scopes);
+                    (0..count).for_each(|_| scopes.unpush());
+                    self.pending_scopes += count;
+                }
+                Change::Pop(bindings) => Arc::make_mut(&mut self.scopes).unpop(bindings),
+            }
+            self.version = version;
+        }
+    }
+
+    /// Record a change of the names, which gives the state a new version.
+    fn record(&mut self, change: Change) {
+        let version = next_version();
+        self.trail.push((change, std::mem::replace(&mut self.version, version)));
+    }
+
+    /// Record a change that leaves the names as they were, and the version.
+    fn record_unchanged(&mut self, change: Change) {
+        self.trail.push((change, self.version));
+    }
+
+    /// Note that the parser recovered from an error.
+    pub(crate) fn record_recovery(&mut self) {
+        self.recoveries += 1;
+        self.errors += 1;
+        if self.max_errors.is_some_and(|max| self.errors > max) {
+            self.budget_exceeded = true;
+        }
+        self.check_memory();
+    }
+
+    /// Key of the memoized result of `rule` at the token at address `token`,
+    /// in the current state.
+    ///
+    /// Returns `None` if memoization is disabled.
+    pub(crate) fn memo_key(&self, rule: &'static str, token: usize, no_recover: bool) -> Option<MemoKey> {
+        self.memo.as_ref()?;
+        Some(MemoKey {
+            rule,
+            token,
+            version: self.version,
+            no_recover,
+        })
+    }
+
+    /// Replay the memoized result at `key`, binding the names it bound.
+    ///
+    /// Returns the output and the address of the token after it, or `None`
+    /// at the end of input.
+    pub(crate) fn memo_replay<O: Clone + 'static>(&mut self, key: &MemoKey) -> Option<(O, Option<usize>)> {
+        let memo = self.memo.as_mut()?;
+        let Some(entry) = memo.entries.get(key) else {
+            memo.stats.misses += 1;
+            return None;
+        };
+        let output = entry.output.downcast_ref::<O>()?.clone();
+        let end = entry.end;
+        memo.stats.hits += 1;
+        if let Some(index) = &mut self.declarations {
+            index.extend(&entry.declarations);
+        }
+        if let Some(collector) = &mut self.dependencies {
+            collector.lookups.extend_from_slice(&entry.lookups);
+        }
+        let bindings = entry.bindings.clone();
+        self.extend_bindings(&bindings);
+        Some((output, end))
+    }
+
+    /// Mark the start of a parse to memoize with [`State::memo_store`].
+    pub(crate) fn memo_mark(&self) -> MemoMark {
+        MemoMark {
+            bindings: self.bindings_len(),
+            declarations: self.declarations_len(),
+            lookups: self.lookups_len(),
+            scopes: self.scopes_len(),
+            recoveries: self.recoveries,
+        }
+    }
+
+    /// Record the result of a parse started at `mark`, unless it recovered
+    /// from an error or left a scope open.
+    pub(crate) fn memo_store<O: Send + Sync + 'static>(
+        &mut self,
+        key: MemoKey,
+        mark: MemoMark,
+        output: O,
+        end: Option<usize>,
+    ) {
+        if mark.recoveries != self.recoveries || mark.scopes != self.scopes_len() {
+            return;
+        }
+        let bindings = self.bindings_since(mark.bindings).to_vec();
+        let declarations = self
+            .declarations
+            .as_ref()
+            .map_or_else(DeclarationIndex::default, |index| index.tail(mark.declarations));
+        let lookups = match &self.dependencies {
+            Some(collector) => collector.lookups[mark.lookups..].to_vec(),
+            None => Vec::new(),
+        };
+        if let Some(memo) = &mut self.memo {
+            let entry = MemoEntry {
+                output: Box::new(output),
+                end,
+                bindings,
+                declarations,
+                lookups,
+            };
+            memo.entries.insert(key, entry);
         }
     }
 }
 
+/// A flag that cancels the parses it is set on, see
+/// [`State::set_cancellation`].
+///
+/// Clones share the flag, so that one clone can be kept to cancel the parse
+/// from another thread or task while the state is parsing:
+///
+/// ```ignore
+/// let token = CancellationToken::new();
+/// state.set_cancellation(Some(token.clone()));
+/// // On the next keystroke
+/// token.cancel();
+/// ```
+#[derive(Debug, Clone, Default)]
+pub struct CancellationToken(Arc<AtomicBool>);
+
+impl CancellationToken {
+    /// Create a token that is not cancelled.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Cancel the parses using the token.
+    pub fn cancel(&self) {
+        self.0.store(true, Ordering::Relaxed);
+    }
+
+    /// Whether the token was cancelled.
+    pub fn is_cancelled(&self) -> bool {
+        self.0.load(Ordering::Relaxed)
+    }
+}
+
+/// Time spent in each pass of a two-pass parse, see [`State::set_two_pass`].
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct TwoPassStats {
+    /// Time spent parsing external declarations without error recovery,
+    /// including attempts that failed.
+    pub fast_time: Duration,
+    /// Time spent parsing external declarations again with error recovery.
+    pub recovery_time: Duration,
+    /// Number of external declarations parsed without error recovery.
+    pub fast_declarations: usize,
+    /// Number of external declarations parsed again with error recovery.
+    pub recovered_declarations: usize,
+}
+
+/// Hit counts of memoized rules, see [`State::set_memoize`].
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct MemoStats {
+    /// Number of times a memoized result was replayed.
+    pub hits: u64,
+    /// Number of times a memoized rule was parsed.
+    pub misses: u64,
+}
+
+impl MemoStats {
+    /// Fraction of memoized rule invocations that were replayed.
+    pub fn hit_rate(&self) -> f64 {
+        let total = self.hits + self.misses;
+        if total == 0 {
+            0.0
+        } else {
+            self.hits as f64 / total as f64
+        }
+    }
+}
+
+#[derive(Default)]
+struct Memo {
+    entries: FxHashMap<MemoKey, MemoEntry>,
+    stats: MemoStats,
+}
+
+impl Clone for Memo {
+    fn clone(&self) -> Self {
+        Memo::default()
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct MemoKey {
+    rule: &'static str,
+    /// Address of the first token.
+    token: usize,
+    version: u64,
+    no_recover: bool,
+}
+
+struct MemoEntry {
+    output: Box<dyn Any + Send + Sync>,
+    /// Address of the token after the result.
+    end: Option<usize>,
+    /// Names bound in the innermost scope.
+    bindings: Vec<Binding>,
+    /// Names entered into the declaration index.
+    declarations: DeclarationIndex,
+    /// Names looked up for the dependency graph.
+    lookups: Vec<Symbol>,
+}
+
+/// A state between external declarations, see [`State::mark`].
+#[derive(Clone, Copy)]
+pub(crate) struct StateMark {
+    position: usize,
+    errors: usize,
+    recoveries: u64,
+    declarations: usize,
+    depth: usize,
+    depth_exceeded: bool,
+    scope_depth: u32,
+}
+
+#[derive(Clone, Copy)]
+pub(crate) struct MemoMark {
+    bindings: usize,
+    declarations: usize,
+    lookups: usize,
+    scopes: usize,
+    recoveries: u64,
+}
+
 impl<'src, I> Inspector<'src, I> for State
 where
     I: Input<'src>,
 {
-    type Checkpoint = usize;
+    /// Position in the trail, number of errors recovered from, and length of
+    /// the declaration index.
+    type Checkpoint = (usize, usize, usize);
 
-    fn on_token(&mut self, _token: &I::Token) {}
+    fn on_token(&mut self, _token: &I::Token) {
+        #[cfg(feature = "profile")]
+        if let Some(profile) = &mut self.profile {
+            profile.tokens += 1;
+        }
+        self.token_work += 1;
+        if self.max_token_work.is_some_and(|max| self.token_work > max) {
+            self.budget_exceeded = true;
+        } else if self.token_work % DEADLINE_INTERVAL == 0 {
+            self.check_budget();
+        }
+    }
 
     fn on_save<'parse>(&self, _cursor: &Cursor<'src, 'parse, I>) -> Self::Checkpoint {
-        self.current
+        (self.position(), self.errors, self.declarations_len())
     }
 
     fn on_rewind<'parse>(&mut self, marker: &Checkpoint<'src, 'parse, I, Self::Checkpoint>) {
-        self.current = *marker.inspector();
+        let (position, errors, declarations) = *marker.inspector();
+        self.rewinds += 1;
+        self.rewind(position);
+        if let Some(index) = &mut self.declarations {
+            index.truncate(declarations);
+        }
+        // Errors emitted since the checkpoint are discarded with it
+        self.errors = errors;
     }
 }
 
+/// Number of tokens read between checks of the deadline and the cancellation.
+const DEADLINE_INTERVAL: u64 = 4096;
+
+/// A [`DependencyGraph`] being collected.
 #[derive(Clone)]
-pub struct Context {
-    namespaces: Vec<Namespace>,
+struct DependencyCollector {
+    graph: DependencyGraph,
+    /// Names looked up since the external declaration being parsed started,
+    /// kept when the parser backtracks.
+    lookups: Vec<Symbol>,
+    /// Number of bindings in the live scopes when it started.
+    bindings: usize,
 }
 
-impl Default for Context {
-    fn default() -> Self {
-        let mut builtin = Namespace::default();
-        builtin.add_typedef_name(Identifier::from("__builtin_va_list")); // TODO: va_arg
-        builtin.add_typedef_name(Identifier::from("__uint128_t"));
-        builtin.add_typedef_name(Identifier::from("_Float16"));
-        builtin.add_typedef_name(Identifier::from("_Float128"));
-        builtin.add_typedef_name(Identifier::from("_Bool"));
+/// Number of entries of a [`LookupCache`].
+const LOOKUP_CACHE_SIZE: usize = 64;
 
-        let namespaces = vec![builtin, Namespace::default()];
-        Self { namespaces }
+/// Kinds of recently looked up names, by the low bits of their symbols.
+///
+/// Versions identify the contents of the scopes across all states, so the
+/// entries stay valid after a rewind, a clone or [`State::reset_from`], and
+/// are never cleared.
+#[derive(Clone)]
+struct LookupCache {
+    entries: Box<[LookupEntry; LOOKUP_CACHE_SIZE]>,
+}
+
+impl Default for LookupCache {
+    fn default() -> Self {
+        let empty = LookupEntry {
+            version: u64::MAX,
+            name: Symbol::default(),
+            kind: None,
+        };
+        Self {
+            entries: Box::new([empty; LOOKUP_CACHE_SIZE]),
+        }
     }
 }
 
 #[derive(Clone, Copy)]
-pub struct ContextRef<'a> {
-    handle: usize,
-    contexts: &'a RefCell<Slab<Context>>,
+struct LookupEntry {
+    /// Version of the scopes the name was looked up in, `u64::MAX` for none.
+    version: u64,
+    name: Symbol,
+    kind: Option<Kind>,
 }
 
-impl ContextRef<'_> {
-    fn context(&self) -> Ref<'_, Context> {
-        Ref::map(self.contexts.borrow(), |contexts| &contexts[self.handle])
+/// A version no state had before.
+///
+/// Versions are unique across all states, so that states that diverged after
+/// a rewind never share one. Threads take them from the shared counter in
+/// blocks, so that recording a change does not contend with other threads.
+fn next_version() -> u64 {
+    const BLOCK: u64 = 1 << 10;
+    static NEXT_BLOCK: AtomicU64 = AtomicU64::new(1);
+    thread_local! {
+        /// The next version of the block of the thread, and the end of the block.
+        static VERSIONS: Cell<(u64, u64)> = const { Cell::new((0, 0)) };
     }
+    VERSIONS.with(|versions| {
+        let (mut next, mut end) = versions.get();
+        if next == end {
+            next = NEXT_BLOCK.fetch_add(BLOCK, Ordering::Relaxed);
+            end = next + BLOCK;
+        }
+        versions.set((next + 1, end));
+        next
+    })
+}
 
-    fn namespaces(&self) -> Ref<'_, Vec<Namespace>> {
-        Ref::map(self.context(), |context| &context.namespaces)
+/// A reversible change to the scopes.
+#[derive(Clone)]
+enum Change {
+    /// A name was bound in the innermost scope.
+    Bind,
+    /// Names were bound in the innermost scope at once.
+    BindAll(usize),
+    /// A scope with no names was pushed, as a pending scope.
+    Push,
+    /// Pending scopes were pushed onto the scopes, to bind a name.
+    Materialize(usize),
+    /// A scope was popped, together with its bindings.
+    Pop(Vec<Binding>),
+    /// A pending scope was popped.
+    PopPending,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) enum Kind {
+    TypedefName,
+    EnumConstant,
+}
+
+/// A name registered in a scope.
+pub(crate) type Binding = (Kind, Identifier);
+
+#[derive(Clone)]
+struct Scopes {
+    /// Kind of the innermost binding of each name in the live scopes.
+    names: FxHashMap<Identifier, Kind>,
+    /// Bindings of all live scopes, innermost scope last.
+    bindings: Vec<Binding>,
+    /// Kind of the binding each of `bindings` shadows, if any, to restore
+    /// when it goes out of scope.
+    shadowed: Vec<Option<Kind>>,
+    /// Start of each live scope in `bindings`.
+    starts: Vec<usize>,
+}
+
+impl Default for Scopes {
+    fn default() -> Self {
+        let mut scopes = Scopes {
+            names: FxHashMap::default(),
+            bindings: Vec::new(),
+            shadowed: Vec::new(),
+            starts: vec![0],
+        };
+        scopes.bind((Kind::TypedefName, Identifier::from("__builtin_va_list"))); // TODO: va_arg
+        scopes.bind((Kind::TypedefName, Identifier::from("__uint128_t")));
+        scopes.bind((Kind::TypedefName, Identifier::from("_Float16")));
+        scopes.bind((Kind::TypedefName, Identifier::from("_Float128")));
+        scopes.bind((Kind::TypedefName, Identifier::from("_Bool")));
+        scopes.push();
+        scopes
     }
+}
 
+impl Scopes {
+    fn is(&self, kind: Kind, name: &Identifier) -> bool {
+        self.names.get(name) == Some(&kind)
+    }
+
+    fn restore(&mut self, name: Identifier, shadowed: Option<Kind>) {
+        match shadowed {
+            Some(kind) => self.names.insert(name, kind),
+            None => self.names.remove(&name),
+        };
+    }
+
+    fn bind(&mut self, (kind, name): Binding) {
+        self.shadowed.push(self.names.insert(name, kind));
+        self.bindings.push((kind, name));
+    }
+
+    /// Bind `bindings` in order, returning their number.
+    fn bind_all(&mut self, bindings: impl IntoIterator<Item = Binding>) -> usize {
+        let start = self.bindings.len();
+        let bindings = bindings.into_iter();
+        self.bindings.reserve(bindings.size_hint().0);
+        self.shadowed.reserve(bindings.size_hint().0);
+        bindings.for_each(|binding| self.bind(binding));
+        self.bindings.len() - start
+    }
+
+    fn unbind(&mut self) {
+        let (_, name) = self.bindings.pop().expect("No binding to undo");
+        let shadowed = self.shadowed.pop().expect("Bindings are in step");
+        self.restore(name, shadowed);
+    }
+
+    fn push(&mut self) {
+        self.starts.push(self.bindings.len());
+    }
+
+    fn unpush(&mut self) {
+        self.starts.pop();
+    }
+
+    fn pop(&mut self) -> Option<Vec<Binding>> {
+        let start = self.starts.pop()?;
+        let bindings = self.bindings.split_off(start);
+        let shadowed = self.shadowed.split_off(start);
+        for (&(_, name), shadowed) in bindings.iter().zip(shadowed).rev() {
+            self.restore(name, shadowed);
+        }
+        Some(bindings)
+    }
+
+    fn unpop(&mut self, bindings: Vec<Binding>) {
+        self.push();
+        for binding in bindings {
+            self.bind(binding);
+        }
+    }
+}
+
+#[derive(Clone, Copy)]
+pub struct ContextRef<'a> {
+    state: &'a State,
+}
+
+impl ContextRef<'_> {
     pub fn is_typedef_name(&self, name: &Identifier) -> bool {
-        self.namespaces().iter().rev().any(|ns| ns.is_typedef_name(name))
+        self.state.scopes.is(Kind::TypedefName, name)
     }
 
     pub fn is_enum_constant(&self, name: &Identifier) -> bool {
-        self.namespaces().iter().rev().any(|ns| ns.is_enum_constant(name))
+        self.state.scopes.is(Kind::EnumConstant, name)
     }
 }
 
 pub struct ContextRefMut<'a> {
-    handle: &'a mut usize,
-    contexts: &'a RefCell<Slab<Context>>,
+    state: &'a mut State,
 }
 
 impl ContextRefMut<'_> {
-    fn context(&self) -> Ref<'_, Context> {
-        Ref::map(self.contexts.borrow(), |contexts| &contexts[*self.handle])
+    fn scopes_mut(&mut self) -> &mut Scopes {
+        Arc::make_mut(&mut self.state.scopes)
     }
 
-    /// Clone the underlying `Context` to get a mutable copy.
-    /// Kinda like `Rc::make_mut`, but clones every time.
-    fn context_mut(&mut self) -> RefMut<'_, Context> {
-        let context = self.context().clone();
-        let mut contexts = self.contexts.borrow_mut();
-        *self.handle = contexts.insert(context);
-        RefMut::map(contexts, |contexts| &mut contexts[*self.handle])
+    /// Push the pending scopes onto the scopes, before a name is bound in
+    /// the innermost one.
+    fn materialize(&mut self) {
+        let count = std::mem::take(&mut self.state.pending_scopes);
+        if count > 0 {
+            let scopes = self.scopes_mut();
+            (0..count).for_each(|_| scopes.push());
+            self.state.record_unchanged(Change::Materialize(count));
+        }
     }
 
-    fn namespaces_mut(&mut self) -> RefMut<'_, Vec<Namespace>> {
-        RefMut::map(self.context_mut(), |context| &mut context.namespaces)
+    fn bind(&mut self, binding: Binding) {
+        self.materialize();
+        self.scopes_mut().bind(binding);
+        self.state.record(Change::Bind);
+        self.note_bindings();
     }
 
-    fn namespace_mut(&mut self) -> RefMut<'_, Namespace> {
-        RefMut::map(self.namespaces_mut(), |namespaces| {
-            namespaces.last_mut().expect("No namespace to mutate")
-        })
+    /// Note the bindings in the live scopes for [`State::peak_bindings`].
+    fn note_bindings(&mut self) {
+        let state = &mut *self.state;
+        state.peak_bindings = state.peak_bindings.max(state.scopes.bindings.len());
     }
 
     pub fn add_typedef_name(&mut self, name: Identifier) {
-        self.namespace_mut().add_typedef_name(name);
+        self.bind((Kind::TypedefName, name));
     }
 
     pub fn add_enum_constant(&mut self, name: Identifier) {
-        self.namespace_mut().add_enum_constant(name);
+        self.bind((Kind::EnumConstant, name));
+    }
+
+    fn bind_all(&mut self, bindings: impl IntoIterator<Item = Binding>) {
+        let mut bindings = bindings.into_iter().peekable();
+        if bindings.peek().is_none() {
+            return;
+        }
+        self.materialize();
+        let count = self.scopes_mut().bind_all(bindings);
+        if count > 0 {
+            self.state.record(Change::BindAll(count));
+        }
+        self.note_bindings();
+    }
+
+    /// Add `names` as typedef names in one change of the state, which a
+    /// rewind undoes at once.
+    pub fn add_typedef_names(&mut self, names: impl IntoIterator<Item = Identifier>) {
+        self.bind_all(names.into_iter().map(|name| (Kind::TypedefName, name)));
+    }
+
+    /// Add `names` as enumeration constants in one change of the state, which
+    /// a rewind undoes at once.
+    pub fn add_enum_constants(&mut self, names: impl IntoIterator<Item = Identifier>) {
+        self.bind_all(names.into_iter().map(|name| (Kind::EnumConstant, name)));
     }
 
+    /// Enter a new scope.
+    ///
+    /// Most scopes declare no typedef names or enumeration constants, so the
+    /// scope is only pending until a name is bound in it: entering and
+    /// leaving it neither copies scopes shared with another state nor
+    /// changes the version.
     pub fn push(&mut self) {
-        self.namespaces_mut().push(Namespace::default());
+        self.state.pending_scopes += 1;
+        self.state.record_unchanged(Change::Push);
     }
 
+    /// Leave the innermost scope, unbinding its names.
     pub fn pop(&mut self) {
-        self.namespaces_mut().pop();
+        if self.state.pending_scopes > 0 {
+            self.state.pending_scopes -= 1;
+            self.state.record_unchanged(Change::PopPending);
+        } else if let Some(bindings) = self.scopes_mut().pop() {
+            self.state.record(Change::Pop(bindings));
+        }
     }
 }
 
-#[derive(Default, Clone)]
-pub struct Namespace {
-    typedef_names: Rc<FxHashSet<Identifier>>,
-    enum_constants: Rc<FxHashSet<Identifier>>,
-}
+#[cfg(test)]
+mod test {
+    use super::{LOOKUP_CACHE_SIZE, State};
+    use crate::{Identifier, ParseIter, ParseSession, PrefixSnapshot};
 
-impl Namespace {
-    pub fn is_typedef_name(&self, name: &Identifier) -> bool {
-        self.typedef_names.contains(name)
+    fn assert_send<T: Send>() {}
+    fn assert_sync<T: Sync>() {}
+
+    #[test]
+    fn test_send_sync() {
+        assert_send::<State>();
+        assert_sync::<State>();
+        assert_send::<PrefixSnapshot>();
+        assert_sync::<PrefixSnapshot>();
+        assert_send::<ParseSession>();
+        assert_send::<ParseIter<'static, 'static>>();
     }
 
-    pub fn is_enum_constant(&self, name: &Identifier) -> bool {
-        self.enum_constants.contains(name)
+    #[test]
+    fn test_rewind() {
+        let mut state = State::new();
+        let start = state.position();
+        state.ctx_mut().add_typedef_name("foo".into());
+        state.ctx_mut().push();
+        state.ctx_mut().add_enum_constant("bar".into());
+        let inner = state.position();
+        state.ctx_mut().pop();
+        assert!(state.ctx().is_typedef_name(&"foo".into()));
+        assert!(!state.ctx().is_enum_constant(&"bar".into()));
+
+        state.rewind(inner);
+        assert!(state.ctx().is_enum_constant(&"bar".into()));
+
+        state.rewind(start);
+        assert!(!state.ctx().is_typedef_name(&"foo".into()));
+        assert!(!state.ctx().is_enum_constant(&"bar".into()));
+        assert!(state.ctx().is_typedef_name(&"_Bool".into()));
     }
 
-    pub fn add_typedef_name(&mut self, name: Identifier) {
-        Rc::make_mut(&mut self.typedef_names).insert(name);
+    #[test]
+    fn test_shadowing() {
+        let mut state = State::new();
+        state.ctx_mut().add_typedef_name("foo".into());
+        state.ctx_mut().push();
+        state.ctx_mut().add_enum_constant("foo".into());
+        assert!(!state.ctx().is_typedef_name(&"foo".into()));
+        assert!(state.ctx().is_enum_constant(&"foo".into()));
+
+        let inner = state.position();
+        state.ctx_mut().pop();
+        assert!(state.ctx().is_typedef_name(&"foo".into()));
+        assert!(!state.ctx().is_enum_constant(&"foo".into()));
+        state.rewind(inner);
+        assert!(state.ctx().is_enum_constant(&"foo".into()));
     }
 
-    pub fn add_enum_constant(&mut self, name: Identifier) {
-        Rc::make_mut(&mut self.enum_constants).insert(name);
+    #[test]
+    fn test_version() {
+        let mut state = State::new();
+        let start = state.position();
+        let initial = state.version;
+        state.ctx_mut().add_typedef_name("foo".into());
+        let foo = state.version;
+        assert_ne!(foo, initial);
+
+        state.rewind(start);
+        assert_eq!(state.version, initial);
+        state.ctx_mut().add_typedef_name("bar".into());
+        assert_ne!(state.version, foo);
+    }
+
+    #[test]
+    fn test_bind_all() {
+        let mut state = State::new();
+        let start = state.position();
+        state.ctx_mut().add_typedef_name("a".into());
+        let names = (0..100).map(|i| format!("e{i}").as_str().into());
+        state.ctx_mut().add_enum_constants(names);
+        assert_eq!(state.trail.len(), 2);
+        assert!(state.ctx().is_enum_constant(&"e99".into()));
+
+        state.rewind(start + 1);
+        assert!(!state.ctx().is_enum_constant(&"e0".into()));
+        assert!(state.ctx().is_typedef_name(&"a".into()));
+        state.ctx_mut().add_typedef_names(Vec::new());
+        assert_eq!(state.trail.len(), 1);
+    }
+
+    #[test]
+    fn test_pending_scopes() {
+        let mut state = State::new();
+        state.ctx_mut().add_typedef_name("foo".into());
+        let shared = state.clone();
+        let (start, version) = (state.position(), state.version);
+
+        // Scopes without names leave the shared scopes and the version alone
+        state.ctx_mut().push();
+        state.ctx_mut().push();
+        state.ctx_mut().pop();
+        assert!(std::sync::Arc::ptr_eq(&state.scopes, &shared.scopes));
+        assert_eq!(state.version, version);
+
+        // A name binds in the innermost scope, and goes with it
+        state.ctx_mut().push();
+        state.ctx_mut().add_enum_constant("foo".into());
+        let inner = state.position();
+        assert!(state.ctx().is_enum_constant(&"foo".into()));
+        assert_eq!(state.scopes_len(), shared.scopes_len() + 2);
+        state.ctx_mut().pop();
+        assert!(state.ctx().is_typedef_name(&"foo".into()));
+        state.ctx_mut().pop();
+        assert_eq!(state.scopes_len(), shared.scopes_len());
+
+        state.rewind(inner);
+        assert!(state.ctx().is_enum_constant(&"foo".into()));
+        assert_eq!(state.scopes_len(), shared.scopes_len() + 2);
+        state.rewind(start);
+        assert!(state.ctx().is_typedef_name(&"foo".into()));
+        assert_eq!((state.scopes_len(), state.pending_scopes), (shared.scopes_len(), 0));
+    }
+
+    #[test]
+    fn test_lookup_cache() {
+        let mut state = State::new();
+        let start = state.position();
+        let foo = Identifier::from("foo");
+        assert!(!state.lookup_typedef_name(&foo));
+        state.ctx_mut().add_typedef_name(foo);
+        assert!(state.lookup_typedef_name(&foo));
+        assert!(!state.lookup_enum_constant(&foo));
+
+        // Lookups in the restored version see the names it had
+        let inner = state.position();
+        state.ctx_mut().push();
+        state.ctx_mut().add_enum_constant(foo);
+        assert!(state.lookup_enum_constant(&foo));
+        state.rewind(inner);
+        assert!(state.lookup_typedef_name(&foo));
+        state.rewind(start);
+        assert!(!state.lookup_typedef_name(&foo));
+
+        // Names sharing an entry replace each other
+        let other = (0..)
+            .map(|i| Identifier::from(format!("t{i}").as_str()))
+            .find(|name| name.0.as_u32() as usize % LOOKUP_CACHE_SIZE == foo.0.as_u32() as usize % LOOKUP_CACHE_SIZE)
+            .unwrap();
+        state.ctx_mut().add_typedef_name(other);
+        assert!(state.lookup_typedef_name(&other));
+        assert!(!state.lookup_typedef_name(&foo));
+        assert!(state.lookup_typedef_name(&other));
+    }
+
+    #[test]
+    fn test_commit() {
+        let mut state = State::new();
+        let start = state.position();
+        state.ctx_mut().add_typedef_name("foo".into());
+        state.commit();
+        assert!(state.trail.is_empty());
+
+        let committed = state.position();
+        state.ctx_mut().add_typedef_name("bar".into());
+        state.rewind(committed);
+        assert!(!state.ctx().is_typedef_name(&"bar".into()));
+
+        state.rewind(start);
+        assert!(state.ctx().is_typedef_name(&"foo".into()));
     }
 }
@@ -0,0 +1,443 @@
+//! Project-wide table of the external declarations of many translation units.
+//!
+//! Each translation unit is reduced to its [`UnitSymbols`], the declarations
+//! of its names with external linkage, from the syntax tree and the
+//! [`DeclarationIndex`] collected while parsing it. The [`SymbolDatabase`]
+//! then merges the units on all cores into one entry per name, with every
+//! declaration of the name in every unit:
+//!
+//! ```ignore
+//! let mut state = State::new();
+//! state.set_declaration_index(true);
+//! let parsed = parse_many(&files, &state);
+//! let units: Vec<_> = parsed
+//!     .iter()
+//!     .map(|unit| UnitSymbols::new(unit.output.as_ref().unwrap(), unit.declarations.as_ref().unwrap()))
+//!     .collect();
+//! let database = SymbolDatabase::merge(&units);
+//! for symbol in database.conflicts() {
+//!     // ...
+//! }
+//! ```
+//!
+//! Types are compared as written, after removing storage classes, function
+//! specifiers, the names of the declarator and its parameters, and the bodies
+//! of tagged structs, unions and enums, so that e.g. `int f(int x)` and
+//! `int f(int)` have the same type, but `size_t` and `unsigned long` do not.
+
+use std::{
+    fmt::{self, Write},
+    hash::{Hash, Hasher},
+    num::NonZeroUsize,
+    ops::Range,
+    thread,
+};
+
+use rustc_hash::{FxHashMap, FxHashSet, FxHasher};
+#[cfg(feature = "serde")]
+use serde::{Deserialize, Serialize};
+
+use crate::{
+    ast::*,
+    index::{DeclarationIndex, DeclaredKind},
+    parallel::par_map,
+    span::Span,
+    symbol::Symbol,
+    visitor::{
+        VisitorMut, walk_declaration_mut, walk_declaration_specifiers_mut, walk_direct_declarator_mut,
+        walk_enum_specifier_mut, walk_expression_mut, walk_parameter_declaration_mut,
+        walk_specifier_qualifier_list_mut, walk_statement_mut, walk_struct_union_specifier_mut,
+    },
+};
+
+/// The declarations of the names with external linkage in a translation unit,
+/// in order.
+///
+/// Names declared `static` anywhere in the unit have internal linkage and are
+/// left out. Functions with a body and objects that are not `extern` or have an
+/// initializer are definitions; tentative definitions count as definitions.
+///
+/// Like a [`DeclarationIndex`], the entries are stored as one array per field.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct UnitSymbols {
+    names: Vec<Symbol>,
+    kinds: Vec<DeclaredKind>,
+    spans: Vec<Span>,
+    /// Hash of the type of each declaration, see [`signature`].
+    signatures: Vec<u64>,
+    definitions: Vec<bool>,
+}
+
+impl UnitSymbols {
+    /// Collect the external declarations of `unit`, taking the span of each
+    /// name from the `index` collected while parsing it.
+    ///
+    /// Names that are not in the index, e.g. because `unit` was parsed with
+    /// the index disabled, get a default span.
+    pub fn new(unit: &TranslationUnit, index: &DeclarationIndex) -> Self {
+        let mut symbols = Self::default();
+        let mut internal = FxHashSet::default();
+        // Names declared at file scope, in the order of the declarators of `unit`
+        let mut declared = index.iter().filter(|declared| {
+            declared.depth == 0 && matches!(declared.kind, DeclaredKind::Function | DeclaredKind::Object)
+        });
+        let mut add = |specifiers: &DeclarationSpecifiers, declarator: &Declarator, defined: bool| {
+            let Some(name) = declarator.identifier() else {
+                return;
+            };
+            let span = declared
+                .find(|declared| declared.name == name.0)
+                .map_or_else(Span::default, |declared| declared.span);
+            if has_storage_class(specifiers, StorageClassSpecifier::Static) {
+                internal.insert(name.0);
+                return;
+            }
+            let kind = if declarator.is_function() {
+                DeclaredKind::Function
+            } else {
+                DeclaredKind::Object
+            };
+            symbols.names.push(name.0);
+            symbols.kinds.push(kind);
+            symbols.spans.push(span);
+            symbols.signatures.push(signature(specifiers, declarator));
+            symbols.definitions.push(defined);
+        };
+
+        for external_declaration in &unit.external_declarations {
+            match external_declaration {
+                ExternalDeclaration::Function(function) => add(&function.specifiers, &function.declarator, true),
+                ExternalDeclaration::Declaration(Declaration {
+                    kind: DeclarationKind::Normal { specifiers, declarators, .. },
+                    ..
+                }) => {
+                    let extern_ = has_storage_class(specifiers, StorageClassSpecifier::Extern);
+                    for InitDeclarator { declarator, initializer } in declarators {
+                        let defined = !declarator.is_function() && (!extern_ || initializer.is_some());
+                        add(specifiers, declarator, defined);
+                    }
+                }
+                ExternalDeclaration::Declaration(_) => {}
+            }
+        }
+
+        if !internal.is_empty() {
+            symbols.retain(|name| !internal.contains(&name));
+        }
+        symbols
+    }
+
+    /// The number of declarations.
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    /// Check whether there are no declarations.
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+
+    /// The declared names.
+    pub fn names(&self) -> &[Symbol] {
+        &self.names
+    }
+
+    fn retain(&mut self, mut keep: impl FnMut(Symbol) -> bool) {
+        let mut kept = 0;
+        for i in 0..self.len() {
+            if keep(self.names[i]) {
+                self.names.swap(kept, i);
+                self.kinds.swap(kept, i);
+                self.spans.swap(kept, i);
+                self.signatures.swap(kept, i);
+                self.definitions.swap(kept, i);
+                kept += 1;
+            }
+        }
+        self.names.truncate(kept);
+        self.kinds.truncate(kept);
+        self.spans.truncate(kept);
+        self.signatures.truncate(kept);
+        self.definitions.truncate(kept);
+    }
+
+    fn site(&self, unit: u32, i: usize) -> SymbolSite {
+        SymbolSite {
+            unit,
+            kind: self.kinds[i],
+            span: self.spans[i],
+            signature: self.signatures[i],
+            defined: self.definitions[i],
+        }
+    }
+}
+
+pub(crate) fn has_storage_class(specifiers: &DeclarationSpecifiers, class: StorageClassSpecifier) -> bool {
+    specifiers
+        .specifiers
+        .iter()
+        .any(|specifier| *specifier == DeclarationSpecifier::StorageClass(class))
+}
+
+/// Hash of the type declared by `specifiers` and `declarator`, see
+/// [`Canonical`].
+fn signature(specifiers: &DeclarationSpecifiers, declarator: &Declarator) -> u64 {
+    let mut specifiers = specifiers.clone();
+    let mut declarator = declarator.clone();
+    Canonical.visit_declaration_specifiers_mut(&mut specifiers);
+    Canonical.visit_declarator_mut(&mut declarator);
+    Sorted.visit_declaration_specifiers_mut(&mut specifiers);
+    Sorted.visit_declarator_mut(&mut declarator);
+    let mut hasher = FxHasher::default();
+    debug_hash(&specifiers).hash(&mut hasher);
+    debug_hash(&declarator).hash(&mut hasher);
+    hasher.finish()
+}
+
+/// Hash of the debug representation of `value`, without building it.
+fn debug_hash(value: &impl fmt::Debug) -> u64 {
+    struct HashWriter(FxHasher);
+
+    impl Write for HashWriter {
+        fn write_str(&mut self, s: &str) -> fmt::Result {
+            self.0.write(s.as_bytes());
+            Ok(())
+        }
+    }
+
+    let mut writer = HashWriter(FxHasher::default());
+    write!(writer, "{value:?}").expect("Hashing does not fail");
+    writer.0.finish()
+}
+
+/// Clears what does not take part in the type of a declaration.
+struct Canonical;
+
+impl<'a> VisitorMut<'a> for Canonical {
+    type Result = ();
+
+    fn visit_declaration_specifiers_mut(&mut self, s: &'a mut DeclarationSpecifiers) {
+        s.specifiers
+            .retain(|specifier| matches!(specifier, DeclarationSpecifier::TypeSpecifierQualifier(_)));
+        walk_declaration_specifiers_mut(self, s)
+    }
+
+    fn visit_expression_mut(&mut self, e: &'a mut Expression) {
+        e.span = Span::default();
+        walk_expression_mut(self, e)
+    }
+
+    fn visit_statement_mut(&mut self, s: &'a mut Statement) {
+        s.span = Span::default();
+        walk_statement_mut(self, s)
+    }
+
+    fn visit_declaration_mut(&mut self, d: &'a mut Declaration) {
+        d.span = Span::default();
+        walk_declaration_mut(self, d)
+    }
+
+    fn visit_direct_declarator_mut(&mut self, d: &'a mut DirectDeclarator) {
+        if let DirectDeclarator::Identifier { identifier, .. } = d {
+            *identifier = Identifier::default();
+        }
+        walk_direct_declarator_mut(self, d)
+    }
+
+    fn visit_parameter_declaration_mut(&mut self, pd: &'a mut ParameterDeclaration) {
+        if let Some(ParameterDeclarationKind::Declarator(declarator)) = pd.declarator.take() {
+            pd.declarator = abstract_declarator(declarator).map(ParameterDeclarationKind::Abstract);
+        }
+        walk_parameter_declaration_mut(self, pd)
+    }
+
+    fn visit_struct_union_specifier_mut(&mut self, s: &'a mut StructOrUnionSpecifier) {
+        if s.identifier.is_some() {
+            s.members = None;
+        }
+        walk_struct_union_specifier_mut(self, s)
+    }
+
+    fn visit_enum_specifier_mut(&mut self, e: &'a mut EnumSpecifier) {
+        if e.identifier.is_some() {
+            e.enumerators = None;
+        }
+        walk_enum_specifier_mut(self, e)
+    }
+}
+
+/// Sorts the type specifiers and qualifiers of a declaration cleared by
+/// [`Canonical`], so that e.g. `const char` and `char const` are the same.
+struct Sorted;
+
+impl<'a> VisitorMut<'a> for Sorted {
+    type Result = ();
+
+    fn visit_declaration_specifiers_mut(&mut self, s: &'a mut DeclarationSpecifiers) {
+        s.specifiers.sort_by_cached_key(debug_hash);
+        walk_declaration_specifiers_mut(self, s)
+    }
+
+    fn visit_specifier_qualifier_list_mut(&mut self, s: &'a mut SpecifierQualifierList) {
+        s.items.sort_by_cached_key(debug_hash);
+        walk_specifier_qualifier_list_mut(self, s)
+    }
+}
+
+/// The abstract declarator of the type of `declarator`, so that parameters
+/// with and without a name have the same type.
+fn abstract_declarator(declarator: Declarator) -> Option<AbstractDeclarator> {
+    match declarator {
+        Declarator::Direct(direct) => direct_abstract_declarator(direct).map(AbstractDeclarator::Direct),
+        Declarator::Pointer { pointer, declarator } => Some(AbstractDeclarator::Pointer {
+            pointer,
+            abstract_declarator: abstract_declarator(*declarator).map(Box::new),
+        }),
+        Declarator::Error => Some(AbstractDeclarator::Error),
+    }
+}
+
+fn direct_abstract_declarator(direct: DirectDeclarator) -> Option<DirectAbstractDeclarator> {
+    match direct {
+        DirectDeclarator::Identifier { .. } => None,
+        DirectDeclarator::Parenthesized(declarator) => abstract_declarator(*declarator)
+            .map(|declarator| DirectAbstractDeclarator::Parenthesized(Box::new(declarator))),
+        DirectDeclarator::Array { declarator, attributes, array_declarator } => Some(DirectAbstractDeclarator::Array {
+            declarator: direct_abstract_declarator(*declarator).map(Box::new),
+            attributes,
+            array_declarator,
+        }),
+        DirectDeclarator::Function { declarator, attributes, parameters } => Some(DirectAbstractDeclarator::Function {
+            declarator: direct_abstract_declarator(*declarator).map(Box::new),
+            attributes,
+            parameters,
+        }),
+    }
+}
+
+/// A declaration of an [`ExternalSymbol`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SymbolSite {
+    /// Index of the unit in the units merged.
+    pub unit: u32,
+    /// Whether the declaration is of a function or an object.
+    pub kind: DeclaredKind,
+    /// Span of the name in the unit.
+    pub span: Span,
+    /// Hash of the declared type, equal for declarations of the same type as
+    /// written.
+    pub signature: u64,
+    /// Whether the declaration is a definition.
+    pub defined: bool,
+}
+
+/// A name with external linkage and its declarations.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ExternalSymbol {
+    /// The name.
+    pub name: Symbol,
+    /// Range of the declarations in [`SymbolDatabase::sites`].
+    sites: Range<u32>,
+    /// Number of declarations that are definitions.
+    pub definitions: u32,
+    /// Whether the declarations disagree on the kind or type of the name.
+    pub conflicting: bool,
+}
+
+/// The names with external linkage of many translation units, with their
+/// declarations, see the [module documentation](self).
+#[derive(Debug, Clone, Default)]
+pub struct SymbolDatabase {
+    /// Symbols in the order of their first declaration.
+    symbols: Vec<ExternalSymbol>,
+    sites: Vec<SymbolSite>,
+    by_name: FxHashMap<Symbol, u32>,
+}
+
+impl SymbolDatabase {
+    /// Merge the declarations of `units`, on all available cores.
+    ///
+    /// The names are split into shards by hash, and each worker collects the
+    /// declarations of the names of its shards from all units, so the workers
+    /// share no table. The result does not depend on the number of workers.
+    pub fn merge(units: &[UnitSymbols]) -> Self {
+        let shard_count = thread::available_parallelism().map_or(1, NonZeroUsize::get) * 4;
+        let shard_of = |name: Symbol| {
+            let mut hasher = FxHasher::default();
+            name.hash(&mut hasher);
+            hasher.finish() as usize % shard_count
+        };
+        let shard_ids: Vec<usize> = (0..shard_count).collect();
+        let shards = par_map(&shard_ids, |&shard| {
+            // First declaration of each name, and its declarations
+            let mut names: FxHashMap<Symbol, ((u32, usize), Vec<SymbolSite>)> = FxHashMap::default();
+            for (unit_index, unit) in units.iter().enumerate() {
+                let unit_index = unit_index.try_into().expect("Too many units to merge");
+                for (i, &name) in unit.names.iter().enumerate() {
+                    if shard_of(name) == shard {
+                        let (_, sites) = names.entry(name).or_insert_with(|| ((unit_index, i), Vec::new()));
+                        sites.push(unit.site(unit_index, i));
+                    }
+                }
+            }
+            names.into_iter().collect::<Vec<_>>()
+        });
+
+        let mut entries: Vec<_> = shards.into_iter().flatten().collect();
+        entries.sort_unstable_by_key(|(_, (first, _))| *first);
+        let mut database = SymbolDatabase {
+            symbols: Vec::with_capacity(entries.len()),
+            sites: Vec::new(),
+            by_name: FxHashMap::with_capacity_and_hasher(entries.len(), Default::default()),
+        };
+        for (name, (_, sites)) in entries {
+            let start = database.sites.len() as u32;
+            let first = sites[0];
+            let conflicting = sites
+                .iter()
+                .any(|site| site.kind != first.kind || site.signature != first.signature);
+            let definitions = sites.iter().filter(|site| site.defined).count() as u32;
+            database.sites.extend(sites);
+            let end = database.sites.len().try_into().expect("Too many declarations to merge");
+            database.by_name.insert(name, database.symbols.len() as u32);
+            database.symbols.push(ExternalSymbol {
+                name,
+                sites: start..end,
+                definitions,
+                conflicting,
+            });
+        }
+        database
+    }
+
+    /// The number of names.
+    pub fn len(&self) -> usize {
+        self.symbols.len()
+    }
+
+    /// Check whether there are no names.
+    pub fn is_empty(&self) -> bool {
+        self.symbols.is_empty()
+    }
+
+    /// The symbol of `name`, if it has external linkage in any unit.
+    pub fn get(&self, name: Symbol) -> Option<&ExternalSymbol> {
+        self.by_name.get(&name).map(|&i| &self.symbols[i as usize])
+    }
+
+    /// The symbols, in the order of their first declaration.
+    pub fn symbols(&self) -> &[ExternalSymbol] {
+        &self.symbols
+    }
+
+    /// The declarations of `symbol`, in the order of the units.
+    pub fn sites(&self, symbol: &ExternalSymbol) -> &[SymbolSite] {
+        &self.sites[symbol.sites.start as usize..symbol.sites.end as usize]
+    }
+
+    /// The symbols whose declarations disagree on their kind or type.
+    pub fn conflicts(&self) -> impl Iterator<Item = &ExternalSymbol> + '_ {
+        self.symbols.iter().filter(|symbol| symbol.conflicting)
+    }
+}
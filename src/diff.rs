@@ -0,0 +1,278 @@
+//! Differences between two versions of a translation unit.
+//!
+//! [`diff_units`] compares the external declarations of two units by their
+//! [`StructuralHashes`], so that an unchanged declaration costs one
+//! comparison of hashes however large it is, and returns the shortest edit
+//! script turning the old list into the new one. A function definition whose
+//! signature is unchanged but whose body changed is not replaced whole, even
+//! if it moved: its edit lists the changes to the block items of the body
+//! instead. Deletions come first, in the order of the old unit, then
+//! insertions, in the order of the new one.
+//!
+//! ```ignore
+//! for edit in diff_units(&before, &after) {
+//!     match edit {
+//!         Edit::Delete { item, .. } => { /* ... */ }
+//!         Edit::Insert { item, .. } => { /* ... */ }
+//!         Edit::Body { new, edits, .. } => { /* ... */ }
+//!     }
+//! }
+//! ```
+//!
+//! Nodes with equal hashes are taken to be equal. Besides hashing both
+//! trees, the cost is the length of the lists in the range between their
+//! common prefix and suffix, times the number of edits, and the same again
+//! for the bodies of the function definitions that changed.
+
+use std::hash::{Hash, Hasher};
+
+use rustc_hash::FxHasher;
+
+use crate::{ast::*, index::StructuralHashes, span::Span};
+
+/// An external declaration or a block item of a function body.
+#[derive(Debug, Clone, Copy)]
+pub enum Item<'a> {
+    /// An external declaration of the unit.
+    ExternalDeclaration(&'a ExternalDeclaration),
+    /// A block item of a function body.
+    BlockItem(&'a BlockItem),
+}
+
+impl Item<'_> {
+    /// The span of the item, unless it is a label or a statement, which have
+    /// no span of their own.
+    pub fn span(self) -> Option<Span> {
+        match self {
+            Item::ExternalDeclaration(d) => Some(d.span()),
+            Item::BlockItem(BlockItem::Declaration(d)) => Some(d.span),
+            Item::BlockItem(_) => None,
+        }
+    }
+}
+
+/// An edit of a list of items, in an edit script from [`diff_units`].
+#[derive(Debug, Clone)]
+pub enum Edit<'a, 'b> {
+    /// An item of the old list is removed.
+    Delete {
+        /// The index of the item in the old list.
+        index: usize,
+        /// The item removed.
+        item: Item<'a>,
+    },
+    /// An item of the new list is added.
+    Insert {
+        /// The index of the item in the new list.
+        index: usize,
+        /// The item added.
+        item: Item<'b>,
+    },
+    /// The function definitions have the same signature, and the block items
+    /// of their bodies differ by `edits`.
+    Body {
+        /// The index of the definition in the old unit.
+        old_index: usize,
+        /// The index of the definition in the new unit.
+        new_index: usize,
+        /// The definition in the old unit.
+        old: &'a FunctionDefinition,
+        /// The definition in the new unit.
+        new: &'b FunctionDefinition,
+        /// The edits of the block items of the body.
+        edits: Vec<Edit<'a, 'b>>,
+    },
+}
+
+/// The edit script turning `old` into `new`, see the [module
+/// documentation](self).
+pub fn diff_units<'a, 'b>(old: &'a TranslationUnit, new: &'b TranslationUnit) -> Vec<Edit<'a, 'b>> {
+    diff_hashed(old, &StructuralHashes::new(old), new, &StructuralHashes::new(new))
+}
+
+/// Like [`diff_units`], with the structural hashes of the units already
+/// built, e.g. kept from a previous comparison.
+pub fn diff_hashed<'a, 'b>(
+    old: &'a TranslationUnit,
+    old_hashes: &StructuralHashes<'a>,
+    new: &'b TranslationUnit,
+    new_hashes: &StructuralHashes<'b>,
+) -> Vec<Edit<'a, 'b>> {
+    let old_list: Vec<u64> = (old.external_declarations.iter())
+        .map(|d| old_hashes.external_declaration(d).expect("Hashes of another unit"))
+        .collect();
+    let new_list: Vec<u64> = (new.external_declarations.iter())
+        .map(|d| new_hashes.external_declaration(d).expect("Hashes of another unit"))
+        .collect();
+
+    let (mut deleted, mut inserted) = (Vec::new(), Vec::new());
+    for op in shortest_edits(&old_list, &new_list) {
+        match op {
+            Op::Delete(i) => deleted.push(i),
+            Op::Insert(j) => inserted.push(j),
+        }
+    }
+    let mut edits = Vec::new();
+    replace_functions(old, new, &deleted, &inserted, &mut edits);
+    edits
+}
+
+/// Add the edits replacing the external declarations `deleted` of `old` with
+/// `inserted` of `new`, diffing the bodies of the function definitions with
+/// the same signature instead, wherever they moved.
+fn replace_functions<'a, 'b>(
+    old: &'a TranslationUnit,
+    new: &'b TranslationUnit,
+    deleted: &[usize],
+    inserted: &[usize],
+    edits: &mut Vec<Edit<'a, 'b>>,
+) {
+    let signature = |d: &ExternalDeclaration| match d {
+        ExternalDeclaration::Function(f) => {
+            let mut hasher = FxHasher::default();
+            f.attributes.hash(&mut hasher);
+            f.specifiers.hash(&mut hasher);
+            f.declarator.hash(&mut hasher);
+            Some(hasher.finish())
+        }
+        ExternalDeclaration::Declaration(_) => None,
+    };
+    let signatures: Vec<_> = (inserted.iter())
+        .map(|&j| signature(&new.external_declarations[j]))
+        .collect();
+    let mut paired = vec![false; inserted.len()];
+
+    for &i in deleted {
+        let item = &old.external_declarations[i];
+        let found =
+            signature(item).and_then(|hash| (0..inserted.len()).find(|&k| !paired[k] && signatures[k] == Some(hash)));
+        if let (ExternalDeclaration::Function(f), Some(k)) = (item, found)
+            && let ExternalDeclaration::Function(g) = &new.external_declarations[inserted[k]]
+        {
+            paired[k] = true;
+            edits.push(Edit::Body {
+                old_index: i,
+                new_index: inserted[k],
+                old: f,
+                new: g,
+                edits: diff_items(&f.body.items, &g.body.items),
+            });
+        } else {
+            edits.push(Edit::Delete {
+                index: i,
+                item: Item::ExternalDeclaration(item),
+            });
+        }
+    }
+    for (k, &j) in inserted.iter().enumerate() {
+        if !paired[k] {
+            edits.push(Edit::Insert {
+                index: j,
+                item: Item::ExternalDeclaration(&new.external_declarations[j]),
+            });
+        }
+    }
+}
+
+/// The edit script turning the block items `old` into `new`.
+fn diff_items<'a, 'b>(old: &'a [BlockItem], new: &'b [BlockItem]) -> Vec<Edit<'a, 'b>> {
+    // Block items have no structural hashes of their own, so they are hashed
+    // here, only for the bodies that changed
+    let hashes = |items: &[BlockItem]| -> Vec<u64> {
+        (items.iter())
+            .map(|item| {
+                let mut hasher = FxHasher::default();
+                item.hash(&mut hasher);
+                hasher.finish()
+            })
+            .collect()
+    };
+    (shortest_edits(&hashes(old), &hashes(new)).into_iter())
+        .map(|op| match op {
+            Op::Delete(i) => Edit::Delete { index: i, item: Item::BlockItem(&old[i]) },
+            Op::Insert(j) => Edit::Insert { index: j, item: Item::BlockItem(&new[j]) },
+        })
+        .collect()
+}
+
+/// An edit of a list of hashes.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Op {
+    Delete(usize),
+    Insert(usize),
+}
+
+/// The shortest list of deletions from `a` and insertions from `b` turning
+/// `a` into `b`, in order.
+///
+/// The common prefix and suffix are skipped first, then the rest is diffed
+/// with Myers' algorithm, in time proportional to its length times the
+/// number of edits.
+fn shortest_edits(a: &[u64], b: &[u64]) -> Vec<Op> {
+    let prefix = a.iter().zip(b).take_while(|(x, y)| x == y).count();
+    let (a_rest, b_rest) = (&a[prefix..], &b[prefix..]);
+    let suffix = (a_rest.iter().rev())
+        .zip(b_rest.iter().rev())
+        .take_while(|(x, y)| x == y)
+        .count();
+    let (a, b) = (&a_rest[..a_rest.len() - suffix], &b_rest[..b_rest.len() - suffix]);
+    if a.is_empty() && b.is_empty() {
+        return Vec::new();
+    }
+
+    let (n, m) = (a.len() as isize, b.len() as isize);
+    let offset = n + m;
+    let at = |k: isize| (offset + k) as usize;
+    // The furthest `x` reached on each diagonal `k = x - y`, before each
+    // number of edits
+    let mut v = vec![0isize; 2 * (n + m) as usize + 2];
+    let mut trace = Vec::new();
+    'search: for d in 0..=n + m {
+        trace.push(v.clone());
+        for k in (-d..=d).step_by(2) {
+            let mut x = if k == -d || (k != d && v[at(k - 1)] < v[at(k + 1)]) {
+                v[at(k + 1)]
+            } else {
+                v[at(k - 1)] + 1
+            };
+            let mut y = x - k;
+            while x < n && y < m && a[x as usize] == b[y as usize] {
+                x += 1;
+                y += 1;
+            }
+            v[at(k)] = x;
+            if x >= n && y >= m {
+                break 'search;
+            }
+        }
+    }
+
+    // Walk back from the end through the diagonal taken by each edit
+    let mut ops = Vec::new();
+    let (mut x, mut y) = (n, m);
+    for (d, v) in trace.iter().enumerate().rev() {
+        let d = d as isize;
+        let k = x - y;
+        let prev_k = if k == -d || (k != d && v[at(k - 1)] < v[at(k + 1)]) {
+            k + 1
+        } else {
+            k - 1
+        };
+        let prev_x = v[at(prev_k)];
+        let prev_y = prev_x - prev_k;
+        while x > prev_x && y > prev_y {
+            x -= 1;
+            y -= 1;
+        }
+        if d > 0 {
+            ops.push(if x == prev_x {
+                Op::Insert(prefix + prev_y as usize)
+            } else {
+                Op::Delete(prefix + prev_x as usize)
+            });
+        }
+        (x, y) = (prev_x, prev_y);
+    }
+    ops.reverse();
+    ops
+}
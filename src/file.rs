@@ -0,0 +1,76 @@
+//! Memory-mapped source files.
+
+use std::{fs::File, io, ops::Deref, path::Path};
+
+use memmap2::Mmap;
+
+use crate::{BalancedTokenSequence, LexIter, lex, lex_iter, span::ContextMapping};
+
+/// A source file mapped into memory and checked to be valid UTF-8.
+///
+/// The file is read directly from the mapping, so lexing a large preprocessed
+/// file does not copy it onto the heap, and the [`ContextMapping`] returned by
+/// [`SourceFile::lex`] borrows from the mapping.
+///
+/// The file must not be modified while it is mapped: other processes changing
+/// it under the mapping is undefined behavior, as with any memory map.
+#[derive(Debug)]
+pub struct SourceFile {
+    map: Mmap,
+    filename: Option<String>,
+}
+
+impl SourceFile {
+    /// Map the file at `path`.
+    ///
+    /// Returns an error of kind [`io::ErrorKind::InvalidData`] if the file is
+    /// not valid UTF-8.
+    pub fn open(path: impl AsRef<Path>) -> io::Result<Self> {
+        let path = path.as_ref();
+        let file = File::open(path)?;
+        let map = unsafe { Mmap::map(&file)? };
+        #[cfg(unix)]
+        let _ = map.advise(memmap2::Advice::Sequential);
+        std::str::from_utf8(&map).map_err(|err| io::Error::new(io::ErrorKind::InvalidData, err))?;
+        let filename = path.to_str().map(str::to_string);
+        Ok(Self { map, filename })
+    }
+
+    /// The contents of the file.
+    pub fn as_str(&self) -> &str {
+        // Checked in `open`
+        unsafe { std::str::from_utf8_unchecked(&self.map) }
+    }
+
+    /// The path of the file, if it is valid UTF-8.
+    pub fn filename(&self) -> Option<&str> {
+        self.filename.as_deref()
+    }
+
+    /// Lex the file, naming it by its path in the initial source context.
+    pub fn lex(&self) -> (BalancedTokenSequence, ContextMapping<'_>) {
+        lex(self.as_str(), self.filename())
+    }
+
+    /// Lex the top-level tokens of the file on demand, see [`lex_iter`].
+    ///
+    /// Only the pages of the file around the tokens being lexed need to be in
+    /// memory, so arbitrarily large files can be processed a token at a time.
+    pub fn lex_iter(&self) -> LexIter<'_> {
+        lex_iter(self.as_str(), self.filename())
+    }
+}
+
+impl Deref for SourceFile {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        self.as_str()
+    }
+}
+
+impl AsRef<str> for SourceFile {
+    fn as_ref(&self) -> &str {
+        self.as_str()
+    }
+}
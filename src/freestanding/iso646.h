@@ -0,0 +1,17 @@
+/* Freestanding <iso646.h> built into cgrammar. */
+#ifndef __CGRAMMAR_ISO646_H
+#define __CGRAMMAR_ISO646_H
+
+#define and &&
+#define and_eq &=
+#define bitand &
+#define bitor |
+#define compl ~
+#define not !
+#define not_eq !=
+#define or ||
+#define or_eq |=
+#define xor ^
+#define xor_eq ^=
+
+#endif
@@ -0,0 +1,51 @@
+/* Freestanding <limits.h> built into cgrammar, for an LP64 target unless
+   __LONG_WIDTH__ is defined otherwise. */
+#ifndef __CGRAMMAR_LIMITS_H
+#define __CGRAMMAR_LIMITS_H
+
+#ifndef __LONG_WIDTH__
+#define __LONG_WIDTH__ 64
+#endif
+
+#define CHAR_BIT 8
+#define BOOL_WIDTH 1
+#define CHAR_WIDTH 8
+#define SCHAR_WIDTH 8
+#define UCHAR_WIDTH 8
+#define SHRT_WIDTH 16
+#define USHRT_WIDTH 16
+#define INT_WIDTH 32
+#define UINT_WIDTH 32
+#define LONG_WIDTH __LONG_WIDTH__
+#define ULONG_WIDTH __LONG_WIDTH__
+#define LLONG_WIDTH 64
+#define ULLONG_WIDTH 64
+#define BITINT_MAXWIDTH 128
+#define MB_LEN_MAX 16
+
+#define BOOL_MAX 1
+#define SCHAR_MIN (-128)
+#define SCHAR_MAX 127
+#define UCHAR_MAX 255
+#define CHAR_MIN SCHAR_MIN
+#define CHAR_MAX SCHAR_MAX
+#define SHRT_MIN (-32767 - 1)
+#define SHRT_MAX 32767
+#define USHRT_MAX 65535
+#define INT_MIN (-2147483647 - 1)
+#define INT_MAX 2147483647
+#define UINT_MAX 4294967295U
+#if __LONG_WIDTH__ == 64
+#define LONG_MAX 9223372036854775807L
+#define ULONG_MAX 18446744073709551615UL
+#else
+#define LONG_MAX 2147483647L
+#define ULONG_MAX 4294967295UL
+#endif
+#define LONG_MIN (-LONG_MAX - 1L)
+#define LLONG_MIN (-9223372036854775807LL - 1)
+#define LLONG_MAX 9223372036854775807LL
+#define ULLONG_MAX 18446744073709551615ULL
+#define __STDC_VERSION_LIMITS_H__ 202311L
+
+#endif
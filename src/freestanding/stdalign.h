@@ -0,0 +1,8 @@
+/* Freestanding <stdalign.h> built into cgrammar. */
+#ifndef __CGRAMMAR_STDALIGN_H
+#define __CGRAMMAR_STDALIGN_H
+
+#define __alignas_is_defined 1
+#define __alignof_is_defined 1
+
+#endif
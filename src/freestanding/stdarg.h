@@ -0,0 +1,13 @@
+/* Freestanding <stdarg.h> built into cgrammar. */
+#ifndef __CGRAMMAR_STDARG_H
+#define __CGRAMMAR_STDARG_H
+
+typedef __builtin_va_list va_list;
+
+#define va_start(ap, ...) __builtin_va_start(ap, 0)
+#define va_arg(ap, type) (*(type *)__builtin_va_arg_address(ap, sizeof(type)))
+#define va_copy(dest, src) __builtin_va_copy(dest, src)
+#define va_end(ap) __builtin_va_end(ap)
+#define __STDC_VERSION_STDARG_H__ 202311L
+
+#endif
@@ -0,0 +1,7 @@
+/* Freestanding <stdbool.h> built into cgrammar. */
+#ifndef __CGRAMMAR_STDBOOL_H
+#define __CGRAMMAR_STDBOOL_H
+
+#define __bool_true_false_are_defined 1
+
+#endif
@@ -0,0 +1,19 @@
+/* Freestanding <stddef.h> built into cgrammar. */
+#ifndef __CGRAMMAR_STDDEF_H
+#define __CGRAMMAR_STDDEF_H
+
+typedef typeof(sizeof 0) size_t;
+typedef typeof((char *)0 - (char *)0) ptrdiff_t;
+typedef typeof(L'\0') wchar_t;
+typedef typeof(nullptr) nullptr_t;
+typedef struct {
+    long long __max_align_ll;
+    long double __max_align_ld;
+} max_align_t;
+
+#define NULL ((void *)0)
+#define offsetof(type, member) ((size_t)&((type *)0)->member)
+#define unreachable() (__builtin_unreachable())
+#define __STDC_VERSION_STDDEF_H__ 202311L
+
+#endif
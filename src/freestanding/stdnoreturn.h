@@ -0,0 +1,7 @@
+/* Freestanding <stdnoreturn.h> built into cgrammar. */
+#ifndef __CGRAMMAR_STDNORETURN_H
+#define __CGRAMMAR_STDNORETURN_H
+
+#define noreturn _Noreturn
+
+#endif
@@ -0,0 +1,744 @@
+//! Heap memory held by tokens and syntax trees.
+//!
+//! [`HeapSize`] reports the bytes a value owns on the heap: the capacity of
+//! its vectors and strings and the contents of its boxes, recursively, so
+//! that the memory of a parsed unit can be measured and limited:
+//!
+//! ```ignore
+//! let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+//! let bytes = tokens.deep_size() + unit.deep_size();
+//! ```
+//!
+//! Identifiers are interned [`Symbol`](crate::Symbol)s, whose strings are
+//! shared by the whole process and never freed, so they count as nothing.
+//! The tokens and state of a lazy function body, and the arguments of an
+//! attribute, are shared by the clones of the body or attribute, and each
+//! clone counts its part. The values of custom attributes, whose types are
+//! unknown, count as nothing. The sizes are exact for the
+//! containers, but not for the allocator overhead, nor for the heap of the
+//! parsing state kept with a lazy body and of the errors found in it, which
+//! count only their own size.
+
+use std::sync::Arc;
+
+use crate::{State, ast::*, parser::Dialect, parser_utils::Error, span::Spanned};
+
+/// Values that own memory on the heap.
+pub trait HeapSize {
+    /// The bytes the value owns on the heap, not counting its own size.
+    fn heap_size(&self) -> usize;
+
+    /// The bytes of the value and of the memory it owns on the heap.
+    fn deep_size(&self) -> usize
+    where
+        Self: Sized,
+    {
+        size_of::<Self>() + self.heap_size()
+    }
+}
+
+impl<T: HeapSize> HeapSize for Vec<T> {
+    fn heap_size(&self) -> usize {
+        self.capacity() * size_of::<T>() + self.iter().map(T::heap_size).sum::<usize>()
+    }
+}
+
+impl<T: HeapSize> HeapSize for Box<T> {
+    fn heap_size(&self) -> usize {
+        (**self).deep_size()
+    }
+}
+
+impl<T: HeapSize> HeapSize for Option<T> {
+    fn heap_size(&self) -> usize {
+        self.as_ref().map_or(0, T::heap_size)
+    }
+}
+
+impl<T: HeapSize> HeapSize for Spanned<T> {
+    fn heap_size(&self) -> usize {
+        self.value.heap_size()
+    }
+}
+
+impl HeapSize for String {
+    fn heap_size(&self) -> usize {
+        self.capacity()
+    }
+}
+
+macro_rules! no_heap {
+    ($($ty:ty),* $(,)?) => {
+        $(impl HeapSize for $ty {
+            fn heap_size(&self) -> usize {
+                0
+            }
+        })*
+    };
+}
+
+no_heap! {
+    Identifier, IntegerSuffix, FloatingConstant, FloatingSuffix, EncodingPrefix,
+    PredefinedConstant, Punctuator, UnaryOperator, BinaryOperator, AssignmentOperator, StorageClassSpecifier,
+    StructOrUnion, TypeQualifier, FunctionSpecifier, PointerOrBlock, AttributeToken,
+}
+
+impl HeapSize for Constant {
+    fn heap_size(&self) -> usize {
+        match self {
+            Constant::Integer(x) => x.heap_size(),
+            Constant::Character(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for IntegerConstant {
+    fn heap_size(&self) -> usize {
+        match &self.value {
+            IntegerValue::Narrow(_) => 0,
+            IntegerValue::Wide(text) => text.len(),
+        }
+    }
+}
+
+impl HeapSize for CharacterConstant {
+    fn heap_size(&self) -> usize {
+        self.value.heap_size()
+    }
+}
+
+impl HeapSize for StringLiterals {
+    fn heap_size(&self) -> usize {
+        self.0.heap_size()
+    }
+}
+
+impl HeapSize for StringLiteral {
+    fn heap_size(&self) -> usize {
+        self.value.heap_size()
+    }
+}
+
+impl HeapSize for BalancedTokenSequence {
+    fn heap_size(&self) -> usize {
+        self.tokens.heap_size()
+    }
+}
+
+impl HeapSize for BalancedToken {
+    fn heap_size(&self) -> usize {
+        match self {
+            BalancedToken::Parenthesized(x) | BalancedToken::Bracketed(x) | BalancedToken::Braced(x) => {
+                // The reference counts of the `Arc`, then its contents
+                let size = 2 * size_of::<usize>() + x.deep_size();
+                size / Arc::strong_count(x)
+            }
+            BalancedToken::StringLiteral(x) => (2 * size_of::<usize>() + x.deep_size()) / Arc::strong_count(x),
+            BalancedToken::QuotedString(x) => x.heap_size(),
+            BalancedToken::Constant(x) => x.heap_size(),
+            #[cfg(feature = "quasi-quote")]
+            BalancedToken::Interpolation(x) => size_of_val(&**x),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for Expression {
+    fn heap_size(&self) -> usize {
+        self.kind.heap_size()
+    }
+}
+
+impl HeapSize for ExpressionKind {
+    fn heap_size(&self) -> usize {
+        match self {
+            ExpressionKind::Postfix(x) => x.heap_size(),
+            ExpressionKind::Unary(x) => x.heap_size(),
+            ExpressionKind::Cast(x) => x.heap_size(),
+            ExpressionKind::Binary(x) => x.heap_size(),
+            ExpressionKind::Conditional(x) => x.heap_size(),
+            ExpressionKind::Assignment(x) => x.heap_size(),
+            ExpressionKind::Comma(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for PrimaryExpression {
+    fn heap_size(&self) -> usize {
+        match self {
+            PrimaryExpression::Constant(x) => x.heap_size(),
+            PrimaryExpression::StringLiteral(x) => x.heap_size(),
+            PrimaryExpression::QuotedString(x) => x.heap_size(),
+            PrimaryExpression::Parenthesized(x) => x.heap_size(),
+            PrimaryExpression::Generic(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for GenericSelection {
+    fn heap_size(&self) -> usize {
+        self.controlling_expression.heap_size() + self.associations.heap_size()
+    }
+}
+
+impl HeapSize for GenericAssociation {
+    fn heap_size(&self) -> usize {
+        match self {
+            GenericAssociation::Type { type_name, expression } => type_name.heap_size() + expression.heap_size(),
+            GenericAssociation::Default { expression } => expression.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for PostfixExpression {
+    fn heap_size(&self) -> usize {
+        match self {
+            PostfixExpression::Primary(x) => x.heap_size(),
+            PostfixExpression::ArrayAccess { array, index } => array.heap_size() + index.heap_size(),
+            PostfixExpression::FunctionCall { function, arguments } => function.heap_size() + arguments.heap_size(),
+            PostfixExpression::MemberAccess { object, .. } => object.heap_size(),
+            PostfixExpression::MemberAccessPtr { object, .. } => object.heap_size(),
+            PostfixExpression::PostIncrement(x) => x.heap_size(),
+            PostfixExpression::PostDecrement(x) => x.heap_size(),
+            PostfixExpression::CompoundLiteral(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for CompoundLiteral {
+    fn heap_size(&self) -> usize {
+        self.storage_class_specifiers.heap_size() + self.type_name.heap_size() + self.initializer.heap_size()
+    }
+}
+
+impl HeapSize for UnaryExpression {
+    fn heap_size(&self) -> usize {
+        match self {
+            UnaryExpression::Postfix(x) => x.heap_size(),
+            UnaryExpression::PreIncrement(x) => x.heap_size(),
+            UnaryExpression::PreDecrement(x) => x.heap_size(),
+            UnaryExpression::Unary { operand, .. } => operand.heap_size(),
+            UnaryExpression::Sizeof(x) => x.heap_size(),
+            UnaryExpression::SizeofType(x) => x.heap_size(),
+            UnaryExpression::Alignof(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for CastExpression {
+    fn heap_size(&self) -> usize {
+        match self {
+            CastExpression::Unary(x) => x.heap_size(),
+            CastExpression::Cast { type_name, expression } => type_name.heap_size() + expression.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for BinaryExpression {
+    fn heap_size(&self) -> usize {
+        self.left.heap_size() + self.right.heap_size()
+    }
+}
+
+impl HeapSize for ConditionalExpression {
+    fn heap_size(&self) -> usize {
+        self.condition.heap_size() + self.then_expr.heap_size() + self.else_expr.heap_size()
+    }
+}
+
+impl HeapSize for AssignmentExpression {
+    fn heap_size(&self) -> usize {
+        self.left.heap_size() + self.right.heap_size()
+    }
+}
+
+impl HeapSize for CommaExpression {
+    fn heap_size(&self) -> usize {
+        self.expressions.heap_size()
+    }
+}
+
+impl HeapSize for ConstantExpression {
+    fn heap_size(&self) -> usize {
+        match self {
+            ConstantExpression::Expression(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for Declaration {
+    fn heap_size(&self) -> usize {
+        self.kind.heap_size()
+    }
+}
+
+impl HeapSize for DeclarationKind {
+    fn heap_size(&self) -> usize {
+        match self {
+            DeclarationKind::Normal { attributes, specifiers, declarators } => {
+                attributes.heap_size() + specifiers.heap_size() + declarators.heap_size()
+            }
+            DeclarationKind::Typedef { attributes, specifiers, declarators } => {
+                attributes.heap_size() + specifiers.heap_size() + declarators.heap_size()
+            }
+            DeclarationKind::StaticAssert(x) => x.heap_size(),
+            DeclarationKind::Attribute(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for DeclarationSpecifiers {
+    fn heap_size(&self) -> usize {
+        self.specifiers.heap_size() + self.attributes.heap_size()
+    }
+}
+
+impl HeapSize for DeclarationSpecifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            DeclarationSpecifier::TypeSpecifierQualifier(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for InitDeclarator {
+    fn heap_size(&self) -> usize {
+        self.declarator.heap_size() + self.initializer.heap_size()
+    }
+}
+
+impl HeapSize for TypeSpecifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            TypeSpecifier::BitInt(x) => x.heap_size(),
+            TypeSpecifier::Atomic(x) => x.heap_size(),
+            TypeSpecifier::Struct(x) => x.heap_size(),
+            TypeSpecifier::Enum(x) => x.heap_size(),
+            TypeSpecifier::Typeof(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for StructOrUnionSpecifier {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.members.heap_size()
+    }
+}
+
+impl HeapSize for MemberDeclaration {
+    fn heap_size(&self) -> usize {
+        match self {
+            MemberDeclaration::Normal { attributes, specifiers, declarators, .. } => {
+                attributes.heap_size() + specifiers.heap_size() + declarators.heap_size()
+            }
+            MemberDeclaration::StaticAssert(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for SpecifierQualifierList {
+    fn heap_size(&self) -> usize {
+        self.items.heap_size() + self.attributes.heap_size()
+    }
+}
+
+impl HeapSize for TypeSpecifierQualifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            TypeSpecifierQualifier::TypeSpecifier(x) => x.heap_size(),
+            TypeSpecifierQualifier::AlignmentSpecifier(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for MemberDeclarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            MemberDeclarator::Declarator(x) => x.heap_size(),
+            MemberDeclarator::BitField { declarator, width } => declarator.heap_size() + width.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for EnumSpecifier {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.type_specifier.heap_size() + self.enumerators.heap_size()
+    }
+}
+
+impl HeapSize for Enumerator {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.value.heap_size()
+    }
+}
+
+impl HeapSize for AtomicTypeSpecifier {
+    fn heap_size(&self) -> usize {
+        self.type_name.heap_size()
+    }
+}
+
+impl HeapSize for TypeofSpecifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            TypeofSpecifier::Typeof(x) => x.heap_size(),
+            TypeofSpecifier::TypeofUnqual(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for TypeofSpecifierArgument {
+    fn heap_size(&self) -> usize {
+        match self {
+            TypeofSpecifierArgument::Expression(x) => x.heap_size(),
+            TypeofSpecifierArgument::TypeName(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for AlignmentSpecifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            AlignmentSpecifier::Type(x) => x.heap_size(),
+            AlignmentSpecifier::Expression(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for Declarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            Declarator::Direct(x) => x.heap_size(),
+            Declarator::Pointer { pointer, declarator } => pointer.heap_size() + declarator.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for DirectDeclarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            DirectDeclarator::Identifier { attributes, .. } => attributes.heap_size(),
+            DirectDeclarator::Parenthesized(x) => x.heap_size(),
+            DirectDeclarator::Array { declarator, attributes, array_declarator } => {
+                declarator.heap_size() + attributes.heap_size() + array_declarator.heap_size()
+            }
+            DirectDeclarator::Function { declarator, attributes, parameters } => {
+                declarator.heap_size() + attributes.heap_size() + parameters.heap_size()
+            }
+        }
+    }
+}
+
+impl HeapSize for ArrayDeclarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            ArrayDeclarator::Normal { type_qualifiers, size } => type_qualifiers.heap_size() + size.heap_size(),
+            ArrayDeclarator::Static { type_qualifiers, size } => type_qualifiers.heap_size() + size.heap_size(),
+            ArrayDeclarator::VLA { type_qualifiers } => type_qualifiers.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for Pointer {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.type_qualifiers.heap_size()
+    }
+}
+
+impl HeapSize for ParameterTypeList {
+    fn heap_size(&self) -> usize {
+        match self {
+            ParameterTypeList::Parameters(x) => x.heap_size(),
+            ParameterTypeList::Variadic(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for ParameterDeclaration {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.specifiers.heap_size() + self.declarator.heap_size()
+    }
+}
+
+impl HeapSize for ParameterDeclarationKind {
+    fn heap_size(&self) -> usize {
+        match self {
+            ParameterDeclarationKind::Declarator(x) => x.heap_size(),
+            ParameterDeclarationKind::Abstract(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for TypeName {
+    fn heap_size(&self) -> usize {
+        match self {
+            TypeName::TypeName { specifiers, abstract_declarator } => {
+                specifiers.heap_size() + abstract_declarator.heap_size()
+            }
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for AbstractDeclarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            AbstractDeclarator::Direct(x) => x.heap_size(),
+            AbstractDeclarator::Pointer { pointer, abstract_declarator } => {
+                pointer.heap_size() + abstract_declarator.heap_size()
+            }
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for DirectAbstractDeclarator {
+    fn heap_size(&self) -> usize {
+        match self {
+            DirectAbstractDeclarator::Parenthesized(x) => x.heap_size(),
+            DirectAbstractDeclarator::Array { declarator, attributes, array_declarator } => {
+                declarator.heap_size() + attributes.heap_size() + array_declarator.heap_size()
+            }
+            DirectAbstractDeclarator::Function { declarator, attributes, parameters } => {
+                declarator.heap_size() + attributes.heap_size() + parameters.heap_size()
+            }
+        }
+    }
+}
+
+impl HeapSize for Initializer {
+    fn heap_size(&self) -> usize {
+        match self {
+            Initializer::Expression(x) => x.heap_size(),
+            Initializer::Braced(x) => x.heap_size(),
+            Initializer::Constants(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for ConstantInitializer {
+    fn heap_size(&self) -> usize {
+        self.constants.heap_size()
+    }
+}
+
+impl HeapSize for BracedInitializer {
+    fn heap_size(&self) -> usize {
+        self.initializers.heap_size()
+    }
+}
+
+impl HeapSize for DesignatedInitializer {
+    fn heap_size(&self) -> usize {
+        self.designation.heap_size() + self.initializer.heap_size()
+    }
+}
+
+impl HeapSize for Designation {
+    fn heap_size(&self) -> usize {
+        self.designator.heap_size() + self.designation.heap_size()
+    }
+}
+
+impl HeapSize for Designator {
+    fn heap_size(&self) -> usize {
+        match self {
+            Designator::Array(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for StaticAssertDeclaration {
+    fn heap_size(&self) -> usize {
+        self.condition.heap_size() + self.message.heap_size()
+    }
+}
+
+impl HeapSize for AttributeSpecifier {
+    fn heap_size(&self) -> usize {
+        match self {
+            AttributeSpecifier::Attributes(x) => x.heap_size(),
+            AttributeSpecifier::Asm(x) => {
+                // The reference counts of the `Arc`, then its contents
+                let size = 2 * size_of::<usize>() + size_of::<StringLiterals>() + x.heap_size();
+                size / Arc::strong_count(x)
+            }
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for Attribute {
+    fn heap_size(&self) -> usize {
+        self.arguments.as_ref().map_or(0, |arguments| {
+            // The reference counts of the `Arc`, then its contents
+            let size = 2 * size_of::<usize>() + arguments.deep_size();
+            size / Arc::strong_count(arguments)
+        })
+    }
+}
+
+impl HeapSize for Statement {
+    fn heap_size(&self) -> usize {
+        self.kind.heap_size()
+    }
+}
+
+impl HeapSize for StatementKind {
+    fn heap_size(&self) -> usize {
+        match self {
+            StatementKind::Labeled(x) => x.heap_size(),
+            StatementKind::Unlabeled(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for UnlabeledStatement {
+    fn heap_size(&self) -> usize {
+        match self {
+            UnlabeledStatement::Expression(x) => x.heap_size(),
+            UnlabeledStatement::Primary { attributes, block } => attributes.heap_size() + block.heap_size(),
+            UnlabeledStatement::Jump { attributes, statement } => attributes.heap_size() + statement.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for PrimaryBlock {
+    fn heap_size(&self) -> usize {
+        match self {
+            PrimaryBlock::Compound(x) => x.heap_size(),
+            PrimaryBlock::Selection(x) => x.heap_size(),
+            PrimaryBlock::Iteration(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for Label {
+    fn heap_size(&self) -> usize {
+        match self {
+            Label::Identifier { attributes, .. } => attributes.heap_size(),
+            Label::Case { attributes, expression } => attributes.heap_size() + expression.heap_size(),
+            Label::Default { attributes } => attributes.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for LabeledStatement {
+    fn heap_size(&self) -> usize {
+        self.label.heap_size() + self.statement.heap_size()
+    }
+}
+
+impl HeapSize for CompoundStatement {
+    fn heap_size(&self) -> usize {
+        self.items.heap_size()
+    }
+}
+
+impl HeapSize for BlockItem {
+    fn heap_size(&self) -> usize {
+        match self {
+            BlockItem::Declaration(x) => x.heap_size(),
+            BlockItem::Statement(x) => x.heap_size(),
+            BlockItem::Label(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for ExpressionStatement {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.expression.heap_size()
+    }
+}
+
+impl HeapSize for SelectionStatement {
+    fn heap_size(&self) -> usize {
+        match self {
+            SelectionStatement::If { condition, then_stmt, else_stmt } => {
+                condition.heap_size() + then_stmt.heap_size() + else_stmt.heap_size()
+            }
+            SelectionStatement::Switch { expression, statement } => expression.heap_size() + statement.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for IterationStatement {
+    fn heap_size(&self) -> usize {
+        match self {
+            IterationStatement::While { condition, body } => condition.heap_size() + body.heap_size(),
+            IterationStatement::DoWhile { body, condition } => body.heap_size() + condition.heap_size(),
+            IterationStatement::For { init, condition, update, body } => {
+                init.heap_size() + condition.heap_size() + update.heap_size() + body.heap_size()
+            }
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for ForInit {
+    fn heap_size(&self) -> usize {
+        match self {
+            ForInit::Expression(x) => x.heap_size(),
+            ForInit::Declaration(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for JumpStatement {
+    fn heap_size(&self) -> usize {
+        match self {
+            JumpStatement::Return(x) => x.heap_size(),
+            _ => 0,
+        }
+    }
+}
+
+impl HeapSize for TranslationUnit {
+    fn heap_size(&self) -> usize {
+        self.external_declarations.heap_size()
+    }
+}
+
+impl HeapSize for ExternalDeclaration {
+    fn heap_size(&self) -> usize {
+        match self {
+            ExternalDeclaration::Function(x) => x.heap_size(),
+            ExternalDeclaration::Declaration(x) => x.heap_size(),
+        }
+    }
+}
+
+impl HeapSize for FunctionDefinition {
+    fn heap_size(&self) -> usize {
+        self.attributes.heap_size() + self.specifiers.heap_size() + self.declarator.heap_size() + self.body.heap_size()
+    }
+}
+
+impl HeapSize for Block {
+    fn heap_size(&self) -> usize {
+        let parsed = self.parsed().map_or(0, |(body, errors)| {
+            body.heap_size() + errors.capacity() * size_of::<Error<'static>>()
+        });
+        let unparsed = self.unparsed().map_or(0, |unparsed| {
+            // The reference counts of the `Arc`, then its contents
+            let size =
+                2 * size_of::<usize>() + size_of::<(BalancedTokenSequence, State, Dialect)>() + unparsed.0.heap_size();
+            size / Arc::strong_count(unparsed)
+        });
+        parsed + unparsed
+    }
+}
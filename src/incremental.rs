@@ -0,0 +1,516 @@
+//! Incremental reparsing of one translation unit after text edits.
+
+use std::{ops::Range, sync::Arc};
+
+use chumsky::{prelude::*, span::Span as _};
+use rustc_hash::FxHashSet;
+
+use crate::{
+    Attribute, BalancedToken, BalancedTokenSequence, ConstantInitializer, Declaration, DeclarationIndex, Expression,
+    ExternalDeclaration, FunctionDefinition, Identifier, MemberDeclaration, State, Statement, TranslationUnit,
+    context::Binding,
+    lex,
+    lexer::lex_region,
+    parallel::declaration_end,
+    parser::{external_declaration, no_recover},
+    parser_utils::Error,
+    span::{ContextMapping, ContextTable, Spanned},
+    visitor::{
+        VisitorMut, walk_declaration_mut, walk_expression_mut, walk_member_declaration_mut, walk_primary_block_mut,
+        walk_statement_mut,
+    },
+};
+
+/// A text edit: `range` of the source is replaced by `text`.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct TextEdit {
+    /// The byte range of the replaced text.
+    pub range: Range<usize>,
+    /// The replacement text.
+    pub text: String,
+}
+
+impl TextEdit {
+    /// Create a new text edit.
+    pub fn new(range: Range<usize>, text: impl Into<String>) -> Self {
+        Self { range, text: text.into() }
+    }
+
+    /// Apply this edit to `source`.
+    ///
+    /// Panics if the range is out of bounds or not on char boundaries.
+    pub fn apply(&self, source: &mut String) {
+        source.replace_range(self.range.clone(), &self.text);
+    }
+
+    /// Change in source length made by this edit.
+    fn delta(&self) -> isize {
+        self.text.len() as isize - self.range.len() as isize
+    }
+}
+
+/// A translation unit that is reparsed incrementally as its source is edited.
+///
+/// The unit is parsed one external declaration at a time, as split by
+/// [`parse_parallel`](crate::parse_parallel); a piece that does not parse
+/// on its own, such as the parameter declarations of a K&R function
+/// definition, is joined with the following pieces, as by
+/// [`parse_iter`](crate::parse_iter). After an edit, only the
+/// top-level tokens around the edit are lexed again, and only the external
+/// declarations they belong to are parsed again, together with any later
+/// declaration that mentions a typedef name or enumeration constant whose
+/// declaration changed. Other declarations are reused, with their spans
+/// moved. The result is always the same as parsing the edited source with
+/// [`IncrementalUnit::new`]; if the edit cannot be handled locally, e.g. it
+/// opens a comment or unbalances brackets, the whole unit is parsed again.
+pub struct IncrementalUnit {
+    source: String,
+    filename: Option<String>,
+    init_state: State,
+    tokens: BalancedTokenSequence,
+    contexts: ContextTable,
+    chunks: Vec<Chunk>,
+}
+
+/// One external declaration and the result of parsing it.
+struct Chunk {
+    /// Range of the top-level tokens of this declaration, which may span
+    /// several pieces.
+    tokens: Range<usize>,
+    output: Option<ExternalDeclaration>,
+    errors: Vec<Error<'static>>,
+    /// Names this declaration registers in the file scope.
+    declared: Vec<Binding>,
+    /// Names this declaration declares, if the initial state collects them.
+    declarations: Option<DeclarationIndex>,
+}
+
+/// The text and external declarations touched by an edit.
+struct Region {
+    chunks: Range<usize>,
+    text: Range<usize>,
+}
+
+impl IncrementalUnit {
+    /// Lex and parse `source`, starting from `init_state`.
+    pub fn new(source: impl Into<String>, filename: Option<&str>, init_state: State) -> Self {
+        let mut unit = Self {
+            source: source.into(),
+            filename: filename.map(Into::into),
+            init_state,
+            tokens: BalancedTokenSequence {
+                tokens: Vec::new(),
+                closed: true,
+                eoi: Default::default(),
+            },
+            contexts: ContextTable::new(),
+            chunks: Vec::new(),
+        };
+        unit.rebuild();
+        unit
+    }
+
+    /// The current source code.
+    pub fn source(&self) -> &str {
+        &self.source
+    }
+
+    /// The top-level tokens of the current source.
+    pub fn tokens(&self) -> &BalancedTokenSequence {
+        &self.tokens
+    }
+
+    /// Source contexts of the spans in the tokens, output and errors.
+    pub fn ctx_map(&self) -> ContextMapping<'_> {
+        ContextMapping::with_table(&self.source, self.contexts.clone())
+    }
+
+    /// The parsed external declarations, in source order.
+    pub fn external_declarations(&self) -> impl Iterator<Item = &ExternalDeclaration> {
+        self.chunks.iter().filter_map(|chunk| chunk.output.as_ref())
+    }
+
+    /// Collect the parsed external declarations into a translation unit.
+    pub fn translation_unit(&self) -> TranslationUnit {
+        TranslationUnit {
+            external_declarations: self.external_declarations().cloned().collect(),
+        }
+    }
+
+    /// Errors encountered while parsing, in source order.
+    pub fn errors(&self) -> impl Iterator<Item = &Error<'static>> {
+        self.chunks.iter().flat_map(|chunk| &chunk.errors)
+    }
+
+    /// Check whether parsing produced any errors.
+    pub fn has_errors(&self) -> bool {
+        self.chunks.iter().any(|chunk| !chunk.errors.is_empty())
+    }
+
+    /// The names declared in the current source, if the initial state
+    /// collects them, see [`State::set_declaration_index`]. Each external
+    /// declaration keeps its own names, moved with it when it is reused.
+    pub fn declaration_index(&self) -> Option<DeclarationIndex> {
+        self.init_state.declaration_index()?;
+        let mut index = DeclarationIndex::default();
+        for declarations in self.chunks.iter().filter_map(|chunk| chunk.declarations.as_ref()) {
+            index.extend(declarations);
+        }
+        Some(index)
+    }
+
+    /// Apply `edit` to the source and update the parse.
+    ///
+    /// Returns the number of external declarations that were parsed again.
+    /// Panics if the range of the edit is out of bounds or not on char
+    /// boundaries.
+    pub fn edit(&mut self, edit: &TextEdit) -> usize {
+        let region = self.affected_region(edit);
+        let line_delta = newlines(&edit.text) - newlines(&self.source[edit.range.clone()]);
+        edit.apply(&mut self.source);
+        if let Some(region) = region
+            && let Some(reparsed) = self.reparse(region, edit.delta(), line_delta)
+        {
+            return reparsed;
+        }
+        self.rebuild();
+        self.chunks.len()
+    }
+
+    fn rebuild(&mut self) {
+        let (tokens, ctx_map) = lex(&self.source, self.filename.as_deref());
+        self.contexts = ctx_map.into_table();
+        let mut state = self.state_before(0);
+        let mut chunks = Vec::new();
+        let mut start = 0;
+        while start < tokens.tokens.len() {
+            let chunk = parse_chunk_at(&tokens, start, &mut state);
+            start = chunk.tokens.end;
+            chunks.push(chunk);
+        }
+        self.chunks = chunks;
+        self.tokens = tokens;
+    }
+
+    /// The parsing state at the start of the chunk at `index`.
+    fn state_before(&self, index: usize) -> State {
+        let mut state = self.init_state.clone();
+        for chunk in &self.chunks[..index] {
+            state.extend_bindings(&chunk.declared);
+        }
+        state.commit();
+        state
+    }
+
+    /// Find the chunks whose tokens touch `edit`, and the text between the
+    /// chunks around them.
+    fn affected_region(&self, edit: &TextEdit) -> Option<Region> {
+        let tokens = &self.tokens.tokens;
+        // Lexing stopped early at a stray closing bracket
+        if tokens.is_empty() || self.tokens.eoi.start() != self.source.len() {
+            return None;
+        }
+
+        let first = tokens
+            .partition_point(|token| token.span.end() < edit.range.start)
+            .min(tokens.len() - 1);
+        let last = tokens
+            .partition_point(|token| token.span.start() <= edit.range.end)
+            .clamp(first + 1, tokens.len());
+        let chunk_of = |index: usize| self.chunks.partition_point(|chunk| chunk.tokens.end <= index);
+        let chunks = chunk_of(first)..chunk_of(last - 1) + 1;
+
+        let start = match chunks.start.checked_sub(1) {
+            Some(prev) => tokens[self.chunks[prev].tokens.end - 1].span.end(),
+            None => 0,
+        };
+        let end = self
+            .chunks
+            .get(chunks.end)
+            .map_or(self.source.len(), |next| tokens[next.tokens.start].span.start());
+        (start <= edit.range.start && edit.range.end <= end).then_some(Region { chunks, text: start..end })
+    }
+
+    /// Update the parse after an edit inside `region`, which is measured in
+    /// the old source. Returns `None` if the whole unit must be parsed again.
+    fn reparse(&mut self, region: Region, delta: isize, line_delta: isize) -> Option<usize> {
+        let Region { chunks, text } = region;
+        let token_range = self.chunks[chunks.start].tokens.start..self.chunks[chunks.end - 1].tokens.end;
+        let end = text.end.checked_add_signed(delta)?;
+        // Whether a `#` starts a directive depends on the text before it
+        if self.source.as_bytes().get(end) == Some(&b'#') {
+            return None;
+        }
+
+        // Contexts started in the region are found again by lexing it
+        let table = std::mem::replace(&mut self.contexts, ContextTable::new());
+        let mut ctx_map = ContextMapping::with_table(&self.source, table);
+        let suffix_starts: Vec<_> = ctx_map
+            .split_off_starts(text.start)
+            .into_iter()
+            .filter(|&(start, _)| start as usize > text.end)
+            .collect();
+        let lexed = lex_region(&self.source, text.start..end, &mut ctx_map);
+        // Contexts started after the edit record line numbers, and may share
+        // their entries with contexts before it
+        for (start, id) in suffix_starts {
+            let Some(mut context) = ctx_map.context(id).cloned() else {
+                continue;
+            };
+            context.line_offset += line_delta as i32;
+            let start = (start as usize)
+                .checked_add_signed(delta)
+                .expect("Context moved out of range");
+            ctx_map.start_context(start, context);
+        }
+        self.contexts = ctx_map.into_table();
+        let new_tokens = lexed?;
+
+        // Splice the new tokens in and move everything after them
+        let inserted = new_tokens.len();
+        let token_delta = inserted as isize - token_range.len() as isize;
+        self.tokens.tokens.splice(token_range.clone(), new_tokens);
+        shift_tokens(&mut self.tokens.tokens[token_range.start + inserted..], delta);
+        self.tokens.eoi.shift(delta);
+        for chunk in &mut self.chunks[chunks.end..] {
+            chunk.tokens = shift_range(&chunk.tokens, token_delta);
+        }
+
+        // Parse the new tokens until a boundary meets an old chunk again; a
+        // joined chunk may swallow old chunks after the region
+        let mut state = self.state_before(chunks.start);
+        let mut new_chunks = Vec::new();
+        let mut start = token_range.start;
+        let mut next = chunks.end;
+        loop {
+            while next < self.chunks.len() && self.chunks[next].tokens.start < start {
+                next += 1;
+            }
+            if start == self.tokens.tokens.len()
+                || self.chunks.get(next).is_some_and(|chunk| chunk.tokens.start == start)
+            {
+                break;
+            }
+            let chunk = parse_chunk_at(&self.tokens, start, &mut state);
+            start = chunk.tokens.end;
+            new_chunks.push(chunk);
+        }
+        let mut reparsed = new_chunks.len();
+        let mut changed = FxHashSet::default();
+        let old_chunks: Vec<_> = self.chunks.splice(chunks.start..next, new_chunks).collect();
+        changed_names(
+            old_chunks.iter().flat_map(|chunk| &chunk.declared),
+            self.chunks[chunks.start..chunks.start + reparsed]
+                .iter()
+                .flat_map(|chunk| &chunk.declared),
+            &mut changed,
+        );
+
+        // Reuse the following chunks, unless they depend on a changed name
+        for chunk in &mut self.chunks[chunks.start + reparsed..] {
+            if delta == 0 && changed.is_empty() {
+                break;
+            }
+            let stale = delta != 0 && (!chunk.errors.is_empty() || chunk.output.as_ref().is_some_and(has_body_errors));
+            let depends = !changed.is_empty() && mentions(&self.tokens.tokens[chunk.tokens.clone()], &changed);
+            if stale || depends {
+                let new_chunk = parse_chunk_at(&self.tokens, chunk.tokens.start, &mut state);
+                // The chunks would be joined differently from scratch
+                if new_chunk.tokens != chunk.tokens {
+                    return None;
+                }
+                changed_names(&chunk.declared, &new_chunk.declared, &mut changed);
+                *chunk = new_chunk;
+                reparsed += 1;
+            } else {
+                if let Some(output) = &mut chunk.output {
+                    ShiftSpans(delta).visit_external_declaration_mut(output);
+                }
+                if let Some(declarations) = &mut chunk.declarations {
+                    declarations.shift(delta);
+                }
+                state.extend_bindings(&chunk.declared);
+                state.commit();
+            }
+        }
+        Some(reparsed)
+    }
+}
+
+/// Parse the external declaration starting at the top-level token `start`.
+///
+/// Without recovery, the piece up to the next boundary is joined with the
+/// following pieces until it parses, as in [`parse_iter`](crate::parse_iter).
+/// If no join parses, the piece alone is parsed with error recovery.
+fn parse_chunk_at(tokens: &BalancedTokenSequence, start: usize, state: &mut State) -> Chunk {
+    let parser = no_recover(external_declaration()).then_ignore(end());
+    let piece_end = declaration_end(&tokens.tokens, start);
+    let mut end = piece_end;
+    let mark = state.mark();
+    let bindings = state.bindings_len();
+    loop {
+        let result = parser.parse_with_state(tokens.slice_as_input(start..end), state);
+        if !result.has_errors()
+            && let Some(output) = result.into_output()
+        {
+            let declared = state.bindings_since(bindings).to_vec();
+            state.commit();
+            return Chunk {
+                tokens: start..end,
+                output: Some(output),
+                errors: Vec::new(),
+                declared,
+                declarations: state.take_declaration_index(),
+            };
+        }
+        state.rewind_to(&mark);
+        if end == tokens.tokens.len() {
+            break;
+        }
+        end = declaration_end(&tokens.tokens, end);
+    }
+    parse_chunk(tokens, start..piece_end, state)
+}
+
+/// Parse the external declaration in `range` of the top-level tokens, with
+/// error recovery.
+fn parse_chunk(tokens: &BalancedTokenSequence, range: Range<usize>, state: &mut State) -> Chunk {
+    let mark = state.bindings_len();
+    let (output, errors) = external_declaration()
+        .then_ignore(end())
+        .parse_with_state(tokens.slice_as_input(range.clone()), state)
+        .into_output_errors();
+    let declared = state.bindings_since(mark).to_vec();
+    state.commit();
+    Chunk {
+        tokens: range,
+        output,
+        errors: errors.into_iter().map(|error| error.into_owned()).collect(),
+        declared,
+        declarations: state.take_declaration_index(),
+    }
+}
+
+/// Add the names bound differently in `old` and `new` to `changed`.
+fn changed_names<'a>(
+    old: impl IntoIterator<Item = &'a Binding>,
+    new: impl IntoIterator<Item = &'a Binding>,
+    changed: &mut FxHashSet<Identifier>,
+) {
+    let old: FxHashSet<_> = old.into_iter().collect();
+    let new: FxHashSet<_> = new.into_iter().collect();
+    changed.extend(old.symmetric_difference(&new).map(|(_, name)| *name));
+}
+
+/// Check whether tokens mention any of `names`, at any depth.
+fn mentions(tokens: &[Spanned<BalancedToken>], names: &FxHashSet<Identifier>) -> bool {
+    tokens.iter().any(|token| match &token.value {
+        BalancedToken::Identifier(id) => names.contains(id),
+        BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+            mentions(&inner.tokens, names)
+        }
+        #[cfg(feature = "quasi-quote")]
+        BalancedToken::Template(_) | BalancedToken::Interpolation(_) => true,
+        _ => false,
+    })
+}
+
+/// Check whether a parsed function body has errors, whose spans cannot be moved.
+fn has_body_errors(declaration: &ExternalDeclaration) -> bool {
+    matches!(declaration, ExternalDeclaration::Function(f) if f.body.is_parsed() && !f.body.errors().is_empty())
+}
+
+fn newlines(text: &str) -> isize {
+    memchr::memchr_iter(b'\n', text.as_bytes()).count() as isize
+}
+
+fn shift_range(range: &Range<usize>, delta: isize) -> Range<usize> {
+    let shift = |index: usize| index.checked_add_signed(delta).expect("Token index moved out of range");
+    shift(range.start)..shift(range.end)
+}
+
+/// Move every span of `tokens`, including those of nested groups, by `delta`.
+pub(crate) fn shift_tokens(tokens: &mut [Spanned<BalancedToken>], delta: isize) {
+    for token in tokens {
+        token.span.shift(delta);
+        if let BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) =
+            &mut token.value
+        {
+            shift_sequence(Arc::make_mut(inner), delta);
+        }
+    }
+}
+
+fn shift_sequence(sequence: &mut BalancedTokenSequence, delta: isize) {
+    shift_tokens(&mut sequence.tokens, delta);
+    sequence.eoi.shift(delta);
+}
+
+/// Moves every span in an external declaration by a fixed offset.
+///
+/// Unparsed function bodies and blocks are moved as tokens, without parsing
+/// them.
+struct ShiftSpans(isize);
+
+impl<'a> VisitorMut<'a> for ShiftSpans {
+    type Result = ();
+
+    fn visit_function_definition_mut(&mut self, f: &'a mut FunctionDefinition) {
+        f.span.shift(self.0);
+        for attr in &mut f.attributes {
+            self.visit_attribute_specifier_mut(attr);
+        }
+        self.visit_declaration_specifiers_mut(&mut f.specifiers);
+        self.visit_declarator_mut(&mut f.declarator);
+        if f.body.is_parsed() {
+            self.visit_compound_statement_mut(&mut f.body);
+        } else if let Some(tokens) = f.body.unparsed_tokens_mut() {
+            shift_sequence(tokens, self.0);
+        }
+    }
+
+    fn visit_primary_block_mut(&mut self, pb: &'a mut PrimaryBlock) {
+        match pb {
+            PrimaryBlock::Compound(c) if !c.is_parsed() => {
+                if let Some(tokens) = c.unparsed_tokens_mut() {
+                    shift_sequence(tokens, self.0);
+                }
+            }
+            _ => walk_primary_block_mut(self, pb),
+        }
+    }
+
+    fn visit_attribute_mut(&mut self, a: &'a mut Attribute) {
+        if let Some(arguments) = &mut a.arguments {
+            shift_sequence(Arc::make_mut(arguments), self.0);
+        }
+    }
+
+    fn visit_constant_initializer_mut(&mut self, c: &'a mut ConstantInitializer) {
+        for constant in &mut c.constants {
+            constant.span.shift(self.0);
+        }
+    }
+
+    fn visit_statement_mut(&mut self, s: &'a mut Statement) {
+        s.span.shift(self.0);
+        walk_statement_mut(self, s)
+    }
+
+    fn visit_expression_mut(&mut self, e: &'a mut Expression) {
+        e.span.shift(self.0);
+        walk_expression_mut(self, e)
+    }
+
+    fn visit_declaration_mut(&mut self, d: &'a mut Declaration) {
+        d.span.shift(self.0);
+        walk_declaration_mut(self, d)
+    }
+
+    fn visit_member_declaration_mut(&mut self, md: &'a mut MemberDeclaration) {
+        if let MemberDeclaration::Normal { span, .. } = md {
+            span.shift(self.0);
+        }
+        walk_member_declaration_mut(self, md)
+    }
+}
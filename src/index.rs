@@ -0,0 +1,1194 @@
+//! Flattened index of the nodes of a translation unit.
+//!
+//! An [`AstIndex`] lists the main nodes of a translation unit in pre-order,
+//! with the end of the subtree of each node and a tag of its kind, so that
+//! passes that look for one kind of node scan a compact array instead of
+//! walking the whole tree through the `walk_*` functions:
+//!
+//! ```ignore
+//! let index = AstIndex::new(&unit);
+//! for call in index.function_calls() {
+//!     // ...
+//! }
+//! ```
+//!
+//! The index is built with one walk of the tree and borrows it, so the tree
+//! cannot be modified while the index is alive.
+//!
+//! Each node of an [`AstIndex`] has a dense [`NodeId`], its position in the
+//! index, so that analyses attach their facts to nodes in a [`NodeVec`] or a
+//! [`NodeMap`], which are flat arrays indexed by it, instead of maps keyed by
+//! the addresses of the nodes:
+//!
+//! ```ignore
+//! let mut constant = NodeMap::new(&index);
+//! for (id, node) in index.of_kind(NodeKind::Expression) {
+//!     // ...
+//!     constant.insert(id.into(), value);
+//! }
+//! let value = constant.get(index.id(Node::Expression(e))?);
+//! ```
+//!
+//! A [`SpanIndex`] sorts the nodes with spans by their position in the
+//! source, to find the innermost node at an offset in logarithmic time
+//! instead of a walk of the tree.
+//!
+//! [`StructuralHashes`] keeps the hash of each expression, statement and
+//! external declaration, computed in one bottom-up walk, for passes that look
+//! for repeated code.
+//!
+//! A [`DeclarationIndex`] lists the names declared in a translation unit
+//! instead, and is collected by the parser itself, see
+//! [`State::set_declaration_index`](crate::State::set_declaration_index), as
+//! is a [`DependencyGraph`] of the typedef names and enumeration constants
+//! each external declaration looked up and bound.
+//!
+//! An [`OccurrenceIndex`] lists where each identifier occurs in a source, and
+//! is collected by the lexer, see [`lex_occurrences`](crate::lex_occurrences).
+
+use std::{
+    cell::RefCell,
+    cmp::Reverse,
+    hash::{Hash, Hasher},
+    marker::PhantomData,
+    ops::{BitOr, ControlFlow, Index, IndexMut, Range},
+    sync::OnceLock,
+};
+
+use rustc_hash::{FxHashMap, FxHasher};
+
+#[cfg(feature = "serde")]
+use serde::{Deserialize, Serialize};
+
+use crate::{
+    ast::*,
+    span::Span,
+    symbol::Symbol,
+    visitor::{
+        Visitor, VisitorResult, walk_declaration, walk_declarator, walk_expression, walk_external_declaration,
+        walk_function_definition, walk_postfix_expression, walk_statement, walk_type_name,
+    },
+};
+
+/// A node of the index.
+#[derive(Debug, Clone, Copy)]
+pub enum Node<'a> {
+    ExternalDeclaration(&'a ExternalDeclaration),
+    FunctionDefinition(&'a FunctionDefinition),
+    Declaration(&'a Declaration),
+    Declarator(&'a Declarator),
+    Statement(&'a Statement),
+    Expression(&'a Expression),
+    PostfixExpression(&'a PostfixExpression),
+    TypeName(&'a TypeName),
+}
+
+/// The kind of a [`Node`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum NodeKind {
+    ExternalDeclaration,
+    FunctionDefinition,
+    Declaration,
+    Declarator,
+    Statement,
+    Expression,
+    PostfixExpression,
+    TypeName,
+}
+
+/// A set of [`NodeKind`]s.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, Hash)]
+pub struct NodeKinds(u16);
+
+impl NodeKinds {
+    /// No kinds.
+    pub const NONE: Self = Self(0);
+
+    /// All kinds.
+    pub const ALL: Self = Self((1 << (NodeKind::TypeName as u16 + 1)) - 1);
+
+    /// The set of `kind` alone.
+    pub const fn of(kind: NodeKind) -> Self {
+        Self(1 << kind as u16)
+    }
+
+    /// The set with `kind` added.
+    pub const fn with(self, kind: NodeKind) -> Self {
+        Self(self.0 | Self::of(kind).0)
+    }
+
+    /// Check whether `kind` is in the set.
+    pub const fn contains(self, kind: NodeKind) -> bool {
+        self.0 & Self::of(kind).0 != 0
+    }
+
+    /// Check whether the set has all kinds.
+    pub const fn is_all(self) -> bool {
+        self.0 == Self::ALL.0
+    }
+
+    /// Check whether the sets have a kind in common.
+    pub const fn intersects(self, other: Self) -> bool {
+        self.0 & other.0 != 0
+    }
+}
+
+impl From<NodeKind> for NodeKinds {
+    fn from(kind: NodeKind) -> Self {
+        Self::of(kind)
+    }
+}
+
+impl<T: Into<NodeKinds>> BitOr<T> for NodeKinds {
+    type Output = Self;
+
+    fn bitor(self, other: T) -> Self {
+        Self(self.0 | other.into().0)
+    }
+}
+
+impl Node<'_> {
+    /// The kind of the node.
+    pub fn kind(self) -> NodeKind {
+        match self {
+            Node::ExternalDeclaration(_) => NodeKind::ExternalDeclaration,
+            Node::FunctionDefinition(_) => NodeKind::FunctionDefinition,
+            Node::Declaration(_) => NodeKind::Declaration,
+            Node::Declarator(_) => NodeKind::Declarator,
+            Node::Statement(_) => NodeKind::Statement,
+            Node::Expression(_) => NodeKind::Expression,
+            Node::PostfixExpression(_) => NodeKind::PostfixExpression,
+            Node::TypeName(_) => NodeKind::TypeName,
+        }
+    }
+
+    /// The span of the node, for the kinds of nodes that have one.
+    pub fn span(self) -> Option<Span> {
+        match self {
+            Node::FunctionDefinition(f) => Some(f.span),
+            Node::Declaration(d) => Some(d.span),
+            Node::Statement(s) => Some(s.span),
+            Node::Expression(e) => Some(e.span),
+            _ => None,
+        }
+    }
+}
+
+/// The nodes of a translation unit in pre-order.
+///
+/// Node `i` is the root of the subtree of the nodes in [`AstIndex::subtree`],
+/// which starts with `i` itself, and its parent is [`AstIndex::parent`], so
+/// the enclosing nodes of a node are found without another walk of the tree.
+/// Expressions are indexed both as [`Node::Expression`] and, when they are
+/// postfix expressions, as the [`Node::PostfixExpression`] they contain.
+#[derive(Debug, Clone, Default)]
+pub struct AstIndex<'a> {
+    nodes: Vec<Node<'a>>,
+    /// Kind of each node, kept apart so that scans for a kind stay compact.
+    kinds: Vec<NodeKind>,
+    /// End of the subtree of each node.
+    ends: Vec<u32>,
+    /// Kinds of the nodes in the subtree of each node.
+    contains: Vec<NodeKinds>,
+    /// Parent of each node, or `u32::MAX` for the external declarations.
+    parents: Vec<u32>,
+    /// Keys of the nodes with their ids, sorted by key, built on the first
+    /// lookup of an id.
+    ids: OnceLock<Vec<((NodeKind, usize), NodeId)>>,
+}
+
+impl<'a> AstIndex<'a> {
+    /// Index the nodes of `unit`.
+    pub fn new(unit: &'a TranslationUnit) -> Self {
+        let mut builder = Builder { index: Self::default(), open: Vec::new() };
+        builder.visit_translation_unit(unit);
+        builder.index
+    }
+
+    /// The number of nodes.
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    /// Check whether there are no nodes.
+    pub fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+
+    /// The node `i`.
+    pub fn get(&self, i: usize) -> Option<Node<'a>> {
+        self.nodes.get(i).copied()
+    }
+
+    /// The nodes in pre-order.
+    pub fn nodes(&self) -> &[Node<'a>] {
+        &self.nodes
+    }
+
+    /// The indices of the nodes in the subtree of node `i`, including `i`.
+    pub fn subtree(&self, i: usize) -> Range<usize> {
+        i..self.ends[i] as usize
+    }
+
+    /// The kinds of the nodes in the subtree of node `i`.
+    pub fn subtree_kinds(&self, i: usize) -> NodeKinds {
+        self.contains[i]
+    }
+
+    /// The nodes of `kind`, with their indices, in pre-order.
+    pub fn of_kind(&self, kind: NodeKind) -> impl Iterator<Item = (usize, Node<'a>)> + '_ {
+        self.kinds
+            .iter()
+            .enumerate()
+            .filter(move |(_, k)| **k == kind)
+            .map(|(i, _)| (i, self.nodes[i]))
+    }
+
+    /// The function calls, in pre-order.
+    pub fn function_calls(&self) -> impl Iterator<Item = &'a PostfixExpression> + '_ {
+        self.of_kind(NodeKind::PostfixExpression)
+            .filter_map(|(_, node)| match node {
+                Node::PostfixExpression(call @ PostfixExpression::FunctionCall { .. }) => Some(call),
+                _ => None,
+            })
+    }
+
+    /// The id of `node`, if it is a node of the translation unit.
+    ///
+    /// The first lookup sorts the nodes by address, and each lookup is a
+    /// binary search, with no hashing. Passes that scan the index get the ids
+    /// of the nodes from their positions instead.
+    pub fn id(&self, node: Node<'a>) -> Option<NodeId> {
+        let ids = self.ids.get_or_init(|| {
+            let mut ids: Vec<_> = (self.nodes.iter().enumerate())
+                .map(|(i, node)| (node.key(), NodeId::new(i)))
+                .collect();
+            ids.sort_unstable_by_key(|(key, _)| *key);
+            ids
+        });
+        let key = node.key();
+        let i = ids.binary_search_by_key(&key, |(key, _)| *key).ok()?;
+        Some(ids[i].1)
+    }
+
+    /// The id of the expression `e` of the translation unit.
+    pub fn expression_id(&self, e: &'a Expression) -> Option<NodeId> {
+        self.id(Node::Expression(e))
+    }
+
+    /// The id of the statement `s` of the translation unit.
+    pub fn statement_id(&self, s: &'a Statement) -> Option<NodeId> {
+        self.id(Node::Statement(s))
+    }
+
+    /// The id of the declaration `d` of the translation unit.
+    pub fn declaration_id(&self, d: &'a Declaration) -> Option<NodeId> {
+        self.id(Node::Declaration(d))
+    }
+
+    /// The node of `id`.
+    pub fn node(&self, id: NodeId) -> Node<'a> {
+        self.nodes[id.index()]
+    }
+
+    /// The parent of the node `id`, or `None` for an external declaration.
+    pub fn parent(&self, id: NodeId) -> Option<NodeId> {
+        let parent = self.parents[id.index()];
+        (parent != u32::MAX).then_some(NodeId(parent))
+    }
+
+    /// The ancestors of the node `id`, from its parent up to its external
+    /// declaration.
+    pub fn ancestors(&self, id: NodeId) -> impl Iterator<Item = NodeId> + '_ {
+        std::iter::successors(self.parent(id), |&id| self.parent(id))
+    }
+
+    /// The nearest ancestor of the node `id` of `kind`, e.g. the function
+    /// definition or the statement enclosing an expression.
+    pub fn enclosing(&self, id: NodeId, kind: NodeKind) -> Option<NodeId> {
+        self.ancestors(id).find(|&id| self.kinds[id.index()] == kind)
+    }
+
+    /// Visit the outermost nodes of the kinds in [`Visitor::INTERESTS`], in
+    /// pre-order, skipping the subtrees that contain none of them.
+    ///
+    /// The visitor walks the subtrees of the nodes it is called on as usual,
+    /// so a sparse query, e.g. for declarations, only walks the parts of the
+    /// tree around the nodes it finds.
+    pub fn visit<V: Visitor<'a>>(&self, visitor: &mut V) -> V::Result {
+        let mut i = 0;
+        while i < self.nodes.len() {
+            if !self.contains[i].intersects(V::INTERESTS) {
+                i = self.ends[i] as usize;
+                continue;
+            }
+            if !V::INTERESTS.contains(self.kinds[i]) {
+                i += 1;
+                continue;
+            }
+            let result = match self.nodes[i] {
+                Node::ExternalDeclaration(d) => visitor.visit_external_declaration(d),
+                Node::FunctionDefinition(f) => visitor.visit_function_definition(f),
+                Node::Declaration(d) => visitor.visit_declaration(d),
+                Node::Declarator(d) => visitor.visit_declarator(d),
+                Node::Statement(s) => visitor.visit_statement(s),
+                Node::Expression(e) => visitor.visit_expression(e),
+                Node::PostfixExpression(p) => visitor.visit_postfix_expression(p),
+                Node::TypeName(tn) => visitor.visit_type_name(tn),
+            };
+            if let ControlFlow::Break(residual) = result.branch() {
+                return V::Result::from_residual(residual);
+            }
+            i = self.ends[i] as usize;
+        }
+        V::Result::output()
+    }
+}
+
+/// The id of a node in an [`AstIndex`], which is its position in pre-order.
+///
+/// Ids are dense, so that facts about the nodes are kept in a [`NodeVec`] or
+/// a [`NodeMap`]. They are only meaningful for the index they come from.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct NodeId(u32);
+
+impl NodeId {
+    /// The id of the node at position `i` of an index.
+    pub fn new(i: usize) -> Self {
+        Self(i.try_into().expect("Too many nodes to index"))
+    }
+
+    /// The position of the node in its index.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+impl From<usize> for NodeId {
+    fn from(i: usize) -> Self {
+        Self::new(i)
+    }
+}
+
+/// A value for each node of an [`AstIndex`], in one array indexed by
+/// [`NodeId`].
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct NodeVec<T> {
+    values: Vec<T>,
+}
+
+impl<T> NodeVec<T> {
+    /// The values `f(id, node)` of the nodes of `index`.
+    pub fn from_fn<'a>(index: &AstIndex<'a>, mut f: impl FnMut(NodeId, Node<'a>) -> T) -> Self {
+        let values = (index.nodes.iter().enumerate())
+            .map(|(i, node)| f(NodeId::new(i), *node))
+            .collect();
+        Self { values }
+    }
+
+    /// The number of values, which is the number of nodes of the index.
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    /// Check whether there are no values.
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// The values of the nodes in pre-order.
+    pub fn values(&self) -> &[T] {
+        &self.values
+    }
+
+    /// The values with the ids of their nodes.
+    pub fn iter(&self) -> impl Iterator<Item = (NodeId, &T)> + '_ {
+        (self.values.iter().enumerate()).map(|(i, value)| (NodeId::new(i), value))
+    }
+}
+
+impl<T: Clone> NodeVec<T> {
+    /// The same `value` for each node of `index`.
+    pub fn new(index: &AstIndex<'_>, value: T) -> Self {
+        Self { values: vec![value; index.len()] }
+    }
+}
+
+impl<T> Index<NodeId> for NodeVec<T> {
+    type Output = T;
+
+    fn index(&self, id: NodeId) -> &T {
+        &self.values[id.index()]
+    }
+}
+
+impl<T> IndexMut<NodeId> for NodeVec<T> {
+    fn index_mut(&mut self, id: NodeId) -> &mut T {
+        &mut self.values[id.index()]
+    }
+}
+
+/// A value for some of the nodes of an [`AstIndex`], in one array indexed by
+/// [`NodeId`], for facts that only some nodes have, e.g. the values of
+/// constant expressions.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct NodeMap<T> {
+    values: Vec<Option<T>>,
+    len: usize,
+}
+
+impl<T> Default for NodeMap<T> {
+    fn default() -> Self {
+        Self { values: Vec::new(), len: 0 }
+    }
+}
+
+impl<T> NodeMap<T> {
+    /// An empty map for the nodes of `index`.
+    pub fn new(index: &AstIndex<'_>) -> Self {
+        let mut values = Vec::with_capacity(index.len());
+        values.resize_with(index.len(), || None);
+        Self { values, len: 0 }
+    }
+
+    /// The number of nodes with a value.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Check whether no node has a value.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// The value of the node `id`.
+    pub fn get(&self, id: NodeId) -> Option<&T> {
+        self.values.get(id.index())?.as_ref()
+    }
+
+    /// The value of the node `id`, mutably.
+    pub fn get_mut(&mut self, id: NodeId) -> Option<&mut T> {
+        self.values.get_mut(id.index())?.as_mut()
+    }
+
+    /// Check whether the node `id` has a value.
+    pub fn contains(&self, id: NodeId) -> bool {
+        self.get(id).is_some()
+    }
+
+    /// Set the value of the node `id`, returning the value it had.
+    pub fn insert(&mut self, id: NodeId, value: T) -> Option<T> {
+        let i = id.index();
+        if i >= self.values.len() {
+            self.values.resize_with(i + 1, || None);
+        }
+        let old = self.values[i].replace(value);
+        self.len += usize::from(old.is_none());
+        old
+    }
+
+    /// Remove the value of the node `id`, returning it.
+    pub fn remove(&mut self, id: NodeId) -> Option<T> {
+        let old = self.values.get_mut(id.index())?.take();
+        self.len -= usize::from(old.is_some());
+        old
+    }
+
+    /// The values with the ids of their nodes, in pre-order.
+    pub fn iter(&self) -> impl Iterator<Item = (NodeId, &T)> + '_ {
+        (self.values.iter().enumerate()).filter_map(|(i, value)| Some((NodeId::new(i), value.as_ref()?)))
+    }
+}
+
+/// Builds an [`AstIndex`] with one walk of the tree.
+struct Builder<'a> {
+    index: AstIndex<'a>,
+    /// Nodes whose subtrees are being walked.
+    open: Vec<usize>,
+}
+
+impl<'a> Builder<'a> {
+    /// Add `node`, then the nodes found by `walk` as its subtree.
+    fn push(&mut self, node: Node<'a>, walk: impl FnOnce(&mut Self)) {
+        let index = &mut self.index;
+        let i = index.nodes.len();
+        index.nodes.push(node);
+        index.kinds.push(node.kind());
+        index.ends.push(0);
+        index.contains.push(node.kind().into());
+        index
+            .parents
+            .push(self.open.last().map_or(u32::MAX, |&parent| parent as u32));
+        self.open.push(i);
+        walk(self);
+        self.open.pop();
+
+        let index = &mut self.index;
+        index.ends[i] = index.nodes.len().try_into().expect("Too many nodes to index");
+        if let Some(&parent) = self.open.last() {
+            let kinds = index.contains[i];
+            index.contains[parent] = index.contains[parent] | kinds;
+        }
+    }
+}
+
+impl<'a> Visitor<'a> for Builder<'a> {
+    type Result = ();
+
+    fn visit_external_declaration(&mut self, d: &'a ExternalDeclaration) {
+        self.push(Node::ExternalDeclaration(d), |builder| {
+            walk_external_declaration(builder, d)
+        })
+    }
+
+    fn visit_function_definition(&mut self, f: &'a FunctionDefinition) {
+        self.push(Node::FunctionDefinition(f), |builder| {
+            walk_function_definition(builder, f)
+        })
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        self.push(Node::Declaration(d), |builder| walk_declaration(builder, d))
+    }
+
+    fn visit_declarator(&mut self, d: &'a Declarator) {
+        self.push(Node::Declarator(d), |builder| walk_declarator(builder, d))
+    }
+
+    fn visit_statement(&mut self, s: &'a Statement) {
+        self.push(Node::Statement(s), |builder| walk_statement(builder, s))
+    }
+
+    fn visit_expression(&mut self, e: &'a Expression) {
+        self.push(Node::Expression(e), |builder| walk_expression(builder, e))
+    }
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) {
+        self.push(Node::PostfixExpression(p), |builder| {
+            walk_postfix_expression(builder, p)
+        })
+    }
+
+    fn visit_type_name(&mut self, tn: &'a TypeName) {
+        self.push(Node::TypeName(tn), |builder| walk_type_name(builder, tn))
+    }
+}
+
+/// The function definitions, declarations, statements and expressions of a
+/// translation unit, by their spans, for finding the node at an offset, e.g.
+/// under the cursor of an editor.
+///
+/// The spans of a tree nest, so the nodes are kept in one array sorted by
+/// start, each with the nearest node whose span contains its own. A lookup
+/// is a binary search for the last node starting at or before the offset,
+/// then a walk up from it to the first node containing the offset, so it
+/// takes logarithmic time and the depth of the node found. Building the
+/// index is one walk of the tree, with no hashing, so it can be built again
+/// after each edit of an [`IncrementalUnit`](crate::IncrementalUnit).
+#[derive(Debug, Clone, Default)]
+pub struct SpanIndex<'a> {
+    nodes: Vec<Node<'a>>,
+    starts: Vec<u32>,
+    ends: Vec<u32>,
+    /// The nearest node containing each node, or [`NO_PARENT`].
+    parents: Vec<u32>,
+}
+
+const NO_PARENT: u32 = u32::MAX;
+
+impl<'a> SpanIndex<'a> {
+    /// Index the nodes of `unit` with spans.
+    pub fn new(unit: &'a TranslationUnit) -> Self {
+        let mut builder = SpanBuilder { nodes: Vec::new() };
+        builder.visit_translation_unit(unit);
+        let mut nodes = builder.nodes;
+        // The walk is in source order, but sort in case a tree built by hand
+        // is not; the sort is stable, so nodes with the same span stay
+        // outermost first
+        let key = |&(start, end, _): &(u32, u32, Node<'a>)| (start, Reverse(end));
+        if !nodes.is_sorted_by_key(key) {
+            nodes.sort_by_key(key);
+        }
+
+        let mut index = Self {
+            nodes: Vec::with_capacity(nodes.len()),
+            starts: Vec::with_capacity(nodes.len()),
+            ends: Vec::with_capacity(nodes.len()),
+            parents: Vec::with_capacity(nodes.len()),
+        };
+        let mut open: Vec<u32> = Vec::new();
+        for (start, end, node) in nodes {
+            while let Some(&top) = open.last()
+                && index.ends[top as usize] < end
+            {
+                open.pop();
+            }
+            let i = index.nodes.len().try_into().expect("Too many nodes to index");
+            index.nodes.push(node);
+            index.starts.push(start);
+            index.ends.push(end);
+            index.parents.push(open.last().copied().unwrap_or(NO_PARENT));
+            open.push(i);
+        }
+        index
+    }
+
+    /// The number of nodes.
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    /// Check whether there are no nodes.
+    pub fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+
+    /// The nodes, sorted by the start of their spans.
+    pub fn nodes(&self) -> &[Node<'a>] {
+        &self.nodes
+    }
+
+    /// The innermost node whose span contains `offset`.
+    pub fn node_at(&self, offset: usize) -> Option<Node<'a>> {
+        self.nodes_at(offset).next()
+    }
+
+    /// The nodes whose spans contain `offset`, from the innermost out.
+    pub fn nodes_at(&self, offset: usize) -> impl Iterator<Item = Node<'a>> + '_ {
+        self.enclosing_nodes(offset..offset + 1)
+    }
+
+    /// The innermost node whose span contains all of `range`.
+    pub fn enclosing(&self, range: Range<usize>) -> Option<Node<'a>> {
+        self.enclosing_nodes(range).next()
+    }
+
+    /// The nodes whose spans contain all of `range`, from the innermost out.
+    pub fn enclosing_nodes(&self, range: Range<usize>) -> impl Iterator<Item = Node<'a>> + '_ {
+        // Every node containing the range starts at or before it, so it is
+        // the last such node or one of the nodes containing that one
+        let last = self.starts.partition_point(|&start| start as usize <= range.start);
+        let mut i = last.checked_sub(1).map_or(NO_PARENT, |i| i as u32);
+        while i != NO_PARENT && (self.ends[i as usize] as usize) < range.end {
+            i = self.parents[i as usize];
+        }
+        std::iter::successors((i != NO_PARENT).then_some(i), |&i| {
+            let parent = self.parents[i as usize];
+            (parent != NO_PARENT).then_some(parent)
+        })
+        .map(|i| self.nodes[i as usize])
+    }
+
+    /// The nodes whose spans lie within `range`, sorted by their starts.
+    pub fn within(&self, range: Range<usize>) -> impl Iterator<Item = Node<'a>> + '_ {
+        let first = self.starts.partition_point(|&start| (start as usize) < range.start);
+        let last = self.starts.partition_point(|&start| (start as usize) < range.end);
+        (first..last)
+            .filter(move |&i| self.ends[i] as usize <= range.end)
+            .map(|i| self.nodes[i])
+    }
+}
+
+/// Collects the nodes with spans for a [`SpanIndex`], in pre-order.
+struct SpanBuilder<'a> {
+    nodes: Vec<(u32, u32, Node<'a>)>,
+}
+
+impl<'a> SpanBuilder<'a> {
+    fn push(&mut self, node: Node<'a>) {
+        let range = node.span().expect("Node without a span").range();
+        // Spans store their offsets as `u32`
+        self.nodes.push((range.start as u32, range.end as u32, node));
+    }
+}
+
+impl<'a> Visitor<'a> for SpanBuilder<'a> {
+    type Result = ();
+
+    fn visit_function_definition(&mut self, f: &'a FunctionDefinition) {
+        self.push(Node::FunctionDefinition(f));
+        walk_function_definition(self, f)
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        self.push(Node::Declaration(d));
+        walk_declaration(self, d)
+    }
+
+    fn visit_statement(&mut self, s: &'a Statement) {
+        self.push(Node::Statement(s));
+        walk_statement(self, s)
+    }
+
+    fn visit_expression(&mut self, e: &'a Expression) {
+        self.push(Node::Expression(e));
+        walk_expression(self, e)
+    }
+}
+
+/// Hashes of the subtrees of nodes being built on this thread, by the kind
+/// and address of the node.
+type Hashes = FxHashMap<(NodeKind, usize), u64>;
+
+thread_local! {
+    static HASHES: RefCell<Option<Hashes>> = const { RefCell::new(None) };
+}
+
+/// The hash of `node` if [`StructuralHashes::new`] has already hashed it.
+pub(crate) fn memoized_hash(node: Node<'_>) -> Option<u64> {
+    HASHES.with_borrow(|hashes| hashes.as_ref()?.get(&node.key()).copied())
+}
+
+impl Node<'_> {
+    /// The key of the node in [`Hashes`] and in the ids of an [`AstIndex`].
+    fn key(self) -> (NodeKind, usize) {
+        let address = match self {
+            Node::ExternalDeclaration(d) => d as *const _ as usize,
+            Node::FunctionDefinition(f) => f as *const _ as usize,
+            Node::Declaration(d) => d as *const _ as usize,
+            Node::Declarator(d) => d as *const _ as usize,
+            Node::Statement(s) => s as *const _ as usize,
+            Node::Expression(e) => e as *const _ as usize,
+            Node::PostfixExpression(p) => p as *const _ as usize,
+            Node::TypeName(tn) => tn as *const _ as usize,
+        };
+        (self.kind(), address)
+    }
+}
+
+/// Structural hashes of the expressions, statements and external
+/// declarations of a translation unit.
+///
+/// A structural hash ignores spans, so the same code has the same hash
+/// wherever it appears, in this translation unit or in another one parsed by
+/// the same process. Symbols hash by their interned index, so hashes are not
+/// stable across processes.
+///
+/// The hashes are computed in one bottom-up walk of the tree, and each node
+/// is hashed from the hashes of its nearest nested expressions and
+/// statements, so building them is linear in the size of the tree. They are
+/// not the values that [`Hash`] gives for the nodes alone, but two nodes
+/// with the same structure have the same hash here.
+#[derive(Debug, Clone, Default)]
+pub struct StructuralHashes<'a> {
+    hashes: Hashes,
+    tree: PhantomData<&'a TranslationUnit>,
+}
+
+impl<'a> StructuralHashes<'a> {
+    /// Hash the expressions, statements and external declarations of `unit`.
+    pub fn new(unit: &'a TranslationUnit) -> Self {
+        /// Takes the hashes out of the thread when dropped.
+        struct Guard;
+
+        impl Drop for Guard {
+            fn drop(&mut self) {
+                HASHES.set(None);
+            }
+        }
+
+        HASHES.set(Some(Hashes::default()));
+        let guard = Guard;
+        HashBuilder.visit_translation_unit(unit);
+        let hashes = HASHES.take().expect("Hashes are being built");
+        drop(guard);
+        Self { hashes, tree: PhantomData }
+    }
+
+    /// The number of hashed nodes.
+    pub fn len(&self) -> usize {
+        self.hashes.len()
+    }
+
+    /// Check whether no node is hashed.
+    pub fn is_empty(&self) -> bool {
+        self.hashes.is_empty()
+    }
+
+    /// The hash of `node`, if it is an expression, a statement or an external
+    /// declaration of the translation unit.
+    pub fn get(&self, node: Node<'a>) -> Option<u64> {
+        self.hashes.get(&node.key()).copied()
+    }
+
+    /// The hash of the expression `e` of the translation unit.
+    pub fn expression(&self, e: &'a Expression) -> Option<u64> {
+        self.get(Node::Expression(e))
+    }
+
+    /// The hash of the statement `s` of the translation unit.
+    pub fn statement(&self, s: &'a Statement) -> Option<u64> {
+        self.get(Node::Statement(s))
+    }
+
+    /// The hash of the external declaration `d` of the translation unit.
+    pub fn external_declaration(&self, d: &'a ExternalDeclaration) -> Option<u64> {
+        self.get(Node::ExternalDeclaration(d))
+    }
+}
+
+/// Hashes the nodes of a tree after their subtrees, into [`HASHES`].
+struct HashBuilder;
+
+impl HashBuilder {
+    fn insert(node: Node<'_>, hash: impl FnOnce(&mut FxHasher)) {
+        let mut hasher = FxHasher::default();
+        hash(&mut hasher);
+        let hash = hasher.finish();
+        HASHES.with_borrow_mut(|hashes| {
+            hashes
+                .as_mut()
+                .expect("Hashes are being built")
+                .insert(node.key(), hash)
+        });
+    }
+}
+
+impl<'a> Visitor<'a> for HashBuilder {
+    type Result = ();
+
+    fn visit_external_declaration(&mut self, d: &'a ExternalDeclaration) {
+        walk_external_declaration(self, d);
+        Self::insert(Node::ExternalDeclaration(d), |hasher| d.hash(hasher));
+    }
+
+    fn visit_statement(&mut self, s: &'a Statement) {
+        walk_statement(self, s);
+        Self::insert(Node::Statement(s), |hasher| s.kind.hash(hasher));
+    }
+
+    fn visit_expression(&mut self, e: &'a Expression) {
+        walk_expression(self, e);
+        Self::insert(Node::Expression(e), |hasher| e.kind.hash(hasher));
+    }
+}
+
+/// The kind of a name in a [`DeclarationIndex`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub enum DeclaredKind {
+    /// A function, declared or defined.
+    Function,
+    /// A variable or parameter.
+    Object,
+    /// A typedef name.
+    Typedef,
+    /// A struct, union or enum tag.
+    Tag,
+    /// An enumeration constant.
+    Enumerator,
+    /// A struct or union member.
+    Member,
+}
+
+/// The names declared in a translation unit, in the order they were parsed.
+///
+/// Each entry has the name, its kind, the span of the name, and the depth of
+/// the scope it is declared in: 0 at file scope, plus one for each enclosing
+/// compound statement or parameter list. Tags are entered where they are
+/// defined with a member or enumerator list, and parameters as objects.
+///
+/// The entries are stored as one array per field, so that scans for a name or
+/// a kind stay compact, and with the `serde` feature the index is written to
+/// disk as is by [`serialize::encode_tree`](crate::serialize::encode_tree).
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct DeclarationIndex {
+    names: Vec<Symbol>,
+    kinds: Vec<DeclaredKind>,
+    spans: Vec<Span>,
+    depths: Vec<u32>,
+}
+
+/// An entry of a [`DeclarationIndex`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Declared {
+    /// The declared name.
+    pub name: Symbol,
+    /// The kind of the name.
+    pub kind: DeclaredKind,
+    /// The span of the name.
+    pub span: Span,
+    /// The depth of the scope of the declaration.
+    pub depth: u32,
+}
+
+impl DeclarationIndex {
+    /// The number of entries.
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    /// Check whether there are no entries.
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+
+    /// The entry `i`.
+    pub fn get(&self, i: usize) -> Option<Declared> {
+        Some(Declared {
+            name: *self.names.get(i)?,
+            kind: self.kinds[i],
+            span: self.spans[i],
+            depth: self.depths[i],
+        })
+    }
+
+    /// The entries in order.
+    pub fn iter(&self) -> impl Iterator<Item = Declared> + '_ {
+        (0..self.len()).map(|i| self.get(i).unwrap())
+    }
+
+    /// The declared names.
+    pub fn names(&self) -> &[Symbol] {
+        &self.names
+    }
+
+    /// The kind of each name.
+    pub fn kinds(&self) -> &[DeclaredKind] {
+        &self.kinds
+    }
+
+    /// The span of each name.
+    pub fn spans(&self) -> &[Span] {
+        &self.spans
+    }
+
+    /// The scope depth of each name.
+    pub fn depths(&self) -> &[u32] {
+        &self.depths
+    }
+
+    /// The entries declaring `name`.
+    pub fn lookup(&self, name: Symbol) -> impl Iterator<Item = Declared> + '_ {
+        self.names
+            .iter()
+            .enumerate()
+            .filter(move |(_, n)| **n == name)
+            .map(|(i, _)| self.get(i).unwrap())
+    }
+
+    /// The entries of `kind`.
+    pub fn of_kind(&self, kind: DeclaredKind) -> impl Iterator<Item = Declared> + '_ {
+        self.kinds
+            .iter()
+            .enumerate()
+            .filter(move |(_, k)| **k == kind)
+            .map(|(i, _)| self.get(i).unwrap())
+    }
+
+    pub(crate) fn push(&mut self, name: Symbol, kind: DeclaredKind, span: Span, depth: u32) {
+        self.names.push(name);
+        self.kinds.push(kind);
+        self.spans.push(span);
+        self.depths.push(depth);
+    }
+
+    pub(crate) fn truncate(&mut self, len: usize) {
+        self.names.truncate(len);
+        self.kinds.truncate(len);
+        self.spans.truncate(len);
+        self.depths.truncate(len);
+    }
+
+    /// The entries from `start` on.
+    pub(crate) fn tail(&self, start: usize) -> Self {
+        Self {
+            names: self.names[start..].to_vec(),
+            kinds: self.kinds[start..].to_vec(),
+            spans: self.spans[start..].to_vec(),
+            depths: self.depths[start..].to_vec(),
+        }
+    }
+
+    pub(crate) fn extend(&mut self, other: &Self) {
+        self.names.extend_from_slice(&other.names);
+        self.kinds.extend_from_slice(&other.kinds);
+        self.spans.extend_from_slice(&other.spans);
+        self.depths.extend_from_slice(&other.depths);
+    }
+
+    /// Move the span of every entry by `delta`.
+    pub(crate) fn shift(&mut self, delta: isize) {
+        for span in &mut self.spans {
+            span.shift(delta);
+        }
+    }
+
+    /// Set the kind of `name` declared by the declarator that starts at
+    /// `start`, which is the first entry from there on.
+    pub(crate) fn set_kind(&mut self, name: Symbol, start: usize, kind: DeclaredKind) {
+        let inside = self.spans.iter().rev().take_while(|span| span.range().start >= start);
+        let first = self.spans.len() - inside.count();
+        if self.names.get(first) == Some(&name) {
+            self.kinds[first] = kind;
+        }
+    }
+}
+
+/// Where each identifier occurs in a source, collected by the lexer, see
+/// [`lex_occurrences`](crate::lex_occurrences).
+///
+/// For each distinct identifier, the index keeps a posting list: the sorted
+/// start offsets of the identifier tokens spelling it. The lists are stored
+/// back to back in one array, and the names sorted by symbol, so that the
+/// occurrences of a name are found by a binary search. Keywords that are never
+/// identifiers, see [`Symbol::is_reserved`], are left out, and so are `true`,
+/// `false` and `nullptr`, which are lexed as constants.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct OccurrenceIndex {
+    /// The distinct names, sorted by symbol.
+    names: Vec<Symbol>,
+    /// Where the offsets of each name start in `offsets`, and their end.
+    starts: Vec<u32>,
+    offsets: Vec<u32>,
+}
+
+impl OccurrenceIndex {
+    /// The number of distinct names.
+    pub fn len(&self) -> usize {
+        self.names.len()
+    }
+
+    /// Check whether no identifier occurs.
+    pub fn is_empty(&self) -> bool {
+        self.names.is_empty()
+    }
+
+    /// The distinct names, sorted by symbol.
+    pub fn names(&self) -> &[Symbol] {
+        &self.names
+    }
+
+    /// The start offsets of the occurrences of `name`, in order.
+    pub fn offsets(&self, name: Symbol) -> &[u32] {
+        match self.names.binary_search_by_key(&name.as_u32(), |name| name.as_u32()) {
+            Ok(i) => self.entry(i),
+            Err(_) => &[],
+        }
+    }
+
+    /// The spans of the occurrences of `name`, in order.
+    pub fn spans(&self, name: Symbol) -> impl Iterator<Item = Span> + '_ {
+        let len = name.len();
+        (self.offsets(name).iter()).map(move |&offset| Span::new(offset as usize..offset as usize + len))
+    }
+
+    /// The names with the start offsets of their occurrences, by symbol.
+    pub fn iter(&self) -> impl Iterator<Item = (Symbol, &[u32])> + '_ {
+        self.names.iter().enumerate().map(|(i, &name)| (name, self.entry(i)))
+    }
+
+    fn entry(&self, i: usize) -> &[u32] {
+        &self.offsets[self.starts[i] as usize..self.starts[i + 1] as usize]
+    }
+
+    /// Build the index from the occurrences in the order they were lexed.
+    pub(crate) fn from_occurrences(mut occurrences: Vec<(Symbol, u32)>) -> Self {
+        // The sort is stable, so the offsets of each name stay in order
+        occurrences.sort_by_key(|(name, _)| name.as_u32());
+        let mut index = Self {
+            names: Vec::new(),
+            starts: Vec::new(),
+            offsets: Vec::with_capacity(occurrences.len()),
+        };
+        for (name, offset) in occurrences {
+            if index.names.last() != Some(&name) {
+                index.names.push(name);
+                index.starts.push(index.offsets.len() as u32);
+            }
+            index.offsets.push(offset);
+        }
+        index.starts.push(index.offsets.len() as u32);
+        index
+    }
+}
+
+/// The names each external declaration of a translation unit looked up and
+/// bound in the parsing state, collected by the parser itself, see
+/// [`State::set_dependency_graph`](crate::State::set_dependency_graph).
+///
+/// Whether an identifier is a typedef name or an enumeration constant decides
+/// how the declarations after it are parsed, so these are the names on which
+/// a parsed declaration depends: after an edit of the declarations binding
+/// some names, only the declarations in [`DependencyGraph::affected`] need to
+/// be parsed again, besides the edited ones.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct DependencyGraph {
+    declarations: Vec<Dependencies>,
+    /// The declarations that looked up each name.
+    consumers: FxHashMap<Symbol, Vec<u32>>,
+}
+
+/// The dependencies of one external declaration in a [`DependencyGraph`].
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Dependencies {
+    /// The names looked up as typedef names or enumeration constants,
+    /// whether they were one or not, in the order first looked up.
+    pub consumed: Vec<Symbol>,
+    /// The typedef names bound at file scope.
+    pub typedef_names: Vec<Symbol>,
+    /// The enumeration constants bound at file scope.
+    pub enum_constants: Vec<Symbol>,
+}
+
+impl DependencyGraph {
+    /// The number of external declarations.
+    pub fn len(&self) -> usize {
+        self.declarations.len()
+    }
+
+    /// Check whether there are no external declarations.
+    pub fn is_empty(&self) -> bool {
+        self.declarations.is_empty()
+    }
+
+    /// The dependencies of the external declaration `i`.
+    pub fn get(&self, i: usize) -> Option<&Dependencies> {
+        self.declarations.get(i)
+    }
+
+    /// The dependencies of each external declaration, in order.
+    pub fn iter(&self) -> impl Iterator<Item = &Dependencies> + '_ {
+        self.declarations.iter()
+    }
+
+    /// The external declarations that looked up `name`, in order.
+    pub fn consumers(&self, name: Symbol) -> impl Iterator<Item = usize> + '_ {
+        (self.consumers.get(&name).into_iter().flatten()).map(|&i| i as usize)
+    }
+
+    /// The external declarations to parse again once the declarations of
+    /// `names` changed, in order: those that looked up one of the names, and
+    /// those that looked up a name bound by one of them, and so on.
+    pub fn affected(&self, names: impl IntoIterator<Item = Symbol>) -> Vec<usize> {
+        let mut names: Vec<Symbol> = names.into_iter().collect();
+        let mut affected = vec![false; self.len()];
+        while let Some(name) = names.pop() {
+            for i in self.consumers(name) {
+                if !std::mem::replace(&mut affected[i], true) {
+                    let dependencies = &self.declarations[i];
+                    names.extend(dependencies.typedef_names.iter().chain(&dependencies.enum_constants));
+                }
+            }
+        }
+        (0..self.len()).filter(|&i| affected[i]).collect()
+    }
+
+    /// Enter the next external declaration, with the names it looked up so
+    /// far in `lookups`, which may repeat.
+    pub(crate) fn push(&mut self, lookups: &[Symbol], typedef_names: Vec<Symbol>, enum_constants: Vec<Symbol>) {
+        let i = self.declarations.len().try_into().expect("Too many declarations");
+        let mut consumed = Vec::new();
+        for &name in lookups {
+            let consumers = self.consumers.entry(name).or_default();
+            if consumers.last() != Some(&i) {
+                consumers.push(i);
+                consumed.push(name);
+            }
+        }
+        self.declarations
+            .push(Dependencies { consumed, typedef_names, enum_constants });
+    }
+}
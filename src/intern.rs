@@ -0,0 +1,324 @@
+//! Hash-consing of the type syntax repeated across declarations.
+//!
+//! Code expanded from headers repeats the same declaration specifiers, type
+//! names and pointers many times, each one a separate tree. An [`Interner`]
+//! keeps one shared copy of each distinct value, and hands out [`Interned`]
+//! handles to it, so that passes keeping type syntax around, e.g. for every
+//! declaration of many translation units, store each distinct type once, and
+//! compare types by address:
+//!
+//! ```ignore
+//! let mut interner = TypeInterner::new();
+//! let types = interner.intern_unit(&unit);
+//! let a = types.specifiers(&first.specifiers).unwrap();
+//! let b = types.specifiers(&second.specifiers).unwrap();
+//! if a == b {
+//!     // ...
+//! }
+//! ```
+//!
+//! Values are compared without their spans, as by their structural [`Hash`],
+//! and the shared copy has its spans cleared, since it stands for values at
+//! many places.
+
+use std::{
+    fmt,
+    hash::{Hash, Hasher},
+    marker::PhantomData,
+    ops::Deref,
+    sync::Arc,
+};
+
+use rustc_hash::{FxHashMap, FxHashSet};
+
+use crate::{
+    ast::*,
+    span::Span,
+    visitor::{
+        Visitor, VisitorMut, walk_declaration_mut, walk_declaration_specifiers, walk_expression_mut, walk_pointer,
+        walk_statement_mut, walk_type_name,
+    },
+};
+
+/// A handle to a value shared by an [`Interner`].
+///
+/// Handles from the same interner are equal exactly when their values are,
+/// so equality and hashing use the address of the value alone.
+pub struct Interned<T>(Arc<T>);
+
+impl<T> Interned<T> {
+    /// The number of handles to the value, including the interner's own.
+    pub fn handles(this: &Self) -> usize {
+        Arc::strong_count(&this.0)
+    }
+}
+
+impl<T> Clone for Interned<T> {
+    fn clone(&self) -> Self {
+        Self(self.0.clone())
+    }
+}
+
+impl<T> Deref for Interned<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.0
+    }
+}
+
+impl<T> PartialEq for Interned<T> {
+    fn eq(&self, other: &Self) -> bool {
+        Arc::ptr_eq(&self.0, &other.0)
+    }
+}
+
+impl<T> Eq for Interned<T> {}
+
+impl<T> Hash for Interned<T> {
+    fn hash<H: Hasher>(&self, state: &mut H) {
+        Arc::as_ptr(&self.0).hash(state);
+    }
+}
+
+impl<T: fmt::Debug> fmt::Debug for Interned<T> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(&*self.0, f)
+    }
+}
+
+/// Keeps one shared copy of each distinct value interned.
+#[derive(Debug)]
+pub struct Interner<T> {
+    values: FxHashSet<Arc<T>>,
+}
+
+impl<T> Default for Interner<T> {
+    fn default() -> Self {
+        Self { values: FxHashSet::default() }
+    }
+}
+
+impl<T: Clone + Eq + Hash + Unspan> Interner<T> {
+    /// Create an empty interner.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The shared copy of `value`, added if no equal value was interned.
+    pub fn intern(&mut self, value: &T) -> Interned<T> {
+        // Values without spans, e.g. most specifier lists, are found without
+        // a copy, since spans are not hashed
+        if let Some(shared) = self.values.get(value) {
+            return Interned(shared.clone());
+        }
+        let mut value = value.clone();
+        value.unspan();
+        if let Some(shared) = self.values.get(&value) {
+            return Interned(shared.clone());
+        }
+        let shared = Arc::new(value);
+        self.values.insert(shared.clone());
+        Interned(shared)
+    }
+
+    /// The number of distinct values.
+    pub fn len(&self) -> usize {
+        self.values.len()
+    }
+
+    /// Check whether no value was interned.
+    pub fn is_empty(&self) -> bool {
+        self.values.is_empty()
+    }
+
+    /// Drop the values that no handle refers to anymore.
+    pub fn shrink(&mut self) {
+        self.values.retain(|value| Arc::strong_count(value) > 1);
+    }
+}
+
+/// Syntax whose spans can be cleared, so that the same syntax at different
+/// places is equal.
+pub trait Unspan {
+    /// Clear the spans in the value.
+    fn unspan(&mut self);
+}
+
+macro_rules! unspan {
+    ($($ty:ty => $visit:ident),* $(,)?) => {
+        $(impl Unspan for $ty {
+            fn unspan(&mut self) {
+                Unspanned.$visit(self)
+            }
+        })*
+    };
+}
+
+unspan! {
+    DeclarationSpecifiers => visit_declaration_specifiers_mut,
+    TypeName => visit_type_name_mut,
+    Pointer => visit_pointer_mut,
+}
+
+/// Clears the spans of a tree.
+struct Unspanned;
+
+impl Unspanned {
+    fn tokens(tokens: &mut BalancedTokenSequence) {
+        tokens.eoi = Span::default();
+        for token in &mut tokens.tokens {
+            token.span = Span::default();
+            if let BalancedToken::Parenthesized(inner)
+            | BalancedToken::Bracketed(inner)
+            | BalancedToken::Braced(inner) = &mut token.value
+            {
+                Self::tokens(Arc::make_mut(inner));
+            }
+        }
+    }
+}
+
+impl<'a> VisitorMut<'a> for Unspanned {
+    type Result = ();
+
+    fn visit_expression_mut(&mut self, e: &'a mut Expression) {
+        e.span = Span::default();
+        walk_expression_mut(self, e)
+    }
+
+    fn visit_statement_mut(&mut self, s: &'a mut Statement) {
+        s.span = Span::default();
+        walk_statement_mut(self, s)
+    }
+
+    fn visit_declaration_mut(&mut self, d: &'a mut Declaration) {
+        d.span = Span::default();
+        walk_declaration_mut(self, d)
+    }
+
+    fn visit_attribute_mut(&mut self, a: &'a mut Attribute) {
+        if let Some(arguments) = &mut a.arguments {
+            Self::tokens(Arc::make_mut(arguments));
+        }
+    }
+}
+
+/// Interns the declaration specifiers, type names and pointers of
+/// translation units.
+///
+/// One interner can be used for many units, so that their types share
+/// storage too.
+#[derive(Debug, Default)]
+pub struct TypeInterner {
+    specifiers: Interner<DeclarationSpecifiers>,
+    type_names: Interner<TypeName>,
+    pointers: Interner<Pointer>,
+}
+
+impl TypeInterner {
+    /// Create an empty interner.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The shared copy of the declaration specifiers `s`.
+    pub fn specifiers(&mut self, s: &DeclarationSpecifiers) -> Interned<DeclarationSpecifiers> {
+        self.specifiers.intern(s)
+    }
+
+    /// The shared copy of the type name `tn`.
+    pub fn type_name(&mut self, tn: &TypeName) -> Interned<TypeName> {
+        self.type_names.intern(tn)
+    }
+
+    /// The shared copy of the pointer `p`.
+    pub fn pointer(&mut self, p: &Pointer) -> Interned<Pointer> {
+        self.pointers.intern(p)
+    }
+
+    /// Intern every declaration specifier list, type name and pointer of
+    /// `unit`.
+    pub fn intern_unit<'a>(&mut self, unit: &'a TranslationUnit) -> UnitTypes<'a> {
+        let mut builder = UnitBuilder {
+            types: UnitTypes::default(),
+            interner: self,
+        };
+        builder.visit_translation_unit(unit);
+        builder.types
+    }
+
+    /// The number of distinct declaration specifier lists, type names and
+    /// pointers.
+    pub fn len(&self) -> usize {
+        self.specifiers.len() + self.type_names.len() + self.pointers.len()
+    }
+
+    /// Check whether nothing was interned.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Drop the values that no handle refers to anymore, e.g. after the
+    /// [`UnitTypes`] of a unit are dropped.
+    pub fn shrink(&mut self) {
+        self.specifiers.shrink();
+        self.type_names.shrink();
+        self.pointers.shrink();
+    }
+}
+
+/// The shared copies of the declaration specifiers, type names and pointers
+/// of a translation unit, by the address of the node in the tree.
+#[derive(Debug, Default)]
+pub struct UnitTypes<'a> {
+    specifiers: FxHashMap<usize, Interned<DeclarationSpecifiers>>,
+    type_names: FxHashMap<usize, Interned<TypeName>>,
+    pointers: FxHashMap<usize, Interned<Pointer>>,
+    tree: PhantomData<&'a TranslationUnit>,
+}
+
+impl<'a> UnitTypes<'a> {
+    /// The shared copy of the declaration specifiers `s` of the unit.
+    pub fn specifiers(&self, s: &'a DeclarationSpecifiers) -> Option<&Interned<DeclarationSpecifiers>> {
+        self.specifiers.get(&(s as *const _ as usize))
+    }
+
+    /// The shared copy of the type name `tn` of the unit.
+    pub fn type_name(&self, tn: &'a TypeName) -> Option<&Interned<TypeName>> {
+        self.type_names.get(&(tn as *const _ as usize))
+    }
+
+    /// The shared copy of the pointer `p` of the unit.
+    pub fn pointer(&self, p: &'a Pointer) -> Option<&Interned<Pointer>> {
+        self.pointers.get(&(p as *const _ as usize))
+    }
+}
+
+/// Builds the [`UnitTypes`] of a unit with one walk of the tree.
+struct UnitBuilder<'a, 'i> {
+    types: UnitTypes<'a>,
+    interner: &'i mut TypeInterner,
+}
+
+impl<'a> Visitor<'a> for UnitBuilder<'a, '_> {
+    type Result = ();
+
+    fn visit_declaration_specifiers(&mut self, s: &'a DeclarationSpecifiers) {
+        let shared = self.interner.specifiers(s);
+        self.types.specifiers.insert(s as *const _ as usize, shared);
+        walk_declaration_specifiers(self, s)
+    }
+
+    fn visit_type_name(&mut self, tn: &'a TypeName) {
+        let shared = self.interner.type_name(tn);
+        self.types.type_names.insert(tn as *const _ as usize, shared);
+        walk_type_name(self, tn)
+    }
+
+    fn visit_pointer(&mut self, p: &'a Pointer) {
+        let shared = self.interner.pointer(p);
+        self.types.pointers.insert(p as *const _ as usize, shared);
+        walk_pointer(self, p)
+    }
+}
@@ -0,0 +1,466 @@
+//! Sizes, alignments and member offsets of the types of a [`TypeTable`].
+//!
+//! A [`LayoutEngine`] lays types out for a [`Target`], the sizes and
+//! alignments of the scalar types of an ABI, with bit-fields packed as GCC or
+//! MSVC does. Layouts are memoized per type and per record, and the engine is
+//! shared by reference, so the types of a whole project can be laid out on all
+//! cores with [`LayoutEngine::layout_all`]:
+//!
+//! ```ignore
+//! let engine = LayoutEngine::new(&table, Target::LP64);
+//! let ids: Vec<_> = table.iter().map(|(id, _)| id).collect();
+//! for (id, layout) in ids.iter().zip(engine.layout_all(&ids)) {
+//!     println!("{}: {layout:?}", table.display(*id));
+//! }
+//! ```
+//!
+//! Types without a layout, e.g. incomplete or variable length types,
+//! functions and unresolved names, have none, as does every type that
+//! contains one. Attributes such as `packed` are not read.
+
+use std::sync::{Arc, Mutex, PoisonError};
+
+use rustc_hash::FxHashMap;
+
+use crate::{
+    parallel::par_map,
+    symbol::Symbol,
+    types::{AlignAs, ArrayLength, Field, IntegerRank, RecordId, Type, TypeId, TypeTable},
+};
+
+/// The size and alignment of a type, in bytes.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct Layout {
+    /// `sizeof`.
+    pub size: u64,
+    /// `_Alignof`.
+    pub align: u64,
+}
+
+impl Layout {
+    /// A layout of `size` bytes aligned to `align`.
+    pub const fn new(size: u64, align: u64) -> Self {
+        Self { size, align }
+    }
+}
+
+/// The sizes and alignments of the scalar types of an ABI.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct Target {
+    /// `short`.
+    pub short: Layout,
+    /// `int`, and enumerations without a fixed underlying type whose
+    /// constants fit in it.
+    pub int: Layout,
+    /// `long`.
+    pub long: Layout,
+    /// `long long`, which also bounds the alignment of `_BitInt`.
+    pub long_long: Layout,
+    /// Pointers and block pointers.
+    pub pointer: Layout,
+    /// `float`.
+    pub float: Layout,
+    /// `double`.
+    pub double: Layout,
+    /// `long double`.
+    pub long_double: Layout,
+    /// Whether bit-fields are packed as MSVC does, in units of their declared
+    /// type that are never shared with a type of another size, rather than as
+    /// the System V ABI does.
+    pub ms_bitfields: bool,
+}
+
+impl Target {
+    /// 64-bit Unix, e.g. x86-64 and AArch64 Linux.
+    pub const LP64: Self = Self {
+        short: Layout::new(2, 2),
+        int: Layout::new(4, 4),
+        long: Layout::new(8, 8),
+        long_long: Layout::new(8, 8),
+        pointer: Layout::new(8, 8),
+        float: Layout::new(4, 4),
+        double: Layout::new(8, 8),
+        long_double: Layout::new(16, 16),
+        ms_bitfields: false,
+    };
+
+    /// 64-bit Windows.
+    pub const LLP64: Self = Self {
+        long: Layout::new(4, 4),
+        long_double: Layout::new(8, 8),
+        ms_bitfields: true,
+        ..Self::LP64
+    };
+
+    /// 32-bit Unix, e.g. i386 Linux, where 8-byte scalars in structures are
+    /// only 4-byte aligned.
+    pub const ILP32: Self = Self {
+        long: Layout::new(4, 4),
+        long_long: Layout::new(8, 4),
+        pointer: Layout::new(4, 4),
+        double: Layout::new(8, 4),
+        long_double: Layout::new(12, 4),
+        ..Self::LP64
+    };
+}
+
+/// The layout of a structure or union, with the offsets of its members.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct RecordLayout {
+    /// The size and alignment of the whole.
+    pub layout: Layout,
+    /// The offset of each member of [`Record::fields`](crate::types::Record::fields),
+    /// in bits.
+    pub bit_offsets: Vec<u64>,
+}
+
+impl RecordLayout {
+    /// The offset of the member at `index`, in bytes, rounded down for a
+    /// bit-field.
+    pub fn offset(&self, index: usize) -> u64 {
+        self.bit_offsets[index] / 8
+    }
+}
+
+/// Lays out the types of a [`TypeTable`] for a [`Target`], memoizing the
+/// layouts.
+///
+/// The engine only reads the table, and its memos are behind locks, so one
+/// engine can be shared by threads. A layout computed by two threads at once
+/// is computed twice, with the same result.
+#[derive(Debug)]
+pub struct LayoutEngine<'t> {
+    table: &'t TypeTable,
+    target: Target,
+    types: Mutex<FxHashMap<TypeId, Option<Layout>>>,
+    records: Mutex<FxHashMap<RecordId, Option<Arc<RecordLayout>>>>,
+}
+
+impl<'t> LayoutEngine<'t> {
+    /// Create an engine laying out the types of `table` for `target`.
+    pub fn new(table: &'t TypeTable, target: Target) -> Self {
+        Self {
+            table,
+            target,
+            types: Mutex::default(),
+            records: Mutex::default(),
+        }
+    }
+
+    /// The target the types are laid out for.
+    pub fn target(&self) -> &Target {
+        &self.target
+    }
+
+    /// Number of types and records laid out so far.
+    pub fn memoized(&self) -> usize {
+        let types = self.types.lock().unwrap_or_else(PoisonError::into_inner).len();
+        types + self.records.lock().unwrap_or_else(PoisonError::into_inner).len()
+    }
+
+    /// The layout of `ty`, if it has one.
+    pub fn layout(&self, ty: TypeId) -> Option<Layout> {
+        self.layout_in(ty, &mut Vec::new())
+    }
+
+    /// `sizeof` of `ty`.
+    pub fn size_of(&self, ty: TypeId) -> Option<u64> {
+        self.layout(ty).map(|layout| layout.size)
+    }
+
+    /// `_Alignof` of `ty`.
+    pub fn align_of(&self, ty: TypeId) -> Option<u64> {
+        self.layout(ty).map(|layout| layout.align)
+    }
+
+    /// The layouts of `types`, in order, computed on all available cores.
+    pub fn layout_all(&self, types: &[TypeId]) -> Vec<Option<Layout>> {
+        par_map(types, |&ty| self.layout(ty))
+    }
+
+    /// The layout of the structure or union `ty`, with the offsets of its
+    /// members, if it is complete.
+    pub fn record_layout(&self, ty: TypeId) -> Option<Arc<RecordLayout>> {
+        match *self.table.get(self.table.unqualified(ty)) {
+            Type::Struct(record) => self.record_layout_in(record, false, &mut Vec::new()),
+            Type::Union(record) => self.record_layout_in(record, true, &mut Vec::new()),
+            _ => None,
+        }
+    }
+
+    /// `offsetof` of the member of `ty` named by `path`, e.g. `["a", "b"]`
+    /// for `offsetof(T, a.b)`, in bytes. Members of anonymous structures and
+    /// unions are found as members of `ty`.
+    ///
+    /// There is no offset if a member is not found or is a bit-field.
+    pub fn offset_of(&self, ty: TypeId, path: &[Symbol]) -> Option<u64> {
+        let mut ty = ty;
+        let mut offset = 0;
+        for &name in path {
+            let (bits, member, bitfield) = self.find_member(ty, name)?;
+            if bitfield {
+                return None;
+            }
+            offset += bits / 8;
+            ty = member;
+        }
+        Some(offset)
+    }
+
+    /// The offset in bits of the member `name` of `ty`, its type and whether
+    /// it is a bit-field.
+    fn find_member(&self, ty: TypeId, name: Symbol) -> Option<(u64, TypeId, bool)> {
+        let layout = self.record_layout(ty)?;
+        let (Type::Struct(id) | Type::Union(id)) = *self.table.get(self.table.unqualified(ty)) else {
+            unreachable!("Only structures and unions have a record layout");
+        };
+        let fields = &self.table.record(id).fields;
+        if let Some(index) = fields.iter().position(|field| field.name == Some(name)) {
+            let field = &fields[index];
+            return Some((layout.bit_offsets[index], field.ty, field.bit_width.is_some()));
+        }
+        // Members of anonymous members, outermost first
+        fields.iter().enumerate().find_map(|(index, field)| {
+            if field.name.is_some() || field.bit_width.is_some() {
+                return None;
+            }
+            let (bits, ty, bitfield) = self.find_member(field.ty, name)?;
+            Some((layout.bit_offsets[index] + bits, ty, bitfield))
+        })
+    }
+
+    /// [`layout`](Self::layout), with the records being laid out on `stack`,
+    /// so that a record containing itself has no layout.
+    fn layout_in(&self, ty: TypeId, stack: &mut Vec<RecordId>) -> Option<Layout> {
+        if let Some(&layout) = self.types.lock().unwrap_or_else(PoisonError::into_inner).get(&ty) {
+            return layout;
+        }
+        let layout = self.compute(ty, stack);
+        self.types
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+            .insert(ty, layout);
+        layout
+    }
+
+    fn compute(&self, ty: TypeId, stack: &mut Vec<RecordId>) -> Option<Layout> {
+        let target = &self.target;
+        let layout = match *self.table.get(ty) {
+            Type::Bool | Type::Char | Type::SignedChar | Type::UnsignedChar => Layout::new(1, 1),
+            Type::Integer { rank, .. } => match rank {
+                IntegerRank::Short => target.short,
+                IntegerRank::Int => target.int,
+                IntegerRank::Long => target.long,
+                IntegerRank::LongLong => target.long_long,
+            },
+            Type::BitInt { width, .. } => self.bit_int(width?),
+            Type::Float => target.float,
+            Type::Double => target.double,
+            Type::LongDouble => target.long_double,
+            Type::Decimal32 => Layout::new(4, 4),
+            Type::Decimal64 => Layout::new(8, 8),
+            Type::Decimal128 => Layout::new(16, 16),
+            Type::Complex(real) => {
+                let real = self.layout_in(real, stack)?;
+                Layout::new(real.size * 2, real.align)
+            }
+            Type::Pointer(_) | Type::Block(_) => target.pointer,
+            Type::Array {
+                element,
+                length: ArrayLength::Constant(length),
+            } => {
+                let element = self.layout_in(element, stack)?;
+                Layout::new(element.size.checked_mul(length)?, element.align)
+            }
+            Type::Struct(record) => self.record_layout_in(record, false, stack)?.layout,
+            Type::Union(record) => self.record_layout_in(record, true, stack)?.layout,
+            Type::Enum(record) => self.enumeration(record, stack)?,
+            Type::Qualified { base, .. } => self.layout_in(base, stack)?,
+            Type::Array { .. } | Type::Void | Type::Function { .. } | Type::Unknown => return None,
+        };
+        Some(layout)
+    }
+
+    /// `_BitInt(width)`: the smallest standard integer that holds it, or for
+    /// wider ones, a whole number of `long long`s.
+    fn bit_int(&self, width: u64) -> Layout {
+        let target = &self.target;
+        let fits = [Layout::new(1, 1), target.short, target.int, target.long_long];
+        match fits.into_iter().find(|layout| width <= layout.size * 8) {
+            Some(layout) => layout,
+            None => {
+                let unit = target.long_long.size * 8;
+                Layout::new(width.div_ceil(unit) * target.long_long.size, target.long_long.align)
+            }
+        }
+    }
+
+    fn enumeration(&self, record: RecordId, stack: &mut Vec<RecordId>) -> Option<Layout> {
+        let record = self.table.record(record);
+        if let Some(underlying) = record.underlying {
+            return self.layout_in(underlying, stack);
+        }
+        // Constants that do not fit in an `int` widen the type, as with GCC
+        let int = i128::from(self.target.int.size) * 8;
+        let fits = |value: i128| value >= -(1 << (int - 1)) && value < 1 << int;
+        if record.enumerators.iter().all(|&(_, value)| fits(value)) {
+            Some(self.target.int)
+        } else {
+            Some(self.target.long_long)
+        }
+    }
+
+    fn record_layout_in(&self, id: RecordId, union: bool, stack: &mut Vec<RecordId>) -> Option<Arc<RecordLayout>> {
+        if let Some(layout) = self.records.lock().unwrap_or_else(PoisonError::into_inner).get(&id) {
+            return layout.clone();
+        }
+        if stack.contains(&id) {
+            return None;
+        }
+        stack.push(id);
+        let layout = self.compute_record(id, union, stack).map(Arc::new);
+        stack.pop();
+        (self.records.lock().unwrap_or_else(PoisonError::into_inner)).insert(id, layout.clone());
+        layout
+    }
+
+    fn compute_record(&self, id: RecordId, union: bool, stack: &mut Vec<RecordId>) -> Option<RecordLayout> {
+        let record = self.table.record(id);
+        if !record.complete {
+            return None;
+        }
+        let mut packer = Packer::new(self.target.ms_bitfields);
+        let mut bit_offsets = Vec::with_capacity(record.fields.len());
+        for (index, field) in record.fields.iter().enumerate() {
+            let last = index + 1 == record.fields.len();
+            let (layout, align) = self.field(field, last && !union, stack)?;
+            if union {
+                packer.union_member(field, layout, align);
+                bit_offsets.push(0);
+            } else {
+                bit_offsets.push(packer.place(field, layout, align));
+            }
+        }
+        Some(RecordLayout { layout: packer.finish(), bit_offsets })
+    }
+
+    /// The layout of the type of `field`, and its alignment with its
+    /// alignment specifiers. A flexible array member, if `flexible`, has no
+    /// size.
+    fn field(&self, field: &Field, flexible: bool, stack: &mut Vec<RecordId>) -> Option<(Layout, u64)> {
+        let layout = match *self.table.get(field.ty) {
+            Type::Array {
+                element,
+                length: ArrayLength::Unspecified,
+            } if flexible => Layout::new(0, self.layout_in(element, stack)?.align),
+            _ => self.layout_in(field.ty, stack)?,
+        };
+        let mut align = layout.align;
+        for alignas in &field.alignas {
+            align = align.max(match *alignas {
+                AlignAs::Bytes(bytes) => bytes,
+                AlignAs::Type(ty) => self.layout_in(ty, stack)?.align,
+            });
+        }
+        Some((layout, align))
+    }
+}
+
+/// Places the members of a record one after another, in bits.
+struct Packer {
+    ms_bitfields: bool,
+    /// The end of the members placed so far.
+    offset: u64,
+    /// The size of a union, the largest member.
+    size: u64,
+    align: u64,
+    /// The start and size of the storage unit of the last bit-field, with
+    /// MSVC packing.
+    unit: Option<(u64, u64)>,
+}
+
+impl Packer {
+    fn new(ms_bitfields: bool) -> Self {
+        Self {
+            ms_bitfields,
+            offset: 0,
+            size: 0,
+            align: 1,
+            unit: None,
+        }
+    }
+
+    /// Place `field` after the members placed so far, returning its offset.
+    fn place(&mut self, field: &Field, layout: Layout, align: u64) -> u64 {
+        let unit_bits = layout.size * 8;
+        let align_bits = align * 8;
+        let Some(width) = field.bit_width else {
+            if let Some((start, size)) = self.unit.take() {
+                self.offset = self.offset.max(start + size);
+            }
+            self.align = self.align.max(align);
+            self.offset = self.offset.next_multiple_of(align_bits);
+            let offset = self.offset;
+            self.offset += unit_bits;
+            return offset;
+        };
+
+        if self.ms_bitfields {
+            // A bit-field shares the unit of the last one if it has a type of
+            // the same size and fits in it
+            match self.unit {
+                Some((start, size)) if width > 0 && size == unit_bits && self.offset + width <= start + size => {}
+                Some((start, size)) => {
+                    self.offset = (start + size).next_multiple_of(align_bits);
+                    self.unit = (width > 0).then_some((self.offset, unit_bits));
+                }
+                // A zero-width bit-field after other members has no effect
+                None if width == 0 => return self.offset,
+                None => {
+                    self.offset = self.offset.next_multiple_of(align_bits);
+                    self.unit = Some((self.offset, unit_bits));
+                }
+            }
+            if width > 0 {
+                self.align = self.align.max(align);
+            }
+        } else if width == 0 {
+            // An unnamed zero-width bit-field ends the unit it is in,
+            // without aligning the record
+            self.offset = self.offset.next_multiple_of(align_bits);
+        } else {
+            // A bit-field never straddles a unit of its type
+            if self.offset % unit_bits + width > unit_bits {
+                self.offset = self.offset.next_multiple_of(align_bits);
+            }
+            if field.name.is_some() {
+                self.align = self.align.max(align);
+            }
+        }
+        let offset = self.offset;
+        self.offset += width;
+        offset
+    }
+
+    /// Account for the member `field` of a union, at offset 0.
+    fn union_member(&mut self, field: &Field, layout: Layout, align: u64) {
+        let bits = match field.bit_width {
+            Some(width) => width.next_multiple_of(8),
+            None => layout.size * 8,
+        };
+        self.size = self.size.max(bits);
+        if field.bit_width != Some(0) {
+            self.align = self.align.max(align);
+        }
+    }
+
+    /// The layout of the record, padded to its alignment.
+    fn finish(self) -> Layout {
+        let end = match self.unit {
+            Some((start, size)) => self.offset.max(start + size),
+            None => self.offset,
+        };
+        let bytes = end.max(self.size).div_ceil(8);
+        Layout::new(bytes.next_multiple_of(self.align), self.align)
+    }
+}
@@ -1,11 +1,23 @@
 //! Lexer for C source code, producing balanced token sequences.
 
+use std::{
+    borrow::Cow,
+    num::NonZeroUsize,
+    ops::Range,
+    sync::{Arc, RwLock},
+    thread,
+};
+
 use ordered_float::NotNan;
+use rustc_hash::{FxHashMap, FxHashSet};
 
 #[cfg(feature = "quasi-quote")]
 use crate::quasi_quote::Template;
 use crate::{
     ast::*,
+    incremental::shift_tokens,
+    index::OccurrenceIndex,
+    parallel::par_map,
     span::{ContextMapping, SourceContext, Span, Spanned},
 };
 
@@ -14,15 +26,805 @@ use crate::{
 /// This function tokenizes the input string and returns the result along with
 /// any errors encountered during lexing.
 pub fn lex<'a>(source: &'a str, filename: Option<&str>) -> (BalancedTokenSequence, ContextMapping<'a>) {
+    #[cfg(feature = "tracing")]
+    let span = tracing::debug_span!("lex", bytes = source.len(), tokens = tracing::field::Empty).entered();
     let mut lexer = Lexer::new(source, filename);
     let result = lexer.balanced_token_sequence();
+    #[cfg(feature = "tracing")]
+    span.record("tokens", result.tokens.len());
     (result, lexer.ctx_map)
 }
 
+/// Lexes source code given as bytes, e.g. the output of a preprocessor, which
+/// need not be valid UTF-8.
+///
+/// Valid UTF-8 is lexed in place, after one validation of the bytes, without
+/// copying them. Otherwise the text is copied to `buffer`, with each byte of an
+/// invalid sequence, typically a Latin-1 character of a legacy source, replaced
+/// by the ASCII substitute character `\x1a`. The offsets of the text are thus
+/// those of the bytes. Outside literals, a run of invalid bytes is lexed as
+/// one [`BalancedToken::Unknown`], together with the characters around it that
+/// start no token either; in the value of a literal each byte is kept as
+/// `\x1a`.
+pub fn lex_bytes<'a>(
+    bytes: &'a [u8],
+    filename: Option<&str>,
+    buffer: &'a mut String,
+) -> (BalancedTokenSequence, ContextMapping<'a>) {
+    let source = match std::str::from_utf8(bytes) {
+        Ok(source) => source,
+        Err(_) => {
+            buffer.clear();
+            buffer.reserve(bytes.len());
+            for chunk in bytes.utf8_chunks() {
+                buffer.push_str(chunk.valid());
+                buffer.extend(std::iter::repeat_n('\x1a', chunk.invalid().len()));
+            }
+            buffer.as_str()
+        }
+    };
+    lex(source, filename)
+}
+
+/// Lexes the input source code like [`lex`], also collecting where each
+/// identifier occurs, as an [`OccurrenceIndex`].
+///
+/// Finding the references of a name in the index is a binary search, so
+/// reference queries need neither a parse nor a walk of the tree.
+pub fn lex_occurrences<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+) -> (BalancedTokenSequence, ContextMapping<'a>, OccurrenceIndex) {
+    let mut lexer = Lexer::new(source, filename).with_occurrences();
+    let result = lexer.balanced_token_sequence();
+    let occurrences = OccurrenceIndex::from_occurrences(lexer.take_occurrences());
+    (result, lexer.ctx_map, occurrences)
+}
+
+/// Lexes the input source code like [`lex`], also collecting the whitespace,
+/// comments and line directives between the tokens, as a [`TriviaTable`].
+///
+/// The tokens are those [`lex`] returns, so that the table costs nothing to
+/// the lexing that does not ask for it, and nothing to the size of a token
+/// when it is collected.
+pub fn lex_trivia<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+) -> (BalancedTokenSequence, ContextMapping<'a>, TriviaTable) {
+    let mut lexer = Lexer::new(source, filename).with_trivia();
+    let result = lexer.balanced_token_sequence();
+    let trivia = TriviaTable { runs: lexer.take_trivia() };
+    (result, lexer.ctx_map, trivia)
+}
+
+/// Lexes the input source code like [`lex`], also collecting its doc
+/// comments, as [`DocComments`].
+pub fn lex_doc_comments<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+) -> (BalancedTokenSequence, ContextMapping<'a>, DocComments) {
+    let mut lexer = Lexer::new(source, filename).with_doc_comments();
+    let result = lexer.balanced_token_sequence();
+    let (comments, tokens) = lexer.take_doc_comments().into_iter().unzip();
+    (result, lexer.ctx_map, DocComments { comments, tokens })
+}
+
+/// The doc comments of a source, `/** ... */` and `/// ...`, as collected by
+/// [`lex_doc_comments`].
+///
+/// Each doc comment is kept with the offset of the token after it, and only
+/// the last of the comments before a token is kept, so the doc comment of a
+/// declaration is found by the start of its span, as a slice of the source:
+///
+/// ```ignore
+/// let (tokens, ctx_map, docs) = lex_doc_comments(source, None);
+/// for declaration in &unit.external_declarations {
+///     println!("{:?}", docs.external_declaration(&ctx_map, declaration));
+/// }
+/// ```
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct DocComments {
+    /// Start and end of each comment, in source order.
+    comments: Vec<(u32, u32)>,
+    /// Start of the token after each comment.
+    tokens: Vec<u32>,
+}
+
+impl DocComments {
+    /// Number of doc comments.
+    pub fn len(&self) -> usize {
+        self.comments.len()
+    }
+
+    /// Whether the source has no doc comments.
+    pub fn is_empty(&self) -> bool {
+        self.comments.is_empty()
+    }
+
+    /// The span of the doc comment just before the token at `offset`, if
+    /// there is one.
+    pub fn before(&self, offset: usize) -> Option<Span> {
+        let index = self.tokens.binary_search(&(offset as u32)).ok()?;
+        let (start, end) = self.comments[index];
+        Some(Span::new(start as usize..end as usize))
+    }
+
+    /// The doc comment of `declaration`, from the source of `ctx_map`.
+    pub fn external_declaration<'a>(
+        &self,
+        ctx_map: &ContextMapping<'a>,
+        declaration: &ExternalDeclaration,
+    ) -> Option<&'a str> {
+        self.text(ctx_map, declaration.span())
+    }
+
+    /// The doc comment of the member `declaration`, from the source of
+    /// `ctx_map`.
+    pub fn member_declaration<'a>(
+        &self,
+        ctx_map: &ContextMapping<'a>,
+        declaration: &MemberDeclaration,
+    ) -> Option<&'a str> {
+        self.text(ctx_map, declaration.span()?)
+    }
+
+    fn text<'a>(&self, ctx_map: &ContextMapping<'a>, span: Span) -> Option<&'a str> {
+        let comment = self.before(span.range().start)?;
+        ctx_map.source.get(comment.range())
+    }
+
+    /// The spans of the doc comments, in source order.
+    pub fn iter(&self) -> impl ExactSizeIterator<Item = Span> + '_ {
+        (self.comments.iter()).map(|&(start, end)| Span::new(start as usize..end as usize))
+    }
+}
+
+/// The whitespace, comments and line directives of a source, kept beside its
+/// tokens by [`lex_trivia`].
+///
+/// Each run of trivia is stored as its byte range only, and is found by the
+/// offset of the token it precedes, the start of a token or of the closing
+/// bracket of a group, or the end of the source for the trivia after the last
+/// token. Tokens written back with
+/// [`BalancedTokenSequence::write_with_trivia`] then keep the comments and
+/// layout of the source, even around tokens that were edited:
+///
+/// ```ignore
+/// let (tokens, _, trivia) = lex_trivia(source, None);
+/// let mut text = String::new();
+/// tokens.write_with_trivia(source, &trivia, &mut text)?;
+/// assert_eq!(text, source);
+/// ```
+#[derive(Debug, Default, Clone, PartialEq, Eq)]
+pub struct TriviaTable {
+    /// Start and end of each run, in source order.
+    runs: Vec<(u32, u32)>,
+}
+
+impl TriviaTable {
+    /// Number of runs of trivia.
+    pub fn len(&self) -> usize {
+        self.runs.len()
+    }
+
+    /// Whether the source has no trivia.
+    pub fn is_empty(&self) -> bool {
+        self.runs.is_empty()
+    }
+
+    /// The byte range of the trivia just before `offset`, the start of a
+    /// token, if there is any.
+    pub fn before(&self, offset: usize) -> Option<Range<usize>> {
+        let index = self.runs.partition_point(|&(_, end)| (end as usize) < offset);
+        let &(start, end) = self.runs.get(index)?;
+        (end as usize == offset).then_some(start as usize..end as usize)
+    }
+
+    /// The byte ranges of the runs of trivia, in source order.
+    pub fn iter(&self) -> impl ExactSizeIterator<Item = Range<usize>> + '_ {
+        self.runs.iter().map(|&(start, end)| start as usize..end as usize)
+    }
+}
+
+/// A set of identifiers to look for in sources without parsing them, e.g. to
+/// find which of many files are worth parsing.
+///
+/// The sources are scanned with the lexer, so that names in comments, string
+/// literals, character constants and line directives are not found, but no
+/// tokens are built: the scan only keeps the closing brackets of the groups it
+/// is in, and stops at the first name of the set. Keywords are spelled as
+/// identifiers, so they can be looked for too.
+///
+/// ```ignore
+/// let search = TokenSearch::new(["memcpy", "memmove"]);
+/// let to_parse = files.iter().filter(|file| search.is_match(&file.source));
+/// ```
+pub struct TokenSearch {
+    names: FxHashSet<Box<str>>,
+    /// Bit `n` is set if a name has length `n`, or at least 63 for bit 63, so
+    /// that most identifiers are rejected without hashing them.
+    lengths: u64,
+}
+
+impl TokenSearch {
+    /// Creates a search for `names`.
+    pub fn new<S: AsRef<str>>(names: impl IntoIterator<Item = S>) -> Self {
+        let names: FxHashSet<Box<str>> = names.into_iter().map(|name| name.as_ref().into()).collect();
+        let lengths = names.iter().fold(0, |lengths, name| lengths | Self::length_bit(name));
+        Self { names, lengths }
+    }
+
+    fn length_bit(name: &str) -> u64 {
+        1 << name.len().min(63)
+    }
+
+    /// The span of the first identifier of `source` in the set, among the
+    /// tokens [`lex`] lexes.
+    pub fn find(&self, source: &str) -> Option<Span> {
+        let mut lexer = Lexer::new(source, None);
+        lexer.find_identifier(|name| self.lengths & Self::length_bit(name) != 0 && self.names.contains(name))
+    }
+
+    /// Check whether an identifier of `source` is in the set.
+    pub fn is_match(&self, source: &str) -> bool {
+        self.find(source).is_some()
+    }
+}
+
+/// Lexes the input source code into top-level balanced tokens on demand.
+///
+/// The iterator yields the tokens of the sequence [`lex`] returns, one at a
+/// time, lexing each only when it is asked for, so that the whole token tree
+/// of the source is never held at once. [`LexIter::finish`] returns the
+/// end of the tokens and the source contexts.
+///
+/// The source itself is borrowed as a whole `&str`, so it must already be in
+/// memory, or mapped as by `SourceFile::lex_iter` with the `mmap` feature;
+/// this does not stream input of unbounded size from a reader. Each token is
+/// a whole top-level group, which is held at once however large it is.
+///
+/// Like [`lex`], the tokens end at a stray closing bracket, without an error:
+/// the iterator then stops, and [`LexIter::offset`] is the offset of the
+/// bracket rather than the end of the source.
+pub fn lex_iter<'a>(source: &'a str, filename: Option<&str>) -> LexIter<'a> {
+    LexIter {
+        lexer: Lexer::new(source, filename),
+        done: false,
+    }
+}
+
+/// Iterator over the top-level tokens of a source, see [`lex_iter`].
+pub struct LexIter<'a> {
+    lexer: Lexer<'a>,
+    /// Whether the end of the input or a stray closing bracket was reached.
+    done: bool,
+}
+
+impl<'a> LexIter<'a> {
+    /// Source contexts of the line directives lexed so far.
+    pub fn ctx_map(&self) -> &ContextMapping<'a> {
+        &self.lexer.ctx_map
+    }
+
+    /// Offset of the first byte of the source not lexed yet.
+    pub fn offset(&self) -> usize {
+        self.lexer.cursor()
+    }
+
+    /// Stop lexing, returning the end-of-input span of the tokens yielded so
+    /// far, as in [`BalancedTokenSequence::eoi`], and the source contexts.
+    pub fn finish(mut self) -> (Span, ContextMapping<'a>) {
+        self.lexer.skip_whitespace();
+        (Span::new_eoi(self.lexer.cursor()), self.lexer.ctx_map)
+    }
+}
+
+impl Iterator for LexIter<'_> {
+    type Item = Spanned<BalancedToken>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.done {
+            return None;
+        }
+        self.lexer.skip_whitespace();
+        let token = match self.lexer.peek() {
+            Some(')' | ']' | '}') | None => None,
+            _ => self.lexer.balanced_token(),
+        };
+        self.done = token.is_none();
+        token
+    }
+}
+
+impl std::iter::FusedIterator for LexIter<'_> {}
+
+/// Lexes the top-level tokens in `range` of the source, recording the
+/// contexts of `#line` directives after those already in `ctx_map`.
+///
+/// Returns `None` unless the tokens end exactly at the end of `range`, e.g.
+/// when a comment or a bracketed group runs past it.
+pub(crate) fn lex_region<'a>(
+    source: &'a str,
+    range: Range<usize>,
+    ctx_map: &mut ContextMapping<'a>,
+) -> Option<Vec<Spanned<BalancedToken>>> {
+    let contexts = std::mem::replace(ctx_map, ContextMapping::new(source));
+    let mut lexer = Lexer::resume(source, range.start, contexts);
+    let result = lexer.balanced_tokens_until(range.end);
+    *ctx_map = lexer.ctx_map;
+    result
+}
+
+/// Lexes the top-level tokens of the source from `cursor` to its end, as
+/// [`lex`] does from the start, recording the contexts of `#line` directives
+/// after those already in `ctx_map`.
+///
+/// Returns the tokens and the end-of-input span, as in
+/// [`BalancedTokenSequence::eoi`].
+#[cfg(feature = "async")]
+pub(crate) fn lex_rest<'a>(
+    source: &'a str,
+    cursor: usize,
+    ctx_map: &mut ContextMapping<'a>,
+) -> (Vec<Spanned<BalancedToken>>, Span) {
+    let contexts = std::mem::replace(ctx_map, ContextMapping::new(source));
+    let mut lexer = Lexer::resume(source, cursor, contexts);
+    let mut tokens = Vec::new();
+    // A stray closing bracket ends the top-level sequence
+    lexer.push_tokens_until(source.len(), &mut tokens);
+    lexer.skip_whitespace();
+    let eoi = Span::new_eoi(lexer.cursor());
+    *ctx_map = lexer.ctx_map;
+    (tokens, eoi)
+}
+
+/// Lexes the top-level tokens of each of `ranges` of the source onto one
+/// vector, with one lexer, for the snippets of a
+/// [`ParseSession`](crate::ParseSession) batch. The ranges must be in order.
+///
+/// Returns the tokens and, for each range, the range of its tokens, or `None`
+/// unless they end exactly at its end, e.g. when a bracketed group or a
+/// comment is left open.
+pub(crate) fn lex_ranges<'a>(
+    source: &'a str,
+    ranges: &[Range<usize>],
+) -> (
+    Vec<Spanned<BalancedToken>>,
+    Vec<Option<Range<usize>>>,
+    ContextMapping<'a>,
+) {
+    let mut lexer = Lexer::new(source, None);
+    let mut tokens = Vec::new();
+    let mut lexed = Vec::with_capacity(ranges.len());
+    for range in ranges {
+        if lexer.cursor() > range.start {
+            // The range before ran into this one
+            let ctx_map = std::mem::replace(&mut lexer.ctx_map, ContextMapping::new(source));
+            lexer = Lexer::resume(source, range.start, ctx_map);
+        }
+        lexer.seek(range.start);
+        let start = tokens.len();
+        if lexer.push_tokens_until(range.end, &mut tokens) && lexer.cursor() == range.end {
+            lexed.push(Some(start..tokens.len()));
+        } else {
+            tokens.truncate(start);
+            lexed.push(None);
+        }
+    }
+    (tokens, lexed, lexer.ctx_map)
+}
+
+/// A token of a line lexed by [`lex_line`].
+#[derive(Clone)]
+pub(crate) struct LineToken {
+    /// The token, with brackets as punctuators.
+    pub token: Spanned<BalancedToken>,
+    /// Whether whitespace or a comment precedes the token on its line.
+    pub space: bool,
+}
+
+/// Lexes the tokens of the line of `source` starting at `cursor` onto
+/// `tokens`, for the preprocessor, and returns the offset of the next line.
+///
+/// Brackets are lexed as single punctuators rather than groups, and `#` lines
+/// as tokens instead of line directives. A line ends at the first newline
+/// outside of a comment that is not escaped by a backslash.
+pub(crate) fn lex_line(source: &str, cursor: usize, tokens: &mut Vec<LineToken>) -> usize {
+    let mut lexer = Lexer::resume(source, cursor, ContextMapping::new(source));
+    lexer.stop_at_newlines();
+    // End of the last token, since string literals take the whitespace after them
+    let mut end = cursor;
+    loop {
+        lexer.skip_whitespace();
+        let start = lexer.cursor();
+        let space = start > end;
+        let bracket = match lexer.peek() {
+            None => break,
+            Some('\n') => {
+                lexer.eat();
+                break;
+            }
+            Some('(') => Some(Punctuator::LeftParen),
+            Some(')') => Some(Punctuator::RightParen),
+            Some('[') => Some(Punctuator::LeftBracket),
+            Some(']') => Some(Punctuator::RightBracket),
+            Some('{') => Some(Punctuator::LeftBrace),
+            Some('}') => Some(Punctuator::RightBrace),
+            _ => None,
+        };
+        let token = match bracket {
+            Some(punctuator) => {
+                lexer.eat();
+                Spanned::new(BalancedToken::Punctuator(punctuator), lexer.make_span(start))
+            }
+            None => match lexer.balanced_token() {
+                Some(token) => token,
+                None => break,
+            },
+        };
+        end = token.span.range().end;
+        tokens.push(LineToken { token, space });
+    }
+    lexer.cursor()
+}
+
+/// The constant spelled by all of `text`, if it is one token, e.g. to check
+/// that the source at the span of a constant still spells it.
+#[cfg(feature = "printer")]
+pub(crate) fn lex_constant(text: &str) -> Option<Constant> {
+    let mut lexer = Lexer::new(text, None);
+    match lexer.balanced_token()?.value {
+        BalancedToken::Constant(constant) if lexer.is_eof() => Some(constant),
+        _ => None,
+    }
+}
+
+/// Vectors and strings kept between the sources a lexer lexes, so that
+/// lexing many sources, e.g. the snippets an editor lexes on every change,
+/// allocates little once the pool is warm.
+///
+/// [`TokenPool::lex`] lexes like [`lex`], collecting the tokens of each group
+/// and the text of string literals and quoted strings into buffers from the
+/// pool, and [`TokenPool::recycle`] gives the buffers of a token sequence
+/// that is no longer needed back to the pool. Buffers of the pool have a
+/// capacity rounded up to a power of two, so that they can be reused for
+/// tokens of other lengths, and tokens lexed with a pool may take up to twice
+/// the memory of those of [`lex`].
+///
+/// Identifiers seen for the first time and the filename still allocate. The
+/// pool keeps the buffers given back to it until it is dropped.
+#[derive(Default)]
+pub struct TokenPool {
+    buffers: Buffers,
+    /// Vectors given back, whose tokens are not taken out yet.
+    recycled: Vec<Vec<Spanned<BalancedToken>>>,
+}
+
+impl TokenPool {
+    /// Creates an empty pool.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of free buffers in the pool.
+    pub fn len(&self) -> usize {
+        self.buffers.vectors.len()
+            + self.buffers.literals.len()
+            + self.buffers.strings.len()
+            + self.buffers.shared_groups.len()
+            + self.buffers.shared_literals.len()
+    }
+
+    /// Whether the pool holds no free buffers.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Lexes the input source code like [`lex`], reusing the buffers of the
+    /// pool.
+    pub fn lex<'a>(&mut self, source: &'a str, filename: Option<&str>) -> (BalancedTokenSequence, ContextMapping<'a>) {
+        let mut lexer = Lexer::new(source, filename).with_buffers(std::mem::take(&mut self.buffers));
+        let result = lexer.balanced_token_sequence();
+        self.buffers = lexer.take_buffers();
+        (result, lexer.ctx_map)
+    }
+
+    /// Give the buffers of `tokens` and of the groups nested in it back to the
+    /// pool.
+    pub fn recycle(&mut self, tokens: BalancedTokenSequence) {
+        // Without recursion, since groups may nest deeper than the stack allows
+        self.recycled.push(tokens.tokens);
+        while let Some(mut tokens) = self.recycled.pop() {
+            for token in tokens.drain(..) {
+                // Groups and literals still shared, e.g. by a syntax tree, are
+                // left to their other owners
+                match token.value {
+                    BalancedToken::Parenthesized(mut inner)
+                    | BalancedToken::Bracketed(mut inner)
+                    | BalancedToken::Braced(mut inner) => {
+                        if let Some(group) = Arc::get_mut(&mut inner) {
+                            self.recycled.push(std::mem::take(&mut group.tokens));
+                            self.buffers.shared_groups.push(inner);
+                        }
+                    }
+                    BalancedToken::StringLiteral(mut shared) => {
+                        if let Some(StringLiterals(literals)) = Arc::get_mut(&mut shared) {
+                            for literal in literals.drain(..) {
+                                self.buffers.strings.put(literal.value);
+                            }
+                            self.buffers.literals.put(std::mem::take(literals));
+                            self.buffers.shared_literals.push(shared);
+                        }
+                    }
+                    BalancedToken::QuotedString(text) => self.buffers.strings.put(text),
+                    _ => {}
+                }
+            }
+            self.buffers.vectors.put(tokens);
+        }
+    }
+}
+
+/// Tokens of the `#line`-delimited regions of lexed sources, shared between
+/// lexers and threads.
+///
+/// A region runs from the end of one line marker, `# <line> "<file>"`, to the
+/// end of the next one. Translation units that include the same headers
+/// contain the same regions, so [`lex_cached`] lexes each distinct region
+/// once and clones its tokens afterwards.
+///
+/// Regions are keyed by their text, so the cache grows with the distinct
+/// content lexed through it.
+#[derive(Default)]
+pub struct TokenCache {
+    regions: RwLock<FxHashMap<Box<str>, Arc<CachedRegion>>>,
+}
+
+enum CachedRegion {
+    /// The tokens of the region, and the contexts its line markers start, with
+    /// offsets, spans and line offsets relative to the start of the region.
+    Complete {
+        tokens: Vec<Spanned<BalancedToken>>,
+        contexts: Vec<(usize, SourceContext)>,
+    },
+    /// A token or comment runs past the end of the region, so it is lexed
+    /// together with the next one.
+    Incomplete,
+}
+
+impl TokenCache {
+    /// Creates an empty cache.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of distinct regions in the cache.
+    pub fn len(&self) -> usize {
+        self.regions.read().unwrap().len()
+    }
+
+    /// Whether the cache holds no regions.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    fn get(&self, text: &str) -> Option<Arc<CachedRegion>> {
+        self.regions.read().unwrap().get(text).cloned()
+    }
+
+    fn insert(&self, text: &str, region: CachedRegion) {
+        self.regions
+            .write()
+            .unwrap()
+            .entry(text.into())
+            .or_insert_with(|| Arc::new(region));
+    }
+}
+
+/// Lexes the input source code like [`lex`], reusing the tokens of regions
+/// between line markers that `cache` already holds.
+///
+/// The result is the same as that of [`lex`]: tokens from the cache are
+/// moved to where their region starts, and the contexts of their line markers
+/// are started again at their line.
+pub fn lex_cached<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+    cache: &TokenCache,
+) -> (BalancedTokenSequence, ContextMapping<'a>) {
+    let mut lexer = Lexer::new(source, filename);
+    let mut tokens = Vec::new();
+    let mut start = 0;
+    while start < source.len() {
+        // Lines before the region, for the line offsets of its contexts
+        let base_line = lexer.lineno() - 1;
+        let mut end = next_line_marker_end(source, start);
+        let cached = loop {
+            match cache.get(&source[start..end]).as_deref() {
+                Some(CachedRegion::Incomplete) => end = next_line_marker_end(source, end),
+                Some(CachedRegion::Complete { tokens, contexts }) => break Some((tokens.clone(), contexts.clone())),
+                None => break None,
+            }
+        };
+
+        if let Some((mut cached, contexts)) = cached {
+            shift_tokens(&mut cached, start as isize);
+            tokens.extend(cached);
+            for (offset, mut context) in contexts {
+                context.line_offset += base_line;
+                lexer.ctx_map.start_context(start + offset, context);
+            }
+            lexer.seek(end);
+            start = end;
+            continue;
+        }
+
+        let first_token = tokens.len();
+        let first_context = lexer.ctx_map.starts_len();
+        let mut ended = true;
+        loop {
+            if !lexer.push_tokens_until(end, &mut tokens) {
+                // A stray closing bracket ends the top-level sequence
+                ended = false;
+                break;
+            }
+            if lexer.cursor() == end {
+                break;
+            }
+            cache.insert(&source[start..end], CachedRegion::Incomplete);
+            end = next_line_marker_end(source, end);
+        }
+        if !ended {
+            break;
+        }
+
+        let mut region = tokens[first_token..].to_vec();
+        shift_tokens(&mut region, -(start as isize));
+        let contexts = lexer
+            .ctx_map
+            .starts_since(first_context)
+            .map(|(offset, context)| {
+                let mut context = context.clone();
+                context.line_offset -= base_line;
+                (offset - start, context)
+            })
+            .collect();
+        cache.insert(&source[start..end], CachedRegion::Complete { tokens: region, contexts });
+        start = end;
+    }
+
+    lexer.skip_whitespace();
+    let eoi = Span::new_eoi(lexer.cursor());
+    let tokens = BalancedTokenSequence { tokens, closed: true, eoi };
+    (tokens, lexer.ctx_map)
+}
+
+/// Smallest chunk of the source that [`lex_parallel`] lexes on its own.
+const MIN_CHUNK_LEN: usize = 1 << 14;
+
+/// Lexes the input source code like [`lex`], lexing chunks of it on all
+/// available cores.
+///
+/// The source is split at lines starting with an identifier or a `#` in the
+/// first column, as the top-level declarations and line markers of
+/// preprocessed code do, and the chunks are lexed in parallel, each from the
+/// top level. A chunk is only used if the tokens before it end exactly at its
+/// start, so when a split falls inside a comment, a literal or a bracketed
+/// group, the source from there is lexed again sequentially, up to the next
+/// split the tokens end at. The result is always the same as that of [`lex`].
+pub fn lex_parallel<'a>(source: &'a str, filename: Option<&str>) -> (BalancedTokenSequence, ContextMapping<'a>) {
+    let workers = thread::available_parallelism().map_or(1, NonZeroUsize::get);
+    let count = (workers * 4).min(source.len() / MIN_CHUNK_LEN);
+    if workers < 2 || count < 2 {
+        return lex(source, filename);
+    }
+    let starts = chunk_starts(source, count);
+    let ranges: Vec<_> = starts
+        .iter()
+        .zip(starts[1..].iter().chain([&source.len()]))
+        .map(|(&start, &end)| start..end)
+        .collect();
+
+    let chunks = par_map(&ranges, |range| {
+        let mut lexer = Lexer::resume(source, range.start, ContextMapping::new(source));
+        let mut tokens = Vec::new();
+        let complete = lexer.push_tokens_until(range.end, &mut tokens) && lexer.cursor() == range.end;
+        complete.then(|| {
+            let contexts: Vec<_> = lexer
+                .ctx_map
+                .starts_since(0)
+                .map(|(offset, context)| (offset, context.clone()))
+                .collect();
+            (tokens, contexts)
+        })
+    });
+
+    let mut lexer = Lexer::new(source, filename);
+    let mut tokens = Vec::new();
+    for (range, chunk) in ranges.iter().zip(chunks) {
+        match chunk {
+            Some((chunk, contexts)) if lexer.cursor() == range.start => {
+                tokens.extend(chunk);
+                for (offset, context) in contexts {
+                    lexer.ctx_map.start_context(offset, context);
+                }
+                lexer.seek(range.end);
+            }
+            // Lex the chunk again from where the tokens before it end, which
+            // may be past its end if a comment or token spans it
+            _ => {
+                if !lexer.push_tokens_until(range.end, &mut tokens) {
+                    // A stray closing bracket ends the top-level sequence
+                    break;
+                }
+            }
+        }
+    }
+
+    lexer.skip_whitespace();
+    let eoi = Span::new_eoi(lexer.cursor());
+    let tokens = BalancedTokenSequence { tokens, closed: true, eoi };
+    (tokens, lexer.ctx_map)
+}
+
+/// Starts of the chunks [`lex_parallel`] splits `source` into: 0, and the
+/// first line starting with an identifier or a `#` after each of `count - 1`
+/// evenly spaced offsets.
+fn chunk_starts(source: &str, count: usize) -> Vec<usize> {
+    let bytes = source.as_bytes();
+    let mut starts = vec![0];
+    for index in 1..count {
+        let from = (source.len() / count * index).max(starts[starts.len() - 1]);
+        let start = memchr::memchr_iter(b'\n', &bytes[from..])
+            .map(|i| from + i + 1)
+            .find(|&start| {
+                bytes
+                    .get(start)
+                    .is_some_and(|&b| b.is_ascii_alphabetic() || b == b'_' || b == b'#')
+            });
+        match start {
+            Some(start) => starts.push(start),
+            None => break,
+        }
+    }
+    starts
+}
+
+/// End of the first line marker, `# <number> ...`, on a line starting at or
+/// after `from`, which is the start of a line, or the end of `source`.
+fn next_line_marker_end(source: &str, from: usize) -> usize {
+    let bytes = source.as_bytes();
+    let is_blank = |b: &u8| matches!(b, b' ' | b'\t');
+    for hash in memchr::memchr_iter(b'#', &bytes[from..]).map(|i| from + i) {
+        let line_start = bytes[from..hash]
+            .iter()
+            .rposition(|b| !is_blank(b))
+            .map_or(from, |i| from + i + 1);
+        let at_line_start = line_start == from || bytes[line_start - 1] == b'\n';
+        let is_marker = bytes[hash + 1..]
+            .iter()
+            .find(|b| !is_blank(b))
+            .is_some_and(u8::is_ascii_digit);
+        if at_line_start && is_marker {
+            return memchr::memchr(b'\n', &bytes[hash..]).map_or(source.len(), |i| hash + i + 1);
+        }
+    }
+    source.len()
+}
+
 mod lexer_core {
-    use regex_automata::{Anchored, Input, meta::Regex};
+    use std::sync::{Arc, OnceLock};
+
+    use regex_automata::{
+        Anchored, Input,
+        dfa::{Automaton, sparse},
+    };
 
-    use crate::span::{ContextId, ContextMapping, SourceContext, Span};
+    use crate::{
+        BalancedToken, BalancedTokenSequence, StringLiteral, StringLiterals,
+        span::{ContextMapping, SourceContext, Span, Spanned},
+        symbol::Symbol,
+    };
 
     pub trait Pattern {
         fn matches(self, string: &str) -> Option<usize>;
@@ -40,145 +842,692 @@ mod lexer_core {
         }
     }
 
-    impl Pattern for &'_ Regex {
+    /// A regex compiled to a sparse DFA by `build.rs`, which is searched in
+    /// place and needs no cache, so that matching does not synchronize with
+    /// other threads.
+    pub struct Dfa {
+        bytes: &'static [u8],
+        dfa: OnceLock<sparse::DFA<&'static [u8]>>,
+    }
+
+    impl Dfa {
+        pub const fn new(bytes: &'static [u8]) -> Self {
+            Self { bytes, dfa: OnceLock::new() }
+        }
+
+        fn get(&self) -> &sparse::DFA<&'static [u8]> {
+            // Validated once, without copying
+            (self.dfa).get_or_init(|| sparse::DFA::from_bytes(self.bytes).expect("DFA built by build.rs").0)
+        }
+    }
+
+    impl Pattern for &'static Dfa {
         fn matches(self, string: &str) -> Option<usize> {
             let input = Input::new(string).anchored(Anchored::Yes);
-            self.find(input).map(|mat| mat.len())
+            let mat = self.get().try_search_fwd(&input).expect("Anchored search");
+            mat.map(|mat| mat.offset())
+        }
+    }
+
+    /// A hand-written scanner returning the length of the match.
+    pub struct Scan<F>(pub F);
+
+    impl<F: FnOnce(&str) -> Option<usize>> Pattern for Scan<F> {
+        fn matches(self, string: &str) -> Option<usize> {
+            (self.0)(string)
         }
     }
 
     pub struct Lexer<'a> {
         string: &'a str,
         cursor: usize,
-        /// Whether the cursor is at the beginning of a line.
-        line_begin: bool,
-        /// Current line number.
+        /// Offset up to which newlines have been counted into `lineno`.
+        line_cursor: usize,
+        /// Line number at `line_cursor`.
         lineno: i32,
-        /// Current source context.
-        ctx_id: ContextId,
         /// Source collection for context tracking.
         pub(crate) ctx_map: ContextMapping<'a>,
+        buffers: Buffers,
+        /// Whether the vectors of groups come from `buffers`, see [`Lexer::with_buffers`].
+        pooled: bool,
+        /// Whether whitespace stops at newlines, see [`Lexer::stop_at_newlines`].
+        lines: bool,
+        /// Identifier tokens lexed so far, with their start, see [`Lexer::with_occurrences`].
+        occurrences: Option<Vec<(Symbol, u32)>>,
+        /// Runs of trivia skipped so far, see [`Lexer::with_trivia`].
+        trivia: Option<Vec<(u32, u32)>>,
+        /// Doc comments skipped so far, with the start of the token after
+        /// them, see [`Lexer::with_doc_comments`].
+        doc_comments: Option<Vec<((u32, u32), u32)>>,
+    }
+
+    /// Buffers a lexer reuses while lexing, kept between sources by a
+    /// [`TokenPool`](super::TokenPool).
+    #[derive(Default)]
+    pub struct Buffers {
+        /// Tokens of the groups being lexed, innermost group last.
+        scratch: Vec<Spanned<BalancedToken>>,
+        /// Bracketed groups being lexed, innermost group last.
+        groups: Vec<Group>,
+        pub vectors: FreeList<Vec<Spanned<BalancedToken>>>,
+        pub literals: FreeList<Vec<StringLiteral>>,
+        pub strings: FreeList<String>,
+        /// Unshared pointers to empty groups and string literals, whose
+        /// allocations are reused for the next ones.
+        pub shared_groups: Vec<Arc<BalancedTokenSequence>>,
+        pub shared_literals: Vec<Arc<StringLiterals>>,
+    }
+
+    /// A bracketed group whose closing bracket is not lexed yet.
+    pub struct Group {
+        pub start: usize,
+        pub close: char,
+        pub make_token: fn(Arc<BalancedTokenSequence>) -> BalancedToken,
+        pub mark: usize,
+    }
+
+    /// A growable buffer that can be emptied and reused.
+    pub trait Reusable {
+        fn with_capacity(capacity: usize) -> Self;
+        fn capacity(&self) -> usize;
+        fn clear(&mut self);
+    }
+
+    impl<T> Reusable for Vec<T> {
+        fn with_capacity(capacity: usize) -> Self {
+            Vec::with_capacity(capacity)
+        }
+
+        fn capacity(&self) -> usize {
+            self.capacity()
+        }
+
+        fn clear(&mut self) {
+            self.clear();
+        }
+    }
+
+    impl Reusable for String {
+        fn with_capacity(capacity: usize) -> Self {
+            String::with_capacity(capacity)
+        }
+
+        fn capacity(&self) -> usize {
+            self.capacity()
+        }
+
+        fn clear(&mut self) {
+            self.clear();
+        }
+    }
+
+    /// Empty buffers, in size classes: class `k` holds buffers with a
+    /// capacity of at least `2^k`.
+    pub struct FreeList<B> {
+        classes: Vec<Vec<B>>,
+    }
+
+    impl<B> Default for FreeList<B> {
+        fn default() -> Self {
+            Self { classes: Vec::new() }
+        }
+    }
+
+    impl<B: Reusable> FreeList<B> {
+        pub fn len(&self) -> usize {
+            self.classes.iter().map(Vec::len).sum()
+        }
+
+        /// An empty buffer with a capacity of at least `len`. New buffers are
+        /// rounded up to a power of two, so that they can be taken again for
+        /// any length up to their capacity.
+        pub fn take(&mut self, len: usize) -> B {
+            if len == 0 {
+                return B::with_capacity(0);
+            }
+            let capacity = len.next_power_of_two();
+            let class = capacity.trailing_zeros() as usize;
+            let reused = self.classes.iter_mut().skip(class).find_map(Vec::pop);
+            reused.unwrap_or_else(|| B::with_capacity(capacity))
+        }
+
+        pub fn put(&mut self, mut buffer: B) {
+            if buffer.capacity() == 0 {
+                return;
+            }
+            buffer.clear();
+            let class = buffer.capacity().ilog2() as usize;
+            if self.classes.len() <= class {
+                self.classes.resize_with(class + 1, Vec::new);
+            }
+            self.classes[class].push(buffer);
+        }
     }
 
     #[derive(Clone, Copy)]
     pub struct LexerCheckpoint {
         cursor: usize,
-        line_begin: bool,
+        line_cursor: usize,
         lineno: i32,
-        ctx_id: ContextId,
+        ctx_starts: usize,
+        trivia: usize,
+        doc_comments: usize,
     }
 
     impl<'a> Lexer<'a> {
         pub fn new(string: &'a str, filename: Option<&str>) -> Self {
             let mut ctx_map = ContextMapping::new(string);
+            if let Some(filename) = filename {
+                let filename = ctx_map.intern_filename(filename);
+                ctx_map.start_context(0, SourceContext { filename, line_offset: 0 });
+            }
             Self {
                 string,
                 cursor: 0,
-                line_begin: true,
+                line_cursor: 0,
+                lineno: 1,
+                ctx_map,
+                buffers: Buffers::default(),
+                pooled: false,
+                lines: false,
+                occurrences: None,
+                trivia: None,
+                doc_comments: None,
+            }
+        }
+
+        /// Resume lexing at `cursor`.
+        pub fn resume(string: &'a str, cursor: usize, ctx_map: ContextMapping<'a>) -> Self {
+            Self {
+                string,
+                cursor,
+                line_cursor: 0,
                 lineno: 1,
-                ctx_id: filename.map_or(ContextId::none(), |filename| {
-                    ctx_map.insert_context(SourceContext {
-                        filename: filename.into(),
-                        line_offset: 0,
-                    })
-                }),
                 ctx_map,
+                buffers: Buffers::default(),
+                pooled: false,
+                lines: false,
+                occurrences: None,
+                trivia: None,
+                doc_comments: None,
             }
         }
 
+        /// Lex with `buffers`, collecting the tokens of groups into vectors
+        /// from its free vectors instead of vectors of exactly their size.
+        pub fn with_buffers(mut self, buffers: Buffers) -> Self {
+            self.buffers = buffers;
+            self.pooled = true;
+            self
+        }
+
+        /// Record the identifier tokens lexed, to take with [`Lexer::take_occurrences`].
+        pub fn with_occurrences(mut self) -> Self {
+            self.occurrences = Some(Vec::new());
+            self
+        }
+
+        pub fn take_occurrences(&mut self) -> Vec<(Symbol, u32)> {
+            self.occurrences.take().unwrap_or_default()
+        }
+
+        /// Record an identifier token starting at `start`, when recording.
+        pub fn record_occurrence(&mut self, name: Symbol, start: usize) {
+            // Keywords that are never identifiers are left out
+            if let Some(occurrences) = &mut self.occurrences
+                && !name.is_reserved()
+            {
+                occurrences.push((name, start as u32));
+            }
+        }
+
+        /// Record the runs of trivia skipped, to take with [`Lexer::take_trivia`].
+        pub fn with_trivia(mut self) -> Self {
+            self.trivia = Some(Vec::new());
+            self
+        }
+
+        pub fn take_trivia(&mut self) -> Vec<(u32, u32)> {
+            self.trivia.take().unwrap_or_default()
+        }
+
+        /// Record a run of trivia from `start` to the cursor, when recording.
+        pub fn record_trivia(&mut self, start: usize) {
+            if let Some(trivia) = &mut self.trivia
+                && self.cursor > start
+            {
+                trivia.push((start as u32, self.cursor as u32));
+            }
+        }
+
+        /// Record the doc comments skipped, to take with [`Lexer::take_doc_comments`].
+        pub fn with_doc_comments(mut self) -> Self {
+            self.doc_comments = Some(Vec::new());
+            self
+        }
+
+        pub fn records_doc_comments(&self) -> bool {
+            self.doc_comments.is_some()
+        }
+
+        pub fn take_doc_comments(&mut self) -> Vec<((u32, u32), u32)> {
+            self.doc_comments.take().unwrap_or_default()
+        }
+
+        /// Record `comment` as the doc comment of the token at the cursor,
+        /// when recording.
+        pub fn record_doc_comment(&mut self, comment: Range<usize>) {
+            if let Some(doc_comments) = &mut self.doc_comments {
+                doc_comments.push(((comment.start as u32, comment.end as u32), self.cursor as u32));
+            }
+        }
+
+        pub fn take_buffers(&mut self) -> Buffers {
+            std::mem::take(&mut self.buffers)
+        }
+
+        /// Take the stack of bracketed groups, to give back with [`Lexer::put_groups`].
+        pub fn take_groups(&mut self) -> Vec<Group> {
+            std::mem::take(&mut self.buffers.groups)
+        }
+
+        pub fn put_groups(&mut self, groups: Vec<Group>) {
+            self.buffers.groups = groups;
+        }
+
+        /// Stop skipping whitespace at newlines, and lex the `#` of directives
+        /// as a punctuator, so that the tokens of each line can be told apart.
+        pub fn stop_at_newlines(&mut self) {
+            self.lines = true;
+        }
+
+        pub fn stops_at_newlines(&self) -> bool {
+            self.lines
+        }
+
         pub fn checkpoint(&self) -> LexerCheckpoint {
             LexerCheckpoint {
                 cursor: self.cursor,
-                line_begin: self.line_begin,
+                line_cursor: self.line_cursor,
                 lineno: self.lineno,
-                ctx_id: self.ctx_id,
+                ctx_starts: self.ctx_map.starts_len(),
+                trivia: self.trivia.as_ref().map_or(0, Vec::len),
+                doc_comments: self.doc_comments.as_ref().map_or(0, Vec::len),
             }
         }
 
         pub fn restore(&mut self, checkpoint: LexerCheckpoint) {
             self.cursor = checkpoint.cursor;
-            self.line_begin = checkpoint.line_begin;
+            self.line_cursor = checkpoint.line_cursor;
             self.lineno = checkpoint.lineno;
-            self.ctx_id = checkpoint.ctx_id;
+            self.ctx_map.truncate_starts(checkpoint.ctx_starts);
+            if let Some(trivia) = &mut self.trivia {
+                trivia.truncate(checkpoint.trivia);
+            }
+            if let Some(doc_comments) = &mut self.doc_comments {
+                doc_comments.truncate(checkpoint.doc_comments);
+            }
+        }
+
+        pub fn remaining(&self) -> &'a str {
+            &self.string[self.cursor..]
+        }
+
+        pub fn is_eof(&self) -> bool {
+            self.cursor >= self.string.len()
+        }
+
+        pub fn cursor(&self) -> usize {
+            self.cursor
+        }
+
+        /// Move the cursor forward to `cursor`, skipping the text before it.
+        pub fn seek(&mut self, cursor: usize) {
+            debug_assert!(cursor >= self.cursor);
+            self.cursor = cursor;
+        }
+
+        /// Whether only whitespace precedes the cursor on the current line.
+        pub fn line_begin(&self) -> bool {
+            let consumed = &self.string[..self.cursor];
+            let line_start = memchr::memrchr(b'\n', consumed.as_bytes()).map_or(0, |i| i + 1);
+            consumed[line_start..].chars().all(char::is_whitespace)
+        }
+
+        /// Current line number, counting newlines consumed since the last call.
+        pub fn lineno(&mut self) -> i32 {
+            let pending = &self.string.as_bytes()[self.line_cursor..self.cursor];
+            self.lineno += memchr::memchr_iter(b'\n', pending).count() as i32;
+            self.line_cursor = self.cursor;
+            self.lineno
+        }
+
+        pub fn set_context(&mut self, context: SourceContext) {
+            self.ctx_map.start_context(self.cursor, context);
+        }
+
+        pub fn peek(&self) -> Option<char> {
+            self.remaining().chars().next()
+        }
+
+        /// The next byte, for dispatching on ASCII characters without
+        /// decoding a `char`.
+        pub fn peek_byte(&self) -> Option<u8> {
+            self.string.as_bytes().get(self.cursor).copied()
+        }
+
+        pub fn eat(&mut self) -> Option<char> {
+            let ch = self.peek()?;
+            self.cursor += ch.len_utf8();
+            Some(ch)
+        }
+
+        pub fn eat_if(&mut self, pat: impl Pattern) -> Option<&'a str> {
+            let remaining = self.remaining();
+            let len = pat.matches(remaining)?;
+            self.cursor += len;
+            Some(&remaining[..len])
+        }
+
+        /// Start collecting the tokens of a group, returning its mark.
+        pub fn begin_group(&self) -> usize {
+            self.buffers.scratch.len()
         }
 
-        fn on_token(&mut self, ch: char) {
-            if ch == '\n' {
-                self.line_begin = true;
-                self.lineno += 1;
-            } else if self.line_begin && !ch.is_whitespace() {
-                self.line_begin = false;
+        pub fn push_token(&mut self, token: Spanned<BalancedToken>) {
+            self.buffers.scratch.push(token);
+        }
+
+        /// Take the tokens pushed since `mark`, in a vector of exactly their
+        /// size, or in a free vector when lexing with buffers.
+        ///
+        /// Nested groups share one scratch stack, so each group costs a single
+        /// allocation instead of one per growth of its vector.
+        pub fn end_group(&mut self, mark: usize) -> Vec<Spanned<BalancedToken>> {
+            let tokens = self.buffers.scratch.drain(mark..);
+            if !self.pooled {
+                return tokens.collect();
             }
+            let mut vector = self.buffers.vectors.take(tokens.len());
+            vector.extend(tokens);
+            vector
         }
 
-        pub fn remaining(&self) -> &'a str {
-            &self.string[self.cursor..]
+        /// An empty string with a capacity of at least `len`, or of exactly
+        /// `len` unless lexing with buffers.
+        pub fn take_string(&mut self, len: usize) -> String {
+            match self.pooled {
+                true => self.buffers.strings.take(len),
+                false => String::with_capacity(len),
+            }
         }
 
-        pub fn is_eof(&self) -> bool {
-            self.cursor >= self.string.len()
+        /// `group` in a shared pointer, reusing a free one when lexing with
+        /// buffers.
+        pub fn share_group(&mut self, group: BalancedTokenSequence) -> Arc<BalancedTokenSequence> {
+            share(self.pooled.then_some(&mut self.buffers.shared_groups), group)
         }
 
-        pub fn cursor(&self) -> usize {
-            self.cursor
+        /// `literals` in a shared pointer, reusing a free one when lexing with
+        /// buffers.
+        pub fn share_literals(&mut self, literals: StringLiterals) -> Arc<StringLiterals> {
+            share(self.pooled.then_some(&mut self.buffers.shared_literals), literals)
         }
 
-        pub fn line_begin(&self) -> bool {
-            self.line_begin
+        /// An empty vector for the string literals of a token.
+        pub fn take_literals(&mut self) -> Vec<StringLiteral> {
+            match self.pooled {
+                true => self.buffers.literals.take(1),
+                false => Vec::new(),
+            }
         }
 
-        pub fn lineno(&self) -> i32 {
-            self.lineno
+        pub fn make_span(&self, start: usize) -> Span {
+            Span::new(start..self.cursor)
         }
+    }
 
-        pub fn ctx_id(&self) -> ContextId {
-            self.ctx_id
+    /// `value` in a pointer from `free`, if there is one, or in a new one.
+    fn share<T>(free: Option<&mut Vec<Arc<T>>>, value: T) -> Arc<T> {
+        match free.and_then(Vec::pop) {
+            Some(mut shared) => {
+                *Arc::get_mut(&mut shared).expect("Free pointers are not shared") = value;
+                shared
+            }
+            None => Arc::new(value),
         }
+    }
+}
 
-        pub fn set_context(&mut self, context: SourceContext) {
-            self.ctx_id = self.ctx_map.insert_context(context);
+use lexer_core::{Buffers, Dfa, Group, Lexer, Scan};
+
+/// The regexes of the lexer, compiled to DFAs at build time.
+mod dfa {
+    use super::Dfa;
+
+    macro_rules! patterns {
+        ($( $( #[$attrs:meta] )* $name:ident = $pattern:literal; )*) => {$(
+            $( #[$attrs] )*
+            pub static $name: Dfa = Dfa::new(include_bytes!(concat!(env!("OUT_DIR"), "/", stringify!($name), ".dfa")));
+        )*};
+    }
+
+    include!("lexer_patterns.rs");
+}
+
+/// ASCII byte classification, used to dispatch on the first byte of a token.
+mod ascii {
+    pub const IDENT_START: u8 = 1 << 0;
+    pub const IDENT_CONTINUE: u8 = 1 << 1;
+    pub const PUNCT: u8 = 1 << 2;
+    pub const WHITESPACE: u8 = 1 << 3;
+
+    /// First bytes of punctuators, excluding the bracket characters.
+    const PUNCTUATORS: &[u8] = b".&*+-~!/%<>^|?:;=,#";
+
+    const fn build() -> [u8; 256] {
+        let mut table = [0; 256];
+        let mut b = 0;
+        while b < 128 {
+            let ch = b as u8;
+            if ch.is_ascii_alphabetic() || ch == b'_' {
+                table[b] |= IDENT_START | IDENT_CONTINUE;
+            }
+            if ch.is_ascii_digit() {
+                table[b] |= IDENT_CONTINUE;
+            }
+            // Matches `char::is_whitespace` on ASCII, including vertical tab
+            if ch.is_ascii_whitespace() || ch == 0x0b {
+                table[b] |= WHITESPACE;
+            }
+            b += 1;
+        }
+        let mut i = 0;
+        while i < PUNCTUATORS.len() {
+            table[PUNCTUATORS[i] as usize] |= PUNCT;
+            i += 1;
         }
+        table
+    }
 
-        pub fn peek(&self) -> Option<char> {
-            self.remaining().chars().next()
+    static CLASS: [u8; 256] = build();
+
+    /// Check whether a byte belongs to the given class.
+    #[inline]
+    pub fn is(byte: u8, class: u8) -> bool {
+        CLASS[byte as usize] & class != 0
+    }
+
+    /// Bytes of an identifier checked at once by [`identifier`].
+    const BLOCK: usize = 16;
+
+    /// Check whether a byte continues an ASCII identifier, without branches
+    /// or table lookups, so that the check of a block vectorizes.
+    #[inline]
+    fn is_ident_continue(b: u8) -> bool {
+        let lower = b | 0x20;
+        (lower >= b'a') & (lower <= b'z') | (b >= b'0') & (b <= b'9') | (b == b'_')
+    }
+
+    /// Length of the ASCII identifier at the start of `string`.
+    ///
+    /// Long identifiers are skipped a block of bytes at a time, and the rest
+    /// byte by byte. Returns `None` if the identifier continues with a
+    /// non-ASCII character, which is left to the Unicode-aware regex.
+    pub fn identifier(string: &str) -> Option<usize> {
+        let bytes = string.as_bytes();
+        if !is(*bytes.first()?, IDENT_START) {
+            return None;
         }
+        let mut len = 1;
+        while let Some(block) = bytes.get(len..len + BLOCK)
+            && block.iter().fold(true, |all, &b| all & is_ident_continue(b))
+        {
+            len += BLOCK;
+        }
+        len += bytes[len..]
+            .iter()
+            .position(|&b| !is(b, IDENT_CONTINUE))
+            .unwrap_or(bytes.len() - len);
+        bytes.get(len).is_none_or(|b| b.is_ascii()).then_some(len)
+    }
 
-        pub fn eat(&mut self) -> Option<char> {
-            let ch = self.peek()?;
-            self.cursor += ch.len_utf8();
-            self.on_token(ch);
-            Some(ch)
+    /// Length of the whitespace run at the start of `string`.
+    ///
+    /// ASCII whitespace is skipped through the class table; non-ASCII
+    /// characters are decoded only when one is encountered.
+    pub fn whitespace(string: &str) -> Option<usize> {
+        let bytes = string.as_bytes();
+        let mut len = 0;
+        loop {
+            len += bytes[len..]
+                .iter()
+                .position(|&b| !is(b, WHITESPACE))
+                .unwrap_or(bytes.len() - len);
+            match string[len..].chars().next() {
+                Some(ch) if !ch.is_ascii() && ch.is_whitespace() => len += ch.len_utf8(),
+                _ => break,
+            }
         }
+        (len > 0).then_some(len)
+    }
 
-        pub fn eat_if(&mut self, pat: impl Pattern) -> Option<&'a str> {
-            let remaining = self.remaining();
-            let len = pat.matches(remaining)?;
-            let matched = &remaining[..len];
-            // Update line tracking for each character
-            for ch in matched.chars() {
-                self.on_token(ch);
+    /// Length of the whitespace run at the start of `string` that does not
+    /// end a line, including newlines escaped by a backslash.
+    pub fn line_whitespace(string: &str) -> Option<usize> {
+        let bytes = string.as_bytes();
+        let mut len = 0;
+        loop {
+            match bytes.get(len..) {
+                Some([b' ' | b'\t' | b'\r' | 0x0b | 0x0c, ..]) => len += 1,
+                Some([b'\\', b'\n', ..]) => len += 2,
+                Some([b'\\', b'\r', b'\n', ..]) => len += 3,
+                _ => break,
             }
-            self.cursor += len;
-            Some(matched)
         }
+        (len > 0).then_some(len)
+    }
+}
 
-        pub fn make_span(&self, start: usize) -> Span {
-            Span::new(start..self.cursor, self.ctx_id)
+/// Decode the escape sequences of the body of a string literal, see
+/// [`StringLiteral::unescape`].
+pub(crate) fn unescape(body: &str) -> Cow<'_, str> {
+    if memchr::memchr(b'\\', body.as_bytes()).is_none() {
+        return Cow::Borrowed(body);
+    }
+    let mut value = String::new();
+    unescape_into(body, &mut value);
+    Cow::Owned(value)
+}
+
+/// Append `body` to `value`, decoding its escape sequences.
+fn unescape_into(body: &str, value: &mut String) {
+    let Some(first) = memchr::memchr(b'\\', body.as_bytes()) else {
+        value.push_str(body);
+        return;
+    };
+    // Characters are never longer than their escape sequences
+    value.reserve(body.len());
+    value.push_str(&body[..first]);
+    let mut lexer = Lexer::resume(body, first, ContextMapping::new(body));
+    while !lexer.is_eof() {
+        if let Some(ch) = lexer.escape_sequence() {
+            value.push(ch);
+        }
+        let run = memchr::memchr(b'\\', lexer.remaining().as_bytes()).unwrap_or(lexer.remaining().len());
+        value.push_str(&lexer.remaining()[..run]);
+        lexer.seek(lexer.cursor() + run);
+    }
+}
+
+/// Whether `comment` is a doc comment, `/** ... */` or `/// ...`, but not a
+/// line of asterisks or slashes.
+fn is_doc_comment(comment: &str) -> bool {
+    match comment.as_bytes() {
+        [b'/', b'*', b'*', rest @ ..] => !rest.starts_with(b"*") && !rest.starts_with(b"/"),
+        [b'/', b'/', b'/', rest @ ..] => !rest.starts_with(b"/"),
+        _ => false,
+    }
+}
+
+/// Value of the integer constant `text`, whose digits in `radix` start at
+/// `start`, skipping `'` digit separators. A value wider than a `u64` keeps
+/// the text.
+///
+/// The digits are accumulated as they are read, without copying them.
+fn digits_value(text: &str, start: usize, radix: u32) -> IntegerValue {
+    let mut value: u64 = 0;
+    for byte in text[start..].bytes().filter(|&byte| byte != b'\'') {
+        let digit = (byte as char).to_digit(radix).expect("Digits are matched by the lexer");
+        match value
+            .checked_mul(radix.into())
+            .and_then(|value| value.checked_add(digit.into()))
+        {
+            Some(next) => value = next,
+            None => return IntegerValue::Wide(text.into()),
         }
     }
+    IntegerValue::Narrow(value)
 }
 
-use lexer_core::Lexer;
+/// Parse `text` with `parse`, after removing `'` digit separators.
+///
+/// Text without separators is parsed in place, and short text with them is
+/// copied to the stack, so only unusually long constants allocate.
+fn without_separators<T>(text: &str, parse: impl FnOnce(&str) -> Option<T>) -> Option<T> {
+    if memchr::memchr(b'\'', text.as_bytes()).is_none() {
+        return parse(text);
+    }
+    let mut buf = [0; 64];
+    if text.len() > buf.len() {
+        return parse(&text.replace('\'', ""));
+    }
+    let mut len = 0;
+    for byte in text.bytes().filter(|&byte| byte != b'\'') {
+        buf[len] = byte;
+        len += 1;
+    }
+    // Constants are ASCII
+    parse(std::str::from_utf8(&buf[..len]).ok()?)
+}
 
 impl<'a> Lexer<'a> {
     /// (6.4.2.1) identifier
     fn identifier(&mut self) -> Option<Identifier> {
-        // C identifiers can start with underscore or XID_Start, followed by
-        // XID_Continue
-        let ident = self.eat_if(re!(r"[_\p{XID_Start}]\p{XID_Continue}*"))?;
+        let ident = self.identifier_text()?;
         Some(Identifier(ident.into()))
     }
 
+    /// The text of an identifier, not interned.
+    fn identifier_text(&mut self) -> Option<&'a str> {
+        // C identifiers can start with underscore or XID_Start, followed by
+        // XID_Continue. Pure ASCII identifiers are scanned without the regex.
+        match self.eat_if(Scan(ascii::identifier)) {
+            Some(ident) => Some(ident),
+            None => self.eat_if(&dfa::IDENTIFIER),
+        }
+    }
+
     /// (6.4.4.1) integer constant
     fn integer_constant(&mut self) -> Option<IntegerConstant> {
         // Order matters: hexadecimal and binary must come before octal
@@ -193,49 +1542,45 @@ impl<'a> Lexer<'a> {
     }
 
     /// (6.4.4.1) decimal constant
-    fn decimal_constant(&mut self) -> Option<i128> {
-        let value = self.eat_if(re!(r"[1-9](?:'?[0-9])*"))?;
-        let value = value.replace("'", "").parse().unwrap_or(i128::MAX);
-        Some(value)
+    fn decimal_constant(&mut self) -> Option<IntegerValue> {
+        let value = self.eat_if(&dfa::DECIMAL_CONSTANT)?;
+        Some(digits_value(value, 0, 10))
     }
 
     /// (6.4.4.1) octal constant
-    fn octal_constant(&mut self) -> Option<i128> {
+    fn octal_constant(&mut self) -> Option<IntegerValue> {
         // Try 0o/0O prefix first, then traditional octal (0 followed by octal digits)
-        if let Some(value) = self.eat_if(re!(r"0[oO][0-7](?:'?[0-7])*")) {
-            let digits = &value[2..];
-            return Some(i128::from_str_radix(&digits.replace("'", ""), 8).unwrap_or(i128::MAX));
+        if let Some(value) = self.eat_if(&dfa::OCTAL_PREFIXED_CONSTANT) {
+            return Some(digits_value(value, 2, 8));
         }
-        if let Some(value) = self.eat_if(re!(r"0(?:'?[0-7])*")) {
-            return Some(i128::from_str_radix(&value.replace("'", ""), 8).unwrap_or(i128::MAX));
+        if let Some(value) = self.eat_if(&dfa::OCTAL_CONSTANT) {
+            return Some(digits_value(value, 0, 8));
         }
         None
     }
 
     /// (6.4.4.1) hexadecimal constant
-    fn hexadecimal_constant(&mut self) -> Option<i128> {
-        let value = self.eat_if(re!(r"0[xX][0-9a-fA-F](?:'?[0-9a-fA-F])*"))?;
-        let value = i128::from_str_radix(&value[2..].replace("'", ""), 16).unwrap_or(i128::MAX);
-        Some(value)
+    fn hexadecimal_constant(&mut self) -> Option<IntegerValue> {
+        let value = self.eat_if(&dfa::HEXADECIMAL_CONSTANT)?;
+        Some(digits_value(value, 2, 16))
     }
 
     /// (6.4.4.1) binary constant
-    fn binary_constant(&mut self) -> Option<i128> {
-        let value = self.eat_if(re!(r"0[bB][01](?:'?[01])*"))?;
-        let value = i128::from_str_radix(&value[2..].replace("'", ""), 2).unwrap_or(i128::MAX);
-        Some(value)
+    fn binary_constant(&mut self) -> Option<IntegerValue> {
+        let value = self.eat_if(&dfa::BINARY_CONSTANT)?;
+        Some(digits_value(value, 2, 2))
     }
 
     /// (6.4.4.1) integer suffix
     fn integer_suffix(&mut self) -> Option<IntegerSuffix> {
         [
-            (re!(r"(u|U)(ll|LL)|(ll|LL)(u|U)"), IntegerSuffix::UnsignedLongLong),
-            (re!(r"(u|U)(l|L)|(l|L)(u|U)"), IntegerSuffix::UnsignedLong),
-            (re!(r"(u|U)(wb|WB)|(wb|WB)(u|U)"), IntegerSuffix::UnsignedBitPrecise),
-            (re!(r"u|U"), IntegerSuffix::Unsigned),
-            (re!(r"ll|LL"), IntegerSuffix::LongLong),
-            (re!(r"l|L"), IntegerSuffix::Long),
-            (re!(r"wb|WB"), IntegerSuffix::BitPrecise),
+            (&dfa::UNSIGNED_LONG_LONG_SUFFIX, IntegerSuffix::UnsignedLongLong),
+            (&dfa::UNSIGNED_LONG_SUFFIX, IntegerSuffix::UnsignedLong),
+            (&dfa::UNSIGNED_BIT_PRECISE_SUFFIX, IntegerSuffix::UnsignedBitPrecise),
+            (&dfa::UNSIGNED_SUFFIX, IntegerSuffix::Unsigned),
+            (&dfa::LONG_LONG_SUFFIX, IntegerSuffix::LongLong),
+            (&dfa::LONG_SUFFIX, IntegerSuffix::Long),
+            (&dfa::BIT_PRECISE_SUFFIX, IntegerSuffix::BitPrecise),
         ]
         .into_iter()
         .find_map(|(pattern, suffix)| self.eat_if(pattern).map(|_| suffix))
@@ -254,26 +1599,26 @@ impl<'a> Lexer<'a> {
 
     /// (6.4.4.2) decimal floating constant
     fn decimal_floating_constant(&mut self) -> Option<NotNan<f64>> {
-        let value = self.eat_if(re!(r"(?:(?:\d+(?:'?\d+)*)?\.(?:\d+(?:'?\d+)*)|(?:\d+(?:'?\d+)*)\.)(?:[eE][+-]?(?:\d+(?:'?\d+)*))?|(?:\d+(?:'?\d+)*)(?:[eE][+-]?(?:\d+(?:'?\d+)*))"))?;
-        let parsed: f64 = value.replace("'", "").parse().ok()?;
+        let value = self.eat_if(&dfa::DECIMAL_FLOATING_CONSTANT)?;
+        let parsed = without_separators(value, |value| value.parse().ok())?;
         NotNan::new(parsed).ok()
     }
 
     /// (6.4.4.2) hexadecimal floating constant
     fn hexadecimal_floating_constant(&mut self) -> Option<NotNan<f64>> {
-        let value = self.eat_if(re!(r"(?:0[xX])(?:(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)?\.(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)|(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)\.?)(?:[pP][+-]?(?:\d+(?:'?\d+)*))"))?;
-        let parsed = hexf_parse::parse_hexf64(&value.replace("'", ""), false).ok()?;
+        let value = self.eat_if(&dfa::HEXADECIMAL_FLOATING_CONSTANT)?;
+        let parsed = without_separators(value, |value| hexf_parse::parse_hexf64(value, false).ok())?;
         NotNan::new(parsed).ok()
     }
 
     /// (6.4.4.2) floating suffix
     fn floating_suffix(&mut self) -> Option<FloatingSuffix> {
         [
-            (re!(r"df|DF"), FloatingSuffix::DF),
-            (re!(r"dd|DD"), FloatingSuffix::DD),
-            (re!(r"dl|DL"), FloatingSuffix::DL),
-            (re!(r"f|F"), FloatingSuffix::F),
-            (re!(r"l|L"), FloatingSuffix::L),
+            (&dfa::DF_SUFFIX, FloatingSuffix::DF),
+            (&dfa::DD_SUFFIX, FloatingSuffix::DD),
+            (&dfa::DL_SUFFIX, FloatingSuffix::DL),
+            (&dfa::F_SUFFIX, FloatingSuffix::F),
+            (&dfa::L_SUFFIX, FloatingSuffix::L),
         ]
         .into_iter()
         .find_map(|(pattern, suffix)| self.eat_if(pattern).map(|_| suffix))
@@ -318,25 +1663,25 @@ impl<'a> Lexer<'a> {
             }
             // Octal escape sequence (\ooo)
             '0'..='7' => {
-                let digits = self.eat_if(re!(r"[0-7]{1,3}"))?;
+                let digits = self.eat_if(&dfa::OCTAL_ESCAPE)?;
                 char::from_u32(u32::from_str_radix(digits, 8).ok()?)
             }
             // Hexadecimal escape sequence (\xhh)
             'x' => {
                 self.eat();
-                let digits = self.eat_if(re!(r"[0-9a-fA-F]+"))?;
+                let digits = self.eat_if(&dfa::HEXADECIMAL_ESCAPE)?;
                 char::from_u32(u32::from_str_radix(digits, 16).ok()?)
             }
             // Universal character names (\uxxxx)
             'u' => {
                 self.eat();
-                let digits = self.eat_if(re!(r"[0-9a-fA-F]{4}"))?;
+                let digits = self.eat_if(&dfa::UCN_SHORT)?;
                 char::from_u32(u32::from_str_radix(digits, 16).ok()?)
             }
             // Universal character names (\Uxxxxxxxx)
             'U' => {
                 self.eat();
-                let digits = self.eat_if(re!(r"[0-9a-fA-F]{8}"))?;
+                let digits = self.eat_if(&dfa::UCN_LONG)?;
                 char::from_u32(u32::from_str_radix(digits, 16).ok()?)
             }
             // Fallback: just return the character itself
@@ -355,74 +1700,62 @@ impl<'a> Lexer<'a> {
         }
 
         let mut value = String::new();
+        self.quoted_body_into(b'\'', &mut value);
+        Some(CharacterConstant { encoding_prefix, value })
+    }
+
+    /// Append the body of a string literal or character constant, up to its
+    /// closing `quote`, to `value`, decoding its escape sequences, and eat the
+    /// quote. A newline or the end of input ends the body early, leaving the
+    /// literal unclosed.
+    ///
+    /// The runs between escape sequences are found with `memchr3` and copied
+    /// at once, so only backslashes go through [`Lexer::escape_sequence`].
+    fn quoted_body_into(&mut self, quote: u8, value: &mut String) {
         loop {
-            match self.peek() {
-                Some('\'') => {
-                    self.eat();
-                    break;
-                }
-                Some('\\') => {
+            let remaining = self.remaining();
+            let Some(next) = memchr::memchr3(quote, b'\\', b'\n', remaining.as_bytes()) else {
+                value.push_str(remaining);
+                self.seek(self.cursor() + remaining.len());
+                return;
+            };
+            value.push_str(&remaining[..next]);
+            self.seek(self.cursor() + next);
+            match remaining.as_bytes()[next] {
+                b'\\' => {
                     if let Some(ch) = self.escape_sequence() {
                         value.push(ch);
                     }
                 }
-                Some(ch) if ch != '\n' => {
-                    value.push(ch);
+                b'\n' => return,
+                _ => {
                     self.eat();
+                    return;
                 }
-                _ => break, // EOF or newline - unclosed character constant
             }
         }
-
-        Some(CharacterConstant { encoding_prefix, value })
     }
 
     /// (6.4.4.5) predefined constant
-    fn predefined_constant(&mut self) -> Option<PredefinedConstant> {
-        [
-            ("false", PredefinedConstant::False),
-            ("true", PredefinedConstant::True),
-            ("nullptr", PredefinedConstant::Nullptr),
-        ]
-        .into_iter()
-        .find_map(|(keyword, constant)| {
-            let ckpt = self.checkpoint();
-            if self.eat_if(keyword).is_some() {
-                if self.peek().is_none_or(|c| !c.is_alphanumeric() && c != '_') {
-                    Some(constant)
-                } else {
-                    // Revert if followed by more identifier characters
-                    self.restore(ckpt);
-                    None
-                }
-            } else {
-                None
-            }
-        })
+    fn predefined_constant(name: &str) -> Option<PredefinedConstant> {
+        match name {
+            "false" => Some(PredefinedConstant::False),
+            "true" => Some(PredefinedConstant::True),
+            "nullptr" => Some(PredefinedConstant::Nullptr),
+            _ => None,
+        }
     }
 
-    /// (6.4.4) constant
-    fn constant(&mut self) -> Option<Constant> {
+    /// (6.4.4) constant, starting with a digit or `.`
+    fn numeric_constant(&mut self) -> Option<Constant> {
         let ckpt = self.checkpoint();
 
-        // Try predefined constant first
-        if let Some(pc) = self.predefined_constant() {
-            return Some(Constant::Predefined(pc));
-        }
-        self.restore(ckpt);
-
         // Try floating constant (must be before integer for proper parsing of "0.5")
         if let Some(fc) = self.floating_constant() {
             return Some(Constant::Floating(fc));
         }
         self.restore(ckpt);
 
-        // Try character constant
-        if let Some(cc) = self.character_constant() {
-            return Some(Constant::Character(cc));
-        }
-        self.restore(ckpt);
-
         // Try integer constant
         if let Some(ic) = self.integer_constant() {
             return Some(Constant::Integer(ic));
@@ -432,12 +1765,26 @@ impl<'a> Lexer<'a> {
         None
     }
 
-    /// (6.4.5) string-literal
-    fn string_literal(&mut self) -> Option<StringLiterals> {
-        let mut literals = Vec::new();
+    /// The quote following an encoding prefix (`u8`, `u`, `U` or `L`) at the
+    /// cursor, if the cursor is at a prefixed string literal or character
+    /// constant.
+    fn prefixed_quote(&self) -> Option<u8> {
+        let bytes = self.remaining().as_bytes();
+        let skip = if bytes.starts_with(b"u8") { 2 } else { 1 };
+        bytes.get(skip).copied().filter(|&b| b == b'"' || b == b'\'')
+    }
+
+    /// (6.4.5) string-literal, as a token
+    fn string_literal(&mut self) -> Option<BalancedToken> {
+        let mut literals = self.take_literals();
 
         loop {
             let ckpt = self.checkpoint();
+            // Skip whitespace between adjacent string literals, but not after
+            // the last one, which is not part of the token
+            if !literals.is_empty() {
+                self.skip_whitespace();
+            }
             let encoding_prefix = self.encoding_prefix();
 
             if self.eat_if('"').is_none() {
@@ -445,36 +1792,25 @@ impl<'a> Lexer<'a> {
                 break;
             }
 
-            let mut value = String::new();
-            loop {
-                match self.peek() {
-                    Some('"') => {
-                        self.eat();
-                        break;
-                    }
-                    Some('\\') => {
-                        if let Some(ch) = self.escape_sequence() {
-                            value.push(ch);
-                        }
-                    }
-                    Some(ch) if ch != '\n' => {
-                        value.push(ch);
-                        self.eat();
-                    }
-                    _ => break, // EOF or newline - unclosed string
-                }
-            }
+            // The run up to the first escape sequence sizes the value, so a
+            // body without escape sequences is copied once, into a string of
+            // its size, and a body with them is decoded in the same pass
+            let remaining = self.remaining();
+            let run = memchr::memchr3(b'"', b'\\', b'\n', remaining.as_bytes()).unwrap_or(remaining.len());
+            let mut value = self.take_string(run);
+            value.push_str(&remaining[..run]);
+            self.seek(self.cursor() + run);
+            self.quoted_body_into(b'"', &mut value);
 
             literals.push(StringLiteral { encoding_prefix, value });
-
-            // Skip whitespace between adjacent string literals
-            self.skip_whitespace();
         }
 
         if literals.is_empty() {
             None
         } else {
-            Some(StringLiterals(literals))
+            Some(BalancedToken::StringLiteral(
+                self.share_literals(StringLiterals(literals)),
+            ))
         }
     }
 
@@ -482,88 +1818,71 @@ impl<'a> Lexer<'a> {
     fn quoted_string(&mut self) -> Option<String> {
         self.eat_if('`')?;
 
-        let mut content = String::new();
-        loop {
-            match self.peek() {
-                Some('`') => {
-                    self.eat();
-                    break;
-                }
-                Some(ch) => {
-                    content.push(ch);
-                    self.eat();
-                }
-                None => break, // EOF - unclosed quoted string
-            }
-        }
+        // EOF - unclosed quoted string
+        let remaining = self.remaining();
+        let len = memchr::memchr(b'`', remaining.as_bytes()).unwrap_or(remaining.len());
+        self.seek(self.cursor() + len);
+        self.eat_if('`');
 
-        Some(content)
+        let mut text = self.take_string(len);
+        text.push_str(&remaining[..len]);
+        Some(text)
     }
 
     /// (6.4.6) punctuator (excluding parentheses and brackets)
     fn punctuator(&mut self) -> Option<Punctuator> {
-        // Helper macro to try patterns and return punctuator
-        macro_rules! try_punct {
-            ($($pat:expr => $variant:expr),* $(,)?) => {
-                $(
-                    if self.eat_if($pat).is_some() {
-                        return Some($variant);
-                    }
-                )*
-            };
-        }
-
-        // Put longer operators first to avoid partial matches
-        // Assignment and compound operators (3 chars)
-        try_punct! {
-            "<<=" => Punctuator::LeftShiftAssign,
-            ">>=" => Punctuator::RightShiftAssign,
-            "..." => Punctuator::Ellipsis,
-            // Compound operators (2 chars)
-            "*=" => Punctuator::MulAssign,
-            "/=" => Punctuator::DivAssign,
-            "%=" => Punctuator::ModAssign,
-            "+=" => Punctuator::AddAssign,
-            "-=" => Punctuator::SubAssign,
-            "&=" => Punctuator::AndAssign,
-            "^=" => Punctuator::XorAssign,
-            "|=" => Punctuator::OrAssign,
-            "##" => Punctuator::HashHash,
-            "++" => Punctuator::Increment,
-            "--" => Punctuator::Decrement,
-            "<<" => Punctuator::LeftShift,
-            ">>" => Punctuator::RightShift,
-            "<=" => Punctuator::LessEqual,
-            ">=" => Punctuator::GreaterEqual,
-            "==" => Punctuator::Equal,
-            "!=" => Punctuator::NotEqual,
-            "&&" => Punctuator::LogicalAnd,
-            "||" => Punctuator::LogicalOr,
-            "->" => Punctuator::Arrow,
-            "::" => Punctuator::Scope,
-            // Simple operators (1 char)
-            '.' => Punctuator::Dot,
-            '&' => Punctuator::Ampersand,
-            '*' => Punctuator::Star,
-            '+' => Punctuator::Plus,
-            '-' => Punctuator::Minus,
-            '~' => Punctuator::Tilde,
-            '!' => Punctuator::Bang,
-            '/' => Punctuator::Slash,
-            '%' => Punctuator::Percent,
-            '<' => Punctuator::Less,
-            '>' => Punctuator::Greater,
-            '^' => Punctuator::Caret,
-            '|' => Punctuator::Pipe,
-            '?' => Punctuator::Question,
-            ':' => Punctuator::Colon,
-            ';' => Punctuator::Semicolon,
-            '=' => Punctuator::Assign,
-            ',' => Punctuator::Comma,
-            '#' => Punctuator::Hash,
-        }
-
-        None
+        // Dispatch on the first byte, then take the longest punctuator the
+        // following bytes complete
+        let bytes = self.remaining().as_bytes();
+        let byte = |index: usize| bytes.get(index).copied().unwrap_or(0);
+        let (punctuator, len) = match (byte(0), byte(1)) {
+            (b'<', b'<') if byte(2) == b'=' => (Punctuator::LeftShiftAssign, 3),
+            (b'>', b'>') if byte(2) == b'=' => (Punctuator::RightShiftAssign, 3),
+            (b'.', b'.') if byte(2) == b'.' => (Punctuator::Ellipsis, 3),
+            (b'*', b'=') => (Punctuator::MulAssign, 2),
+            (b'/', b'=') => (Punctuator::DivAssign, 2),
+            (b'%', b'=') => (Punctuator::ModAssign, 2),
+            (b'+', b'=') => (Punctuator::AddAssign, 2),
+            (b'-', b'=') => (Punctuator::SubAssign, 2),
+            (b'&', b'=') => (Punctuator::AndAssign, 2),
+            (b'^', b'=') => (Punctuator::XorAssign, 2),
+            (b'|', b'=') => (Punctuator::OrAssign, 2),
+            (b'#', b'#') => (Punctuator::HashHash, 2),
+            (b'+', b'+') => (Punctuator::Increment, 2),
+            (b'-', b'-') => (Punctuator::Decrement, 2),
+            (b'<', b'<') => (Punctuator::LeftShift, 2),
+            (b'>', b'>') => (Punctuator::RightShift, 2),
+            (b'<', b'=') => (Punctuator::LessEqual, 2),
+            (b'>', b'=') => (Punctuator::GreaterEqual, 2),
+            (b'=', b'=') => (Punctuator::Equal, 2),
+            (b'!', b'=') => (Punctuator::NotEqual, 2),
+            (b'&', b'&') => (Punctuator::LogicalAnd, 2),
+            (b'|', b'|') => (Punctuator::LogicalOr, 2),
+            (b'-', b'>') => (Punctuator::Arrow, 2),
+            (b':', b':') => (Punctuator::Scope, 2),
+            (b'.', _) => (Punctuator::Dot, 1),
+            (b'&', _) => (Punctuator::Ampersand, 1),
+            (b'*', _) => (Punctuator::Star, 1),
+            (b'+', _) => (Punctuator::Plus, 1),
+            (b'-', _) => (Punctuator::Minus, 1),
+            (b'~', _) => (Punctuator::Tilde, 1),
+            (b'!', _) => (Punctuator::Bang, 1),
+            (b'/', _) => (Punctuator::Slash, 1),
+            (b'%', _) => (Punctuator::Percent, 1),
+            (b'<', _) => (Punctuator::Less, 1),
+            (b'>', _) => (Punctuator::Greater, 1),
+            (b'^', _) => (Punctuator::Caret, 1),
+            (b'|', _) => (Punctuator::Pipe, 1),
+            (b'?', _) => (Punctuator::Question, 1),
+            (b':', _) => (Punctuator::Colon, 1),
+            (b';', _) => (Punctuator::Semicolon, 1),
+            (b'=', _) => (Punctuator::Assign, 1),
+            (b',', _) => (Punctuator::Comma, 1),
+            (b'#', _) => (Punctuator::Hash, 1),
+            _ => return None,
+        };
+        self.seek(self.cursor() + len);
+        Some(punctuator)
     }
 
     /// quasi-quote template
@@ -577,12 +1896,9 @@ impl<'a> Lexer<'a> {
     /// Skip single-line comment
     fn skip_line_comment(&mut self) -> bool {
         if self.eat_if("//").is_some() {
-            while let Some(ch) = self.peek() {
-                if ch == '\n' {
-                    break;
-                }
-                self.eat();
-            }
+            self.eat_if(Scan(|s: &str| {
+                Some(memchr::memchr(b'\n', s.as_bytes()).unwrap_or(s.len()))
+            }));
             true
         } else {
             false
@@ -592,14 +1908,10 @@ impl<'a> Lexer<'a> {
     /// Skip multi-line comment
     fn skip_block_comment(&mut self) -> bool {
         if self.eat_if("/*").is_some() {
-            loop {
-                if self.eat_if("*/").is_some() {
-                    break;
-                }
-                if self.eat().is_none() {
-                    break; // EOF
-                }
-            }
+            // An unterminated comment runs to EOF
+            self.eat_if(Scan(|s: &str| {
+                Some(memchr::memmem::find(s.as_bytes(), b"*/").map_or(s.len(), |i| i + 2))
+            }));
             true
         } else {
             false
@@ -608,10 +1920,6 @@ impl<'a> Lexer<'a> {
 
     /// Skip line directive (#line, #pragma, etc.)
     fn skip_line_directive(&mut self) -> bool {
-        if !self.line_begin() {
-            return false;
-        }
-
         let ckpt = self.checkpoint();
 
         // Skip leading whitespace on the line
@@ -623,35 +1931,32 @@ impl<'a> Lexer<'a> {
             }
         }
 
-        if self.eat_if('#').is_none() {
+        // Only look back for the start of the line once a `#` is seen
+        if !self.remaining().starts_with('#') || !self.line_begin() {
             self.restore(ckpt);
             return false;
         }
+        self.eat();
 
         // Check for #pragma
         let is_pragma = self.eat_if("pragma").is_some();
 
-        // Read until end of line
-        let mut directive = String::new();
-        while let Some(ch) = self.peek() {
-            if ch == '\n' {
-                self.eat();
-                break;
-            }
-            directive.push(ch);
-            self.eat();
-        }
+        // Read until end of line, in place
+        let remaining = self.remaining();
+        let len = memchr::memchr(b'\n', remaining.as_bytes()).unwrap_or(remaining.len());
+        let directive = &remaining[..len];
+        self.seek(self.cursor() + len);
+        self.eat_if('\n');
 
         if !is_pragma {
             // Parse #line directive: # <line> "<file>"
-            let parts: Vec<&str> = directive.split_whitespace().collect();
-            if let [line, file, ..] = &parts[..]
+            let mut parts = directive.split_whitespace();
+            if let (Some(line), Some(file)) = (parts.next(), parts.next())
                 && let Ok(line_num) = line.parse::<i32>()
             {
-                self.set_context(SourceContext {
-                    filename: file.trim_matches('"').to_string(),
-                    line_offset: self.lineno() - line_num,
-                });
+                let line_offset = self.lineno() - line_num;
+                let filename = self.ctx_map.intern_filename(file.trim_matches('"'));
+                self.set_context(SourceContext { filename, line_offset });
             }
         }
 
@@ -660,25 +1965,44 @@ impl<'a> Lexer<'a> {
 
     /// Skip whitespace, comments, and line directives
     fn skip_whitespace(&mut self) {
+        self.skip_whitespace_until(usize::MAX);
+    }
+
+    /// Skip whitespace, comments, and line directives, stopping once the cursor
+    /// reaches `end`.
+    fn skip_whitespace_until(&mut self, end: usize) {
+        let from = self.cursor();
+        let mut doc_comment = None;
         loop {
             let start = self.cursor();
+            if start >= end {
+                break;
+            }
 
             // Skip whitespace characters
-            while let Some(ch) = self.peek() {
-                if ch.is_whitespace() {
-                    self.eat();
-                } else {
-                    break;
-                }
+            if self.stops_at_newlines() {
+                self.eat_if(Scan(ascii::line_whitespace));
+            } else {
+                self.eat_if(Scan(ascii::whitespace));
             }
 
             // Skip comments
+            let comment = self.cursor();
             if self.skip_line_comment() || self.skip_block_comment() {
+                if self.records_doc_comments() && is_doc_comment(&self.string[comment..self.cursor()]) {
+                    // Consecutive `///` lines are one comment
+                    let joined = doc_comment.filter(|doc: &Range<usize>| {
+                        self.string[doc.clone()].starts_with("///")
+                            && self.string[comment..].starts_with("///")
+                            && self.string[doc.end..comment].trim().is_empty()
+                    });
+                    doc_comment = Some(joined.map_or(comment, |doc| doc.start)..self.cursor());
+                }
                 continue;
             }
 
             // Skip line directives
-            if self.skip_line_directive() {
+            if !self.stops_at_newlines() && self.skip_line_directive() {
                 continue;
             }
 
@@ -686,23 +2010,76 @@ impl<'a> Lexer<'a> {
                 break;
             }
         }
+        self.record_trivia(from);
+        if let Some(comment) = doc_comment {
+            self.record_doc_comment(comment);
+        }
     }
 
     /// Helper method to parse parenthesized/bracketed/braced sequences
-    fn parse_bracketed<F>(&mut self, open: char, close: char, make_token: F) -> Option<Spanned<BalancedToken>>
-    where
-        F: Fn(BalancedTokenSequence) -> BalancedToken,
-    {
+    ///
+    /// Nested groups are tracked on an explicit stack rather than by
+    /// recursion, so the nesting depth is not limited by the native stack.
+    fn parse_bracketed(
+        &mut self,
+        open: char,
+        close: char,
+        make_token: fn(Arc<BalancedTokenSequence>) -> BalancedToken,
+    ) -> Option<Spanned<BalancedToken>> {
         let start = self.cursor();
-        if self.eat_if(open).is_some() {
-            let mut inner = self.balanced_token_sequence();
-            if self.eat_if(close).is_none() {
-                inner.closed = false;
+        self.eat_if(open)?;
+        // The stack is kept by the lexer, so that it is allocated once
+        let mut groups = self.take_groups();
+        groups.push(Group {
+            start,
+            close,
+            make_token,
+            mark: self.begin_group(),
+        });
+
+        loop {
+            self.skip_whitespace();
+            let start = self.cursor();
+            let group = match self.peek_byte() {
+                Some(b'(') => Some((')', BalancedToken::Parenthesized as fn(_) -> _)),
+                Some(b'[') => Some((']', BalancedToken::Bracketed as fn(_) -> _)),
+                Some(b'{') => Some(('}', BalancedToken::Braced as fn(_) -> _)),
+                _ => None,
+            };
+            if let Some((close, make_token)) = group {
+                self.eat();
+                groups.push(Group {
+                    start,
+                    close,
+                    make_token,
+                    mark: self.begin_group(),
+                });
+                continue;
             }
-            let span = self.make_span(start);
-            return Some(Spanned::new(make_token(inner), span));
+
+            let token = match self.peek_byte() {
+                Some(b')' | b']' | b'}') | None => None,
+                _ => self.balanced_token(),
+            };
+            if let Some(token) = token {
+                self.push_token(token);
+                continue;
+            }
+
+            // The innermost group ends here, closed or not
+            let group = groups.pop().expect("Group stack is not empty");
+            let eoi = Span::new_eoi(self.cursor());
+            let tokens = self.end_group(group.mark);
+            let closed = self.eat_if(group.close).is_some();
+            let span = self.make_span(group.start);
+            let group_tokens = self.share_group(BalancedTokenSequence { tokens, closed, eoi });
+            let token = Spanned::new((group.make_token)(group_tokens), span);
+            if groups.is_empty() {
+                self.put_groups(groups);
+                return Some(token);
+            }
+            self.push_token(token);
         }
-        None
     }
 
     /// (6.7.12.1) balanced token
@@ -710,62 +2087,65 @@ impl<'a> Lexer<'a> {
         self.skip_whitespace();
 
         let start = self.cursor();
+        let ckpt = self.checkpoint();
+        let first = self.peek_byte()?;
+
+        // Dispatch on the first byte, so that each token runs only the
+        // sub-lexer that can match it.
+        let token = match first {
+            // Parenthesized: ( balanced-token-sequence? )
+            b'(' => return self.parse_bracketed('(', ')', BalancedToken::Parenthesized),
+            // Bracketed: [ balanced-token-sequence? ]
+            b'[' => return self.parse_bracketed('[', ']', BalancedToken::Bracketed),
+            // Braced: { balanced-token-sequence? }
+            b'{' => return self.parse_bracketed('{', '}', BalancedToken::Braced),
+            b'"' => self.string_literal(),
+            // Quoted string (backtick)
+            b'`' => self.quoted_string().map(BalancedToken::QuotedString),
+            // Template (quasi-quote)
+            #[cfg(feature = "quasi-quote")]
+            b'@' => self.template().map(BalancedToken::Template),
+            b'\'' => self
+                .character_constant()
+                .map(|cc| BalancedToken::Constant(Constant::Character(cc))),
+            b'.' if self.remaining().as_bytes().get(1).is_some_and(u8::is_ascii_digit) => {
+                self.numeric_constant().map(BalancedToken::Constant)
+            }
+            b'0'..=b'9' => self.numeric_constant().map(BalancedToken::Constant),
+            // Prefixed string literal or character constant
+            b'u' | b'U' | b'L' if self.prefixed_quote() == Some(b'"') => self.string_literal(),
+            b'u' | b'U' | b'L' if self.prefixed_quote() == Some(b'\'') => self
+                .character_constant()
+                .map(|cc| BalancedToken::Constant(Constant::Character(cc))),
+            // Identifier, or predefined constant spelled as an identifier
+            b if ascii::is(b, ascii::IDENT_START) || !b.is_ascii() => {
+                self.identifier()
+                    .map(|id| match Self::predefined_constant(id.as_ref()) {
+                        Some(pc) => BalancedToken::Constant(Constant::Predefined(pc)),
+                        None => {
+                            self.record_occurrence(id.0, start);
+                            BalancedToken::Identifier(id)
+                        }
+                    })
+            }
+            b if ascii::is(b, ascii::PUNCT) => self.punctuator().map(BalancedToken::Punctuator),
+            _ => None,
+        };
 
-        // Parenthesized: ( balanced-token-sequence? )
-        if let Some(token) = self.parse_bracketed('(', ')', BalancedToken::Parenthesized) {
-            return Some(token);
-        }
-
-        // Bracketed: [ balanced-token-sequence? ]
-        if let Some(token) = self.parse_bracketed('[', ']', BalancedToken::Bracketed) {
-            return Some(token);
-        }
-
-        // Braced: { balanced-token-sequence? }
-        if let Some(token) = self.parse_bracketed('{', '}', BalancedToken::Braced) {
-            return Some(token);
-        }
-
-        // String literal
-        if let Some(sl) = self.string_literal() {
-            let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::StringLiteral(sl), span));
-        }
-
-        // Quoted string (backtick)
-        if let Some(qs) = self.quoted_string() {
-            let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::QuotedString(qs), span));
-        }
-
-        // Template (quasi-quote)
-        #[cfg(feature = "quasi-quote")]
-        if let Some(t) = self.template() {
-            let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::Template(t), span));
-        }
-
-        // Constant (must try before identifier for true/false/nullptr)
-        if let Some(c) = self.constant() {
-            let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::Constant(c), span));
-        }
-
-        // Identifier
-        if let Some(id) = self.identifier() {
-            let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::Identifier(id), span));
-        }
-
-        // Punctuator
-        if let Some(p) = self.punctuator() {
+        if let Some(token) = token {
             let span = self.make_span(start);
-            return Some(Spanned::new(BalancedToken::Punctuator(p), span));
+            return Some(Spanned::new(token, span));
         }
 
-        // Unknown token - any single character that doesn't match anything
+        // Unknown token - a character that doesn't match anything, with the
+        // characters after it that start no token either, so that garbage
+        // input costs a token per run rather than per byte
+        self.restore(ckpt);
         if !self.is_eof() && self.peek().is_some_and(|c| !c.is_whitespace()) {
             self.eat();
+            while !self.may_start_token() {
+                self.eat();
+            }
             let span = self.make_span(start);
             return Some(Spanned::new(BalancedToken::Unknown, span));
         }
@@ -773,9 +2153,27 @@ impl<'a> Lexer<'a> {
         None
     }
 
+    /// Whether a token other than an unknown one, or whitespace, may start at
+    /// the cursor, which ends a run of unknown characters.
+    fn may_start_token(&mut self) -> bool {
+        let Some(b) = self.peek_byte() else {
+            return true;
+        };
+        if b.is_ascii() {
+            // Everything that `balanced_token` dispatches on
+            return ascii::is(b, ascii::IDENT_START | ascii::PUNCT | ascii::WHITESPACE)
+                || b.is_ascii_digit()
+                || b"()[]{}\"`'@".contains(&b);
+        }
+        let ckpt = self.checkpoint();
+        let identifier = self.identifier_text().is_some();
+        self.restore(ckpt);
+        identifier || self.peek().is_some_and(char::is_whitespace)
+    }
+
     /// (6.7.12.1) balanced token sequence
     fn balanced_token_sequence(&mut self) -> BalancedTokenSequence {
-        let mut tokens = Vec::new();
+        let mark = self.begin_group();
 
         loop {
             self.skip_whitespace();
@@ -787,15 +2185,147 @@ impl<'a> Lexer<'a> {
             }
 
             if let Some(token) = self.balanced_token() {
-                tokens.push(token);
+                self.push_token(token);
             } else {
                 break;
             }
         }
 
         self.skip_whitespace();
-        let eoi = Span::new_eoi(self.cursor(), self.ctx_id());
+        let eoi = Span::new_eoi(self.cursor());
+        let tokens = self.end_group(mark);
 
         BalancedTokenSequence { tokens, closed: true, eoi }
     }
+
+    /// Scan the tokens as [`Lexer::balanced_token_sequence`] would lex them,
+    /// without building them, up to the first identifier `found` accepts.
+    ///
+    /// Returns the span of the identifier, or `None` once the input or a stray
+    /// closing bracket ends the tokens.
+    fn find_identifier(&mut self, mut found: impl FnMut(&str) -> bool) -> Option<Span> {
+        // The closing brackets of the groups the cursor is in
+        let mut groups = Vec::new();
+        loop {
+            self.skip_whitespace();
+            let start = self.cursor();
+            match self.peek_byte()? {
+                b'(' => groups.push(b')'),
+                b'[' => groups.push(b']'),
+                b'{' => groups.push(b'}'),
+                // The innermost group ends here, and the bracket closes the
+                // first group it matches, as in `parse_bracketed`
+                close @ (b')' | b']' | b'}') => while groups.pop()? != close {},
+                quote @ (b'"' | b'\'') => self.skip_quoted(quote),
+                b'u' | b'U' | b'L' if self.prefixed_quote().is_some() => {
+                    self.encoding_prefix();
+                    let quote = self.peek_byte().expect("A quote follows the prefix");
+                    self.skip_quoted(quote);
+                }
+                b'`' => {
+                    self.eat();
+                    // EOF - unclosed quoted string
+                    let remaining = self.remaining();
+                    let len = memchr::memchr(b'`', remaining.as_bytes()).unwrap_or(remaining.len());
+                    self.seek(self.cursor() + len);
+                    self.eat_if('`');
+                }
+                #[cfg(feature = "quasi-quote")]
+                b'@' if self.template().is_some() => continue,
+                b'.' if self.remaining().as_bytes().get(1).is_some_and(u8::is_ascii_digit) => {
+                    if self.numeric_constant().is_some() {
+                        continue;
+                    }
+                }
+                b'0'..=b'9' if self.numeric_constant().is_some() => continue,
+                b if ascii::is(b, ascii::IDENT_START) || !b.is_ascii() => {
+                    if let Some(ident) = self.identifier_text() {
+                        if found(ident) {
+                            return Some(self.make_span(start));
+                        }
+                        continue;
+                    }
+                }
+                b if ascii::is(b, ascii::PUNCT) && self.punctuator().is_some() => continue,
+                _ => {}
+            }
+            // A bracket, or an unknown character, is a single character
+            if self.cursor() == start {
+                self.eat();
+            }
+        }
+    }
+
+    /// Skip a string literal or a character constant, after its encoding
+    /// prefix, as [`Lexer::string_literal`] and [`Lexer::character_constant`]
+    /// lex its body.
+    fn skip_quoted(&mut self, quote: u8) {
+        self.eat();
+        loop {
+            let remaining = self.remaining().as_bytes();
+            let Some(next) = memchr::memchr3(quote, b'\\', b'\n', remaining) else {
+                // EOF - unclosed literal
+                self.seek(self.cursor() + remaining.len());
+                return;
+            };
+            self.seek(self.cursor() + next);
+            match remaining[next] {
+                b'\\' => {
+                    self.escape_sequence();
+                }
+                // Newline - unclosed literal
+                b'\n' => return,
+                _ => {
+                    self.eat();
+                    return;
+                }
+            }
+        }
+    }
+
+    /// Top-level tokens up to `end`, which must not fall inside a token.
+    fn balanced_tokens_until(&mut self, end: usize) -> Option<Vec<Spanned<BalancedToken>>> {
+        let mark = self.begin_group();
+        let mut complete = true;
+        loop {
+            self.skip_whitespace();
+            if self.cursor() >= end {
+                break;
+            }
+            let token = match self.peek() {
+                Some(')' | ']' | '}') => None,
+                _ => self.balanced_token(),
+            };
+            match token {
+                Some(token) => self.push_token(token),
+                None => {
+                    complete = false;
+                    break;
+                }
+            }
+        }
+        let tokens = self.end_group(mark);
+        (complete && self.cursor() == end).then_some(tokens)
+    }
+
+    /// Push the top-level tokens before `end` onto `tokens`, stopping at the
+    /// first token, comment or line directive that reaches it.
+    ///
+    /// Returns `false` if a closing bracket stops the tokens first.
+    fn push_tokens_until(&mut self, end: usize, tokens: &mut Vec<Spanned<BalancedToken>>) -> bool {
+        loop {
+            self.skip_whitespace_until(end);
+            if self.cursor() >= end {
+                return true;
+            }
+            let token = match self.peek() {
+                Some(')' | ']' | '}') => None,
+                _ => self.balanced_token(),
+            };
+            match token {
+                Some(token) => tokens.push(token),
+                None => return false,
+            }
+        }
+    }
 }
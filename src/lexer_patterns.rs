@@ -0,0 +1,42 @@
+// The regexes of the lexer. `build.rs` compiles them to DFAs, and the lexer
+// loads the DFAs from static data; each defines `patterns!` before including
+// this file.
+patterns! {
+    /// (6.4.2.1) identifier, for identifiers with non-ASCII characters
+    IDENTIFIER = r"[_\p{XID_Start}]\p{XID_Continue}*";
+    /// (6.4.4.1) decimal constant
+    DECIMAL_CONSTANT = r"[1-9](?:'?[0-9])*";
+    /// (6.4.4.1) octal constant with a `0o` prefix
+    OCTAL_PREFIXED_CONSTANT = r"0[oO][0-7](?:'?[0-7])*";
+    /// (6.4.4.1) octal constant
+    OCTAL_CONSTANT = r"0(?:'?[0-7])*";
+    /// (6.4.4.1) hexadecimal constant
+    HEXADECIMAL_CONSTANT = r"0[xX][0-9a-fA-F](?:'?[0-9a-fA-F])*";
+    /// (6.4.4.1) binary constant
+    BINARY_CONSTANT = r"0[bB][01](?:'?[01])*";
+    /// (6.4.4.1) integer suffixes
+    UNSIGNED_LONG_LONG_SUFFIX = r"(u|U)(ll|LL)|(ll|LL)(u|U)";
+    UNSIGNED_LONG_SUFFIX = r"(u|U)(l|L)|(l|L)(u|U)";
+    UNSIGNED_BIT_PRECISE_SUFFIX = r"(u|U)(wb|WB)|(wb|WB)(u|U)";
+    UNSIGNED_SUFFIX = r"u|U";
+    LONG_LONG_SUFFIX = r"ll|LL";
+    LONG_SUFFIX = r"l|L";
+    BIT_PRECISE_SUFFIX = r"wb|WB";
+    /// (6.4.4.2) decimal floating constant
+    DECIMAL_FLOATING_CONSTANT = r"(?:(?:\d+(?:'?\d+)*)?\.(?:\d+(?:'?\d+)*)|(?:\d+(?:'?\d+)*)\.)(?:[eE][+-]?(?:\d+(?:'?\d+)*))?|(?:\d+(?:'?\d+)*)(?:[eE][+-]?(?:\d+(?:'?\d+)*))";
+    /// (6.4.4.2) hexadecimal floating constant
+    HEXADECIMAL_FLOATING_CONSTANT = r"(?:0[xX])(?:(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)?\.(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)|(?:[0-9a-fA-F]+(?:'?[0-9a-fA-F]+)*)\.?)(?:[pP][+-]?(?:\d+(?:'?\d+)*))";
+    /// (6.4.4.2) floating suffixes
+    DF_SUFFIX = r"df|DF";
+    DD_SUFFIX = r"dd|DD";
+    DL_SUFFIX = r"dl|DL";
+    F_SUFFIX = r"f|F";
+    L_SUFFIX = r"l|L";
+    /// (6.4.4.4) octal escape sequence
+    OCTAL_ESCAPE = r"[0-7]{1,3}";
+    /// (6.4.4.4) hexadecimal escape sequence
+    HEXADECIMAL_ESCAPE = r"[0-9a-fA-F]+";
+    /// (6.4.3) universal character names
+    UCN_SHORT = r"[0-9a-fA-F]{4}";
+    UCN_LONG = r"[0-9a-fA-F]{8}";
+}
@@ -4,22 +4,93 @@
 #[macro_use]
 mod utils;
 
+#[cfg(feature = "arena")]
+pub mod arena;
 mod ast;
+#[cfg(feature = "async")]
+mod async_stream;
+mod attributes;
+#[cfg(all(feature = "serde", feature = "mmap"))]
+mod cache;
+pub mod callgraph;
+pub mod cfg;
+pub mod clones;
 mod context;
+pub mod database;
+pub mod diff;
+#[cfg(feature = "mmap")]
+mod file;
+mod heap_size;
+mod incremental;
+pub mod index;
+pub mod intern;
+pub mod layout;
 mod lexer;
+mod parallel;
 pub mod parser;
+mod persistent;
+mod prefix;
+pub mod preprocess;
 #[cfg(feature = "printer")]
 pub mod printer;
+#[cfg(feature = "profile")]
+pub mod profile;
+pub mod query;
 #[cfg(feature = "report")]
 mod report;
+pub mod resolve;
+pub mod rewrite;
+#[cfg(feature = "serde")]
+pub mod serialize;
+mod session;
 pub mod span;
+mod stats;
+mod stream;
+pub mod summary;
+pub mod symbol;
+pub mod token_format;
+mod token_writer;
+pub mod types;
 pub mod visitor;
 
 pub use ast::*;
+#[cfg(feature = "async")]
+pub use async_stream::{DeclarationStream, parse_async};
+pub use attributes::{AttributeParsers, AttributeValue};
+#[cfg(all(feature = "serde", feature = "mmap"))]
+pub use cache::{CacheStats, ParseCache};
 pub use chumsky::Parser;
-pub use context::State;
-pub use lexer::lex;
+pub use context::{CancellationToken, MemoStats, State, TwoPassStats};
+pub use database::{SymbolDatabase, UnitSymbols};
+#[cfg(feature = "mmap")]
+pub use file::SourceFile;
+pub use heap_size::HeapSize;
+pub use incremental::{IncrementalUnit, TextEdit};
+pub use index::{
+    AstIndex, DeclarationIndex, DeclaredKind, Dependencies, DependencyGraph, NodeId, NodeKind, NodeKinds, NodeMap,
+    NodeVec, OccurrenceIndex, SpanIndex, StructuralHashes,
+};
+pub use intern::{Interned, Interner, TypeInterner, UnitTypes};
+pub use layout::{Layout, LayoutEngine, Target};
+pub use lexer::{
+    DocComments, LexIter, TokenCache, TokenPool, TokenSearch, TriviaTable, lex, lex_bytes, lex_cached,
+    lex_doc_comments, lex_iter, lex_occurrences, lex_parallel, lex_trivia,
+};
+pub use parallel::{
+    ParsedUnit, PipelineStats, SpeculationStats, par_visit, par_visit_mut, parse_many, parse_parallel, parse_pipelined,
+    parse_speculative,
+};
 pub use parser::*;
+pub use persistent::SharedUnit;
+pub use prefix::PrefixSnapshot;
+pub use preprocess::{HeaderCache, Preprocessed, Preprocessor};
+pub use query::{Query, QueryError, QueryMatch, QuerySet};
 #[cfg(feature = "report")]
 pub use report::*;
+pub use session::{ParseSession, ParsedSnippet};
+pub use stats::{CapturedParse, ParseStats, SlowInputCapture, parse_with_stats};
+pub use stream::{ParseIter, parse_iter, parse_matching};
+pub use summary::UnitSummary;
+pub use symbol::Symbol;
+pub use types::{TypeId, TypeResolver, TypeTable};
 pub use visitor::{Visitor, VisitorMut};
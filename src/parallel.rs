@@ -0,0 +1,992 @@
+//! Parallel parsing of many translation units, or of one large translation
+//! unit, pipelined lexing and parsing, and parallel visiting and
+//! transforming of the declarations of a translation unit.
+
+use std::{
+    cmp::Reverse,
+    collections::VecDeque,
+    num::NonZeroUsize,
+    ops::{ControlFlow, Range},
+    sync::{
+        Arc, Condvar, Mutex, PoisonError,
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        mpsc,
+    },
+    thread,
+    time::{Duration, Instant},
+};
+
+use chumsky::prelude::*;
+
+use crate::{
+    BalancedToken, BalancedTokenSequence, ExternalDeclaration, Identifier, Punctuator, State, TranslationUnit,
+    context::Binding,
+    index::DeclarationIndex,
+    lex, lex_iter,
+    parser::{Dialect, external_declaration, no_recover, translation_unit, with_dialect},
+    parser_utils::Error,
+    span::{ContextMapping, Span, Spanned, Tokens},
+    symbol::Symbol,
+    visitor::{Visitor, VisitorMut, VisitorResult},
+};
+
+/// Apply `f` to every item on all available cores, keeping the order of `items`.
+///
+/// The workers build parsers in the [dialect](Dialect::current) of the
+/// calling thread, as do those of the other parallel functions.
+pub(crate) fn par_map<T: Sync, R: Send>(items: &[T], f: impl Fn(&T) -> R + Sync) -> Vec<R> {
+    let workers = thread::available_parallelism()
+        .map_or(1, NonZeroUsize::get)
+        .min(items.len());
+    let next = AtomicUsize::new(0);
+    let dialect = Dialect::current();
+
+    let mut results: Vec<(usize, R)> = thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                scope.spawn(|| {
+                    with_dialect(dialect, || {
+                        let mut results = Vec::new();
+                        loop {
+                            let index = next.fetch_add(1, Ordering::Relaxed);
+                            let Some(item) = items.get(index) else {
+                                break;
+                            };
+                            results.push((index, f(item)));
+                        }
+                        results
+                    })
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().unwrap_or_else(|panic| std::panic::resume_unwind(panic)))
+            .collect()
+    });
+
+    results.sort_unstable_by_key(|(index, _)| *index);
+    results.into_iter().map(|(_, result)| result).collect()
+}
+
+/// Visit the external declarations of `unit` on all available cores.
+///
+/// Each worker thread visits the declarations it picks up with its own visitor
+/// from `make_visitor`, and once all declarations are visited, the visitors of
+/// the workers are combined with `reduce`. Which worker visits which
+/// declaration is not deterministic, so `reduce` should not depend on it, as
+/// when collecting names into sets or adding up counts.
+///
+/// If a visit breaks, the workers stop picking up declarations and the
+/// residual of the first break is returned.
+pub fn par_visit<'a, V>(
+    unit: &'a TranslationUnit,
+    make_visitor: impl Fn() -> V + Sync,
+    mut reduce: impl FnMut(V, V) -> V,
+) -> ControlFlow<<V::Result as VisitorResult>::Residual, V>
+where
+    V: Visitor<'a> + Send,
+    <V::Result as VisitorResult>::Residual: Send,
+{
+    let declarations = &unit.external_declarations;
+    let workers = thread::available_parallelism()
+        .map_or(1, NonZeroUsize::get)
+        .min(declarations.len());
+    let next = AtomicUsize::new(0);
+    let stop = AtomicBool::new(false);
+    let dialect = Dialect::current();
+
+    let results: Vec<ControlFlow<_, V>> = thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                scope.spawn(|| {
+                    with_dialect(dialect, || {
+                        let mut visitor = make_visitor();
+                        while !stop.load(Ordering::Relaxed) {
+                            let Some(declaration) = declarations.get(next.fetch_add(1, Ordering::Relaxed)) else {
+                                break;
+                            };
+                            if let ControlFlow::Break(residual) =
+                                visitor.visit_external_declaration(declaration).branch()
+                            {
+                                stop.store(true, Ordering::Relaxed);
+                                return ControlFlow::Break(residual);
+                            }
+                        }
+                        ControlFlow::Continue(visitor)
+                    })
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .map(|handle| handle.join().unwrap_or_else(|panic| std::panic::resume_unwind(panic)))
+            .collect()
+    });
+
+    let mut merged = None;
+    for result in results {
+        let visitor = match result {
+            ControlFlow::Continue(visitor) => visitor,
+            ControlFlow::Break(residual) => return ControlFlow::Break(residual),
+        };
+        merged = Some(match merged {
+            Some(merged) => reduce(merged, visitor),
+            None => visitor,
+        });
+    }
+    ControlFlow::Continue(merged.unwrap_or_else(make_visitor))
+}
+
+/// Transform the external declarations of `unit` in place on all available
+/// cores.
+///
+/// Each worker thread visits the declarations it picks up with its own visitor
+/// from `make_visitor`, and after each declaration, `take_output` takes what
+/// the visitor produced for it besides its changes, such as diagnostics or
+/// declarations to insert next to it. The outputs are returned in the order of
+/// the declarations, so they are the same whichever worker visited which
+/// declaration, as long as `take_output` leaves nothing of one declaration
+/// for the next.
+///
+/// If a visit breaks, the workers stop picking up declarations and the
+/// residual of the first break is returned; the declarations visited by then
+/// keep their changes.
+pub fn par_visit_mut<'a, V, O>(
+    unit: &'a mut TranslationUnit,
+    make_visitor: impl Fn() -> V + Sync,
+    take_output: impl Fn(&mut V) -> O + Sync,
+) -> ControlFlow<<V::Result as VisitorResult>::Residual, Vec<O>>
+where
+    V: VisitorMut<'a>,
+    O: Send,
+    <V::Result as VisitorResult>::Residual: Send,
+{
+    let workers = thread::available_parallelism()
+        .map_or(1, NonZeroUsize::get)
+        .min(unit.external_declarations.len());
+    // Workers take the declarations one at a time, so that a few large
+    // functions do not leave the other workers idle
+    let declarations = Mutex::new(unit.external_declarations.iter_mut().enumerate());
+    let stop = AtomicBool::new(false);
+    let dialect = Dialect::current();
+
+    let results: Vec<ControlFlow<_, Vec<(usize, O)>>> = thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers)
+            .map(|_| {
+                scope.spawn(|| {
+                    with_dialect(dialect, || {
+                        let mut visitor = make_visitor();
+                        let mut outputs = Vec::new();
+                        while !stop.load(Ordering::Relaxed) {
+                            let next = declarations.lock().unwrap_or_else(PoisonError::into_inner).next();
+                            let Some((index, declaration)) = next else {
+                                break;
+                            };
+                            let result = visitor.visit_external_declaration_mut(declaration).branch();
+                            outputs.push((index, take_output(&mut visitor)));
+                            if let ControlFlow::Break(residual) = result {
+                                stop.store(true, Ordering::Relaxed);
+                                return ControlFlow::Break(residual);
+                            }
+                        }
+                        ControlFlow::Continue(outputs)
+                    })
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .map(|handle| handle.join().unwrap_or_else(|panic| std::panic::resume_unwind(panic)))
+            .collect()
+    });
+
+    let mut outputs = Vec::new();
+    for result in results {
+        match result {
+            ControlFlow::Continue(worker_outputs) => outputs.extend(worker_outputs),
+            ControlFlow::Break(residual) => return ControlFlow::Break(residual),
+        }
+    }
+    outputs.sort_unstable_by_key(|(index, _)| *index);
+    ControlFlow::Continue(outputs.into_iter().map(|(_, output)| output).collect())
+}
+
+/// The result of parsing one translation unit.
+pub struct ParsedUnit<'a> {
+    /// The parsed translation unit, if parsing produced any output.
+    pub output: Option<TranslationUnit>,
+    /// Errors encountered while parsing.
+    pub errors: Vec<Error<'a>>,
+    /// Source contexts of the spans in `output` and `errors`.
+    pub ctx_map: ContextMapping<'a>,
+    /// The names declared, if the state parsed with collects them, see
+    /// [`State::set_declaration_index`].
+    pub declarations: Option<DeclarationIndex>,
+}
+
+impl ParsedUnit<'_> {
+    /// Check whether parsing produced any errors.
+    pub fn has_errors(&self) -> bool {
+        !self.errors.is_empty()
+    }
+}
+
+/// Files of at least this many bytes are split into external declarations by
+/// [`parse_many`], which the workers share.
+const SPLIT_BYTES: usize = 1 << 20;
+
+/// Number of declarations of a split file in each task of [`parse_many`], and
+/// in each chunk of [`parse_parallel`].
+const SPLIT_CHUNK: usize = 64;
+
+/// Lex and parse each `(source, filename)` pair, using all available cores.
+///
+/// Every file is parsed from a clone of `init_state`. Each worker thread
+/// builds the parser graph once and reuses it for all files it picks up, or
+/// with the `sync` feature, all workers share the graph of the process.
+/// Results are returned in the order of `files`.
+///
+/// File sizes are often skewed, so the workers pick up the largest files
+/// first, and files of a megabyte or more are split as in [`parse_parallel`]:
+/// the worker that picks one up parses the declarations that may declare
+/// typedef names or enumeration constants, and queues the others ahead of the
+/// remaining files for any worker to pick up. A large file thus does not keep
+/// one worker busy while the others are idle at the end. Files are not split
+/// if `init_state` collects a declaration index or dependency graph, or has a
+/// budget, which are per parse.
+pub fn parse_many<'a>(files: &[(&'a str, Option<&str>)], init_state: &State) -> Vec<ParsedUnit<'a>> {
+    let mut order: Vec<usize> = (0..files.len()).collect();
+    order.sort_by_key(|&index| Reverse(files[index].0.len()));
+    let queue = TaskQueue::new(order.into_iter().map(Task::File));
+    let results: Vec<Mutex<Option<ParsedUnit<'a>>>> = files.iter().map(|_| Mutex::new(None)).collect();
+    let store = |index: usize, unit| *results[index].lock().unwrap_or_else(PoisonError::into_inner) = Some(unit);
+    let split = splittable(init_state);
+
+    let mut workers = thread::available_parallelism().map_or(1, NonZeroUsize::get);
+    // A file that is split keeps every worker busy
+    if !split || files.iter().all(|(source, _)| source.len() < SPLIT_BYTES) {
+        workers = workers.min(files.len());
+    }
+    let dialect = Dialect::current();
+    thread::scope(|scope| {
+        for _ in 0..workers {
+            scope.spawn(|| {
+                with_dialect(dialect, || {
+                    while let Some(task) = queue.pop() {
+                        let _done = TaskDone(&queue);
+                        match task {
+                            Task::File(index) => {
+                                let (source, filename) = files[index];
+                                let (tokens, ctx_map) = lex(source, filename);
+                                if !split || source.len() < SPLIT_BYTES {
+                                    store(index, parse_unit(&tokens, ctx_map, init_state));
+                                    continue;
+                                }
+                                let ranges = split_external_declarations(&tokens.tokens);
+                                let Some(first_pass) = prepass(&tokens, &ranges, &mut init_state.clone()) else {
+                                    store(index, parse_unit(&tokens, ctx_map, init_state));
+                                    continue;
+                                };
+                                let unit = SplitUnit::new(index, tokens, ctx_map, ranges, first_pass);
+                                if unit.pending.is_empty() {
+                                    store(index, unit.finish(init_state));
+                                } else {
+                                    let unit = Arc::new(unit);
+                                    let chunks = (0..unit.pending.len()).step_by(SPLIT_CHUNK);
+                                    let tasks = chunks.map(|start| {
+                                        let end = (start + SPLIT_CHUNK).min(unit.pending.len());
+                                        Task::Declarations(unit.clone(), start..end)
+                                    });
+                                    queue.push_front(tasks);
+                                }
+                            }
+                            Task::Declarations(unit, pending) => {
+                                if unit.parse_pending(pending, init_state) {
+                                    store(unit.file, unit.finish(init_state));
+                                }
+                            }
+                        }
+                    }
+                })
+            });
+        }
+    });
+
+    results
+        .into_iter()
+        .map(|result| {
+            result
+                .into_inner()
+                .unwrap_or_else(PoisonError::into_inner)
+                .expect("Every file is parsed")
+        })
+        .collect()
+}
+
+/// Parse lexed tokens as a translation unit from a clone of `init_state`.
+pub(crate) fn parse_unit<'a>(
+    tokens: &BalancedTokenSequence,
+    ctx_map: ContextMapping<'a>,
+    init_state: &State,
+) -> ParsedUnit<'a> {
+    let mut state = init_state.clone();
+    // The recursive rules are cached, so this is cheap after the first file
+    let (output, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    let errors = errors.into_iter().map(|error| error.into_owned()).collect();
+    let declarations = state.take_declaration_index();
+    ParsedUnit { output, errors, ctx_map, declarations }
+}
+
+/// Whether parsing the external declarations of a unit apart gives the same
+/// results, including what `state` collects over the whole parse.
+fn splittable(state: &State) -> bool {
+    state.declaration_index().is_none()
+        && state.dependency_graph().is_none()
+        && state.max_token_work().is_none()
+        && state.max_errors().is_none()
+        && state.deadline().is_none()
+}
+
+/// A task of [`parse_many`].
+enum Task<'a> {
+    /// Parse the file at this index.
+    File(usize),
+    /// Parse a range of the pending declarations of a split file.
+    Declarations(Arc<SplitUnit<'a>>, Range<usize>),
+}
+
+/// The tasks of [`parse_many`], which its workers pick up from the front.
+struct TaskQueue<'a> {
+    /// The queued tasks, and the number of tasks picked up and not done.
+    tasks: Mutex<(VecDeque<Task<'a>>, usize)>,
+    changed: Condvar,
+}
+
+impl<'a> TaskQueue<'a> {
+    fn new(tasks: impl IntoIterator<Item = Task<'a>>) -> Self {
+        Self {
+            tasks: Mutex::new((tasks.into_iter().collect(), 0)),
+            changed: Condvar::new(),
+        }
+    }
+
+    /// Pick up the next task, waiting while the queue is empty and tasks that
+    /// may queue more are running.
+    fn pop(&self) -> Option<Task<'a>> {
+        let mut guard = self.tasks.lock().unwrap_or_else(PoisonError::into_inner);
+        loop {
+            let (tasks, running) = &mut *guard;
+            if let Some(task) = tasks.pop_front() {
+                *running += 1;
+                return Some(task);
+            }
+            if *running == 0 {
+                return None;
+            }
+            guard = self.changed.wait(guard).unwrap_or_else(PoisonError::into_inner);
+        }
+    }
+
+    /// Queue tasks ahead of the others, in order.
+    fn push_front(&self, tasks: impl DoubleEndedIterator<Item = Task<'a>>) {
+        let mut guard = self.tasks.lock().unwrap_or_else(PoisonError::into_inner);
+        for task in tasks.rev() {
+            guard.0.push_front(task);
+        }
+        self.changed.notify_all();
+    }
+}
+
+/// Marks a task picked up from a [`TaskQueue`] as done when dropped, even if
+/// its worker panics.
+struct TaskDone<'q, 'a>(&'q TaskQueue<'a>);
+
+impl Drop for TaskDone<'_, '_> {
+    fn drop(&mut self) {
+        let mut guard = self.0.tasks.lock().unwrap_or_else(PoisonError::into_inner);
+        guard.1 -= 1;
+        if guard.1 == 0 {
+            self.0.changed.notify_all();
+        }
+    }
+}
+
+/// A file of [`parse_many`] split into external declarations.
+struct SplitUnit<'a> {
+    file: usize,
+    tokens: BalancedTokenSequence,
+    ctx_map: Mutex<Option<ContextMapping<'a>>>,
+    ranges: Vec<Range<usize>>,
+    /// The external declarations parsed so far.
+    parsed: Mutex<Vec<Option<ExternalDeclaration>>>,
+    /// The declarations left to parse, and the names bound before them, see
+    /// [`Prepass`].
+    pending: Vec<(usize, usize)>,
+    bindings: Vec<Binding>,
+    /// Number of pending declarations not parsed yet.
+    remaining: AtomicUsize,
+    /// Whether a pending declaration failed to parse on its own.
+    failed: AtomicBool,
+}
+
+impl<'a> SplitUnit<'a> {
+    /// The lexed file at `file`, split into `ranges` after [`prepass`].
+    fn new(
+        file: usize,
+        tokens: BalancedTokenSequence,
+        ctx_map: ContextMapping<'a>,
+        ranges: Vec<Range<usize>>,
+        (parsed, pending, bindings): Prepass,
+    ) -> Self {
+        Self {
+            file,
+            tokens,
+            ctx_map: Mutex::new(Some(ctx_map)),
+            ranges,
+            parsed: Mutex::new(parsed),
+            remaining: AtomicUsize::new(pending.len()),
+            pending,
+            bindings,
+            failed: AtomicBool::new(false),
+        }
+    }
+
+    /// Parse a range of the pending declarations from `init_state`, and
+    /// return whether they were the last.
+    fn parse_pending(&self, pending: Range<usize>, init_state: &State) -> bool {
+        let count = pending.len();
+        let mut parsed = Vec::with_capacity(count);
+        let mut parser = PendingParser::new(init_state, &self.bindings);
+        for &(index, bound) in &self.pending[pending] {
+            // Once one fails the unit is parsed again, so the others are skipped
+            if self.failed.load(Ordering::Relaxed) {
+                break;
+            }
+            let input = self.tokens.slice_as_input(self.ranges[index].clone());
+            match parser.parse(input, bound) {
+                Some(declaration) => parsed.push((index, declaration)),
+                None => self.failed.store(true, Ordering::Relaxed),
+            }
+        }
+        let mut declarations = self.parsed.lock().unwrap_or_else(PoisonError::into_inner);
+        for (index, declaration) in parsed {
+            declarations[index] = Some(declaration);
+        }
+        drop(declarations);
+        self.remaining.fetch_sub(count, Ordering::AcqRel) == count
+    }
+
+    /// The parsed unit, once every declaration is parsed. If one failed, the
+    /// whole unit is parsed again, so that the result is the same as
+    /// [`translation_unit`].
+    fn finish(&self, init_state: &State) -> ParsedUnit<'a> {
+        let ctx_map = (self.ctx_map.lock().unwrap_or_else(PoisonError::into_inner))
+            .take()
+            .expect("A unit is finished once");
+        if self.failed.load(Ordering::Relaxed) {
+            return parse_unit(&self.tokens, ctx_map, init_state);
+        }
+        let parsed = std::mem::take(&mut *self.parsed.lock().unwrap_or_else(PoisonError::into_inner));
+        let external_declarations = parsed.into_iter().collect::<Option<_>>();
+        ParsedUnit {
+            output: Some(TranslationUnit {
+                external_declarations: external_declarations.expect("Every declaration is parsed"),
+            }),
+            errors: Vec::new(),
+            ctx_map,
+            declarations: None,
+        }
+    }
+}
+
+/// Parse one translation unit, parsing its external declarations in parallel.
+///
+/// The top-level tokens are split at `;` and at function bodies. Declarations
+/// that may declare typedef names or enumeration constants are parsed first,
+/// in order; the others are then parsed in parallel, each with the state as
+/// it was at its start. If any declaration fails to parse on its own, the
+/// whole unit is parsed again sequentially, so the result is always the same
+/// as [`translation_unit`].
+pub fn parse_parallel<'a>(
+    tokens: &'a BalancedTokenSequence,
+    state: &mut State,
+) -> (Option<TranslationUnit>, Vec<Error<'a>>) {
+    if let Some(external_declarations) = parse_split(tokens, state) {
+        return (Some(TranslationUnit { external_declarations }), Vec::new());
+    }
+    translation_unit()
+        .parse_with_state(tokens.as_input(), state)
+        .into_output_errors()
+}
+
+fn parse_split(tokens: &BalancedTokenSequence, state: &mut State) -> Option<Vec<ExternalDeclaration>> {
+    let ranges = split_external_declarations(&tokens.tokens);
+    let mut working = state.clone();
+    let (mut parsed, pending, bindings) = prepass(tokens, &ranges, &mut working)?;
+
+    // The workers parse chunks of the pending declarations from `state`,
+    // which is left as it was until they are done
+    let initial = &*state;
+    let chunks: Vec<_> = pending.chunks(SPLIT_CHUNK).collect();
+    let results = par_map(&chunks, |pending| {
+        let mut parser = PendingParser::new(initial, &bindings);
+        pending
+            .iter()
+            .map(|&(index, bound)| parser.parse(tokens.slice_as_input(ranges[index].clone()), bound))
+            .collect::<Option<Vec<_>>>()
+    });
+    for (pending, results) in chunks.into_iter().zip(results) {
+        for (&(index, _), declaration) in pending.iter().zip(results?) {
+            parsed[index] = Some(declaration);
+        }
+    }
+
+    *state = working;
+    parsed.into_iter().collect()
+}
+
+/// The declarations of `ranges` parsed so far, the others with the number of
+/// names bound before them, and the names bound at file scope, in order.
+type Prepass = (Vec<Option<ExternalDeclaration>>, Vec<(usize, usize)>, Vec<Binding>);
+
+/// Parse the declarations of `ranges` that may declare typedef names or
+/// enumeration constants, in order from `state`, which is left after the last
+/// of them. Returns `None` if one of them fails to parse on its own.
+fn prepass(tokens: &BalancedTokenSequence, ranges: &[Range<usize>], state: &mut State) -> Option<Prepass> {
+    let keywords = [Symbol::intern("typedef"), Symbol::intern("enum")];
+    state.commit();
+    let start = state.bindings_len();
+    let mut parsed = Vec::with_capacity(ranges.len());
+    let mut pending = Vec::new();
+    for (index, range) in ranges.iter().enumerate() {
+        if may_declare_names(&tokens.tokens[range.clone()], &keywords) {
+            let input = tokens.slice_as_input(range.clone());
+            parsed.push(Some(parse_external_declaration(input, state)?));
+            state.commit();
+        } else {
+            parsed.push(None);
+            pending.push((index, state.bindings_len() - start));
+        }
+    }
+    Some((parsed, pending, state.bindings_since(start).to_vec()))
+}
+
+/// Parses pending declarations of a [`Prepass`] in order, each with the
+/// names bound before it.
+///
+/// The declarations share one working state, which binds the names of the
+/// prepass as it gets to them and is rewound after each declaration, so its
+/// scopes are copied from the initial state once.
+struct PendingParser<'p> {
+    state: State,
+    /// The names of the prepass, and how many of them are bound.
+    bindings: &'p [Binding],
+    bound: usize,
+}
+
+impl<'p> PendingParser<'p> {
+    /// Parse from `initial`, the state the prepass started from.
+    fn new(initial: &State, bindings: &'p [Binding]) -> Self {
+        let mut state = initial.clone();
+        state.commit();
+        Self { state, bindings, bound: 0 }
+    }
+
+    /// Parse a declaration with the first `bound` names of the prepass bound.
+    fn parse(&mut self, input: Tokens<'_>, bound: usize) -> Option<ExternalDeclaration> {
+        debug_assert!(bound >= self.bound, "Pending declarations are parsed in order");
+        if bound > self.bound {
+            self.state.extend_bindings(&self.bindings[self.bound..bound]);
+            self.state.commit();
+            self.bound = bound;
+        }
+        let mark = self.state.mark();
+        let declaration = parse_external_declaration(input, &mut self.state);
+        self.state.rewind_to(&mark);
+        declaration
+    }
+}
+
+/// Number of external declarations in each chunk of [`parse_speculative`].
+const SPECULATIVE_CHUNK: usize = 64;
+
+/// Chunks of external declarations of [`parse_speculative`], and how many were
+/// parsed again.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct SpeculationStats {
+    /// Number of chunks.
+    pub chunks: usize,
+    /// Chunks parsed again in parallel, after looking up names that earlier
+    /// chunks declared.
+    pub reparsed: usize,
+    /// Chunks parsed again in the sequential validation, because the chunks
+    /// before them were parsed again into other names.
+    pub sequential: usize,
+}
+
+/// Parse one translation unit, parsing chunks of its external declarations
+/// in parallel, each assuming that the chunks before it declare no typedef
+/// names or enumeration constants.
+///
+/// Unlike [`parse_parallel`], no declaration is parsed ahead of the others:
+/// every chunk is parsed at once from `state`, noting the names it looked up
+/// and the names it declared. A sequential pass then finds the chunks that
+/// looked up a name that the chunks before them declared, which are parsed
+/// again in parallel from the state after those chunks. A last sequential
+/// pass checks the assumptions of every chunk against the names declared
+/// before it, and parses again those still wrong, so the result is always
+/// the same as [`translation_unit`].
+///
+/// When typedef names are declared in headers at the start of the unit, the
+/// chunks after them are parsed twice, both times in parallel. If any chunk
+/// fails to parse without errors, or `state` collects a declaration index or
+/// dependency graph, or has a budget, the whole unit is parsed sequentially.
+pub fn parse_speculative<'a>(
+    tokens: &'a BalancedTokenSequence,
+    state: &mut State,
+) -> (Option<TranslationUnit>, Vec<Error<'a>>, SpeculationStats) {
+    let mut stats = SpeculationStats::default();
+    if splittable(state)
+        && let Some(external_declarations) = speculate(tokens, state, &mut stats)
+    {
+        return (Some(TranslationUnit { external_declarations }), Vec::new(), stats);
+    }
+    let (output, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), state)
+        .into_output_errors();
+    (output, errors, stats)
+}
+
+fn speculate(
+    tokens: &BalancedTokenSequence,
+    state: &mut State,
+    stats: &mut SpeculationStats,
+) -> Option<Vec<ExternalDeclaration>> {
+    let ranges = split_external_declarations(&tokens.tokens);
+    let chunks: Vec<_> = ranges.chunks(SPECULATIVE_CHUNK).collect();
+    stats.chunks = chunks.len();
+    state.commit();
+    let initial = &*state;
+
+    // Every chunk is first parsed from the initial state
+    let mut parsed = par_map(&chunks, |ranges| parse_chunk(tokens, ranges, initial));
+    // The states chunks were parsed again from, if not the initial one
+    let mut starts: Vec<Option<State>> = vec![None; chunks.len()];
+
+    // Chunks that looked up names declared before them are parsed again from
+    // the state after the chunks before them, as far as they are known
+    let mut running = initial.clone();
+    let mut retry = Vec::new();
+    for (index, chunk) in parsed.iter().enumerate() {
+        if chunk.as_ref().is_none_or(|chunk| !chunk.holds(initial, &running)) {
+            retry.push((index, running.clone()));
+        }
+        if let Some(chunk) = chunk {
+            running.extend_bindings(&chunk.bindings);
+        }
+    }
+    stats.reparsed = retry.len();
+    let results = par_map(&retry, |(index, start)| parse_chunk(tokens, chunks[*index], start));
+    for ((index, start), chunk) in retry.into_iter().zip(results) {
+        parsed[index] = chunk;
+        starts[index] = Some(start);
+    }
+
+    // Check each chunk against the names declared before it
+    let mut running = initial.clone();
+    let mut external_declarations = Vec::with_capacity(ranges.len());
+    for (index, chunk) in parsed.into_iter().enumerate() {
+        let start = starts[index].as_ref().unwrap_or(initial);
+        let chunk = match chunk {
+            Some(chunk) if chunk.holds(start, &running) => chunk,
+            _ => {
+                stats.sequential += 1;
+                parse_chunk(tokens, chunks[index], &running)?
+            }
+        };
+        running.extend_bindings(&chunk.bindings);
+        running.commit();
+        external_declarations.extend(chunk.declarations);
+    }
+    *state = running;
+    Some(external_declarations)
+}
+
+/// External declarations of [`parse_speculative`] parsed together, with the
+/// names they assumed and declared.
+struct Chunk {
+    declarations: Vec<ExternalDeclaration>,
+    /// Names looked up as typedef names or enumeration constants.
+    lookups: Vec<Symbol>,
+    /// Names bound at file scope, in order.
+    bindings: Vec<Binding>,
+}
+
+impl Chunk {
+    /// Check whether the chunk, parsed from `start`, parses the same from
+    /// `state`: each name it looked up is of the same kind in both.
+    fn holds(&self, start: &State, state: &State) -> bool {
+        let (start, state) = (start.ctx(), state.ctx());
+        self.lookups.iter().all(|&name| {
+            let name = Identifier(name);
+            start.is_typedef_name(&name) == state.is_typedef_name(&name)
+                && start.is_enum_constant(&name) == state.is_enum_constant(&name)
+        })
+    }
+}
+
+/// Parse the external declarations of `ranges` in order from a clone of
+/// `start`, or return `None` if one of them fails to parse on its own.
+fn parse_chunk(tokens: &BalancedTokenSequence, ranges: &[Range<usize>], start: &State) -> Option<Chunk> {
+    let mut state = start.clone();
+    state.set_dependency_graph(true);
+    let bindings = state.bindings_len();
+    let mut declarations = Vec::with_capacity(ranges.len());
+    for range in ranges {
+        let input = tokens.slice_as_input(range.clone());
+        declarations.push(parse_external_declaration(input, &mut state)?);
+        state.finish_external_declaration();
+        state.commit();
+    }
+    let graph = state.take_dependency_graph()?;
+    let mut lookups: Vec<_> = graph.iter().flat_map(|d| d.consumed.iter().copied()).collect();
+    lookups.sort_unstable_by_key(|name| name.as_u32());
+    lookups.dedup();
+    Some(Chunk {
+        declarations,
+        lookups,
+        bindings: state.bindings_since(bindings).to_vec(),
+    })
+}
+
+/// Number of groups of tokens the lexer of [`parse_pipelined`] may be ahead of
+/// the parser.
+const PIPELINE_DEPTH: usize = 64;
+
+/// Time spent in each stage of [`parse_pipelined`], and the input it handled.
+///
+/// The stage that waits less is the bottleneck: a lexer that often waits for
+/// room in the queue is ahead of the parser, and a parser that often waits for
+/// tokens is ahead of the lexer.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct PipelineStats {
+    /// Bytes of source lexed.
+    pub bytes: usize,
+    /// Top-level tokens passed from the lexer to the parser.
+    pub tokens: usize,
+    /// Groups of tokens passed from the lexer to the parser.
+    pub groups: usize,
+    /// Time the lexer spent lexing.
+    pub lex_time: Duration,
+    /// Time the lexer waited for the parser to make room in the queue.
+    pub lex_wait: Duration,
+    /// Time the parser spent parsing.
+    pub parse_time: Duration,
+    /// Time the parser waited for the lexer to produce tokens.
+    pub parse_wait: Duration,
+}
+
+impl PipelineStats {
+    /// Bytes lexed per second of lexing.
+    pub fn lex_throughput(&self) -> f64 {
+        self.bytes as f64 / self.lex_time.as_secs_f64()
+    }
+
+    /// Top-level tokens parsed per second of parsing.
+    pub fn parse_throughput(&self) -> f64 {
+        self.tokens as f64 / self.parse_time.as_secs_f64()
+    }
+}
+
+/// Lex and parse one translation unit, with the lexer running ahead of the
+/// parser on another thread.
+///
+/// The lexer splits the top-level tokens into groups at `;` and at function
+/// bodies, as [`parse_parallel`] does, and passes them to the parser through a
+/// bounded queue as soon as each group is lexed. The parser parses each group
+/// as an external declaration, joining a group that does not parse on its own
+/// with the following ones, and parses what is left at the end with error
+/// recovery. The output is the same as that of [`translation_unit`] on the
+/// tokens of [`lex`], and is returned with the time spent in each stage.
+pub fn parse_pipelined<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+    state: &mut State,
+) -> (ParsedUnit<'a>, PipelineStats) {
+    let (sender, receiver) = mpsc::sync_channel::<BalancedTokenSequence>(PIPELINE_DEPTH);
+    let mut stats = PipelineStats {
+        bytes: source.len(),
+        ..PipelineStats::default()
+    };
+
+    let (output, errors, ctx_map) = thread::scope(|scope| {
+        let lexer = scope.spawn(move || {
+            let (mut lex_time, mut lex_wait) = (Duration::ZERO, Duration::ZERO);
+            let mut send = |tokens, eoi| {
+                let start = Instant::now();
+                let sent = sender.send(BalancedTokenSequence { tokens, closed: true, eoi });
+                lex_wait += start.elapsed();
+                sent.is_ok()
+            };
+
+            let mut stream = lex_iter(source, filename);
+            let mut group = Vec::new();
+            // A complete group waits for the next token, where its input ends
+            let mut complete = None;
+            loop {
+                let start = Instant::now();
+                let token = stream.next();
+                lex_time += start.elapsed();
+                let Some(token) = token else {
+                    break;
+                };
+                if let Some(tokens) = complete.take()
+                    && !send(tokens, Span::new_eoi(token.span.range().start))
+                {
+                    break;
+                }
+                group.push(token);
+                if ends_declaration(&group, 0, group.len() - 1) {
+                    complete = Some(std::mem::take(&mut group));
+                }
+            }
+            let (eoi, ctx_map) = stream.finish();
+            for tokens in complete.into_iter().chain((!group.is_empty()).then_some(group)) {
+                send(tokens, eoi);
+            }
+            (ctx_map, lex_time, lex_wait)
+        });
+
+        // Without recovery, a group that is not a whole declaration fails fast
+        let parser = no_recover(external_declaration()).then_ignore(end());
+        let mut external_declarations = Vec::new();
+        let mut pending = BalancedTokenSequence {
+            tokens: Vec::new(),
+            closed: true,
+            eoi: Span::new_eoi(0),
+        };
+        loop {
+            let start = Instant::now();
+            let Ok(group) = receiver.recv() else {
+                break;
+            };
+            stats.parse_wait += start.elapsed();
+
+            let start = Instant::now();
+            stats.tokens += group.tokens.len();
+            stats.groups += 1;
+            pending.tokens.extend(group.tokens);
+            pending.eoi = group.eoi;
+            let mark = state.mark();
+            let parsed = {
+                let result = parser.parse_with_state(pending.as_input(), state);
+                if result.has_errors() {
+                    None
+                } else {
+                    result.into_output()
+                }
+            };
+            if let Some(external_declaration) = parsed {
+                // Nothing rewinds into a completed external declaration
+                state.commit();
+                external_declarations.push(external_declaration);
+                pending.tokens.clear();
+            } else {
+                state.rewind_to(&mark);
+            }
+            stats.parse_time += start.elapsed();
+        }
+
+        let start = Instant::now();
+        let mut errors = Vec::new();
+        let output = if pending.tokens.is_empty() {
+            Some(TranslationUnit { external_declarations })
+        } else {
+            // The rest does not parse as whole declarations
+            let (rest, rest_errors) = translation_unit()
+                .parse_with_state(pending.as_input(), state)
+                .into_output_errors();
+            errors = rest_errors.into_iter().map(|error| error.into_owned()).collect();
+            rest.map(|rest| {
+                external_declarations.extend(rest.external_declarations);
+                TranslationUnit { external_declarations }
+            })
+        };
+        stats.parse_time += start.elapsed();
+
+        let (ctx_map, lex_time, lex_wait) = lexer.join().unwrap_or_else(|panic| std::panic::resume_unwind(panic));
+        stats.lex_time = lex_time;
+        stats.lex_wait = lex_wait;
+        (output, errors, ctx_map)
+    });
+
+    let declarations = state.declaration_index().cloned();
+    (ParsedUnit { output, errors, ctx_map, declarations }, stats)
+}
+
+pub(crate) fn parse_external_declaration(input: Tokens<'_>, state: &mut State) -> Option<ExternalDeclaration> {
+    let result = external_declaration().then_ignore(end()).parse_with_state(input, state);
+    if result.has_errors() {
+        None
+    } else {
+        result.into_output()
+    }
+}
+
+/// Split top-level tokens after each `;` and each function body.
+pub(crate) fn split_external_declarations(tokens: &[Spanned<BalancedToken>]) -> Vec<Range<usize>> {
+    let mut ranges = Vec::new();
+    let mut start = 0;
+    while start < tokens.len() {
+        let end = declaration_end(tokens, start);
+        ranges.push(start..end);
+        start = end;
+    }
+    ranges
+}
+
+/// Find the end of the external declaration starting at `start`: just after
+/// the next `;` or function body, or the end of `tokens`.
+///
+/// A braced group is taken as a function body when it follows a
+/// parenthesized group that follows an identifier or another group, as in
+/// `f(void) {` or `(*f(void))(int) {`. A misplaced boundary only makes the
+/// pieces fail to parse.
+pub(crate) fn declaration_end(tokens: &[Spanned<BalancedToken>], start: usize) -> usize {
+    (start..tokens.len())
+        .find(|&index| ends_declaration(tokens, start, index))
+        .map_or(tokens.len(), |index| index + 1)
+}
+
+/// Check whether the token at `index` ends the external declaration starting
+/// at `start`, see [`declaration_end`].
+fn ends_declaration(tokens: &[Spanned<BalancedToken>], start: usize, index: usize) -> bool {
+    match &tokens[index].value {
+        BalancedToken::Punctuator(Punctuator::Semicolon) => true,
+        BalancedToken::Braced(_) => {
+            index >= start + 2
+                && matches!(tokens[index - 1].value, BalancedToken::Parenthesized(_))
+                && matches!(
+                    tokens[index - 2].value,
+                    BalancedToken::Identifier(_) | BalancedToken::Parenthesized(_) | BalancedToken::Bracketed(_)
+                )
+        }
+        _ => false,
+    }
+}
+
+/// Check whether tokens mention any of `keywords`, at any depth.
+pub(crate) fn may_declare_names(tokens: &[Spanned<BalancedToken>], keywords: &[Symbol]) -> bool {
+    tokens.iter().any(|token| match &token.value {
+        BalancedToken::Identifier(id) => keywords.contains(&id.0),
+        BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+            may_declare_names(&inner.tokens, keywords)
+        }
+        #[cfg(feature = "quasi-quote")]
+        BalancedToken::Template(_) | BalancedToken::Interpolation(_) => true,
+        _ => false,
+    })
+}
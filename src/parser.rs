@@ -1,9 +1,12 @@
 //! Parser for C source code, producing an abstract syntax tree.
 
-use chumsky::prelude::*;
+use std::{cell::Cell, sync::Arc, time::Instant};
+
+use chumsky::{input::InputRef, prelude::*};
 use macro_rules_attribute::apply;
+use rustc_hash::{FxHashMap, FxHashSet};
 
-use crate::{ast::*, context::State, span::*, utils::*};
+use crate::{HeapSize, ast::*, context::State, index::DeclaredKind, span::*, symbol::Symbol, utils::*};
 
 /// Utilities for the parser.
 pub mod parser_utils {
@@ -14,6 +17,13 @@ pub mod parser_utils {
     /// Token stream type used by the parser.
     pub type TokenStream = BalancedTokenSequence;
     /// Error type used by the parser.
+    ///
+    /// The type is fixed rather than a parameter of the grammar: recursive
+    /// rules are built once per thread, or once per process with the `sync`
+    /// feature, into a slot of their own type, which
+    /// cannot depend on a type parameter of the rule. `Rich` keeps
+    /// the found token by reference, so a failed alternative costs its set of
+    /// expected tokens, and rules with a label replace that set with the label.
     pub type Error<'a> = Rich<'a, BalancedToken, Span>;
     /// Extra parser state including error tracking, state, and context.
     pub type Extra<'a> = chumsky::extra::Full<Error<'a>, State, Context>;
@@ -28,57 +38,163 @@ pub mod parser_utils {
 
 use parser_utils::*;
 
+/// The language a parser accepts, fixed when the parser is built with
+/// [`with_dialect`].
+///
+/// Each dialect extends the one before it. The alternatives of the rules that
+/// a dialect has no use for are left out of the parsers built for it, rather
+/// than tried and rejected on every parse.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum Dialect {
+    /// Standard C23.
+    C23,
+    /// C23 with the GNU extensions: `__attribute__` and `__asm__` specifiers.
+    Gnu,
+    /// GNU C with the templates of the `quasi-quote` feature, the default.
+    #[default]
+    Templates,
+}
+
+thread_local! {
+    /// The dialect parsers are built for on this thread.
+    static DIALECT: Cell<Dialect> = const { Cell::new(Dialect::Templates) };
+}
+
+impl Dialect {
+    /// The number of dialects.
+    pub(crate) const COUNT: usize = 3;
+
+    /// The dialect parsers are built for on this thread.
+    pub fn current() -> Dialect {
+        DIALECT.get()
+    }
+
+    /// Whether the GNU extensions are parsed.
+    pub fn gnu(self) -> bool {
+        self >= Dialect::Gnu
+    }
+
+    /// Whether templates are parsed, with the `quasi-quote` feature.
+    pub fn templates(self) -> bool {
+        cfg!(feature = "quasi-quote") && self >= Dialect::Templates
+    }
+}
+
+/// Build parsers for `dialect` in `build`, e.g.
+/// `with_dialect(Dialect::C23, translation_unit)`.
+///
+/// The cached rules are built once per dialect, and lazy blocks are parsed in
+/// the dialect of the parser that found them. The parallel functions, such as
+/// [`parse_parallel`](crate::parse_parallel) and
+/// [`parse_many`](crate::parse_many), pass the dialect of the calling thread
+/// to the workers that build their parsers.
+pub fn with_dialect<R>(dialect: Dialect, build: impl FnOnce() -> R) -> R {
+    struct Restore(Dialect);
+
+    impl Drop for Restore {
+        fn drop(&mut self) {
+            DIALECT.set(self.0);
+        }
+    }
+
+    let _restore = Restore(DIALECT.replace(dialect));
+    build()
+}
+
+/// The alternatives of a rule, after an interpolation when the dialect has
+/// templates.
+///
+/// The two parsers are variants of a [`Templated`] rather than boxed, so the
+/// rules of the other dialects are not called through a pointer.
+#[cfg(feature = "quasi-quote")]
+macro_rules! templated {
+    ($parser:expr) => {{
+        let parser = $parser;
+        ::chumsky::extension::v1::Ext(if Dialect::current().templates() {
+            Templated::Interpolated(choice((interpolation(), parser)))
+        } else {
+            Templated::Plain(parser)
+        })
+    }};
+}
+
+/// The alternatives of a rule, after an interpolation when the dialect has
+/// templates.
+#[cfg(not(feature = "quasi-quote"))]
+macro_rules! templated {
+    ($parser:expr) => {
+        $parser
+    };
+}
+
 // =============================================================================
 // Expressions
 // =============================================================================
 
 /// (6.5.1) primary expression
+///
+/// The alternatives start with different kinds of tokens, so only the one the
+/// next token can start is tried, rather than each in turn.
 pub fn primary_expression<'a>() -> impl Parser<'a, Tokens<'a>, PrimaryExpression, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        generic_selection().map(PrimaryExpression::Generic),
-        constant().map(PrimaryExpression::Constant),
+    let constant = constant().map(PrimaryExpression::Constant);
+    let name = choice((
         enumeration_constant().map(PrimaryExpression::EnumerationConstant),
         identifier().map(PrimaryExpression::Identifier),
-        string_literal().map(PrimaryExpression::StringLiteral),
-        quoted_string().map(PrimaryExpression::QuotedString),
-        expression()
-            .parenthesized()
-            .map(Box::new)
-            .map(PrimaryExpression::Parenthesized)
-            .recover_with(recover_parenthesized(PrimaryExpression::Error)),
-    ))
-    .labelled("primiary expression")
-    .as_context()
+    ));
+    let string_literal = string_literal().map(PrimaryExpression::StringLiteral);
+    let quoted_string = quoted_string().map(PrimaryExpression::QuotedString);
+    let parenthesized = expression()
+        .parenthesized()
+        .map(Box::new)
+        .map(PrimaryExpression::Parenthesized)
+        .recover_with(recover_parenthesized(PrimaryExpression::Error));
+    let alternatives = templated!(choice((
+        generic_selection().map(PrimaryExpression::Generic),
+        constant.clone(),
+        name.clone(),
+        string_literal.clone(),
+        quoted_string.clone(),
+        parenthesized.clone(),
+    )));
+
+    let generic = Symbol::intern("_Generic");
+    // Alternatives before the constant
+    let skipped = 1 + Dialect::current().templates() as u64;
+    custom(move |inp| {
+        const LABEL: &str = "primiary expression";
+        match inp.peek_ref() {
+            Some(Token::Constant(_)) => predicted(inp, LABEL, skipped, &constant, &alternatives),
+            Some(Token::Identifier(ident)) if ident.0 != generic => {
+                predicted(inp, LABEL, skipped + 1, &name, &alternatives)
+            }
+            Some(Token::StringLiteral(_)) => predicted(inp, LABEL, skipped + 3, &string_literal, &alternatives),
+            Some(Token::QuotedString(_)) => predicted(inp, LABEL, skipped + 4, &quoted_string, &alternatives),
+            Some(Token::Parenthesized(_)) => predicted(inp, LABEL, skipped + 5, &parenthesized, &alternatives),
+            _ => inp.parse(&alternatives),
+        }
+    })
+    .labelled_rule("primiary expression")
 }
 
 /// (6.5.1) enumeration constant
 pub fn enumeration_constant<'a>() -> impl Parser<'a, Tokens<'a>, Identifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        identifier().try_map_with(|name, extra| {
-            if extra.state().ctx().is_enum_constant(&name) {
-                Ok(name)
-            } else {
-                Err(expected_found(
-                    ["enumeration constant"],
-                    Some(Token::Identifier(name)),
-                    extra.span(),
-                ))
-            }
-        }),
-    ))
-    .labelled("enumeration constant")
-    .as_context()
+    templated!(identifier().try_map_with(|name, extra| {
+        if extra.state().lookup_enum_constant(&name) {
+            Ok(name)
+        } else {
+            Err(expected_found(
+                ["enumeration constant"],
+                Some(Token::Identifier(name)),
+                extra.span(),
+            ))
+        }
+    }))
+    .labelled_rule("enumeration constant")
 }
 
 /// (6.5.1.1) generic selection
 pub fn generic_selection<'a>() -> impl Parser<'a, Tokens<'a>, GenericSelection, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         keyword("_Generic")
             .ignore_then(
                 assignment_expression() // TODO: generic over type
@@ -88,31 +204,25 @@ pub fn generic_selection<'a>() -> impl Parser<'a, Tokens<'a>, GenericSelection,
                     .then(generic_association_list())
                     .parenthesized(), // TODO: error recovery
             )
-            .map(|(controlling_expression, associations)| GenericSelection { controlling_expression, associations }),
-    ))
-    .labelled("generic selection")
-    .as_context()
+            .map(|(controlling_expression, associations)| GenericSelection { controlling_expression, associations })
+    )
+    .labelled_rule("generic selection")
 }
 
 /// (6.5.1.1) generic association list
 pub fn generic_association_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<GenericAssociation>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         generic_association()
             .separated_by(punctuator(Punctuator::Comma))
             .at_least(1)
-            .collect::<Vec<GenericAssociation>>(),
-    ))
-    .labelled("generic association list")
-    .as_context()
+            .collect::<Vec<GenericAssociation>>()
+    )
+    .labelled_rule("generic association list")
 }
 
 /// (6.5.1.1) generic association
 pub fn generic_association<'a>() -> impl Parser<'a, Tokens<'a>, GenericAssociation, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         keyword("default")
             .ignore_then(punctuator(Punctuator::Colon))
             .ignore_then(assignment_expression().map(Brand::into_inner).map(Box::new))
@@ -121,9 +231,8 @@ pub fn generic_association<'a>() -> impl Parser<'a, Tokens<'a>, GenericAssociati
             .then_ignore(punctuator(Punctuator::Colon))
             .then(assignment_expression().map(Brand::into_inner).map(Box::new))
             .map(|(type_name, expression)| GenericAssociation::Type { type_name, expression }),
-    ))
-    .labelled("generic association")
-    .as_context()
+    )))
+    .labelled_rule("generic association")
 }
 
 /// (6.5.2) postfix expression
@@ -167,46 +276,36 @@ pub fn postfix_expression<'a>() -> impl Parser<'a, Tokens<'a>, PostfixExpression
         |acc, f| f(acc),
     );
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        compound_literal().map(PostfixExpression::CompoundLiteral),
+    templated!(choice((
+        compound_literal().map(|cl| PostfixExpression::CompoundLiteral(Box::new(cl))),
         postfix,
-    ))
-    .labelled("postfix expression")
-    .as_context()
+    )))
+    .labelled_rule("postfix expression")
 }
 
 /// (6.5.2.5) compound literal
 pub fn compound_literal<'a>() -> impl Parser<'a, Tokens<'a>, CompoundLiteral, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        storage_class_specifiers()
-            .then(type_name())
-            .parenthesized() // TODO: error recovery
+    templated!(
+        parenthesized_type_start()
+            .ignore_then(storage_class_specifiers().then(type_name()).parenthesized()) // TODO: error recovery
             .then(braced_initializer())
             .map(|((storage_class_specifiers, type_name), initializer)| CompoundLiteral {
                 storage_class_specifiers,
                 type_name,
                 initializer,
-            }),
-    ))
-    .labelled("compound literal")
-    .as_context()
+            })
+    )
+    .labelled_rule("compound literal")
 }
 
 /// (6.5.2.5) storage class specifiers
 pub fn storage_class_specifiers<'a>() -> impl Parser<'a, Tokens<'a>, Vec<StorageClassSpecifier>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         storage_class_specifier()
             .repeated()
-            .collect::<Vec<StorageClassSpecifier>>(),
-    ))
-    .labelled("storage class specifiers")
-    .as_context()
+            .collect::<Vec<StorageClassSpecifier>>()
+    )
+    .labelled_rule("storage class specifiers")
 }
 
 /// (6.5.3) unary expression
@@ -233,15 +332,14 @@ pub fn unary_expression<'a>() -> impl Parser<'a, Tokens<'a>, UnaryExpression, Ex
     let sizeof_expr = keyword("sizeof").ignore_then(unary_expression()).map(Box::new);
     let type_name = type_name()
         .parenthesized()
-        .recover_with(recover_parenthesized(TypeName::Error));
+        .recover_with(recover_parenthesized(TypeName::Error))
+        .map(Box::new);
     let sizeof_type = keyword("sizeof").ignore_then(type_name.clone());
     let alignof_type = keyword("alignof").or(keyword("_Alignof")).ignore_then(type_name);
 
     let postfix = postfix_expression();
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         pre_increment.map(UnaryExpression::PreIncrement),
         pre_decrement.map(UnaryExpression::PreDecrement),
         unary.map(|(operator, operand)| UnaryExpression::Unary { operator, operand: Box::new(operand) }),
@@ -250,9 +348,8 @@ pub fn unary_expression<'a>() -> impl Parser<'a, Tokens<'a>, UnaryExpression, Ex
         sizeof_type.map(UnaryExpression::SizeofType),
         alignof_type.map(UnaryExpression::Alignof),
         postfix.map(UnaryExpression::Postfix),
-    ))
-    .labelled("unary expression")
-    .as_context()
+    )))
+    .labelled_rule("unary expression")
 }
 
 /// (6.5.4) cast expression
@@ -261,17 +358,26 @@ pub fn cast_expression<'a>() -> impl Parser<'a, Tokens<'a>, CastExpression, Extr
     let cast = type_name()
         .parenthesized()
         .recover_with(recover_parenthesized(TypeName::Error))
+        .map(Box::new)
         .then(allow_recover(cast_expression().map(Box::new)))
         .map(|(type_name, expression)| CastExpression::Cast { type_name, expression });
     let unary = unary_expression().map(CastExpression::Unary);
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        no_recover(cast.clone()),
-        no_recover(unary.clone()),
+    let strict_unary = no_recover(unary.clone());
+    let alternatives = templated!(choice((
+        no_recover(parenthesized_type_start().ignore_then(cast.clone())),
+        strict_unary.clone(),
         cast,
         unary,
-    ))
+    )));
+    // A cast starts with a parenthesized token, so anything else is a unary
+    // expression if it parses at all
+    let skipped = 1 + Dialect::current().templates() as u64;
+    nesting(custom(move |inp| match inp.peek_ref() {
+        Some(Token::Parenthesized(_)) => inp.parse(&alternatives),
+        #[cfg(feature = "quasi-quote")]
+        Some(Token::Template(_) | Token::Interpolation(_)) => inp.parse(&alternatives),
+        _ => predicted(inp, "cast expression", skipped, &strict_unary, &alternatives),
+    }))
 }
 
 /// (6.5.5) multiplicative expression
@@ -294,73 +400,130 @@ pub fn cast_expression<'a>() -> impl Parser<'a, Tokens<'a>, CastExpression, Extr
 ///
 /// (6.5.14) logical OR expression
 pub fn binary_expression<'a>() -> impl Parser<'a, Tokens<'a>, Brand<Expression, BinaryExpression>, Extra<'a>> + Clone {
-    use chumsky::pratt::*;
+    let operand = binary_operand();
+    templated!(custom(move |inp| binary_operands(inp, &operand, 0)))
+        .map(Brand::new)
+        .labelled_rule("binary expression")
+}
+
+/// An operand of a binary operator: a cast expression, without the wrappers
+/// of a cast expression that is a single unary or postfix expression.
+fn binary_operand<'a>() -> impl Parser<'a, Tokens<'a>, Expression, Extra<'a>> + Clone {
+    // Operands without an operator are a single postfix expression
+    cast_expression().map_with(|c, e| Expression::new(ExpressionKind::from_cast(c), e.span()))
+}
+
+include!(concat!(env!("OUT_DIR"), "/precedence.rs"));
 
-    macro_rules! op {
-        ($punct:expr) => {{
-            use Punctuator::*;
-            punctuator($punct)
-        }};
+/// Number of punctuators, the size of tables indexed by `Punctuator as usize`.
+const PUNCTUATORS: usize = Punctuator::HashHash as usize + 1;
+
+/// Binding powers of [`BINARY_OPERATOR_POWERS`] by `Punctuator as usize`, 0
+/// for punctuators that are not binary operators.
+const BINARY_POWERS: [u8; PUNCTUATORS] = {
+    let mut powers = [0; PUNCTUATORS];
+    let mut i = 0;
+    while i < BINARY_OPERATOR_POWERS.len() {
+        let (punctuator, power) = BINARY_OPERATOR_POWERS[i];
+        powers[punctuator as usize] = power;
+        i += 1;
     }
+    powers
+};
 
-    macro_rules! binary {
-        ($op:expr) => {
-            |left, _, right, extra: &mut _| {
-                use BinaryOperator::*;
-                Expression::new(
-                    ExpressionKind::Binary(BinaryExpression {
-                        operator: $op,
-                        left: Box::new(left),
-                        right: Box::new(right),
-                    }),
-                    extra.span(),
-                )
-            }
-        };
+/// Binding power and operator of a binary operator punctuator; operators with
+/// a higher binding power bind tighter. All binary operators are left
+/// associative.
+///
+/// The binding powers are derived from the levels of `src/grammar.txt` by the
+/// build script.
+fn binary_operator(punctuator: Punctuator) -> Option<(u8, BinaryOperator)> {
+    use BinaryOperator::*;
+    let power = BINARY_POWERS[punctuator as usize];
+    if power == 0 {
+        return None;
     }
+    let operator = match punctuator {
+        Punctuator::Star => Multiply,
+        Punctuator::Slash => Divide,
+        Punctuator::Percent => Modulo,
+        Punctuator::Plus => Add,
+        Punctuator::Minus => Subtract,
+        Punctuator::LeftShift => LeftShift,
+        Punctuator::RightShift => RightShift,
+        Punctuator::Less => Less,
+        Punctuator::LessEqual => LessEqual,
+        Punctuator::Greater => Greater,
+        Punctuator::GreaterEqual => GreaterEqual,
+        Punctuator::Equal => Equal,
+        Punctuator::NotEqual => NotEqual,
+        Punctuator::Ampersand => BitwiseAnd,
+        Punctuator::Caret => BitwiseXor,
+        Punctuator::Pipe => BitwiseOr,
+        Punctuator::LogicalAnd => LogicalAnd,
+        Punctuator::LogicalOr => LogicalOr,
+        _ => return None,
+    };
+    Some((power, operator))
+}
 
-    // Suppose precedence is X, use 1000 - 10*X as the associativity level
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        choice((
-            cast_expression().map_with(|c, e| Expression::new(ExpressionKind::Cast(c), e.span())),
-            unary_expression().map_with(|u, e| Expression::new(ExpressionKind::Unary(u), e.span())),
-            postfix_expression().map_with(|p, e| Expression::new(ExpressionKind::Postfix(p), e.span())),
-        ))
-        .pratt((
-            infix(left(1000 - 30), op!(Star), binary!(Multiply)),
-            infix(left(1000 - 30), op!(Slash), binary!(Divide)),
-            infix(left(1000 - 30), op!(Percent), binary!(Modulo)),
-            infix(left(1000 - 40), op!(Plus), binary!(Add)),
-            infix(left(1000 - 40), op!(Minus), binary!(Subtract)),
-            infix(left(1000 - 50), op!(LeftShift), binary!(LeftShift)),
-            infix(left(1000 - 50), op!(RightShift), binary!(RightShift)),
-            infix(left(1000 - 60), op!(Less), binary!(Less)),
-            infix(left(1000 - 60), op!(LessEqual), binary!(LessEqual)),
-            infix(left(1000 - 60), op!(Greater), binary!(Greater)),
-            infix(left(1000 - 60), op!(GreaterEqual), binary!(GreaterEqual)),
-            infix(left(1000 - 70), op!(Equal), binary!(Equal)),
-            infix(left(1000 - 70), op!(NotEqual), binary!(NotEqual)),
-            infix(left(1000 - 80), op!(Ampersand), binary!(BitwiseAnd)),
-            infix(left(1000 - 90), op!(Caret), binary!(BitwiseXor)),
-            infix(left(1000 - 100), op!(Pipe), binary!(BitwiseOr)),
-            infix(left(1000 - 110), op!(LogicalAnd), binary!(LogicalAnd)),
-            infix(left(1000 - 120), op!(LogicalOr), binary!(LogicalOr)),
-        )),
-    ))
-    .map(Brand::new)
-    .labelled("binary expression")
-    .as_context()
+/// Parse operands separated by binary operators binding at least as tight as
+/// `min_power`, by precedence climbing.
+fn binary_operands<'a, P>(
+    inp: &mut InputRef<'a, '_, Tokens<'a>, Extra<'a>>,
+    operand: &P,
+    min_power: u8,
+) -> Result<Expression, Error<'a>>
+where
+    P: Parser<'a, Tokens<'a>, Expression, Extra<'a>>,
+{
+    let left = inp.parse(operand)?;
+    Ok(climb_binary(inp, operand, left, min_power))
+}
+
+/// Parse the binary operators binding at least as tight as `min_power` after
+/// `left`, with their operands, by precedence climbing over the binding powers
+/// of [`BINARY_OPERATOR_POWERS`].
+///
+/// Each operator is found with a single lookup of the next token. Chains of
+/// operators of the same binding power are folded in a loop, so the recursion
+/// depth is bounded by the number of binding powers. If no operand follows an
+/// operator, the operator is left unparsed.
+fn climb_binary<'a, P>(
+    inp: &mut InputRef<'a, '_, Tokens<'a>, Extra<'a>>,
+    operand: &P,
+    mut left: Expression,
+    min_power: u8,
+) -> Expression
+where
+    P: Parser<'a, Tokens<'a>, Expression, Extra<'a>>,
+{
+    while let Some(Token::Punctuator(punctuator)) = inp.peek_ref()
+        && let Some((power, operator)) = binary_operator(*punctuator)
+        && power >= min_power
+    {
+        let before = inp.save();
+        inp.next_ref();
+        let Ok(right) = binary_operands(inp, operand, power + 1) else {
+            inp.rewind(before);
+            break;
+        };
+        let span = Span::new(left.span.range().start..right.span.range().end);
+        let binary = BinaryExpression {
+            operator,
+            left: Box::new(left),
+            right: Box::new(right),
+        };
+        left = Expression::new(ExpressionKind::Binary(binary), span);
+    }
+    left
 }
 
 /// (6.5.15) conditional expression
 #[apply(cached)]
 pub fn conditional_expression<'a>()
 -> impl Parser<'a, Tokens<'a>, Brand<Expression, ConditionalExpression>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         binary_expression()
             .then_ignore(punctuator(Punctuator::Question))
             .then(expression())
@@ -377,10 +540,9 @@ pub fn conditional_expression<'a>()
                 )
             }),
         binary_expression().map(Brand::into_inner),
-    ))
+    )))
     .map(Brand::new)
-    .labelled("conditional expression")
-    .as_context()
+    .labelled_rule("conditional expression")
 }
 
 /// (6.5.16) assignment expression
@@ -400,11 +562,9 @@ pub fn assignment_expression<'a>()
         Token::Punctuator(Punctuator::LeftShiftAssign) => AssignmentOperator::LeftShiftAssign,
         Token::Punctuator(Punctuator::RightShiftAssign) => AssignmentOperator::RightShiftAssign,
     };
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         unary_expression()
-            .map_with(|u, e| Expression::new(ExpressionKind::Unary(u), e.span()))
+            .map_with(|u, e| Expression::new(ExpressionKind::from_unary(u), e.span()))
             .then(assigment_opeartor)
             .then(assignment_expression().map(Brand::into_inner))
             .map_with(|((left, operator), right), extra| {
@@ -418,18 +578,15 @@ pub fn assignment_expression<'a>()
                 )
             }),
         conditional_expression().map(Brand::into_inner),
-    ))
+    )))
     .map(Brand::new)
-    .labelled("assignment expression")
-    .as_context()
+    .labelled_rule("assignment expression")
 }
 
 /// (6.5.17) expression
 #[apply(cached)]
 pub fn expression<'a>() -> impl Parser<'a, Tokens<'a>, Expression, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         assignment_expression()
             .map(Brand::into_inner)
             .separated_by(punctuator(Punctuator::Comma))
@@ -441,25 +598,21 @@ pub fn expression<'a>() -> impl Parser<'a, Tokens<'a>, Expression, Extra<'a>> +
                 } else {
                     Expression::new(ExpressionKind::Comma(CommaExpression { expressions }), extra.span())
                 }
-            }),
-    ))
-    .labelled("expression")
-    .as_context()
+            })
+    )
+    .labelled_rule("expression")
 }
 
 /// (6.6) constant expression
 #[apply(cached)]
 pub fn constant_expression<'a>() -> impl Parser<'a, Tokens<'a>, ConstantExpression, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         conditional_expression()
             .map(Brand::into_inner)
             .map(Box::new)
-            .map(ConstantExpression::Expression),
-    ))
-    .labelled("constant expression")
-    .as_context()
+            .map(ConstantExpression::Expression)
+    )
+    .labelled_rule("constant expression")
 }
 
 // =============================================================================
@@ -493,168 +646,210 @@ pub fn declaration<'a>() -> impl Parser<'a, Tokens<'a>, Declaration, Extra<'a>>
 
     let static_assert = static_assert_declaration();
 
-    let attribute = choice((
-        old_fashioned_attribute_specifier()
-            .repeated()
-            .at_least(1)
-            .collect::<Vec<AttributeSpecifier>>(),
-        attribute_specifier_sequence().then_ignore(punctuator(Punctuator::Semicolon)),
-    ));
+    let standard = attribute_specifier_sequence().then_ignore(punctuator(Punctuator::Semicolon));
+    let attribute = if Dialect::current().gnu() {
+        let gnu = (old_fashioned_attribute_specifier().repeated().at_least(1))
+            .collect::<ShortList<AttributeSpecifier>>()
+            .map(ShortList::into_vec);
+        choice((gnu, standard)).boxed()
+    } else {
+        standard.boxed()
+    };
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         static_assert.map_with(|s, e| Declaration::new(DeclarationKind::StaticAssert(s), e.span())),
         normal,
         typedef,
         attribute.map_with(|a, e| Declaration::new(DeclarationKind::Attribute(a), e.span())),
-    ))
-    .labelled("declaration")
-    .as_context()
+    )))
+    .labelled_rule("declaration")
 }
 
 /// (6.7) declaration specifiers (without typedef)
 pub fn declaration_specifiers<'a>() -> impl Parser<'a, Tokens<'a>, DeclarationSpecifiers, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        declaration_specifier()
-            .repeated()
-            .at_least(1)
-            .collect::<Vec<DeclarationSpecifier>>()
-            .then(attribute_specifier_sequence())
-            .map(|(specifiers, attributes)| DeclarationSpecifiers { specifiers, attributes }),
-    ))
-    .labelled("declaration specifiers")
-    .as_context()
+    memoized(
+        "declaration specifiers",
+        templated!(
+            declaration_specifier()
+                .repeated()
+                .at_least(1)
+                .collect::<ShortList<DeclarationSpecifier>>()
+                .map(ShortList::into_vec)
+                .then(attribute_specifier_sequence())
+                .map(|(specifiers, attributes)| DeclarationSpecifiers { specifiers, attributes })
+        )
+        .labelled_rule("declaration specifiers"),
+    )
 }
 
 /// (6.7) declaration specifiers (with typedef)
 pub fn declaration_specifiers_with_typedef<'a>() -> impl Parser<'a, Tokens<'a>, DeclarationSpecifiers, Extra<'a>> + Clone
 {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        declaration_specifier()
-            .or(keyword("typedef").to(DeclarationSpecifier::StorageClass(StorageClassSpecifier::Typedef)))
-            .repeated()
-            .at_least(1)
-            .collect::<Vec<DeclarationSpecifier>>()
-            .then(attribute_specifier_sequence())
-            .map(|(specifiers, attributes)| DeclarationSpecifiers { specifiers, attributes }),
-    ))
-    .labelled("declaration specifiers")
-    .as_context()
+    memoized(
+        "declaration specifiers with typedef",
+        templated!(
+            declaration_specifier()
+                .or(keyword("typedef").to(DeclarationSpecifier::StorageClass(StorageClassSpecifier::Typedef)))
+                .repeated()
+                .at_least(1)
+                .collect::<ShortList<DeclarationSpecifier>>()
+                .map(ShortList::into_vec)
+                .then(attribute_specifier_sequence())
+                .map(|(specifiers, attributes)| DeclarationSpecifiers { specifiers, attributes })
+        )
+        .labelled_rule("declaration specifiers"),
+    )
 }
 
 /// (6.7) declaration specifier (without typedef)
 #[apply(cached)]
 pub fn declaration_specifier<'a>() -> impl Parser<'a, Tokens<'a>, DeclarationSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    // Specifiers that are a single keyword take one lookup; `_Atomic` may
+    // start an atomic type specifier, so it is left to the alternatives
+    let storage_classes = STORAGE_CLASS_SPECIFIERS
+        .iter()
+        .map(|&(kwd, specifier)| (kwd, DeclarationSpecifier::StorageClass(specifier)));
+    let type_specifiers = TYPE_SPECIFIERS.iter().map(|(kwd, specifier)| {
+        let specifier = TypeSpecifierQualifier::TypeSpecifier(specifier.clone());
+        (*kwd, DeclarationSpecifier::TypeSpecifierQualifier(specifier))
+    });
+    let type_qualifiers = TYPE_QUALIFIERS
+        .iter()
+        .filter(|&&(kwd, _)| kwd != "_Atomic")
+        .map(|&(kwd, qualifier)| {
+            let qualifier = TypeSpecifierQualifier::TypeQualifier(qualifier);
+            (kwd, DeclarationSpecifier::TypeSpecifierQualifier(qualifier))
+        });
+    let function_specifiers = FUNCTION_SPECIFIERS
+        .iter()
+        .map(|&(kwd, specifier)| (kwd, DeclarationSpecifier::Function(specifier)));
+    let keywords = keyword_table(
+        storage_classes
+            .chain(type_specifiers)
+            .chain(type_qualifiers)
+            .chain(function_specifiers),
+    );
+
+    templated!(choice((
+        keywords,
         storage_class_specifier().map(DeclarationSpecifier::StorageClass),
         type_specifier_qualifier().map(DeclarationSpecifier::TypeSpecifierQualifier),
         function_specifier().map(DeclarationSpecifier::Function),
-    ))
-    .labelled("declaration specifier")
-    .as_context()
+    )))
+    .labelled_rule("declaration specifier")
 }
 
 /// (6.7) init declarator list
 pub fn init_declarator_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<InitDeclarator>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         init_declarator()
             .separated_by(punctuator(Punctuator::Comma))
             .at_least(1)
-            .collect::<Vec<InitDeclarator>>(),
-    ))
-    .labelled("init declarator list")
-    .as_context()
+            .collect::<ShortList<InitDeclarator>>()
+            .map(ShortList::into_vec)
+    )
+    .labelled_rule("init declarator list")
 }
 
 /// (6.7) init declarator
 pub fn init_declarator<'a>() -> impl Parser<'a, Tokens<'a>, InitDeclarator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         declarator()
+            .map_with(|declarator, extra| {
+                if declarator.is_function()
+                    && let Some(ident) = declarator.identifier()
+                {
+                    extra.state().declare_as(*ident, DeclaredKind::Function, extra.span());
+                }
+                declarator
+            })
             .then(punctuator(Punctuator::Assign).ignore_then(initializer()).or_not())
-            .map(|(declarator, initializer)| InitDeclarator { declarator, initializer }),
-    ))
-    .labelled("init declarator")
-    .as_context()
+            .map(|(declarator, initializer)| InitDeclarator { declarator, initializer })
+    )
+    .labelled_rule("init declarator")
 }
 
 /// (6.7) typedef declarator list (variant of init declarator list)
 pub fn typedef_declarator_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<Declarator>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         typedef_declarator()
             .separated_by(punctuator(Punctuator::Comma))
             .at_least(1)
-            .collect::<Vec<Declarator>>(),
-    ))
-    .labelled("init declarator list")
-    .as_context()
+            .collect::<ShortList<Declarator>>()
+            .map(ShortList::into_vec)
+    )
+    .labelled_rule("init declarator list")
 }
 
 /// (6.7) typedef declarator (variant of init declarator)
 pub fn typedef_declarator<'a>() -> impl Parser<'a, Tokens<'a>, Declarator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        declarator().map_with(move |declarator, extra| {
-            if let Some(ident) = declarator.identifier() {
-                extra.state().ctx_mut().add_typedef_name(ident.clone());
-            }
-            declarator
-        }),
-    ))
-    .labelled("init declarator")
-    .as_context()
-}
+    templated!(declarator().map_with(move |declarator, extra| {
+        if let Some(ident) = declarator.identifier() {
+            extra.state().ctx_mut().add_typedef_name(*ident);
+            extra.state().declare_as(*ident, DeclaredKind::Typedef, extra.span());
+        }
+        declarator
+    }))
+    .labelled_rule("init declarator")
+}
+
+/// Storage class specifiers that are a single keyword (without typedef).
+const STORAGE_CLASS_SPECIFIERS: &[(&str, StorageClassSpecifier)] = &[
+    ("auto", StorageClassSpecifier::Auto),
+    ("constexpr", StorageClassSpecifier::Constexpr),
+    ("extern", StorageClassSpecifier::Extern),
+    ("register", StorageClassSpecifier::Register),
+    ("static", StorageClassSpecifier::Static),
+    ("thread_local", StorageClassSpecifier::ThreadLocal),
+];
+
+/// Type specifiers that are a single keyword.
+const TYPE_SPECIFIERS: &[(&str, TypeSpecifier)] = &[
+    ("void", TypeSpecifier::Void),
+    ("char", TypeSpecifier::Char),
+    ("short", TypeSpecifier::Short),
+    ("int", TypeSpecifier::Int),
+    ("long", TypeSpecifier::Long),
+    ("float", TypeSpecifier::Float),
+    ("double", TypeSpecifier::Double),
+    ("signed", TypeSpecifier::Signed),
+    ("unsigned", TypeSpecifier::Unsigned),
+    ("bool", TypeSpecifier::Bool),
+    ("_Bool", TypeSpecifier::Bool),
+    ("_Complex", TypeSpecifier::Complex),
+    ("_Decimal32", TypeSpecifier::Decimal32),
+    ("_Decimal64", TypeSpecifier::Decimal64),
+    ("_Decimal128", TypeSpecifier::Decimal128),
+];
+
+/// Type qualifiers, all of which are a single keyword.
+const TYPE_QUALIFIERS: &[(&str, TypeQualifier)] = &[
+    ("const", TypeQualifier::Const),
+    ("restrict", TypeQualifier::Restrict),
+    ("__restrict", TypeQualifier::Restrict),
+    ("volatile", TypeQualifier::Volatile),
+    ("_Atomic", TypeQualifier::Atomic),
+    ("_Nonnull", TypeQualifier::Nonnull),
+    ("_Nullable", TypeQualifier::Nullable),
+    ("_Thread_local", TypeQualifier::ThreadLocal),
+];
+
+/// Function specifiers, all of which are a single keyword.
+const FUNCTION_SPECIFIERS: &[(&str, FunctionSpecifier)] = &[
+    ("inline", FunctionSpecifier::Inline),
+    ("_Noreturn", FunctionSpecifier::Noreturn),
+];
 
 /// (6.7.1) storage class specifier (without typedef)
 #[apply(cached)]
 pub fn storage_class_specifier<'a>() -> impl Parser<'a, Tokens<'a>, StorageClassSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        keyword("auto").to(StorageClassSpecifier::Auto),
-        keyword("constexpr").to(StorageClassSpecifier::Constexpr),
-        keyword("extern").to(StorageClassSpecifier::Extern),
-        keyword("register").to(StorageClassSpecifier::Register),
-        keyword("static").to(StorageClassSpecifier::Static),
-        keyword("thread_local").to(StorageClassSpecifier::ThreadLocal),
-        // keyword("typedef").to(StorageClassSpecifier::Typedef),
-    ))
-    .labelled("storage class specifier")
-    .as_context()
+    templated!(keyword_table(STORAGE_CLASS_SPECIFIERS.iter().copied())).labelled_rule("storage class specifier")
 }
 
 /// (6.7.2) type specifier
 pub fn type_specifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        keyword("void").to(TypeSpecifier::Void),
-        keyword("char").to(TypeSpecifier::Char),
-        keyword("short").to(TypeSpecifier::Short),
-        keyword("int").to(TypeSpecifier::Int),
-        keyword("long").to(TypeSpecifier::Long),
-        keyword("float").to(TypeSpecifier::Float),
-        keyword("double").to(TypeSpecifier::Double),
-        keyword("signed").to(TypeSpecifier::Signed),
-        keyword("unsigned").to(TypeSpecifier::Unsigned),
-        keyword("bool").or(keyword("_Bool")).to(TypeSpecifier::Bool),
-        keyword("_Complex").to(TypeSpecifier::Complex),
-        keyword("_Decimal32").to(TypeSpecifier::Decimal32),
-        keyword("_Decimal64").to(TypeSpecifier::Decimal64),
-        keyword("_Decimal128").to(TypeSpecifier::Decimal128),
+    templated!(choice((
+        keyword_table(TYPE_SPECIFIERS.iter().cloned()),
         keyword("_BitInt")
             .ignore_then(
                 constant_expression()
@@ -662,14 +857,13 @@ pub fn type_specifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeSpecifier, Extra<
                     .recover_with(recover_parenthesized(ConstantExpression::Error)),
             )
             .map(TypeSpecifier::BitInt),
-        atomic_type_specifier().map(TypeSpecifier::Atomic),
-        struct_or_union_specifier().map(TypeSpecifier::Struct),
-        enum_specifier().map(TypeSpecifier::Enum),
-        typeof_specifier().map(TypeSpecifier::Typeof),
+        atomic_type_specifier().map(Box::new).map(TypeSpecifier::Atomic),
+        struct_or_union_specifier().map(Box::new).map(TypeSpecifier::Struct),
+        enum_specifier().map(Box::new).map(TypeSpecifier::Enum),
+        typeof_specifier().map(Box::new).map(TypeSpecifier::Typeof),
         typedef_name().map(TypeSpecifier::TypedefName), // Must be last to avoid conflicts
-    ))
-    .labelled("type specifier")
-    .as_context()
+    )))
+    .labelled_rule("type specifier")
 }
 
 /// (6.7.2.1) struct or union specifier
@@ -679,33 +873,23 @@ pub fn struct_or_union_specifier<'a>() -> impl Parser<'a, Tokens<'a>, StructOrUn
         keyword("union").to(StructOrUnion::Union),
     ));
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         struct_or_union
             .then(attribute_specifier_sequence())
-            .then(identifier().or_not())
+            .then(tag().or_not())
             .then(member_declaration_list().braced().or_not())
-            .map(|(((kind, attributes), identifier), members)| StructOrUnionSpecifier {
-                kind,
-                attributes,
-                identifier,
-                members,
-            }),
-    ))
-    .labelled("struct or union specifier")
-    .as_context()
+            .map_with(|(((kind, attributes), tag), members), extra| {
+                let identifier = declare_tag(tag, members.is_some(), extra.state());
+                StructOrUnionSpecifier { kind, attributes, identifier, members }
+            })
+    )
+    .labelled_rule("struct or union specifier")
 }
 
 /// (6.7.2.1) member declaration list
 pub fn member_declaration_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<MemberDeclaration>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        member_declaration().repeated().collect::<Vec<MemberDeclaration>>(),
-    ))
-    .labelled("member declaration list")
-    .as_context()
+    templated!(member_declaration().repeated().collect::<Vec<MemberDeclaration>>())
+        .labelled_rule("member declaration list")
 }
 
 /// (6.7.2.1) member declaration
@@ -716,164 +900,158 @@ pub fn member_declaration<'a>() -> impl Parser<'a, Tokens<'a>, MemberDeclaration
         .then(specifier_qualifier_list())
         .then(member_declarator_list().or_not().map(Option::unwrap_or_default))
         .then_ignore(punctuator(Punctuator::Semicolon))
-        .map(|((attributes, specifiers), declarators)| MemberDeclaration::Normal {
+        .map_with(|((attributes, specifiers), declarators), e| MemberDeclaration::Normal {
             attributes,
             specifiers,
             declarators,
+            span: e.span(),
         })
-        .recover_with(skip_until(any().ignored(), punctuator(Punctuator::Semicolon), || {
+        .recover_with(recover_skip_until(punctuator(Punctuator::Semicolon), || {
             MemberDeclaration::Error
         }));
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        static_assert,
-        normal,
-    ))
-    .labelled("member declaration")
-    .as_context()
+    templated!(choice((static_assert, normal,))).labelled_rule("member declaration")
 }
 
 /// (6.7.2.1) specifier qualifier list
 #[apply(cached)]
 pub fn specifier_qualifier_list<'a>() -> impl Parser<'a, Tokens<'a>, SpecifierQualifierList, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         type_specifier_qualifier()
             .repeated()
             .at_least(1)
-            .collect::<Vec<TypeSpecifierQualifier>>()
+            .collect::<ShortList<TypeSpecifierQualifier>>()
+            .map(ShortList::into_vec)
             .then(attribute_specifier_sequence())
-            .map(|(items, attributes)| SpecifierQualifierList { items, attributes }),
-    ))
-    .labelled("specifier qualifier list")
-    .as_context()
+            .map(|(items, attributes)| SpecifierQualifierList { items, attributes })
+    )
+    .labelled_rule("specifier qualifier list")
 }
 
 /// (6.7.2.1) type specifier qualifier
 #[apply(cached)]
 pub fn type_specifier_qualifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeSpecifierQualifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    // See `declaration_specifier`
+    let type_specifiers = TYPE_SPECIFIERS
+        .iter()
+        .map(|(kwd, specifier)| (*kwd, TypeSpecifierQualifier::TypeSpecifier(specifier.clone())));
+    let type_qualifiers = TYPE_QUALIFIERS
+        .iter()
+        .filter(|&&(kwd, _)| kwd != "_Atomic")
+        .map(|&(kwd, qualifier)| (kwd, TypeSpecifierQualifier::TypeQualifier(qualifier)));
+    let keywords = keyword_table(type_specifiers.chain(type_qualifiers));
+
+    templated!(choice((
+        keywords,
         type_specifier().map(TypeSpecifierQualifier::TypeSpecifier),
         type_qualifier().map(TypeSpecifierQualifier::TypeQualifier),
         alignment_specifier().map(TypeSpecifierQualifier::AlignmentSpecifier),
-    ))
-    .labelled("type specifier qualifier")
-    .as_context()
+    )))
+    .labelled_rule("type specifier qualifier")
 }
 
 /// (6.7.2.1) member declarator list
 pub fn member_declarator_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<MemberDeclarator>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         member_declarator()
             .separated_by(punctuator(Punctuator::Comma))
             .at_least(1)
-            .collect::<Vec<MemberDeclarator>>(),
-    ))
-    .labelled("member declarator list")
-    .as_context()
+            .collect::<Vec<MemberDeclarator>>()
+    )
+    .labelled_rule("member declarator list")
 }
 
 /// (6.7.2.1) member declarator
 pub fn member_declarator<'a>() -> impl Parser<'a, Tokens<'a>, MemberDeclarator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        declarator()
+    let declarator = declarator().map_with(|declarator, extra| {
+        if let Some(ident) = declarator.identifier() {
+            extra.state().declare_as(*ident, DeclaredKind::Member, extra.span());
+        }
+        declarator
+    });
+    templated!(choice((
+        declarator
+            .clone()
             .or_not()
             .then_ignore(punctuator(Punctuator::Colon))
             .then(constant_expression())
             .map(|(declarator, width)| MemberDeclarator::BitField { declarator, width }),
-        declarator().map(MemberDeclarator::Declarator),
-    ))
-    .labelled("member declarator")
-    .as_context()
+        declarator.map(MemberDeclarator::Declarator),
+    )))
+    .labelled_rule("member declarator")
 }
 
 /// (6.7.2.2) enum specifier
 pub fn enum_specifier<'a>() -> impl Parser<'a, Tokens<'a>, EnumSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         keyword("enum")
             .ignore_then(attribute_specifier_sequence())
-            .then(identifier().or_not())
+            .then(tag().or_not())
             .then(
                 punctuator(Punctuator::Colon)
                     .ignore_then(specifier_qualifier_list())
                     .or_not(),
             )
             .then(enumerator_list().braced().or_not())
-            .map(
-                |(((attributes, identifier), type_specifier), enumerators)| EnumSpecifier {
+            .map_with(|(((attributes, tag), type_specifier), enumerators), extra| {
+                let identifier = declare_tag(tag, enumerators.is_some(), extra.state());
+                EnumSpecifier {
                     attributes,
                     identifier,
                     type_specifier,
                     enumerators,
-                },
-            ),
-    ))
-    .labelled("enum specifier")
-    .as_context()
+                }
+            })
+    )
+    .labelled_rule("enum specifier")
 }
 
 /// (6.7.2.2) enumerator list
 pub fn enumerator_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<Enumerator>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         enumerator()
             .map_with(|enumerator, extra| {
-                extra.state().ctx_mut().add_enum_constant(enumerator.name.clone());
+                extra.state().ctx_mut().add_enum_constant(enumerator.name);
                 enumerator
             })
             .separated_by(punctuator(Punctuator::Comma))
             .allow_trailing()
-            .collect::<Vec<Enumerator>>(),
-    ))
-    .labelled("enumerator list")
-    .as_context()
+            .collect::<Vec<Enumerator>>()
+    )
+    .labelled_rule("enumerator list")
 }
 
 /// (6.7.2.2) enumerator
 pub fn enumerator<'a>() -> impl Parser<'a, Tokens<'a>, Enumerator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         identifier()
+            .map_with(|name, extra| {
+                extra.state().declare(name, DeclaredKind::Enumerator, extra.span());
+                name
+            })
             .then(attribute_specifier_sequence())
             .then(
                 punctuator(Punctuator::Assign)
                     .ignore_then(constant_expression())
                     .or_not(),
             )
-            .map(|((name, attributes), value)| Enumerator { name, attributes, value }),
-    ))
-    .labelled("enumerator")
-    .as_context()
+            .map(|((name, attributes), value)| Enumerator { name, attributes, value })
+    )
+    .labelled_rule("enumerator")
 }
 
 /// (6.7.2.4) atomic type specifier
 pub fn atomic_type_specifier<'a>() -> impl Parser<'a, Tokens<'a>, AtomicTypeSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         keyword("_Atomic")
             .ignore_then(
                 type_name()
                     .parenthesized()
                     .recover_with(recover_parenthesized(TypeName::Error)),
             )
-            .map(|type_name| AtomicTypeSpecifier { type_name }),
-    ))
-    .labelled("atomic type specifier")
-    .as_context()
+            .map(|type_name| AtomicTypeSpecifier { type_name })
+    )
+    .labelled_rule("atomic type specifier")
 }
 
 /// (6.7.2.5) typeof specifier
@@ -885,9 +1063,7 @@ pub fn typeof_specifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeofSpecifier, Ex
     .parenthesized()
     .recover_with(recover_parenthesized(TypeofSpecifierArgument::Error));
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         keyword("typeof")
             .or(keyword("__typeof__"))
             .ignore_then(typeof_arg.clone())
@@ -895,40 +1071,19 @@ pub fn typeof_specifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeofSpecifier, Ex
         keyword("typeof_unqual")
             .ignore_then(typeof_arg)
             .map(TypeofSpecifier::TypeofUnqual),
-    ))
-    .labelled("typeof specifier")
-    .as_context()
+    )))
+    .labelled_rule("typeof specifier")
 }
 
 /// (6.7.3) type qualifier
 #[apply(cached)]
 pub fn type_qualifier<'a>() -> impl Parser<'a, Tokens<'a>, TypeQualifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        keyword("const").to(TypeQualifier::Const),
-        keyword("restrict").to(TypeQualifier::Restrict),
-        keyword("__restrict").to(TypeQualifier::Restrict),
-        keyword("volatile").to(TypeQualifier::Volatile),
-        keyword("_Atomic").to(TypeQualifier::Atomic),
-        keyword("_Nonnull").to(TypeQualifier::Nonnull),
-        keyword("_Nullable").to(TypeQualifier::Nullable),
-        keyword("_Thread_local").to(TypeQualifier::ThreadLocal),
-    ))
-    .labelled("type qualifier")
-    .as_context()
+    templated!(keyword_table(TYPE_QUALIFIERS.iter().copied())).labelled_rule("type qualifier")
 }
 
 /// (6.7.4) function specifier
 pub fn function_specifier<'a>() -> impl Parser<'a, Tokens<'a>, FunctionSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        keyword("inline").to(FunctionSpecifier::Inline),
-        keyword("_Noreturn").to(FunctionSpecifier::Noreturn),
-    ))
-    .labelled("function specifier")
-    .as_context()
+    templated!(keyword_table(FUNCTION_SPECIFIERS.iter().copied())).labelled_rule("function specifier")
 }
 
 /// (6.7.5) alignment specifier
@@ -938,19 +1093,15 @@ pub fn alignment_specifier<'a>() -> impl Parser<'a, Tokens<'a>, AlignmentSpecifi
         .recover_with(recover_parenthesized(ConstantExpression::Error));
     let typ = type_name()
         .parenthesized()
-        .recover_with(recover_parenthesized(TypeName::Error));
+        .recover_with(recover_parenthesized(TypeName::Error))
+        .map(Box::new);
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        keyword("alignas").ignore_then(choice((
-            no_recover(typ.clone()).map(AlignmentSpecifier::Type),
-            expr.map(AlignmentSpecifier::Expression),
-            typ.map(AlignmentSpecifier::Type),
-        ))),
-    ))
-    .labelled("alignment specifier")
-    .as_context()
+    templated!(keyword("alignas").ignore_then(choice((
+        no_recover(typ.clone()).map(AlignmentSpecifier::Type),
+        expr.map(AlignmentSpecifier::Expression),
+        typ.map(AlignmentSpecifier::Type),
+    ))))
+    .labelled_rule("alignment specifier")
 }
 
 /// (6.7.6) declarator
@@ -960,20 +1111,18 @@ pub fn declarator<'a>() -> impl Parser<'a, Tokens<'a>, Declarator, Extra<'a>> +
         .then(declarator().map(Box::new))
         .map(|(pointer, declarator)| Declarator::Pointer { pointer, declarator });
     let direct = direct_declarator().map(Declarator::Direct);
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        pointer,
-        direct,
-    ))
-    .labelled("declarator")
-    .as_context()
+    templated!(choice((pointer, direct,))).labelled_rule("declarator")
 }
 
 /// (6.7.6) direct declarator
 #[apply(cached)]
 pub fn direct_declarator<'a>() -> impl Parser<'a, Tokens<'a>, DirectDeclarator, Extra<'a>> + Clone {
+    // Entered as an object, and given its kind by the enclosing declaration
     let identifier_decl = identifier()
+        .map_with(|identifier, extra| {
+            extra.state().declare(identifier, DeclaredKind::Object, extra.span());
+            identifier
+        })
         .then(attribute_specifier_sequence())
         .map(|(identifier, attributes)| DirectDeclarator::Identifier { identifier, attributes });
 
@@ -985,9 +1134,7 @@ pub fn direct_declarator<'a>() -> impl Parser<'a, Tokens<'a>, DirectDeclarator,
 
     type DirectDeclaratorFn = Box<dyn FnOnce(DirectDeclarator) -> DirectDeclarator>;
     let base = choice((identifier_decl, parenthesized));
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         base.foldl(
             choice((
                 array_declarator().then(attribute_specifier_sequence()).map(
@@ -1012,17 +1159,14 @@ pub fn direct_declarator<'a>() -> impl Parser<'a, Tokens<'a>, DirectDeclarator,
             ))
             .repeated(),
             |acc, f| f(acc),
-        ),
-    ))
-    .labelled("direct declarator")
-    .as_context()
+        )
+    )
+    .labelled_rule("direct declarator")
 }
 
 /// (6.7.6) array declarator
 pub fn array_declarator<'a>() -> impl Parser<'a, Tokens<'a>, ArrayDeclarator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         choice((
             keyword("static")
                 .ignore_then(type_qualifier_list().or_not().map(Option::unwrap_or_default))
@@ -1044,18 +1188,15 @@ pub fn array_declarator<'a>() -> impl Parser<'a, Tokens<'a>, ArrayDeclarator, Ex
                 .map(|(type_qualifiers, size)| ArrayDeclarator::Normal { type_qualifiers, size }),
         ))
         .bracketed()
-        .recover_with(recover_bracketed(ArrayDeclarator::Error)),
-    ))
-    .labelled("array declarator")
-    .as_context()
+        .recover_with(recover_bracketed(ArrayDeclarator::Error))
+    )
+    .labelled_rule("array declarator")
 }
 
 /// (6.7.6) pointer
 #[apply(cached)]
 pub fn pointer<'a>() -> impl Parser<'a, Tokens<'a>, Pointer, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         choice((
             punctuator(Punctuator::Star).to(PointerOrBlock::Pointer),
             punctuator(Punctuator::Caret).to(PointerOrBlock::Block),
@@ -1066,56 +1207,53 @@ pub fn pointer<'a>() -> impl Parser<'a, Tokens<'a>, Pointer, Extra<'a>> + Clone
             pointer_or_block,
             attributes,
             type_qualifiers,
-        }),
-    ))
-    .labelled("pointer")
-    .as_context()
+        })
+    )
+    .labelled_rule("pointer")
 }
 
 /// (6.7.6) type qualifier list
 #[apply(cached)]
 pub fn type_qualifier_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<TypeQualifier>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        type_qualifier().repeated().at_least(1).collect::<Vec<TypeQualifier>>(),
-    ))
-    .labelled("type qualifier list")
-    .as_context()
+    templated!(
+        type_qualifier()
+            .repeated()
+            .at_least(1)
+            .collect::<ShortList<TypeQualifier>>()
+            .map(ShortList::into_vec)
+    )
+    .labelled_rule("type qualifier list")
 }
 
 /// (6.7.6) parameter type list
 #[apply(cached)]
 pub fn parameter_type_list<'a>() -> impl Parser<'a, Tokens<'a>, ParameterTypeList, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         punctuator(Punctuator::Ellipsis).to(ParameterTypeList::OnlyVariadic),
-        parameter_declaration()
-            .separated_by(punctuator(Punctuator::Comma))
-            .collect::<Vec<ParameterDeclaration>>()
-            .then(
-                punctuator(Punctuator::Comma)
-                    .ignore_then(punctuator(Punctuator::Ellipsis))
-                    .or_not(),
-            )
-            .map(|(params, variadic)| {
-                if variadic.is_some() {
-                    ParameterTypeList::Variadic(params)
-                } else {
-                    ParameterTypeList::Parameters(params)
-                }
-            }),
-    ))
-    .labelled("parameter type list")
-    .as_context()
+        declaration_scope(
+            parameter_declaration()
+                .separated_by(punctuator(Punctuator::Comma))
+                .collect::<Vec<ParameterDeclaration>>(),
+        )
+        .then(
+            punctuator(Punctuator::Comma)
+                .ignore_then(punctuator(Punctuator::Ellipsis))
+                .or_not(),
+        )
+        .map(|(params, variadic)| {
+            if variadic.is_some() {
+                ParameterTypeList::Variadic(params)
+            } else {
+                ParameterTypeList::Parameters(params)
+            }
+        }),
+    )))
+    .labelled_rule("parameter type list")
 }
 
 /// (6.7.6) parameter declaration
 pub fn parameter_declaration<'a>() -> impl Parser<'a, Tokens<'a>, ParameterDeclaration, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         attribute_specifier_sequence()
             .then(declaration_specifiers())
             .then(choice((
@@ -1124,24 +1262,23 @@ pub fn parameter_declaration<'a>() -> impl Parser<'a, Tokens<'a>, ParameterDecla
                     .map(Some),
                 abstract_declarator().map(ParameterDeclarationKind::Abstract).or_not(),
             )))
-            .map(|((attributes, specifiers), declarator)| ParameterDeclaration { attributes, specifiers, declarator }),
-    ))
-    .labelled("parameter declaration")
-    .as_context()
+            .map(|((attributes, specifiers), declarator)| ParameterDeclaration { attributes, specifiers, declarator })
+    )
+    .labelled_rule("parameter declaration")
 }
 
 /// (6.7.7) type name
 #[apply(cached)]
 pub fn type_name<'a>() -> impl Parser<'a, Tokens<'a>, TypeName, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        specifier_qualifier_list()
-            .then(abstract_declarator().or_not())
-            .map(|(specifiers, abstract_declarator)| TypeName::TypeName { specifiers, abstract_declarator }),
-    ))
-    .labelled("type name")
-    .as_context()
+    memoized(
+        "type name",
+        templated!(
+            specifier_qualifier_list()
+                .then(abstract_declarator().or_not())
+                .map(|(specifiers, abstract_declarator)| TypeName::TypeName { specifiers, abstract_declarator })
+        )
+        .labelled_rule("type name"),
+    )
 }
 
 /// (6.7.7) abstract declarator
@@ -1151,14 +1288,7 @@ pub fn abstract_declarator<'a>() -> impl Parser<'a, Tokens<'a>, AbstractDeclarat
         .then(abstract_declarator().map(Box::new).or_not())
         .map(|(pointer, abstract_declarator)| AbstractDeclarator::Pointer { pointer, abstract_declarator });
     let direct = direct_abstract_declarator().map(AbstractDeclarator::Direct);
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        pointer,
-        direct,
-    ))
-    .labelled("abstract declarator")
-    .as_context()
+    templated!(choice((pointer, direct,))).labelled_rule("abstract declarator")
 }
 
 /// (6.7.7) direct abstract declarator
@@ -1192,93 +1322,153 @@ pub fn direct_abstract_declarator<'a>() -> impl Parser<'a, Tokens<'a>, DirectAbs
     ))
     .repeated();
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         choice((
             parenthesized.map(Some).foldl(postfix.clone(), |acc, f| Some(f(acc))),
             empty().to(None).foldl(postfix.at_least(1), |acc, f| Some(f(acc))),
         ))
-        .unwrapped(),
-    ))
-    .labelled("direct abstract declarator")
-    .as_context()
+        .unwrapped()
+    )
+    .labelled_rule("direct abstract declarator")
 }
 
 /// (6.7.8) typedef name
 pub fn typedef_name<'a>() -> impl Parser<'a, Tokens<'a>, Identifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        identifier(),
-    ))
-    .try_map_with(|name, extra| {
-        if extra.state().ctx().is_typedef_name(&name) {
-            Ok(name)
-        } else {
-            Err(expected_found(
-                ["typedef name"],
-                Some(BalancedToken::Identifier(name)),
-                extra.span(),
-            ))
-        }
+    templated!(identifier())
+        .try_map_with(|name, extra| {
+            if extra.state().lookup_typedef_name(&name) {
+                Ok(name)
+            } else {
+                Err(expected_found(
+                    ["typedef name"],
+                    Some(BalancedToken::Identifier(name)),
+                    extra.span(),
+                ))
+            }
+        })
+        .labelled_rule("typedef name")
+}
+
+/// Check that the next token is parenthesized and starts with a keyword or a
+/// typedef name, so that it may hold the type name of a cast or compound
+/// literal, without reading it.
+///
+/// Whether an identifier names a type depends on the scopes at that point, so
+/// this takes the place of a lookahead over the whole unit: a parenthesized
+/// expression fails here at its first token, rather than after trying the
+/// alternatives of a type name. Identifiers starting with `_` are taken to be
+/// keywords, as extensions such as `__typeof__` are.
+fn parenthesized_type_start<'a>() -> impl Parser<'a, Tokens<'a>, (), Extra<'a>> + Clone {
+    let keywords: FxHashSet<Symbol> = TYPE_SPECIFIERS
+        .iter()
+        .map(|&(kwd, _)| kwd)
+        .chain(TYPE_QUALIFIERS.iter().map(|&(kwd, _)| kwd))
+        .chain(STORAGE_CLASS_SPECIFIERS.iter().map(|&(kwd, _)| kwd))
+        .chain(["struct", "union", "enum", "typeof", "typeof_unqual", "alignas"])
+        .map(Symbol::intern)
+        .collect();
+    custom(move |inp| {
+        let Some(Token::Parenthesized(group)) = inp.peek_ref() else {
+            let before = inp.cursor();
+            return Err(expected_found(["type name"], None, inp.span_since(&before)));
+        };
+        let Some(first) = group.tokens.first() else {
+            return Err(expected_found(["type name"], None, group.eoi));
+        };
+        let found = match &first.value {
+            Token::Identifier(name)
+                if keywords.contains(&name.0) || name.0.starts_with('_') || inp.state().lookup_typedef_name(name) =>
+            {
+                return Ok(());
+            }
+            #[cfg(feature = "quasi-quote")]
+            Token::Template(_) | Token::Interpolation(_) => return Ok(()),
+            // Report groups by their bracket rather than copying them
+            Token::Parenthesized(_) => Token::Punctuator(Punctuator::LeftParen),
+            Token::Bracketed(_) => Token::Punctuator(Punctuator::LeftBracket),
+            Token::Braced(_) => Token::Punctuator(Punctuator::LeftBrace),
+            token => token.clone(),
+        };
+        Err(expected_found(["type name"], Some(found), first.span))
     })
-    .labelled("typedef name")
-    .as_context()
 }
 
 /// (6.7.10) braced initializer
 #[apply(cached)]
 pub fn braced_initializer<'a>() -> impl Parser<'a, Tokens<'a>, BracedInitializer, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         designated_initializer()
             .separated_by(punctuator(Punctuator::Comma))
             .allow_trailing()
             .collect::<Vec<DesignatedInitializer>>()
             .braced()
-            .map(|initializers| BracedInitializer { initializers }),
-    ))
-    .labelled("braced initializer")
-    .as_context()
+            .map(|initializers| BracedInitializer { initializers })
+    )
+    .labelled_rule("braced initializer")
 }
 
 /// (6.7.10) initializer
+///
+/// Braced initializers of constants only are taken as a whole when
+/// [`State::compact_initializers`] is set, without parsing each constant as
+/// an expression.
 #[apply(cached)]
 pub fn initializer<'a>() -> impl Parser<'a, Tokens<'a>, Initializer, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        braced_initializer().map(Initializer::Braced),
+    let braced = braced_initializer().map(Initializer::Braced);
+    let braced = custom(move |inp| {
+        if inp.state().compact_initializers()
+            && let Some(Token::Braced(group)) = inp.peek_ref()
+            && let Some(constants) = constant_list(group)
+        {
+            inp.next_ref();
+            return Ok(Initializer::Constants(ConstantInitializer { constants }));
+        }
+        inp.parse(&braced)
+    });
+    templated!(choice((
+        braced,
         assignment_expression()
             .map(Brand::into_inner)
             .map(Box::new)
             .map(Initializer::Expression),
-    ))
-    .labelled("initializer")
-    .as_context()
+    )))
+    .labelled_rule("initializer")
+}
+
+/// The constants of `group` if it is a list of constants, e.g. `0x12, 0x34`,
+/// with an optional trailing comma.
+fn constant_list(group: &BalancedTokenSequence) -> Option<Vec<Spanned<Constant>>> {
+    // Checked before anything is copied, since most lists hold other tokens
+    let constant = |token: &Spanned<Token>| matches!(token.value, Token::Constant(_));
+    let comma = |token: &Spanned<Token>| token.value == Token::Punctuator(Punctuator::Comma);
+    let pairs = group.tokens.chunks(2);
+    let is_list = pairs
+        .clone()
+        .all(|pair| constant(&pair[0]) && pair.get(1).is_none_or(comma));
+    if !group.closed || group.tokens.is_empty() || !is_list {
+        return None;
+    }
+    let constants = pairs.map(|pair| match &pair[0].value {
+        Token::Constant(value) => Spanned::new(value.clone(), pair[0].span),
+        _ => unreachable!("Checked above"),
+    });
+    Some(constants.collect())
 }
 
 /// (6.7.10) designated initializer
 pub fn designated_initializer<'a>() -> impl Parser<'a, Tokens<'a>, DesignatedInitializer, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         designation()
             .or_not()
             .then(initializer())
-            .map(|(designation, initializer)| DesignatedInitializer { designation, initializer }),
-    ))
-    .labelled("designated initializer")
-    .as_context()
+            .map(|(designation, initializer)| DesignatedInitializer { designation, initializer })
+    )
+    .labelled_rule("designated initializer")
 }
 
 /// (6.7.10) designation
 pub fn designation<'a>() -> impl Parser<'a, Tokens<'a>, Designation, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         empty()
             .to(None)
             .foldl(designator().repeated().at_least(1), |designation, designator| {
@@ -1288,17 +1478,14 @@ pub fn designation<'a>() -> impl Parser<'a, Tokens<'a>, Designation, Extra<'a>>
                 })
             })
             .unwrapped()
-            .then_ignore(punctuator(Punctuator::Assign)),
-    ))
-    .labelled("designation")
-    .as_context()
+            .then_ignore(punctuator(Punctuator::Assign))
+    )
+    .labelled_rule("designation")
 }
 
 /// (6.7.10) designator
 pub fn designator<'a>() -> impl Parser<'a, Tokens<'a>, Designator, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         constant_expression()
             .bracketed()
             .recover_with(recover_bracketed(ConstantExpression::Error))
@@ -1306,16 +1493,13 @@ pub fn designator<'a>() -> impl Parser<'a, Tokens<'a>, Designator, Extra<'a>> +
         punctuator(Punctuator::Dot)
             .ignore_then(identifier())
             .map(Designator::Member),
-    ))
-    .labelled("designator")
-    .as_context()
+    )))
+    .labelled_rule("designator")
 }
 
 /// (6.7.11) static assert declaration
 pub fn static_assert_declaration<'a>() -> impl Parser<'a, Tokens<'a>, StaticAssertDeclaration, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         keyword("static_assert")
             .or(keyword("_Static_assert"))
             .ignore_then(
@@ -1324,10 +1508,9 @@ pub fn static_assert_declaration<'a>() -> impl Parser<'a, Tokens<'a>, StaticAsse
                     .parenthesized(), // TODO: error recovery
             )
             .then_ignore(punctuator(Punctuator::Semicolon))
-            .map(|(condition, message)| StaticAssertDeclaration { condition, message }),
-    ))
-    .labelled("static assert declaration")
-    .as_context()
+            .map(|(condition, message)| StaticAssertDeclaration { condition, message })
+    )
+    .labelled_rule("static assert declaration")
 }
 
 // =============================================================================
@@ -1337,14 +1520,13 @@ pub fn static_assert_declaration<'a>() -> impl Parser<'a, Tokens<'a>, StaticAsse
 /// (6.8) statement
 #[apply(cached)]
 pub fn statement<'a>() -> impl Parser<'a, Tokens<'a>, Statement, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        labelled_statement().map_with(|l, e| Statement::new(StatementKind::Labeled(l), e.span())),
-        unlabeled_statement().map_with(|u, e| Statement::new(StatementKind::Unlabeled(u), e.span())),
-    ))
-    .labelled("statement")
-    .as_context()
+    nesting(
+        templated!(choice((
+            labelled_statement().map_with(|l, e| Statement::new(StatementKind::Labeled(l), e.span())),
+            unlabeled_statement().map_with(|u, e| Statement::new(StatementKind::Unlabeled(u), e.span())),
+        )))
+        .labelled_rule("statement"),
+    )
 }
 
 /// (6.8) unlabeled statement
@@ -1352,7 +1534,7 @@ pub fn statement<'a>() -> impl Parser<'a, Tokens<'a>, Statement, Extra<'a>> + Cl
 pub fn unlabeled_statement<'a>() -> impl Parser<'a, Tokens<'a>, UnlabeledStatement, Extra<'a>> + Clone {
     let primary_block = attribute_specifier_sequence()
         .then(choice((
-            compound_statement().map(PrimaryBlock::Compound),
+            block().map(PrimaryBlock::Compound),
             selection_statement().map(PrimaryBlock::Selection),
             iteration_statement().map(PrimaryBlock::Iteration),
         )))
@@ -1364,15 +1546,7 @@ pub fn unlabeled_statement<'a>() -> impl Parser<'a, Tokens<'a>, UnlabeledStateme
 
     let expr = expression_statement().map(UnlabeledStatement::Expression);
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        primary_block,
-        jump,
-        expr,
-    ))
-    .labelled("unlabeled statement")
-    .as_context()
+    templated!(choice((primary_block, jump, expr,))).labelled_rule("unlabeled statement")
 }
 
 /// (6.8.1) label
@@ -1393,94 +1567,90 @@ pub fn label<'a>() -> impl Parser<'a, Tokens<'a>, Label, Extra<'a>> + Clone {
         .then_ignore(punctuator(Punctuator::Colon))
         .map(|(attributes, identifier)| Label::Identifier { attributes, identifier });
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        case_label,
-        default_label,
-        ident_label,
-    ))
-    .labelled("label")
-    .as_context()
+    templated!(choice((case_label, default_label, ident_label,))).labelled_rule("label")
 }
 
 /// (6.8.1) labeled statement
 pub fn labelled_statement<'a>() -> impl Parser<'a, Tokens<'a>, LabeledStatement, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         label()
             .then(statement().map(Box::new))
-            .map(|(label, statement)| LabeledStatement { label, statement }),
-    ))
-    .labelled("labeled statement")
-    .as_context()
+            .map(|(label, statement)| LabeledStatement { label, statement })
+    )
+    .labelled_rule("labeled statement")
 }
 
 /// (6.8.2) compound statement
 #[apply(cached)]
 pub fn compound_statement<'a>() -> impl Parser<'a, Tokens<'a>, CompoundStatement, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        block_item()
-            .repeated()
-            .collect::<Vec<BlockItem>>()
+    templated!(
+        declaration_scope(block_item().repeated().collect::<Vec<BlockItem>>())
             .braced()
-            .map(|items| CompoundStatement { items }),
-    ))
-    .labelled("compound statement")
-    .as_context()
+            .map(|items| CompoundStatement { items })
+    )
+    .labelled_rule("compound statement")
 }
 
 /// (6.8.2) block item
 pub fn block_item<'a>() -> impl Parser<'a, Tokens<'a>, BlockItem, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         declaration().map(BlockItem::Declaration),
         label().map(BlockItem::Label),
         unlabeled_statement().map(BlockItem::Statement),
-    ))
-    .labelled("block item")
-    .as_context()
+    )))
+    .labelled_rule("block item")
 }
 
 /// (6.8.3) expression statement
 pub fn expression_statement<'a>() -> impl Parser<'a, Tokens<'a>, ExpressionStatement, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         attribute_specifier_sequence()
             .then(
                 expression()
                     .map(Box::new)
                     .or_not()
                     .then_ignore(punctuator(Punctuator::Semicolon))
-                    .recover_with(skip_until(any().ignored(), punctuator(Punctuator::Semicolon), || {
+                    .recover_with(recover_skip_until(punctuator(Punctuator::Semicolon), || {
                         Some(Box::new(Expression::dummy(ExpressionKind::Error)))
                     })),
             )
-            .map(|(attributes, expression)| ExpressionStatement { attributes, expression }),
-    ))
-    .labelled("expression statement")
-    .as_context()
+            .map(|(attributes, expression)| ExpressionStatement { attributes, expression })
+    )
+    .labelled_rule("expression statement")
 }
 
 /// (6.8.4) selection statement
 pub fn selection_statement<'a>() -> impl Parser<'a, Tokens<'a>, SelectionStatement, Extra<'a>> + Clone {
-    let if_stmt = keyword("if")
+    let if_head = keyword("if").ignore_then(
+        expression()
+            .parenthesized()
+            .recover_with(recover_parenthesized_with(|span| {
+                Expression::new(ExpressionKind::Error, span)
+            }))
+            .map(Box::new),
+    );
+    // `else if` chains are collected in a loop instead of recursing through
+    // `statement`, and nested afterwards
+    let else_if = keyword("else")
         .ignore_then(
-            expression()
-                .parenthesized()
-                .recover_with(recover_parenthesized_with(|span| {
-                    Expression::new(ExpressionKind::Error, span)
-                }))
-                .map(Box::new),
+            if_head
+                .clone()
+                .map_with(|condition, extra| (extra.span().range().start, condition)),
         )
+        .then(statement().map(Box::new));
+    let if_stmt = if_head
         .then(statement().map(Box::new))
+        .then(else_if.repeated().collect::<Vec<_>>())
         .then(keyword("else").ignore_then(statement().map(Box::new)).or_not())
-        .map(|((condition, then_stmt), else_stmt)| SelectionStatement::If { condition, then_stmt, else_stmt });
+        .map_with(|(((condition, then_stmt), else_ifs), mut else_stmt), extra| {
+            let end = extra.span().range().end;
+            for ((start, condition), then_stmt) in else_ifs.into_iter().rev() {
+                let block = PrimaryBlock::Selection(SelectionStatement::If { condition, then_stmt, else_stmt });
+                let kind = StatementKind::Unlabeled(UnlabeledStatement::Primary { attributes: Vec::new(), block });
+                else_stmt = Some(Box::new(Statement::new(kind, Span::new(start..end))));
+            }
+            SelectionStatement::If { condition, then_stmt, else_stmt }
+        });
 
     let switch_stmt = keyword("switch")
         .ignore_then(
@@ -1494,14 +1664,7 @@ pub fn selection_statement<'a>() -> impl Parser<'a, Tokens<'a>, SelectionStateme
         .then(statement().map(Box::new))
         .map(|(expression, statement)| SelectionStatement::Switch { expression, statement });
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        if_stmt,
-        switch_stmt,
-    ))
-    .labelled("selection statement")
-    .as_context()
+    templated!(choice((if_stmt, switch_stmt,))).labelled_rule("selection statement")
 }
 
 /// (6.8.5) iteration statement
@@ -1550,15 +1713,7 @@ pub fn iteration_statement<'a>() -> impl Parser<'a, Tokens<'a>, IterationStateme
         .then(statement().map(Box::new))
         .map(|(((init, condition), update), body)| IterationStatement::For { init, condition, update, body });
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        while_stmt,
-        do_while_stmt,
-        for_stmt,
-    ))
-    .labelled("iteration statement")
-    .as_context()
+    templated!(choice((while_stmt, do_while_stmt, for_stmt,))).labelled_rule("iteration statement")
 }
 
 /// (6.8.6) jump statement
@@ -1581,16 +1736,7 @@ pub fn jump_statement<'a>() -> impl Parser<'a, Tokens<'a>, JumpStatement, Extra<
         .then_ignore(punctuator(Punctuator::Semicolon))
         .map(|expr| JumpStatement::Return(expr.map(Box::new)));
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        goto_stmt,
-        continue_stmt,
-        break_stmt,
-        return_stmt,
-    ))
-    .labelled("jump statement")
-    .as_context()
+    templated!(choice((goto_stmt, continue_stmt, break_stmt, return_stmt,))).labelled_rule("jump statement")
 }
 
 // =============================================================================
@@ -1600,91 +1746,92 @@ pub fn jump_statement<'a>() -> impl Parser<'a, Tokens<'a>, JumpStatement, Extra<
 /// (6.7.12.1) attribute specifier sequence
 #[apply(cached)]
 pub fn attribute_specifier_sequence<'a>() -> impl Parser<'a, Tokens<'a>, Vec<AttributeSpecifier>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        attribute_specifier().repeated().collect::<Vec<AttributeSpecifier>>(),
-    ))
-    .labelled("attribute specifier sequence")
-    .as_context()
+    templated!(
+        attribute_specifier()
+            .repeated()
+            .collect::<ShortList<AttributeSpecifier>>()
+            .map(ShortList::into_vec)
+    )
+    .labelled_rule("attribute specifier sequence")
 }
 
 /// (6.7.12.1) attribute specifier
 pub fn attribute_specifier<'a>() -> impl Parser<'a, Tokens<'a>, AttributeSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        old_fashioned_attribute_specifier(),
-        asm_attribute_specifier(),
-        attribute_list()
-            .map(AttributeSpecifier::Attributes) // TODO: error recovery
-            .bracketed()
-            .bracketed(),
-    ))
-    .labelled("attribute specifier")
-    .as_context()
+    let standard = attribute_list()
+        .map(AttributeSpecifier::Attributes) // TODO: error recovery
+        .bracketed()
+        .bracketed();
+    let alternatives = if Dialect::current().gnu() {
+        choice((old_fashioned_attribute_specifier(), asm_attribute_specifier(), standard)).boxed()
+    } else {
+        standard.boxed()
+    };
+    templated!(alternatives).labelled_rule("attribute specifier")
 }
 
 /// (extension) old fashioned (`__attribute__`) attribute specifier
 #[apply(cached)]
 pub fn old_fashioned_attribute_specifier<'a>() -> impl Parser<'a, Tokens<'a>, AttributeSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         keyword("__attribute__").ignore_then(
             attribute_list()
                 .parenthesized()
                 .parenthesized()
                 .map(AttributeSpecifier::Attributes)
                 .recover_with(recover_parenthesized(AttributeSpecifier::Error)),
-        ),
-    ))
-    .labelled("old fashioned attribute specifier")
-    .as_context()
+        )
+    )
+    .labelled_rule("old fashioned attribute specifier")
 }
 
 /// (extension) asm attribute specifier
 pub fn asm_attribute_specifier<'a>() -> impl Parser<'a, Tokens<'a>, AttributeSpecifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         choice((keyword("__asm"), keyword("__asm__"))).ignore_then(
-            string_literal()
+            shared_string_literal()
                 .map(AttributeSpecifier::Asm)
                 .parenthesized()
                 .recover_with(recover_parenthesized(AttributeSpecifier::Error)),
-        ),
-    ))
-    .labelled("asm attribute specifier")
-    .as_context()
+        )
+    )
+    .labelled_rule("asm attribute specifier")
 }
 
 /// (6.7.12.1) attribute list
 pub fn attribute_list<'a>() -> impl Parser<'a, Tokens<'a>, Vec<Attribute>, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         attribute()
             .separated_by(punctuator(Punctuator::Comma))
             .allow_trailing()
-            .collect::<Vec<Attribute>>(),
-    ))
-    .labelled("attribute list")
-    .as_context()
+            .collect::<Vec<Attribute>>()
+    )
+    .labelled_rule("attribute list")
 }
 
 /// (6.7.12.1) attribute
 #[apply(cached)]
 pub fn attribute<'a>() -> impl Parser<'a, Tokens<'a>, Attribute, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        attribute_token()
-            .then(attribute_argument_clause().or_not())
-            .map(|(token, arguments)| Attribute { token, arguments }),
+    templated!(attribute_token().then(attribute_argument_clause().or_not()).validate(
+        |(token, arguments), extra, emitter| {
+            let state = extra.state();
+            let value = match (&arguments, state.attribute_parsers().cloned()) {
+                (Some(arguments), Some(parsers)) => parsers.parse(&token, arguments, state),
+                _ => None,
+            };
+            let value = value.and_then(|(value, errors)| {
+                if !errors.is_empty() {
+                    // Reported with the main parse, and never memoized
+                    state.record_recovery();
+                }
+                for error in errors {
+                    emitter.emit(error.into_owned());
+                }
+                value
+            });
+            Attribute { token, arguments, value }
+        }
     ))
-    .labelled("attribute")
-    .as_context()
+    .labelled_rule("attribute")
 }
 
 /// (6.7.12.1) attribute token
@@ -1694,18 +1841,17 @@ pub fn attribute_token<'a>() -> impl Parser<'a, Tokens<'a>, AttributeToken, Extr
         .then_ignore(punctuator(Punctuator::Scope))
         .then(identifier_or_keyword());
 
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(choice((
         prefixed.map(|(prefix, identifier)| AttributeToken::Prefixed { prefix, identifier }),
         standard.map(AttributeToken::Standard),
-    ))
-    .labelled("attribute token")
-    .as_context()
+    )))
+    .labelled_rule("attribute token")
 }
 
 /// (6.7.12.1) attribute argument clause
-pub fn attribute_argument_clause<'a>() -> impl Parser<'a, Tokens<'a>, TokenStream, Extra<'a>> + Clone {
+///
+/// The tokens are shared with the group of the input, not copied.
+pub fn attribute_argument_clause<'a>() -> impl Parser<'a, Tokens<'a>, Arc<TokenStream>, Extra<'a>> + Clone {
     select_ref! {
         Token::Parenthesized(tokens) => tokens.clone(),
     }
@@ -1717,44 +1863,250 @@ pub fn attribute_argument_clause<'a>() -> impl Parser<'a, Tokens<'a>, TokenStrea
 
 /// (6.9) translation unit
 pub fn translation_unit<'a>() -> impl Parser<'a, Tokens<'a>, TranslationUnit, Extra<'a>> + Clone {
-    external_declaration()
+    let recovering = external_declaration();
+    let fast = no_recover(recovering.clone());
+    let resynchronizing = fast.clone().recover_with(recover_to_declaration_boundary());
+    let external_declaration = custom(move |inp| {
+        if inp.state().check_budget() {
+            let before = inp.cursor();
+            let message = inp.state().budget_message();
+            return Err(Rich::custom(inp.span_since(&before), message));
+        }
+        if inp.state().resynchronize() {
+            return inp.parse(&resynchronizing);
+        }
+        if !inp.state().two_pass() {
+            return inp.parse(&recovering);
+        }
+        let before = inp.save();
+        let start = Instant::now();
+        let fast = inp.parse(&fast);
+        let fast_time = start.elapsed();
+        let stats = inp.state().two_pass_stats_mut().expect("Two-pass parsing is enabled");
+        stats.fast_time += fast_time;
+        if fast.is_ok() {
+            stats.fast_declarations += 1;
+            return fast;
+        }
+
+        inp.rewind(before);
+        let start = Instant::now();
+        let recovered = inp.parse(&recovering);
+        let recovery_time = start.elapsed();
+        let stats = inp.state().two_pass_stats_mut().expect("Two-pass parsing is enabled");
+        stats.recovery_time += recovery_time;
+        stats.recovered_declarations += recovered.is_ok() as usize;
+        recovered
+    });
+    #[cfg(feature = "tracing")]
+    let external_declaration = traced_declaration(external_declaration);
+
+    let unit = custom(|inp| {
+        inp.state().reset_nesting();
+        Ok(())
+    })
+    .ignore_then(
+        external_declaration
+            .map_with(|external_declaration, extra| {
+                // Nothing rewinds into a completed external declaration
+                extra.state().finish_external_declaration();
+                extra.state().commit();
+                if extra.state().max_memory().is_some() {
+                    let bytes = size_of::<ExternalDeclaration>() + external_declaration.heap_size();
+                    extra.state().record_memory(bytes);
+                }
+                external_declaration
+            })
+            .repeated()
+            .collect::<Vec<ExternalDeclaration>>(),
+    )
+    .then_ignore(
+        // Skip the rest of the input once the budget is exceeded
+        custom(|inp| {
+            if inp.state().budget_exceeded() {
+                let before = inp.cursor();
+                let message = inp.state().budget_message();
+                return Err(Rich::custom(inp.span_since(&before), message));
+            }
+            Ok(())
+        })
+        .recover_with(via_parser(any().repeated())),
+    )
+    .map(|external_declarations| TranslationUnit { external_declarations })
+    .labelled_rule("translation unit");
+    #[cfg(feature = "tracing")]
+    let unit = traced_unit(unit);
+    unit
+}
+
+/// Build the parser on this thread and compile the patterns of the lexer,
+/// ahead of the first parse.
+///
+/// The recursive rules of the parser are built on first use on each thread,
+/// and the patterns of the lexer on first use in the process, so otherwise
+/// the first parse on a thread pays for them. Call this at startup, or when a
+/// worker thread starts. With the `sync` feature, the rules are shared by all
+/// threads, so calling this once at startup is enough.
+pub fn warm_up() {
+    // Uses every kind of literal, so that every pattern is compiled
+    const SOURCE: &str = "typedef struct s { int a : 1; } t; enum e { A = 0x1 + 01 + 0b1 + 0o1 + 1ull }; \
+                          t f(t *p, ...) { return (t) { .a = 1.0f + 0x1p1 + 'c' + \"s\"[0] }; }";
+    let (tokens, _) = crate::lex(SOURCE, None);
+    let _ = translation_unit().parse(tokens.as_input());
+}
+
+/// Check whether `tokens` are a valid translation unit, updating `state` as
+/// [`translation_unit`] does, e.g. with the typedef names declared.
+///
+/// The external declarations are parsed without error recovery, so the check
+/// stops at the first error, and each is dropped as soon as it is parsed, so
+/// no tree of the unit is built. Turn [`State::rule_labels`] off for cheaper
+/// errors when only the outcome matters.
+///
+/// With the `arena` feature, the parse runs in [`arena::scratch`], so that the
+/// trees and errors it drops are allocated apart from longer-lived memory.
+///
+/// [`arena::scratch`]: crate::arena::scratch
+pub fn validate<'a>(tokens: &'a BalancedTokenSequence, state: &mut State) -> Result<(), Vec<Error<'a>>> {
+    #[cfg(feature = "arena")]
+    return crate::arena::scratch(|| validate_unit(tokens, state));
+    #[cfg(not(feature = "arena"))]
+    validate_unit(tokens, state)
+}
+
+fn validate_unit<'a>(tokens: &'a BalancedTokenSequence, state: &mut State) -> Result<(), Vec<Error<'a>>> {
+    // Parsed rather than checked: rules declare names in `map_with`, which
+    // chumsky skips when it checks a parser
+    no_recover(external_declaration())
+        .map_with(|_, extra| {
+            extra.state().finish_external_declaration();
+            extra.state().commit();
+        })
         .repeated()
-        .collect::<Vec<ExternalDeclaration>>()
-        .map(|external_declarations| TranslationUnit { external_declarations })
-        .labelled("translation unit")
-        .as_context()
+        .then_ignore(end())
+        .parse_with_state(tokens.as_input(), state)
+        .into_result()
 }
 
 /// (6.9) external declaration
+///
+/// A function definition is tried first, unless a scan of the top-level
+/// tokens ahead finds that they cannot hold one, as is the case for most of
+/// the declarations of headers.
 pub fn external_declaration<'a>() -> impl Parser<'a, Tokens<'a>, ExternalDeclaration, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    let declaration = declaration().map(ExternalDeclaration::Declaration);
+    let alternatives = templated!(choice((
         function_definition().map(ExternalDeclaration::Function),
-        declaration().map(ExternalDeclaration::Declaration),
-    ))
-    .labelled("external declaration")
-    .as_context()
+        declaration.clone(),
+    )));
+    let declaration = no_recover(declaration);
+    let skipped = 1 + Dialect::current().templates() as u64;
+    custom(move |inp| {
+        if declaration_ahead(inp) {
+            predicted(inp, "external declaration", skipped, &declaration, &alternatives)
+        } else {
+            inp.parse(&alternatives)
+        }
+    })
+    .labelled_rule("external declaration")
+}
+
+/// Check whether the external declaration ahead cannot be a function
+/// definition, without consuming the input.
+///
+/// The body of a function follows its declarator, whose last token is its
+/// parameter list or an attribute, and there is no top-level `;`, `=` or `,`
+/// before it. Braces after anything else are the members of a structure or
+/// enumeration, so the scan goes on past them. Templates may stand for
+/// anything, so they stop the scan.
+fn declaration_ahead<'a>(inp: &mut InputRef<'a, '_, Tokens<'a>, Extra<'a>>) -> bool {
+    let before = inp.save();
+    let mut after_group = false;
+    let ahead = loop {
+        match inp.next_ref() {
+            Some(Token::Punctuator(Punctuator::Semicolon | Punctuator::Assign | Punctuator::Comma)) => break true,
+            Some(Token::Braced(_)) if after_group => break false,
+            #[cfg(feature = "quasi-quote")]
+            Some(Token::Template(_) | Token::Interpolation(_)) => break false,
+            Some(token) => after_group = matches!(token, Token::Parenthesized(_) | Token::Bracketed(_)),
+            None => break false,
+        }
+    };
+    inp.rewind(before);
+    ahead
 }
 
 /// (6.9.1) function definition
 pub fn function_definition<'a>() -> impl Parser<'a, Tokens<'a>, FunctionDefinition, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
+    templated!(
         attribute_specifier_sequence()
             .then(declaration_specifiers())
-            .then(declarator())
-            .then(compound_statement())
-            .map(|(((attributes, specifiers), declarator), body)| FunctionDefinition {
+            .then(declarator().map_with(|declarator, extra| {
+                if let Some(ident) = declarator.identifier() {
+                    extra.state().declare_as(*ident, DeclaredKind::Function, extra.span());
+                }
+                declarator
+            }))
+            .then(function_body())
+            .map_with(|(((attributes, specifiers), declarator), body), e| FunctionDefinition {
                 attributes,
                 specifiers,
                 declarator,
                 body,
-            }),
-    ))
-    .labelled("function definition")
-    .as_context()
+                span: e.span(),
+            })
+    )
+    .labelled_rule("function definition")
+}
+
+/// (6.9.1) function body
+///
+/// Parsed eagerly, unless [`State::lazy_function_bodies`] is set.
+pub fn function_body<'a>() -> impl Parser<'a, Tokens<'a>, FunctionBody, Extra<'a>> + Clone {
+    lazy_block(State::lazy_function_bodies)
+}
+
+/// (6.8.2) compound statement of a primary block
+///
+/// Parsed eagerly, unless [`State::lazy_blocks`] is set.
+pub fn block<'a>() -> impl Parser<'a, Tokens<'a>, Block, Extra<'a>> + Clone {
+    lazy_block(State::lazy_blocks)
+}
+
+/// A compound statement, kept unparsed with a snapshot of the state when
+/// `lazy` holds for the state.
+fn lazy_block<'a>(lazy: fn(&State) -> bool) -> impl Parser<'a, Tokens<'a>, Block, Extra<'a>> + Clone {
+    let eager = compound_statement().map(Block::from);
+    let dialect = Dialect::current();
+    let unparsed = choice((
+        select_ref! {
+            Token::Braced(tokens) => TokenStream::clone(tokens),
+        }
+        .map_with(move |tokens, extra| Block::lazy_in(tokens, extra.state().clone(), dialect)),
+        eager.clone(),
+    ));
+    custom(move |inp| {
+        if lazy(inp.state()) {
+            inp.parse(&unparsed)
+        } else {
+            inp.parse(&eager)
+        }
+    })
+}
+
+/// Parse the tokens inside the braces of a lazy block, in `dialect`.
+pub(crate) fn parse_function_body(
+    tokens: &BalancedTokenSequence,
+    state: &mut State,
+    dialect: Dialect,
+) -> (CompoundStatement, Vec<Error<'static>>) {
+    let (items, errors) = with_dialect(dialect, block_item)
+        .repeated()
+        .collect::<Vec<BlockItem>>()
+        .parse_with_state(tokens.as_input(), state)
+        .into_output_errors();
+    let body = CompoundStatement { items: items.unwrap_or_default() };
+    (body, errors.into_iter().map(|error| error.into_owned()).collect())
 }
 
 // =============================================================================
@@ -1763,63 +2115,59 @@ pub fn function_definition<'a>() -> impl Parser<'a, Tokens<'a>, FunctionDefiniti
 
 /// Parse an identifier or keyword token.
 pub fn identifier_or_keyword<'a>() -> impl Parser<'a, Tokens<'a>, Identifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        select_ref! {
-            Token::Identifier(value) => value.clone(),
-        },
-    ))
+    templated!(select_ref! {
+        Token::Identifier(value) => *value,
+    })
 }
 
 /// Parse an identifier (excluding keywords).
 pub fn identifier<'a>() -> impl Parser<'a, Tokens<'a>, Identifier, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        identifier_or_keyword().try_map(|id, span| match id.as_ref() {
-            "auto" | "break" | "case" | "char" | "const" | "continue" | "default" | "do" | "double" | "else"
-            | "enum" | "extern" | "float" | "for" | "goto" | "if" | "inline" | "int" | "long" | "register"
-            | "restrict" | "return" | "short" | "signed" | "sizeof" | "static" | "struct" | "switch" | "typedef"
-            | "union" | "unsigned" | "void" | "volatile" | "_Alignas" => {
-                Err(expected_found(["identifier"], Some(Token::Identifier(id)), span))
-            }
-            _ => Ok(id),
-        }),
-    ))
+    templated!(identifier_or_keyword().try_map(|id, span| {
+        if id.0.is_reserved() {
+            Err(expected_found(["identifier"], Some(Token::Identifier(id)), span))
+        } else {
+            Ok(id)
+        }
+    }))
 }
 
 /// Parse a constant token.
 pub fn constant<'a>() -> impl Parser<'a, Tokens<'a>, Constant, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        select_ref! {
-            Token::Constant(value) => value.clone(),
-        },
-    ))
+    templated!(select_ref! {
+        Token::Constant(value) => value.clone(),
+    })
 }
 
 /// Parse a string literal token.
 pub fn string_literal<'a>() -> impl Parser<'a, Tokens<'a>, StringLiterals, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        select_ref! {
-            Token::StringLiteral(value) => value.clone(),
-        },
-    ))
+    templated!(select_ref! {
+        Token::StringLiteral(value) => StringLiterals::clone(value),
+    })
+}
+
+/// Parse a string literal token, shared with the token of the input rather
+/// than copied, see [`attribute_argument_clause`].
+///
+/// For payloads that are large and seldom read, such as the strings of asm
+/// labels, which are kept as they are rather than parsed.
+pub fn shared_string_literal<'a>() -> impl Parser<'a, Tokens<'a>, Arc<StringLiterals>, Extra<'a>> + Clone {
+    let shared = select_ref! {
+        Token::StringLiteral(value) => value.clone(),
+    };
+    #[cfg(feature = "quasi-quote")]
+    let shared = if Dialect::current().templates() {
+        choice((interpolation().map(Arc::new), shared)).boxed()
+    } else {
+        shared.boxed()
+    };
+    shared
 }
 
 /// Parse a quoted string token.
 pub fn quoted_string<'a>() -> impl Parser<'a, Tokens<'a>, String, Extra<'a>> + Clone {
-    choice((
-        #[cfg(feature = "quasi-quote")]
-        interpolation(),
-        select_ref! {
-            Token::QuotedString(value) => value.clone(),
-        },
-    ))
+    templated!(select_ref! {
+        Token::QuotedString(value) => value.clone(),
+    })
 }
 
 #[cfg(feature = "quasi-quote")]
@@ -1839,8 +2187,24 @@ pub fn interpolation<'a, T: quasi_quote::Interpolate>() -> impl Parser<'a, Token
 
 /// Parse a specific keyword.
 pub fn keyword<'a>(kwd: &str) -> impl Parser<'a, Tokens<'a>, (), Extra<'a>> + Clone {
+    // Interned once when the parser is built, so matching is an integer compare
+    let kwd = Symbol::intern(kwd);
+    select_ref! {
+        Token::Identifier(name) if name.0 == kwd => ()
+    }
+}
+
+/// Parse any of the keywords in `table`, producing the value of the matching
+/// keyword with a single lookup.
+pub fn keyword_table<'a, O: Clone>(
+    table: impl IntoIterator<Item = (&'static str, O)>,
+) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone {
+    let table: FxHashMap<Symbol, O> = table
+        .into_iter()
+        .map(|(kwd, value)| (Symbol::intern(kwd), value))
+        .collect();
     select_ref! {
-        Token::Identifier(name) if name.as_ref() == kwd => ()
+        Token::Identifier(name) if table.contains_key(&name.0) => table[&name.0].clone()
     }
 }
 
@@ -1860,6 +2224,121 @@ where
     map_ctx(|_| Context { no_recover: true }, parser)
 }
 
+/// Parse `alternative`, which the next tokens predict to be the first of the
+/// alternatives of `fallback` to succeed, after `skipped` alternatives which
+/// would have failed there.
+///
+/// If the prediction is wrong, the input is rewound and `fallback` parsed in
+/// full, so that errors are the same as without the prediction. With the
+/// `profile` feature, the skipped attempts are recorded as avoided for the
+/// rule with the given label.
+#[cfg_attr(not(feature = "profile"), allow(unused_variables))]
+fn predicted<'a, O>(
+    inp: &mut InputRef<'a, '_, Tokens<'a>, Extra<'a>>,
+    label: &'static str,
+    skipped: u64,
+    alternative: &impl Parser<'a, Tokens<'a>, O, Extra<'a>>,
+    fallback: &impl Parser<'a, Tokens<'a>, O, Extra<'a>>,
+) -> Result<O, Error<'a>> {
+    let before = inp.save();
+    match inp.parse(alternative) {
+        Ok(output) => {
+            #[cfg(feature = "profile")]
+            {
+                if let Some(profile) = inp.state().profile_mut() {
+                    profile.avoid(label, skipped);
+                }
+                crate::profile::avoid_totals(label, skipped);
+            }
+            Ok(output)
+        }
+        Err(_) => {
+            inp.rewind(before);
+            inp.parse(fallback)
+        }
+    }
+}
+
+/// Count a level of nesting around the given parser, failing if that exceeds
+/// [`State::max_nesting_depth`].
+pub fn nesting<'a, A, O>(parser: A) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
+{
+    custom(move |inp| {
+        if !inp.state().enter_nesting() {
+            let before = inp.cursor();
+            let message = if inp.state().budget_exceeded() {
+                inp.state().budget_message()
+            } else {
+                "nesting too deep"
+            };
+            return Err(Rich::custom(inp.span_since(&before), message));
+        }
+        let result = inp.parse(&parser);
+        inp.state().exit_nesting();
+        result
+    })
+}
+
+/// Memoize successful parses of a rule that is often tried again at the same
+/// position, if enabled by [`State::set_memoize`].
+///
+/// The rule must leave the scopes as it found them, apart from names bound in
+/// the innermost scope, which are bound again when the result is replayed.
+pub fn memoized<'a, A, O>(rule: &'static str, parser: A) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
+    O: Clone + Send + Sync + 'static,
+{
+    let token_addr = |token: Option<&Token>| token.map(|token| std::ptr::from_ref(token).addr());
+    custom(move |inp| {
+        let no_recover = inp.ctx().no_recover;
+        let Some(key) = token_addr(inp.peek_ref()).and_then(|token| inp.state().memo_key(rule, token, no_recover))
+        else {
+            return inp.parse(&parser);
+        };
+        if let Some((output, end)) = inp.state().memo_replay::<O>(&key) {
+            while token_addr(inp.peek_ref()) != end && inp.next_ref().is_some() {}
+            return Ok(output);
+        }
+        let mark = inp.state().memo_mark();
+        let output = inp.parse(&parser)?;
+        let end = token_addr(inp.peek_ref());
+        inp.state().memo_store(key, mark, output.clone(), end);
+        Ok(output)
+    })
+}
+
+/// Parse a compound statement or parameter list, so that the names it
+/// declares are entered one scope deeper into the declaration index.
+pub fn declaration_scope<'a, A, O>(parser: A) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
+{
+    custom(move |inp| {
+        inp.state().enter_scope();
+        let result = inp.parse(&parser);
+        inp.state().exit_scope();
+        result
+    })
+}
+
+/// Parse the tag of a struct, union or enum specifier, with its span.
+fn tag<'a>() -> impl Parser<'a, Tokens<'a>, (Identifier, Span), Extra<'a>> + Clone {
+    identifier().map_with(|identifier, extra| (identifier, extra.span()))
+}
+
+/// Enter the tag of a specifier into the declaration index if the specifier
+/// defines it.
+fn declare_tag(tag: Option<(Identifier, Span)>, defined: bool, state: &mut State) -> Option<Identifier> {
+    let (identifier, span) = tag?;
+    if defined {
+        state.declare(identifier, DeclaredKind::Tag, span);
+    }
+    Some(identifier)
+}
+
 /// Temporarily allow error recovery for the given parser.
 pub fn allow_recover<'a, A, O>(parser: A) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
 where
@@ -1881,12 +2360,62 @@ where
             if extra.ctx().no_recover {
                 Err(Rich::custom(extra.span(), "cannot recover in this context"))
             } else {
+                #[cfg(feature = "tracing")]
+                tracing::debug!(span = ?extra.span().range(), "recovered from a syntax error");
+                extra.state().record_recovery();
                 Ok(error)
             }
         },
     ))
 }
 
+/// Create a recovery strategy that skips tokens up to and including `until`,
+/// and returns the result of `fallback`.
+///
+/// Unlike [`recover_via_parser`], this recovers even in a `no_recover` context.
+pub fn recover_skip_until<'a, U, O>(
+    until: U,
+    fallback: impl Fn() -> O + Clone,
+) -> impl chumsky::recovery::Strategy<'a, Tokens<'a>, O, Extra<'a>> + Clone
+where
+    U: Parser<'a, Tokens<'a>, (), Extra<'a>> + Clone,
+{
+    via_parser(
+        any()
+            .and_is(until.clone().not())
+            .repeated()
+            .then(until)
+            .map_with(move |_, extra| {
+                #[cfg(feature = "tracing")]
+                tracing::debug!(span = ?extra.span().range(), "recovered from a syntax error");
+                extra.state().record_recovery();
+                fallback()
+            }),
+    )
+}
+
+/// Create a recovery strategy that skips an external declaration up to the
+/// next declaration boundary, see [`State::set_resynchronize`].
+///
+/// The boundary is the next top-level `;`, or the next braced group and an
+/// optional `;` after it, so the tokens are scanned once and never parsed. At
+/// the end of the input, the remaining tokens are skipped.
+fn recover_to_declaration_boundary<'a>()
+-> impl chumsky::recovery::Strategy<'a, Tokens<'a>, ExternalDeclaration, Extra<'a>> + Clone {
+    let semicolon = punctuator(Punctuator::Semicolon);
+    let braced = select_ref! { Token::Braced(_) => () };
+    let boundary = choice((semicolon.clone(), braced.then_ignore(semicolon.or_not())));
+    let skipped = any().and_is(boundary.clone().not()).repeated();
+    via_parser(
+        choice((skipped.clone().then(boundary), skipped.at_least(1).then(end()))).map_with(|_, extra| {
+            #[cfg(feature = "tracing")]
+            tracing::debug!(span = ?extra.span().range(), "skipped to a declaration boundary");
+            extra.state().record_recovery();
+            ExternalDeclaration::Declaration(Declaration::new(DeclarationKind::Error, extra.span()))
+        }),
+    )
+}
+
 /// Create a recovery strategy that consumes a parenthesized token and returns
 /// the given error value.
 pub fn recover_parenthesized<'a, O: Clone>(
@@ -1937,16 +2466,130 @@ where
     LabelError::<Tokens<'a>, L>::expected_found(expected, found.map(MaybeRef::Val), span)
 }
 
+/// Parse an external declaration in a `tracing` span, recording its source
+/// range, the tokens read, the deepest nesting and the names bound after it.
+#[cfg(feature = "tracing")]
+fn traced_declaration<'a, A>(parser: A) -> impl Parser<'a, Tokens<'a>, ExternalDeclaration, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, ExternalDeclaration, Extra<'a>> + Clone,
+{
+    use tracing::field::Empty;
+
+    custom(move |inp| {
+        let span = tracing::debug_span!(
+            "external_declaration",
+            range = Empty,
+            tokens = Empty,
+            depth = Empty,
+            bindings = Empty
+        )
+        .entered();
+        let before = inp.cursor();
+        let token_work = inp.state().token_work();
+        inp.state().take_peak_depth();
+        let result = inp.parse(&parser);
+        span.record("range", tracing::field::debug(inp.span_since(&before).range()));
+        let state = inp.state();
+        span.record("tokens", state.token_work() - token_work);
+        span.record("depth", state.take_peak_depth());
+        span.record("bindings", state.bindings_len());
+        result
+    })
+}
+
+/// Parse a translation unit in a `tracing` span, recording the declarations
+/// parsed, the tokens read, the error recoveries and the names bound.
+#[cfg(feature = "tracing")]
+fn traced_unit<'a, A>(parser: A) -> impl Parser<'a, Tokens<'a>, TranslationUnit, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, TranslationUnit, Extra<'a>> + Clone,
+{
+    use tracing::field::Empty;
+
+    custom(move |inp| {
+        let span = tracing::debug_span!(
+            "translation_unit",
+            declarations = Empty,
+            tokens = Empty,
+            recoveries = Empty,
+            bindings = Empty
+        )
+        .entered();
+        let token_work = inp.state().token_work();
+        let recoveries = inp.state().recoveries();
+        let result = inp.parse(&parser);
+        if let Ok(unit) = &result {
+            span.record("declarations", unit.external_declarations.len());
+        }
+        let state = inp.state();
+        span.record("tokens", state.token_work() - token_work);
+        span.record("recoveries", state.recoveries() - recoveries);
+        span.record("bindings", state.bindings_len());
+        result
+    })
+}
+
+/// Record the statistics of a rule in [`State::profile`], and in the
+/// process-wide [`profile::totals`](crate::profile::totals) if they are
+/// collected.
+#[cfg(feature = "profile")]
+pub fn profiled<'a, A, O>(label: &'static str, parser: A) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
+where
+    A: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
+{
+    crate::profile::register_rule(label);
+    custom(move |inp| {
+        let entry = inp.state().profile().map(|profile| profile.enter());
+        let totals_entry = crate::profile::enter_totals(inp.state().token_work());
+        if entry.is_none() && totals_entry.is_none() {
+            return inp.parse(&parser);
+        }
+        let result = inp.parse(&parser);
+        if let Some(entry) = entry
+            && let Some(profile) = inp.state().profile_mut()
+        {
+            profile.exit(label, entry, result.is_ok());
+        }
+        if let Some(entry) = totals_entry {
+            crate::profile::exit_totals(label, entry, inp.state().token_work(), result.is_ok());
+        }
+        result
+    })
+}
+
 /// Extension trait for parsers to add convenience methods for parsing nested
 /// token sequences.
 pub trait ParserExt<O> {
+    /// Label a grammar rule, for error messages and as the context of the
+    /// errors inside it, unless [`State::rule_labels`] is off.
+    ///
+    /// With the `profile` feature, the rule is also recorded in
+    /// [`State::profile`] and in the process-wide profile totals.
+    fn labelled_rule<'a>(self, label: &'static str) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
+    where
+        Self: Sized,
+        Self: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
+    {
+        let labelled = self.clone().labelled(label).as_context();
+        let parser = custom(move |inp| {
+            if inp.state().rule_labels() {
+                inp.parse(&labelled)
+            } else {
+                inp.parse(&self)
+            }
+        });
+        #[cfg(feature = "profile")]
+        let parser = profiled(label, parser);
+        parser
+    }
+
     /// Parse the content within parentheses.
     fn parenthesized<'a>(self) -> impl Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone
     where
         Self: Sized,
         Self: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
     {
-        self.nested_in(select_ref! {
+        nesting(self).nested_in(select_ref! {
             Token::Parenthesized(tokens) => tokens.as_input()
         })
     }
@@ -1957,7 +2600,7 @@ pub trait ParserExt<O> {
         Self: Sized,
         Self: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
     {
-        self.nested_in(select_ref! {
+        nesting(self).nested_in(select_ref! {
             Token::Bracketed(tokens) => tokens.as_input()
         })
     }
@@ -1968,10 +2611,29 @@ pub trait ParserExt<O> {
         Self: Sized,
         Self: Parser<'a, Tokens<'a>, O, Extra<'a>> + Clone,
     {
-        self.nested_in(select_ref! {
+        nesting(self).nested_in(select_ref! {
             Token::Braced(tokens) => tokens.as_input()
         })
     }
 }
 
 impl<'a, T, O> ParserExt<O> for T where T: Parser<'a, Tokens<'a>, O, Extra<'a>> {}
+
+#[cfg(test)]
+mod test {
+    use super::{BINARY_OPERATOR_POWERS, BINARY_POWERS, binary_operator};
+    use crate::Punctuator;
+
+    #[test]
+    fn test_precedence_table() {
+        // Every operator of the grammar has an operator of the tree
+        for &(punctuator, power) in BINARY_OPERATOR_POWERS {
+            assert_eq!(binary_operator(punctuator).map(|(power, _)| power), Some(power));
+        }
+        let binary = BINARY_POWERS.iter().filter(|&&power| power > 0).count();
+        assert_eq!(binary, BINARY_OPERATOR_POWERS.len());
+        assert!(binary_operator(Punctuator::Assign).is_none());
+        assert_eq!(binary_operator(Punctuator::Star).map(|(power, _)| power), Some(10));
+        assert_eq!(binary_operator(Punctuator::LogicalOr).map(|(power, _)| power), Some(1));
+    }
+}
@@ -0,0 +1,171 @@
+//! A translation unit whose clones share their external declarations.
+
+use std::{ops::ControlFlow, sync::Arc};
+
+use crate::{
+    ExternalDeclaration, TranslationUnit,
+    visitor::{Visitor, VisitorMut, VisitorResult},
+};
+
+/// A translation unit whose external declarations are shared, copied on
+/// write, between its clones.
+///
+/// Cloning a `SharedUnit` is O(1), and changing one of its declarations copies
+/// the list of declarations and that declaration only; every other
+/// declaration stays shared with the unit it was cloned from. Tools that derive
+/// many variants of one parse then pay for the declarations they rewrite,
+/// instead of a deep clone of the whole unit per variant:
+///
+/// ```ignore
+/// let base = SharedUnit::from(unit);
+/// let mut variant = base.clone();
+/// variant.transform(|d| matches!(d, ExternalDeclaration::Function(_)), &mut Rename);
+/// ```
+///
+/// The declarations are the unit of sharing: a rewrite deep in a function
+/// body copies that function definition.
+#[derive(Debug, Default, Clone, PartialEq, Eq, Hash)]
+pub struct SharedUnit {
+    declarations: Arc<Vec<Arc<ExternalDeclaration>>>,
+}
+
+impl SharedUnit {
+    /// Number of external declarations.
+    pub fn len(&self) -> usize {
+        self.declarations.len()
+    }
+
+    /// Whether the unit has no external declarations.
+    pub fn is_empty(&self) -> bool {
+        self.declarations.is_empty()
+    }
+
+    /// The external declaration at `index`.
+    pub fn get(&self, index: usize) -> Option<&ExternalDeclaration> {
+        self.declarations.get(index).map(|declaration| &**declaration)
+    }
+
+    /// The external declarations, in order.
+    pub fn iter(&self) -> impl ExactSizeIterator<Item = &ExternalDeclaration> {
+        self.declarations.iter().map(|declaration| &**declaration)
+    }
+
+    /// The external declaration at `index`, for writing, copied first if it
+    /// is shared.
+    pub fn make_mut(&mut self, index: usize) -> Option<&mut ExternalDeclaration> {
+        Arc::make_mut(&mut self.declarations).get_mut(index).map(Arc::make_mut)
+    }
+
+    /// Replace the external declaration at `index`, returning the old one.
+    ///
+    /// Panics if `index` is out of bounds.
+    pub fn replace(&mut self, index: usize, declaration: ExternalDeclaration) -> Arc<ExternalDeclaration> {
+        std::mem::replace(&mut Arc::make_mut(&mut self.declarations)[index], Arc::new(declaration))
+    }
+
+    /// Insert an external declaration at `index`.
+    ///
+    /// Panics if `index` is greater than the length.
+    pub fn insert(&mut self, index: usize, declaration: ExternalDeclaration) {
+        Arc::make_mut(&mut self.declarations).insert(index, Arc::new(declaration));
+    }
+
+    /// Append an external declaration.
+    pub fn push(&mut self, declaration: ExternalDeclaration) {
+        Arc::make_mut(&mut self.declarations).push(Arc::new(declaration));
+    }
+
+    /// Remove the external declaration at `index`.
+    ///
+    /// Panics if `index` is out of bounds.
+    pub fn remove(&mut self, index: usize) -> Arc<ExternalDeclaration> {
+        Arc::make_mut(&mut self.declarations).remove(index)
+    }
+
+    /// Keep the external declarations for which `keep` returns true.
+    pub fn retain(&mut self, mut keep: impl FnMut(&ExternalDeclaration) -> bool) {
+        let Some(first) = self.iter().position(|declaration| !keep(declaration)) else {
+            return;
+        };
+        let declarations = Arc::make_mut(&mut self.declarations);
+        let mut index = 0;
+        declarations.retain(|declaration| {
+            index += 1;
+            index <= first || (index > first + 1 && keep(declaration))
+        });
+    }
+
+    /// Visit the external declarations, in order.
+    pub fn visit<'a, V: Visitor<'a>>(&'a self, visitor: &mut V) -> V::Result {
+        for declaration in self.declarations.iter() {
+            if let ControlFlow::Break(residual) = visitor.visit_external_declaration(declaration).branch() {
+                return V::Result::from_residual(residual);
+            }
+        }
+        V::Result::output()
+    }
+
+    /// Run `visitor` over the external declarations for which `select`
+    /// returns true, copying those that are shared first.
+    ///
+    /// `select` sees each declaration before it is copied, so that the
+    /// declarations the visitor leaves alone stay shared.
+    pub fn transform<'a, V: VisitorMut<'a>>(
+        &'a mut self,
+        mut select: impl FnMut(&ExternalDeclaration) -> bool,
+        visitor: &mut V,
+    ) -> V::Result {
+        let Some(first) = self.iter().position(&mut select) else {
+            return V::Result::output();
+        };
+        let declarations = Arc::make_mut(&mut self.declarations);
+        for (index, declaration) in declarations.iter_mut().enumerate().skip(first) {
+            if index > first && !select(declaration) {
+                continue;
+            }
+            let declaration = Arc::make_mut(declaration);
+            if let ControlFlow::Break(residual) = visitor.visit_external_declaration_mut(declaration).branch() {
+                return V::Result::from_residual(residual);
+            }
+        }
+        V::Result::output()
+    }
+
+    /// Number of external declarations at the same index in `self` and
+    /// `other` that are shared, not copies.
+    pub fn shared_with(&self, other: &SharedUnit) -> usize {
+        (self.declarations.iter().zip(other.declarations.iter()))
+            .filter(|(a, b)| Arc::ptr_eq(a, b))
+            .count()
+    }
+
+    /// The unit as a plain translation unit, cloning the declarations that
+    /// are shared.
+    pub fn into_unit(self) -> TranslationUnit {
+        let declarations = Arc::unwrap_or_clone(self.declarations);
+        TranslationUnit {
+            external_declarations: declarations.into_iter().map(Arc::unwrap_or_clone).collect(),
+        }
+    }
+}
+
+impl From<TranslationUnit> for SharedUnit {
+    fn from(unit: TranslationUnit) -> Self {
+        let declarations = unit.external_declarations.into_iter().map(Arc::new).collect();
+        Self { declarations: Arc::new(declarations) }
+    }
+}
+
+impl From<SharedUnit> for TranslationUnit {
+    fn from(unit: SharedUnit) -> Self {
+        unit.into_unit()
+    }
+}
+
+impl FromIterator<ExternalDeclaration> for SharedUnit {
+    fn from_iter<I: IntoIterator<Item = ExternalDeclaration>>(iter: I) -> Self {
+        Self {
+            declarations: Arc::new(iter.into_iter().map(Arc::new).collect()),
+        }
+    }
+}
@@ -0,0 +1,107 @@
+//! Snapshots of the parsing state after a common prefix of many inputs.
+
+use std::sync::Arc;
+
+use chumsky::prelude::*;
+
+use crate::{
+    BalancedTokenSequence, ExternalDeclaration, State, TranslationUnit, lex, parser::translation_unit,
+    parser_utils::Error,
+};
+
+/// The external declarations of a source prefix, and the parsing state after
+/// them.
+///
+/// When many translation units start with the same text, e.g. the expansion
+/// of the same system headers, the prefix can be parsed once into a snapshot.
+/// [`PrefixSnapshot::parse`] then checks that an input starts with the same
+/// text, and only parses the rest of it, starting from the state after the
+/// prefix: the typedef names and enumeration constants the prefix declares.
+#[derive(Clone)]
+pub struct PrefixSnapshot {
+    /// The text of the prefix, shared by the clones of the snapshot.
+    text: Arc<str>,
+    /// Number of top-level tokens of the prefix.
+    tokens: usize,
+    declarations: Vec<ExternalDeclaration>,
+    state: State,
+}
+
+impl PrefixSnapshot {
+    /// Parse `prefix` starting from `state`.
+    ///
+    /// Returns `None` if the prefix does not parse without errors, e.g. if it
+    /// ends in the middle of a declaration.
+    pub fn new(prefix: &str, state: &State) -> Option<Self> {
+        let (tokens, _) = lex(prefix, None);
+        let mut state = state.clone();
+        let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+        if result.has_errors() {
+            return None;
+        }
+        let declarations = result.into_output()?.external_declarations;
+        state.commit();
+        Some(Self {
+            text: prefix.into(),
+            tokens: tokens.tokens.len(),
+            declarations,
+            state,
+        })
+    }
+
+    /// The external declarations of the prefix.
+    pub fn declarations(&self) -> &[ExternalDeclaration] {
+        &self.declarations
+    }
+
+    /// The parsing state after the prefix.
+    pub fn state(&self) -> &State {
+        &self.state
+    }
+
+    /// Check whether `source`, lexed into `tokens`, starts with the prefix.
+    pub fn matches(&self, source: &str, tokens: &BalancedTokenSequence) -> bool {
+        let len = self.text.len();
+        // The prefix must end between two top-level tokens. The text is
+        // compared byte for byte, which stops at the first difference
+        tokens.tokens.len() >= self.tokens
+            && tokens.tokens[..self.tokens]
+                .last()
+                .is_none_or(|last| last.span.range().end <= len)
+            && tokens
+                .tokens
+                .get(self.tokens)
+                .is_none_or(|next| next.span.range().start >= len)
+            && source.as_bytes().starts_with(self.text.as_bytes())
+    }
+
+    /// Parse `tokens`, lexed from `source`, as a translation unit.
+    ///
+    /// If `source` starts with the prefix, the declarations of the prefix are
+    /// reused, `state` is replaced by the state after the prefix, and only the
+    /// rest is parsed. Otherwise, the whole input is parsed from `state`. In
+    /// both cases the result is the same as [`translation_unit`].
+    pub fn parse<'a>(
+        &self,
+        source: &str,
+        tokens: &'a BalancedTokenSequence,
+        state: &mut State,
+    ) -> (Option<TranslationUnit>, Vec<Error<'a>>) {
+        if !self.matches(source, tokens) {
+            return translation_unit()
+                .parse_with_state(tokens.as_input(), state)
+                .into_output_errors();
+        }
+        *state = self.state.clone();
+        let input = tokens.slice_as_input(self.tokens..tokens.tokens.len());
+        let (rest, errors) = translation_unit().parse_with_state(input, state).into_output_errors();
+        let output = rest.map(|rest| {
+            let mut external_declarations =
+                Vec::with_capacity(self.declarations.len() + rest.external_declarations.len());
+            external_declarations.extend_from_slice(&self.declarations);
+            external_declarations.extend(rest.external_declarations);
+            TranslationUnit { external_declarations }
+        });
+        (output, errors)
+    }
+}
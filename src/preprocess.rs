@@ -0,0 +1,2093 @@
+//! C preprocessor working on tokens.
+//!
+//! A [`Preprocessor`] lexes a source file and the files it includes line by
+//! line, and runs the directives and macro expansions on the tokens, so that
+//! it produces the [`BalancedTokenSequence`] that [`lex`](crate::lex) gives
+//! for the output of an external preprocessor without that output ever being
+//! written out:
+//!
+//! ```ignore
+//! let mut preprocessor = Preprocessor::new();
+//! preprocessor.add_include_path("include");
+//! let output = preprocessor.preprocess_file("main.c")?;
+//! let unit = translation_unit().parse(output.tokens.as_input());
+//! ```
+//!
+//! Spans index the text of each file read, placed one after the other, and
+//! [`Preprocessed::ctx_map`] maps them to the file and line they come from,
+//! reading the text of the files where they are, shared with the
+//! [`HeaderCache`], rather than from one copy of them all. Tokens expanded from a macro have the spans of
+//! their spelling in the definition, and those made by `#` and `##` the span
+//! of the operator or of its left operand. Where each was expanded is kept in
+//! the context mapping too, see [`ContextMapping::macro_stack`].
+//!
+//! Object-like and function-like macros with `#`, `##`, `__VA_ARGS__` and
+//! `__VA_OPT__`, the conditional directives with `defined` and
+//! `__has_include`, `#include`, `#include_next`, `#embed` with its standard
+//! parameters, `#line`, `#error`, `#pragma once` and `_Pragma` are supported.
+//! Other pragmas and `#warning` are dropped, as the lexer drops them from the
+//! output of an external preprocessor. Arithmetic in `#if` is done in `i128`,
+//! which holds the values of both signed and unsigned `intmax_t`, without
+//! telling them apart.
+//!
+//! Each file is lexed once per run. A file whose text is all in one
+//! conditional, `#ifndef X` or `#if !defined X` to the matching `#endif`, is
+//! skipped when it is included again with `X` defined, as is a file with
+//! `#pragma once`, without reading its lines. A [`HeaderCache`] keeps the
+//! lexed headers between runs, so that translation units including the same
+//! headers do not read or lex them again.
+//!
+//! The headers of a freestanding implementation, `<stddef.h>`, `<stdint.h>`,
+//! `<stdarg.h>` and the like, are built into the crate, see
+//! [`Preprocessor::add_freestanding_headers`]. They are lexed once per
+//! process and shared by every run, without the loader or the cache.
+//!
+//! Hide sets, the macros that tokens must not be expanded by again, are
+//! interned per run, so nested expansions share them and combine them in
+//! constant time once each pair has been seen. Object-like macros are
+//! rescanned on their own on first use with each hide set, and that
+//! expansion is reused until a macro is defined or undefined, unless it
+//! depends on where it is used.
+
+use std::{
+    fmt, io,
+    ops::Range,
+    path::{Path, PathBuf},
+    rc::Rc,
+    sync::{Arc, LazyLock, OnceLock, RwLock},
+    time::SystemTime,
+};
+
+#[cfg(feature = "profile")]
+use std::time::Instant;
+
+use rustc_hash::{FxHashMap, FxHashSet};
+
+use crate::{
+    ast::*,
+    lexer::{LineToken, lex_line},
+    span::{ContextMapping, Expansion, ExpansionId, NO_EXPANSION, SourceContext, Span, Spanned},
+    symbol::Symbol,
+};
+
+#[cfg(feature = "profile")]
+use crate::profile::MacroProfile;
+
+/// Maximum nesting of `#include` directives.
+const MAX_INCLUDE_DEPTH: usize = 200;
+
+/// Reads the file at a path.
+type Loader = Box<dyn FnMut(&Path) -> io::Result<Vec<u8>>>;
+
+/// A C preprocessor, see the [module documentation](self).
+pub struct Preprocessor {
+    include_paths: Vec<PathBuf>,
+    /// Macros defined before each source, e.g. on the command line.
+    macros: FxHashMap<Symbol, Rc<Macro>>,
+    loader: Loader,
+    cache: Option<Arc<HeaderCache>>,
+    #[cfg(feature = "profile")]
+    profile: bool,
+}
+
+impl Default for Preprocessor {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Preprocessor {
+    /// Create a preprocessor that reads files from the file system, with no
+    /// include paths and the standard predefined macros.
+    pub fn new() -> Self {
+        let mut preprocessor = Self {
+            include_paths: Vec::new(),
+            macros: FxHashMap::default(),
+            loader: Box::new(|path: &Path| std::fs::read(path)),
+            cache: None,
+            #[cfg(feature = "profile")]
+            profile: false,
+        };
+        preprocessor.define("__STDC__", "1");
+        preprocessor.define("__STDC_VERSION__", "202311L");
+        preprocessor.define("__STDC_HOSTED__", "1");
+        preprocessor
+    }
+
+    /// Add a directory to search for `#include <...>`, and for
+    /// `#include "..."` after the directory of the including file.
+    pub fn add_include_path(&mut self, path: impl Into<PathBuf>) {
+        self.include_paths.push(path.into());
+    }
+
+    /// Search the freestanding headers built into the crate for
+    /// `#include <...>`, after the include paths added so far: `<stddef.h>`,
+    /// `<stdint.h>`, `<stdbool.h>`, `<stdarg.h>`, `<limits.h>`,
+    /// `<stdalign.h>`, `<stdnoreturn.h>` and `<iso646.h>`.
+    ///
+    /// The headers target LP64 unless `__LONG_WIDTH__` and `__INTPTR_WIDTH__`
+    /// are defined otherwise. `va_arg` and `offsetof` expand to expressions
+    /// that parse, but have no meaning to the parser.
+    pub fn add_freestanding_headers(&mut self) {
+        self.include_paths.push(PathBuf::from(FREESTANDING));
+    }
+
+    /// Define a macro for every source, as `-D name=body` does. `name` is the
+    /// name of an object-like macro, or the name and parameters of a
+    /// function-like macro, e.g. `MAX(a, b)`.
+    ///
+    /// Panics if `name` is not a macro name or if the definition is invalid.
+    pub fn define(&mut self, name: &str, body: &str) {
+        let text = format!("{name} {body}");
+        let mut tokens = Vec::new();
+        lex_line(&text, 0, &mut tokens);
+        let tokens: Vec<_> = tokens
+            .into_iter()
+            .map(|LineToken { token, space }| PpToken {
+                spelling: Some(text[token.span.range()].into()),
+                token: Spanned::dummy(token.value),
+                space,
+                hide: HideSet::default(),
+                expansion: NO_EXPANSION,
+            })
+            .collect();
+        let (name, definition) = parse_define(&tokens, Symbol::intern("__VA_ARGS__"))
+            .unwrap_or_else(|message| panic!("Invalid definition of `{name}`: {message}"));
+        self.macros.insert(name, Rc::new(definition));
+    }
+
+    /// Remove the definition of a macro, as `-U name` does.
+    pub fn undefine(&mut self, name: &str) {
+        self.macros.remove(&Symbol::intern(name));
+    }
+
+    /// Set the function that reads included and embedded files.
+    ///
+    /// The default reads them from the file system. Sources kept in memory,
+    /// e.g. by an editor, can be preprocessed without writing them out.
+    pub fn set_loader(&mut self, loader: impl FnMut(&Path) -> io::Result<Vec<u8>> + 'static) {
+        self.loader = Box::new(loader);
+    }
+
+    /// Keep the included files lexed in `cache`, which may be shared with
+    /// other preprocessors, e.g. those of other threads.
+    pub fn set_header_cache(&mut self, cache: Arc<HeaderCache>) {
+        self.cache = Some(cache);
+    }
+
+    /// Set whether runs record statistics of the macros they expand, in
+    /// [`Preprocessed::profile`]. See the [`profile`](crate::profile) module
+    /// for details.
+    #[cfg(feature = "profile")]
+    pub fn set_profile(&mut self, profile: bool) {
+        self.profile = profile;
+    }
+
+    /// Preprocess `source`, the text of the file `filename`.
+    ///
+    /// Macros defined by the source do not outlive the call.
+    pub fn preprocess(&mut self, source: &str, filename: &str) -> Preprocessed {
+        let mut run = Run::new(self);
+        let main = run.add_file(PathBuf::from(filename), Arc::new(Lexed::new(source.into())));
+        run.paths.insert(PathBuf::from(filename), Some(main));
+        run.run(main)
+    }
+
+    /// Read the file at `path` with the loader and preprocess it.
+    pub fn preprocess_file(&mut self, path: impl AsRef<Path>) -> io::Result<Preprocessed> {
+        let path = path.as_ref();
+        let source = Lexed::new(text((self.loader)(path)?));
+        let mut run = Run::new(self);
+        let main = run.add_file(path.to_path_buf(), Arc::new(source));
+        run.paths.insert(path.to_path_buf(), Some(main));
+        Ok(run.run(main))
+    }
+}
+
+/// The output of a [`Preprocessor`].
+#[derive(Debug, Clone)]
+pub struct Preprocessed {
+    /// The tokens of the translation unit.
+    pub tokens: BalancedTokenSequence,
+    /// The text of each file read, in the order the spans of the tokens index
+    /// them.
+    files: Vec<Arc<str>>,
+    /// The text of the files joined, built on first use.
+    source: OnceLock<String>,
+    /// Errors in directives and macro invocations. The tokens are produced
+    /// regardless, as an external preprocessor would produce them.
+    pub errors: Vec<PreprocessError>,
+    /// Statistics of the macros expanded, if profiling is enabled with
+    /// [`Preprocessor::set_profile`].
+    #[cfg(feature = "profile")]
+    pub profile: Option<MacroProfile>,
+    /// Source contexts and the offsets where they start, sorted by offset.
+    contexts: Vec<(usize, SourceContext)>,
+    /// Macro expansions, and the runs of tokens coming from each.
+    expansions: Vec<Expansion>,
+    runs: Vec<(u32, u32)>,
+}
+
+impl Preprocessed {
+    /// The text of the files read, one after the other, which the spans of
+    /// the tokens index. A newline is added after a file that does not end
+    /// with one.
+    ///
+    /// The text is joined on the first call; [`Preprocessed::ctx_map`] reads
+    /// the files without it.
+    pub fn source(&self) -> &str {
+        self.source.get_or_init(|| {
+            let mut source = String::with_capacity(self.files.iter().map(|text| text.len() + 1).sum());
+            for text in &self.files {
+                source.push_str(text);
+                if !text.ends_with('\n') {
+                    source.push('\n');
+                }
+            }
+            source
+        })
+    }
+
+    /// The source contexts of the spans of the tokens, giving the file and
+    /// line each comes from, and the macro expansions of the tokens.
+    ///
+    /// The mapping reads the text of spans from the files, and has an empty
+    /// [`ContextMapping::source`]; set it to [`Preprocessed::source`] for uses
+    /// that need the text as one string, e.g. reports.
+    pub fn ctx_map(&self) -> ContextMapping<'_> {
+        let mut ctx_map = ContextMapping::new("");
+        for text in &self.files {
+            ctx_map.add_buffer(text.clone());
+        }
+        for (offset, context) in &self.contexts {
+            ctx_map.start_context(*offset, context.clone());
+        }
+        ctx_map.set_expansions(self.expansions.clone(), self.runs.clone());
+        ctx_map
+    }
+}
+
+/// An error in a directive or a macro invocation.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct PreprocessError {
+    /// The span of the directive or token at fault, in
+    /// [`Preprocessed::source`].
+    pub span: Span,
+    /// The description of the error.
+    pub message: String,
+}
+
+impl fmt::Display for PreprocessError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str(&self.message)
+    }
+}
+
+impl std::error::Error for PreprocessError {}
+
+/// Lexed headers, shared between preprocessors and threads.
+///
+/// Headers are keyed by the path they are read from, and read again when the
+/// modification time of the file changes. Files that are not on the file
+/// system, e.g. those of a loader reading from memory, are taken as
+/// unchanged until the cache is cleared.
+#[derive(Default)]
+pub struct HeaderCache {
+    headers: RwLock<FxHashMap<PathBuf, (Option<SystemTime>, Arc<Lexed>)>>,
+}
+
+impl HeaderCache {
+    /// Creates an empty cache.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of headers in the cache.
+    pub fn len(&self) -> usize {
+        self.headers.read().unwrap().len()
+    }
+
+    /// Whether the cache holds no headers.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Remove all headers from the cache.
+    pub fn clear(&self) {
+        self.headers.write().unwrap().clear();
+    }
+
+    /// The header at `path`, lexed from the text given by `read` unless the
+    /// cache holds it as of its modification time.
+    fn get_or_read(&self, path: &Path, read: impl FnOnce() -> Option<Arc<str>>) -> Option<Arc<Lexed>> {
+        let modified = std::fs::metadata(path).and_then(|metadata| metadata.modified()).ok();
+        if let Some((time, lexed)) = self.headers.read().unwrap().get(path)
+            && *time == modified
+        {
+            return Some(lexed.clone());
+        }
+        let lexed = Arc::new(Lexed::new(read()?));
+        self.headers
+            .write()
+            .unwrap()
+            .insert(path.to_path_buf(), (modified, lexed.clone()));
+        Some(lexed)
+    }
+}
+
+/// The include path that names the freestanding headers.
+const FREESTANDING: &str = "<freestanding>";
+
+/// The freestanding headers built into the crate, lexed on first use.
+static FREESTANDING_HEADERS: LazyLock<FxHashMap<&'static str, Arc<Lexed>>> = LazyLock::new(|| {
+    [
+        ("stddef.h", include_str!("freestanding/stddef.h")),
+        ("stdint.h", include_str!("freestanding/stdint.h")),
+        ("stdbool.h", include_str!("freestanding/stdbool.h")),
+        ("stdarg.h", include_str!("freestanding/stdarg.h")),
+        ("limits.h", include_str!("freestanding/limits.h")),
+        ("stdalign.h", include_str!("freestanding/stdalign.h")),
+        ("stdnoreturn.h", include_str!("freestanding/stdnoreturn.h")),
+        ("iso646.h", include_str!("freestanding/iso646.h")),
+    ]
+    .into_iter()
+    .map(|(name, text)| (name, Arc::new(Lexed::new(text.into()))))
+    .collect()
+});
+
+/// The lines of a file, lexed.
+struct Lexed {
+    text: Arc<str>,
+    /// Tokens of the lines, with spans in the text.
+    tokens: Vec<LineToken>,
+    /// End of each line in the text, and of its tokens in `tokens`.
+    lines: Vec<(usize, usize)>,
+    /// Macro of the include guard around the whole file.
+    guard: Option<Symbol>,
+}
+
+impl Lexed {
+    fn new(text: Arc<str>) -> Self {
+        let mut tokens = Vec::new();
+        let mut lines = Vec::new();
+        let mut cursor = 0;
+        while cursor < text.len() {
+            cursor = lex_line(&text, cursor, &mut tokens);
+            lines.push((cursor, tokens.len()));
+        }
+        let mut lexed = Self { text, tokens, lines, guard: None };
+        lexed.guard = lexed.include_guard();
+        lexed
+    }
+
+    /// The tokens of line `i`.
+    fn line(&self, i: usize) -> &[LineToken] {
+        let start = i.checked_sub(1).map_or(0, |i| self.lines[i].1);
+        &self.tokens[start..self.lines[i].1]
+    }
+
+    /// The macro `X` of `#ifndef X` or `#if !defined X` on the first line
+    /// with tokens, if the matching `#endif` is on the last one.
+    fn include_guard(&self) -> Option<Symbol> {
+        let identifier = |token: &LineToken| match &token.token.value {
+            BalancedToken::Identifier(identifier) => Some(identifier.0),
+            _ => None,
+        };
+        let punct = |token: &LineToken, punctuator| matches!(token.token.value, BalancedToken::Punctuator(p) if p == punctuator);
+        let is_defined = |token: &LineToken| identifier(token).is_some_and(|name| name.as_str() == "defined");
+        let directive = |line: &[LineToken]| match line {
+            [hash, name, ..] if punct(hash, Punctuator::Hash) => identifier(name).map(Symbol::as_str),
+            _ => None,
+        };
+
+        let mut lines = (0..self.lines.len())
+            .map(|i| self.line(i))
+            .filter(|line| !line.is_empty());
+        let first = lines.next()?;
+        let guard = match (directive(first)?, &first[2..]) {
+            ("ifndef", [name]) => identifier(name)?,
+            ("if", [bang, defined, name]) if punct(bang, Punctuator::Bang) && is_defined(defined) => identifier(name)?,
+            ("if", [bang, defined, open, name, close])
+                if punct(bang, Punctuator::Bang)
+                    && is_defined(defined)
+                    && punct(open, Punctuator::LeftParen)
+                    && punct(close, Punctuator::RightParen) =>
+            {
+                identifier(name)?
+            }
+            _ => return None,
+        };
+        let mut depth = 1;
+        for line in lines {
+            if depth == 0 {
+                return None;
+            }
+            match directive(line) {
+                Some("if" | "ifdef" | "ifndef") => depth += 1,
+                Some("else" | "elif" | "elifdef" | "elifndef") if depth == 1 => return None,
+                Some("endif") => depth -= 1,
+                _ => {}
+            }
+        }
+        (depth == 0).then_some(guard)
+    }
+}
+
+/// A macro definition.
+struct Macro {
+    /// Parameters of a function-like macro, ending with `__VA_ARGS__` if it is
+    /// variadic.
+    params: Option<Vec<Symbol>>,
+    variadic: bool,
+    body: Vec<PpToken>,
+}
+
+/// A preprocessing token.
+#[derive(Clone)]
+struct PpToken {
+    /// The token, with brackets as punctuators.
+    token: Spanned<BalancedToken>,
+    /// Whether whitespace precedes the token.
+    space: bool,
+    /// Macros that must not expand the token again.
+    hide: HideSet,
+    /// Spelling of a token that is not spelled by its span, e.g. one made by
+    /// `##`.
+    spelling: Option<Rc<str>>,
+    /// Index of the expansion the token comes from, [`NO_EXPANSION`] for a
+    /// token as written and [`IN_BODY`] for one of a macro definition.
+    expansion: u32,
+}
+
+/// The expansion of the tokens of macro definitions, replaced by that of each
+/// invocation when they are substituted.
+const IN_BODY: u32 = u32::MAX - 1;
+
+/// A set of macro names, interned by [`HideSets`].
+#[derive(Clone, Copy, Default, PartialEq, Eq, PartialOrd, Ord, Hash)]
+struct HideSet(u32);
+
+/// The hide sets of a run, interned as bitsets over the macro names in them,
+/// so that tokens hold a set as an index, and each operation on two sets is
+/// done once.
+#[derive(Default)]
+struct HideSets {
+    /// Bit of each macro name in the sets.
+    bits: FxHashMap<Symbol, usize>,
+    /// Words of each set, without trailing zeros. Set 0 is empty.
+    sets: Vec<Rc<[u64]>>,
+    ids: FxHashMap<Rc<[u64]>, HideSet>,
+    /// Results of the operations done so far, with the smaller set first.
+    with: FxHashMap<(HideSet, Symbol), HideSet>,
+    union: FxHashMap<(HideSet, HideSet), HideSet>,
+    intersection: FxHashMap<(HideSet, HideSet), HideSet>,
+}
+
+impl HideSets {
+    fn new() -> Self {
+        let mut sets = Self::default();
+        sets.intern(Vec::new());
+        sets
+    }
+
+    fn intern(&mut self, mut words: Vec<u64>) -> HideSet {
+        while words.last() == Some(&0) {
+            words.pop();
+        }
+        if let Some(&set) = self.ids.get(&words[..]) {
+            return set;
+        }
+        let set = HideSet(self.sets.len().try_into().expect("Too many hide sets"));
+        let words: Rc<[u64]> = words.into();
+        self.sets.push(words.clone());
+        self.ids.insert(words, set);
+        set
+    }
+
+    fn words(&self, set: HideSet) -> &[u64] {
+        &self.sets[set.0 as usize]
+    }
+
+    fn contains(&self, set: HideSet, name: Symbol) -> bool {
+        self.bits
+            .get(&name)
+            .and_then(|&bit| self.words(set).get(bit / 64).map(|word| word >> (bit % 64) & 1 != 0))
+            .unwrap_or(false)
+    }
+
+    fn with(&mut self, set: HideSet, name: Symbol) -> HideSet {
+        if let Some(&result) = self.with.get(&(set, name)) {
+            return result;
+        }
+        let next = self.bits.len();
+        let bit = *self.bits.entry(name).or_insert(next);
+        let mut words = self.words(set).to_vec();
+        if words.len() <= bit / 64 {
+            words.resize(bit / 64 + 1, 0);
+        }
+        words[bit / 64] |= 1 << (bit % 64);
+        let result = self.intern(words);
+        self.with.insert((set, name), result);
+        result
+    }
+
+    fn union(&mut self, a: HideSet, b: HideSet) -> HideSet {
+        let (a, b) = (a.min(b), a.max(b));
+        if a == b || a == HideSet::default() {
+            return b;
+        }
+        if let Some(&result) = self.union.get(&(a, b)) {
+            return result;
+        }
+        let (mut words, other) = (self.words(a).to_vec(), self.words(b));
+        if words.len() < other.len() {
+            words.resize(other.len(), 0);
+        }
+        for (word, other) in words.iter_mut().zip(other) {
+            *word |= other;
+        }
+        let result = self.intern(words);
+        self.union.insert((a, b), result);
+        result
+    }
+
+    fn intersection(&mut self, a: HideSet, b: HideSet) -> HideSet {
+        let (a, b) = (a.min(b), a.max(b));
+        if a == b || a == HideSet::default() {
+            return a;
+        }
+        if let Some(&result) = self.intersection.get(&(a, b)) {
+            return result;
+        }
+        let words = self.words(a).iter().zip(self.words(b)).map(|(a, b)| a & b).collect();
+        let result = self.intern(words);
+        self.intersection.insert((a, b), result);
+        result
+    }
+}
+
+/// Names the preprocessor treats specially.
+struct Names {
+    defined: Symbol,
+    has_include: Symbol,
+    file: Symbol,
+    line: Symbol,
+    pragma: Symbol,
+    va_args: Symbol,
+    va_opt: Symbol,
+}
+
+/// A file read by a run.
+struct File {
+    path: PathBuf,
+    name: Arc<str>,
+    lexed: Arc<Lexed>,
+    /// Offset of the text in the source.
+    base: usize,
+    /// Number of lines in the source before the text.
+    lines: i32,
+}
+
+/// A file being preprocessed, of the stack of included files.
+struct Frame {
+    file: usize,
+    /// Include path the file was found in, for `#include_next`.
+    dir: Option<usize>,
+    /// Offset in the file of the next line, and its index.
+    cursor: usize,
+    line: usize,
+    /// Offset in the file of the last line read, and its number.
+    line_start: usize,
+    lineno: i32,
+    /// Line number set by `#line` minus the position of the line in the file.
+    line_delta: i32,
+    /// File name set by `#line`.
+    name: Arc<str>,
+    conditionals: Vec<Conditional>,
+}
+
+/// An open conditional directive.
+struct Conditional {
+    /// Whether the lines around the conditional are included.
+    enclosing: bool,
+    /// Whether a group of the conditional has been included.
+    taken: bool,
+    /// Whether the lines of the current group are included.
+    active: bool,
+    /// Whether `#else` has been seen.
+    has_else: bool,
+    /// The span of the `#if`.
+    span: Span,
+}
+
+/// The state of the preprocessing of one source.
+struct Run<'p> {
+    include_paths: &'p [PathBuf],
+    loader: &'p mut Loader,
+    cache: Option<&'p HeaderCache>,
+    macros: FxHashMap<Symbol, Rc<Macro>>,
+    names: Names,
+    files: Vec<File>,
+    /// Files by path, `None` for those that could not be read.
+    paths: FxHashMap<PathBuf, Option<usize>>,
+    /// Files with `#pragma once`, which are not included again.
+    once: FxHashSet<usize>,
+    /// Offset in the source of the next file.
+    end: usize,
+    /// Number of lines in the source before `end`.
+    lines: i32,
+    frames: Vec<Frame>,
+    /// Tokens to read before the next line, the next one last.
+    pending: Vec<PpToken>,
+    /// Whether reading stops at the end of `pending`, to expand a macro
+    /// argument on its own.
+    isolated: bool,
+    hide_sets: HideSets,
+    /// Expansions of object-like macros on their own, by the hide set of the
+    /// macro name, `None` for those that depend on where they are used, with
+    /// the expansions recorded while expanding them. Cleared when a macro is
+    /// defined.
+    memo: FxHashMap<(Symbol, HideSet), Option<(Rc<[PpToken]>, Range<u32>)>>,
+    /// Whether an expansion used `__FILE__`, `__LINE__` or `_Pragma`.
+    used_context: bool,
+    #[cfg(feature = "profile")]
+    profile: Option<MacroProfile>,
+    output: Vec<Spanned<BalancedToken>>,
+    /// The expansion of each token of `output`.
+    output_expansions: Vec<u32>,
+    /// Macro expansions, by index, including those of directives.
+    expansions: Vec<Expansion>,
+    contexts: Vec<(usize, SourceContext)>,
+    errors: Vec<PreprocessError>,
+}
+
+/// The text of a file, replacing invalid UTF-8.
+fn text(bytes: Vec<u8>) -> Arc<str> {
+    match String::from_utf8(bytes) {
+        Ok(text) => text.into(),
+        Err(error) => String::from_utf8_lossy(error.as_bytes()).into(),
+    }
+}
+
+/// The name of an identifier, or of a predefined constant, which is an
+/// identifier to the preprocessor.
+fn name_of(token: &PpToken) -> Option<Symbol> {
+    match &token.token.value {
+        BalancedToken::Identifier(identifier) => Some(identifier.0),
+        BalancedToken::Constant(Constant::Predefined(constant)) => Some(Symbol::intern(match constant {
+            PredefinedConstant::False => "false",
+            PredefinedConstant::True => "true",
+            PredefinedConstant::Nullptr => "nullptr",
+        })),
+        _ => None,
+    }
+}
+
+fn is_punct(token: &PpToken, punctuator: Punctuator) -> bool {
+    matches!(token.token.value, BalancedToken::Punctuator(p) if p == punctuator)
+}
+
+/// Escape `text` for a string literal.
+fn escape(text: &str) -> String {
+    let mut escaped = String::with_capacity(text.len() + 2);
+    escaped.push('"');
+    for ch in text.chars() {
+        if ch == '"' || ch == '\\' {
+            escaped.push('\\');
+        }
+        escaped.push(ch);
+    }
+    escaped.push('"');
+    escaped
+}
+
+/// Parse the tokens of a `#define` after the directive name.
+fn parse_define(tokens: &[PpToken], va_args: Symbol) -> Result<(Symbol, Macro), &'static str> {
+    const INVALID_PARAMETERS: &str = "invalid macro parameters";
+
+    let name = name_of(tokens.first().ok_or("macro name missing")?).ok_or("macro names must be identifiers")?;
+    if name.as_str() == "defined" {
+        return Err("`defined` cannot be used as a macro name");
+    }
+
+    let mut rest = &tokens[1..];
+    let mut params = None;
+    let mut variadic = false;
+    if let Some(open) = rest.first()
+        && is_punct(open, Punctuator::LeftParen)
+        && !open.space
+    {
+        let mut list = Vec::new();
+        let mut i = 1;
+        if rest.get(i).is_some_and(|token| is_punct(token, Punctuator::RightParen)) {
+            i += 1;
+        } else {
+            loop {
+                let param = rest.get(i).ok_or(INVALID_PARAMETERS)?;
+                if is_punct(param, Punctuator::Ellipsis) {
+                    variadic = true;
+                    list.push(va_args);
+                } else {
+                    list.push(name_of(param).ok_or(INVALID_PARAMETERS)?);
+                }
+                let separator = rest.get(i + 1).ok_or(INVALID_PARAMETERS)?;
+                i += 2;
+                if is_punct(separator, Punctuator::RightParen) {
+                    break;
+                }
+                if variadic || !is_punct(separator, Punctuator::Comma) {
+                    return Err(INVALID_PARAMETERS);
+                }
+            }
+        }
+        rest = &rest[i..];
+        params = Some(list);
+    }
+
+    let mut body = rest.to_vec();
+    if let Some(first) = body.first_mut() {
+        first.space = false;
+    }
+    for token in &mut body {
+        token.expansion = IN_BODY;
+    }
+    if body.first().is_some_and(|token| is_punct(token, Punctuator::HashHash))
+        || body.last().is_some_and(|token| is_punct(token, Punctuator::HashHash))
+    {
+        return Err("`##` cannot be at either end of a macro");
+    }
+    if let Some(params) = &params {
+        let is_param = |token: &PpToken| name_of(token).is_some_and(|name| params.contains(&name));
+        for (i, token) in body.iter().enumerate() {
+            if is_punct(token, Punctuator::Hash) && !body.get(i + 1).is_some_and(is_param) {
+                return Err("`#` is not followed by a macro parameter");
+            }
+        }
+    }
+    Ok((name, Macro { params, variadic, body }))
+}
+
+/// A macro being substituted.
+struct Substitution<'m> {
+    mac: &'m Macro,
+    args: &'m [Vec<PpToken>],
+    /// Macro-expanded arguments, expanded on first use.
+    expanded: Vec<Option<Vec<PpToken>>>,
+}
+
+impl Substitution<'_> {
+    /// The index of the parameter `token` names.
+    fn param(&self, token: &PpToken) -> Option<usize> {
+        let name = name_of(token)?;
+        self.mac.params.as_ref()?.iter().position(|&param| param == name)
+    }
+}
+
+impl<'p> Run<'p> {
+    fn new(preprocessor: &'p mut Preprocessor) -> Self {
+        Self {
+            include_paths: &preprocessor.include_paths,
+            loader: &mut preprocessor.loader,
+            cache: preprocessor.cache.as_deref(),
+            macros: preprocessor.macros.clone(),
+            names: Names {
+                defined: Symbol::intern("defined"),
+                has_include: Symbol::intern("__has_include"),
+                file: Symbol::intern("__FILE__"),
+                line: Symbol::intern("__LINE__"),
+                pragma: Symbol::intern("_Pragma"),
+                va_args: Symbol::intern("__VA_ARGS__"),
+                va_opt: Symbol::intern("__VA_OPT__"),
+            },
+            files: Vec::new(),
+            paths: FxHashMap::default(),
+            once: FxHashSet::default(),
+            end: 0,
+            lines: 0,
+            frames: Vec::new(),
+            pending: Vec::new(),
+            isolated: false,
+            hide_sets: HideSets::new(),
+            memo: FxHashMap::default(),
+            used_context: false,
+            #[cfg(feature = "profile")]
+            profile: preprocessor.profile.then(MacroProfile::default),
+            output: Vec::new(),
+            output_expansions: Vec::new(),
+            expansions: Vec::new(),
+            contexts: Vec::new(),
+            errors: Vec::new(),
+        }
+    }
+
+    fn error(&mut self, span: Span, message: impl Into<String>) {
+        self.errors.push(PreprocessError { span, message: message.into() });
+    }
+
+    /// Place a file in the source after those read before.
+    fn add_file(&mut self, path: PathBuf, lexed: Arc<Lexed>) -> usize {
+        let name: Arc<str> = path.to_string_lossy().into();
+        self.contexts.push((
+            self.end,
+            SourceContext {
+                filename: name.clone(),
+                line_offset: self.lines,
+            },
+        ));
+        let (len, newline) = (lexed.text.len(), !lexed.text.ends_with('\n'));
+        let lines = memchr::memchr_iter(b'\n', lexed.text.as_bytes()).count() as i32 + i32::from(newline);
+        let id = self.files.len();
+        self.files.push(File {
+            path,
+            name,
+            lexed,
+            base: self.end,
+            lines: self.lines,
+        });
+        self.end += len + usize::from(newline);
+        self.lines += lines;
+        id
+    }
+
+    /// Read the file at `path` the first time it is asked for, or take it from
+    /// the header cache or the freestanding headers.
+    fn load(&mut self, path: &Path) -> Option<usize> {
+        if let Some(&file) = self.paths.get(path) {
+            return file;
+        }
+        if let Ok(name) = path.strip_prefix(FREESTANDING) {
+            let lexed = name.to_str().and_then(|name| FREESTANDING_HEADERS.get(name)).cloned();
+            let file = lexed.map(|lexed| self.add_file(path.to_path_buf(), lexed));
+            self.paths.insert(path.to_path_buf(), file);
+            return file;
+        }
+        let mut read = || (self.loader)(path).ok().map(text);
+        let lexed = match self.cache {
+            Some(cache) => cache.get_or_read(path, read),
+            None => read().map(|text| Arc::new(Lexed::new(text))),
+        };
+        let file = lexed.map(|lexed| self.add_file(path.to_path_buf(), lexed));
+        self.paths.insert(path.to_path_buf(), file);
+        file
+    }
+
+    /// Search for the file `name` with `read`, in the directory of the current
+    /// file if `quoted`, then in the include paths from `from` on. Returns the
+    /// result of `read` and the include path it was found in.
+    fn search<T>(
+        &mut self,
+        name: &str,
+        quoted: bool,
+        from: usize,
+        mut read: impl FnMut(&mut Self, &Path) -> Option<T>,
+    ) -> Option<(T, Option<usize>)> {
+        if quoted && let Some(frame) = self.frames.last() {
+            let path = self.files[frame.file].path.parent().unwrap_or(Path::new("")).join(name);
+            if let Some(found) = read(self, &path) {
+                return Some((found, None));
+            }
+        }
+        let include_paths = self.include_paths;
+        include_paths
+            .iter()
+            .enumerate()
+            .skip(from)
+            .find_map(|(dir, path)| Some((read(self, &path.join(name))?, Some(dir))))
+    }
+
+    /// The spelling of `token` in the source.
+    fn spelling<'s>(&'s self, token: &'s PpToken) -> &'s str {
+        if let Some(spelling) = &token.spelling {
+            return spelling;
+        }
+        let range = token.token.span.range();
+        let Some(file) = self
+            .files
+            .partition_point(|file| file.base <= range.start)
+            .checked_sub(1)
+            .map(|file| &self.files[file])
+        else {
+            return "";
+        };
+        file.lexed
+            .text
+            .get(range.start - file.base..range.end - file.base)
+            .unwrap_or("")
+    }
+
+    fn run(mut self, main: usize) -> Preprocessed {
+        self.push_frame(main, None);
+        while let Some(token) = self.expand_next() {
+            self.output.push(token.token);
+            self.output_expansions.push(token.expansion);
+        }
+
+        let files = self.files.iter().map(|file| file.lexed.text.clone()).collect();
+        let main = &self.files[main];
+        let eoi = Span::new_eoi(main.base + main.lexed.text.len());
+        let mut contexts = self.contexts;
+        contexts.sort_by_key(|&(offset, _)| offset);
+        let (tokens, runs) = build_groups(self.output, &self.output_expansions, eoi);
+        Preprocessed {
+            tokens,
+            files,
+            source: OnceLock::new(),
+            errors: self.errors,
+            #[cfg(feature = "profile")]
+            profile: self.profile,
+            contexts,
+            expansions: self.expansions,
+            runs,
+        }
+    }
+
+    fn push_frame(&mut self, file: usize, dir: Option<usize>) {
+        self.frames.push(Frame {
+            file,
+            dir,
+            cursor: 0,
+            line: 0,
+            line_start: 0,
+            lineno: 1,
+            line_delta: 0,
+            name: self.files[file].name.clone(),
+            conditionals: Vec::new(),
+        });
+    }
+
+    /// Whether the lines being read are included.
+    fn active(&self) -> bool {
+        self.frames
+            .last()
+            .and_then(|frame| frame.conditionals.last())
+            .is_none_or(|conditional| conditional.active)
+    }
+
+    /// The next token, before macro expansion.
+    fn next_token(&mut self) -> Option<PpToken> {
+        loop {
+            if let Some(token) = self.pending.pop() {
+                return Some(token);
+            }
+            if self.isolated || !self.read_line() {
+                return None;
+            }
+        }
+    }
+
+    /// Read the next line of the current file, running it if it is a
+    /// directive and queueing its tokens otherwise. Returns `false` at the
+    /// end of the main file.
+    fn read_line(&mut self) -> bool {
+        let Some(frame) = self.frames.last_mut() else {
+            return false;
+        };
+        let file = &self.files[frame.file];
+        let (lexed, base) = (file.lexed.clone(), file.base);
+        if frame.line >= lexed.lines.len() {
+            let frame = self.frames.pop().expect("Frame is open");
+            for conditional in frame.conditionals {
+                self.error(conditional.span, "unterminated conditional directive");
+            }
+            return true;
+        }
+
+        let start = frame.cursor;
+        frame.lineno += memchr::memchr_iter(b'\n', &lexed.text.as_bytes()[frame.line_start..start]).count() as i32;
+        frame.line_start = start;
+        frame.cursor = lexed.lines[frame.line].0;
+        let line = lexed.line(frame.line);
+        frame.line += 1;
+
+        let token = |(i, line_token): (usize, &LineToken)| {
+            let mut token = line_token.token.clone();
+            token.span.shift(base as isize);
+            PpToken {
+                token,
+                space: line_token.space || i == 0,
+                hide: HideSet::default(),
+                spelling: None,
+                expansion: NO_EXPANSION,
+            }
+        };
+        let directive = line
+            .first()
+            .is_some_and(|first| matches!(first.token.value, BalancedToken::Punctuator(Punctuator::Hash)));
+        if directive {
+            let tokens: Vec<_> = line.iter().enumerate().map(token).collect();
+            self.directive(tokens);
+        } else if self.active() {
+            self.pending.extend(line.iter().enumerate().rev().map(token));
+        }
+        true
+    }
+
+    /// Run a directive line.
+    fn directive(&mut self, tokens: Vec<PpToken>) {
+        let span = tokens[0].token.span;
+        let Some(directive) = tokens.get(1) else {
+            return;
+        };
+        let args = &tokens[2..];
+        let Some(name) = name_of(directive) else {
+            // GNU line marker: # <line> "<file>"
+            if self.active() {
+                if matches!(directive.token.value, BalancedToken::Constant(Constant::Integer(_))) {
+                    self.line_directive(&tokens[1..], span, false);
+                } else {
+                    self.error(span, "invalid preprocessing directive");
+                }
+            }
+            return;
+        };
+
+        match name.as_str() {
+            kind @ ("if" | "ifdef" | "ifndef") => {
+                let enclosing = self.active();
+                let value = enclosing && self.condition(kind, args, span);
+                self.frames
+                    .last_mut()
+                    .expect("Frame is open")
+                    .conditionals
+                    .push(Conditional {
+                        enclosing,
+                        taken: value,
+                        active: value,
+                        has_else: false,
+                        span,
+                    });
+            }
+            kind @ ("elif" | "elifdef" | "elifndef") => {
+                let Some(conditional) = self.frames.last().and_then(|frame| frame.conditionals.last()) else {
+                    return self.error(span, format!("#{kind} without #if"));
+                };
+                if conditional.has_else {
+                    return self.error(span, format!("#{kind} after #else"));
+                }
+                let value = conditional.enclosing && !conditional.taken && self.condition(kind, args, span);
+                let conditional = self.conditional();
+                conditional.active = value;
+                conditional.taken |= value;
+            }
+            "else" => {
+                let Some(conditional) = self.frames.last_mut().and_then(|frame| frame.conditionals.last_mut()) else {
+                    return self.error(span, "#else without #if");
+                };
+                if conditional.has_else {
+                    return self.error(span, "#else after #else");
+                }
+                conditional.active = conditional.enclosing && !conditional.taken;
+                conditional.taken = true;
+                conditional.has_else = true;
+            }
+            "endif" => {
+                if self
+                    .frames
+                    .last_mut()
+                    .and_then(|frame| frame.conditionals.pop())
+                    .is_none()
+                {
+                    self.error(span, "#endif without #if");
+                }
+            }
+            _ if !self.active() => {}
+            "define" => match parse_define(args, self.names.va_args) {
+                Ok((name, definition)) => {
+                    self.memo.clear();
+                    self.macros.insert(name, Rc::new(definition));
+                }
+                Err(message) => self.error(span, message),
+            },
+            "undef" => match args.first().and_then(name_of) {
+                Some(name) => {
+                    self.memo.clear();
+                    self.macros.remove(&name);
+                }
+                None => self.error(span, "macro name missing"),
+            },
+            "include" => self.include(args, span, false),
+            "include_next" => self.include(args, span, true),
+            "embed" => self.embed(args, span),
+            "line" => self.line_directive(args, span, true),
+            "error" => {
+                let message = self.spellings(args);
+                self.error(span, format!("#error {message}"));
+            }
+            "pragma" => {
+                if args
+                    .first()
+                    .and_then(name_of)
+                    .is_some_and(|name| name.as_str() == "once")
+                {
+                    let file = self.frames.last().expect("Frame is open").file;
+                    self.once.insert(file);
+                }
+            }
+            "warning" | "ident" | "sccs" => {}
+            other => self.error(span, format!("unknown directive `#{other}`")),
+        }
+    }
+
+    /// The innermost open conditional.
+    fn conditional(&mut self) -> &mut Conditional {
+        self.frames
+            .last_mut()
+            .and_then(|frame| frame.conditionals.last_mut())
+            .expect("Conditional is open")
+    }
+
+    /// Whether a group of a conditional directive is included.
+    fn condition(&mut self, kind: &str, args: &[PpToken], span: Span) -> bool {
+        match kind {
+            "if" | "elif" => self.evaluate(args, span),
+            _ => {
+                let Some(name) = args.first().and_then(name_of) else {
+                    self.error(span, "macro name missing");
+                    return false;
+                };
+                self.is_defined(name) == matches!(kind, "ifdef" | "elifdef")
+            }
+        }
+    }
+
+    fn is_defined(&self, name: Symbol) -> bool {
+        self.macros.contains_key(&name)
+            || [
+                self.names.file,
+                self.names.line,
+                self.names.has_include,
+                self.names.pragma,
+            ]
+            .contains(&name)
+    }
+
+    /// A token of the integer `value`.
+    fn number(value: i128, span: Span) -> PpToken {
+        PpToken {
+            token: Spanned::new(BalancedToken::Constant(Constant::Integer(value.into())), span),
+            space: true,
+            hide: HideSet::default(),
+            spelling: Some(value.to_string().into()),
+            expansion: NO_EXPANSION,
+        }
+    }
+
+    /// The spellings of `tokens`, separated as in the source.
+    fn spellings(&self, tokens: &[PpToken]) -> String {
+        let mut text = String::new();
+        for (i, token) in tokens.iter().enumerate() {
+            if i > 0 && token.space {
+                text.push(' ');
+            }
+            text.push_str(self.spelling(token));
+        }
+        text
+    }
+
+    /// Evaluate the controlling expression of `#if` or `#elif`.
+    fn evaluate(&mut self, args: &[PpToken], span: Span) -> bool {
+        let mut tokens = Vec::with_capacity(args.len());
+        let mut i = 0;
+        while i < args.len() {
+            let token = &args[i];
+            let name = name_of(token);
+            if name == Some(self.names.defined) {
+                let (name, len) = match (args.get(i + 1), args.get(i + 2), args.get(i + 3)) {
+                    (Some(open), Some(name), Some(close))
+                        if is_punct(open, Punctuator::LeftParen) && is_punct(close, Punctuator::RightParen) =>
+                    {
+                        (name_of(name), 4)
+                    }
+                    (Some(name), ..) => (name_of(name), 2),
+                    _ => (None, 1),
+                };
+                let Some(name) = name else {
+                    self.error(token.token.span, "`defined` expects a macro name");
+                    return false;
+                };
+                tokens.push(Self::number(self.is_defined(name).into(), token.token.span));
+                i += len;
+            } else if name == Some(self.names.has_include) {
+                let header = args
+                    .get(i + 1)
+                    .filter(|open| is_punct(open, Punctuator::LeftParen))
+                    .and_then(|_| self.header_name(&args[i + 2..]))
+                    .filter(|&(_, _, len)| {
+                        args.get(i + 2 + len)
+                            .is_some_and(|close| is_punct(close, Punctuator::RightParen))
+                    });
+                let Some((name, quoted, len)) = header else {
+                    self.error(token.token.span, "`__has_include` expects a header name");
+                    return false;
+                };
+                let found = self.search(&name, quoted, 0, |run, path| run.load(path)).is_some();
+                tokens.push(Self::number(found.into(), token.token.span));
+                i += len + 3;
+            } else {
+                tokens.push(token.clone());
+                i += 1;
+            }
+        }
+
+        let tokens = self.expand_list(tokens);
+        let mut evaluator = Evaluator { tokens: &tokens, pos: 0, skip: 0 };
+        let value = evaluator.conditional().and_then(|value| {
+            if evaluator.pos == tokens.len() {
+                Ok(value)
+            } else {
+                Err("invalid expression in `#if`")
+            }
+        });
+        match value {
+            Ok(value) => value != 0,
+            Err(message) => {
+                self.error(span, message);
+                false
+            }
+        }
+    }
+
+    /// The header name at the start of `tokens`, whether it is quoted, and the
+    /// number of its tokens.
+    fn header_name(&self, tokens: &[PpToken]) -> Option<(String, bool, usize)> {
+        match tokens.first()?.token.value {
+            BalancedToken::StringLiteral(_) => {
+                let spelling = self.spelling(&tokens[0]);
+                let name = spelling.strip_prefix('"')?.strip_suffix('"')?;
+                Some((name.to_string(), true, 1))
+            }
+            BalancedToken::Punctuator(Punctuator::Less) => {
+                let end = tokens.iter().position(|token| is_punct(token, Punctuator::Greater))?;
+                let mut name = self.spellings(&tokens[1..end]);
+                if tokens.get(1).is_some_and(|first| first.space) {
+                    name.insert(0, ' ');
+                }
+                Some((name, false, end + 1))
+            }
+            _ => None,
+        }
+    }
+
+    /// The header name of `#include` or `#embed`, macro-expanded if it is not
+    /// spelled out, and the tokens after it.
+    fn header_arguments(&mut self, args: &[PpToken]) -> Option<(String, bool, Vec<PpToken>)> {
+        if let Some((name, quoted, len)) = self.header_name(args) {
+            return Some((name, quoted, args[len..].to_vec()));
+        }
+        let expanded = self.expand_list(args.to_vec());
+        let (name, quoted, len) = self.header_name(&expanded)?;
+        Some((name, quoted, expanded[len..].to_vec()))
+    }
+
+    fn include(&mut self, args: &[PpToken], span: Span, next: bool) {
+        let Some((name, quoted, _)) = self.header_arguments(args) else {
+            return self.error(span, "expected \"FILENAME\" or <FILENAME>");
+        };
+        if self.frames.len() >= MAX_INCLUDE_DEPTH {
+            return self.error(span, "#include nested too deeply");
+        }
+        let from = match self.frames.last() {
+            Some(frame) if next => frame.dir.map_or(0, |dir| dir + 1),
+            _ => 0,
+        };
+        match self.search(&name, quoted && !next, from, |run, path| run.load(path)) {
+            // Files already included with `#pragma once` or their include
+            // guard defined are skipped without reading their lines
+            Some((file, _))
+                if self.once.contains(&file)
+                    || self.files[file].lexed.guard.is_some_and(|guard| self.is_defined(guard)) => {}
+            Some((file, dir)) => self.push_frame(file, dir),
+            None => self.error(span, format!("cannot find `{name}`")),
+        }
+    }
+
+    /// Replace `#embed` by the bytes of the resource, as integer constants
+    /// separated by commas.
+    fn embed(&mut self, args: &[PpToken], span: Span) {
+        let Some((name, quoted, params)) = self.header_arguments(args) else {
+            return self.error(span, "expected \"FILENAME\" or <FILENAME>");
+        };
+
+        let mut limit = None;
+        let (mut prefix, mut suffix, mut if_empty) = (Vec::new(), Vec::new(), Vec::new());
+        let mut i = 0;
+        while i < params.len() {
+            // Standard parameters may be prefixed by `std::`
+            if name_of(&params[i]).is_some_and(|name| name.as_str() == "std")
+                && params
+                    .get(i + 1)
+                    .is_some_and(|token| is_punct(token, Punctuator::Scope))
+            {
+                i += 2;
+            }
+            let Some(param) = params.get(i).and_then(name_of) else {
+                return self.error(span, "invalid `#embed` parameter");
+            };
+            let mut value = Vec::new();
+            i += 1;
+            if params
+                .get(i)
+                .is_some_and(|token| is_punct(token, Punctuator::LeftParen))
+            {
+                let mut depth = 0;
+                i += 1;
+                loop {
+                    let Some(token) = params.get(i) else {
+                        return self.error(span, "unterminated `#embed` parameter");
+                    };
+                    i += 1;
+                    match token.token.value {
+                        BalancedToken::Punctuator(Punctuator::LeftParen) => depth += 1,
+                        BalancedToken::Punctuator(Punctuator::RightParen) if depth == 0 => break,
+                        BalancedToken::Punctuator(Punctuator::RightParen) => depth -= 1,
+                        _ => {}
+                    }
+                    value.push(token.clone());
+                }
+            }
+            match param.as_str() {
+                "limit" => {
+                    let value = self.expand_list(value);
+                    let mut evaluator = Evaluator { tokens: &value, pos: 0, skip: 0 };
+                    match evaluator.conditional() {
+                        Ok(value) if evaluator.pos == evaluator.tokens.len() => limit = Some(value.max(0)),
+                        _ => return self.error(span, "invalid `#embed` limit"),
+                    }
+                }
+                "prefix" => prefix = value,
+                "suffix" => suffix = value,
+                "if_empty" => if_empty = value,
+                other => return self.error(span, format!("unsupported `#embed` parameter `{other}`")),
+            }
+        }
+
+        let read = |run: &mut Self, path: &Path| (run.loader)(path).ok();
+        let Some((mut bytes, _)) = self.search(&name, quoted, 0, read) else {
+            return self.error(span, format!("cannot find `{name}`"));
+        };
+        if let Some(limit) = limit {
+            bytes.truncate(limit.try_into().unwrap_or(usize::MAX));
+        }
+
+        let mut tokens = Vec::new();
+        if bytes.is_empty() {
+            tokens = if_empty;
+        } else {
+            let comma = PpToken {
+                token: Spanned::new(BalancedToken::Punctuator(Punctuator::Comma), span),
+                space: false,
+                hide: HideSet::default(),
+                spelling: Some(",".into()),
+                expansion: NO_EXPANSION,
+            };
+            tokens.extend(prefix);
+            for (i, byte) in bytes.into_iter().enumerate() {
+                if i > 0 {
+                    tokens.push(comma.clone());
+                }
+                tokens.push(Self::number(byte.into(), span));
+            }
+            tokens.extend(suffix);
+        }
+        self.pending.extend(tokens.into_iter().rev());
+    }
+
+    /// Run `#line` or a line marker.
+    fn line_directive(&mut self, args: &[PpToken], span: Span, expand: bool) {
+        let args = if expand {
+            self.expand_list(args.to_vec())
+        } else {
+            args.to_vec()
+        };
+        let Some(BalancedToken::Constant(Constant::Integer(line))) = args.first().map(|token| &token.token.value)
+        else {
+            return self.error(span, "`#line` expects a line number");
+        };
+        let line = line
+            .value
+            .as_u64()
+            .map_or(i32::MAX, |line| i32::try_from(line).unwrap_or(i32::MAX));
+        let name = match args.get(1).map(|token| &token.token.value) {
+            Some(BalancedToken::StringLiteral(name)) => Some(name.to_joined()),
+            _ => None,
+        };
+
+        let frame = self.frames.last_mut().expect("Frame is open");
+        let file = &self.files[frame.file];
+        let read = &file.lexed.text.as_bytes()[frame.line_start..frame.cursor];
+        let next = frame.lineno + memchr::memchr_iter(b'\n', read).count() as i32;
+        frame.line_delta = line - next;
+        if let Some(name) = name {
+            frame.name = name.into();
+        }
+        let context = SourceContext {
+            filename: frame.name.clone(),
+            line_offset: file.lines - frame.line_delta,
+        };
+        self.contexts.push((file.base + frame.cursor, context));
+    }
+
+    /// The next token after macro expansion.
+    fn expand_next(&mut self) -> Option<PpToken> {
+        loop {
+            let token = self.next_token()?;
+            let Some(name) = name_of(&token) else {
+                return Some(token);
+            };
+            if self.hide_sets.contains(token.hide, name) {
+                return Some(token);
+            }
+            let Some(mac) = self.macros.get(&name).cloned() else {
+                let frame = self.frames.last();
+                self.used_context |= [self.names.file, self.names.line, self.names.pragma].contains(&name);
+                return Some(match name {
+                    _ if name == self.names.file => {
+                        let value = frame.map_or_else(String::new, |frame| frame.name.to_string());
+                        PpToken {
+                            spelling: Some(escape(&value).into()),
+                            token: Spanned::new(BalancedToken::StringLiteral(Arc::new(value.into())), token.token.span),
+                            ..token
+                        }
+                    }
+                    _ if name == self.names.line => {
+                        let line = frame.map_or(0, |frame| frame.lineno + frame.line_delta);
+                        PpToken {
+                            expansion: token.expansion,
+                            ..Self::number(line.into(), token.token.span)
+                        }
+                    }
+                    _ if name == self.names.pragma && self.pragma_operator() => continue,
+                    _ => token,
+                });
+            };
+
+            #[cfg(feature = "profile")]
+            let start = self.profile.is_some().then(Instant::now);
+            // A macro expanded for its memo is recorded by that expansion
+            #[cfg(feature = "profile")]
+            let fresh = mac.params.is_none() && !self.memo.contains_key(&(name, token.hide));
+            let memo = match mac.params {
+                None => self.memoized(name, &token),
+                Some(_) => None,
+            };
+            #[cfg(feature = "profile")]
+            let memoized = memo.is_some();
+            let expansion = match (&mac.params, memo) {
+                (_, Some(memo)) => memo,
+                (None, None) => {
+                    let hide = self.hide_sets.with(token.hide, name);
+                    let expansion = self.expansion(name, &token);
+                    self.substitute(&mac, &[], hide, expansion)
+                }
+                (Some(_), None) => {
+                    // A function-like macro name not followed by `(` is not
+                    // an invocation
+                    match self.next_token() {
+                        Some(open) if is_punct(&open, Punctuator::LeftParen) => {}
+                        next => {
+                            self.pending.extend(next);
+                            return Some(token);
+                        }
+                    }
+                    let Some((args, close)) = self.arguments(&mac, name, token.token.span) else {
+                        continue;
+                    };
+                    let hide = self.hide_sets.intersection(token.hide, close.hide);
+                    let hide = self.hide_sets.with(hide, name);
+                    let expansion = self.expansion(name, &token);
+                    self.substitute(&mac, &args, hide, expansion)
+                }
+            };
+            #[cfg(feature = "profile")]
+            if let (Some(profile), Some(start), false) = (&mut self.profile, start, fresh) {
+                profile.record(name.as_str(), start, expansion.len(), memoized);
+            }
+            let start = self.pending.len();
+            self.pending.extend(expansion.into_iter().rev());
+            if self.pending.len() > start {
+                self.pending.last_mut().expect("Expansion is not empty").space = token.space;
+            }
+        }
+    }
+
+    /// The expansion of the object-like macro `name` at `token`, rescanned on
+    /// its own the first time, unless it depends on where the macro is used:
+    /// on `__FILE__`, `__LINE__`, `_Pragma` or a function-like macro name at
+    /// its end, which the tokens after it may invoke.
+    fn memoized(&mut self, name: Symbol, token: &PpToken) -> Option<Vec<PpToken>> {
+        let key = (name, token.hide);
+        if let Some(memo) = self.memo.get(&key) {
+            let (tokens, expansions) = memo.clone()?;
+            return Some(self.relocate(&tokens, expansions, token));
+        }
+        // Uses of the macro within its expansion are expanded as usual
+        self.memo.insert(key, None);
+        let errors = self.errors.len();
+        let used_context = std::mem::replace(&mut self.used_context, false);
+        let first = self.expansions.len() as u32;
+        let expansion = self.expand_list(vec![token.clone()]);
+        let expansions = first..self.expansions.len() as u32;
+        let open_call = expansion.last().is_some_and(|last| {
+            name_of(last).is_some_and(|name| {
+                !self.hide_sets.contains(last.hide, name)
+                    && self.macros.get(&name).is_some_and(|mac| mac.params.is_some())
+            })
+        });
+        let memoize = !self.used_context && !open_call && self.errors.len() == errors;
+        self.used_context |= used_context;
+        self.errors.truncate(errors);
+        if !memoize {
+            return None;
+        }
+        self.memo.insert(key, Some((expansion.as_slice().into(), expansions)));
+        Some(expansion)
+    }
+
+    /// Record the expansion of the macro `name` at `token`, returning its
+    /// index.
+    fn expansion(&mut self, name: Symbol, token: &PpToken) -> u32 {
+        self.expansions.push(Expansion {
+            name,
+            site: token.token.span,
+            parent: (token.expansion < IN_BODY).then_some(ExpansionId::from(token.expansion)),
+        });
+        (self.expansions.len() - 1) as u32
+    }
+
+    /// The memoized expansion `tokens` of a macro, used again at `token`.
+    /// The `expansions` recorded while expanding it the first time, the first
+    /// of which is the expansion of the macro itself, are recorded again for
+    /// this use, with the site of the first from `token`.
+    fn relocate(&mut self, tokens: &[PpToken], expansions: Range<u32>, token: &PpToken) -> Vec<PpToken> {
+        let base = self.expansions.len() as u32;
+        let relocated = |index: u32| match expansions.contains(&index) {
+            true => index - expansions.start + base,
+            false => index,
+        };
+        for index in expansions.clone() {
+            let mut expansion = self.expansions[index as usize].clone();
+            if index == expansions.start {
+                expansion.site = token.token.span;
+                expansion.parent = (token.expansion < IN_BODY).then_some(ExpansionId::from(token.expansion));
+            } else {
+                expansion.parent = expansion
+                    .parent
+                    .map(|parent| ExpansionId::from(relocated(parent.idx() as u32)));
+            }
+            self.expansions.push(expansion);
+        }
+        (tokens.iter())
+            .map(|memo| PpToken {
+                expansion: relocated(memo.expansion),
+                ..memo.clone()
+            })
+            .collect()
+    }
+
+    /// Macro-expand `tokens` on their own, as for a macro argument.
+    fn expand_list(&mut self, mut tokens: Vec<PpToken>) -> Vec<PpToken> {
+        tokens.reverse();
+        let pending = std::mem::replace(&mut self.pending, tokens);
+        let isolated = std::mem::replace(&mut self.isolated, true);
+        let mut expanded = Vec::new();
+        while let Some(token) = self.expand_next() {
+            expanded.push(token);
+        }
+        self.pending = pending;
+        self.isolated = isolated;
+        expanded
+    }
+
+    /// Drop `_Pragma ( string-literal )`, running `_Pragma("once")`. Returns
+    /// `false`, reading nothing, if the tokens do not follow.
+    fn pragma_operator(&mut self) -> bool {
+        let mut tokens = Vec::new();
+        for _ in 0..3 {
+            tokens.extend(self.next_token());
+        }
+        let valid = match &tokens[..] {
+            [open, pragma, close] => {
+                is_punct(open, Punctuator::LeftParen)
+                    && matches!(pragma.token.value, BalancedToken::StringLiteral(_))
+                    && is_punct(close, Punctuator::RightParen)
+            }
+            _ => false,
+        };
+        if !valid {
+            self.pending.extend(tokens.into_iter().rev());
+            return false;
+        }
+        if let BalancedToken::StringLiteral(pragma) = &tokens[1].token.value
+            && pragma.concatenated().as_str().trim() == "once"
+            && let Some(frame) = self.frames.last()
+        {
+            self.once.insert(frame.file);
+        }
+        true
+    }
+
+    /// Read the arguments of an invocation of the function-like macro `mac`
+    /// after its `(`, returning them and the closing `)`.
+    fn arguments(&mut self, mac: &Macro, name: Symbol, span: Span) -> Option<(Vec<Vec<PpToken>>, PpToken)> {
+        let params = mac.params.as_ref().map_or(0, Vec::len);
+        let mut args = vec![Vec::new()];
+        let mut depth = 0;
+        let close = loop {
+            let Some(token) = self.next_token() else {
+                self.error(span, format!("unterminated invocation of macro `{name}`"));
+                return None;
+            };
+            match token.token.value {
+                BalancedToken::Punctuator(Punctuator::LeftParen) => depth += 1,
+                BalancedToken::Punctuator(Punctuator::RightParen) if depth == 0 => break token,
+                BalancedToken::Punctuator(Punctuator::RightParen) => depth -= 1,
+                BalancedToken::Punctuator(Punctuator::Comma)
+                    if depth == 0 && !(mac.variadic && args.len() == params) =>
+                {
+                    args.push(Vec::new());
+                    continue;
+                }
+                _ => {}
+            }
+            args.last_mut().expect("Arguments are not empty").push(token);
+        };
+
+        if params == 0 && args.len() == 1 && args[0].is_empty() {
+            args.clear();
+        }
+        // The variable arguments may be left out
+        if mac.variadic && args.len() + 1 == params {
+            args.push(Vec::new());
+        }
+        if args.len() != params {
+            self.error(
+                span,
+                format!("macro `{name}` takes {params} arguments, but {} were given", args.len()),
+            );
+            return None;
+        }
+        Some((args, close))
+    }
+
+    /// The replacement of an invocation of `mac` with `args`, with the macros
+    /// of `hide` added to the hide sets of its tokens, and the tokens of the
+    /// body and those made by `#` and `##` coming from `expansion`.
+    fn substitute(&mut self, mac: &Macro, args: &[Vec<PpToken>], hide: HideSet, expansion: u32) -> Vec<PpToken> {
+        let mut substitution = Substitution {
+            mac,
+            args,
+            expanded: vec![None; args.len()],
+        };
+        let mut output = Vec::new();
+        self.substitute_into(&mut substitution, &mac.body, &mut output);
+        for token in &mut output {
+            token.hide = self.hide_sets.union(token.hide, hide);
+            if token.expansion == IN_BODY {
+                token.expansion = expansion;
+            }
+        }
+        output
+    }
+
+    /// Substitute the parameters in `body`, and run `#` and `##`. Returns
+    /// whether the substitution ends with a placemarker, an operand that
+    /// expanded to nothing.
+    fn substitute_into<'m>(
+        &mut self,
+        cx: &mut Substitution<'m>,
+        body: &'m [PpToken],
+        output: &mut Vec<PpToken>,
+    ) -> bool {
+        let mut placemarker = false;
+        let mut i = 0;
+        while i < body.len() {
+            let token = &body[i];
+            if cx.mac.params.is_some()
+                && is_punct(token, Punctuator::Hash)
+                && let Some(param) = body.get(i + 1).and_then(|token| cx.param(token))
+            {
+                output.push(self.stringize(&cx.args[param], token.token.span));
+                placemarker = false;
+                i += 2;
+                continue;
+            }
+            if is_punct(token, Punctuator::HashHash) && i + 1 < body.len() {
+                let mut rhs = Vec::new();
+                i += 1 + self.operand(cx, body, i + 1, true, &mut rhs).0;
+                if rhs.is_empty() {
+                    continue;
+                }
+                let mut rhs = rhs.into_iter();
+                match output.pop() {
+                    Some(lhs) if !placemarker => {
+                        let first = rhs.next().expect("Operand is not empty");
+                        self.paste(lhs, first, output);
+                    }
+                    lhs => output.extend(lhs),
+                }
+                output.extend(rhs);
+                placemarker = false;
+                continue;
+            }
+            let raw = body.get(i + 1).is_some_and(|next| is_punct(next, Punctuator::HashHash));
+            let (len, empty) = self.operand(cx, body, i, raw, output);
+            i += len;
+            placemarker = empty;
+        }
+        placemarker
+    }
+
+    /// Substitute the operand at `body[i]`, a parameter, `__VA_OPT__(...)` or
+    /// a token, returning the number of its tokens and whether it ends with a
+    /// placemarker. Parameters are replaced by
+    /// their argument as written if `raw`, e.g. next to `##`, and by the
+    /// macro-expanded argument otherwise.
+    fn operand<'m>(
+        &mut self,
+        cx: &mut Substitution<'m>,
+        body: &'m [PpToken],
+        i: usize,
+        raw: bool,
+        output: &mut Vec<PpToken>,
+    ) -> (usize, bool) {
+        let token = &body[i];
+        if let Some(param) = cx.param(token) {
+            let start = output.len();
+            if raw {
+                output.extend(cx.args[param].iter().cloned());
+            } else {
+                output.extend(self.expanded(cx, param).iter().cloned());
+            }
+            if let Some(first) = output.get_mut(start) {
+                first.space = token.space;
+            }
+            return (1, output.len() == start);
+        }
+        if cx.mac.variadic
+            && name_of(token) == Some(self.names.va_opt)
+            && body
+                .get(i + 1)
+                .is_some_and(|open| is_punct(open, Punctuator::LeftParen))
+            && let Some(close) = matching_paren(body, i + 1)
+        {
+            let va_args = cx.args.len() - 1;
+            let start = output.len();
+            let placemarker =
+                self.expanded(cx, va_args).is_empty() || self.substitute_into(cx, &body[i + 2..close], output);
+            return (close + 1 - i, placemarker || output.len() == start);
+        }
+        output.push(token.clone());
+        (1, false)
+    }
+
+    /// The macro-expanded argument `param`.
+    fn expanded<'c>(&mut self, cx: &'c mut Substitution<'_>, param: usize) -> &'c [PpToken] {
+        if cx.expanded[param].is_none() {
+            cx.expanded[param] = Some(self.expand_list(cx.args[param].clone()));
+        }
+        cx.expanded[param].as_deref().expect("Argument is expanded")
+    }
+
+    /// The string literal of `#` applied to `arg`.
+    fn stringize(&self, arg: &[PpToken], span: Span) -> PpToken {
+        let value = self.spellings(arg);
+        PpToken {
+            spelling: Some(escape(&value).into()),
+            token: Spanned::new(BalancedToken::StringLiteral(Arc::new(value.into())), span),
+            space: true,
+            hide: HideSet::default(),
+            expansion: IN_BODY,
+        }
+    }
+
+    /// Push the token of `##` applied to `lhs` and `rhs`, or both if they do
+    /// not form a token.
+    fn paste(&mut self, lhs: PpToken, rhs: PpToken, output: &mut Vec<PpToken>) {
+        let text = format!("{}{}", self.spelling(&lhs), self.spelling(&rhs));
+        let mut tokens = Vec::new();
+        lex_line(&text, 0, &mut tokens);
+        match tokens.pop() {
+            Some(token) if tokens.is_empty() && token.token.span.range() == (0..text.len()) => {
+                output.push(PpToken {
+                    token: Spanned::new(token.token.value, lhs.token.span),
+                    spelling: Some(text.into()),
+                    expansion: IN_BODY,
+                    ..lhs
+                });
+            }
+            _ => {
+                let message = format!(
+                    "pasting `{}` and `{}` does not give a valid token",
+                    self.spelling(&lhs),
+                    self.spelling(&rhs)
+                );
+                self.error(lhs.token.span, message);
+                output.extend([lhs, rhs]);
+            }
+        }
+    }
+}
+
+/// The index of the `)` matching the `(` at `tokens[open]`.
+fn matching_paren(tokens: &[PpToken], open: usize) -> Option<usize> {
+    let mut depth = 0;
+    for (i, token) in tokens.iter().enumerate().skip(open) {
+        match token.token.value {
+            BalancedToken::Punctuator(Punctuator::LeftParen) => depth += 1,
+            BalancedToken::Punctuator(Punctuator::RightParen) => {
+                depth -= 1;
+                if depth == 0 {
+                    return Some(i);
+                }
+            }
+            _ => {}
+        }
+    }
+    None
+}
+
+/// Nest the tokens between brackets into groups, and join adjacent string
+/// literals, as the lexer does. Returns the runs of the tokens of the groups
+/// from the same expansion, given the expansion of each token in
+/// `expansions`, numbered as [`ContextMapping`] describes.
+///
+/// A closing bracket without an opening one is an unknown token, and the
+/// groups it closes by matching an outer bracket are unclosed.
+fn build_groups(
+    tokens: Vec<Spanned<BalancedToken>>,
+    expansions: &[u32],
+    eoi: Span,
+) -> (BalancedTokenSequence, Vec<(u32, u32)>) {
+    struct Group {
+        close: Punctuator,
+        open: Span,
+        outer: Vec<Spanned<BalancedToken>>,
+    }
+
+    fn end_group(groups: &mut Vec<Group>, tokens: &mut Vec<Spanned<BalancedToken>>, end: Span, closed: bool) {
+        let group = groups.pop().expect("Group is open");
+        let inner = std::mem::replace(tokens, group.outer);
+        let make_token = match group.close {
+            Punctuator::RightParen => BalancedToken::Parenthesized,
+            Punctuator::RightBracket => BalancedToken::Bracketed,
+            _ => BalancedToken::Braced,
+        };
+        let start = group.open.range().start;
+        let close = end.range().start.max(start);
+        let span = match closed {
+            true if start <= end.range().end => Span::new(start..end.range().end),
+            false => Span::new(start..close),
+            true => group.open,
+        };
+        let eoi = Span::new_eoi(close);
+        tokens.push(Spanned::new(
+            make_token(Arc::new(BalancedTokenSequence { tokens: inner, closed, eoi })),
+            span,
+        ));
+    }
+
+    let mut groups: Vec<Group> = Vec::new();
+    let mut current = Vec::new();
+    let mut runs: Vec<(u32, u32)> = Vec::new();
+    let mut index = 0;
+    for (token, &expansion) in tokens.into_iter().zip(expansions) {
+        // Closing brackets and joined string literals are not numbered
+        let numbered = match &token.value {
+            BalancedToken::Punctuator(
+                close @ (Punctuator::RightParen | Punctuator::RightBracket | Punctuator::RightBrace),
+            ) => !groups.iter().any(|group| group.close == *close),
+            BalancedToken::StringLiteral(_) => !matches!(
+                current.last(),
+                Some(Spanned {
+                    value: BalancedToken::StringLiteral(_),
+                    ..
+                })
+            ),
+            _ => true,
+        };
+        if numbered {
+            if runs.last().map_or(NO_EXPANSION, |&(_, last)| last) != expansion {
+                runs.push((index, expansion));
+            }
+            index += 1;
+        }
+        match token.value {
+            BalancedToken::Punctuator(
+                open @ (Punctuator::LeftParen | Punctuator::LeftBracket | Punctuator::LeftBrace),
+            ) => {
+                let close = match open {
+                    Punctuator::LeftParen => Punctuator::RightParen,
+                    Punctuator::LeftBracket => Punctuator::RightBracket,
+                    _ => Punctuator::RightBrace,
+                };
+                groups.push(Group {
+                    close,
+                    open: token.span,
+                    outer: std::mem::take(&mut current),
+                });
+            }
+            BalancedToken::Punctuator(
+                close @ (Punctuator::RightParen | Punctuator::RightBracket | Punctuator::RightBrace),
+            ) => match groups.iter().rposition(|group| group.close == close) {
+                Some(depth) => {
+                    while groups.len() > depth + 1 {
+                        end_group(&mut groups, &mut current, token.span, false);
+                    }
+                    end_group(&mut groups, &mut current, token.span, true);
+                }
+                None => current.push(Spanned::new(BalancedToken::Unknown, token.span)),
+            },
+            BalancedToken::StringLiteral(literals) => match current.last_mut() {
+                Some(Spanned {
+                    value: BalancedToken::StringLiteral(last),
+                    span,
+                }) => {
+                    Arc::make_mut(last).0.extend(Arc::unwrap_or_clone(literals).0);
+                    if span.range().start <= token.span.range().end {
+                        *span = Span::new(span.range().start..token.span.range().end);
+                    }
+                }
+                _ => current.push(Spanned::new(BalancedToken::StringLiteral(literals), token.span)),
+            },
+            value => current.push(Spanned::new(value, token.span)),
+        }
+    }
+    while !groups.is_empty() {
+        end_group(&mut groups, &mut current, eoi, false);
+    }
+    (BalancedTokenSequence { tokens: current, closed: true, eoi }, runs)
+}
+
+/// Evaluates the controlling expression of a conditional directive.
+struct Evaluator<'t> {
+    tokens: &'t [PpToken],
+    pos: usize,
+    /// Depth of operands that are not evaluated, where division by zero is
+    /// not an error.
+    skip: u32,
+}
+
+impl<'t> Evaluator<'t> {
+    fn peek(&self) -> Option<&'t BalancedToken> {
+        self.tokens.get(self.pos).map(|token| &token.token.value)
+    }
+
+    fn eat(&mut self, punctuator: Punctuator) -> bool {
+        let found = matches!(self.peek(), Some(BalancedToken::Punctuator(p)) if *p == punctuator);
+        self.pos += usize::from(found);
+        found
+    }
+
+    /// (6.5.15) conditional expression
+    fn conditional(&mut self) -> Result<i128, &'static str> {
+        let condition = self.binary(1)?;
+        if !self.eat(Punctuator::Question) {
+            return Ok(condition);
+        }
+        self.skip += u32::from(condition == 0);
+        let then = self.conditional()?;
+        self.skip -= u32::from(condition == 0);
+        if !self.eat(Punctuator::Colon) {
+            return Err("expected `:` in `#if`");
+        }
+        self.skip += u32::from(condition != 0);
+        let otherwise = self.conditional()?;
+        self.skip -= u32::from(condition != 0);
+        Ok(if condition != 0 { then } else { otherwise })
+    }
+
+    /// Binary operators of at least `min` precedence.
+    fn binary(&mut self, min: u8) -> Result<i128, &'static str> {
+        let mut lhs = self.unary()?;
+        loop {
+            let Some(BalancedToken::Punctuator(op)) = self.peek() else {
+                break;
+            };
+            let op = *op;
+            let precedence = match op {
+                Punctuator::Star | Punctuator::Slash | Punctuator::Percent => 10,
+                Punctuator::Plus | Punctuator::Minus => 9,
+                Punctuator::LeftShift | Punctuator::RightShift => 8,
+                Punctuator::Less | Punctuator::Greater | Punctuator::LessEqual | Punctuator::GreaterEqual => 7,
+                Punctuator::Equal | Punctuator::NotEqual => 6,
+                Punctuator::Ampersand => 5,
+                Punctuator::Caret => 4,
+                Punctuator::Pipe => 3,
+                Punctuator::LogicalAnd => 2,
+                Punctuator::LogicalOr => 1,
+                _ => break,
+            };
+            if precedence < min {
+                break;
+            }
+            self.pos += 1;
+            let skip = match op {
+                Punctuator::LogicalAnd => lhs == 0,
+                Punctuator::LogicalOr => lhs != 0,
+                _ => false,
+            };
+            self.skip += u32::from(skip);
+            let rhs = self.binary(precedence + 1)?;
+            self.skip -= u32::from(skip);
+            let shift = |rhs: i128| u32::try_from(rhs).ok().filter(|&rhs| rhs < i128::BITS);
+            lhs = match op {
+                Punctuator::Star => lhs.wrapping_mul(rhs),
+                Punctuator::Slash | Punctuator::Percent if rhs == 0 => {
+                    if self.skip == 0 {
+                        return Err("division by zero in `#if`");
+                    }
+                    0
+                }
+                Punctuator::Slash => lhs.wrapping_div(rhs),
+                Punctuator::Percent => lhs.wrapping_rem(rhs),
+                Punctuator::Plus => lhs.wrapping_add(rhs),
+                Punctuator::Minus => lhs.wrapping_sub(rhs),
+                Punctuator::LeftShift => shift(rhs).map_or(0, |rhs| lhs << rhs),
+                Punctuator::RightShift => shift(rhs).map_or(if lhs < 0 { -1 } else { 0 }, |rhs| lhs >> rhs),
+                Punctuator::Less => (lhs < rhs).into(),
+                Punctuator::Greater => (lhs > rhs).into(),
+                Punctuator::LessEqual => (lhs <= rhs).into(),
+                Punctuator::GreaterEqual => (lhs >= rhs).into(),
+                Punctuator::Equal => (lhs == rhs).into(),
+                Punctuator::NotEqual => (lhs != rhs).into(),
+                Punctuator::Ampersand => lhs & rhs,
+                Punctuator::Caret => lhs ^ rhs,
+                Punctuator::Pipe => lhs | rhs,
+                Punctuator::LogicalAnd => (lhs != 0 && rhs != 0).into(),
+                _ => (lhs != 0 || rhs != 0).into(),
+            };
+        }
+        Ok(lhs)
+    }
+
+    /// Unary operators and primary expressions.
+    fn unary(&mut self) -> Result<i128, &'static str> {
+        let token = self.peek().ok_or("missing operand in `#if`")?;
+        self.pos += 1;
+        Ok(match token {
+            BalancedToken::Punctuator(Punctuator::Plus) => self.unary()?,
+            BalancedToken::Punctuator(Punctuator::Minus) => self.unary()?.wrapping_neg(),
+            BalancedToken::Punctuator(Punctuator::Tilde) => !self.unary()?,
+            BalancedToken::Punctuator(Punctuator::Bang) => (self.unary()? == 0).into(),
+            BalancedToken::Punctuator(Punctuator::LeftParen) => {
+                let value = self.conditional()?;
+                if !self.eat(Punctuator::RightParen) {
+                    return Err("expected `)` in `#if`");
+                }
+                value
+            }
+            BalancedToken::Constant(Constant::Integer(integer)) => integer
+                .value
+                .to_u128()
+                .map_or(i128::MAX, |value| i128::try_from(value).unwrap_or(i128::MAX)),
+            BalancedToken::Constant(Constant::Character(character)) => {
+                character.value.chars().next().map_or(0, |ch| ch as i128)
+            }
+            BalancedToken::Constant(Constant::Predefined(PredefinedConstant::True)) => 1,
+            BalancedToken::Constant(Constant::Predefined(_)) => 0,
+            // Identifiers left after macro expansion are zero
+            BalancedToken::Identifier(_) => 0,
+            _ => return Err("invalid token in `#if`"),
+        })
+    }
+}
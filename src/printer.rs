@@ -1,8 +1,24 @@
 //! Pretty printer for the AST.
 
-use elegance::Render;
-
-use crate::{ast::*, visitor::Visitor};
+use std::{
+    cell::RefCell,
+    io::{self, BufWriter, Write},
+    ops::{ControlFlow, Range},
+    sync::Arc,
+};
+
+use elegance::{Io, Render};
+use macro_rules_attribute::apply;
+use rustc_hash::FxHashMap;
+
+use crate::{
+    ast::*,
+    lexer::lex_constant,
+    parallel::par_map,
+    span::{ContextMapping, Span},
+    utils::needs_space,
+    visitor::{Visitor, walk_block_item, walk_statement},
+};
 
 /// Precedence levels for C expressions (lower number = lower precedence = binds
 /// less tightly)
@@ -45,7 +61,7 @@ mod decl_precedence {
 /// This context tracks the precedence and associativity of the surrounding
 /// expression to enable minimal parenthesization when printing expressions.
 #[derive(Debug, Clone, Copy, Default)]
-pub struct Context {
+pub struct Context<'s> {
     /// the precedence of the surrounding context (0 = no context/top level)
     precedence: usize,
     /// whether we're in a position that requires parens at equal precedence
@@ -54,9 +70,24 @@ pub struct Context {
     /// the precedence of the surrounding declarator context (0 = no context/top
     /// level)
     decl_precedence: usize,
+    /// The text the printed tree was parsed from, to copy constants from
+    source: Option<&'s str>,
 }
 
-impl Context {
+impl<'s> Context<'s> {
+    /// A context for printing a tree parsed from `source`, which copies each
+    /// constant from its span in `source` where the constant there is the
+    /// same, keeping its spelling, e.g. hexadecimal floats, digit separators
+    /// and the case of suffixes.
+    pub fn with_source(source: &'s str) -> Self {
+        Self { source: Some(source), ..Self::default() }
+    }
+
+    /// The context at the top level, e.g. within parentheses.
+    fn top(self) -> Self {
+        Self { source: self.source, ..Self::default() }
+    }
+
     /// Check if an expression with the given precedence needs parentheses in
     /// this context
     fn needs_parens(&self, expr_prec: usize) -> bool {
@@ -106,8 +137,575 @@ fn expr_precedence(e: &Expression) -> usize {
 ///
 /// This type alias configures the elegance printer with the [`Context`] type
 /// for tracking expression precedence during printing.
-pub type Printer<'a, R> = elegance::Printer<'a, R, String, Context>;
+pub type Printer<'a, R> = elegance::Printer<'a, R, String, Context<'a>>;
+
+/// Pretty print `unit` to `writer`, with lines `width` columns wide.
+///
+/// The printer writes each part of the output as soon as its layout is
+/// decided, through a buffer, so the memory used is bounded by the largest
+/// external declaration rather than by the whole output, as happens when
+/// printing into a `String`.
+pub fn write_translation_unit(unit: &TranslationUnit, writer: impl Write, width: isize) -> io::Result<()> {
+    #[cfg(feature = "tracing")]
+    let _span = tracing::debug_span!("print", declarations = unit.external_declarations.len(), width).entered();
+    let mut writer = BufWriter::new(writer);
+    let mut printer = Printer::new_extra(Io(&mut writer), width, Context::default());
+    printer.visit_translation_unit(unit)?;
+    printer.finish()?;
+    writer.flush()
+}
+
+/// Number of external declarations printed together by a worker of
+/// [`print_parallel`].
+const PARALLEL_CHUNK: usize = 64;
+
+/// Pretty print `unit` into a string on all available cores, with lines
+/// `width` columns wide.
+///
+/// The layout of each external declaration does not depend on the others, so
+/// runs of declarations are printed into separate buffers by worker threads
+/// and concatenated in order. The output is the same as printing the unit
+/// with [`Printer::visit_translation_unit`].
+pub fn print_parallel(unit: &TranslationUnit, width: isize) -> String {
+    #[cfg(feature = "tracing")]
+    let _span = tracing::debug_span!("print", declarations = unit.external_declarations.len(), width).entered();
+    let chunks: Vec<_> = unit.external_declarations.chunks(PARALLEL_CHUNK).collect();
+    let outputs = par_map(&chunks, |declarations| {
+        let mut printer = Printer::new_extra(String::new(), width, Context::default());
+        for declaration in *declarations {
+            printer
+                .visit_external_declaration(declaration)
+                .and_then(|()| printer.hard_break())
+                .expect("Printing into a string does not fail");
+        }
+        printer.finish().expect("Printing into a string does not fail")
+    });
+    let mut output = String::with_capacity(outputs.iter().map(String::len).sum());
+    for chunk in outputs {
+        output.push_str(&chunk);
+    }
+    output
+}
+
+/// Print `unit`, a rewrite of `original` parsed from `source`, copying the
+/// external declarations it does not change from the source.
+///
+/// An external declaration of `unit` is unchanged if `original` has an equal
+/// one at the same span, e.g. because a [`VisitorMut`](crate::VisitorMut)
+/// left it alone. Unchanged declarations are written verbatim, keeping their
+/// formatting and comments, and the others are pretty printed with lines
+/// `width` columns wide, so the printing cost grows with the size of the
+/// edit rather than with the size of the file.
+///
+/// Constants in the declarations printed are copied from the source where it
+/// still spells them, see [`Context::with_source`].
+pub fn print_rewritten(unit: &TranslationUnit, original: &TranslationUnit, source: &str, width: isize) -> String {
+    #[cfg(feature = "tracing")]
+    let _span = tracing::debug_span!("print", declarations = unit.external_declarations.len(), width).entered();
+    let originals: FxHashMap<Span, &ExternalDeclaration> = original
+        .external_declarations
+        .iter()
+        .map(|declaration| (declaration.span(), declaration))
+        .collect();
+    let mut output = String::new();
+    for declaration in &unit.external_declarations {
+        let span = declaration.span();
+        let verbatim = originals
+            .get(&span)
+            .filter(|original| **original == declaration)
+            .and_then(|_| source.get(span.range()))
+            .filter(|text| !text.is_empty());
+        if let Some(text) = verbatim {
+            output.push_str(text);
+            output.push('\n');
+            continue;
+        }
+        let mut printer = Printer::new_extra(String::new(), width, Context::with_source(source));
+        printer
+            .visit_external_declaration(declaration)
+            .and_then(|()| printer.hard_break())
+            .expect("Printing into a string does not fail");
+        output.push_str(&printer.finish().expect("Printing into a string does not fail"));
+    }
+    output
+}
+
+/// A replacement of the text of a source.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct TextEdit {
+    /// The byte range of the source replaced.
+    pub range: Range<usize>,
+    /// The text put in its place.
+    pub text: String,
+}
 
+/// Pretty print the part of `unit`, parsed from `source`, around the byte
+/// `range`, with lines `width` columns wide, e.g. to format the statement
+/// just typed in an editor.
+///
+/// The smallest declaration or statement with a span that encloses the range
+/// is printed on its own, and continues the indentation of the line it starts
+/// on. A range across several external declarations formats each of them.
+/// The external declarations are found by their spans, in logarithmic time,
+/// and only the one that is formatted is looked into, so the cost does not
+/// grow with the size of the file.
+///
+/// Statements in a compound statement have no span of their own, so a range
+/// over one that is not the body of another statement formats the enclosing
+/// block, or the whole function definition.
+pub fn format_range(unit: &TranslationUnit, source: &str, range: Range<usize>, width: isize) -> Vec<TextEdit> {
+    let declarations = &unit.external_declarations;
+    let first = declarations.partition_point(|d| d.span().range().end < range.start);
+    let last = declarations.partition_point(|d| d.span().range().start <= range.end);
+    let declarations = declarations.get(first..last).unwrap_or_default();
+    let node = match declarations {
+        [ExternalDeclaration::Function(f)] => {
+            let mut enclosing = Enclosing { range, node: None };
+            enclosing.visit_compound_statement(&f.body);
+            enclosing.node
+        }
+        _ => None,
+    };
+    match node {
+        Some(node) => vec![format_node(node, source, width)],
+        None => (declarations.iter())
+            .map(|d| format_node(Node::External(d), source, width))
+            .collect(),
+    }
+}
+
+/// A node that [`format_range`] prints on its own.
+#[derive(Clone, Copy)]
+enum Node<'a> {
+    External(&'a ExternalDeclaration),
+    Declaration(&'a Declaration),
+    Statement(&'a Statement),
+}
+
+/// Finds the innermost declaration or statement of a function body whose span
+/// encloses `range`.
+struct Enclosing<'a> {
+    range: Range<usize>,
+    node: Option<Node<'a>>,
+}
+
+impl Enclosing<'_> {
+    fn encloses(&self, span: Span) -> bool {
+        let span = span.range();
+        span.start <= self.range.start && self.range.end <= span.end
+    }
+}
+
+impl<'a> Visitor<'a> for Enclosing<'a> {
+    type Result = ();
+
+    fn visit_statement(&mut self, s: &'a Statement) {
+        // Statements outside of the range need not be looked into
+        if self.encloses(s.span) {
+            self.node = Some(Node::Statement(s));
+            walk_statement(self, s)
+        }
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        if self.encloses(d.span) {
+            self.node = Some(Node::Declaration(d));
+        }
+    }
+
+    fn visit_expression(&mut self, _: &'a Expression) {}
+}
+
+fn format_node(node: Node, source: &str, width: isize) -> TextEdit {
+    let range = match node {
+        Node::External(d) => d.span(),
+        Node::Declaration(d) => d.span,
+        Node::Statement(s) => s.span,
+    }
+    .range();
+    let line = &source[source[..range.start].rfind('\n').map_or(0, |i| i + 1)..];
+    let indent = &line[..line.len() - line.trim_start_matches([' ', '\t']).len()];
+
+    let mut printer = Printer::new_extra(
+        String::new(),
+        (width - indent.len() as isize).max(1),
+        Context::with_source(source),
+    );
+    match node {
+        Node::External(d) => printer.visit_external_declaration(d),
+        // As in a compound statement
+        Node::Declaration(d) => printer.igroup(2, |pp| pp.visit_declaration(d)),
+        Node::Statement(s) => printer.igroup(2, |pp| pp.visit_statement(s)),
+    }
+    .expect("Printing into a string does not fail");
+    let printed = printer.finish().expect("Printing into a string does not fail");
+
+    let mut text = String::with_capacity(printed.len());
+    for (i, line) in printed.lines().enumerate() {
+        if i > 0 {
+            text.push('\n');
+            if !line.is_empty() {
+                text.push_str(indent);
+            }
+        }
+        text.push_str(line);
+    }
+    TextEdit { range, text }
+}
+
+/// The layout operations used by the [`Visitor`] implementation of the
+/// printers, see [`CompactPrinter`].
+trait Layout<'a> {
+    type Error;
+
+    fn text(&mut self, text: &'a str) -> Result<(), Self::Error>;
+
+    fn text_owned(&mut self, text: String) -> Result<(), Self::Error>;
+
+    fn space(&mut self) -> Result<(), Self::Error>;
+
+    fn scan_break(&mut self, size: usize, offset: isize) -> Result<(), Self::Error>;
+
+    fn hard_break(&mut self) -> Result<(), Self::Error>;
+
+    fn igroup(
+        &mut self,
+        indent: isize,
+        f: impl FnOnce(&mut Self) -> Result<(), Self::Error>,
+    ) -> Result<(), Self::Error>;
+
+    fn cgroup(
+        &mut self,
+        indent: isize,
+        f: impl FnOnce(&mut Self) -> Result<(), Self::Error>,
+    ) -> Result<(), Self::Error>;
+
+    /// Note that the following tokens come from the source at `span`.
+    fn mark_span(&mut self, _span: Span) -> Result<(), Self::Error> {
+        Ok(())
+    }
+
+    /// The text of `s` to print as one token, if it is not laid out
+    /// specifier by specifier, see [`flat_specifiers`].
+    fn flat_specifiers(&mut self, _s: &DeclarationSpecifiers) -> Option<String> {
+        None
+    }
+
+    /// The source text of the constant `c` at `span`, if it is copied from
+    /// the source, see [`Context::with_source`].
+    fn constant_source(&mut self, _span: Span, _c: &Constant) -> Option<&'a str> {
+        None
+    }
+}
+
+impl<'a, R: Render> Layout<'a> for Printer<'a, R> {
+    type Error = R::Error;
+
+    fn text(&mut self, text: &'a str) -> Result<(), R::Error> {
+        elegance::Printer::text(self, text)
+    }
+
+    fn text_owned(&mut self, text: String) -> Result<(), R::Error> {
+        elegance::Printer::text_owned(self, text)
+    }
+
+    fn space(&mut self) -> Result<(), R::Error> {
+        elegance::Printer::space(self)
+    }
+
+    fn scan_break(&mut self, size: usize, offset: isize) -> Result<(), R::Error> {
+        elegance::Printer::scan_break(self, size as _, offset as _)
+    }
+
+    fn hard_break(&mut self) -> Result<(), R::Error> {
+        elegance::Printer::hard_break(self)
+    }
+
+    fn igroup(&mut self, indent: isize, f: impl FnOnce(&mut Self) -> Result<(), R::Error>) -> Result<(), R::Error> {
+        elegance::Printer::igroup(self, indent as _, f)
+    }
+
+    fn cgroup(&mut self, indent: isize, f: impl FnOnce(&mut Self) -> Result<(), R::Error>) -> Result<(), R::Error> {
+        elegance::Printer::cgroup(self, indent as _, f)
+    }
+
+    fn flat_specifiers(&mut self, s: &DeclarationSpecifiers) -> Option<String> {
+        flat_specifiers(s)
+    }
+
+    fn constant_source(&mut self, span: Span, c: &Constant) -> Option<&'a str> {
+        // A constant changed in place keeps its span, so the text there is
+        // checked to still spell it
+        let text = self.extra.source?.get(span.range())?;
+        (lex_constant(text).as_ref() == Some(c)).then_some(text)
+    }
+}
+
+/// Number of specifier lists whose text is kept by each thread.
+const FLAT_SPECIFIERS: usize = 4096;
+
+thread_local! {
+    /// The text of the specifier lists printed on this thread.
+    static SPECIFIERS: RefCell<FxHashMap<DeclarationSpecifiers, String>> = RefCell::default();
+}
+
+/// The text of `s`, with a space between specifiers, if they are all keywords
+/// and typedef names, e.g. `static inline` or `const unsigned long`.
+///
+/// The layout engine measures every token and break it is given, and header
+/// code repeats the same few specifier lists thousands of times, so the
+/// pretty printer gives such a list as one token, with its text memoized by
+/// value. A line is then never broken inside the specifiers, which only
+/// matters when a single list is wider than a line.
+fn flat_specifiers(s: &DeclarationSpecifiers) -> Option<String> {
+    let simple = |spec: &DeclarationSpecifier| match spec {
+        DeclarationSpecifier::StorageClass(_)
+        | DeclarationSpecifier::Function(_)
+        | DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::TypeQualifier(_)) => true,
+        DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::TypeSpecifier(ts)) => !matches!(
+            ts,
+            TypeSpecifier::BitInt(_)
+                | TypeSpecifier::Atomic(_)
+                | TypeSpecifier::Struct(_)
+                | TypeSpecifier::Enum(_)
+                | TypeSpecifier::Typeof(_)
+        ),
+        DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::AlignmentSpecifier(_)) => false,
+    };
+    // A single specifier is one token anyway
+    if s.specifiers.len() < 2 || !s.specifiers.iter().all(simple) {
+        return None;
+    }
+    SPECIFIERS.with_borrow_mut(|memo| {
+        if let Some(text) = memo.get(s) {
+            return Some(text.clone());
+        }
+        let mut printer = CompactPrinter::new(Vec::new());
+        for (i, spec) in s.specifiers.iter().enumerate() {
+            if i > 0 {
+                printer.space().ok()?;
+            }
+            printer.visit_declaration_specifier(spec).ok()?;
+        }
+        let text = String::from_utf8(printer.finish()).ok()?;
+        if memo.len() >= FLAT_SPECIFIERS {
+            memo.clear();
+        }
+        memo.insert(s.clone(), text.clone());
+        Some(text)
+    })
+}
+
+/// A printer that writes the tokens of the AST with as few spaces as
+/// possible, and a line break only after each external declaration.
+///
+/// Compiling generated code does not need line breaking, and the layout of
+/// the pretty [`Printer`] is most of its cost, so this printer writes straight
+/// to its writer, which should be buffered. It shares the [`Visitor`]
+/// implementation of the pretty printer, so it prints the same tokens and the
+/// same parentheses: only the spacing differs.
+///
+/// With [`CompactPrinter::with_line_markers`], it also writes `#line`
+/// directives, so that compiler diagnostics and debug information refer to
+/// the lines of the original source of each declaration and statement.
+pub struct CompactPrinter<'m, W> {
+    writer: W,
+    /// Last byte written on the current line.
+    last: Option<u8>,
+    /// Whether the last token written is a number.
+    number: bool,
+    /// Whether a space was requested since the last token.
+    space: bool,
+    extra: Context<'static>,
+    line_markers: Option<LineMarkers<'m>>,
+}
+
+/// The source contexts of the spans of the AST, and the file and line of the
+/// current output line, once a line marker was written.
+struct LineMarkers<'m> {
+    ctx_map: &'m ContextMapping<'m>,
+    current: Option<(Option<Arc<str>>, usize)>,
+}
+
+impl<W: Write> CompactPrinter<'static, W> {
+    /// Create a compact printer that writes to `writer`.
+    pub fn new(writer: W) -> Self {
+        CompactPrinter {
+            writer,
+            last: None,
+            number: false,
+            space: false,
+            extra: Context::default(),
+            line_markers: None,
+        }
+    }
+}
+
+impl<'m, W: Write> CompactPrinter<'m, W> {
+    /// Create a compact printer that writes to `writer`, with `#line`
+    /// directives for the source contexts of the spans in `ctx_map`.
+    pub fn with_line_markers(writer: W, ctx_map: &'m ContextMapping<'m>) -> Self {
+        CompactPrinter {
+            writer,
+            last: None,
+            number: false,
+            space: false,
+            extra: Context::default(),
+            line_markers: Some(LineMarkers { ctx_map, current: None }),
+        }
+    }
+
+    /// Get the writer back.
+    pub fn finish(self) -> W {
+        self.writer
+    }
+
+    /// Write a token, after a space if one was requested and is needed.
+    fn token(&mut self, text: &str) -> io::Result<()> {
+        let bytes = text.as_bytes();
+        let (Some(&first), Some(&last)) = (bytes.first(), bytes.last()) else {
+            return Ok(());
+        };
+        if self.space
+            && self
+                .last
+                .is_some_and(|previous| needs_space(previous, first, self.number))
+        {
+            self.writer.write_all(b" ")?;
+        }
+        self.writer.write_all(bytes)?;
+        self.last = Some(last);
+        self.number = first.is_ascii_digit() || (first == b'.' && bytes.get(1).is_some_and(u8::is_ascii_digit));
+        self.space = false;
+        Ok(())
+    }
+
+    fn newline(&mut self) -> io::Result<()> {
+        self.writer.write_all(b"\n")?;
+        self.last = None;
+        self.space = false;
+        if let Some(LineMarkers { current: Some((_, line)), .. }) = &mut self.line_markers {
+            *line += 1;
+        }
+        Ok(())
+    }
+}
+
+impl<'a, W: Write> Layout<'a> for CompactPrinter<'_, W> {
+    type Error = io::Error;
+
+    fn text(&mut self, text: &'a str) -> io::Result<()> {
+        self.token(text)
+    }
+
+    fn text_owned(&mut self, text: String) -> io::Result<()> {
+        self.token(&text)
+    }
+
+    fn space(&mut self) -> io::Result<()> {
+        self.space = true;
+        Ok(())
+    }
+
+    fn scan_break(&mut self, size: usize, _offset: isize) -> io::Result<()> {
+        self.space |= size > 0;
+        Ok(())
+    }
+
+    fn hard_break(&mut self) -> io::Result<()> {
+        self.newline()
+    }
+
+    fn igroup(&mut self, _indent: isize, f: impl FnOnce(&mut Self) -> io::Result<()>) -> io::Result<()> {
+        f(self)
+    }
+
+    fn cgroup(&mut self, _indent: isize, f: impl FnOnce(&mut Self) -> io::Result<()>) -> io::Result<()> {
+        f(self)
+    }
+
+    fn mark_span(&mut self, span: Span) -> io::Result<()> {
+        let Some(markers) = &self.line_markers else {
+            return Ok(());
+        };
+        // Nodes made outside the parser have no span
+        if span.range().is_empty() {
+            return Ok(());
+        }
+        let ctx_map = markers.ctx_map;
+        let line = span.line_col(ctx_map).line;
+        let filename = ctx_map
+            .context(span.context_id(ctx_map))
+            .map(|ctx| ctx.filename.clone());
+        match &markers.current {
+            Some((current_filename, current_line)) if *current_filename == filename && *current_line == line => {
+                return Ok(());
+            }
+            Some((current_filename, current_line)) if *current_filename == filename && *current_line + 1 == line => {
+                return self.newline();
+            }
+            _ => {}
+        }
+        if self.last.is_some() {
+            self.writer.write_all(b"\n")?;
+        }
+        match &filename {
+            Some(filename) => {
+                let filename = filename.replace('\\', "\\\\").replace('"', "\\\"");
+                writeln!(self.writer, "#line {line} \"{filename}\"")?
+            }
+            None => writeln!(self.writer, "#line {line}")?,
+        }
+        self.last = None;
+        self.space = false;
+        if let Some(markers) = &mut self.line_markers {
+            markers.current = Some((filename, line));
+        }
+        Ok(())
+    }
+}
+
+/// The span of the first declaration or expression in `item`.
+fn first_span(item: &BlockItem) -> Option<Span> {
+    struct FirstSpan;
+
+    impl<'a> Visitor<'a> for FirstSpan {
+        type Result = ControlFlow<Span>;
+
+        fn visit_declaration(&mut self, d: &'a Declaration) -> Self::Result {
+            ControlFlow::Break(d.span)
+        }
+
+        fn visit_expression(&mut self, e: &'a Expression) -> Self::Result {
+            ControlFlow::Break(e.span)
+        }
+    }
+
+    walk_block_item(&mut FirstSpan, item).break_value()
+}
+
+/// Implements [`Visitor`] for the [`CompactPrinter`] with the same body as
+/// for the [`Printer`].
+macro_rules! also_compact {
+    (
+        impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
+            type Result = Result<(), R::Error>;
+            $($body:tt)*
+        }
+    ) => {
+        impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
+            type Result = Result<(), R::Error>;
+            $($body)*
+        }
+
+        impl<'a, W: Write> Visitor<'a> for CompactPrinter<'_, W> {
+            type Result = io::Result<()>;
+            $($body)*
+        }
+    };
+}
+
+#[apply(also_compact)]
 impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
     type Result = Result<(), R::Error>;
 
@@ -145,6 +743,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
 
     fn visit_translation_unit(&mut self, tu: &'a TranslationUnit) -> Self::Result {
         for external in &tu.external_declarations {
+            self.mark_span(external.span())?;
             self.visit_external_declaration(external)?;
             self.hard_break()?;
         }
@@ -382,6 +981,11 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
     }
 
     fn visit_expression(&mut self, e: &'a Expression) -> Self::Result {
+        if let ExpressionKind::Postfix(PostfixExpression::Primary(PrimaryExpression::Constant(c))) = &e.kind
+            && let Some(text) = self.constant_source(e.span, c)
+        {
+            return self.text(text);
+        }
         let ctx = self.extra;
         let expr_prec = expr_precedence(e);
         let needs_parens = ctx.needs_parens(expr_prec);
@@ -393,7 +997,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
         }
 
         // Reset context for inner expression processing
-        self.extra = Context::default();
+        self.extra = self.extra.top();
 
         match &e.kind {
             ExpressionKind::Postfix(p) => self.visit_postfix_expression(p)?,
@@ -429,6 +1033,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: op_prec,
                 assoc: false,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&b.left)?;
             pp.space()?;
@@ -442,6 +1047,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: op_prec,
                 assoc: true,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&b.right)
         })
@@ -479,6 +1085,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: precedence::CONDITIONAL,
                 assoc: true,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&cond.condition)?;
             pp.space()?;
@@ -487,7 +1094,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
             pp.scan_break(1, 2)?;
 
             // then_expr can be any expression (comma is allowed inside ?:)
-            pp.extra = Context::default();
+            pp.extra = pp.extra.top();
             pp.visit_expression(&cond.then_expr)?;
             pp.space()?;
 
@@ -499,6 +1106,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: precedence::CONDITIONAL,
                 assoc: false,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&cond.else_expr)
         })
@@ -512,6 +1120,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: precedence::ASSIGNMENT,
                 assoc: true,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&a.left)?;
             pp.space()?;
@@ -524,6 +1133,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 precedence: precedence::ASSIGNMENT,
                 assoc: false,
                 decl_precedence: 0,
+                ..pp.extra
             };
             pp.visit_expression(&a.right)
         })
@@ -560,6 +1170,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::COMMA,
                     assoc: i > 0, // right side needs parens at equal precedence
                     decl_precedence: 0,
+                    ..pp.extra
                 };
                 pp.visit_expression(expr)?;
             }
@@ -776,7 +1387,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 self.text("[")?;
                 // Reset context since brackets protect the index expression
                 let old_ctx = self.extra;
-                self.extra = Context::default();
+                self.extra = self.extra.top();
                 self.visit_expression(index)?;
                 self.extra = old_ctx;
                 self.text("]")
@@ -792,7 +1403,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                         }
                         // Reset context since function call parens protect arguments
                         let old_ctx = pp.extra;
-                        pp.extra = Context::default();
+                        pp.extra = pp.extra.top();
                         pp.visit_expression(arg)?;
                         pp.extra = old_ctx;
                     }
@@ -854,7 +1465,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                 self.text("(")?;
                 // Reset context since the parens we're printing protect the inner expression
                 let old_ctx = self.extra;
-                self.extra = Context::default();
+                self.extra = self.extra.top();
                 self.visit_expression(e)?;
                 self.extra = old_ctx;
                 self.text(")")
@@ -865,7 +1476,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     pp.text("(")?;
                     // Reset context since _Generic parens protect the expressions
                     let old_ctx = pp.extra;
-                    pp.extra = Context::default();
+                    pp.extra = pp.extra.top();
                     pp.visit_expression(&g.controlling_expression)?;
                     pp.text(",")?;
                     pp.space()?;
@@ -908,6 +1519,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::UNARY,
                     assoc: false,
                     decl_precedence: 0,
+                    ..self.extra
                 };
                 self.visit_unary_expression(inner)?;
                 self.extra = old_ctx;
@@ -920,6 +1532,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::UNARY,
                     assoc: false,
                     decl_precedence: 0,
+                    ..self.extra
                 };
                 self.visit_unary_expression(inner)?;
                 self.extra = old_ctx;
@@ -932,6 +1545,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::CAST,
                     assoc: false,
                     decl_precedence: 0,
+                    ..self.extra
                 };
                 self.visit_cast_expression(operand)?;
                 self.extra = old_ctx;
@@ -945,6 +1559,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::UNARY,
                     assoc: false,
                     decl_precedence: 0,
+                    ..self.extra
                 };
                 self.visit_unary_expression(inner)?;
                 self.extra = old_ctx;
@@ -990,6 +1605,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
                     precedence: precedence::CAST,
                     assoc: false,
                     decl_precedence: 0,
+                    ..self.extra
                 };
                 self.visit_cast_expression(expression)?;
                 self.extra = old_ctx;
@@ -1004,6 +1620,9 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
 
             for item in &c.items {
                 pp.space()?;
+                if let Some(span) = first_span(item) {
+                    pp.mark_span(span)?;
+                }
                 pp.igroup(2, |pp| pp.visit_block_item(item))?;
             }
             pp.scan_break(1, -2)?;
@@ -1012,6 +1631,9 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
     }
 
     fn visit_declaration_specifiers(&mut self, s: &'a DeclarationSpecifiers) -> Self::Result {
+        if let Some(text) = self.flat_specifiers(s) {
+            return self.text_owned(text);
+        }
         for (i, spec) in s.specifiers.iter().enumerate() {
             if i > 0 {
                 self.space()?;
@@ -1131,7 +1753,7 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
 
     fn visit_member_declaration(&mut self, m: &'a MemberDeclaration) -> Self::Result {
         match m {
-            MemberDeclaration::Normal { attributes, specifiers, declarators } => {
+            MemberDeclaration::Normal { attributes, specifiers, declarators, .. } => {
                 for a in attributes {
                     self.visit_attribute_specifier(a)?;
                     self.space()?;
@@ -1419,6 +2041,21 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
         })
     }
 
+    fn visit_constant_initializer(&mut self, c: &'a ConstantInitializer) -> Self::Result {
+        self.cgroup(2, |pp| {
+            pp.text("{")?;
+            for (i, constant) in c.constants.iter().enumerate() {
+                if i > 0 {
+                    pp.text(",")?;
+                }
+                pp.space()?;
+                print_constant(pp, &constant.value)?;
+            }
+            pp.scan_break(0, -2)?;
+            pp.text("}")
+        })
+    }
+
     fn visit_designated_initializer(&mut self, init: &'a DesignatedInitializer) -> Self::Result {
         self.igroup(2, |pp| {
             if let Some(designation) = &init.designation {
@@ -1552,10 +2189,10 @@ impl<'a, R: Render> Visitor<'a> for Printer<'a, R> {
     }
 }
 
-fn print_balanced_token_sequence<'a, R: Render>(
-    pp: &mut Printer<'a, R>,
+fn print_balanced_token_sequence<'a, L: Layout<'a>>(
+    pp: &mut L,
     seq: &'a BalancedTokenSequence,
-) -> Result<(), R::Error> {
+) -> Result<(), L::Error> {
     for (i, token) in seq.tokens.iter().enumerate() {
         if i > 0 {
             pp.space()?;
@@ -1608,7 +2245,7 @@ fn print_balanced_token_sequence<'a, R: Render>(
     Ok(())
 }
 
-fn print_string_literal<'a, R: Render>(pp: &mut Printer<'a, R>, lit: &'a StringLiteral) -> Result<(), R::Error> {
+fn print_string_literal<'a, L: Layout<'a>>(pp: &mut L, lit: &'a StringLiteral) -> Result<(), L::Error> {
     match &lit.encoding_prefix {
         Some(EncodingPrefix::U8) => pp.text("u8")?,
         Some(EncodingPrefix::U) => pp.text("u")?,
@@ -1637,7 +2274,7 @@ fn print_string_literal<'a, R: Render>(pp: &mut Printer<'a, R>, lit: &'a StringL
     pp.text("\"")
 }
 
-fn print_constant<'a, R: Render>(pp: &mut Printer<'a, R>, c: &'a Constant) -> Result<(), R::Error> {
+fn print_constant<'a, L: Layout<'a>>(pp: &mut L, c: &'a Constant) -> Result<(), L::Error> {
     match c {
         Constant::Integer(integer_constant) => {
             pp.text_owned(integer_constant.value.to_string())?;
@@ -1721,64 +2358,6 @@ fn print_constant<'a, R: Render>(pp: &mut Printer<'a, R>, c: &'a Constant) -> Re
     }
 }
 
-fn print_punctuator<'a, R: Render>(pp: &mut Printer<'a, R>, p: &'a Punctuator) -> Result<(), R::Error> {
-    let text = match p {
-        // Brackets
-        Punctuator::LeftBracket => "[",
-        Punctuator::RightBracket => "]",
-        Punctuator::LeftParen => "(",
-        Punctuator::RightParen => ")",
-        Punctuator::LeftBrace => "{",
-        Punctuator::RightBrace => "}",
-
-        // Operators
-        Punctuator::Dot => ".",
-        Punctuator::Arrow => "->",
-        Punctuator::Increment => "++",
-        Punctuator::Decrement => "--",
-        Punctuator::Ampersand => "&",
-        Punctuator::Star => "*",
-        Punctuator::Plus => "+",
-        Punctuator::Minus => "-",
-        Punctuator::Tilde => "~",
-        Punctuator::Bang => "!",
-        Punctuator::Slash => "/",
-        Punctuator::Percent => "%",
-        Punctuator::LeftShift => "<<",
-        Punctuator::RightShift => ">>",
-        Punctuator::Less => "<",
-        Punctuator::Greater => ">",
-        Punctuator::LessEqual => "<=",
-        Punctuator::GreaterEqual => ">=",
-        Punctuator::Equal => "==",
-        Punctuator::NotEqual => "!=",
-        Punctuator::Caret => "^",
-        Punctuator::Pipe => "|",
-        Punctuator::LogicalAnd => "&&",
-        Punctuator::LogicalOr => "||",
-        Punctuator::Question => "?",
-        Punctuator::Colon => ":",
-        Punctuator::Scope => "::",
-        Punctuator::Semicolon => ";",
-        Punctuator::Ellipsis => "...",
-
-        // Assignment
-        Punctuator::Assign => "=",
-        Punctuator::MulAssign => "*=",
-        Punctuator::DivAssign => "/=",
-        Punctuator::ModAssign => "%=",
-        Punctuator::AddAssign => "+=",
-        Punctuator::SubAssign => "-=",
-        Punctuator::LeftShiftAssign => "<<=",
-        Punctuator::RightShiftAssign => ">>=",
-        Punctuator::AndAssign => "&=",
-        Punctuator::XorAssign => "^=",
-        Punctuator::OrAssign => "|=",
-
-        // Other
-        Punctuator::Comma => ",",
-        Punctuator::Hash => "#",
-        Punctuator::HashHash => "##",
-    };
-    pp.text(text)
+fn print_punctuator<'a, L: Layout<'a>>(pp: &mut L, p: &'a Punctuator) -> Result<(), L::Error> {
+    pp.text(p.as_str())
 }
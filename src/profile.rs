@@ -0,0 +1,618 @@
+//! Per-rule parser profiling.
+//!
+//! With the `profile` feature, every labelled rule of the parser records how
+//! often it was entered, how often it succeeded, and how many tokens it read,
+//! once profiling is enabled with [`State::set_profile`]. Rules that fail are
+//! rewound by their caller, so the tokens they read are wasted work:
+//! backtracking hot spots show up as rules with many rewinds and discarded
+//! tokens.
+//!
+//! Counts and times are inclusive: a rule includes the rules it calls.
+//!
+//! Rules whose alternatives can be told apart by the next tokens try the
+//! alternative they predict first. The failed attempts at the alternatives
+//! before it, which the prediction saved, are counted as avoided.
+//!
+//! Likewise, a [`Preprocessor`] with [`Preprocessor::set_profile`] records
+//! how often each macro was expanded and the time spent collecting its
+//! arguments and substituting them, in a [`MacroProfile`]. The time of a
+//! macro includes the macros expanded in its arguments.
+//!
+//! To profile a whole run, such as a pass over a corpus, [`collect_totals`]
+//! makes every parse of every thread add to process-wide totals, whatever its
+//! state, and [`totals`] sums them up. With them, [`Profile::unused_rules`]
+//! lists the rules that were never tried and [`Profile::failing_rules`] those
+//! that never succeeded, the dead alternatives which only cost attempts. A
+//! [`TotalsDump`] held by `main` writes the totals out as the process exits.
+//!
+//! [`State::set_profile`]: crate::State::set_profile
+//! [`Preprocessor`]: crate::Preprocessor
+//! [`Preprocessor::set_profile`]: crate::Preprocessor::set_profile
+
+use std::{
+    collections::BTreeSet,
+    fmt::{self, Write},
+    fs, io,
+    path::PathBuf,
+    sync::{
+        Arc, LazyLock, Mutex, MutexGuard, PoisonError,
+        atomic::{AtomicBool, Ordering},
+    },
+    time::{Duration, Instant},
+};
+
+use rustc_hash::FxHashMap;
+
+/// Statistics of one rule.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct RuleStats {
+    /// Number of times the rule was tried.
+    pub entries: u64,
+    /// Number of times the rule succeeded.
+    pub successes: u64,
+    /// Number of times the rule failed, so that its caller rewound it.
+    pub rewinds: u64,
+    /// Tokens read by the rule, including tokens read again after rewinding.
+    pub tokens: u64,
+    /// Tokens read by attempts that failed.
+    pub discarded_tokens: u64,
+    /// Failed attempts at alternatives of the rule that were not made, as the
+    /// next tokens ruled them out.
+    pub avoided: u64,
+    /// Time spent in the rule.
+    pub time: Duration,
+}
+
+/// Statistics of all rules of a parse, see the [module documentation](self).
+#[derive(Debug, Default, Clone)]
+pub struct Profile {
+    rules: FxHashMap<&'static str, RuleStats>,
+    /// Tokens read so far.
+    pub(crate) tokens: u64,
+}
+
+/// Where a rule was entered, to pass to [`Profile::exit`].
+#[derive(Clone, Copy)]
+pub(crate) struct RuleEntry {
+    start: Instant,
+    tokens: u64,
+}
+
+impl Profile {
+    /// Statistics of the rule with the given label, if it was entered.
+    pub fn rule(&self, label: &str) -> Option<&RuleStats> {
+        self.rules.get(label)
+    }
+
+    /// Statistics of all entered rules, most expensive first.
+    pub fn rules(&self) -> Vec<(&'static str, RuleStats)> {
+        let mut rules: Vec<_> = self.rules.iter().map(|(&label, &stats)| (label, stats)).collect();
+        rules.sort_by(|(a, a_stats), (b, b_stats)| b_stats.time.cmp(&a_stats.time).then(a.cmp(b)));
+        rules
+    }
+
+    /// Total number of failed attempts avoided by looking ahead.
+    pub fn avoided(&self) -> u64 {
+        self.rules.values().map(|stats| stats.avoided).sum()
+    }
+
+    /// Render the statistics as a JSON array of objects, most expensive first.
+    ///
+    /// Times are in nanoseconds.
+    pub fn to_json(&self) -> String {
+        let mut json = String::from("[");
+        for (index, (label, stats)) in self.rules().into_iter().enumerate() {
+            if index > 0 {
+                json.push(',');
+            }
+            json.push_str("{\"rule\":");
+            push_json_string(&mut json, label);
+            write!(
+                json,
+                ",\"entries\":{},\"successes\":{},\"rewinds\":{},\"tokens\":{},\"discarded_tokens\":{},\"avoided\":{},\"time_ns\":{}}}",
+                stats.entries,
+                stats.successes,
+                stats.rewinds,
+                stats.tokens,
+                stats.discarded_tokens,
+                stats.avoided,
+                stats.time.as_nanos(),
+            )
+            .unwrap();
+        }
+        json.push(']');
+        json
+    }
+
+    /// Add the statistics of `other` to these.
+    pub fn merge(&mut self, other: &Profile) {
+        for (&label, other) in &other.rules {
+            let stats = self.rules.entry(label).or_default();
+            stats.entries += other.entries;
+            stats.successes += other.successes;
+            stats.rewinds += other.rewinds;
+            stats.tokens += other.tokens;
+            stats.discarded_tokens += other.discarded_tokens;
+            stats.avoided += other.avoided;
+            stats.time += other.time;
+        }
+        self.tokens += other.tokens;
+    }
+
+    /// Rules which were never tried, of those the parsers built so far in the
+    /// process, in order.
+    pub fn unused_rules(&self) -> Vec<&'static str> {
+        let rules = RULES.lock().unwrap_or_else(PoisonError::into_inner);
+        rules
+            .iter()
+            .copied()
+            .filter(|label| !self.rules.contains_key(label))
+            .collect()
+    }
+
+    /// Rules which were tried but never succeeded, in order.
+    pub fn failing_rules(&self) -> Vec<&'static str> {
+        let mut rules: Vec<_> = (self.rules.iter())
+            .filter(|(_, stats)| stats.entries > 0 && stats.successes == 0)
+            .map(|(&label, _)| label)
+            .collect();
+        rules.sort_unstable();
+        rules
+    }
+
+    pub(crate) fn enter(&self) -> RuleEntry {
+        RuleEntry::new(self.tokens)
+    }
+
+    pub(crate) fn exit(&mut self, label: &'static str, entry: RuleEntry, success: bool) {
+        self.record(label, entry, self.tokens, success);
+    }
+
+    fn record(&mut self, label: &'static str, entry: RuleEntry, tokens: u64, success: bool) {
+        let tokens = tokens - entry.tokens;
+        let stats = self.rules.entry(label).or_default();
+        stats.entries += 1;
+        stats.tokens += tokens;
+        stats.time += entry.start.elapsed();
+        if success {
+            stats.successes += 1;
+        } else {
+            stats.rewinds += 1;
+            stats.discarded_tokens += tokens;
+        }
+    }
+
+    pub(crate) fn avoid(&mut self, label: &'static str, attempts: u64) {
+        self.rules.entry(label).or_default().avoided += attempts;
+    }
+}
+
+impl RuleEntry {
+    fn new(tokens: u64) -> Self {
+        Self { start: Instant::now(), tokens }
+    }
+}
+
+/// Labels of the rules of the parsers built so far.
+static RULES: Mutex<BTreeSet<&'static str>> = Mutex::new(BTreeSet::new());
+
+/// Whether parses add to the totals.
+static COLLECT: AtomicBool = AtomicBool::new(false);
+
+/// The totals of the threads that parsed since [`collect_totals`].
+#[derive(Default)]
+struct Threads {
+    live: Vec<Arc<Mutex<Profile>>>,
+    /// The sum of the totals of the threads which have exited.
+    exited: Profile,
+}
+
+static THREADS: LazyLock<Mutex<Threads>> = LazyLock::new(Mutex::default);
+
+thread_local! {
+    /// The totals of this thread, only locked by [`totals`] from other
+    /// threads, so that recording a rule takes an uncontended lock.
+    static THREAD: Arc<Mutex<Profile>> = {
+        let profile = Arc::default();
+        threads().live.push(Arc::clone(&profile));
+        profile
+    };
+}
+
+fn threads() -> MutexGuard<'static, Threads> {
+    THREADS.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Set whether every parse, of any thread and whatever its state, adds the
+/// statistics of its rules to the process-wide [`totals`].
+///
+/// Collecting costs a clock read and an uncontended lock per rule tried.
+pub fn collect_totals(collect: bool) {
+    COLLECT.store(collect, Ordering::Relaxed);
+}
+
+/// Whether parses add to the process-wide [`totals`].
+pub fn collecting_totals() -> bool {
+    COLLECT.load(Ordering::Relaxed)
+}
+
+/// The statistics of all parses of all threads since [`collect_totals`] was
+/// enabled, or since [`reset_totals`].
+pub fn totals() -> Profile {
+    let mut threads = threads();
+    let Threads { live, exited } = &mut *threads;
+    // The totals of exited threads are only referenced here
+    live.retain(|profile| {
+        if Arc::strong_count(profile) > 1 {
+            return true;
+        }
+        exited.merge(&profile.lock().unwrap_or_else(PoisonError::into_inner));
+        false
+    });
+    let mut totals = exited.clone();
+    for profile in live.iter() {
+        totals.merge(&profile.lock().unwrap_or_else(PoisonError::into_inner));
+    }
+    totals
+}
+
+/// Clear the process-wide [`totals`].
+pub fn reset_totals() {
+    let mut threads = threads();
+    let Threads { live, exited } = &mut *threads;
+    *exited = Profile::default();
+    for profile in live.iter() {
+        *profile.lock().unwrap_or_else(PoisonError::into_inner) = Profile::default();
+    }
+}
+
+pub(crate) fn register_rule(label: &'static str) {
+    RULES.lock().unwrap_or_else(PoisonError::into_inner).insert(label);
+}
+
+/// Where a rule was entered, if parses add to the totals, to pass to
+/// [`exit_totals`] with the tokens read by then.
+pub(crate) fn enter_totals(tokens: u64) -> Option<RuleEntry> {
+    collecting_totals().then(|| RuleEntry::new(tokens))
+}
+
+pub(crate) fn exit_totals(label: &'static str, entry: RuleEntry, tokens: u64, success: bool) {
+    let _ = THREAD.try_with(|profile| {
+        let mut profile = profile.lock().unwrap_or_else(PoisonError::into_inner);
+        profile.record(label, entry, tokens, success);
+    });
+}
+
+pub(crate) fn avoid_totals(label: &'static str, attempts: u64) {
+    if collecting_totals() {
+        let _ = THREAD.try_with(|profile| {
+            let mut profile = profile.lock().unwrap_or_else(PoisonError::into_inner);
+            profile.avoid(label, attempts);
+        });
+    }
+}
+
+/// Writes the process-wide [`totals`] to a file when dropped, so that a
+/// `main` holding it dumps them as the process exits:
+///
+/// ```ignore
+/// fn main() {
+///     profile::collect_totals(true);
+///     let _dump = profile::TotalsDump::new("profile.json");
+///     // parse the corpus
+/// }
+/// ```
+///
+/// A path ending in `.json` gets an object with the [`Profile::to_json`]
+/// array as `rules`, and the unused and failing rules as `unused` and
+/// `failing`; any other path gets the table, followed by those rules.
+#[derive(Debug)]
+pub struct TotalsDump {
+    path: PathBuf,
+}
+
+impl TotalsDump {
+    /// Dump the totals to `path` when dropped.
+    pub fn new(path: impl Into<PathBuf>) -> Self {
+        Self { path: path.into() }
+    }
+
+    /// Write the totals now.
+    pub fn write(&self) -> io::Result<()> {
+        fs::write(
+            &self.path,
+            render_totals(&totals(), self.path.extension().is_some_and(|ext| ext == "json")),
+        )
+    }
+}
+
+impl Drop for TotalsDump {
+    fn drop(&mut self) {
+        if let Err(error) = self.write() {
+            eprintln!("cannot write the parser profile to {}: {error}", self.path.display());
+        }
+    }
+}
+
+fn render_totals(totals: &Profile, json: bool) -> String {
+    let (unused, failing) = (totals.unused_rules(), totals.failing_rules());
+    if json {
+        let mut json = format!("{{\"rules\":{}", totals.to_json());
+        for (key, labels) in [("unused", unused), ("failing", failing)] {
+            write!(json, ",\"{key}\":[").unwrap();
+            for (index, label) in labels.into_iter().enumerate() {
+                if index > 0 {
+                    json.push(',');
+                }
+                push_json_string(&mut json, label);
+            }
+            json.push(']');
+        }
+        json.push('}');
+        return json;
+    }
+    let mut text = totals.to_string();
+    for (heading, labels) in [("unused rules", unused), ("failing rules", failing)] {
+        write!(text, "\n{heading}:\n").unwrap();
+        for label in labels {
+            writeln!(text, "  {label}").unwrap();
+        }
+    }
+    text
+}
+
+fn push_json_string(json: &mut String, string: &str) {
+    json.push('"');
+    for c in string.chars() {
+        match c {
+            '"' => json.push_str("\\\""),
+            '\\' => json.push_str("\\\\"),
+            c if c.is_control() => write!(json, "\\u{:04x}", c as u32).unwrap(),
+            c => json.push(c),
+        }
+    }
+    json.push('"');
+}
+
+/// Statistics of the expansions of one macro.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct MacroStats {
+    /// Number of times the macro was expanded.
+    pub expansions: u64,
+    /// Number of expansions reused from an earlier expansion of the
+    /// object-like macro.
+    pub memoized: u64,
+    /// Tokens produced by the expansions, before they are rescanned.
+    pub tokens: u64,
+    /// Time spent in the expansions.
+    pub time: Duration,
+}
+
+/// Statistics of the macros expanded by a run of the preprocessor, see the
+/// [module documentation](self).
+#[derive(Debug, Default, Clone)]
+pub struct MacroProfile {
+    macros: FxHashMap<&'static str, MacroStats>,
+}
+
+impl MacroProfile {
+    /// Statistics of the macro with the given name, if it was expanded.
+    pub fn macro_stats(&self, name: &str) -> Option<&MacroStats> {
+        self.macros.get(name)
+    }
+
+    /// Statistics of all expanded macros, most expensive first.
+    pub fn macros(&self) -> Vec<(&'static str, MacroStats)> {
+        let mut macros: Vec<_> = self.macros.iter().map(|(&name, &stats)| (name, stats)).collect();
+        macros.sort_by(|(a, a_stats), (b, b_stats)| b_stats.time.cmp(&a_stats.time).then(a.cmp(b)));
+        macros
+    }
+
+    /// Total number of macro expansions.
+    pub fn expansions(&self) -> u64 {
+        self.macros.values().map(|stats| stats.expansions).sum()
+    }
+
+    /// Render the statistics as a JSON array of objects, most expensive first.
+    ///
+    /// Times are in nanoseconds.
+    pub fn to_json(&self) -> String {
+        let mut json = String::from("[");
+        for (index, (name, stats)) in self.macros().into_iter().enumerate() {
+            if index > 0 {
+                json.push(',');
+            }
+            // Macro names are identifiers, which need no escaping
+            write!(
+                json,
+                "{{\"macro\":\"{name}\",\"expansions\":{},\"memoized\":{},\"tokens\":{},\"time_ns\":{}}}",
+                stats.expansions,
+                stats.memoized,
+                stats.tokens,
+                stats.time.as_nanos(),
+            )
+            .unwrap();
+        }
+        json.push(']');
+        json
+    }
+
+    pub(crate) fn record(&mut self, name: &'static str, start: Instant, tokens: usize, memoized: bool) {
+        let stats = self.macros.entry(name).or_default();
+        stats.expansions += 1;
+        stats.memoized += u64::from(memoized);
+        stats.tokens += tokens as u64;
+        stats.time += start.elapsed();
+    }
+}
+
+/// Renders the statistics as a table, most expensive first.
+impl fmt::Display for MacroProfile {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let macros = self.macros();
+        let width = macros
+            .iter()
+            .map(|(name, _)| name.len())
+            .chain([5])
+            .max()
+            .unwrap_or_default();
+        writeln!(
+            f,
+            "{:width$}  {:>10}  {:>10}  {:>12}  {:>12}",
+            "macro", "expansions", "memoized", "tokens", "time",
+        )?;
+        for (name, stats) in macros {
+            writeln!(
+                f,
+                "{:width$}  {:>10}  {:>10}  {:>12}  {:>12}",
+                name,
+                stats.expansions,
+                stats.memoized,
+                stats.tokens,
+                format!("{:.3?}", stats.time),
+            )?;
+        }
+        Ok(())
+    }
+}
+
+/// Renders the statistics as a table, most expensive first.
+impl fmt::Display for Profile {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let rules = self.rules();
+        let width = rules
+            .iter()
+            .map(|(label, _)| label.len())
+            .chain([4])
+            .max()
+            .unwrap_or_default();
+        writeln!(
+            f,
+            "{:width$}  {:>10}  {:>10}  {:>10}  {:>12}  {:>12}  {:>10}  {:>12}",
+            "rule", "entries", "successes", "rewinds", "tokens", "discarded", "avoided", "time",
+        )?;
+        for (label, stats) in rules {
+            writeln!(
+                f,
+                "{:width$}  {:>10}  {:>10}  {:>10}  {:>12}  {:>12}  {:>10}  {:>12}",
+                label,
+                stats.entries,
+                stats.successes,
+                stats.rewinds,
+                stats.tokens,
+                stats.discarded_tokens,
+                stats.avoided,
+                format!("{:.3?}", stats.time),
+            )?;
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use chumsky::Parser;
+
+    use super::Profile;
+    use crate::{Preprocessor, State, lex, translation_unit};
+
+    #[test]
+    fn test_report() {
+        let mut profile = Profile::default();
+        let outer = profile.enter();
+        let inner = profile.enter();
+        profile.tokens += 3;
+        profile.exit("inner \"rule\"", inner, false);
+        profile.tokens += 2;
+        profile.exit("outer", outer, true);
+
+        let outer = profile.rule("outer").unwrap();
+        assert_eq!(
+            (outer.entries, outer.successes, outer.tokens, outer.discarded_tokens),
+            (1, 1, 5, 0)
+        );
+        let inner = profile.rule("inner \"rule\"").unwrap();
+        assert_eq!((inner.rewinds, inner.discarded_tokens), (1, 3));
+
+        let json = profile.to_json();
+        assert!(json.starts_with("[{") && json.ends_with("}]"));
+        assert!(json.contains("{\"rule\":\"outer\",\"entries\":1,\"successes\":1,\"rewinds\":0,\"tokens\":5,"));
+        assert!(json.contains("{\"rule\":\"inner \\\"rule\\\"\",\"entries\":1,"));
+        assert_eq!(profile.to_string().lines().count(), 3);
+    }
+
+    #[test]
+    fn test_avoided_attempts() {
+        let source = "enum { A }; int f(int); int x = A + (1) + y; int g(void) { return 0; }";
+        let (tokens, _) = lex(source, None);
+        let mut state = State::new();
+        state.set_profile(true);
+        let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+        assert!(!result.has_errors());
+
+        // Only the function definition is tried as one
+        let skipped = 1 + cfg!(feature = "quasi-quote") as u64;
+        let profile = state.profile().unwrap();
+        assert_eq!(profile.rule("external declaration").unwrap().avoided, 3 * skipped);
+        assert!(profile.rule("primiary expression").unwrap().avoided > 0);
+        assert!(profile.avoided() > 3 * skipped);
+    }
+
+    #[test]
+    fn test_totals() {
+        let parse = |source: &str| {
+            let (tokens, _) = lex(source, None);
+            assert!(!translation_unit().parse(tokens.as_input()).has_errors());
+        };
+        super::collect_totals(true);
+        super::reset_totals();
+        std::thread::scope(|scope| {
+            scope.spawn(|| parse("int x;"));
+            scope.spawn(|| parse("int f(void) { return 0; }"));
+        });
+        parse("int y;");
+        let totals = super::totals();
+        super::collect_totals(false);
+
+        // Other tests may parse while the totals are collected
+        let unit = totals.rule("translation unit").unwrap();
+        assert!(unit.entries >= 3 && unit.successes >= 3);
+        assert!(totals.rule("function definition").unwrap().successes >= 1);
+        let mut merged = Profile::default();
+        merged.merge(&totals);
+        merged.merge(&totals);
+        assert_eq!(merged.rule("translation unit").unwrap().entries, 2 * unit.entries);
+
+        // Every rule of the parsers built is known, tried or not
+        let unused = Profile::default().unused_rules();
+        assert!(unused.contains(&"static assert declaration"));
+        assert!(unused.contains(&"translation unit"));
+        assert!(!totals.unused_rules().contains(&"translation unit"));
+
+        let mut profile = Profile::default();
+        let entry = profile.enter();
+        profile.exit("never", entry, false);
+        assert_eq!(profile.failing_rules(), ["never"]);
+        let json = super::render_totals(&profile, true);
+        assert!(json.starts_with("{\"rules\":[{\"rule\":\"never\","));
+        assert!(json.ends_with(",\"failing\":[\"never\"]}"));
+    }
+
+    #[test]
+    fn test_macro_report() {
+        let mut preprocessor = Preprocessor::new();
+        preprocessor.set_profile(true);
+        let output = preprocessor.preprocess("#define ONE 1\n#define F(x) x + ONE\nF(ONE) ONE F(2)", "main.c");
+        let profile = output.profile.unwrap();
+
+        let one = profile.macro_stats("ONE").unwrap();
+        assert_eq!((one.expansions, one.memoized, one.tokens), (4, 2, 4));
+        let f = profile.macro_stats("F").unwrap();
+        assert_eq!((f.expansions, f.memoized, f.tokens), (2, 0, 6));
+        assert_eq!(profile.expansions(), 6);
+
+        let json = profile.to_json();
+        assert!(json.contains("{\"macro\":\"F\",\"expansions\":2,\"memoized\":0,\"tokens\":6,"));
+        assert_eq!(profile.to_string().lines().count(), 3);
+    }
+}
@@ -0,0 +1,837 @@
+//! Structural queries over the expressions of a translation unit.
+//!
+//! A [`Query`] is a pattern over expressions, written as s-expressions in the
+//! manner of tree-sitter queries, and compiled once. A [`QuerySet`] matches
+//! many queries in one walk of the tree, trying at each expression only the
+//! queries whose pattern can match its kind, and calls only against the
+//! queries for the name of their callee:
+//!
+//! ```ignore
+//! let set = QuerySet::new([
+//!     Query::new(r#"(call "memcpy" _ _ (sizeof _) @size)"#)?,
+//!     Query::new(r#"(assign "=" (arrow "next" _) (int 0))"#)?,
+//! ]);
+//! for m in set.matches(&unit) {
+//!     // ...
+//! }
+//! ```
+//!
+//! # Patterns
+//!
+//! | Pattern                         | Matches                                      |
+//! |---------------------------------|----------------------------------------------|
+//! | `_`                             | any expression                               |
+//! | `"name"`                        | the identifier `name`, as `(ident "name")`   |
+//! | `(ident "name"?)`               | an identifier or enumeration constant        |
+//! | `(int N?)`                      | an integer constant, with the value `N`      |
+//! | `(float)`, `(char)`             | a floating or character constant             |
+//! | `(string "text"?)`              | string literals, with the joined value       |
+//! | `(call F A* ..?)`               | a call of `F`                                |
+//! | `(index A I)`                   | an array access                              |
+//! | `(member "name"? X)`            | a member access `X.name`                     |
+//! | `(arrow "name"? X)`             | a member access `X->name`                    |
+//! | `(pre-inc X)`, `(pre-dec X)`    | a prefix increment or decrement              |
+//! | `(post-inc X)`, `(post-dec X)`  | a postfix increment or decrement             |
+//! | `(unary "op"? X)`               | a unary operator, e.g. `"&"` or `"!"`        |
+//! | `(sizeof X)`, `(sizeof-type)`   | `sizeof` of an expression or a type name     |
+//! | `(alignof)`                     | `alignof` of a type name                     |
+//! | `(cast X)`                      | a cast of `X`                                |
+//! | `(binary "op"? L R)`            | a binary operator, e.g. `"+"` or `"=="`      |
+//! | `(assign "op"? L R)`            | an assignment, e.g. `"="` or `"+="`          |
+//! | `(cond C T E)`                  | a conditional expression                     |
+//! | `(comma X* ..?)`                | a comma expression                           |
+//!
+//! The arguments of calls and comma expressions are matched exactly, or as a
+//! prefix when the list ends with `..`. Any pattern followed by `@name`
+//! captures the expression it matches. Parentheses in the source are seen
+//! through, so `(binary "*" _ _)` matches `(a * b)` too.
+//!
+//! Only whole expressions have spans in the tree, so the span of a match or
+//! a capture is that of the smallest expression containing it, e.g. the span
+//! of `p->next` for the `p` of `(arrow _ @object)`.
+
+use std::{fmt, str::FromStr};
+
+use rustc_hash::FxHashMap;
+
+use crate::{
+    ast::*,
+    span::Span,
+    symbol::Symbol,
+    visitor::{Visitor, walk_expression},
+};
+
+/// An error in the text of a query.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct QueryError {
+    /// The byte offset of the error in the text.
+    pub offset: usize,
+    /// The description of the error.
+    pub message: String,
+}
+
+impl fmt::Display for QueryError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "{} at offset {}", self.message, self.offset)
+    }
+}
+
+impl std::error::Error for QueryError {}
+
+/// A compiled pattern over expressions, see the [module documentation](self).
+#[derive(Debug, Clone)]
+pub struct Query {
+    pattern: Pattern,
+    captures: Vec<Box<str>>,
+}
+
+impl Query {
+    /// Compile the query `text`.
+    pub fn new(text: &str) -> Result<Self, QueryError> {
+        let mut parser = QueryParser { text, cursor: 0, captures: Vec::new() };
+        let pattern = parser.pattern()?;
+        parser.skip_whitespace();
+        if parser.cursor < text.len() {
+            return Err(parser.error("expected the end of the query"));
+        }
+        Ok(Self { pattern, captures: parser.captures })
+    }
+
+    /// The names of the captures, in the order of [`QueryMatch::captures`].
+    pub fn capture_names(&self) -> &[Box<str>] {
+        &self.captures
+    }
+
+    /// The index of the capture `name` in [`QueryMatch::captures`].
+    pub fn capture_index(&self, name: &str) -> Option<usize> {
+        self.captures.iter().position(|capture| **capture == *name)
+    }
+
+    /// A name the source of every match spells, as an identifier, callee or
+    /// member, if the pattern tests any.
+    pub(crate) fn required_name(&self) -> Option<Symbol> {
+        self.pattern.required_name()
+    }
+
+    /// Match the query alone against `unit`.
+    pub fn matches(&self, unit: &TranslationUnit) -> Vec<QueryMatch> {
+        QuerySet::new([self.clone()]).matches(unit)
+    }
+}
+
+impl FromStr for Query {
+    type Err = QueryError;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        Self::new(s)
+    }
+}
+
+/// A match of a query of a [`QuerySet`].
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct QueryMatch {
+    /// The index of the query in the set.
+    pub query: usize,
+    /// The span of the expression matched.
+    pub span: Span,
+    /// The spans of the captures, in the order of [`Query::capture_names`].
+    pub captures: Vec<Span>,
+}
+
+/// Queries matched together in one walk of the tree.
+#[derive(Debug, Clone, Default)]
+pub struct QuerySet {
+    queries: Vec<Query>,
+    /// Queries by the kind of expression their pattern matches.
+    by_head: FxHashMap<Head, Vec<usize>>,
+    /// Queries for calls, by the name of the callee.
+    calls: FxHashMap<Symbol, Vec<usize>>,
+    /// Queries matching any expression.
+    any: Vec<usize>,
+}
+
+impl QuerySet {
+    /// Create a set of `queries`, indexed in the order given.
+    pub fn new(queries: impl IntoIterator<Item = Query>) -> Self {
+        let mut set = Self::default();
+        for query in queries {
+            set.push(query);
+        }
+        set
+    }
+
+    /// Add `query` to the set, returning its index.
+    pub fn push(&mut self, query: Query) -> usize {
+        let index = self.queries.len();
+        let pattern = &query.pattern;
+        match (pattern.head, pattern.operands.first()) {
+            (None, _) => self.any.push(index),
+            (
+                Some(Head::Call),
+                Some(Pattern {
+                    head: Some(Head::Ident),
+                    test: Test::Name(name),
+                    ..
+                }),
+            ) => self.calls.entry(*name).or_default().push(index),
+            (Some(head), _) => self.by_head.entry(head).or_default().push(index),
+        }
+        self.queries.push(query);
+        index
+    }
+
+    /// The queries of the set.
+    pub fn queries(&self) -> &[Query] {
+        &self.queries
+    }
+
+    /// The number of queries.
+    pub fn len(&self) -> usize {
+        self.queries.len()
+    }
+
+    /// Check whether the set has no queries.
+    pub fn is_empty(&self) -> bool {
+        self.queries.is_empty()
+    }
+
+    /// Match every query against every expression of `unit`, in the order of
+    /// the expressions in the tree.
+    pub fn matches(&self, unit: &TranslationUnit) -> Vec<QueryMatch> {
+        let mut runner = Runner {
+            set: self,
+            captures: Vec::new(),
+            matches: Vec::new(),
+        };
+        if !self.is_empty() {
+            runner.visit_translation_unit(unit);
+        }
+        runner.matches
+    }
+}
+
+/// The kinds of expressions seen by patterns.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+enum Head {
+    Ident,
+    Int,
+    Float,
+    Char,
+    String,
+    Call,
+    Index,
+    Member,
+    Arrow,
+    PreIncrement,
+    PreDecrement,
+    PostIncrement,
+    PostDecrement,
+    Unary,
+    Sizeof,
+    SizeofType,
+    Alignof,
+    Cast,
+    Binary,
+    Assign,
+    Conditional,
+    Comma,
+    /// Expressions no pattern matches but `_`, e.g. generic selections.
+    Other,
+}
+
+/// The value a pattern tests besides the kind of expression.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum TestKind {
+    None,
+    Name,
+    Int,
+    Text,
+    Unary,
+    Binary,
+    Assign,
+}
+
+#[derive(Debug, Clone)]
+enum Test {
+    None,
+    Name(Symbol),
+    Int(u64),
+    Text(Box<str>),
+    Unary(UnaryOperator),
+    Binary(BinaryOperator),
+    Assign(AssignmentOperator),
+}
+
+/// The kinds of patterns: name, kind of expression, test, number of
+/// operands, and whether more operands may follow.
+const KINDS: &[(&str, Head, TestKind, usize, bool)] = &[
+    ("ident", Head::Ident, TestKind::Name, 0, false),
+    ("int", Head::Int, TestKind::Int, 0, false),
+    ("float", Head::Float, TestKind::None, 0, false),
+    ("char", Head::Char, TestKind::None, 0, false),
+    ("string", Head::String, TestKind::Text, 0, false),
+    ("call", Head::Call, TestKind::None, 1, true),
+    ("index", Head::Index, TestKind::None, 2, false),
+    ("member", Head::Member, TestKind::Name, 1, false),
+    ("arrow", Head::Arrow, TestKind::Name, 1, false),
+    ("pre-inc", Head::PreIncrement, TestKind::None, 1, false),
+    ("pre-dec", Head::PreDecrement, TestKind::None, 1, false),
+    ("post-inc", Head::PostIncrement, TestKind::None, 1, false),
+    ("post-dec", Head::PostDecrement, TestKind::None, 1, false),
+    ("unary", Head::Unary, TestKind::Unary, 1, false),
+    ("sizeof", Head::Sizeof, TestKind::None, 1, false),
+    ("sizeof-type", Head::SizeofType, TestKind::None, 0, false),
+    ("alignof", Head::Alignof, TestKind::None, 0, false),
+    ("cast", Head::Cast, TestKind::None, 1, false),
+    ("binary", Head::Binary, TestKind::Binary, 2, false),
+    ("assign", Head::Assign, TestKind::Assign, 2, false),
+    ("cond", Head::Conditional, TestKind::None, 3, false),
+    ("comma", Head::Comma, TestKind::None, 0, true),
+];
+
+const UNARY_OPERATORS: &[(&str, UnaryOperator)] = &[
+    ("&", UnaryOperator::Address),
+    ("*", UnaryOperator::Dereference),
+    ("+", UnaryOperator::Plus),
+    ("-", UnaryOperator::Minus),
+    ("~", UnaryOperator::BitwiseNot),
+    ("!", UnaryOperator::LogicalNot),
+];
+
+const BINARY_OPERATORS: &[(&str, BinaryOperator)] = &[
+    ("*", BinaryOperator::Multiply),
+    ("/", BinaryOperator::Divide),
+    ("%", BinaryOperator::Modulo),
+    ("+", BinaryOperator::Add),
+    ("-", BinaryOperator::Subtract),
+    ("<<", BinaryOperator::LeftShift),
+    (">>", BinaryOperator::RightShift),
+    ("&", BinaryOperator::BitwiseAnd),
+    ("^", BinaryOperator::BitwiseXor),
+    ("|", BinaryOperator::BitwiseOr),
+    ("<", BinaryOperator::Less),
+    (">", BinaryOperator::Greater),
+    ("<=", BinaryOperator::LessEqual),
+    (">=", BinaryOperator::GreaterEqual),
+    ("==", BinaryOperator::Equal),
+    ("!=", BinaryOperator::NotEqual),
+    ("&&", BinaryOperator::LogicalAnd),
+    ("||", BinaryOperator::LogicalOr),
+];
+
+const ASSIGNMENT_OPERATORS: &[(&str, AssignmentOperator)] = &[
+    ("=", AssignmentOperator::Assign),
+    ("*=", AssignmentOperator::MulAssign),
+    ("/=", AssignmentOperator::DivAssign),
+    ("%=", AssignmentOperator::ModAssign),
+    ("+=", AssignmentOperator::AddAssign),
+    ("-=", AssignmentOperator::SubAssign),
+    ("<<=", AssignmentOperator::LeftShiftAssign),
+    (">>=", AssignmentOperator::RightShiftAssign),
+    ("&=", AssignmentOperator::AndAssign),
+    ("^=", AssignmentOperator::XorAssign),
+    ("|=", AssignmentOperator::OrAssign),
+];
+
+/// A compiled pattern.
+#[derive(Debug, Clone)]
+struct Pattern {
+    /// The kind of expression matched, or `None` for any.
+    head: Option<Head>,
+    test: Test,
+    operands: Vec<Pattern>,
+    /// Whether the list of operands is a prefix, for calls and commas.
+    rest: bool,
+    capture: Option<usize>,
+}
+
+impl Pattern {
+    fn leaf(head: Option<Head>, test: Test) -> Self {
+        Self {
+            head,
+            test,
+            operands: Vec::new(),
+            rest: false,
+            capture: None,
+        }
+    }
+
+    fn required_name(&self) -> Option<Symbol> {
+        match &self.test {
+            Test::Name(name) => Some(*name),
+            _ => self.operands.iter().find_map(Pattern::required_name),
+        }
+    }
+
+    fn matches<'a>(&self, operand: Operand<'a>, span: Span, captures: &mut [Span]) -> bool {
+        let Some((shape, span)) = operand.resolve(span, true) else {
+            unreachable!("parentheses are seen through")
+        };
+        self.matches_shape(&shape, span, captures)
+    }
+
+    fn matches_shape(&self, shape: &Shape<'_>, span: Span, captures: &mut [Span]) -> bool {
+        let matched = match self.head {
+            None => true,
+            Some(head) => {
+                head == shape.head() && self.test_matches(shape) && self.operands_match(shape, span, captures)
+            }
+        };
+        if matched && let Some(capture) = self.capture {
+            captures[capture] = span;
+        }
+        matched
+    }
+
+    fn test_matches(&self, shape: &Shape<'_>) -> bool {
+        match (&self.test, shape) {
+            (Test::None, _) => true,
+            (Test::Name(name), Shape::Ident(id) | Shape::Member(_, _, id)) => id.0 == *name,
+            (Test::Int(value), Shape::Constant(Constant::Integer(integer))) => integer.value.as_u64() == Some(*value),
+            (Test::Text(text), Shape::String(literals)) => {
+                // Compare piece by piece, rather than joining the literals
+                let mut rest = &**text;
+                for literal in &literals.0 {
+                    match rest.strip_prefix(literal.value.as_str()) {
+                        Some(after) => rest = after,
+                        None => return false,
+                    }
+                }
+                rest.is_empty()
+            }
+            (Test::Unary(operator), Shape::Unary(op, _)) => operator == op,
+            (Test::Binary(operator), Shape::Binary(op, _, _)) => operator == op,
+            (Test::Assign(operator), Shape::Assign(op, _, _)) => operator == op,
+            _ => false,
+        }
+    }
+
+    fn operands_match(&self, shape: &Shape<'_>, span: Span, captures: &mut [Span]) -> bool {
+        match *shape {
+            Shape::Call(function, arguments) => {
+                self.operands[0].matches(function, span, captures)
+                    && self.list_matches(&self.operands[1..], arguments, captures)
+            }
+            Shape::Comma(expressions) => self.list_matches(&self.operands, expressions, captures),
+            _ => (self.operands.iter())
+                .zip(shape.operands().into_iter().flatten())
+                .all(|(pattern, operand)| pattern.matches(operand, span, captures)),
+        }
+    }
+
+    fn list_matches(&self, patterns: &[Pattern], expressions: &[Expression], captures: &mut [Span]) -> bool {
+        let count = if self.rest {
+            expressions.len() >= patterns.len()
+        } else {
+            expressions.len() == patterns.len()
+        };
+        count
+            && (patterns.iter().zip(expressions))
+                .all(|(pattern, e)| pattern.matches(Operand::Expression(e), e.span, captures))
+    }
+}
+
+/// A node at one of the levels of the expression grammar.
+#[derive(Clone, Copy)]
+enum Operand<'a> {
+    Expression(&'a Expression),
+    Postfix(&'a PostfixExpression),
+    Unary(&'a UnaryExpression),
+    Cast(&'a CastExpression),
+}
+
+/// An expression as patterns see it, with its operands.
+enum Shape<'a> {
+    Ident(&'a Identifier),
+    Constant(&'a Constant),
+    String(&'a StringLiterals),
+    Call(Operand<'a>, &'a [Expression]),
+    Index(Operand<'a>, Operand<'a>),
+    Member(bool, Operand<'a>, &'a Identifier),
+    PreIncrement(Operand<'a>),
+    PreDecrement(Operand<'a>),
+    PostIncrement(Operand<'a>),
+    PostDecrement(Operand<'a>),
+    Unary(UnaryOperator, Operand<'a>),
+    Sizeof(Operand<'a>),
+    SizeofType,
+    Alignof,
+    Cast(Operand<'a>),
+    Binary(BinaryOperator, Operand<'a>, Operand<'a>),
+    Assign(AssignmentOperator, Operand<'a>, Operand<'a>),
+    Conditional(Operand<'a>, Operand<'a>, Operand<'a>),
+    Comma(&'a [Expression]),
+    Other,
+}
+
+impl<'a> Operand<'a> {
+    /// The shape of the operand, looking through the levels of the grammar,
+    /// and the span of the smallest expression containing it, starting from
+    /// `span`.
+    ///
+    /// Returns `None` at parentheses, unless `parens` is set to see through
+    /// them.
+    fn resolve(self, mut span: Span, parens: bool) -> Option<(Shape<'a>, Span)> {
+        let mut operand = self;
+        let shape = loop {
+            operand = match operand {
+                Operand::Expression(e) => {
+                    span = e.span;
+                    match &e.kind {
+                        ExpressionKind::Postfix(p) => Operand::Postfix(p),
+                        ExpressionKind::Unary(u) => Operand::Unary(u),
+                        ExpressionKind::Cast(c) => Operand::Cast(c),
+                        ExpressionKind::Binary(b) => {
+                            let (left, right) = (Operand::Expression(&*b.left), Operand::Expression(&*b.right));
+                            break Shape::Binary(b.operator, left, right);
+                        }
+                        ExpressionKind::Conditional(c) => {
+                            break Shape::Conditional(
+                                Operand::Expression(&*c.condition),
+                                Operand::Expression(&*c.then_expr),
+                                Operand::Expression(&*c.else_expr),
+                            );
+                        }
+                        ExpressionKind::Assignment(a) => {
+                            let (left, right) = (Operand::Expression(&*a.left), Operand::Expression(&*a.right));
+                            break Shape::Assign(a.operator, left, right);
+                        }
+                        ExpressionKind::Comma(c) => break Shape::Comma(&c.expressions),
+                        ExpressionKind::Error => break Shape::Other,
+                    }
+                }
+                Operand::Cast(CastExpression::Unary(u)) => Operand::Unary(u),
+                Operand::Cast(CastExpression::Cast { expression, .. }) => break Shape::Cast(Operand::Cast(expression)),
+                Operand::Unary(u) => match u {
+                    UnaryExpression::Postfix(p) => Operand::Postfix(p),
+                    UnaryExpression::PreIncrement(u) => break Shape::PreIncrement(Operand::Unary(u)),
+                    UnaryExpression::PreDecrement(u) => break Shape::PreDecrement(Operand::Unary(u)),
+                    UnaryExpression::Unary { operator, operand } => {
+                        break Shape::Unary(*operator, Operand::Cast(operand));
+                    }
+                    UnaryExpression::Sizeof(u) => break Shape::Sizeof(Operand::Unary(u)),
+                    UnaryExpression::SizeofType(_) => break Shape::SizeofType,
+                    UnaryExpression::Alignof(_) => break Shape::Alignof,
+                },
+                Operand::Postfix(p) => match p {
+                    PostfixExpression::Primary(PrimaryExpression::Parenthesized(e)) if parens => Operand::Expression(e),
+                    PostfixExpression::Primary(PrimaryExpression::Parenthesized(_)) => return None,
+                    PostfixExpression::Primary(
+                        PrimaryExpression::Identifier(id) | PrimaryExpression::EnumerationConstant(id),
+                    ) => break Shape::Ident(id),
+                    PostfixExpression::Primary(PrimaryExpression::Constant(c)) => break Shape::Constant(c),
+                    PostfixExpression::Primary(PrimaryExpression::StringLiteral(s)) => break Shape::String(s),
+                    PostfixExpression::Primary(_) => break Shape::Other,
+                    PostfixExpression::ArrayAccess { array, index } => {
+                        break Shape::Index(Operand::Postfix(array), Operand::Expression(index));
+                    }
+                    PostfixExpression::FunctionCall { function, arguments } => {
+                        break Shape::Call(Operand::Postfix(function), arguments);
+                    }
+                    PostfixExpression::MemberAccess { object, member } => {
+                        break Shape::Member(false, Operand::Postfix(object), member);
+                    }
+                    PostfixExpression::MemberAccessPtr { object, member } => {
+                        break Shape::Member(true, Operand::Postfix(object), member);
+                    }
+                    PostfixExpression::PostIncrement(p) => break Shape::PostIncrement(Operand::Postfix(p)),
+                    PostfixExpression::PostDecrement(p) => break Shape::PostDecrement(Operand::Postfix(p)),
+                    PostfixExpression::CompoundLiteral(_) => break Shape::Other,
+                },
+            }
+        };
+        Some((shape, span))
+    }
+}
+
+impl<'a> Shape<'a> {
+    fn head(&self) -> Head {
+        match self {
+            Shape::Ident(_) => Head::Ident,
+            Shape::Constant(Constant::Integer(_)) => Head::Int,
+            Shape::Constant(Constant::Floating(_)) => Head::Float,
+            Shape::Constant(Constant::Character(_)) => Head::Char,
+            Shape::Constant(Constant::Predefined(_)) => Head::Other,
+            Shape::String(_) => Head::String,
+            Shape::Call(..) => Head::Call,
+            Shape::Index(..) => Head::Index,
+            Shape::Member(false, ..) => Head::Member,
+            Shape::Member(true, ..) => Head::Arrow,
+            Shape::PreIncrement(_) => Head::PreIncrement,
+            Shape::PreDecrement(_) => Head::PreDecrement,
+            Shape::PostIncrement(_) => Head::PostIncrement,
+            Shape::PostDecrement(_) => Head::PostDecrement,
+            Shape::Unary(..) => Head::Unary,
+            Shape::Sizeof(_) => Head::Sizeof,
+            Shape::SizeofType => Head::SizeofType,
+            Shape::Alignof => Head::Alignof,
+            Shape::Cast(_) => Head::Cast,
+            Shape::Binary(..) => Head::Binary,
+            Shape::Assign(..) => Head::Assign,
+            Shape::Conditional(..) => Head::Conditional,
+            Shape::Comma(_) => Head::Comma,
+            Shape::Other => Head::Other,
+        }
+    }
+
+    /// The operands of the expression, except the lists of calls and commas.
+    fn operands(&self) -> [Option<Operand<'a>>; 3] {
+        match *self {
+            Shape::Call(a, _)
+            | Shape::Member(_, a, _)
+            | Shape::PreIncrement(a)
+            | Shape::PreDecrement(a)
+            | Shape::PostIncrement(a)
+            | Shape::PostDecrement(a)
+            | Shape::Unary(_, a)
+            | Shape::Sizeof(a)
+            | Shape::Cast(a) => [Some(a), None, None],
+            Shape::Index(a, b) | Shape::Binary(_, a, b) | Shape::Assign(_, a, b) => [Some(a), Some(b), None],
+            Shape::Conditional(a, b, c) => [Some(a), Some(b), Some(c)],
+            _ => [None; 3],
+        }
+    }
+}
+
+/// Matches the queries of a set at each expression of a tree.
+struct Runner<'s> {
+    set: &'s QuerySet,
+    captures: Vec<Span>,
+    matches: Vec<QueryMatch>,
+}
+
+impl<'a> Visitor<'a> for Runner<'_> {
+    type Result = ();
+
+    fn visit_expression(&mut self, e: &'a Expression) {
+        self.visit_operand(Operand::Expression(e), e.span);
+        walk_expression(self, e)
+    }
+}
+
+impl Runner<'_> {
+    fn visit_operand(&mut self, operand: Operand<'_>, span: Span) {
+        // Parenthesized expressions are matched as the expression inside,
+        // when the visitor reaches it
+        let Some((shape, span)) = operand.resolve(span, false) else {
+            return;
+        };
+        self.match_shape(&shape, span);
+        // Operands at the other levels of the grammar are not visited as
+        // expressions
+        for operand in shape.operands().into_iter().flatten() {
+            if !matches!(operand, Operand::Expression(_)) {
+                self.visit_operand(operand, span);
+            }
+        }
+    }
+
+    fn match_shape(&mut self, shape: &Shape<'_>, span: Span) {
+        let set = self.set;
+        let calls = match shape {
+            Shape::Call(function, _) => match function.resolve(span, true) {
+                Some((Shape::Ident(id), _)) => set.calls.get(&id.0),
+                _ => None,
+            },
+            _ => None,
+        };
+        let candidates = (set.any.iter())
+            .chain(set.by_head.get(&shape.head()).into_iter().flatten())
+            .chain(calls.into_iter().flatten());
+        for &index in candidates {
+            let query = &set.queries[index];
+            self.captures.clear();
+            self.captures.resize(query.captures.len(), Span::default());
+            if query.pattern.matches_shape(shape, span, &mut self.captures) {
+                self.matches.push(QueryMatch {
+                    query: index,
+                    span,
+                    captures: self.captures.clone(),
+                });
+            }
+        }
+    }
+}
+
+/// Compiles the text of a query.
+struct QueryParser<'t> {
+    text: &'t str,
+    cursor: usize,
+    captures: Vec<Box<str>>,
+}
+
+impl<'t> QueryParser<'t> {
+    fn error(&self, message: impl Into<String>) -> QueryError {
+        QueryError {
+            offset: self.cursor,
+            message: message.into(),
+        }
+    }
+
+    fn rest(&self) -> &'t str {
+        &self.text[self.cursor..]
+    }
+
+    fn skip_whitespace(&mut self) {
+        let rest = self.rest();
+        self.cursor += rest.len() - rest.trim_start().len();
+    }
+
+    fn eat(&mut self, prefix: &str) -> bool {
+        let found = self.rest().starts_with(prefix);
+        if found {
+            self.cursor += prefix.len();
+        }
+        found
+    }
+
+    /// A name of a pattern kind or a capture.
+    fn name(&mut self) -> Option<&'t str> {
+        let rest = self.rest();
+        let len = rest
+            .find(|c: char| !(c.is_ascii_alphanumeric() || c == '_' || c == '-'))
+            .unwrap_or(rest.len());
+        self.cursor += len;
+        (len > 0).then(|| &rest[..len])
+    }
+
+    /// A quoted string, with `\"` and `\\` escaped.
+    fn string(&mut self) -> Result<Option<String>, QueryError> {
+        let start = self.cursor;
+        if !self.eat("\"") {
+            return Ok(None);
+        }
+        let mut value = String::new();
+        let mut chars = self.rest().char_indices();
+        while let Some((i, c)) = chars.next() {
+            match c {
+                '"' => {
+                    self.cursor += i + 1;
+                    return Ok(Some(value));
+                }
+                '\\' => match chars.next() {
+                    Some((_, c @ ('"' | '\\'))) => value.push(c),
+                    _ => {
+                        self.cursor += i;
+                        return Err(self.error("expected `\\\"` or `\\\\`"));
+                    }
+                },
+                c => value.push(c),
+            }
+        }
+        self.cursor = start;
+        Err(self.error("unterminated string"))
+    }
+
+    fn pattern(&mut self) -> Result<Pattern, QueryError> {
+        self.skip_whitespace();
+        let mut pattern = if self.eat("(") {
+            self.node()?
+        } else if let Some(name) = self.string()? {
+            Pattern::leaf(Some(Head::Ident), Test::Name(Symbol::intern(&name)))
+        } else if self.eat("_") {
+            Pattern::leaf(None, Test::None)
+        } else {
+            return Err(self.error("expected a pattern"));
+        };
+        self.skip_whitespace();
+        if self.eat("@") {
+            let start = self.cursor;
+            let name = self
+                .name()
+                .ok_or_else(|| self.error("expected the name of a capture"))?;
+            if self.captures.iter().any(|capture| **capture == *name) {
+                self.cursor = start;
+                return Err(self.error(format!("capture `{name}` is named twice")));
+            }
+            pattern.capture = Some(self.captures.len());
+            self.captures.push(name.into());
+        }
+        Ok(pattern)
+    }
+
+    /// A pattern in parentheses, after the `(`.
+    fn node(&mut self) -> Result<Pattern, QueryError> {
+        self.skip_whitespace();
+        let start = self.cursor;
+        let name = self
+            .name()
+            .ok_or_else(|| self.error("expected the kind of a pattern"))?;
+        let Some(&(_, head, test, arity, variadic)) = KINDS.iter().find(|kind| kind.0 == name) else {
+            self.cursor = start;
+            return Err(self.error(format!("unknown pattern kind `{name}`")));
+        };
+
+        self.skip_whitespace();
+        let test_start = self.cursor;
+        let test = match test {
+            TestKind::None => Test::None,
+            TestKind::Name => self
+                .string()?
+                .map_or(Test::None, |name| Test::Name(Symbol::intern(&name))),
+            TestKind::Text => self.string()?.map_or(Test::None, |text| Test::Text(text.into())),
+            TestKind::Int => {
+                let rest = self.rest();
+                let len = rest.find(|c: char| !c.is_ascii_digit()).unwrap_or(rest.len());
+                if len == 0 {
+                    Test::None
+                } else {
+                    let value = rest[..len].parse().map_err(|_| self.error("integer too large"))?;
+                    self.cursor += len;
+                    Test::Int(value)
+                }
+            }
+            TestKind::Unary | TestKind::Binary | TestKind::Assign => match self.string()? {
+                None => Test::None,
+                Some(op) => {
+                    let found = match test {
+                        TestKind::Unary => UNARY_OPERATORS.iter().find(|o| o.0 == op).map(|o| Test::Unary(o.1)),
+                        TestKind::Binary => BINARY_OPERATORS.iter().find(|o| o.0 == op).map(|o| Test::Binary(o.1)),
+                        _ => ASSIGNMENT_OPERATORS
+                            .iter()
+                            .find(|o| o.0 == op)
+                            .map(|o| Test::Assign(o.1)),
+                    };
+                    found.ok_or_else(|| QueryError {
+                        offset: test_start,
+                        message: format!("unknown {name} operator `{op}`"),
+                    })?
+                }
+            },
+        };
+
+        let mut operands = Vec::new();
+        let mut rest = false;
+        loop {
+            self.skip_whitespace();
+            if self.eat(")") {
+                break;
+            }
+            if self.cursor == self.text.len() {
+                return Err(self.error("expected `)`"));
+            }
+            if variadic && self.eat("..") {
+                self.skip_whitespace();
+                if !self.eat(")") {
+                    return Err(self.error("expected `)` after `..`"));
+                }
+                rest = true;
+                break;
+            }
+            operands.push(self.pattern()?);
+        }
+        if operands.len() < arity || (!variadic && operands.len() > arity) {
+            self.cursor = start;
+            let at_least = if variadic { "at least " } else { "" };
+            return Err(self.error(format!("`{name}` takes {at_least}{arity} operand(s)")));
+        }
+
+        Ok(Pattern {
+            head: Some(head),
+            test,
+            operands,
+            rest,
+            capture: None,
+        })
+    }
+}
@@ -1,64 +1,112 @@
 //! Error reporting.
 
-use std::fmt;
+use std::{
+    fmt,
+    io::{self, Write},
+    ops::Range,
+};
 
-use crate::span::Span;
+use chumsky::error::RichPattern;
+
+use crate::span::{ContextId, ContextMapping, Span};
 use crate::{ast::*, parser_utils::Error};
 
-struct DiagnosticToken(BalancedToken);
+/// The description of a token in a diagnostic, made from a reference to the
+/// token, so that reporting does not clone the tokens of a group.
+struct DiagnosticToken(&'static str);
 
-impl fmt::Display for DiagnosticToken {
-    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
-        match self.0 {
-            BalancedToken::Parenthesized(_) => write!(f, "(...)"),
-            BalancedToken::Bracketed(_) => write!(f, "[...]"),
-            BalancedToken::Braced(_) => write!(f, "{{...}}"),
-            BalancedToken::Identifier(_) => write!(f, "identifier"),
-            BalancedToken::StringLiteral(_) => write!(f, "string literal"),
-            BalancedToken::QuotedString(_) => write!(f, "quoted string"),
-            BalancedToken::Constant(_) => write!(f, "constant"),
-            BalancedToken::Punctuator(_) => write!(f, "punctuator"),
+impl DiagnosticToken {
+    fn new(token: &BalancedToken) -> Self {
+        Self(match token {
+            BalancedToken::Parenthesized(_) => "(...)",
+            BalancedToken::Bracketed(_) => "[...]",
+            BalancedToken::Braced(_) => "{...}",
+            BalancedToken::Identifier(_) => "identifier",
+            BalancedToken::StringLiteral(_) => "string literal",
+            BalancedToken::QuotedString(_) => "quoted string",
+            BalancedToken::Constant(_) => "constant",
+            BalancedToken::Punctuator(_) => "punctuator",
             #[cfg(feature = "quasi-quote")]
-            BalancedToken::Template(_) => write!(f, "template"),
+            BalancedToken::Template(_) => "template",
             #[cfg(feature = "quasi-quote")]
-            BalancedToken::Interpolation(_) => write!(f, "interpolation"),
-            BalancedToken::Unknown => write!(f, "unknown token"),
-        }
+            BalancedToken::Interpolation(_) => "interpolation",
+            BalancedToken::Unknown => "unknown token",
+        })
     }
 }
 
-/// Convert a parse error to an ariadne report for pretty printing.
-pub fn report<'a>(error: Error<'a>) -> ariadne::Report<'a, Span> {
-    use ariadne::{Label, Report, ReportKind};
-    use chumsky::error::RichReason;
+impl fmt::Display for DiagnosticToken {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str(self.0)
+    }
+}
 
-    let error = error.map_token(DiagnosticToken);
-    let span = *error.span();
+/// Describe `pattern`, cloning only the reference to a token it expects.
+fn describe(pattern: &RichPattern<'_, BalancedToken>) -> String {
+    pattern
+        .clone()
+        .map_token(|token| DiagnosticToken::new(&token))
+        .to_string()
+}
 
-    let message = match error.reason() {
+/// The message of a parse error, as in its [`report`], e.g. for the
+/// diagnostics of an editor.
+pub fn error_message(error: &Error<'_>) -> String {
+    use chumsky::error::RichReason;
+
+    match error.reason() {
         RichReason::ExpectedFound { expected, found } => {
             let expected_str = if expected.is_empty() {
                 "something else".to_string()
             } else {
-                expected.iter().map(|e| e.to_string()).collect::<Vec<_>>().join(", ")
+                expected.iter().map(describe).collect::<Vec<_>>().join(", ")
             };
             let found_str = found
-                .as_ref()
-                .map(|f| f.to_string())
+                .as_deref()
+                .map(|f| DiagnosticToken::new(f).to_string())
                 .unwrap_or_else(|| "end of input".to_string());
             format!("expected {}, found {}", expected_str, found_str)
         }
         RichReason::Custom(msg) => msg.clone(),
-    };
+    }
+}
 
-    let mut builder = Report::build(ReportKind::Error, span).with_message(&message);
+/// Convert a parse error to an ariadne report for pretty printing.
+///
+/// The source contexts of the spans are looked up in `ctx_map`.
+pub fn report<'a>(error: Error<'a>, ctx_map: &ContextMapping) -> ariadne::Report<'a, (ContextId, Range<usize>)> {
+    use ariadne::{Label, Report, ReportKind};
+
+    let resolve = |span: Span| (span.context_id(ctx_map), span.range());
+    let span = resolve(*error.span());
+    let message = error_message(&error);
+
+    let mut builder = Report::build(ReportKind::Error, span.clone()).with_message(&message);
 
     builder = builder.with_label(Label::new(span).with_message(&message));
 
     // Add context information if available
     for (label, ctx_span) in error.contexts() {
-        builder = builder.with_label(Label::new(*ctx_span).with_message(format!("in {}", label)));
+        builder = builder.with_label(Label::new(resolve(*ctx_span)).with_message(format!("in {}", describe(label))));
     }
 
     builder.finish()
 }
+
+/// Render all errors of a parse to `writer`, in order.
+///
+/// The reports share the cache of `ctx_map`, so the source is split into lines
+/// once for all errors and all contexts, and the output is buffered, which
+/// makes this much cheaper than printing each [`report`] on its own when there
+/// are many errors.
+pub fn report_all<'a>(
+    errors: impl IntoIterator<Item = Error<'a>>,
+    ctx_map: &mut ContextMapping,
+    writer: impl Write,
+) -> io::Result<()> {
+    let mut writer = io::BufWriter::new(writer);
+    for error in errors {
+        report(error, ctx_map).write(&mut *ctx_map, &mut writer)?;
+    }
+    writer.flush()
+}
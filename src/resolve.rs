@@ -0,0 +1,417 @@
+//! Resolution of the names used in expressions to their declarations.
+//!
+//! A [`Resolution`] links each identifier used as an expression, a
+//! [`Node::PostfixExpression`] of an [`AstIndex`], to the [`Node::Declarator`]
+//! that declares it, in a [`NodeMap`] keyed by the id of the use. Analyses
+//! that need to know which variable a name refers to look it up there
+//! instead of walking the tree with their own stacks of scopes:
+//!
+//! ```ignore
+//! let index = AstIndex::new(&unit);
+//! let resolution = Resolution::new(&index);
+//! for (id, node) in index.of_kind(NodeKind::PostfixExpression) {
+//!     if let Some(declarator) = resolution.definition(id.into()) {
+//!         // ...
+//!     }
+//! }
+//! ```
+//!
+//! The scopes are kept as a tree in one array, indexed by [`ScopeId`], where
+//! the parser opens them: the file scope, a function scope for the
+//! parameters of each function definition, a block scope for each compound
+//! statement and each `for` statement that declares, and a prototype scope
+//! for the parameters of each other function declarator.
+//!
+//! The names of the file scope are collected first; the external
+//! declarations are then resolved in parallel, each reading the file scope,
+//! which is not changed, and opening its own scopes. A name of the file scope
+//! is only visible after its first declaration, so a use resolves to its last
+//! declaration at or before the external declaration of the use.
+//!
+//! Only the names declared by declarators are resolved: uses of enumeration
+//! constants are not identifiers, and typedef names, members, tags and labels
+//! are not looked up. Names that are used but never declared, e.g. functions
+//! called without a prototype, are [unresolved](Resolution::unresolved).
+
+use rustc_hash::FxHashMap;
+
+use crate::{
+    ast::*,
+    index::{AstIndex, Node, NodeId, NodeKind, NodeMap},
+    parallel::par_map,
+    symbol::Symbol,
+    visitor::{
+        Visitor, walk_compound_statement, walk_declaration, walk_declarator, walk_iteration_statement,
+        walk_member_declaration, walk_parameter_type_list, walk_postfix_expression,
+    },
+};
+
+/// A handle to a scope of a [`Resolution`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct ScopeId(u32);
+
+impl ScopeId {
+    /// The file scope, the root of the tree.
+    pub const FILE: ScopeId = ScopeId(0);
+
+    /// The index of the scope in its resolution.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// The kind of a [`Scope`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum ScopeKind {
+    /// The scope of the external declarations.
+    File,
+    /// The parameters of a function definition, and the labels of its body.
+    Function,
+    /// A compound statement, or a `for` statement with a declaration.
+    Block,
+    /// The parameters of a function declarator that is not a definition.
+    Prototype,
+}
+
+/// A scope, with the names it declares.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Scope {
+    kind: ScopeKind,
+    parent: Option<ScopeId>,
+    names: Vec<(Symbol, NodeId)>,
+}
+
+impl Scope {
+    fn new(kind: ScopeKind, parent: Option<ScopeId>) -> Self {
+        Self { kind, parent, names: Vec::new() }
+    }
+
+    /// The kind of the scope.
+    pub fn kind(&self) -> ScopeKind {
+        self.kind
+    }
+
+    /// The enclosing scope, or `None` for the file scope.
+    pub fn parent(&self) -> Option<ScopeId> {
+        self.parent
+    }
+
+    /// The names declared in the scope, with their declarators, in order.
+    pub fn names(&self) -> &[(Symbol, NodeId)] {
+        &self.names
+    }
+}
+
+/// The declarations of the names used in a translation unit.
+///
+/// See the [module documentation](self).
+#[derive(Debug, Clone)]
+pub struct Resolution {
+    scopes: Vec<Scope>,
+    /// The declarator of each resolved use.
+    definitions: NodeMap<NodeId>,
+    /// The scope of each declarator of a name.
+    declared: NodeMap<ScopeId>,
+    /// The uses of names that are not declared, in pre-order.
+    unresolved: Vec<NodeId>,
+}
+
+impl Resolution {
+    /// Resolve the names used in the translation unit of `index`, on all
+    /// available cores.
+    pub fn new(index: &AstIndex<'_>) -> Self {
+        let externals: Vec<_> = (index.of_kind(NodeKind::ExternalDeclaration))
+            .filter_map(|(_, node)| match node {
+                Node::ExternalDeclaration(d) => Some(d),
+                _ => None,
+            })
+            .collect();
+
+        let mut file = FileScope::default();
+        let mut scope = Scope::new(ScopeKind::File, None);
+        let mut declared = NodeMap::new(index);
+        for (position, d) in externals.iter().enumerate() {
+            let declarators: Vec<&Declarator> = match d {
+                ExternalDeclaration::Function(f) => vec![&f.declarator],
+                ExternalDeclaration::Declaration(d) => match &d.kind {
+                    DeclarationKind::Normal { declarators, .. } => {
+                        declarators.iter().map(|init| &init.declarator).collect()
+                    }
+                    _ => Vec::new(),
+                },
+            };
+            for declarator in declarators {
+                let (Some(name), Some(def)) = (declarator.identifier(), index.id(Node::Declarator(declarator))) else {
+                    continue;
+                };
+                file.names.entry(name.0).or_default().push((position as u32, def));
+                scope.names.push((name.0, def));
+                declared.insert(def, ScopeId::FILE);
+            }
+        }
+
+        let resolved = par_map(&externals.iter().enumerate().collect::<Vec<_>>(), |&(position, d)| {
+            let mut resolver = Resolver::new(index, &file, position as u32);
+            resolver.visit_external_declaration(d);
+            resolver
+        });
+
+        let mut resolution = Resolution {
+            scopes: vec![scope],
+            definitions: NodeMap::new(index),
+            declared,
+            unresolved: Vec::new(),
+        };
+        for resolver in resolved {
+            let offset = resolution.scopes.len() as u32;
+            for mut scope in resolver.scopes {
+                scope.parent = Some(scope.parent.map_or(ScopeId::FILE, |parent| ScopeId(parent.0 + offset)));
+                resolution.scopes.push(scope);
+            }
+            for (def, scope) in resolver.declared {
+                resolution.declared.insert(def, ScopeId(scope + offset));
+            }
+            for (use_, def) in resolver.uses {
+                match def {
+                    Some(def) => {
+                        resolution.definitions.insert(use_, def);
+                    }
+                    None => resolution.unresolved.push(use_),
+                }
+            }
+        }
+        resolution
+    }
+
+    /// The number of scopes.
+    pub fn len(&self) -> usize {
+        self.scopes.len()
+    }
+
+    /// Whether there are no scopes, which is never the case: there is always
+    /// the file scope.
+    pub fn is_empty(&self) -> bool {
+        self.scopes.is_empty()
+    }
+
+    /// The scopes, in the order they are opened, starting with the file scope.
+    pub fn scopes(&self) -> &[Scope] {
+        &self.scopes
+    }
+
+    /// The scope `id`.
+    pub fn scope(&self, id: ScopeId) -> &Scope {
+        &self.scopes[id.index()]
+    }
+
+    /// The declarator of the name used by the postfix expression `use_`, if
+    /// it is an identifier that is declared.
+    pub fn definition(&self, use_: NodeId) -> Option<NodeId> {
+        self.definitions.get(use_).copied()
+    }
+
+    /// The resolved uses with their declarators, in pre-order.
+    pub fn uses(&self) -> impl Iterator<Item = (NodeId, NodeId)> + '_ {
+        self.definitions.iter().map(|(use_, &def)| (use_, def))
+    }
+
+    /// The uses of the name declared by the declarator `def`, in pre-order.
+    pub fn uses_of(&self, def: NodeId) -> impl Iterator<Item = NodeId> + '_ {
+        self.uses().filter(move |&(_, d)| d == def).map(|(use_, _)| use_)
+    }
+
+    /// The scope of the declarator `def`, if it declares a name that can be
+    /// used.
+    pub fn scope_of(&self, def: NodeId) -> Option<ScopeId> {
+        self.declared.get(def).copied()
+    }
+
+    /// The uses of names that are not declared, in pre-order.
+    pub fn unresolved(&self) -> &[NodeId] {
+        &self.unresolved
+    }
+}
+
+/// The names of the file scope, shared by the resolvers of the external
+/// declarations.
+#[derive(Default)]
+struct FileScope {
+    /// The declarators of each name, with the positions of their external
+    /// declarations, in order.
+    names: FxHashMap<Symbol, Vec<(u32, NodeId)>>,
+}
+
+impl FileScope {
+    /// The last declarator of `name` in the external declarations up to
+    /// `position`.
+    fn lookup(&self, name: Symbol, position: u32) -> Option<NodeId> {
+        let declarators = self.names.get(&name)?;
+        let visible = declarators.partition_point(|&(p, _)| p <= position);
+        Some(declarators[visible.checked_sub(1)?].1)
+    }
+}
+
+/// Resolves the names used in one external declaration.
+struct Resolver<'i, 'a> {
+    index: &'i AstIndex<'a>,
+    file: &'i FileScope,
+    position: u32,
+    /// The scopes opened, whose parents are their indices here, or `None`
+    /// for the file scope.
+    scopes: Vec<Scope>,
+    /// The scopes being walked.
+    open: Vec<u32>,
+    /// The declarators of each name in the open scopes, innermost last.
+    bindings: FxHashMap<Symbol, Vec<NodeId>>,
+    /// Whether the outermost declarators walked declare names that can be
+    /// used, rather than typedef names or members.
+    declaring: bool,
+    /// The nesting of the declarators being walked.
+    depth: u32,
+    /// Whether the next parameter list is that of the function being defined.
+    parameters: bool,
+    declared: Vec<(NodeId, u32)>,
+    uses: Vec<(NodeId, Option<NodeId>)>,
+}
+
+impl<'i, 'a> Resolver<'i, 'a> {
+    fn new(index: &'i AstIndex<'a>, file: &'i FileScope, position: u32) -> Self {
+        Self {
+            index,
+            file,
+            position,
+            scopes: Vec::new(),
+            open: Vec::new(),
+            bindings: FxHashMap::default(),
+            declaring: true,
+            depth: 0,
+            parameters: false,
+            declared: Vec::new(),
+            uses: Vec::new(),
+        }
+    }
+
+    fn enter(&mut self, kind: ScopeKind) {
+        let parent = self.open.last().map(|&parent| ScopeId(parent));
+        self.open.push(self.scopes.len() as u32);
+        self.scopes.push(Scope::new(kind, parent));
+    }
+
+    fn exit(&mut self) {
+        let scope = self.open.pop().expect("exit of a scope that is not open");
+        for (name, _) in &self.scopes[scope as usize].names {
+            if let Some(declarators) = self.bindings.get_mut(name) {
+                declarators.pop();
+            }
+        }
+    }
+
+    /// Declare the name of `d` in the innermost scope. Names of the file
+    /// scope are already declared.
+    fn declare(&mut self, d: &'a Declarator) {
+        if !self.declaring || self.depth != 0 {
+            return;
+        }
+        let (Some(&scope), Some(name)) = (self.open.last(), d.identifier()) else {
+            return;
+        };
+        let Some(def) = self.index.id(Node::Declarator(d)) else {
+            return;
+        };
+        self.scopes[scope as usize].names.push((name.0, def));
+        self.bindings.entry(name.0).or_default().push(def);
+        self.declared.push((def, scope));
+    }
+
+    fn lookup(&self, name: Symbol) -> Option<NodeId> {
+        (self
+            .bindings
+            .get(&name)
+            .and_then(|declarators| declarators.last().copied()))
+        .or_else(|| self.file.lookup(name, self.position))
+    }
+}
+
+impl<'a> Visitor<'a> for Resolver<'_, 'a> {
+    type Result = ();
+
+    fn visit_function_definition(&mut self, f: &'a FunctionDefinition) {
+        for attr in &f.attributes {
+            self.visit_attribute_specifier(attr);
+        }
+        self.visit_declaration_specifiers(&f.specifiers);
+        // The name of the function is in the file scope, and its parameters
+        // open the function scope, which stays open for the body
+        let declaring = std::mem::replace(&mut self.declaring, false);
+        self.parameters = true;
+        self.visit_declarator(&f.declarator);
+        self.declaring = declaring;
+        if std::mem::take(&mut self.parameters) {
+            self.enter(ScopeKind::Function);
+        }
+        self.visit_compound_statement(&f.body);
+        self.exit();
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        let typedef = matches!(d.kind, DeclarationKind::Typedef { .. });
+        let declaring = std::mem::replace(&mut self.declaring, self.declaring && !typedef);
+        walk_declaration(self, d);
+        self.declaring = declaring;
+    }
+
+    fn visit_declarator(&mut self, d: &'a Declarator) {
+        self.depth += 1;
+        walk_declarator(self, d);
+        self.depth -= 1;
+        // Declared before its initializer is walked, which can use it
+        self.declare(d);
+    }
+
+    fn visit_member_declaration(&mut self, md: &'a MemberDeclaration) {
+        let declaring = std::mem::replace(&mut self.declaring, false);
+        walk_member_declaration(self, md);
+        self.declaring = declaring;
+    }
+
+    fn visit_parameter_type_list(&mut self, ptl: &'a ParameterTypeList) {
+        let depth = std::mem::replace(&mut self.depth, 0);
+        let declaring = std::mem::replace(&mut self.declaring, true);
+        if std::mem::take(&mut self.parameters) {
+            self.enter(ScopeKind::Function);
+            walk_parameter_type_list(self, ptl);
+        } else {
+            self.enter(ScopeKind::Prototype);
+            walk_parameter_type_list(self, ptl);
+            self.exit();
+        }
+        self.depth = depth;
+        self.declaring = declaring;
+    }
+
+    fn visit_compound_statement(&mut self, c: &'a CompoundStatement) {
+        self.enter(ScopeKind::Block);
+        walk_compound_statement(self, c);
+        self.exit();
+    }
+
+    fn visit_iteration_statement(&mut self, i: &'a IterationStatement) {
+        if let IterationStatement::For { init: Some(ForInit::Declaration(_)), .. } = i {
+            self.enter(ScopeKind::Block);
+            walk_iteration_statement(self, i);
+            self.exit();
+        } else {
+            walk_iteration_statement(self, i);
+        }
+    }
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) {
+        if let PostfixExpression::Primary(PrimaryExpression::Identifier(name)) = p
+            && let Some(use_) = self.index.id(Node::PostfixExpression(p))
+        {
+            let def = self.lookup(name.0);
+            self.uses.push((use_, def));
+        }
+        walk_postfix_expression(self, p)
+    }
+}
@@ -0,0 +1,522 @@
+//! Semantic patches: rewrites of the expressions matched by structural
+//! queries.
+//!
+//! A [`Rule`] is a [`Query`] with a replacement, in which `@name` stands for
+//! the source text of the capture `name`. A [`Rewriter`] matches its rules in
+//! one walk of each unit, as a [`QuerySet`], and returns the rewrites as
+//! [`TextEdit`]s of the source, sorted and not overlapping, so that callers
+//! write back or show only the expressions that changed:
+//!
+//! ```ignore
+//! let rewriter = Rewriter::new([
+//!     Rule::new(r#"(call "bzero" _ @buf _ @len)"#, "memset(@buf, 0, @len)")?,
+//!     Rule::new(r#"(call "square" _ @x)"#, "@x * @x")?,
+//! ]);
+//! for (file, rewrite) in files.iter().zip(rewriter.rewrite_sources(&files, &state)) {
+//!     let text = apply_edits(file.0, &rewrite.edits);
+//!     // ...
+//! }
+//! ```
+//!
+//! Nothing is printed from the tree: the text between the matches is never
+//! touched, and a replacement is made of its template and of the source text
+//! of its captures, so formatting and comments are kept everywhere else. A
+//! capture is put in parentheses unless it is a primary or postfix
+//! expression, or it stands alone as an argument of a call; a replacement is
+//! put in parentheses unless it is a call or similar, or it replaces a whole
+//! argument, initializer, operand of an assignment or expression statement.
+//!
+//! Matches inside the captures of another match are rewritten first, in the
+//! text of the capture, so `square(square(y))` becomes
+//! `(y * y) * (y * y)`. Other matches that overlap a match are dropped, and
+//! of the rules matching the same expression, the first one added wins.
+//!
+//! Over a corpus, [`Rewriter::rewrite_sources`] works on all available cores
+//! and does not parse the sources that cannot match: when each rule tests a
+//! name, sources that spell none of them are skipped after a substring
+//! search, so mostly unaffected corpora cost little more than reading them.
+//! With the `serde` and `mmap` features,
+//! [`Rewriter::rewrite_sources_cached`] reads the units unchanged since the
+//! last run from a [`ParseCache`](crate::ParseCache) instead of parsing them.
+
+use std::{cmp::Reverse, ops::Range};
+
+use rustc_hash::FxHashMap;
+
+use crate::{
+    ParsedUnit, State, TextEdit,
+    ast::*,
+    lex,
+    parallel::{par_map, parse_unit},
+    query::{Query, QueryError, QueryMatch, QuerySet},
+    span::Span,
+    symbol::Symbol,
+    visitor::{Visitor, walk_expression},
+};
+
+/// A part of a replacement.
+#[derive(Debug, Clone)]
+enum Piece {
+    Text(Box<str>),
+    Capture {
+        index: usize,
+        /// Whether the capture stands alone between `(` or `,` and `)` or
+        /// `,`, so it needs no parentheses.
+        bare: bool,
+    },
+}
+
+/// A replacement, compiled.
+#[derive(Debug, Clone)]
+struct Template {
+    pieces: Vec<Piece>,
+    /// Whether the replacement is an identifier, constant, call, member
+    /// access or the like, which needs no parentheses.
+    atomic: bool,
+    /// Whether the replacement has a comma outside of parentheses.
+    comma: bool,
+}
+
+/// A query with the replacement of its matches, see the
+/// [module documentation](self).
+#[derive(Debug, Clone)]
+pub struct Rule {
+    query: Query,
+    template: Template,
+}
+
+impl Rule {
+    /// Compile the query `query` and the replacement `replacement` of its
+    /// matches, where `@name` stands for the capture `name` of the query.
+    /// Every `@` of the replacement starts the name of a capture.
+    ///
+    /// The offset of an error in the replacement is in the replacement.
+    pub fn new(query: &str, replacement: &str) -> Result<Self, QueryError> {
+        let query = Query::new(query)?;
+        let template = Template::new(&query, replacement)?;
+        Ok(Self { query, template })
+    }
+
+    /// The query of the rule.
+    pub fn query(&self) -> &Query {
+        &self.query
+    }
+}
+
+impl Template {
+    fn new(query: &Query, text: &str) -> Result<Self, QueryError> {
+        let mut pieces = Vec::new();
+        let mut rest = text;
+        while let Some(at) = rest.find('@') {
+            let name_len = (rest[at + 1..])
+                .find(|c: char| !(c.is_ascii_alphanumeric() || c == '_' || c == '-'))
+                .unwrap_or(rest.len() - at - 1);
+            let mut name = &rest[at + 1..at + 1 + name_len];
+            // `@a-1` is the capture `a` minus one, unless `a-1` is a capture
+            while query.capture_index(name).is_none()
+                && let Some(dash) = name.rfind('-')
+            {
+                name = &name[..dash];
+            }
+            let Some(index) = query.capture_index(name) else {
+                let offset = text.len() - rest.len() + at;
+                let message = format!("unknown capture `@{}`", &rest[at + 1..at + 1 + name_len]);
+                return Err(QueryError { offset, message });
+            };
+            if at > 0 {
+                pieces.push(Piece::Text(rest[..at].into()));
+            }
+            let before = rest[..at].trim_end();
+            let after = rest[at + 1 + name.len()..].trim_start();
+            let bare = (before.ends_with(['(', ',']) && after.starts_with([')', ',']))
+                || (before.is_empty() && after.is_empty() && pieces.is_empty());
+            pieces.push(Piece::Capture { index, bare });
+            rest = &rest[at + 1 + name.len()..];
+        }
+        if !rest.is_empty() {
+            pieces.push(Piece::Text(rest.into()));
+        }
+
+        // Captures are looked at as identifiers
+        let shape: String = (pieces.iter())
+            .map(|piece| match piece {
+                Piece::Text(text) => &**text,
+                Piece::Capture { .. } => "x",
+            })
+            .collect();
+        let lone = matches!(pieces[..], [Piece::Capture { .. }]);
+        Ok(Self {
+            atomic: !lone && is_atomic(shape.trim()),
+            comma: has_comma(&shape),
+            pieces,
+        })
+    }
+}
+
+/// The end of the group of brackets opened at the start of `text`, if it is
+/// closed.
+fn group_end(text: &str) -> Option<usize> {
+    let mut depth = 0usize;
+    let mut quote = None;
+    let mut chars = text.char_indices();
+    while let Some((i, c)) = chars.next() {
+        match (quote, c) {
+            (Some(_), '\\') => {
+                chars.next();
+            }
+            (Some(q), _) if c == q => quote = None,
+            (Some(_), _) => {}
+            (None, '"' | '\'') => quote = Some(c),
+            (None, '(' | '[' | '{') => depth += 1,
+            (None, ')' | ']' | '}') => {
+                depth = depth.checked_sub(1)?;
+                if depth == 0 {
+                    return Some(i + 1);
+                }
+            }
+            (None, _) => {}
+        }
+    }
+    None
+}
+
+fn is_word(c: char) -> bool {
+    c.is_ascii_alphanumeric() || c == '_'
+}
+
+/// Whether `text` is a primary or postfix expression: a word or a group,
+/// followed by calls, subscripts and member accesses.
+fn is_atomic(text: &str) -> bool {
+    let mut rest = match text.find(|c| !is_word(c)) {
+        Some(0) if text.starts_with('(') => match group_end(text) {
+            Some(end) => &text[end..],
+            None => return false,
+        },
+        Some(0) => return false,
+        Some(len) => &text[len..],
+        None => return !text.is_empty(),
+    };
+    loop {
+        rest = rest.trim_start();
+        if rest.is_empty() {
+            return true;
+        }
+        if rest.starts_with(['(', '[']) {
+            let Some(end) = group_end(rest) else { return false };
+            rest = &rest[end..];
+        } else if let Some(member) = rest.strip_prefix("->").or_else(|| rest.strip_prefix('.')) {
+            let member = member.trim_start();
+            let len = member.find(|c| !is_word(c)).unwrap_or(member.len());
+            if len == 0 {
+                return false;
+            }
+            rest = &member[len..];
+        } else {
+            return false;
+        }
+    }
+}
+
+/// Whether `text` has a comma outside of brackets and quotes.
+fn has_comma(text: &str) -> bool {
+    let mut rest = text;
+    while let Some(i) = rest.find([',', '(', '[', '{', '"', '\'']) {
+        if rest[i..].starts_with(',') {
+            return true;
+        }
+        let end = if rest[i..].starts_with(['"', '\'']) {
+            let quote = rest[i..].chars().next().unwrap();
+            let mut escaped = false;
+            rest[i + 1..]
+                .find(|c| {
+                    let end = !escaped && c == quote;
+                    escaped = !escaped && c == '\\';
+                    end
+                })
+                .map(|j| i + j + 2)
+        } else {
+            group_end(&rest[i..]).map(|j| i + j)
+        };
+        let Some(end) = end else { return false };
+        rest = &rest[end..];
+    }
+    false
+}
+
+/// Whether the expression at `range` of `source` is a whole argument,
+/// initializer, operand of an assignment or expression statement, where a
+/// replacement needs no parentheses unless it has a comma.
+fn is_bare(source: &str, range: Range<usize>) -> bool {
+    let before = source[..range.start].trim_end();
+    let after = source[range.end..].trim_start();
+    let opens = before.ends_with(['(', ',', ';', '{', '}', '['])
+        || before
+            .strip_suffix('=')
+            .is_some_and(|before| !before.ends_with(['=', '!', '<', '>']))
+        || before
+            .strip_suffix("return")
+            .is_some_and(|before| !before.ends_with(is_word));
+    opens && after.starts_with([')', ',', ';', ']', '}'])
+}
+
+/// The kind of an expression captured, for the parentheses it needs.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Kind {
+    /// A primary or postfix expression.
+    Atomic,
+    Comma,
+    Other,
+}
+
+/// Finds the kinds of the expressions at the spans of the captures.
+struct Kinds {
+    kinds: FxHashMap<Span, Option<Kind>>,
+}
+
+impl<'a> Visitor<'a> for Kinds {
+    type Result = ();
+
+    fn visit_expression(&mut self, e: &'a Expression) {
+        // The outermost expression of a span, e.g. with its parentheses
+        if let Some(kind) = self.kinds.get_mut(&e.span)
+            && kind.is_none()
+        {
+            *kind = Some(match e.kind {
+                ExpressionKind::Postfix(_) => Kind::Atomic,
+                ExpressionKind::Comma(_) => Kind::Comma,
+                _ => Kind::Other,
+            });
+        }
+        walk_expression(self, e)
+    }
+}
+
+/// The edits of one source of a corpus.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct FileEdits {
+    /// The rewrites of the source, sorted and not overlapping.
+    pub edits: Vec<TextEdit>,
+    /// The number of syntax errors of the source. Sources with errors are
+    /// not rewritten, since recovering from an error drops text.
+    pub errors: usize,
+}
+
+/// Rules applied together, see the [module documentation](self).
+#[derive(Debug, Clone, Default)]
+pub struct Rewriter {
+    set: QuerySet,
+    templates: Vec<Template>,
+    /// A name the matches of each rule spell, if the rule tests any.
+    names: Vec<Option<Symbol>>,
+}
+
+impl Rewriter {
+    /// Create a rewriter applying `rules`, which take precedence in the order
+    /// given.
+    pub fn new(rules: impl IntoIterator<Item = Rule>) -> Self {
+        let mut rewriter = Self::default();
+        for rule in rules {
+            rewriter.push(rule);
+        }
+        rewriter
+    }
+
+    /// Add `rule` after the others, returning its index.
+    pub fn push(&mut self, rule: Rule) -> usize {
+        self.names.push(rule.query.required_name());
+        self.templates.push(rule.template);
+        self.set.push(rule.query)
+    }
+
+    /// The number of rules.
+    pub fn len(&self) -> usize {
+        self.templates.len()
+    }
+
+    /// Check whether there are no rules.
+    pub fn is_empty(&self) -> bool {
+        self.templates.is_empty()
+    }
+
+    /// Whether any rule can match a unit parsed from `source`. A source for
+    /// which this is false need not be parsed.
+    pub fn may_match(&self, source: &str) -> bool {
+        (self.names.iter()).any(|name| name.is_none_or(|name| source.contains(name.as_str())))
+    }
+
+    /// The rewrites of `unit`, parsed from `source`, sorted and not
+    /// overlapping.
+    pub fn edits(&self, unit: &TranslationUnit, source: &str) -> Vec<TextEdit> {
+        let mut matches = self.set.matches(unit);
+        if matches.is_empty() {
+            return Vec::new();
+        }
+        // Outer matches first, then by rule
+        matches.sort_by_key(|m| (m.span.range().start, Reverse(m.span.range().end), m.query));
+        let mut kinds = Kinds {
+            kinds: (matches.iter())
+                .flat_map(|m| m.captures.iter().map(|&span| (span, None)))
+                .collect(),
+        };
+        kinds.visit_translation_unit(unit);
+
+        let matches: Vec<_> = matches.iter().collect();
+        self.rewrite(source, &matches, &kinds.kinds)
+    }
+
+    /// The rewrites of the outermost of `matches`, sorted by start.
+    fn rewrite(&self, source: &str, matches: &[&QueryMatch], kinds: &FxHashMap<Span, Option<Kind>>) -> Vec<TextEdit> {
+        let mut edits = Vec::new();
+        let mut i = 0;
+        while i < matches.len() {
+            let range = matches[i].span.range();
+            let inner = 1 + matches[i + 1..].partition_point(|m| m.span.range().start < range.end);
+            let text = self.instantiate(source, matches[i], &matches[i + 1..i + inner], kinds);
+            edits.push(TextEdit::new(range, text));
+            i += inner;
+        }
+        edits
+    }
+
+    /// The replacement of `m`, with the `inner` matches that start in it
+    /// applied to its captures.
+    fn instantiate(
+        &self,
+        source: &str,
+        m: &QueryMatch,
+        inner: &[&QueryMatch],
+        kinds: &FxHashMap<Span, Option<Kind>>,
+    ) -> String {
+        let template = &self.templates[m.query];
+        let mut text = String::new();
+        let mut lone = Kind::Other;
+        for piece in &template.pieces {
+            let (index, bare) = match piece {
+                Piece::Text(piece) => {
+                    text.push_str(piece);
+                    continue;
+                }
+                Piece::Capture { index, bare } => (*index, *bare),
+            };
+            let span = m.captures[index];
+            let range = span.range();
+            let inside: Vec<_> = (inner.iter())
+                .filter(|n| range.start <= n.span.range().start && n.span.range().end <= range.end)
+                .copied()
+                .collect();
+            let kind = match inside.first() {
+                // The capture is replaced whole
+                Some(n) if n.span == span && self.templates[n.query].atomic => Kind::Atomic,
+                Some(n) if n.span == span => Kind::Other,
+                _ => kinds.get(&span).copied().flatten().unwrap_or(Kind::Other),
+            };
+            lone = kind;
+            let edits = self.rewrite(source, &inside, kinds);
+            let parenthesize = kind == Kind::Comma || (kind == Kind::Other && !bare);
+            if parenthesize {
+                text.push('(');
+            }
+            splice(source, range, &edits, &mut text);
+            if parenthesize {
+                text.push(')');
+            }
+        }
+
+        let atomic =
+            template.atomic || (matches!(template.pieces[..], [Piece::Capture { .. }]) && lone == Kind::Atomic);
+        if !atomic && (template.comma || !is_bare(source, m.span.range())) {
+            text.insert(0, '(');
+            text.push(')');
+        }
+        text
+    }
+
+    /// Lex and parse each of `files`, a source and an optional filename, from
+    /// a clone of `state`, and rewrite it, on all available cores. Sources no
+    /// rule can match are not parsed, see [`Rewriter::may_match`].
+    pub fn rewrite_sources(&self, files: &[(&str, Option<&str>)], state: &State) -> Vec<FileEdits> {
+        self.rewrite_parsed(files, |source, filename| {
+            let (tokens, ctx_map) = lex(source, filename);
+            parse_unit(&tokens, ctx_map, state)
+        })
+    }
+
+    /// Rewrite each of `files` as [`Rewriter::rewrite_sources`] does, reading
+    /// the units from `cache`, or parsing them and storing them there.
+    #[cfg(all(feature = "serde", feature = "mmap"))]
+    pub fn rewrite_sources_cached(
+        &self,
+        files: &[(&str, Option<&str>)],
+        state: &State,
+        cache: &crate::ParseCache,
+    ) -> Vec<FileEdits> {
+        self.rewrite_parsed(files, |source, filename| cache.parse(source, filename, state))
+    }
+
+    fn rewrite_parsed<'s>(
+        &self,
+        files: &[(&'s str, Option<&str>)],
+        parse: impl Fn(&'s str, Option<&str>) -> ParsedUnit<'s> + Sync,
+    ) -> Vec<FileEdits> {
+        par_map(files, |&(source, filename)| {
+            if !self.may_match(source) {
+                return FileEdits::default();
+            }
+            let parsed = parse(source, filename);
+            match &parsed.output {
+                Some(unit) if !parsed.has_errors() => FileEdits {
+                    edits: self.edits(unit, source),
+                    errors: 0,
+                },
+                _ => FileEdits {
+                    edits: Vec::new(),
+                    errors: parsed.errors.len(),
+                },
+            }
+        })
+    }
+}
+
+/// Append the text of `range` of `source`, with `edits` in it applied, to
+/// `text`.
+fn splice(source: &str, range: Range<usize>, edits: &[TextEdit], text: &mut String) {
+    let mut cursor = range.start;
+    for edit in edits {
+        text.push_str(&source[cursor..edit.range.start]);
+        text.push_str(&edit.text);
+        cursor = edit.range.end;
+    }
+    text.push_str(&source[cursor..range.end]);
+}
+
+/// Apply `edits`, sorted and not overlapping, such as those of a
+/// [`Rewriter`], to `source`.
+pub fn apply_edits(source: &str, edits: &[TextEdit]) -> String {
+    let mut text = String::with_capacity(source.len());
+    splice(source, 0..source.len(), edits, &mut text);
+    text
+}
+
+#[cfg(test)]
+mod test {
+    use super::{has_comma, is_atomic};
+
+    #[test]
+    fn test_is_atomic() {
+        assert!(is_atomic("x"));
+        assert!(is_atomic("memset(x, 0, x)"));
+        assert!(is_atomic("x->next[1].value"));
+        assert!(is_atomic("(x + 1)"));
+        assert!(!is_atomic("x * x"));
+        assert!(!is_atomic("(x) + (x)"));
+        assert!(!is_atomic("-x"));
+        assert!(!is_atomic("f(x"));
+    }
+
+    #[test]
+    fn test_has_comma() {
+        assert!(has_comma("x, 1"));
+        assert!(!has_comma("f(x, 1)"));
+        assert!(!has_comma("g(\"a, b\") + ','"));
+    }
+}
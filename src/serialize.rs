@@ -0,0 +1,525 @@
+//! Compact binary serialization of tokens and syntax trees, for caching.
+//!
+//! With the `serde` feature, the token and syntax tree types implement
+//! `Serialize` and `Deserialize`, and [`encode`] writes a lexed and parsed
+//! translation unit, together with its source contexts, in a compact,
+//! versioned binary format that [`decode`] reads back without lexing or
+//! parsing the source again:
+//!
+//! ```ignore
+//! let (tokens, ctx_map) = lex(source, Some("input.c"));
+//! let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+//! let bytes = serialize::encode(&tokens, &unit, &ctx_map)?;
+//!
+//! let (tokens, unit, ctx_map) = serialize::decode(&bytes, source)?;
+//! ```
+//!
+//! Spans are offsets into the source, so the source itself is not stored:
+//! [`decode`] takes it again and checks that it is the one the data was
+//! encoded from. Identifiers are stored once, in a table of symbols at the
+//! start of the data, and referred to by index. Lazy function bodies are
+//! parsed before they are written.
+//!
+//! The data starts with [`FORMAT_VERSION`], and data written by another
+//! version of the format is rejected.
+//!
+//! With the `export` feature, [`export_json`] and [`export_msgpack`] write a
+//! tree for tools in other languages instead, streaming it to a writer, with
+//! identifiers as strings and the spans and error nodes optional.
+
+use std::{
+    cell::{Cell, RefCell},
+    fmt,
+    hash::Hasher,
+    ops::ControlFlow,
+};
+
+use rustc_hash::{FxHashMap, FxHasher};
+use serde::{Deserialize, Deserializer, Serialize, Serializer, de, de::DeserializeOwned, ser::SerializeStruct};
+
+use crate::{
+    ast::*,
+    span::{ContextMapping, ContextTable, Span, Spanned},
+    symbol::Symbol,
+    visitor::*,
+};
+
+/// Version of the binary format, increased whenever the format or the types of
+/// the syntax tree change.
+pub const FORMAT_VERSION: u32 = 5;
+
+const MAGIC: [u8; 4] = *b"CGRM";
+
+/// Length of the header: magic, version, source length and source hash.
+const HEADER_LEN: usize = 4 + 4 + 8 + 8;
+
+/// Errors from [`encode`] and [`decode`].
+#[derive(Debug)]
+pub enum Error {
+    /// The data does not start with the header of the format.
+    NotEncoded,
+    /// The data was written by another version of the format.
+    Version(u32),
+    /// The data was encoded from another source.
+    SourceMismatch,
+    /// The data could not be written or read, e.g. because it is truncated or
+    /// the tree contains interpolations.
+    Format(postcard::Error),
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            Error::NotEncoded => write!(f, "not an encoded translation unit"),
+            Error::Version(version) => {
+                write!(
+                    f,
+                    "format version {version} is not supported, expected {FORMAT_VERSION}"
+                )
+            }
+            Error::SourceMismatch => write!(f, "encoded from another source"),
+            Error::Format(err) => write!(f, "{err}"),
+        }
+    }
+}
+
+impl std::error::Error for Error {
+    fn source(&self) -> Option<&(dyn std::error::Error + 'static)> {
+        match self {
+            Error::Format(err) => Some(err),
+            _ => None,
+        }
+    }
+}
+
+impl From<postcard::Error> for Error {
+    fn from(err: postcard::Error) -> Self {
+        Error::Format(err)
+    }
+}
+
+/// Encode the tokens and syntax tree of `ctx_map.source`, and its source
+/// contexts.
+pub fn encode(
+    tokens: &BalancedTokenSequence,
+    unit: &TranslationUnit,
+    ctx_map: &ContextMapping<'_>,
+) -> Result<Vec<u8>, Error> {
+    let (symbols, data) = encode_with_symbols(&(tokens, unit, ctx_map.table()))?;
+    let mut bytes = Vec::with_capacity(HEADER_LEN + symbols.len() + data.len());
+    bytes.extend_from_slice(&MAGIC);
+    bytes.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+    bytes.extend_from_slice(&(ctx_map.source.len() as u64).to_le_bytes());
+    bytes.extend_from_slice(&source_hash(ctx_map.source).to_le_bytes());
+    bytes.extend_from_slice(&symbols);
+    bytes.extend_from_slice(&data);
+    Ok(bytes)
+}
+
+/// Encode a syntax tree on its own, without a source, e.g. a compiled
+/// quasi-quote template.
+///
+/// The data has the magic and version of [`encode`], but no source length or
+/// hash, and is read back by [`decode_tree`].
+pub fn encode_tree<T: Serialize>(tree: &T) -> Result<Vec<u8>, Error> {
+    let (symbols, data) = encode_with_symbols(tree)?;
+    let mut bytes = Vec::with_capacity(8 + symbols.len() + data.len());
+    bytes.extend_from_slice(&MAGIC);
+    bytes.extend_from_slice(&FORMAT_VERSION.to_le_bytes());
+    bytes.extend_from_slice(&symbols);
+    bytes.extend_from_slice(&data);
+    Ok(bytes)
+}
+
+/// Encode `value`, returning the symbol table and the data referring to it.
+fn encode_with_symbols<T: Serialize>(value: &T) -> Result<(Vec<u8>, Vec<u8>), Error> {
+    let _table = SymbolTable::Encode(FxHashMap::default(), Vec::new()).enter();
+    let data = postcard::to_allocvec(value)?;
+    let symbols = SYMBOLS.with_borrow_mut(|table| match table.take() {
+        Some(SymbolTable::Encode(_, symbols)) => symbols,
+        _ => unreachable!("Symbol table is entered"),
+    });
+    let symbols: Vec<&str> = symbols.into_iter().map(Symbol::as_str).collect();
+    Ok((postcard::to_allocvec(&symbols)?, data))
+}
+
+/// Decode the tokens, syntax tree and source contexts of `source` from
+/// `bytes`, written by [`encode`].
+pub fn decode<'a>(
+    bytes: &[u8],
+    source: &'a str,
+) -> Result<(BalancedTokenSequence, TranslationUnit, ContextMapping<'a>), Error> {
+    let header = bytes.get(..HEADER_LEN).ok_or(Error::NotEncoded)?;
+    let (magic, header) = header.split_at(4);
+    if magic != MAGIC {
+        return Err(Error::NotEncoded);
+    }
+    let (version, header) = header.split_at(4);
+    let version = u32::from_le_bytes(version.try_into().unwrap());
+    if version != FORMAT_VERSION {
+        return Err(Error::Version(version));
+    }
+    let (len, hash) = header.split_at(8);
+    if u64::from_le_bytes(len.try_into().unwrap()) != source.len() as u64
+        || u64::from_le_bytes(hash.try_into().unwrap()) != source_hash(source)
+    {
+        return Err(Error::SourceMismatch);
+    }
+
+    let (tokens, unit, table): (_, _, ContextTable) = decode_with_symbols(&bytes[HEADER_LEN..])?;
+    Ok((tokens, unit, ContextMapping::with_table(source, table)))
+}
+
+/// Decode a syntax tree written by [`encode_tree`].
+pub fn decode_tree<T: DeserializeOwned>(bytes: &[u8]) -> Result<T, Error> {
+    let header = bytes.get(..8).ok_or(Error::NotEncoded)?;
+    let (magic, version) = header.split_at(4);
+    if magic != MAGIC {
+        return Err(Error::NotEncoded);
+    }
+    let version = u32::from_le_bytes(version.try_into().unwrap());
+    if version != FORMAT_VERSION {
+        return Err(Error::Version(version));
+    }
+    decode_with_symbols(&bytes[8..])
+}
+
+/// Decode a value written by [`encode_with_symbols`].
+fn decode_with_symbols<T: DeserializeOwned>(bytes: &[u8]) -> Result<T, Error> {
+    let (symbols, data): (Vec<&str>, _) = postcard::take_from_bytes(bytes)?;
+    let symbols = symbols.into_iter().map(Symbol::intern).collect();
+    let _table = SymbolTable::Decode(symbols).enter();
+    Ok(postcard::from_bytes(data)?)
+}
+
+fn source_hash(source: &str) -> u64 {
+    let mut hasher = FxHasher::default();
+    hasher.write(source.as_bytes());
+    hasher.finish()
+}
+
+/// Symbols of the data being encoded or decoded on this thread.
+enum SymbolTable {
+    /// Index of each symbol written so far, and the symbols in order.
+    Encode(FxHashMap<Symbol, u32>, Vec<Symbol>),
+    /// Symbols by index.
+    Decode(Vec<Symbol>),
+}
+
+thread_local! {
+    static SYMBOLS: RefCell<Option<SymbolTable>> = const { RefCell::new(None) };
+}
+
+/// Clears the symbol table of the thread when dropped.
+struct SymbolTableGuard;
+
+impl SymbolTable {
+    fn enter(self) -> SymbolTableGuard {
+        SYMBOLS.set(Some(self));
+        SymbolTableGuard
+    }
+}
+
+impl Drop for SymbolTableGuard {
+    fn drop(&mut self) {
+        SYMBOLS.set(None);
+    }
+}
+
+/// Written as an index into the symbol table in [`encode`], and as a string
+/// otherwise.
+impl Serialize for Symbol {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let index = SYMBOLS.with_borrow_mut(|table| match table {
+            Some(SymbolTable::Encode(indices, symbols)) => Some(*indices.entry(*self).or_insert_with(|| {
+                symbols.push(*self);
+                symbols.len() as u32 - 1
+            })),
+            _ => None,
+        });
+        match index {
+            Some(index) => serializer.serialize_u32(index),
+            None => serializer.serialize_str(self.as_str()),
+        }
+    }
+}
+
+impl<'de> Deserialize<'de> for Symbol {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        let decoding = SYMBOLS.with_borrow(|table| matches!(table, Some(SymbolTable::Decode(_))));
+        if decoding {
+            let index = u32::deserialize(deserializer)?;
+            return SYMBOLS
+                .with_borrow(|table| match table {
+                    Some(SymbolTable::Decode(symbols)) => symbols.get(index as usize).copied(),
+                    _ => None,
+                })
+                .ok_or_else(|| de::Error::custom("symbol index out of range"));
+        }
+
+        struct SymbolVisitor;
+
+        impl de::Visitor<'_> for SymbolVisitor {
+            type Value = Symbol;
+
+            fn expecting(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+                f.write_str("a string")
+            }
+
+            fn visit_str<E: de::Error>(self, v: &str) -> Result<Symbol, E> {
+                Ok(Symbol::intern(v))
+            }
+        }
+
+        deserializer.deserialize_str(SymbolVisitor)
+    }
+}
+
+/// Written as the parsed body, parsing it first if it is lazy.
+impl Serialize for Block {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        (**self).serialize(serializer)
+    }
+}
+
+impl<'de> Deserialize<'de> for Block {
+    fn deserialize<D: Deserializer<'de>>(deserializer: D) -> Result<Self, D::Error> {
+        CompoundStatement::deserialize(deserializer).map(Block::from)
+    }
+}
+
+/// Options of [`export_json`] and [`export_msgpack`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ExportOptions {
+    /// Whether to write the spans of the nodes, as `[start, end]` offsets.
+    /// Without them, spanned values are written as the value alone.
+    pub spans: bool,
+    /// Whether to write external declarations and block items that contain
+    /// error nodes from error recovery. The error nodes in nested blocks only
+    /// leave out their own block items.
+    pub errors: bool,
+}
+
+impl Default for ExportOptions {
+    fn default() -> Self {
+        Self { spans: true, errors: true }
+    }
+}
+
+thread_local! {
+    /// Options of the export running on this thread.
+    static EXPORT: Cell<Option<ExportOptions>> = const { Cell::new(None) };
+}
+
+/// Ends the export of the thread when dropped.
+#[cfg(feature = "export")]
+struct ExportGuard;
+
+#[cfg(feature = "export")]
+impl ExportOptions {
+    fn enter(self) -> ExportGuard {
+        EXPORT.set(Some(self));
+        ExportGuard
+    }
+}
+
+#[cfg(feature = "export")]
+impl Drop for ExportGuard {
+    fn drop(&mut self) {
+        EXPORT.set(None);
+    }
+}
+
+/// Write `tree` to `writer` as JSON, for tools in other languages.
+///
+/// The tree is written as it is serialized, without building a JSON value
+/// first, so `writer` should be buffered. Identifiers are written as strings,
+/// enums as objects keyed by their variant, and spans as `[start, end]`
+/// offsets into the source, unless `options` leaves them out.
+#[cfg(feature = "export")]
+pub fn export_json<T: Serialize, W: std::io::Write>(
+    tree: &T,
+    writer: W,
+    options: ExportOptions,
+) -> std::io::Result<()> {
+    let _export = options.enter();
+    serde_json::to_writer(writer, tree)?;
+    Ok(())
+}
+
+/// Write `tree` to `writer` as MessagePack, like [`export_json`], with
+/// structs as maps keyed by their field names.
+#[cfg(feature = "export")]
+pub fn export_msgpack<T: Serialize, W: std::io::Write>(
+    tree: &T,
+    mut writer: W,
+    options: ExportOptions,
+) -> std::io::Result<()> {
+    let _export = options.enter();
+    rmp_serde::encode::write_named(&mut writer, tree).map_err(std::io::Error::other)
+}
+
+/// Written as a struct, and as `[start, end]` when exporting.
+impl Serialize for Span {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let range = self.range();
+        if EXPORT.get().is_some() {
+            return (range.start as u32, range.end as u32).serialize(serializer);
+        }
+        let mut state = serializer.serialize_struct("Span", 2)?;
+        state.serialize_field("start", &(range.start as u32))?;
+        state.serialize_field("len", &(range.len() as u32))?;
+        state.end()
+    }
+}
+
+/// Written as a struct, and as the value alone when exporting without spans.
+impl<T: Serialize> Serialize for Spanned<T> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        if !spans_exported() {
+            return self.value.serialize(serializer);
+        }
+        let mut state = serializer.serialize_struct("Spanned", 2)?;
+        state.serialize_field("value", &self.value)?;
+        state.serialize_field("span", &self.span)?;
+        state.end()
+    }
+}
+
+fn spans_exported() -> bool {
+    EXPORT.get().is_none_or(|options| options.spans)
+}
+
+/// Whether the span fields of the nodes are left out.
+pub(crate) fn omit_span(_: &Span) -> bool {
+    !spans_exported()
+}
+
+/// Written as a sequence, without the items containing error nodes when
+/// exporting without errors.
+pub(crate) fn serialize_items<T, S>(items: &[T], serializer: S) -> Result<S::Ok, S::Error>
+where
+    T: Serialize + ErrorNodes,
+    S: Serializer,
+{
+    if EXPORT.get().is_none_or(|options| options.errors) {
+        return items.serialize(serializer);
+    }
+    let items: Vec<&T> = items.iter().filter(|item| !item.has_error_nodes()).collect();
+    serializer.collect_seq(items)
+}
+
+/// Nodes of lists that error recovery can leave error nodes in.
+pub(crate) trait ErrorNodes {
+    /// Whether the node contains error nodes, outside of its nested blocks.
+    fn has_error_nodes(&self) -> bool;
+}
+
+impl ErrorNodes for ExternalDeclaration {
+    fn has_error_nodes(&self) -> bool {
+        ErrorFinder.visit_external_declaration(self).is_break()
+    }
+}
+
+impl ErrorNodes for BlockItem {
+    fn has_error_nodes(&self) -> bool {
+        ErrorFinder.visit_block_item(self).is_break()
+    }
+}
+
+/// Breaks at the first error node, skipping nested blocks.
+struct ErrorFinder;
+
+impl<'a> Visitor<'a> for ErrorFinder {
+    type Result = ControlFlow<()>;
+
+    fn visit_compound_statement(&mut self, _: &'a CompoundStatement) -> ControlFlow<()> {
+        ControlFlow::Continue(())
+    }
+
+    fn visit_expression(&mut self, e: &'a Expression) -> ControlFlow<()> {
+        if matches!(e.kind, ExpressionKind::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_expression(self, e)
+    }
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) -> ControlFlow<()> {
+        if matches!(p, PostfixExpression::Primary(PrimaryExpression::Error)) {
+            return ControlFlow::Break(());
+        }
+        walk_postfix_expression(self, p)
+    }
+
+    fn visit_constant_expression(&mut self, c: &'a ConstantExpression) -> ControlFlow<()> {
+        if matches!(c, ConstantExpression::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_constant_expression(self, c)
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) -> ControlFlow<()> {
+        if matches!(d.kind, DeclarationKind::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_declaration(self, d)
+    }
+
+    fn visit_member_declaration(&mut self, md: &'a MemberDeclaration) -> ControlFlow<()> {
+        if matches!(md, MemberDeclaration::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_member_declaration(self, md)
+    }
+
+    fn visit_typeof(&mut self, t: &'a TypeofSpecifier) -> ControlFlow<()> {
+        if let TypeofSpecifier::Typeof(TypeofSpecifierArgument::Error)
+        | TypeofSpecifier::TypeofUnqual(TypeofSpecifierArgument::Error) = t
+        {
+            return ControlFlow::Break(());
+        }
+        walk_typeof(self, t)
+    }
+
+    fn visit_declarator(&mut self, d: &'a Declarator) -> ControlFlow<()> {
+        if matches!(d, Declarator::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_declarator(self, d)
+    }
+
+    fn visit_array_declarator(&mut self, d: &'a ArrayDeclarator) -> ControlFlow<()> {
+        if matches!(d, ArrayDeclarator::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_array_declarator(self, d)
+    }
+
+    fn visit_type_name(&mut self, tn: &'a TypeName) -> ControlFlow<()> {
+        if matches!(tn, TypeName::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_type_name(self, tn)
+    }
+
+    fn visit_abstract_declarator(&mut self, a: &'a AbstractDeclarator) -> ControlFlow<()> {
+        if matches!(a, AbstractDeclarator::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_abstract_declarator(self, a)
+    }
+
+    fn visit_attribute_specifier(&mut self, a: &'a AttributeSpecifier) -> ControlFlow<()> {
+        if matches!(a, AttributeSpecifier::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_attribute_specifier(self, a)
+    }
+
+    fn visit_iteration_statement(&mut self, i: &'a IterationStatement) -> ControlFlow<()> {
+        if matches!(i, IterationStatement::Error) {
+            return ControlFlow::Break(());
+        }
+        walk_iteration_statement(self, i)
+    }
+}
@@ -0,0 +1,177 @@
+//! Parsing a stream of inputs with the same setup.
+
+use chumsky::{Parser, error::Rich, input::Input};
+
+use crate::{
+    BalancedTokenSequence, Expression, Identifier, State, Statement, TranslationUnit, TypeName, lex,
+    lexer::lex_ranges,
+    parallel::ParsedUnit,
+    parser::{expression, statement, translation_unit, type_name},
+    parser_utils::Error,
+    span::{Span, Spanned, Tokens},
+};
+
+/// Parses many inputs in turn, each from the same initial state.
+///
+/// The session keeps a template of the initial state, e.g. with typedef names
+/// known in advance, and one working state that is reset from the template
+/// before each input with [`State::reset_from`], so its buffers are reused
+/// instead of cloned and grown again for every input:
+///
+/// ```ignore
+/// let mut session = ParseSession::with_typedef_names(["term", "thm"]);
+/// for snippet in snippets {
+///     let unit = session.parse(snippet, None);
+///     // ...
+/// }
+/// ```
+///
+/// The recursive rules of the parser are built once per thread, or once per
+/// process with the `sync` feature, and cached, so getting
+/// [`translation_unit`] for each input costs a few allocations.
+///
+/// Many small snippets, e.g. expressions of a configuration file, are parsed
+/// as a batch by [`parse_expressions`](Self::parse_expressions) and its
+/// siblings, which lex them all into one token vector with one lexer before
+/// parsing each from the template in turn.
+#[derive(Clone, Default)]
+pub struct ParseSession {
+    template: State,
+    state: State,
+}
+
+impl ParseSession {
+    /// Create a session parsing each input from `template`.
+    pub fn new(template: State) -> Self {
+        Self { state: template.clone(), template }
+    }
+
+    /// Create a session where `names` are typedef names in every input.
+    pub fn with_typedef_names(names: impl IntoIterator<Item: Into<Identifier>>) -> Self {
+        let mut template = State::new();
+        template.ctx_mut().add_typedef_names(names.into_iter().map(Into::into));
+        Self::new(template)
+    }
+
+    /// The initial state of each input.
+    pub fn template(&self) -> &State {
+        &self.template
+    }
+
+    /// Get a mutable reference to the initial state of each input, e.g. to
+    /// set limits or options for the inputs parsed afterwards.
+    pub fn template_mut(&mut self) -> &mut State {
+        &mut self.template
+    }
+
+    /// The state after the last input, e.g. for its statistics.
+    pub fn state(&self) -> &State {
+        &self.state
+    }
+
+    /// Lex and parse `source` as a translation unit.
+    pub fn parse<'a>(&mut self, source: &'a str, filename: Option<&str>) -> ParsedUnit<'a> {
+        let (tokens, ctx_map) = lex(source, filename);
+        let (output, errors) = self.parse_tokens(&tokens);
+        let errors = errors.into_iter().map(|error| error.into_owned()).collect();
+        // A copy, so that the working state keeps its buffers for the next
+        // input, see `State::reset_from`
+        let declarations = self.state.declaration_index().cloned();
+        ParsedUnit { output, errors, ctx_map, declarations }
+    }
+
+    /// Parse `tokens` as a translation unit.
+    pub fn parse_tokens<'a>(&mut self, tokens: &'a BalancedTokenSequence) -> (Option<TranslationUnit>, Vec<Error<'a>>) {
+        self.state.reset_from(&self.template);
+        translation_unit()
+            .parse_with_state(tokens.as_input(), &mut self.state)
+            .into_output_errors()
+    }
+
+    /// Lex and parse each of `snippets` as an expression, in order.
+    pub fn parse_expressions(
+        &mut self,
+        snippets: impl IntoIterator<Item: AsRef<str>>,
+    ) -> Vec<ParsedSnippet<Expression>> {
+        self.parse_snippets(snippets, |input, state| {
+            expression().parse_with_state(input, state).into_output_errors()
+        })
+    }
+
+    /// Lex and parse each of `snippets` as a statement, in order.
+    pub fn parse_statements(&mut self, snippets: impl IntoIterator<Item: AsRef<str>>) -> Vec<ParsedSnippet<Statement>> {
+        self.parse_snippets(snippets, |input, state| {
+            statement().parse_with_state(input, state).into_output_errors()
+        })
+    }
+
+    /// Lex and parse each of `snippets` as a type name, in order.
+    pub fn parse_type_names(&mut self, snippets: impl IntoIterator<Item: AsRef<str>>) -> Vec<ParsedSnippet<TypeName>> {
+        self.parse_snippets(snippets, |input, state| {
+            type_name().parse_with_state(input, state).into_output_errors()
+        })
+    }
+
+    /// Lex `snippets` joined by newlines, and `parse` the tokens of each from
+    /// the template.
+    fn parse_snippets<T>(
+        &mut self,
+        snippets: impl IntoIterator<Item: AsRef<str>>,
+        mut parse: impl for<'t> FnMut(Tokens<'t>, &mut State) -> (Option<T>, Vec<Error<'t>>),
+    ) -> Vec<ParsedSnippet<T>> {
+        let mut source = String::new();
+        let ranges: Vec<_> = (snippets.into_iter())
+            .map(|snippet| {
+                let start = source.len();
+                source.push_str(snippet.as_ref());
+                let range = start..source.len();
+                source.push('\n');
+                range
+            })
+            .collect();
+        let (tokens, lexed, _) = lex_ranges(&source, &ranges);
+
+        (ranges.into_iter().zip(lexed))
+            .map(|(range, lexed)| {
+                let Some(lexed) = lexed else {
+                    return ParsedSnippet {
+                        output: None,
+                        errors: vec![Rich::custom(
+                            Span::new(range.clone()),
+                            "unbalanced brackets or unterminated comment",
+                        )],
+                        offset: range.start,
+                    };
+                };
+                self.state.reset_from(&self.template);
+                let input: Tokens<'_> = tokens[lexed].map(Span::new_eoi(range.end), Spanned::as_pair);
+                let (output, errors) = parse(input, &mut self.state);
+                ParsedSnippet {
+                    output,
+                    errors: errors.into_iter().map(|error| error.into_owned()).collect(),
+                    offset: range.start,
+                }
+            })
+            .collect()
+    }
+}
+
+/// The result of parsing one snippet of a batch, e.g. by
+/// [`ParseSession::parse_expressions`].
+#[derive(Debug, Clone)]
+pub struct ParsedSnippet<T> {
+    /// The parsed snippet, if parsing produced any output.
+    pub output: Option<T>,
+    /// Errors encountered while lexing or parsing.
+    pub errors: Vec<Error<'static>>,
+    /// The offset of the snippet in the text the spans of `output` and
+    /// `errors` index: the snippets of the batch, each followed by a newline.
+    pub offset: usize,
+}
+
+impl<T> ParsedSnippet<T> {
+    /// Check whether parsing produced any errors.
+    pub fn has_errors(&self) -> bool {
+        !self.errors.is_empty()
+    }
+}
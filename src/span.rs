@@ -1,23 +1,28 @@
 //! Span utilities.
 
-#[cfg(feature = "report")]
-use std::collections::HashMap;
-use std::ops::Range;
+use std::{
+    ops::Range,
+    sync::{Arc, OnceLock},
+};
 
 #[cfg(feature = "report")]
 use ariadne::Source;
 use chumsky::input::{Input, MappedInput};
 #[cfg(feature = "dbg-pls")]
 use dbg_pls::DebugPls;
+use rustc_hash::{FxHashMap, FxHashSet};
+#[cfg(feature = "serde")]
+use serde::{Deserialize, Serialize};
 
-use crate::{BalancedToken, BalancedTokenSequence, utils::Slab};
+use crate::{BalancedToken, BalancedTokenSequence, symbol::Symbol, utils::Slab};
 
 /// Source context information for error reporting.
-#[derive(Debug, Clone, PartialEq, Eq)]
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct SourceContext {
     /// The original filename.
-    pub filename: String,
+    pub filename: Arc<str>,
     /// The offset from the line numbers in the input code to the original
     /// source file.
     pub line_offset: i32,
@@ -26,6 +31,7 @@ pub struct SourceContext {
 /// An identifier for a source context.
 #[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
 pub struct ContextId(i32);
 
 impl From<usize> for ContextId {
@@ -46,30 +52,377 @@ impl ContextId {
     }
 }
 
+/// An identifier for a macro expansion, see [`ContextMapping::expansion`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash, PartialOrd, Ord)]
+#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct ExpansionId(u32);
+
+impl From<u32> for ExpansionId {
+    fn from(value: u32) -> Self {
+        ExpansionId(value)
+    }
+}
+
+impl ExpansionId {
+    /// Get the index of this expansion ID.
+    pub fn idx(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// An expansion of a macro by the built-in preprocessor.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+#[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct Expansion {
+    /// The name of the macro expanded.
+    pub name: Symbol,
+    /// The span of the macro name where it is expanded, which is itself in
+    /// the `parent` expansion if there is one.
+    pub site: Span,
+    /// The expansion the macro name was produced by, if it is not in the
+    /// source as written.
+    pub parent: Option<ExpansionId>,
+}
+
 /// A collection of span contexts for tracking source file information.
+///
+/// Spans do not store their context: each context is in effect from the
+/// offset where it starts, e.g. the line after a `#line` directive, up to the
+/// start of the next one.
+///
+/// The spans of tokens expanded from a macro are those of their spelling in
+/// the definition, so for the output of a [`Preprocessor`] the mapping also
+/// keeps where each token was expanded. Tokens are numbered in the order they
+/// are written, with a group counted once, for its opening bracket, and each
+/// run of consecutive tokens from the same expansion takes one entry, so the
+/// macros a token comes from are found by a binary search,
+/// [`ContextMapping::macro_stack`].
+///
+/// Instead of one source, spans may address many [buffers], e.g. the text of
+/// each file read by a [`Preprocessor`], shared with its [`HeaderCache`],
+/// placed one after the other without copying them into one string. The text
+/// and lines of spans are then read from the buffers, by
+/// [`ContextMapping::text`] and [`ContextMapping::line_col`].
+///
+/// [`Preprocessor`]: crate::Preprocessor
+/// [`HeaderCache`]: crate::HeaderCache
+/// [buffers]: ContextMapping::add_buffer
 #[derive(Clone)]
 pub struct ContextMapping<'a> {
-    /// The original source code.
+    /// The original source code, empty for a mapping over buffers that does
+    /// not also have the joined source.
     pub source: &'a str,
-    contexts: Slab<SourceContext>,
+    table: ContextTable,
+    /// Start offset of every line of the source, built on first use.
+    line_starts: OnceLock<Vec<u32>>,
+    /// Source buffers, sorted by offset.
+    buffers: Vec<Buffer>,
+    /// The source for reports, shared by all contexts.
     #[cfg(feature = "report")]
-    ctx_source: HashMap<ContextId, Source<&'a str>>,
+    ctx_source: Option<Source<&'a str>>,
+}
+
+/// A source buffer of a [`ContextMapping`].
+#[derive(Clone)]
+struct Buffer {
+    /// Offset of the text in the spans.
+    base: u32,
+    /// Number of lines before the text.
+    lines: u32,
+    text: Arc<str>,
+    /// Start offset of every line of the text, built on first use.
+    line_starts: OnceLock<Vec<u32>>,
+}
+
+impl Buffer {
+    fn line_starts(&self) -> &[u32] {
+        self.line_starts.get_or_init(|| line_starts(&self.text))
+    }
+}
+
+/// Start offset of every line of `text`.
+fn line_starts(text: &str) -> Vec<u32> {
+    std::iter::once(0)
+        .chain(memchr::memchr_iter(b'\n', text.as_bytes()).map(|index| index as u32 + 1))
+        .collect()
+}
+
+/// Source contexts and the offsets where they start.
+#[derive(Clone)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub(crate) struct ContextTable {
+    contexts: Slab<SourceContext>,
+    /// Start offset of each context in effect, sorted by offset.
+    starts: Vec<(u32, ContextId)>,
+    /// Interned filenames.
+    #[cfg_attr(feature = "serde", serde(skip))]
+    filenames: FxHashSet<Arc<str>>,
+    /// IDs of the contexts started so far.
+    #[cfg_attr(feature = "serde", serde(skip))]
+    ids: FxHashMap<SourceContext, ContextId>,
+    /// Macro expansions, by ID.
+    expansions: Vec<Expansion>,
+    /// Index of the first token of each run of tokens from the same
+    /// expansion, and the expansion, [`NO_EXPANSION`] for tokens as written,
+    /// sorted by token.
+    runs: Vec<(u32, u32)>,
+}
+
+/// The expansion of the tokens of a run that are not expanded from a macro.
+pub(crate) const NO_EXPANSION: u32 = u32::MAX;
+
+impl ContextTable {
+    pub(crate) fn new() -> Self {
+        Self {
+            contexts: Slab::new(),
+            starts: Vec::new(),
+            filenames: FxHashSet::default(),
+            ids: FxHashMap::default(),
+            expansions: Vec::new(),
+            runs: Vec::new(),
+        }
+    }
 }
 
 impl<'a> ContextMapping<'a> {
     /// Creates a new empty span context collection.
     pub fn new(source: &'a str) -> Self {
+        Self::with_table(source, ContextTable::new())
+    }
+
+    pub(crate) fn with_table(source: &'a str, table: ContextTable) -> Self {
         Self {
             source,
-            contexts: Slab::new(),
+            table,
+            line_starts: OnceLock::new(),
+            buffers: Vec::new(),
             #[cfg(feature = "report")]
-            ctx_source: HashMap::new(),
+            ctx_source: None,
         }
     }
 
+    pub(crate) fn table(&self) -> &ContextTable {
+        &self.table
+    }
+
+    pub(crate) fn into_table(self) -> ContextTable {
+        self.table
+    }
+
     /// Inserts a new source context and returns its ID.
     pub fn insert_context(&mut self, context: SourceContext) -> ContextId {
-        self.contexts.insert(context).into()
+        self.table.contexts.insert(context).into()
+    }
+
+    /// Returns the shared copy of `filename`, so that the contexts of every
+    /// line marker naming the same file share one string.
+    pub fn intern_filename(&mut self, filename: &str) -> Arc<str> {
+        if let Some(filename) = self.table.filenames.get(filename) {
+            return filename.clone();
+        }
+        let filename: Arc<str> = filename.into();
+        self.table.filenames.insert(filename.clone());
+        filename
+    }
+
+    /// Puts a source context in effect from `offset` on, and returns its ID.
+    ///
+    /// A context equal to one started before reuses its ID, so repeated line
+    /// markers for the same file and line offset share one entry.
+    ///
+    /// Panics if `offset` precedes the start of the last context.
+    pub fn start_context(&mut self, offset: usize, mut context: SourceContext) -> ContextId {
+        let offset = offset.try_into().expect("Span start overflow");
+        assert!(
+            self.table.starts.last().is_none_or(|&(last, _)| last <= offset),
+            "Contexts must start in order"
+        );
+        let id = match self.table.ids.get(&context) {
+            Some(&id) => id,
+            None => {
+                context.filename = self.intern_filename(&context.filename);
+                let id = self.insert_context(context.clone());
+                self.table.ids.insert(context, id);
+                id
+            }
+        };
+        self.table.starts.push((offset, id));
+        id
+    }
+
+    /// Gets a source context by its ID.
+    pub fn context(&self, id: ContextId) -> Option<&SourceContext> {
+        id.idx().and_then(|id| self.table.contexts.get(id))
+    }
+
+    /// Gets the ID of the context in effect at `offset`.
+    pub fn context_at(&self, offset: usize) -> ContextId {
+        let index = self
+            .table
+            .starts
+            .partition_point(|&(start, _)| start as usize <= offset);
+        index
+            .checked_sub(1)
+            .map_or(ContextId::none(), |index| self.table.starts[index].1)
+    }
+
+    /// Gets the line and column of `offset` in the original source file of the
+    /// context in effect there, applying the line offset of that context.
+    ///
+    /// The line is found by a binary search in a table of line starts, which
+    /// is built on first use and shared by all contexts. Columns count
+    /// characters.
+    pub fn line_col(&self, offset: usize) -> LineCol {
+        let (source, base, lines, line_starts) = match self.buffer_at(offset) {
+            Some(buffer) => (
+                &*buffer.text,
+                buffer.base as usize,
+                buffer.lines as usize,
+                buffer.line_starts(),
+            ),
+            None => (
+                self.source,
+                0,
+                0,
+                &self.line_starts.get_or_init(|| line_starts(self.source))[..],
+            ),
+        };
+        let local = offset - base;
+        let index = line_starts.partition_point(|&start| start as usize <= local) - 1 + lines;
+        let line_start = line_starts[index - lines] as usize;
+        let column = source
+            .get(line_start..local)
+            .map_or(local - line_start, |text| text.chars().count());
+        let line_offset = self.context(self.context_at(offset)).map_or(0, |ctx| ctx.line_offset);
+        LineCol {
+            line: (index + 1).saturating_add_signed(-(line_offset as isize)),
+            column: column + 1,
+        }
+    }
+
+    /// Adds a source buffer after the last one, and returns the offset of its
+    /// text in the spans. A newline is taken to end text that does not end
+    /// with one, so that each buffer starts a line.
+    ///
+    /// The buffer is shared, not copied, e.g. with the [`HeaderCache`] the
+    /// text comes from.
+    ///
+    /// [`HeaderCache`]: crate::HeaderCache
+    pub fn add_buffer(&mut self, text: Arc<str>) -> usize {
+        let (base, lines) = self.buffers.last().map_or((0, 0), |last| {
+            let newline = !last.text.ends_with('\n');
+            let len = last.text.len() + usize::from(newline);
+            let lines = last.line_starts().len() - usize::from(!newline);
+            (last.base as usize + len, last.lines as usize + lines)
+        });
+        self.buffers.push(Buffer {
+            base: base.try_into().expect("Span start overflow"),
+            lines: lines.try_into().expect("Line number overflow"),
+            text,
+            line_starts: OnceLock::new(),
+        });
+        base
+    }
+
+    /// The buffer that `offset` is in, or just past the end of.
+    fn buffer_at(&self, offset: usize) -> Option<&Buffer> {
+        let index = self.buffers.partition_point(|buffer| buffer.base as usize <= offset);
+        self.buffers.get(index.checked_sub(1)?)
+    }
+
+    /// The text of `span`, from the buffer it is in or from the source.
+    pub fn text(&self, span: Span) -> Option<&str> {
+        let range = span.range();
+        match self.buffer_at(range.start) {
+            Some(buffer) => buffer
+                .text
+                .get(range.start - buffer.base as usize..range.end - buffer.base as usize),
+            None => self.source.get(range),
+        }
+    }
+
+    /// The text of the line that `offset` is in, without its newline.
+    pub fn line_text(&self, offset: usize) -> Option<&str> {
+        let (source, base) = match self.buffer_at(offset) {
+            Some(buffer) => (&*buffer.text, buffer.base as usize),
+            None => (self.source, 0),
+        };
+        let local = offset.checked_sub(base)?;
+        let start = source.get(..local)?.rfind('\n').map_or(0, |index| index + 1);
+        let end = source[local..].find('\n').map_or(source.len(), |index| local + index);
+        Some(source[start..end].trim_end_matches('\r'))
+    }
+
+    /// Gets a macro expansion by its ID.
+    pub fn expansion(&self, id: ExpansionId) -> Option<&Expansion> {
+        self.table.expansions.get(id.idx())
+    }
+
+    /// Gets the innermost expansion that the token at `index` comes from, if
+    /// it is expanded from a macro. See [`ContextMapping`] for how tokens are
+    /// numbered.
+    pub fn expansion_at(&self, index: usize) -> Option<ExpansionId> {
+        let runs = &self.table.runs;
+        let run = runs
+            .partition_point(|&(start, _)| start as usize <= index)
+            .checked_sub(1)?;
+        let expansion = runs[run].1;
+        (expansion != NO_EXPANSION).then_some(ExpansionId(expansion))
+    }
+
+    /// The expansions that the token at `index` comes from, innermost first:
+    /// that of the macro that produced it, then that of the macro that
+    /// produced the name of the first, and so on to a macro named in the
+    /// source as written.
+    pub fn macro_stack(&self, index: usize) -> impl Iterator<Item = (ExpansionId, &Expansion)> + '_ {
+        let mut next = self.expansion_at(index);
+        std::iter::from_fn(move || {
+            let id = next?;
+            let expansion = self.expansion(id)?;
+            next = expansion.parent;
+            Some((id, expansion))
+        })
+    }
+
+    /// Set the macro expansions and the runs of tokens coming from them.
+    pub(crate) fn set_expansions(&mut self, expansions: Vec<Expansion>, runs: Vec<(u32, u32)>) {
+        self.table.expansions = expansions;
+        self.table.runs = runs;
+    }
+
+    /// The offset each context is put in effect from, in order, e.g. to
+    /// build the same mapping again elsewhere with
+    /// [`start_context`](Self::start_context).
+    pub fn context_starts(&self) -> impl Iterator<Item = (usize, &SourceContext)> {
+        self.starts_since(0)
+    }
+
+    /// Number of context starts, to pass to [`ContextMapping::truncate_starts`].
+    pub(crate) fn starts_len(&self) -> usize {
+        self.table.starts.len()
+    }
+
+    /// The context starts after the first `len`, with their offsets.
+    pub(crate) fn starts_since(&self, len: usize) -> impl Iterator<Item = (usize, &SourceContext)> {
+        self.table.starts[len..]
+            .iter()
+            .filter_map(|&(start, id)| Some((start as usize, self.context(id)?)))
+    }
+
+    /// Forget the context starts after the first `len`.
+    pub(crate) fn truncate_starts(&mut self, len: usize) {
+        self.table.starts.truncate(len);
+    }
+
+    /// Remove the context starts after `offset`, returning them.
+    pub(crate) fn split_off_starts(&mut self, offset: usize) -> Vec<(u32, ContextId)> {
+        let index = self
+            .table
+            .starts
+            .partition_point(|&(start, _)| start as usize <= offset);
+        self.table.starts.split_off(index)
     }
 }
 
@@ -77,104 +430,102 @@ impl<'a> ContextMapping<'a> {
 impl<'a> ariadne::Cache<ContextId> for ContextMapping<'a> {
     type Storage = &'a str;
 
-    fn fetch(&mut self, id: &ContextId) -> Result<&Source<&'a str>, impl std::fmt::Debug> {
-        let source = self.ctx_source.entry(*id).or_insert_with(|| Source::from(self.source));
+    fn fetch(&mut self, _id: &ContextId) -> Result<&Source<&'a str>, impl std::fmt::Debug> {
+        let source = self.ctx_source.get_or_insert_with(|| Source::from(self.source));
         Ok::<_, ()>(source)
     }
 
     fn display<'b>(&self, id: &'b ContextId) -> Option<impl std::fmt::Display + 'b> {
-        id.idx()
-            .and_then(|idx| self.contexts.get(idx))
-            .map(|ctx| ctx.filename.to_string())
+        self.context(*id).map(|ctx| ctx.filename.to_string())
     }
 }
 
+/// A line and column in a source file, both starting at 1.
+#[derive(Clone, Copy, Debug, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub struct LineCol {
+    /// The line number.
+    pub line: usize,
+    /// The column, in characters.
+    pub column: usize,
+}
+
 /// A source span.
-#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+///
+/// Offsets are stored as `u32`, so sources are limited to 4 GiB. The source
+/// context of a span is looked up by its start in the [`ContextMapping`].
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq, Hash)]
 #[cfg_attr(feature = "dbg-pls", derive(DebugPls))]
+#[cfg_attr(feature = "serde", derive(Deserialize))]
 pub struct Span {
-    start: usize,
+    start: u32,
     len: u32,
-    ctx_id: ContextId,
 }
 
-impl Default for Span {
-    fn default() -> Self {
-        Self {
-            start: 0,
-            len: 0,
-            ctx_id: ContextId::none(),
-        }
+impl Span {
+    /// Create a new span from a range.
+    pub fn new(range: Range<usize>) -> Self {
+        let start: u32 = range.start.try_into().expect("Span start overflow");
+        let end: u32 = range.end.try_into().expect("Span end overflow");
+        Self { start, len: end.saturating_sub(start) }
     }
-}
 
-impl Span {
-    /// Create a new span from a range and context ID.
-    pub fn new(range: std::ops::Range<usize>, ctx_id: ContextId) -> Self {
-        Self {
-            start: range.start,
-            len: range.len().try_into().expect("Span length overflow"),
-            ctx_id,
-        }
+    /// Create a new end-of-input span at the given position.
+    pub fn new_eoi(pos: usize) -> Self {
+        Self::new(pos..pos)
     }
 
-    /// Create a new end-of-input span at the given position and context ID.
-    pub fn new_eoi(pos: usize, ctx_id: ContextId) -> Self {
-        Self { start: pos, len: 0, ctx_id }
+    /// Get the byte range of this span.
+    pub fn range(self) -> Range<usize> {
+        self.start as usize..(self.start + self.len) as usize
+    }
+
+    /// Move this span by `delta` bytes.
+    pub(crate) fn shift(&mut self, delta: isize) {
+        self.start = (self.start as usize)
+            .checked_add_signed(delta)
+            .and_then(|start| start.try_into().ok())
+            .expect("Span moved out of range");
+    }
+
+    /// Get the ID of the source context of this span.
+    pub fn context_id(self, ctx_map: &ContextMapping) -> ContextId {
+        ctx_map.context_at(self.start as usize)
+    }
+
+    /// Get the line and column of the start of this span in its original
+    /// source file, see [`ContextMapping::line_col`].
+    pub fn line_col(self, ctx_map: &ContextMapping) -> LineCol {
+        ctx_map.line_col(self.start as usize)
     }
 
     /// Get the context and range of this span.
     pub fn at_context<'a>(self, ctx_map: &'a ContextMapping) -> (Option<&'a SourceContext>, Range<usize>) {
-        let context = self.ctx_id.idx().and_then(|id: usize| ctx_map.contexts.get(id));
-        let range = self.start..(self.start + self.len as usize);
-        (context, range)
+        (ctx_map.context(self.context_id(ctx_map)), self.range())
     }
 }
 
 impl chumsky::span::Span for Span {
-    type Context = ContextId;
+    type Context = ();
 
     type Offset = usize;
 
-    fn new(context: Self::Context, range: std::ops::Range<Self::Offset>) -> Self {
-        Self {
-            start: range.start,
-            len: range.len().try_into().expect("Span length overflow"),
-            ctx_id: context,
-        }
+    fn new((): Self::Context, range: Range<Self::Offset>) -> Self {
+        Span::new(range)
     }
 
-    fn context(&self) -> Self::Context {
-        self.ctx_id
-    }
+    fn context(&self) -> Self::Context {}
 
     fn start(&self) -> Self::Offset {
-        self.start
+        self.start as usize
     }
 
     fn end(&self) -> Self::Offset {
-        self.start + self.len as usize
-    }
-}
-
-#[cfg(feature = "report")]
-impl ariadne::Span for Span {
-    type SourceId = ContextId;
-
-    fn source(&self) -> &Self::SourceId {
-        &self.ctx_id
-    }
-
-    fn start(&self) -> usize {
-        self.start
-    }
-
-    fn end(&self) -> usize {
-        self.start + self.len as usize
+        (self.start + self.len) as usize
     }
 }
 
 #[derive(Debug, Clone, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Deserialize))]
 /// A value with an associated source span.
 pub struct Spanned<T> {
     /// The wrapped value.
@@ -238,6 +589,11 @@ where
 }
 
 /// Token stream input type for the parser.
+///
+/// The input borrows the tokens, so parsers and errors refer to them instead
+/// of copying them. The mapping is named as a function pointer because the
+/// type of a function item or closure cannot be named in a type alias; it
+/// only splits a [`Spanned`] into references to its fields.
 pub type Tokens<'a> = MappedInput<
     'a,
     BalancedToken,
@@ -251,4 +607,15 @@ impl BalancedTokenSequence {
     pub fn as_input(&self) -> Tokens<'_> {
         self.tokens.as_slice().map(self.eoi, Spanned::as_pair)
     }
+
+    /// Convert a range of the top-level tokens to a parser input.
+    ///
+    /// The input ends where the token following the range begins.
+    pub fn slice_as_input(&self, range: Range<usize>) -> Tokens<'_> {
+        let eoi = self
+            .tokens
+            .get(range.end)
+            .map_or(self.eoi, |next| Span::new_eoi(next.span.range().start));
+        self.tokens[range].map(eoi, Spanned::as_pair)
+    }
 }
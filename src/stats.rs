@@ -0,0 +1,313 @@
+//! A summary of one parse, for telemetry, and the capture of inputs that
+//! parse slowly.
+
+use std::{
+    fmt, fs, io,
+    path::PathBuf,
+    sync::{
+        Arc,
+        atomic::{AtomicU64, Ordering},
+    },
+    time::{Duration, Instant, SystemTime},
+};
+
+use chumsky::Parser;
+
+use crate::{
+    BalancedToken, BalancedTokenSequence, HeapSize, State, index::AstIndex, lex, parallel::ParsedUnit,
+    parser::translation_unit,
+};
+
+/// What one parse read, built and did, and the time of each phase, as
+/// returned by [`parse_with_stats`].
+///
+/// The counts are cheap to collect, so they can be logged for every input to
+/// spot the expensive ones, without the per-rule detail of the `profile`
+/// feature or a `tracing` subscriber.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct ParseStats {
+    /// Bytes of source.
+    pub bytes: usize,
+    /// Tokens lexed, counting each group and the tokens in it.
+    pub tokens: usize,
+    /// Tokens read by the parser, including tokens read again after
+    /// backtracking.
+    pub token_work: u64,
+    /// External declarations parsed.
+    pub external_declarations: usize,
+    /// Nodes of the tree, as indexed by an [`AstIndex`].
+    pub nodes: usize,
+    /// Deepest nesting of the parse.
+    pub max_depth: usize,
+    /// Errors reported.
+    pub errors: usize,
+    /// Error recoveries, including those in alternatives the parser
+    /// backtracked out of.
+    pub recoveries: u64,
+    /// Most typedef names and enumeration constants bound at once.
+    pub peak_bindings: usize,
+    /// Rewinds of the parser to a checkpoint.
+    pub rewinds: u64,
+    /// Time spent lexing.
+    pub lex_time: Duration,
+    /// Time spent parsing.
+    pub parse_time: Duration,
+    /// Time spent counting the nodes of the tree.
+    pub count_time: Duration,
+}
+
+impl ParseStats {
+    /// Tokens read by the parser per token lexed, which is about 1 for a parse
+    /// that never backtracked.
+    pub fn backtracking_ratio(&self) -> f64 {
+        if self.tokens == 0 {
+            0.0
+        } else {
+            self.token_work as f64 / self.tokens as f64
+        }
+    }
+}
+
+/// Lex and parse `source` as a translation unit from a clone of `init_state`,
+/// as [`ParseSession::parse`](crate::ParseSession::parse) does, and summarize
+/// the parse.
+///
+/// The counts of the parser come from the state, which collects them on every
+/// parse; only counting the tokens and the nodes of the tree costs extra, one
+/// walk of each.
+pub fn parse_with_stats<'a>(
+    source: &'a str,
+    filename: Option<&str>,
+    init_state: &State,
+) -> (ParsedUnit<'a>, ParseStats) {
+    let parsed = parse_summarized(source, filename, init_state);
+    (parsed.unit, parsed.stats)
+}
+
+/// A parse of [`parse_summarized`], with its tokens and final state.
+struct Summarized<'a> {
+    unit: ParsedUnit<'a>,
+    stats: ParseStats,
+    tokens: BalancedTokenSequence,
+    state: State,
+}
+
+/// [`parse_with_stats`], also returning the tokens and the final state.
+fn parse_summarized<'a>(source: &'a str, filename: Option<&str>, init_state: &State) -> Summarized<'a> {
+    let start = Instant::now();
+    let (tokens, ctx_map) = lex(source, filename);
+    let lex_time = start.elapsed();
+
+    let start = Instant::now();
+    let mut state = init_state.clone();
+    let (output, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    let errors: Vec<_> = errors.into_iter().map(|error| error.into_owned()).collect();
+    let parse_time = start.elapsed();
+
+    let start = Instant::now();
+    let nodes = output.as_ref().map_or(0, |unit| AstIndex::new(unit).len());
+    let stats = ParseStats {
+        bytes: source.len(),
+        tokens: count_tokens(&tokens),
+        token_work: state.token_work() - init_state.token_work(),
+        external_declarations: output.as_ref().map_or(0, |unit| unit.external_declarations.len()),
+        nodes,
+        max_depth: state.peak_nesting_depth(),
+        errors: errors.len(),
+        recoveries: state.recoveries() - init_state.recoveries(),
+        peak_bindings: state.peak_bindings(),
+        rewinds: state.rewinds() - init_state.rewinds(),
+        lex_time,
+        parse_time,
+        count_time: start.elapsed(),
+    };
+    let declarations = state.take_declaration_index();
+    let unit = ParsedUnit { output, errors, ctx_map, declarations };
+    Summarized { unit, stats, tokens, state }
+}
+
+/// An input that parsed slowly, or into a large tree, as given to the
+/// callback of a [`SlowInputCapture`].
+#[derive(Debug, Clone)]
+pub struct CapturedParse<'a> {
+    /// The source parsed.
+    pub source: &'a str,
+    /// The filename it was lexed with.
+    pub filename: Option<&'a str>,
+    /// The summary of the parse.
+    pub stats: ParseStats,
+    /// Bytes of the tokens and tree on the heap, if the capture has a bound
+    /// on them.
+    pub heap_size: Option<usize>,
+    /// The rule profile of the parse, rendered as a table, if the initial
+    /// state had profiling enabled with the `profile` feature.
+    pub profile: Option<String>,
+}
+
+impl fmt::Display for CapturedParse<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "filename: {}", self.filename.unwrap_or("<none>"))?;
+        if let Some(heap_size) = self.heap_size {
+            writeln!(f, "heap size: {heap_size}")?;
+        }
+        writeln!(f, "{:#?}", self.stats)?;
+        if let Some(profile) = &self.profile {
+            writeln!(f, "\n{profile}")?;
+        }
+        Ok(())
+    }
+}
+
+/// Where a [`SlowInputCapture`] hands its inputs.
+#[derive(Clone)]
+enum CaptureSink {
+    Callback(Arc<dyn Fn(&CapturedParse<'_>) + Send + Sync>),
+    Spool(PathBuf),
+}
+
+/// Captures the inputs whose parse exceeds a time or a memory bound, for
+/// triage of latency outliers in production.
+///
+/// Each input over a bound is handed to a callback, or written to a spool
+/// directory as a `.c` file with the source and a `.txt` file with the
+/// [`ParseStats`] and rule profile of the parse. A spooled source can then be
+/// minimized with the `shrink_test_case` example, which takes the spool
+/// directory itself:
+///
+/// ```ignore
+/// let mut capture = SlowInputCapture::spool("/var/spool/cgrammar");
+/// capture.set_max_time(Some(Duration::from_millis(50)));
+/// let (unit, stats) = capture.parse(source, Some("input.c"), &state);
+/// ```
+///
+/// With no bound set, nothing is captured.
+#[derive(Clone)]
+pub struct SlowInputCapture {
+    sink: CaptureSink,
+    max_time: Option<Duration>,
+    max_heap_size: Option<usize>,
+}
+
+impl fmt::Debug for SlowInputCapture {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let mut debug = f.debug_struct("SlowInputCapture");
+        match &self.sink {
+            CaptureSink::Callback(_) => debug.field("sink", &"<callback>"),
+            CaptureSink::Spool(dir) => debug.field("sink", dir),
+        };
+        debug.field("max_time", &self.max_time);
+        debug.field("max_heap_size", &self.max_heap_size);
+        debug.finish()
+    }
+}
+
+impl SlowInputCapture {
+    /// Hand the captured inputs to `callback`.
+    pub fn callback(callback: impl Fn(&CapturedParse<'_>) + Send + Sync + 'static) -> Self {
+        Self::new(CaptureSink::Callback(Arc::new(callback)))
+    }
+
+    /// Write the captured inputs to `dir`, which is created if needed.
+    pub fn spool(dir: impl Into<PathBuf>) -> Self {
+        Self::new(CaptureSink::Spool(dir.into()))
+    }
+
+    fn new(sink: CaptureSink) -> Self {
+        Self {
+            sink,
+            max_time: None,
+            max_heap_size: None,
+        }
+    }
+
+    /// The time of lexing and parsing over which an input is captured.
+    pub fn max_time(&self) -> Option<Duration> {
+        self.max_time
+    }
+
+    /// Set the time of lexing and parsing over which an input is captured.
+    pub fn set_max_time(&mut self, max_time: Option<Duration>) {
+        self.max_time = max_time;
+    }
+
+    /// The bytes of tokens and tree over which an input is captured.
+    pub fn max_heap_size(&self) -> Option<usize> {
+        self.max_heap_size
+    }
+
+    /// Set the bytes of tokens and tree on the heap over which an input is
+    /// captured. Measuring them walks the tokens and the tree once more.
+    pub fn set_max_heap_size(&mut self, max_heap_size: Option<usize>) {
+        self.max_heap_size = max_heap_size;
+    }
+
+    /// Lex and parse `source`, as [`parse_with_stats`] does, capturing it if
+    /// the parse is over a bound.
+    ///
+    /// Capturing is best-effort: an error writing to the spool directory is
+    /// ignored, so that triage never fails a parse.
+    pub fn parse<'a>(
+        &self,
+        source: &'a str,
+        filename: Option<&str>,
+        init_state: &State,
+    ) -> (ParsedUnit<'a>, ParseStats) {
+        let Summarized { unit, stats, tokens, state } = parse_summarized(source, filename, init_state);
+        let heap_size = (self.max_heap_size.is_some())
+            .then(|| tokens.heap_size() + unit.output.as_ref().map_or(0, HeapSize::heap_size));
+        let slow = self.max_time.is_some_and(|max| stats.lex_time + stats.parse_time > max);
+        let large = self.max_heap_size.zip(heap_size).is_some_and(|(max, size)| size > max);
+        if slow || large {
+            #[cfg(feature = "profile")]
+            let profile = state.profile().map(|profile| profile.to_string());
+            #[cfg(not(feature = "profile"))]
+            let profile = {
+                let _ = state;
+                None
+            };
+            let captured = CapturedParse {
+                source,
+                filename,
+                stats,
+                heap_size,
+                profile,
+            };
+            let _ = self.capture(&captured);
+        }
+        (unit, stats)
+    }
+
+    /// Hand `captured` to the callback, or write it to the spool directory.
+    pub fn capture(&self, captured: &CapturedParse<'_>) -> io::Result<()> {
+        let dir = match &self.sink {
+            CaptureSink::Callback(callback) => {
+                callback(captured);
+                return Ok(());
+            }
+            CaptureSink::Spool(dir) => dir,
+        };
+        fs::create_dir_all(dir)?;
+        // Names sort by time, and processes sharing the directory never clash
+        static NEXT: AtomicU64 = AtomicU64::new(0);
+        let time = SystemTime::now()
+            .duration_since(SystemTime::UNIX_EPOCH)
+            .unwrap_or_default();
+        let id = NEXT.fetch_add(1, Ordering::Relaxed);
+        let name = format!("{}-{}-{id}", time.as_millis(), std::process::id());
+        fs::write(dir.join(format!("{name}.txt")), captured.to_string())?;
+        fs::write(dir.join(format!("{name}.c")), captured.source)
+    }
+}
+
+/// The number of tokens of `tokens`, at any depth.
+fn count_tokens(tokens: &BalancedTokenSequence) -> usize {
+    let nested = tokens.tokens.iter().map(|token| match &token.value {
+        BalancedToken::Parenthesized(group) | BalancedToken::Bracketed(group) | BalancedToken::Braced(group) => {
+            count_tokens(group)
+        }
+        _ => 0,
+    });
+    tokens.tokens.len() + nested.sum::<usize>()
+}
@@ -0,0 +1,204 @@
+//! Parsing a translation unit one external declaration at a time.
+
+use std::time::{Duration, Instant};
+
+use chumsky::prelude::*;
+
+use crate::{
+    BalancedToken, BalancedTokenSequence, ExternalDeclaration, State,
+    parallel::{declaration_end, may_declare_names},
+    parser::{external_declaration, no_recover, translation_unit},
+    parser_utils::Error,
+    span::Spanned,
+    symbol::Symbol,
+};
+
+/// Parse the external declarations of `tokens` one at a time, starting from
+/// `state`.
+///
+/// Unlike [`translation_unit`], which returns all declarations at once, the
+/// iterator parses a declaration only when it is asked for the next one, so
+/// each declaration can be processed and dropped before the rest of the input
+/// is parsed. The declarations are the same as those of [`translation_unit`],
+/// and `state` is left as it would be after them.
+///
+/// The top-level tokens are split at `;` and at function bodies, as by
+/// [`parse_parallel`](crate::parse_parallel), and pieces that do not parse on
+/// their own are joined with the following ones. If the rest of the input
+/// does not parse as whole declarations, e.g. because of a syntax error, it is
+/// parsed at once with error recovery: its errors are yielded as one `Err`,
+/// followed by the declarations recovered from it.
+pub fn parse_iter<'a, 's>(tokens: &'a BalancedTokenSequence, state: &'s mut State) -> ParseIter<'a, 's> {
+    ParseIter {
+        tokens,
+        state,
+        pos: 0,
+        rest: Vec::new().into_iter(),
+        filter: None,
+    }
+}
+
+/// Parse only the external declarations of `tokens` that mention one of
+/// `names`, starting from `state`, e.g. to find the declaration of one name
+/// in a large translation unit.
+///
+/// Like [`parse_iter`], the top-level tokens are split at `;` and at function
+/// bodies. A declaration is parsed and yielded if one of the names is among
+/// its tokens outside braces, where the names it declares are, as in
+/// `int (*foo)(void);`, so mentions in function bodies, struct members and
+/// initializer lists do not count. Declarations that mention `typedef` or
+/// `enum` are parsed but not yielded, so that `state` binds the typedef names
+/// and enumeration constants the others are parsed with. The rest are skipped
+/// without being parsed, and leave no trace in `state`, e.g. in its
+/// declaration index.
+///
+/// Piece boundaries that fail to parse are handled as by [`parse_iter`], and
+/// after a syntax error, the rest of the input is parsed at once and yielded
+/// whole.
+pub fn parse_matching<'a, 's>(
+    tokens: &'a BalancedTokenSequence,
+    state: &'s mut State,
+    names: impl IntoIterator<Item = Symbol>,
+) -> ParseIter<'a, 's> {
+    let filter = Filter {
+        names: names.into_iter().collect(),
+        keywords: [Symbol::intern("typedef"), Symbol::intern("enum")],
+    };
+    ParseIter {
+        filter: Some(filter),
+        ..parse_iter(tokens, state)
+    }
+}
+
+/// Iterator over the external declarations of a translation unit, see
+/// [`parse_iter`].
+pub struct ParseIter<'a, 's> {
+    tokens: &'a BalancedTokenSequence,
+    state: &'s mut State,
+    /// Index of the first top-level token not parsed yet.
+    pos: usize,
+    /// Results of the rest of the input, once it has been parsed at once.
+    rest: std::vec::IntoIter<Result<ExternalDeclaration, Vec<Error<'a>>>>,
+    /// The names of [`parse_matching`], if any.
+    filter: Option<Filter>,
+}
+
+struct Filter {
+    names: Vec<Symbol>,
+    /// `typedef` and `enum`, which the declarations binding names mention.
+    keywords: [Symbol; 2],
+}
+
+/// Check whether tokens mention any of `names` outside braces.
+fn mentions_names(tokens: &[Spanned<BalancedToken>], names: &[Symbol]) -> bool {
+    tokens.iter().any(|token| match &token.value {
+        BalancedToken::Identifier(id) => names.contains(&id.0),
+        BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) => mentions_names(&inner.tokens, names),
+        #[cfg(feature = "quasi-quote")]
+        BalancedToken::Template(_) | BalancedToken::Interpolation(_) => true,
+        _ => false,
+    })
+}
+
+impl<'a> ParseIter<'a, '_> {
+    /// Parse the next external declarations for about `slice`, at least one
+    /// if any are left, e.g. to parse a large input on a single-threaded
+    /// event loop, yielding to other tasks between slices.
+    ///
+    /// A slice ends after the declaration during which it ran out, so a
+    /// single large declaration takes as long as it takes; set a deadline or
+    /// a cancellation token on the state to stop the whole parse instead.
+    /// Returns no results once the input is parsed.
+    pub fn next_slice(&mut self, slice: Duration) -> Vec<<Self as Iterator>::Item> {
+        let start = Instant::now();
+        let mut results = Vec::new();
+        while let Some(result) = self.next() {
+            results.push(result);
+            if start.elapsed() >= slice {
+                break;
+            }
+        }
+        results
+    }
+
+    /// Parse the external declaration at the current position, as [`parse_iter`] does.
+    fn parse_next(&mut self) -> Option<<Self as Iterator>::Item> {
+        if let Some(item) = self.rest.next() {
+            return Some(item);
+        }
+        let tokens = &self.tokens.tokens;
+        if self.pos >= tokens.len() {
+            return None;
+        }
+
+        // Without recovery, a piece that is not a whole declaration fails fast.
+        // Once the budget is exceeded, e.g. by a cancellation, the rest is
+        // skipped with the error of `translation_unit`
+        let parser = no_recover(external_declaration()).then_ignore(end());
+        let mut end = declaration_end(tokens, self.pos);
+        let mark = self.state.mark();
+        while !self.state.check_budget() {
+            let result = parser.parse_with_state(self.tokens.slice_as_input(self.pos..end), self.state);
+            if !result.has_errors()
+                && let Some(external_declaration) = result.into_output()
+            {
+                // Nothing rewinds into a completed external declaration
+                self.state.commit();
+                self.pos = end;
+                return Some(Ok(external_declaration));
+            }
+            self.state.rewind_to(&mark);
+            if end == tokens.len() {
+                break;
+            }
+            end = declaration_end(tokens, end);
+        }
+
+        let input = self.tokens.slice_as_input(self.pos..tokens.len());
+        let (output, errors) = translation_unit()
+            .parse_with_state(input, self.state)
+            .into_output_errors();
+        self.pos = tokens.len();
+        let errors = (!errors.is_empty()).then_some(Err(errors));
+        let external_declarations = output.into_iter().flat_map(|unit| unit.external_declarations);
+        self.rest = errors
+            .into_iter()
+            .chain(external_declarations.map(Ok))
+            .collect::<Vec<_>>()
+            .into_iter();
+        self.rest.next()
+    }
+}
+
+impl<'a> Iterator for ParseIter<'a, '_> {
+    type Item = Result<ExternalDeclaration, Vec<Error<'a>>>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.filter.is_none() || !self.rest.as_slice().is_empty() {
+            return self.parse_next();
+        }
+        let sequence = self.tokens;
+        let tokens = &sequence.tokens;
+        while self.pos < tokens.len() {
+            let filter = self.filter.as_ref().expect("Filtering");
+            let start = self.pos;
+            let end = declaration_end(tokens, start);
+            let piece = &tokens[start..end];
+            if mentions_names(piece, &filter.names) {
+                break;
+            }
+            if !may_declare_names(piece, &filter.keywords) {
+                self.pos = end;
+                continue;
+            }
+            // Parsed for the names it binds, and yielded only if it was joined
+            // with the following pieces up to a match
+            let result = self.parse_next()?;
+            let filter = self.filter.as_ref().expect("Filtering");
+            if result.is_err() || mentions_names(&tokens[start..self.pos], &filter.names) {
+                return Some(result);
+            }
+        }
+        self.parse_next()
+    }
+}
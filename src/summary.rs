@@ -0,0 +1,191 @@
+//! Summaries of the external interface of translation units.
+//!
+//! A [`UnitSummary`] is the "header view" of a translation unit: its
+//! file-scope typedefs, struct, union and enum definitions, and the
+//! declarations of its functions and objects, with function definitions
+//! reduced to their prototypes and initializers left out. Project-wide checks
+//! that only look at the interfaces of many units can load their summaries
+//! instead of their syntax trees, and summaries of several units are
+//! [merged](UnitSummary::merge) into one, with declarations repeated in
+//! shared headers kept once.
+//!
+//! [`UnitSummary::parse`] parses with lazy function bodies, so the bodies are
+//! skipped over and never parsed. With the `serde` feature, summaries are
+//! written and read like other trees, by [`encode_tree`] and [`decode_tree`]:
+//!
+//! ```ignore
+//! let summary = UnitSummary::parse(&tokens, &State::new()).unwrap();
+//! let bytes = serialize::encode_tree(&summary)?;
+//! let mut project: UnitSummary = serialize::decode_tree(&bytes)?;
+//! project.merge(&other);
+//! ```
+//!
+//! Declarations with internal linkage are part of no interface, and are left
+//! out.
+//!
+//! [`encode_tree`]: crate::serialize::encode_tree
+//! [`decode_tree`]: crate::serialize::decode_tree
+
+use std::hash::{Hash, Hasher};
+
+use chumsky::Parser;
+use rustc_hash::{FxHashSet, FxHasher};
+#[cfg(feature = "serde")]
+use serde::{Deserialize, Serialize};
+
+use crate::{ast::*, context::State, database::has_storage_class, parser::translation_unit, symbol::Symbol};
+
+/// The external interface of one or more translation units.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+#[cfg_attr(feature = "serde", derive(Serialize, Deserialize))]
+pub struct UnitSummary {
+    /// File-scope declarations, in order, without initializers.
+    declarations: Vec<Declaration>,
+    /// Names of the functions and objects defined, in order.
+    definitions: Vec<Symbol>,
+}
+
+impl UnitSummary {
+    /// Summarize `unit`. Function bodies are not looked at, so lazy bodies are
+    /// left unparsed.
+    pub fn new(unit: &TranslationUnit) -> Self {
+        let mut summary = Self::default();
+        for external_declaration in &unit.external_declarations {
+            match external_declaration {
+                ExternalDeclaration::Function(f) => {
+                    if has_storage_class(&f.specifiers, StorageClassSpecifier::Static) {
+                        continue;
+                    }
+                    if let Some(name) = f.declarator.identifier() {
+                        summary.definitions.push(name.0);
+                    }
+                    let kind = DeclarationKind::Normal {
+                        attributes: f.attributes.clone(),
+                        specifiers: f.specifiers.clone(),
+                        declarators: vec![InitDeclarator {
+                            declarator: f.declarator.clone(),
+                            initializer: None,
+                        }],
+                    };
+                    summary.declarations.push(Declaration::new(kind, f.span));
+                }
+                ExternalDeclaration::Declaration(d) => summary.declaration(d),
+            }
+        }
+        summary
+    }
+
+    /// Parse `tokens` with lazy function bodies, starting from `state`, and
+    /// summarize the translation unit. Errors in the bodies are not found.
+    pub fn parse(tokens: &BalancedTokenSequence, state: &State) -> Option<Self> {
+        let mut state = state.clone();
+        state.set_lazy_function_bodies(true);
+        let unit = translation_unit()
+            .parse_with_state(tokens.as_input(), &mut state)
+            .into_output()?;
+        Some(Self::new(&unit))
+    }
+
+    fn declaration(&mut self, d: &Declaration) {
+        match &d.kind {
+            DeclarationKind::Normal { attributes, specifiers, declarators } => {
+                if has_storage_class(specifiers, StorageClassSpecifier::Static) {
+                    return;
+                }
+                let extern_ = has_storage_class(specifiers, StorageClassSpecifier::Extern);
+                let declarators = (declarators.iter())
+                    .map(|InitDeclarator { declarator, initializer }| {
+                        if !declarator.is_function()
+                            && (!extern_ || initializer.is_some())
+                            && let Some(name) = declarator.identifier()
+                        {
+                            self.definitions.push(name.0);
+                        }
+                        InitDeclarator {
+                            declarator: declarator.clone(),
+                            initializer: None,
+                        }
+                    })
+                    .collect();
+                let kind = DeclarationKind::Normal {
+                    attributes: attributes.clone(),
+                    specifiers: specifiers.clone(),
+                    declarators,
+                };
+                self.declarations.push(Declaration::new(kind, d.span));
+            }
+            DeclarationKind::Typedef { .. } => self.declarations.push(d.clone()),
+            DeclarationKind::StaticAssert(_) | DeclarationKind::Attribute(_) | DeclarationKind::Error => {}
+        }
+    }
+
+    /// The declarations of the summary, in order.
+    pub fn declarations(&self) -> &[Declaration] {
+        &self.declarations
+    }
+
+    /// The declarations of `name` as a function, object or typedef name.
+    pub fn get(&self, name: Symbol) -> impl Iterator<Item = &Declaration> + '_ {
+        self.declarations.iter().filter(move |d| match &d.kind {
+            DeclarationKind::Normal { declarators, .. } => (declarators.iter()).any(|init| {
+                init.declarator
+                    .identifier()
+                    .is_some_and(|identifier| identifier.0 == name)
+            }),
+            DeclarationKind::Typedef { declarators, .. } => (declarators.iter())
+                .any(|declarator| declarator.identifier().is_some_and(|identifier| identifier.0 == name)),
+            _ => false,
+        })
+    }
+
+    /// The first declaration that defines the struct, union or enum tagged
+    /// `tag`, with its members or enumerators.
+    pub fn tag(&self, tag: Symbol) -> Option<&Declaration> {
+        self.declarations.iter().find(|d| {
+            let specifiers = match &d.kind {
+                DeclarationKind::Normal { specifiers, .. } | DeclarationKind::Typedef { specifiers, .. } => specifiers,
+                _ => return false,
+            };
+            specifiers.specifiers.iter().any(|specifier| match specifier {
+                DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::TypeSpecifier(
+                    TypeSpecifier::Struct(s),
+                )) => s.members.is_some() && s.identifier.is_some_and(|identifier| identifier.0 == tag),
+                DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::TypeSpecifier(
+                    TypeSpecifier::Enum(e),
+                )) => e.enumerators.is_some() && e.identifier.is_some_and(|identifier| identifier.0 == tag),
+                _ => false,
+            })
+        })
+    }
+
+    /// Whether a function or object named `name` is defined.
+    pub fn is_defined(&self, name: Symbol) -> bool {
+        self.definitions.contains(&name)
+    }
+
+    /// The names of the functions and objects defined, in order.
+    pub fn definitions(&self) -> &[Symbol] {
+        &self.definitions
+    }
+
+    /// Merge the summary of another unit into this one. Declarations that are
+    /// the same but for their spans, e.g. from a header included by both
+    /// units, are kept once.
+    pub fn merge(&mut self, other: &UnitSummary) {
+        let mut seen: FxHashSet<u64> = self.declarations.iter().map(structural_hash).collect();
+        for d in &other.declarations {
+            if seen.insert(structural_hash(d)) {
+                self.declarations.push(d.clone());
+            }
+        }
+        let defined: FxHashSet<Symbol> = self.definitions.iter().copied().collect();
+        (self.definitions).extend(other.definitions.iter().filter(|name| !defined.contains(name)));
+    }
+}
+
+/// The hash of `d`, which does not depend on spans.
+fn structural_hash(d: &Declaration) -> u64 {
+    let mut hasher = FxHasher::default();
+    d.hash(&mut hasher);
+    hasher.finish()
+}
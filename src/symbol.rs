@@ -0,0 +1,309 @@
+//! Interned strings for identifiers.
+//!
+//! Every distinct identifier is stored once in a process-wide table and
+//! referred to by a [`Symbol`], which is `Copy` and compares and hashes as an
+//! integer. Interned strings are never freed.
+//!
+//! The table is shared by every thread, so symbols from translation units
+//! parsed in parallel compare equal when their names do. Each thread keeps the
+//! names it has interned in a cache of its own, so a name seen before is found
+//! without touching shared memory. Other names are looked up in one of several
+//! shards, chosen by the hash of the name, and inserted under the lock of
+//! that shard only. The string of a symbol is read without a lock.
+
+use std::{
+    cell::RefCell,
+    fmt,
+    hash::BuildHasher,
+    ops::Deref,
+    ptr,
+    sync::{
+        OnceLock, RwLock,
+        atomic::{AtomicPtr, AtomicU32, Ordering},
+    },
+};
+
+#[cfg(feature = "dbg-pls")]
+use dbg_pls::DebugPls;
+use once_cell::sync::Lazy;
+use rustc_hash::{FxBuildHasher, FxHashMap};
+
+/// A handle to an interned string.
+///
+/// The default symbol is the empty string.
+#[derive(Clone, Copy, Default, PartialEq, Eq, Hash)]
+pub struct Symbol(u32);
+
+impl Symbol {
+    /// Intern a string, returning its symbol.
+    pub fn intern(string: &str) -> Self {
+        if let Ok(Some(symbol)) = CACHE.try_with(|cache| cache.borrow().get(string).copied()) {
+            return symbol;
+        }
+        let symbol = INTERNER.intern(string);
+        let _ = CACHE.try_with(|cache| {
+            let mut cache = cache.borrow_mut();
+            if cache.len() >= CACHE_CAPACITY {
+                cache.clear();
+            }
+            cache.insert(symbol.as_str(), symbol);
+        });
+        symbol
+    }
+
+    /// Get the interned string.
+    pub fn as_str(self) -> &'static str {
+        INTERNER.strings.get(self.0)
+    }
+
+    /// Get the index of this symbol in the interner table.
+    pub fn as_u32(self) -> u32 {
+        self.0
+    }
+
+    /// Check whether this symbol is a keyword that can never be an identifier.
+    pub fn is_reserved(self) -> bool {
+        (1..=RESERVED.len() as u32).contains(&self.0)
+    }
+}
+
+/// Keywords that are never identifiers, interned right after the empty string
+/// so that [`Symbol::is_reserved`] is a range check.
+const RESERVED: &[&str] = &[
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern", "float",
+    "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short", "signed", "sizeof",
+    "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "_Alignas",
+];
+
+impl Deref for Symbol {
+    type Target = str;
+
+    fn deref(&self) -> &str {
+        self.as_str()
+    }
+}
+
+impl AsRef<str> for Symbol {
+    fn as_ref(&self) -> &str {
+        self.as_str()
+    }
+}
+
+impl fmt::Debug for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        fmt::Debug::fmt(self.as_str(), f)
+    }
+}
+
+impl fmt::Display for Symbol {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.write_str(self.as_str())
+    }
+}
+
+#[cfg(feature = "dbg-pls")]
+impl DebugPls for Symbol {
+    fn fmt(&self, f: dbg_pls::Formatter<'_>) {
+        DebugPls::fmt(self.as_str(), f)
+    }
+}
+
+impl From<&str> for Symbol {
+    fn from(string: &str) -> Self {
+        Symbol::intern(string)
+    }
+}
+
+impl From<String> for Symbol {
+    fn from(string: String) -> Self {
+        Symbol::intern(&string)
+    }
+}
+
+static INTERNER: Lazy<Interner> = Lazy::new(|| {
+    let interner = Interner {
+        shards: std::array::from_fn(|_| RwLock::default()),
+        strings: Strings::default(),
+        next: AtomicU32::new(0),
+    };
+    interner.intern("");
+    for keyword in RESERVED {
+        interner.intern(keyword);
+    }
+    interner
+});
+
+thread_local! {
+    /// The names interned by this thread, up to [`CACHE_CAPACITY`].
+    static CACHE: RefCell<FxHashMap<&'static str, Symbol>> = RefCell::default();
+}
+
+/// Number of names a thread caches before its cache is cleared.
+const CACHE_CAPACITY: usize = 1 << 16;
+
+/// Number of shards of the interner, a power of two.
+const SHARDS: usize = 32;
+
+/// Size of the arena chunks that interned strings are copied into.
+const CHUNK_SIZE: usize = 64 * 1024;
+
+struct Interner {
+    shards: [RwLock<Shard>; SHARDS],
+    strings: Strings,
+    /// The next symbol.
+    next: AtomicU32,
+}
+
+/// The names whose hashes fall in one shard.
+#[derive(Default)]
+struct Shard {
+    symbols: FxHashMap<&'static str, Symbol>,
+    /// Unused tail of the current arena chunk.
+    free: &'static mut [u8],
+}
+
+impl Interner {
+    fn intern(&self, string: &str) -> Symbol {
+        let hash = FxBuildHasher.hash_one(string);
+        let shard = &self.shards[(hash >> (64 - SHARDS.trailing_zeros())) as usize];
+        if let Some(&symbol) = shard.read().unwrap().symbols.get(string) {
+            return symbol;
+        }
+        let mut shard = shard.write().unwrap();
+        if let Some(&symbol) = shard.symbols.get(string) {
+            return symbol;
+        }
+        let stored = shard.alloc(string);
+        let index = self.next.fetch_add(1, Ordering::Relaxed);
+        assert!(index < u32::MAX, "too many interned strings");
+        self.strings.set(index, stored);
+        let symbol = Symbol(index);
+        shard.symbols.insert(stored, symbol);
+        symbol
+    }
+}
+
+/// Size of the first segment of [`Strings`], a power of two.
+const FIRST_SEGMENT: usize = 1024;
+
+/// Number of segments of [`Strings`], enough for every `u32` index.
+const SEGMENTS: usize = 23;
+
+/// The interned strings by symbol, in segments of doubling sizes that are
+/// allocated when first needed and never moved, so that a string is read
+/// without a lock.
+struct Strings {
+    segments: [AtomicPtr<OnceLock<&'static str>>; SEGMENTS],
+}
+
+impl Default for Strings {
+    fn default() -> Self {
+        Strings {
+            segments: [const { AtomicPtr::new(ptr::null_mut()) }; SEGMENTS],
+        }
+    }
+}
+
+/// The segment and offset of `index` in [`Strings`].
+fn locate(index: u32) -> (usize, usize) {
+    let slot = index as usize + FIRST_SEGMENT;
+    let segment = slot.ilog2() - FIRST_SEGMENT.ilog2();
+    (segment as usize, slot - (FIRST_SEGMENT << segment))
+}
+
+impl Strings {
+    fn slot(&self, index: u32) -> &OnceLock<&'static str> {
+        let (segment, offset) = locate(index);
+        let len = FIRST_SEGMENT << segment;
+        let mut start = self.segments[segment].load(Ordering::Acquire);
+        if start.is_null() {
+            let new: Box<[OnceLock<&'static str>]> = (0..len).map(|_| OnceLock::new()).collect();
+            let new = Box::into_raw(new).cast();
+            start = match (self.segments[segment]).compare_exchange(
+                ptr::null_mut(),
+                new,
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => new,
+                Err(current) => {
+                    // Another thread allocated the segment first
+                    drop(unsafe { Box::from_raw(ptr::slice_from_raw_parts_mut(new, len)) });
+                    current
+                }
+            };
+        }
+        // Segments are never freed, and their slots are only written once
+        unsafe { &*start.add(offset) }
+    }
+
+    fn set(&self, index: u32, string: &'static str) {
+        (self.slot(index).set(string)).expect("each symbol is set once");
+    }
+
+    fn get(&self, index: u32) -> &'static str {
+        self.slot(index).get().expect("a symbol is set before it is handed out")
+    }
+}
+
+impl Shard {
+    fn alloc(&mut self, string: &str) -> &'static str {
+        let len = string.len();
+        if self.free.len() < len {
+            self.free = Box::leak(vec![0; len.max(CHUNK_SIZE)].into_boxed_slice());
+        }
+        let (stored, free) = std::mem::take(&mut self.free).split_at_mut(len);
+        self.free = free;
+        stored.copy_from_slice(string.as_bytes());
+        std::str::from_utf8(stored).expect("copied from a valid string")
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::{FIRST_SEGMENT, Symbol, locate};
+
+    #[test]
+    fn test_intern() {
+        let foo = Symbol::intern("foo");
+        assert_eq!(foo, Symbol::intern("foo"));
+        assert_ne!(foo, Symbol::intern("bar"));
+        assert_eq!(foo.as_str(), "foo");
+        assert_eq!(Symbol::default().as_str(), "");
+        assert_eq!(format!("{foo} {foo:?}"), r#"foo "foo""#);
+    }
+
+    #[test]
+    fn test_intern_on_threads() {
+        let names: Vec<String> = (0..5000).map(|i| format!("shared_name_{i}")).collect();
+        let symbols: Vec<Vec<Symbol>> = std::thread::scope(|scope| {
+            let threads: Vec<_> = (0..8)
+                .map(|_| scope.spawn(|| names.iter().map(|name| Symbol::intern(name)).collect()))
+                .collect();
+            threads.into_iter().map(|thread| thread.join().unwrap()).collect()
+        });
+        for other in &symbols[1..] {
+            assert_eq!(other, &symbols[0]);
+        }
+        for (name, symbol) in names.iter().zip(&symbols[0]) {
+            assert_eq!(symbol.as_str(), name);
+        }
+    }
+
+    #[test]
+    fn test_locate() {
+        assert_eq!(locate(0), (0, 0));
+        assert_eq!(locate(FIRST_SEGMENT as u32 - 1), (0, FIRST_SEGMENT - 1));
+        assert_eq!(locate(FIRST_SEGMENT as u32), (1, 0));
+        assert_eq!(locate(3 * FIRST_SEGMENT as u32), (2, 0));
+        assert_eq!(locate(u32::MAX).0, super::SEGMENTS - 1);
+    }
+
+    #[test]
+    fn test_reserved() {
+        assert!(Symbol::intern("auto").is_reserved());
+        assert!(Symbol::intern("_Alignas").is_reserved());
+        assert!(!Symbol::intern("bool").is_reserved());
+        assert!(!Symbol::default().is_reserved());
+    }
+}
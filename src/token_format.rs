@@ -0,0 +1,518 @@
+//! A compact binary format of token sequences, for caching them and sending
+//! them between processes, e.g. from a preprocessing tier to a parsing one.
+//!
+//! ```ignore
+//! let (tokens, _) = lex(source, Some("input.c"));
+//! let bytes = token_format::encode(&tokens)?;
+//!
+//! let tokens = token_format::decode(&bytes)?;
+//! ```
+//!
+//! Unlike [`serialize`](crate::serialize), the format needs no feature and
+//! holds the tokens alone, in a few bytes each:
+//!
+//! - each token starts with a byte of its kind, which is the whole token for
+//!   punctuators;
+//! - identifiers are numbers into a table of the distinct names, at the start
+//!   of the data;
+//! - each span is written as the distance of its start from the start of the
+//!   span before it, and its length, both as variable-length integers, which
+//!   takes two or three bytes for most tokens;
+//! - groups in brackets start with a marker and their number of tokens, and
+//!   end with a marker of whether their closing bracket was found.
+//!
+//! Decoding fills a vector of exactly the right size for each group, and
+//! allocates nothing else but the text of literals. The names of the table are
+//! interned once each.
+//!
+//! The data starts with [`TOKEN_FORMAT_VERSION`], and data written by another
+//! version of the format is rejected. The template and interpolation tokens of
+//! quasi-quoting cannot be encoded.
+
+use std::{fmt, sync::Arc};
+
+use ordered_float::NotNan;
+use rustc_hash::FxHashMap;
+
+use crate::{ast::*, span::Span, symbol::Symbol, visitor::grow};
+
+/// Version of the token format, increased whenever it changes.
+pub const TOKEN_FORMAT_VERSION: u32 = 2;
+
+const MAGIC: [u8; 4] = *b"CGTK";
+
+// Kinds of tokens. Punctuators are their discriminant, below `PARENTHESIZED`.
+const PARENTHESIZED: u8 = 64;
+const BRACKETED: u8 = 65;
+const BRACED: u8 = 66;
+const IDENTIFIER: u8 = 67;
+const STRING_LITERAL: u8 = 68;
+const QUOTED_STRING: u8 = 69;
+const INTEGER: u8 = 70;
+const FLOATING: u8 = 71;
+const CHARACTER: u8 = 72;
+const PREDEFINED: u8 = 73;
+const UNKNOWN: u8 = 74;
+/// Ends a sequence whose closing bracket was found.
+const CLOSED: u8 = 75;
+/// Ends a sequence whose closing bracket is missing.
+const UNCLOSED: u8 = 76;
+/// An integer constant wider than a `u64`, as text.
+const WIDE_INTEGER: u8 = 77;
+
+/// Punctuators by discriminant.
+const PUNCTUATORS: [Punctuator; 49] = {
+    use Punctuator::*;
+    [
+        LeftBracket,
+        RightBracket,
+        LeftParen,
+        RightParen,
+        LeftBrace,
+        RightBrace,
+        Dot,
+        Arrow,
+        Increment,
+        Decrement,
+        Ampersand,
+        Star,
+        Plus,
+        Minus,
+        Tilde,
+        Bang,
+        Slash,
+        Percent,
+        LeftShift,
+        RightShift,
+        Less,
+        Greater,
+        LessEqual,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        Caret,
+        Pipe,
+        LogicalAnd,
+        LogicalOr,
+        Question,
+        Colon,
+        Scope,
+        Semicolon,
+        Ellipsis,
+        Assign,
+        MulAssign,
+        DivAssign,
+        ModAssign,
+        AddAssign,
+        SubAssign,
+        LeftShiftAssign,
+        RightShiftAssign,
+        AndAssign,
+        XorAssign,
+        OrAssign,
+        Comma,
+        Hash,
+        HashHash,
+    ]
+};
+
+const INTEGER_SUFFIXES: [IntegerSuffix; 7] = {
+    use IntegerSuffix::*;
+    [
+        Unsigned,
+        Long,
+        LongLong,
+        UnsignedLong,
+        UnsignedLongLong,
+        BitPrecise,
+        UnsignedBitPrecise,
+    ]
+};
+
+const FLOATING_SUFFIXES: [FloatingSuffix; 5] = {
+    use FloatingSuffix::*;
+    [F, L, DF, DD, DL]
+};
+
+const ENCODING_PREFIXES: [EncodingPrefix; 4] = {
+    use EncodingPrefix::*;
+    [U8, U, CapitalU, L]
+};
+
+const PREDEFINED_CONSTANTS: [PredefinedConstant; 3] = {
+    use PredefinedConstant::*;
+    [False, True, Nullptr]
+};
+
+/// Errors from [`encode`] and [`decode`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Error {
+    /// The data does not start with the header of the format.
+    NotEncoded,
+    /// The data was written by another version of the format.
+    Version(u32),
+    /// The data is truncated or corrupt.
+    Invalid,
+    /// The tokens contain templates or interpolations of quasi-quoting.
+    Unsupported,
+}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            Error::NotEncoded => write!(f, "not an encoded token sequence"),
+            Error::Version(version) => write!(
+                f,
+                "token format version {version} is not supported, expected {TOKEN_FORMAT_VERSION}"
+            ),
+            Error::Invalid => write!(f, "truncated or corrupt token sequence"),
+            Error::Unsupported => write!(f, "quasi-quote tokens cannot be encoded"),
+        }
+    }
+}
+
+impl std::error::Error for Error {}
+
+/// Encode `tokens` in the token format.
+pub fn encode(tokens: &BalancedTokenSequence) -> Result<Vec<u8>, Error> {
+    let mut encoder = Encoder::default();
+    encoder.sequence(tokens)?;
+
+    let mut table = Encoder::default();
+    table.varint(encoder.names.len() as u64);
+    for name in &encoder.names {
+        table.string(name.as_str());
+    }
+    let mut bytes = Vec::with_capacity(8 + table.data.len() + encoder.data.len());
+    bytes.extend_from_slice(&MAGIC);
+    bytes.extend_from_slice(&TOKEN_FORMAT_VERSION.to_le_bytes());
+    bytes.extend_from_slice(&table.data);
+    bytes.extend_from_slice(&encoder.data);
+    Ok(bytes)
+}
+
+/// Decode tokens written by [`encode`].
+pub fn decode(bytes: &[u8]) -> Result<BalancedTokenSequence, Error> {
+    let header = bytes.get(..8).ok_or(Error::NotEncoded)?;
+    let (magic, version) = header.split_at(4);
+    if magic != MAGIC {
+        return Err(Error::NotEncoded);
+    }
+    let version = u32::from_le_bytes(version.try_into().unwrap());
+    if version != TOKEN_FORMAT_VERSION {
+        return Err(Error::Version(version));
+    }
+
+    let mut decoder = Decoder {
+        data: &bytes[8..],
+        names: Vec::new(),
+        start: 0,
+    };
+    let count = decoder.len()?;
+    decoder.names.reserve(count.min(decoder.data.len()));
+    for _ in 0..count {
+        let name = decoder.str()?;
+        decoder.names.push(Symbol::intern(name));
+    }
+    // The top level is not in brackets, so its length is not written
+    let sequence = decoder.sequence(Vec::new(), None)?;
+    if !decoder.data.is_empty() {
+        return Err(Error::Invalid);
+    }
+    Ok(sequence)
+}
+
+#[derive(Default)]
+struct Encoder {
+    data: Vec<u8>,
+    /// Index of each name written so far, and the names in order.
+    symbols: FxHashMap<Symbol, u32>,
+    names: Vec<Symbol>,
+    /// Start of the last span written.
+    start: usize,
+}
+
+impl Encoder {
+    /// Write `value` in LEB128, seven bits a byte, lowest first.
+    fn varint(&mut self, mut value: u64) {
+        while value >= 0x80 {
+            self.data.push(value as u8 | 0x80);
+            value >>= 7;
+        }
+        self.data.push(value as u8);
+    }
+
+    fn string(&mut self, string: &str) {
+        self.varint(string.len() as u64);
+        self.data.extend_from_slice(string.as_bytes());
+    }
+
+    fn span(&mut self, span: Span) {
+        let range = span.range();
+        // Zigzag, so that small distances back take a byte too
+        let delta = range.start as i64 - self.start as i64;
+        self.varint(((delta << 1) ^ (delta >> 63)) as u64);
+        self.varint(range.len() as u64);
+        self.start = range.start;
+    }
+
+    fn prefix(&mut self, prefix: Option<EncodingPrefix>) {
+        self.data.push(prefix.map_or(0, |prefix| prefix as u8 + 1));
+    }
+
+    fn sequence(&mut self, sequence: &BalancedTokenSequence) -> Result<(), Error> {
+        for token in &sequence.tokens {
+            self.token(token)?;
+        }
+        self.data.push(if sequence.closed { CLOSED } else { UNCLOSED });
+        self.span(sequence.eoi);
+        Ok(())
+    }
+
+    fn group(&mut self, kind: u8, span: Span, sequence: &BalancedTokenSequence) -> Result<(), Error> {
+        self.data.push(kind);
+        self.span(span);
+        self.varint(sequence.tokens.len() as u64);
+        grow(|| self.sequence(sequence))
+    }
+
+    fn token(&mut self, token: &Spanned<BalancedToken>) -> Result<(), Error> {
+        let kind = match &token.value {
+            BalancedToken::Parenthesized(sequence) => return self.group(PARENTHESIZED, token.span, sequence),
+            BalancedToken::Bracketed(sequence) => return self.group(BRACKETED, token.span, sequence),
+            BalancedToken::Braced(sequence) => return self.group(BRACED, token.span, sequence),
+            BalancedToken::Punctuator(punctuator) => *punctuator as u8,
+            BalancedToken::Identifier(_) => IDENTIFIER,
+            BalancedToken::StringLiteral(_) => STRING_LITERAL,
+            BalancedToken::QuotedString(_) => QUOTED_STRING,
+            BalancedToken::Constant(Constant::Integer(IntegerConstant { value: IntegerValue::Wide(_), .. })) => {
+                WIDE_INTEGER
+            }
+            BalancedToken::Constant(Constant::Integer(_)) => INTEGER,
+            BalancedToken::Constant(Constant::Floating(_)) => FLOATING,
+            BalancedToken::Constant(Constant::Character(_)) => CHARACTER,
+            BalancedToken::Constant(Constant::Predefined(_)) => PREDEFINED,
+            BalancedToken::Unknown => UNKNOWN,
+            #[cfg(feature = "quasi-quote")]
+            BalancedToken::Template(_) | BalancedToken::Interpolation(_) => return Err(Error::Unsupported),
+        };
+        self.data.push(kind);
+        self.span(token.span);
+
+        match &token.value {
+            BalancedToken::Identifier(name) => {
+                let next = self.names.len() as u32;
+                let index = *self.symbols.entry(name.0).or_insert(next);
+                if index == next {
+                    self.names.push(name.0);
+                }
+                self.varint(index.into());
+            }
+            BalancedToken::StringLiteral(literals) => {
+                self.varint(literals.0.len() as u64);
+                for literal in &literals.0 {
+                    self.prefix(literal.encoding_prefix);
+                    self.string(&literal.value);
+                }
+            }
+            BalancedToken::QuotedString(string) => self.string(string),
+            BalancedToken::Constant(Constant::Integer(constant)) => {
+                self.data.push(constant.suffix.map_or(0, |suffix| suffix as u8 + 1));
+                match &constant.value {
+                    IntegerValue::Narrow(value) => self.varint(*value),
+                    IntegerValue::Wide(text) => self.string(text),
+                }
+            }
+            BalancedToken::Constant(Constant::Floating(constant)) => {
+                self.data.push(constant.suffix.map_or(0, |suffix| suffix as u8 + 1));
+                self.data.extend_from_slice(&constant.value.into_inner().to_le_bytes());
+            }
+            BalancedToken::Constant(Constant::Character(constant)) => {
+                self.prefix(constant.encoding_prefix);
+                self.string(&constant.value);
+            }
+            BalancedToken::Constant(Constant::Predefined(constant)) => self.data.push(*constant as u8),
+            _ => {}
+        }
+        Ok(())
+    }
+}
+
+struct Decoder<'a> {
+    data: &'a [u8],
+    names: Vec<Symbol>,
+    /// Start of the last span read.
+    start: usize,
+}
+
+impl<'a> Decoder<'a> {
+    fn byte(&mut self) -> Result<u8, Error> {
+        let (&byte, rest) = self.data.split_first().ok_or(Error::Invalid)?;
+        self.data = rest;
+        Ok(byte)
+    }
+
+    fn varint(&mut self) -> Result<u64, Error> {
+        let mut value = 0;
+        for shift in (0..64).step_by(7) {
+            let byte = self.byte()?;
+            value |= u64::from(byte & 0x7f) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        Err(Error::Invalid)
+    }
+
+    fn len(&mut self) -> Result<usize, Error> {
+        self.varint()?.try_into().map_err(|_| Error::Invalid)
+    }
+
+    fn str(&mut self) -> Result<&'a str, Error> {
+        let len = self.len()?;
+        if len > self.data.len() {
+            return Err(Error::Invalid);
+        }
+        let (bytes, rest) = self.data.split_at(len);
+        self.data = rest;
+        std::str::from_utf8(bytes).map_err(|_| Error::Invalid)
+    }
+
+    /// A variant of `variants` by its index plus one, or none for zero.
+    fn optional<T: Copy>(&mut self, variants: &[T]) -> Result<Option<T>, Error> {
+        match self.byte()? {
+            0 => Ok(None),
+            index => variants
+                .get(index as usize - 1)
+                .copied()
+                .map(Some)
+                .ok_or(Error::Invalid),
+        }
+    }
+
+    fn span(&mut self) -> Result<Span, Error> {
+        let zigzag = self.varint()?;
+        let delta = (zigzag >> 1) as i64 ^ -((zigzag & 1) as i64);
+        let start = (self.start as i64).checked_add(delta).ok_or(Error::Invalid)?;
+        let start = u32::try_from(start).map_err(|_| Error::Invalid)? as usize;
+        let len = u32::try_from(self.varint()?).map_err(|_| Error::Invalid)? as usize;
+        let end = u32::try_from(start + len).map_err(|_| Error::Invalid)? as usize;
+        self.start = start;
+        Ok(Span::new(start..end))
+    }
+
+    /// Read the tokens of a sequence into `tokens`, checking that there are
+    /// `count` of them if given, then its end marker.
+    fn sequence(
+        &mut self,
+        mut tokens: Vec<Spanned<BalancedToken>>,
+        count: Option<usize>,
+    ) -> Result<BalancedTokenSequence, Error> {
+        loop {
+            let kind = self.byte()?;
+            let closed = match kind {
+                CLOSED => true,
+                UNCLOSED => false,
+                _ => {
+                    let token = self.token(kind)?;
+                    tokens.push(token);
+                    continue;
+                }
+            };
+            if count.is_some_and(|count| count != tokens.len()) {
+                return Err(Error::Invalid);
+            }
+            let eoi = self.span()?;
+            return Ok(BalancedTokenSequence { tokens, closed, eoi });
+        }
+    }
+
+    fn group(&mut self) -> Result<BalancedTokenSequence, Error> {
+        let count = self.len()?;
+        // Each token takes at least three bytes, which bounds the count of
+        // corrupt data
+        let tokens = Vec::with_capacity(count.min(self.data.len() / 3));
+        grow(|| self.sequence(tokens, Some(count)))
+    }
+
+    fn token(&mut self, kind: u8) -> Result<Spanned<BalancedToken>, Error> {
+        let span = self.span()?;
+        let value = match kind {
+            PARENTHESIZED => BalancedToken::Parenthesized(Arc::new(self.group()?)),
+            BRACKETED => BalancedToken::Bracketed(Arc::new(self.group()?)),
+            BRACED => BalancedToken::Braced(Arc::new(self.group()?)),
+            IDENTIFIER => {
+                let index = self.len()?;
+                BalancedToken::Identifier(Identifier(*self.names.get(index).ok_or(Error::Invalid)?))
+            }
+            STRING_LITERAL => {
+                let count = self.len()?;
+                let mut literals = Vec::with_capacity(count.min(self.data.len() / 2));
+                for _ in 0..count {
+                    let encoding_prefix = self.optional(&ENCODING_PREFIXES)?;
+                    let value = self.str()?.to_string();
+                    literals.push(StringLiteral { encoding_prefix, value });
+                }
+                BalancedToken::StringLiteral(Arc::new(StringLiterals(literals)))
+            }
+            QUOTED_STRING => BalancedToken::QuotedString(self.str()?.to_string()),
+            INTEGER => {
+                let suffix = self.optional(&INTEGER_SUFFIXES)?;
+                let value = IntegerValue::Narrow(self.varint()?);
+                BalancedToken::Constant(Constant::Integer(IntegerConstant { value, suffix }))
+            }
+            WIDE_INTEGER => {
+                let suffix = self.optional(&INTEGER_SUFFIXES)?;
+                let value = IntegerValue::Wide(self.str()?.into());
+                BalancedToken::Constant(Constant::Integer(IntegerConstant { value, suffix }))
+            }
+            FLOATING => {
+                let suffix = self.optional(&FLOATING_SUFFIXES)?;
+                if self.data.len() < 8 {
+                    return Err(Error::Invalid);
+                }
+                let (value, rest) = self.data.split_at(8);
+                self.data = rest;
+                let value = NotNan::new(f64::from_le_bytes(value.try_into().unwrap())).map_err(|_| Error::Invalid)?;
+                BalancedToken::Constant(Constant::Floating(FloatingConstant { value, suffix }))
+            }
+            CHARACTER => {
+                let encoding_prefix = self.optional(&ENCODING_PREFIXES)?;
+                let value = self.str()?.to_string();
+                BalancedToken::Constant(Constant::Character(CharacterConstant { encoding_prefix, value }))
+            }
+            PREDEFINED => {
+                let constant = PREDEFINED_CONSTANTS.get(self.byte()? as usize).ok_or(Error::Invalid)?;
+                BalancedToken::Constant(Constant::Predefined(*constant))
+            }
+            UNKNOWN => BalancedToken::Unknown,
+            kind => BalancedToken::Punctuator(*PUNCTUATORS.get(kind as usize).ok_or(Error::Invalid)?),
+        };
+        Ok(Spanned { value, span })
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_tables_in_discriminant_order() {
+        for (index, punctuator) in PUNCTUATORS.iter().enumerate() {
+            assert_eq!(*punctuator as usize, index);
+        }
+        assert!(PUNCTUATORS.len() < PARENTHESIZED as usize);
+        for (index, suffix) in INTEGER_SUFFIXES.iter().enumerate() {
+            assert_eq!(*suffix as usize, index);
+        }
+        for (index, suffix) in FLOATING_SUFFIXES.iter().enumerate() {
+            assert_eq!(*suffix as usize, index);
+        }
+        for (index, prefix) in ENCODING_PREFIXES.iter().enumerate() {
+            assert_eq!(*prefix as usize, index);
+        }
+        for (index, constant) in PREDEFINED_CONSTANTS.iter().enumerate() {
+            assert_eq!(*constant as usize, index);
+        }
+    }
+}
@@ -0,0 +1,262 @@
+//! Writing balanced token sequences back to source text.
+
+use std::{
+    fmt::{self, Write},
+    ops::Range,
+};
+
+use crate::{ast::*, lexer::TriviaTable, span::Span, utils::needs_space};
+
+impl BalancedTokenSequence {
+    /// Write the tokens as C source text to `writer`.
+    ///
+    /// With `source`, the text the tokens were lexed from, each token is
+    /// written as its slice of the source, and tokens are separated by a space
+    /// where there was whitespace between them. Tokens that do not come from
+    /// the source, e.g. those built by quasi-quoting, are written from their
+    /// values, separated by a space only where the lexer needs one.
+    ///
+    /// Nothing is allocated, so tools that pass tokens through, e.g. attribute
+    /// arguments, do not need to parse and print them.
+    pub fn write_tokens(&self, source: Option<&str>, writer: impl fmt::Write) -> fmt::Result {
+        TokenWriter::new(source, None, writer).sequence(self)
+    }
+
+    /// Write the tokens as C source text to `writer`, with the trivia of
+    /// `source` they were lexed with by [`lex_trivia`](crate::lex_trivia).
+    ///
+    /// Each token from the source is written as its slice of the source,
+    /// after the whitespace, comments and line directives before it, so that
+    /// the tokens as lexed are written back as `source` exactly. Tokens that
+    /// do not come from the source are written as by
+    /// [`BalancedTokenSequence::write_tokens`].
+    pub fn write_with_trivia(&self, source: &str, trivia: &TriviaTable, writer: impl fmt::Write) -> fmt::Result {
+        let mut writer = TokenWriter::new(Some(source), Some(trivia), writer);
+        writer.sequence(self)?;
+        if let Some(run) = trivia.before(self.eoi.range().start) {
+            writer.writer.write_str(&source[run])?;
+        }
+        Ok(())
+    }
+
+    /// Display the tokens as C source text, see
+    /// [`BalancedTokenSequence::write_tokens`].
+    pub fn display<'a>(&'a self, source: Option<&'a str>) -> impl fmt::Display + 'a {
+        struct Display<'a>(&'a BalancedTokenSequence, Option<&'a str>);
+
+        impl fmt::Display for Display<'_> {
+            fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+                self.0.write_tokens(self.1, f)
+            }
+        }
+
+        Display(self, source)
+    }
+}
+
+struct TokenWriter<'s, W> {
+    source: Option<&'s str>,
+    trivia: Option<&'s TriviaTable>,
+    writer: W,
+    /// Last byte written.
+    last: Option<u8>,
+    /// Whether the last token is a number.
+    number: bool,
+    /// End of the last token in the source.
+    end: Option<usize>,
+    /// Whether there is whitespace in the source before the current token,
+    /// if both it and the last token come from the source.
+    gap: Option<bool>,
+    /// Whether nothing of the current token has been written yet.
+    pending: bool,
+    /// The trivia before the current token, if it is written with trivia.
+    leading: Option<Range<usize>>,
+}
+
+impl<'s, W: fmt::Write> TokenWriter<'s, W> {
+    fn new(source: Option<&'s str>, trivia: Option<&'s TriviaTable>, writer: W) -> Self {
+        TokenWriter {
+            source,
+            trivia,
+            writer,
+            last: None,
+            number: false,
+            end: None,
+            gap: None,
+            pending: false,
+            leading: None,
+        }
+    }
+
+    /// Start a token at `range` of the source, if it comes from the source.
+    fn begin(&mut self, range: Option<Range<usize>>) {
+        self.gap = match (&range, self.end) {
+            (Some(range), Some(end)) if range.start >= end => Some(range.start > end),
+            _ => None,
+        };
+        self.leading = (self.trivia.zip(range.as_ref())).and_then(|(trivia, range)| trivia.before(range.start));
+        self.end = range.map(|range| range.end);
+        self.pending = true;
+    }
+
+    fn sequence(&mut self, seq: &BalancedTokenSequence) -> fmt::Result {
+        for token in &seq.tokens {
+            let (open, close, inner) = match &token.value {
+                BalancedToken::Parenthesized(inner) => ("(", ")", inner),
+                BalancedToken::Bracketed(inner) => ("[", "]", inner),
+                BalancedToken::Braced(inner) => ("{", "}", inner),
+                value => {
+                    self.token(value, token.span)?;
+                    continue;
+                }
+            };
+            let range = self.source_range(token.span);
+            self.begin(range.clone().map(|range| range.start..range.start + 1));
+            self.write_str(open)?;
+            self.sequence(inner)?;
+            if inner.closed {
+                self.begin(range.map(|range| range.end - 1..range.end));
+                self.write_str(close)?;
+            }
+        }
+        Ok(())
+    }
+
+    /// The range of `span` in the source, if it has one.
+    fn source_range(&self, span: Span) -> Option<Range<usize>> {
+        let range = span.range();
+        self.source
+            .filter(|source| !range.is_empty() && source.get(range.clone()).is_some())
+            .map(|_| range)
+    }
+
+    fn token(&mut self, token: &BalancedToken, span: Span) -> fmt::Result {
+        if let Some((source, range)) = self.source.zip(self.source_range(span)) {
+            self.begin(Some(range.clone()));
+            return self.write_str(&source[range]);
+        }
+
+        self.begin(None);
+        match token {
+            BalancedToken::Identifier(identifier) => self.write_str(&identifier.0),
+            BalancedToken::StringLiteral(literals) => {
+                for (i, literal) in literals.0.iter().enumerate() {
+                    if i > 0 {
+                        self.begin(None);
+                    }
+                    self.quoted(literal.encoding_prefix, '"', &literal.value)?;
+                }
+                Ok(())
+            }
+            BalancedToken::QuotedString(text) => write!(self, "`{text}`"),
+            BalancedToken::Constant(constant) => self.constant(constant),
+            BalancedToken::Punctuator(punctuator) => self.write_str(punctuator.as_str()),
+            #[cfg(feature = "quasi-quote")]
+            BalancedToken::Template(template) => {
+                self.write_char('@')?;
+                self.write_str(template.name.as_ref())
+            }
+            #[cfg(feature = "quasi-quote")]
+            BalancedToken::Interpolation(_) => Ok(()),
+            BalancedToken::Unknown => Ok(()),
+            BalancedToken::Parenthesized(_) | BalancedToken::Bracketed(_) | BalancedToken::Braced(_) => {
+                unreachable!("Groups are written by `sequence`")
+            }
+        }
+    }
+
+    fn constant(&mut self, constant: &Constant) -> fmt::Result {
+        match constant {
+            Constant::Integer(integer) => {
+                let suffix = match integer.suffix {
+                    None => "",
+                    Some(IntegerSuffix::Unsigned) => "U",
+                    Some(IntegerSuffix::Long) => "L",
+                    Some(IntegerSuffix::LongLong) => "LL",
+                    Some(IntegerSuffix::UnsignedLong) => "UL",
+                    Some(IntegerSuffix::UnsignedLongLong) => "ULL",
+                    Some(IntegerSuffix::BitPrecise) => "wb",
+                    Some(IntegerSuffix::UnsignedBitPrecise) => "uwb",
+                };
+                write!(self, "{}{suffix}", integer.value)
+            }
+            Constant::Floating(floating) => {
+                let suffix = match floating.suffix {
+                    None => "",
+                    Some(FloatingSuffix::F) => "f",
+                    Some(FloatingSuffix::L) => "l",
+                    Some(FloatingSuffix::DF) => "df",
+                    Some(FloatingSuffix::DD) => "dd",
+                    Some(FloatingSuffix::DL) => "dl",
+                };
+                // `Debug` always writes a decimal point or an exponent
+                write!(self, "{:?}{suffix}", floating.value.into_inner())
+            }
+            Constant::Character(character) => self.quoted(character.encoding_prefix, '\'', &character.value),
+            Constant::Predefined(PredefinedConstant::False) => self.write_str("false"),
+            Constant::Predefined(PredefinedConstant::True) => self.write_str("true"),
+            Constant::Predefined(PredefinedConstant::Nullptr) => self.write_str("nullptr"),
+        }
+    }
+
+    /// Write `value` between `quote`s, escaping it.
+    fn quoted(&mut self, prefix: Option<EncodingPrefix>, quote: char, value: &str) -> fmt::Result {
+        self.write_str(match prefix {
+            Some(EncodingPrefix::U8) => "u8",
+            Some(EncodingPrefix::U) => "u",
+            Some(EncodingPrefix::CapitalU) => "U",
+            Some(EncodingPrefix::L) => "L",
+            None => "",
+        })?;
+        self.write_char(quote)?;
+        for ch in value.chars() {
+            match ch {
+                '\\' => self.write_str("\\\\")?,
+                '\'' => self.write_str("\\'")?,
+                '"' => self.write_str("\\\"")?,
+                '\n' => self.write_str("\\n")?,
+                '\r' => self.write_str("\\r")?,
+                '\t' => self.write_str("\\t")?,
+                '\0' => self.write_str("\\0")?,
+                '\x07' => self.write_str("\\a")?,
+                '\x08' => self.write_str("\\b")?,
+                '\x0c' => self.write_str("\\f")?,
+                '\x0b' => self.write_str("\\v")?,
+                '\x1b' => self.write_str("\\e")?,
+                _ => self.write_char(ch)?,
+            }
+        }
+        self.write_char(quote)
+    }
+}
+
+impl<W: fmt::Write> fmt::Write for TokenWriter<'_, W> {
+    /// Write part of the current token, separating the token from the last
+    /// one first if nothing of it has been written yet.
+    fn write_str(&mut self, text: &str) -> fmt::Result {
+        let bytes = text.as_bytes();
+        let (Some(&first), Some(&last)) = (bytes.first(), bytes.last()) else {
+            return Ok(());
+        };
+        if self.pending {
+            if let Some((source, leading)) = self.source.zip(self.leading.take()) {
+                self.writer.write_str(&source[leading])?;
+            } else {
+                let space = match self.gap {
+                    Some(gap) => gap,
+                    None => self
+                        .last
+                        .is_some_and(|previous| needs_space(previous, first, self.number)),
+                };
+                if space {
+                    self.writer.write_char(' ')?;
+                }
+            }
+            self.number = first.is_ascii_digit() || (first == b'.' && bytes.get(1).is_some_and(u8::is_ascii_digit));
+            self.pending = false;
+        }
+        self.writer.write_str(text)?;
+        self.last = Some(last);
+        Ok(())
+    }
+}
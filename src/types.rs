@@ -0,0 +1,1397 @@
+//! Canonical C types, interned in a table.
+//!
+//! The syntax of a type is spread over the declaration specifiers and the
+//! declarator of each declaration, and typedef names stand for types
+//! declared elsewhere. A [`TypeResolver`] reads that syntax into canonical
+//! [`Type`]s, interned in a [`TypeTable`], so that two spellings of the same
+//! type are the same [`TypeId`] and comparing types is an integer compare:
+//!
+//! ```ignore
+//! let mut table = TypeTable::new();
+//! let types = table.resolve_unit(&unit);
+//! if types.declarator(&a.declarator) == types.declarator(&b.declarator) {
+//!     println!("{}", table.display(types.declarator(&a.declarator).unwrap()));
+//! }
+//! ```
+//!
+//! Typedef names are resolved once, where the typedef is declared, and each
+//! use of the name is then a lookup in the scopes of the resolver, so a chain
+//! of typedefs is followed once per translation unit however often it is
+//! used.
+//!
+//! Structures, unions and enumerations are nominal: each definition is a new
+//! [`Record`], and a tag refers to the definition in scope. Everything else
+//! is structural. Qualifiers on an array apply to its elements, and the types
+//! of parameters are adjusted as in a function type, so e.g. `int f(const int
+//! a[])` and `int f(int *)` have the same type. As in C23, `()` is an empty
+//! parameter list.
+//!
+//! The resolver also evaluates the integer constant expressions it meets, the
+//! sizes of arrays, the values of enumerators, the widths of bit-fields and
+//! the conditions of static assertions, memoizing the value of each node. With
+//! a [`Target`], `sizeof` and `_Alignof` are evaluated through the
+//! [`LayoutEngine`].
+
+use std::{
+    fmt,
+    marker::PhantomData,
+    ops::{BitOr, BitOrAssign},
+};
+
+use rustc_hash::FxHashMap;
+
+use crate::{
+    ast::*,
+    layout::{Layout, LayoutEngine, Target},
+    symbol::Symbol,
+    visitor::{
+        Visitor, walk_compound_statement, walk_declaration, walk_function_definition, walk_iteration_statement,
+        walk_type_name,
+    },
+};
+
+/// A handle to a type of a [`TypeTable`].
+///
+/// Handles from the same table are equal exactly when their types are.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct TypeId(u32);
+
+impl TypeId {
+    /// The index of the type in its table.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// A handle to a structure, union or enumeration of a [`TypeTable`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub struct RecordId(u32);
+
+impl RecordId {
+    /// The index of the record in its table.
+    pub fn index(self) -> usize {
+        self.0 as usize
+    }
+}
+
+/// The rank of a standard integer type other than `char` and `bool`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, PartialOrd, Ord)]
+pub enum IntegerRank {
+    /// `short`.
+    Short,
+    /// `int`.
+    Int,
+    /// `long`.
+    Long,
+    /// `long long`.
+    LongLong,
+}
+
+/// The length of an array type.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum ArrayLength {
+    /// `[]`, an incomplete array.
+    Unspecified,
+    /// A length that is an integer constant expression.
+    Constant(u64),
+    /// A variable length, or one that is not evaluated, e.g. with `sizeof`
+    /// and no target.
+    Variable,
+}
+
+/// A set of type qualifiers.
+#[derive(Clone, Copy, Default, PartialEq, Eq, Hash)]
+pub struct Qualifiers(u8);
+
+impl Qualifiers {
+    /// No qualifiers.
+    pub const NONE: Self = Self(0);
+    /// `const`.
+    pub const CONST: Self = Self(1);
+    /// `volatile`.
+    pub const VOLATILE: Self = Self(2);
+    /// `restrict`.
+    pub const RESTRICT: Self = Self(4);
+    /// `_Atomic`.
+    pub const ATOMIC: Self = Self(8);
+
+    /// Whether there are no qualifiers.
+    pub fn is_empty(self) -> bool {
+        self.0 == 0
+    }
+
+    /// Whether all the qualifiers of `other` are in `self`.
+    pub fn contains(self, other: Self) -> bool {
+        self.0 & other.0 == other.0
+    }
+
+    /// The qualifier of `qualifier`, if it qualifies types.
+    fn of(qualifier: TypeQualifier) -> Self {
+        match qualifier {
+            TypeQualifier::Const => Self::CONST,
+            TypeQualifier::Volatile => Self::VOLATILE,
+            TypeQualifier::Restrict => Self::RESTRICT,
+            TypeQualifier::Atomic => Self::ATOMIC,
+            TypeQualifier::Nonnull | TypeQualifier::Nullable | TypeQualifier::ThreadLocal => Self::NONE,
+        }
+    }
+
+    fn of_all(qualifiers: &[TypeQualifier]) -> Self {
+        qualifiers.iter().fold(Self::NONE, |all, &q| all | Self::of(q))
+    }
+}
+
+impl BitOr for Qualifiers {
+    type Output = Self;
+
+    fn bitor(self, other: Self) -> Self {
+        Self(self.0 | other.0)
+    }
+}
+
+impl BitOrAssign for Qualifiers {
+    fn bitor_assign(&mut self, other: Self) {
+        self.0 |= other.0;
+    }
+}
+
+impl fmt::Debug for Qualifiers {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "Qualifiers({self})")
+    }
+}
+
+impl fmt::Display for Qualifiers {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let names = [
+            (Self::CONST, "const"),
+            (Self::VOLATILE, "volatile"),
+            (Self::RESTRICT, "restrict"),
+            (Self::ATOMIC, "_Atomic"),
+        ];
+        let mut first = true;
+        for (qualifier, name) in names {
+            if self.contains(qualifier) {
+                if !first {
+                    f.write_str(" ")?;
+                }
+                f.write_str(name)?;
+                first = false;
+            }
+        }
+        Ok(())
+    }
+}
+
+/// A canonical C type.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub enum Type {
+    /// `void`.
+    Void,
+    /// `bool`.
+    Bool,
+    /// `char`, distinct from both `signed char` and `unsigned char`.
+    Char,
+    /// `signed char`.
+    SignedChar,
+    /// `unsigned char`.
+    UnsignedChar,
+    /// A standard integer type other than `char` and `bool`.
+    Integer {
+        /// The size.
+        rank: IntegerRank,
+        /// Whether it is signed.
+        signed: bool,
+    },
+    /// `_BitInt(N)`.
+    BitInt {
+        /// The width, if it is an integer constant expression.
+        width: Option<u64>,
+        /// Whether it is signed.
+        signed: bool,
+    },
+    /// `float`.
+    Float,
+    /// `double`.
+    Double,
+    /// `long double`.
+    LongDouble,
+    /// `_Decimal32`.
+    Decimal32,
+    /// `_Decimal64`.
+    Decimal64,
+    /// `_Decimal128`.
+    Decimal128,
+    /// A complex type, of its real type.
+    Complex(TypeId),
+    /// A pointer, to its target type.
+    Pointer(TypeId),
+    /// A block pointer, the clang extension.
+    Block(TypeId),
+    /// An array.
+    Array {
+        /// The type of the elements.
+        element: TypeId,
+        /// The length.
+        length: ArrayLength,
+    },
+    /// A function.
+    Function {
+        /// The unqualified type of the result.
+        result: TypeId,
+        /// The adjusted types of the parameters.
+        parameters: Vec<TypeId>,
+        /// Whether the parameters end with `...`.
+        variadic: bool,
+    },
+    /// A structure.
+    Struct(RecordId),
+    /// A union.
+    Union(RecordId),
+    /// An enumeration.
+    Enum(RecordId),
+    /// A qualified type, whose base is not qualified.
+    Qualified {
+        /// The unqualified type.
+        base: TypeId,
+        /// The qualifiers, never empty.
+        qualifiers: Qualifiers,
+    },
+    /// A type that is not resolved, e.g. the type of a `typeof` of an
+    /// expression, or of a typedef name that was not declared.
+    Unknown,
+}
+
+/// A structure, union or enumeration.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct Record {
+    /// The tag, if it has one.
+    pub tag: Option<Symbol>,
+    /// Whether the members are declared.
+    pub complete: bool,
+    /// The members of a structure or union, in order.
+    pub fields: Vec<Field>,
+    /// The constants of an enumeration and their values, in order.
+    pub enumerators: Vec<(Symbol, i128)>,
+    /// The fixed underlying type of an enumeration, e.g. `enum e : short`.
+    pub underlying: Option<TypeId>,
+}
+
+/// A member of a structure or union.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Field {
+    /// The name, unless it is an anonymous member or an unnamed bit-field.
+    pub name: Option<Symbol>,
+    /// The type.
+    pub ty: TypeId,
+    /// The width of a bit-field, if it is an integer constant expression.
+    pub bit_width: Option<u64>,
+    /// The alignment specifiers of the member, of which the strictest
+    /// applies.
+    pub alignas: Vec<AlignAs>,
+}
+
+/// An alignment specifier of a member.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum AlignAs {
+    /// `_Alignas(N)`, with `N` an integer constant expression other than 0.
+    Bytes(u64),
+    /// `_Alignas(type-name)`.
+    Type(TypeId),
+}
+
+/// Canonical types, each stored once.
+///
+/// A table can be shared by the resolvers of many translation units, so that
+/// their structural types have the same ids.
+#[derive(Debug, Default, Clone)]
+pub struct TypeTable {
+    types: Vec<Type>,
+    ids: FxHashMap<Type, TypeId>,
+    records: Vec<Record>,
+}
+
+impl TypeTable {
+    /// Create an empty table.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The id of `ty`, adding it if it is new.
+    pub fn intern(&mut self, ty: Type) -> TypeId {
+        if let Some(&id) = self.ids.get(&ty) {
+            return id;
+        }
+        let id = TypeId(self.types.len().try_into().expect("Type table overflow"));
+        self.types.push(ty.clone());
+        self.ids.insert(ty, id);
+        id
+    }
+
+    /// The type of `id`.
+    ///
+    /// Panics if `id` is not from this table.
+    pub fn get(&self, id: TypeId) -> &Type {
+        &self.types[id.index()]
+    }
+
+    /// The record of `id`.
+    ///
+    /// Panics if `id` is not from this table.
+    pub fn record(&self, id: RecordId) -> &Record {
+        &self.records[id.index()]
+    }
+
+    /// Number of types.
+    pub fn len(&self) -> usize {
+        self.types.len()
+    }
+
+    /// Whether the table has no types.
+    pub fn is_empty(&self) -> bool {
+        self.types.is_empty()
+    }
+
+    /// Number of structures, unions and enumerations.
+    pub fn records(&self) -> usize {
+        self.records.len()
+    }
+
+    /// The types, in the order they were added.
+    pub fn iter(&self) -> impl ExactSizeIterator<Item = (TypeId, &Type)> {
+        (self.types.iter().enumerate()).map(|(index, ty)| (TypeId(index as u32), ty))
+    }
+
+    fn new_record(&mut self, tag: Option<Symbol>) -> RecordId {
+        let id = RecordId(self.records.len().try_into().expect("Record table overflow"));
+        self.records.push(Record { tag, ..Record::default() });
+        id
+    }
+
+    /// `base` with `qualifiers` added. Qualifiers of an array qualify its
+    /// elements.
+    pub fn qualified(&mut self, base: TypeId, qualifiers: Qualifiers) -> TypeId {
+        if qualifiers.is_empty() {
+            return base;
+        }
+        match *self.get(base) {
+            Type::Qualified { base, qualifiers: inner } => {
+                self.intern(Type::Qualified { base, qualifiers: inner | qualifiers })
+            }
+            Type::Array { element, length } => {
+                let element = self.qualified(element, qualifiers);
+                self.intern(Type::Array { element, length })
+            }
+            _ => self.intern(Type::Qualified { base, qualifiers }),
+        }
+    }
+
+    /// `id` without its qualifiers.
+    pub fn unqualified(&self, id: TypeId) -> TypeId {
+        match *self.get(id) {
+            Type::Qualified { base, .. } => base,
+            _ => id,
+        }
+    }
+
+    /// `id` written as a C type name, e.g. `const char *(*)[4]`.
+    pub fn display(&self, id: TypeId) -> impl fmt::Display + '_ {
+        struct Display<'t>(&'t TypeTable, TypeId);
+
+        impl fmt::Display for Display<'_> {
+            fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+                f.write_str(&self.0.spell(self.1, String::new()))
+            }
+        }
+
+        Display(self, id)
+    }
+
+    /// Spell `id` around `inner`, the declarator spelled so far.
+    fn spell(&self, id: TypeId, inner: String) -> String {
+        let name = match self.get(id) {
+            Type::Pointer(target) | Type::Block(target) => return self.spell_pointer(id, *target, "", inner),
+            Type::Qualified { base, qualifiers } => match self.get(*base) {
+                Type::Pointer(target) | Type::Block(target) => {
+                    return self.spell_pointer(*base, *target, &qualifiers.to_string(), inner);
+                }
+                _ => format!("{qualifiers} {}", self.spell(*base, String::new())),
+            },
+            Type::Array { element, length } => {
+                let length = match length {
+                    ArrayLength::Unspecified => String::new(),
+                    ArrayLength::Constant(length) => length.to_string(),
+                    ArrayLength::Variable => "*".to_string(),
+                };
+                return self.spell(*element, format!("{inner}[{length}]"));
+            }
+            Type::Function { result, parameters, variadic } => {
+                let mut list: Vec<_> = (parameters.iter()).map(|&p| self.spell(p, String::new())).collect();
+                if *variadic {
+                    list.push("...".to_string());
+                } else if list.is_empty() {
+                    list.push("void".to_string());
+                }
+                return self.spell(*result, format!("{inner}({})", list.join(", ")));
+            }
+            Type::Void => "void".to_string(),
+            Type::Bool => "bool".to_string(),
+            Type::Char => "char".to_string(),
+            Type::SignedChar => "signed char".to_string(),
+            Type::UnsignedChar => "unsigned char".to_string(),
+            Type::Integer { rank, signed } => {
+                let rank = match rank {
+                    IntegerRank::Short => "short",
+                    IntegerRank::Int => "int",
+                    IntegerRank::Long => "long",
+                    IntegerRank::LongLong => "long long",
+                };
+                if *signed {
+                    rank.to_string()
+                } else {
+                    format!("unsigned {rank}")
+                }
+            }
+            Type::BitInt { width, signed } => {
+                let width = width.map_or("?".to_string(), |width| width.to_string());
+                if *signed {
+                    format!("_BitInt({width})")
+                } else {
+                    format!("unsigned _BitInt({width})")
+                }
+            }
+            Type::Float => "float".to_string(),
+            Type::Double => "double".to_string(),
+            Type::LongDouble => "long double".to_string(),
+            Type::Decimal32 => "_Decimal32".to_string(),
+            Type::Decimal64 => "_Decimal64".to_string(),
+            Type::Decimal128 => "_Decimal128".to_string(),
+            Type::Complex(real) => format!("_Complex {}", self.spell(*real, String::new())),
+            Type::Struct(record) => self.spell_record("struct", *record),
+            Type::Union(record) => self.spell_record("union", *record),
+            Type::Enum(record) => self.spell_record("enum", *record),
+            Type::Unknown => "<unknown>".to_string(),
+        };
+        // `int (*)[2]` and `char *`, but `int[2]` and `int(void)`
+        if inner.is_empty() || inner.starts_with('[') || (inner.starts_with('(') && !inner.starts_with("(*")) {
+            name + &inner
+        } else {
+            format!("{name} {inner}")
+        }
+    }
+
+    fn spell_pointer(&self, pointer: TypeId, target: TypeId, qualifiers: &str, inner: String) -> String {
+        let mut spelled = String::from(if matches!(self.get(pointer), Type::Block(_)) {
+            "^"
+        } else {
+            "*"
+        });
+        spelled.push_str(qualifiers);
+        if !qualifiers.is_empty() && !inner.is_empty() {
+            spelled.push(' ');
+        }
+        spelled.push_str(&inner);
+        if matches!(self.get(target), Type::Array { .. } | Type::Function { .. }) {
+            spelled = format!("({spelled})");
+        }
+        self.spell(target, spelled)
+    }
+
+    fn spell_record(&self, keyword: &str, record: RecordId) -> String {
+        match self.record(record).tag {
+            Some(tag) => format!("{keyword} {tag}"),
+            None => format!("{keyword} <anonymous>"),
+        }
+    }
+
+    /// Resolve the types declared in `unit`, with a new resolver.
+    pub fn resolve_unit<'a>(&mut self, unit: &'a TranslationUnit) -> ResolvedTypes<'a> {
+        TypeResolver::new(self).resolve_unit(unit)
+    }
+
+    /// Resolve the types declared in `unit`, with a new resolver evaluating
+    /// `sizeof` and `_Alignof` for `target`.
+    pub fn resolve_unit_for<'a>(&mut self, unit: &'a TranslationUnit, target: Target) -> ResolvedTypes<'a> {
+        let mut resolver = TypeResolver::new(self);
+        resolver.set_target(Some(target));
+        resolver.resolve_unit(unit)
+    }
+}
+
+/// The typedef names, tags and enumeration constants of one scope.
+#[derive(Debug, Default)]
+struct Scope {
+    typedefs: FxHashMap<Symbol, TypeId>,
+    tags: FxHashMap<Symbol, TypeId>,
+    constants: FxHashMap<Symbol, i128>,
+}
+
+/// Reads type syntax into the types of a [`TypeTable`], keeping the typedef
+/// names, tags and enumeration constants in scope.
+///
+/// Scopes are entered and exited by the caller, as it walks the tree; the
+/// file scope is always there. Each declarator, type name and definition of a
+/// structure, union or enumeration is resolved once: resolving the same node
+/// again returns the type it had, without defining a new record.
+#[derive(Debug)]
+pub struct TypeResolver<'t> {
+    table: &'t mut TypeTable,
+    scopes: Vec<Scope>,
+    /// Types of the declarators and type names resolved, and records of the
+    /// definitions, by the address of the node.
+    declarators: FxHashMap<usize, TypeId>,
+    type_names: FxHashMap<usize, TypeId>,
+    definitions: FxHashMap<usize, TypeId>,
+    /// Values of the expressions and enumerators evaluated, and the results
+    /// of the static assertions, by the address of the node.
+    constants: FxHashMap<usize, Option<i128>>,
+    enumerators: FxHashMap<usize, i128>,
+    static_assertions: FxHashMap<usize, bool>,
+    target: Option<Target>,
+    /// Layouts of the complete types measured by `sizeof` and `_Alignof`.
+    layouts: FxHashMap<TypeId, Layout>,
+}
+
+impl<'t> TypeResolver<'t> {
+    /// Create a resolver at file scope, adding its types to `table`.
+    pub fn new(table: &'t mut TypeTable) -> Self {
+        Self {
+            table,
+            scopes: vec![Scope::default()],
+            declarators: FxHashMap::default(),
+            type_names: FxHashMap::default(),
+            definitions: FxHashMap::default(),
+            constants: FxHashMap::default(),
+            enumerators: FxHashMap::default(),
+            static_assertions: FxHashMap::default(),
+            target: None,
+            layouts: FxHashMap::default(),
+        }
+    }
+
+    /// The target `sizeof` and `_Alignof` are evaluated for.
+    pub fn target(&self) -> Option<&Target> {
+        self.target.as_ref()
+    }
+
+    /// Set the target `sizeof` and `_Alignof` are evaluated for. Without a
+    /// target, they have no value.
+    pub fn set_target(&mut self, target: Option<Target>) {
+        self.target = target;
+        self.layouts.clear();
+    }
+
+    /// The table the types are added to.
+    pub fn table(&self) -> &TypeTable {
+        &*self.table
+    }
+
+    /// Enter a block scope.
+    pub fn enter_scope(&mut self) {
+        self.scopes.push(Scope::default());
+    }
+
+    /// Exit the innermost block scope, forgetting its names. The file scope
+    /// is never exited.
+    pub fn exit_scope(&mut self) {
+        if self.scopes.len() > 1 {
+            self.scopes.pop();
+        }
+    }
+
+    /// Declare the typedef name `name` as `ty` in the innermost scope, e.g.
+    /// for the typedefs of headers that were not parsed.
+    pub fn define_typedef(&mut self, name: Symbol, ty: TypeId) {
+        self.innermost().typedefs.insert(name, ty);
+    }
+
+    /// The type of the typedef name `name` in scope.
+    pub fn typedef(&self, name: Symbol) -> Option<TypeId> {
+        self.scopes
+            .iter()
+            .rev()
+            .find_map(|scope| scope.typedefs.get(&name).copied())
+    }
+
+    fn innermost(&mut self) -> &mut Scope {
+        self.scopes.last_mut().expect("The file scope is never exited")
+    }
+
+    fn tag(&self, name: Symbol) -> Option<TypeId> {
+        self.scopes
+            .iter()
+            .rev()
+            .find_map(|scope| scope.tags.get(&name).copied())
+    }
+
+    fn enumeration_constant(&self, name: Symbol) -> Option<i128> {
+        self.scopes
+            .iter()
+            .rev()
+            .find_map(|scope| scope.constants.get(&name).copied())
+    }
+
+    fn intern(&mut self, ty: Type) -> TypeId {
+        self.table.intern(ty)
+    }
+
+    /// Resolve the declarations of `unit`, and the type names in it.
+    pub fn resolve_unit<'a>(mut self, unit: &'a TranslationUnit) -> ResolvedTypes<'a> {
+        UnitResolver(&mut self).visit_translation_unit(unit);
+        let constants = (self.constants.into_iter()).filter_map(|(address, value)| Some((address, value?)));
+        ResolvedTypes {
+            declarators: self.declarators,
+            type_names: self.type_names,
+            constants: constants.collect(),
+            enumerators: self.enumerators,
+            static_assertions: self.static_assertions,
+            tree: PhantomData,
+        }
+    }
+
+    /// Resolve the declarators of `d`, declaring its typedef names, and
+    /// return the names it declares with their types.
+    pub fn declaration(&mut self, d: &Declaration) -> Vec<(Identifier, TypeId)> {
+        let mut declared = Vec::new();
+        match &d.kind {
+            DeclarationKind::Normal { specifiers, declarators, .. } => {
+                let base = self.specifiers(specifiers);
+                let typedef = (specifiers.specifiers.iter())
+                    .any(|s| matches!(s, DeclarationSpecifier::StorageClass(StorageClassSpecifier::Typedef)));
+                for init in declarators {
+                    let ty = self.declarator(base, &init.declarator);
+                    if let Some(name) = init.declarator.identifier() {
+                        if typedef {
+                            self.define_typedef(name.0, ty);
+                        }
+                        declared.push((*name, ty));
+                    }
+                }
+            }
+            DeclarationKind::Typedef { specifiers, declarators, .. } => {
+                let base = self.specifiers(specifiers);
+                for declarator in declarators {
+                    let ty = self.declarator(base, declarator);
+                    if let Some(name) = declarator.identifier() {
+                        self.define_typedef(name.0, ty);
+                        declared.push((*name, ty));
+                    }
+                }
+            }
+            DeclarationKind::StaticAssert(s) => {
+                self.static_assertion(s);
+            }
+            DeclarationKind::Attribute(_) | DeclarationKind::Error => {}
+        }
+        declared
+    }
+
+    /// Resolve the type of the function defined by `f`.
+    pub fn function_definition(&mut self, f: &FunctionDefinition) -> TypeId {
+        let base = self.specifiers(&f.specifiers);
+        self.declarator(base, &f.declarator)
+    }
+
+    /// The type named by declaration specifiers, without a declarator.
+    pub fn specifiers(&mut self, s: &DeclarationSpecifiers) -> TypeId {
+        let items = s.specifiers.iter().filter_map(|s| match s {
+            DeclarationSpecifier::TypeSpecifierQualifier(item) => Some(item),
+            _ => None,
+        });
+        self.base_type(items)
+    }
+
+    /// The type named by a specifier qualifier list, without a declarator.
+    pub fn specifier_qualifiers(&mut self, s: &SpecifierQualifierList) -> TypeId {
+        self.base_type(s.items.iter())
+    }
+
+    fn base_type<'s>(&mut self, items: impl Iterator<Item = &'s TypeSpecifierQualifier>) -> TypeId {
+        let mut longs = 0;
+        let (mut short, mut signed, mut unsigned, mut complex) = (false, false, false, false);
+        let mut keyword = None;
+        let mut named = None;
+        let mut qualifiers = Qualifiers::NONE;
+        for item in items {
+            let specifier = match item {
+                TypeSpecifierQualifier::TypeSpecifier(specifier) => specifier,
+                TypeSpecifierQualifier::TypeQualifier(qualifier) => {
+                    qualifiers |= Qualifiers::of(*qualifier);
+                    continue;
+                }
+                TypeSpecifierQualifier::AlignmentSpecifier(_) => continue,
+            };
+            match specifier {
+                TypeSpecifier::Short => short = true,
+                TypeSpecifier::Long => longs += 1,
+                TypeSpecifier::Signed => signed = true,
+                TypeSpecifier::Unsigned => unsigned = true,
+                TypeSpecifier::Complex => complex = true,
+                TypeSpecifier::Int => {}
+                TypeSpecifier::Void
+                | TypeSpecifier::Char
+                | TypeSpecifier::Float
+                | TypeSpecifier::Double
+                | TypeSpecifier::Bool
+                | TypeSpecifier::Decimal32
+                | TypeSpecifier::Decimal64
+                | TypeSpecifier::Decimal128
+                | TypeSpecifier::BitInt(_) => keyword = Some(specifier),
+                TypeSpecifier::Atomic(atomic) => {
+                    let ty = self.type_name(&atomic.type_name);
+                    named = Some(self.table.qualified(ty, Qualifiers::ATOMIC));
+                }
+                TypeSpecifier::Struct(s) => named = Some(self.struct_or_union(s)),
+                TypeSpecifier::Enum(e) => named = Some(self.enumeration(e)),
+                TypeSpecifier::TypedefName(name) => named = Some(self.typedef_name(name.0)),
+                TypeSpecifier::Typeof(typeof_specifier) => named = Some(self.typeof_type(typeof_specifier)),
+            }
+        }
+
+        let base = match (named, keyword) {
+            (Some(ty), _) => ty,
+            (None, Some(TypeSpecifier::Void)) => self.intern(Type::Void),
+            (None, Some(TypeSpecifier::Bool)) => self.intern(Type::Bool),
+            (None, Some(TypeSpecifier::Char)) if signed => self.intern(Type::SignedChar),
+            (None, Some(TypeSpecifier::Char)) if unsigned => self.intern(Type::UnsignedChar),
+            (None, Some(TypeSpecifier::Char)) => self.intern(Type::Char),
+            (None, Some(TypeSpecifier::Float)) => self.intern(Type::Float),
+            (None, Some(TypeSpecifier::Double)) if longs > 0 => self.intern(Type::LongDouble),
+            (None, Some(TypeSpecifier::Double)) => self.intern(Type::Double),
+            (None, Some(TypeSpecifier::Decimal32)) => self.intern(Type::Decimal32),
+            (None, Some(TypeSpecifier::Decimal64)) => self.intern(Type::Decimal64),
+            (None, Some(TypeSpecifier::Decimal128)) => self.intern(Type::Decimal128),
+            (None, Some(TypeSpecifier::BitInt(width))) => {
+                let width = self
+                    .evaluate_constant(width)
+                    .and_then(|width| u64::try_from(width).ok());
+                self.intern(Type::BitInt { width, signed: !unsigned })
+            }
+            // `int`, possibly implicit, with its size and signedness
+            (None, _) => {
+                let rank = match longs {
+                    _ if short => IntegerRank::Short,
+                    0 => IntegerRank::Int,
+                    1 => IntegerRank::Long,
+                    _ => IntegerRank::LongLong,
+                };
+                if complex {
+                    // `_Complex` alone is `double _Complex`
+                    let real = self.intern(Type::Double);
+                    self.intern(Type::Complex(real))
+                } else {
+                    self.intern(Type::Integer { rank, signed: !unsigned })
+                }
+            }
+        };
+        let base = if complex && matches!(self.table.get(base), Type::Float | Type::Double | Type::LongDouble) {
+            self.intern(Type::Complex(base))
+        } else {
+            base
+        };
+        self.table.qualified(base, qualifiers)
+    }
+
+    fn typedef_name(&mut self, name: Symbol) -> TypeId {
+        match self.typedef(name) {
+            Some(ty) => ty,
+            None => self.intern(Type::Unknown),
+        }
+    }
+
+    fn typeof_type(&mut self, specifier: &TypeofSpecifier) -> TypeId {
+        let (argument, unqualified) = match specifier {
+            TypeofSpecifier::Typeof(argument) => (argument, false),
+            TypeofSpecifier::TypeofUnqual(argument) => (argument, true),
+        };
+        let ty = match argument {
+            TypeofSpecifierArgument::TypeName(tn) => self.type_name(tn),
+            TypeofSpecifierArgument::Expression(_) | TypeofSpecifierArgument::Error => self.intern(Type::Unknown),
+        };
+        if unqualified { self.table.unqualified(ty) } else { ty }
+    }
+
+    fn struct_or_union(&mut self, s: &StructOrUnionSpecifier) -> TypeId {
+        let make = match s.kind {
+            StructOrUnion::Struct => Type::Struct,
+            StructOrUnion::Union => Type::Union,
+        };
+        let Some(members) = &s.members else {
+            return self.tag_reference(s.identifier, make);
+        };
+        let address = s as *const _ as usize;
+        if let Some(&ty) = self.definitions.get(&address) {
+            return ty;
+        }
+        let (ty, record) = self.define_tag(s.identifier, make);
+        self.definitions.insert(address, ty);
+
+        let mut fields = Vec::new();
+        for member in members {
+            let (specifiers, declarators) = match member {
+                MemberDeclaration::Normal { specifiers, declarators, .. } => (specifiers, declarators),
+                MemberDeclaration::StaticAssert(s) => {
+                    self.static_assertion(s);
+                    continue;
+                }
+                MemberDeclaration::Error => continue,
+            };
+            let base = self.specifier_qualifiers(specifiers);
+            let alignas = self.alignas(&specifiers.items);
+            if declarators.is_empty() {
+                // An anonymous structure or union
+                fields.push(Field {
+                    name: None,
+                    ty: base,
+                    bit_width: None,
+                    alignas: alignas.clone(),
+                });
+            }
+            for declarator in declarators {
+                let field = match declarator {
+                    MemberDeclarator::Declarator(d) => Field {
+                        name: d.identifier().map(|name| name.0),
+                        ty: self.declarator(base, d),
+                        bit_width: None,
+                        alignas: alignas.clone(),
+                    },
+                    MemberDeclarator::BitField { declarator, width } => Field {
+                        name: declarator.as_ref().and_then(|d| d.identifier()).map(|name| name.0),
+                        ty: declarator.as_ref().map_or(base, |d| self.declarator(base, d)),
+                        bit_width: self
+                            .evaluate_constant(width)
+                            .and_then(|width| u64::try_from(width).ok()),
+                        alignas: alignas.clone(),
+                    },
+                };
+                fields.push(field);
+            }
+        }
+        let record = &mut self.table.records[record.index()];
+        record.fields = fields;
+        record.complete = true;
+        ty
+    }
+
+    fn alignas(&mut self, items: &[TypeSpecifierQualifier]) -> Vec<AlignAs> {
+        let mut alignas = Vec::new();
+        for item in items {
+            match item {
+                TypeSpecifierQualifier::AlignmentSpecifier(AlignmentSpecifier::Type(tn)) => {
+                    alignas.push(AlignAs::Type(self.type_name(tn)));
+                }
+                TypeSpecifierQualifier::AlignmentSpecifier(AlignmentSpecifier::Expression(e)) => {
+                    // `_Alignas(0)` has no effect
+                    if let Some(bytes) = self.evaluate_constant(e).and_then(|bytes| u64::try_from(bytes).ok())
+                        && bytes > 0
+                    {
+                        alignas.push(AlignAs::Bytes(bytes));
+                    }
+                }
+                _ => {}
+            }
+        }
+        alignas
+    }
+
+    fn enumeration(&mut self, e: &EnumSpecifier) -> TypeId {
+        let Some(enumerators) = &e.enumerators else {
+            return self.tag_reference(e.identifier, Type::Enum);
+        };
+        let address = e as *const _ as usize;
+        if let Some(&ty) = self.definitions.get(&address) {
+            return ty;
+        }
+        let (ty, record) = self.define_tag(e.identifier, Type::Enum);
+        self.definitions.insert(address, ty);
+        let underlying = e.type_specifier.as_ref().map(|s| self.specifier_qualifiers(s));
+
+        let mut values = Vec::with_capacity(enumerators.len());
+        let mut next = 0;
+        for enumerator in enumerators {
+            let value = match &enumerator.value {
+                Some(value) => self.evaluate_constant(value).unwrap_or(next),
+                None => next,
+            };
+            // Each constant is in scope from its declaration on, and the next
+            // one follows from it without evaluating it again
+            self.innermost().constants.insert(enumerator.name.0, value);
+            self.enumerators.insert(enumerator as *const _ as usize, value);
+            values.push((enumerator.name.0, value));
+            next = value + 1;
+        }
+        let record = &mut self.table.records[record.index()];
+        record.enumerators = values;
+        record.underlying = underlying;
+        record.complete = true;
+        ty
+    }
+
+    /// The type of `struct tag`, `union tag` or `enum tag` without a list of
+    /// members, declared in the innermost scope if it is not in scope.
+    fn tag_reference(&mut self, tag: Option<Identifier>, make: fn(RecordId) -> Type) -> TypeId {
+        let Some(tag) = tag else {
+            return self.intern(Type::Unknown);
+        };
+        if let Some(ty) = self.tag(tag.0)
+            && self.is_kind(ty, make)
+        {
+            return ty;
+        }
+        let record = self.table.new_record(Some(tag.0));
+        let ty = self.intern(make(record));
+        self.innermost().tags.insert(tag.0, ty);
+        ty
+    }
+
+    /// The type of a new definition of `tag`, which completes the declaration
+    /// of the tag in the innermost scope if there is one.
+    fn define_tag(&mut self, tag: Option<Identifier>, make: fn(RecordId) -> Type) -> (TypeId, RecordId) {
+        if let Some(tag) = tag
+            && let Some(ty) = self.scopes.last().and_then(|scope| scope.tags.get(&tag.0)).copied()
+            && self.is_kind(ty, make)
+            && let Type::Struct(record) | Type::Union(record) | Type::Enum(record) = *self.table.get(ty)
+            && !self.table.record(record).complete
+        {
+            return (ty, record);
+        }
+        let record = self.table.new_record(tag.map(|tag| tag.0));
+        let ty = self.intern(make(record));
+        if let Some(tag) = tag {
+            self.innermost().tags.insert(tag.0, ty);
+        }
+        (ty, record)
+    }
+
+    /// Whether `ty` is a record made by `make`.
+    fn is_kind(&self, ty: TypeId, make: fn(RecordId) -> Type) -> bool {
+        match *self.table.get(ty) {
+            Type::Struct(record) | Type::Union(record) | Type::Enum(record) => *self.table.get(ty) == make(record),
+            _ => false,
+        }
+    }
+
+    /// The type of `d` declared with the specifiers of type `base`.
+    pub fn declarator(&mut self, base: TypeId, d: &Declarator) -> TypeId {
+        let address = d as *const _ as usize;
+        if let Some(&ty) = self.declarators.get(&address) {
+            return ty;
+        }
+        let ty = self.apply_declarator(base, d);
+        self.declarators.insert(address, ty);
+        ty
+    }
+
+    fn apply_declarator(&mut self, base: TypeId, d: &Declarator) -> TypeId {
+        match d {
+            Declarator::Direct(direct) => self.apply_direct(base, direct),
+            Declarator::Pointer { pointer, declarator } => {
+                let ty = self.pointer(base, pointer);
+                self.apply_declarator(ty, declarator)
+            }
+            Declarator::Error => self.intern(Type::Unknown),
+        }
+    }
+
+    fn apply_direct(&mut self, base: TypeId, d: &DirectDeclarator) -> TypeId {
+        match d {
+            DirectDeclarator::Identifier { .. } => base,
+            DirectDeclarator::Parenthesized(declarator) => self.apply_declarator(base, declarator),
+            DirectDeclarator::Array { declarator, array_declarator, .. } => {
+                let ty = self.array(base, array_declarator);
+                self.apply_direct(ty, declarator)
+            }
+            DirectDeclarator::Function { declarator, parameters, .. } => {
+                let ty = self.function(base, parameters);
+                self.apply_direct(ty, declarator)
+            }
+        }
+    }
+
+    /// The type named by `tn`.
+    pub fn type_name(&mut self, tn: &TypeName) -> TypeId {
+        let address = tn as *const _ as usize;
+        if let Some(&ty) = self.type_names.get(&address) {
+            return ty;
+        }
+        let ty = match tn {
+            TypeName::TypeName { specifiers, abstract_declarator } => {
+                let base = self.specifier_qualifiers(specifiers);
+                match abstract_declarator {
+                    Some(d) => self.abstract_declarator(base, d),
+                    None => base,
+                }
+            }
+            TypeName::Error => self.intern(Type::Unknown),
+        };
+        self.type_names.insert(address, ty);
+        ty
+    }
+
+    /// The type of the abstract declarator `d` with the specifiers of type
+    /// `base`.
+    pub fn abstract_declarator(&mut self, base: TypeId, d: &AbstractDeclarator) -> TypeId {
+        match d {
+            AbstractDeclarator::Direct(direct) => self.apply_direct_abstract(base, direct),
+            AbstractDeclarator::Pointer { pointer, abstract_declarator } => {
+                let ty = self.pointer(base, pointer);
+                match abstract_declarator {
+                    Some(d) => self.abstract_declarator(ty, d),
+                    None => ty,
+                }
+            }
+            AbstractDeclarator::Error => self.intern(Type::Unknown),
+        }
+    }
+
+    fn apply_direct_abstract(&mut self, base: TypeId, d: &DirectAbstractDeclarator) -> TypeId {
+        let (ty, declarator) = match d {
+            DirectAbstractDeclarator::Parenthesized(declarator) => return self.abstract_declarator(base, declarator),
+            DirectAbstractDeclarator::Array { declarator, array_declarator, .. } => {
+                (self.array(base, array_declarator), declarator)
+            }
+            DirectAbstractDeclarator::Function { declarator, parameters, .. } => {
+                (self.function(base, parameters), declarator)
+            }
+        };
+        match declarator {
+            Some(d) => self.apply_direct_abstract(ty, d),
+            None => ty,
+        }
+    }
+
+    fn pointer(&mut self, target: TypeId, pointer: &Pointer) -> TypeId {
+        let ty = match pointer.pointer_or_block {
+            PointerOrBlock::Pointer => self.intern(Type::Pointer(target)),
+            PointerOrBlock::Block => self.intern(Type::Block(target)),
+        };
+        self.table.qualified(ty, Qualifiers::of_all(&pointer.type_qualifiers))
+    }
+
+    fn array(&mut self, element: TypeId, array: &ArrayDeclarator) -> TypeId {
+        let length = match array {
+            ArrayDeclarator::Normal { size: None, .. } => ArrayLength::Unspecified,
+            ArrayDeclarator::Normal { size: Some(size), .. } | ArrayDeclarator::Static { size, .. } => {
+                match self.evaluate(size).and_then(|length| u64::try_from(length).ok()) {
+                    Some(length) => ArrayLength::Constant(length),
+                    None => ArrayLength::Variable,
+                }
+            }
+            ArrayDeclarator::VLA { .. } => ArrayLength::Variable,
+            ArrayDeclarator::Error => return self.intern(Type::Unknown),
+        };
+        self.intern(Type::Array { element, length })
+    }
+
+    fn function(&mut self, result: TypeId, parameters: &ParameterTypeList) -> TypeId {
+        let (declarations, variadic) = match parameters {
+            ParameterTypeList::Parameters(declarations) => (&declarations[..], false),
+            ParameterTypeList::Variadic(declarations) => (&declarations[..], true),
+            ParameterTypeList::OnlyVariadic => (&[][..], true),
+        };
+        let mut types = Vec::with_capacity(declarations.len());
+        for declaration in declarations {
+            let base = self.specifiers(&declaration.specifiers);
+            let ty = match &declaration.declarator {
+                Some(ParameterDeclarationKind::Declarator(d)) => self.declarator(base, d),
+                Some(ParameterDeclarationKind::Abstract(d)) => self.abstract_declarator(base, d),
+                None => base,
+            };
+            types.push(self.adjust_parameter(ty));
+        }
+        // `(void)` is an empty list
+        if !variadic && types.len() == 1 && *self.table.get(types[0]) == Type::Void {
+            types.clear();
+        }
+        let result = self.table.unqualified(result);
+        self.intern(Type::Function { result, parameters: types, variadic })
+    }
+
+    /// The type of a parameter declared as `ty` in a function type:
+    /// unqualified, with arrays and functions as pointers.
+    fn adjust_parameter(&mut self, ty: TypeId) -> TypeId {
+        let ty = self.table.unqualified(ty);
+        match *self.table.get(ty) {
+            Type::Array { element, .. } => self.intern(Type::Pointer(element)),
+            Type::Function { .. } => self.intern(Type::Pointer(ty)),
+            _ => ty,
+        }
+    }
+
+    /// The value of the constant expression `e`, see
+    /// [`evaluate`](Self::evaluate).
+    pub fn evaluate_constant(&mut self, e: &ConstantExpression) -> Option<i128> {
+        match e {
+            ConstantExpression::Expression(e) => self.evaluate(e),
+            ConstantExpression::Error => None,
+        }
+    }
+
+    /// The value of the integer constant expression `e`, if it only has
+    /// integer and character constants, enumeration constants in scope,
+    /// casts to integer types, `sizeof` and `_Alignof` of type names, and
+    /// operators on them.
+    ///
+    /// The value of each expression node is memoized, so evaluating the same
+    /// expression again, or one built on it, costs a lookup. `sizeof`,
+    /// `_Alignof` and casts to integer types other than `bool`, `char` and
+    /// `_BitInt` need a [target](Self::set_target); without one, `sizeof`
+    /// and `_Alignof` have no value and such casts keep the value.
+    pub fn evaluate(&mut self, e: &Expression) -> Option<i128> {
+        let address = e as *const _ as usize;
+        if let Some(&value) = self.constants.get(&address) {
+            return value;
+        }
+        let value = self.compute_constant(e);
+        self.constants.insert(address, value);
+        value
+    }
+
+    fn compute_constant(&mut self, e: &Expression) -> Option<i128> {
+        match &e.kind {
+            ExpressionKind::Postfix(p) => self.evaluate_postfix(p),
+            ExpressionKind::Unary(u) => self.evaluate_unary(u),
+            ExpressionKind::Cast(c) => self.evaluate_cast(c),
+            ExpressionKind::Binary(b) => {
+                let left = self.evaluate(&b.left)?;
+                // Only the operand that is evaluated must be a constant
+                match b.operator {
+                    BinaryOperator::LogicalAnd if left == 0 => return Some(0),
+                    BinaryOperator::LogicalOr if left != 0 => return Some(1),
+                    _ => {}
+                }
+                let right = self.evaluate(&b.right)?;
+                Some(match b.operator {
+                    BinaryOperator::Multiply => left.checked_mul(right)?,
+                    BinaryOperator::Divide => left.checked_div(right)?,
+                    BinaryOperator::Modulo => left.checked_rem(right)?,
+                    BinaryOperator::Add => left.checked_add(right)?,
+                    BinaryOperator::Subtract => left.checked_sub(right)?,
+                    BinaryOperator::LeftShift => left.checked_shl(u32::try_from(right).ok()?)?,
+                    BinaryOperator::RightShift => left.checked_shr(u32::try_from(right).ok()?)?,
+                    BinaryOperator::BitwiseAnd => left & right,
+                    BinaryOperator::BitwiseXor => left ^ right,
+                    BinaryOperator::BitwiseOr => left | right,
+                    BinaryOperator::Less => (left < right).into(),
+                    BinaryOperator::Greater => (left > right).into(),
+                    BinaryOperator::LessEqual => (left <= right).into(),
+                    BinaryOperator::GreaterEqual => (left >= right).into(),
+                    BinaryOperator::Equal => (left == right).into(),
+                    BinaryOperator::NotEqual => (left != right).into(),
+                    BinaryOperator::LogicalAnd | BinaryOperator::LogicalOr => (right != 0).into(),
+                })
+            }
+            ExpressionKind::Conditional(c) => {
+                if self.evaluate(&c.condition)? != 0 {
+                    self.evaluate(&c.then_expr)
+                } else {
+                    self.evaluate(&c.else_expr)
+                }
+            }
+            ExpressionKind::Assignment(_) | ExpressionKind::Comma(_) | ExpressionKind::Error => None,
+        }
+    }
+
+    fn evaluate_cast(&mut self, c: &CastExpression) -> Option<i128> {
+        match c {
+            CastExpression::Unary(u) => self.evaluate_unary(u),
+            CastExpression::Cast { type_name, expression } => {
+                let value = self.evaluate_cast(expression)?;
+                let ty = self.type_name(type_name);
+                self.convert(value, ty)
+            }
+        }
+    }
+
+    /// `value` converted to the integer type `ty`.
+    fn convert(&mut self, value: i128, ty: TypeId) -> Option<i128> {
+        let ty = self.table.unqualified(ty);
+        let (bits, signed) = match *self.table.get(ty) {
+            Type::Bool => return Some((value != 0).into()),
+            // As on most targets, `char` is signed
+            Type::Char | Type::SignedChar => (8, true),
+            Type::UnsignedChar => (8, false),
+            Type::BitInt { width: Some(width), signed } => (width, signed),
+            Type::Integer { signed, .. } => match self.layout(ty) {
+                Some(layout) => (layout.size * 8, signed),
+                None => return Some(value),
+            },
+            Type::Enum(_) => match self.layout(ty) {
+                Some(layout) => (layout.size * 8, true),
+                None => return Some(value),
+            },
+            // A typedef name that was not declared
+            Type::Unknown => return Some(value),
+            _ => return None,
+        };
+        if bits == 0 || bits >= 128 {
+            return Some(value);
+        }
+        let modulus = 1i128 << bits;
+        let value = value.rem_euclid(modulus);
+        Some(if signed && value >= modulus / 2 {
+            value - modulus
+        } else {
+            value
+        })
+    }
+
+    /// The layout of `ty` for the target, memoized once the type is complete.
+    fn layout(&mut self, ty: TypeId) -> Option<Layout> {
+        if let Some(&layout) = self.layouts.get(&ty) {
+            return Some(layout);
+        }
+        let layout = LayoutEngine::new(&*self.table, self.target?).layout(ty)?;
+        self.layouts.insert(ty, layout);
+        Some(layout)
+    }
+
+    fn evaluate_unary(&mut self, u: &UnaryExpression) -> Option<i128> {
+        match u {
+            UnaryExpression::Postfix(p) => self.evaluate_postfix(p),
+            UnaryExpression::Unary { operator, operand } => {
+                let value = self.evaluate_cast(operand)?;
+                match operator {
+                    UnaryOperator::Plus => Some(value),
+                    UnaryOperator::Minus => value.checked_neg(),
+                    UnaryOperator::BitwiseNot => Some(!value),
+                    UnaryOperator::LogicalNot => Some((value == 0).into()),
+                    UnaryOperator::Address | UnaryOperator::Dereference => None,
+                }
+            }
+            UnaryExpression::SizeofType(tn) => {
+                let ty = self.type_name(tn);
+                self.layout(ty).map(|layout| layout.size.into())
+            }
+            UnaryExpression::Alignof(tn) => {
+                let ty = self.type_name(tn);
+                self.layout(ty).map(|layout| layout.align.into())
+            }
+            UnaryExpression::PreIncrement(_) | UnaryExpression::PreDecrement(_) | UnaryExpression::Sizeof(_) => None,
+        }
+    }
+
+    fn evaluate_postfix(&mut self, p: &PostfixExpression) -> Option<i128> {
+        let PostfixExpression::Primary(primary) = p else {
+            return None;
+        };
+        match primary {
+            PrimaryExpression::Constant(Constant::Integer(integer)) => integer.value.to_u128()?.try_into().ok(),
+            PrimaryExpression::Constant(Constant::Character(character)) => {
+                let mut chars = character.value.chars();
+                match (chars.next(), chars.next()) {
+                    (Some(c), None) => Some(u32::from(c).into()),
+                    _ => None,
+                }
+            }
+            PrimaryExpression::Constant(Constant::Predefined(PredefinedConstant::True)) => Some(1),
+            PrimaryExpression::Constant(Constant::Predefined(PredefinedConstant::False)) => Some(0),
+            PrimaryExpression::Identifier(name) | PrimaryExpression::EnumerationConstant(name) => {
+                self.enumeration_constant(name.0)
+            }
+            PrimaryExpression::Parenthesized(e) => self.evaluate(e),
+            _ => None,
+        }
+    }
+
+    /// Evaluate the condition of the static assertion `s`, returning whether
+    /// it holds.
+    pub fn static_assertion(&mut self, s: &StaticAssertDeclaration) -> Option<bool> {
+        let holds = self.evaluate_constant(&s.condition).map(|value| value != 0);
+        if let Some(holds) = holds {
+            self.static_assertions.insert(s as *const _ as usize, holds);
+        }
+        holds
+    }
+}
+
+/// The types of the declarators and type names of a translation unit, as
+/// resolved by [`TypeResolver::resolve_unit`], by the address of the node in
+/// the tree.
+#[derive(Debug, Default)]
+pub struct ResolvedTypes<'a> {
+    declarators: FxHashMap<usize, TypeId>,
+    type_names: FxHashMap<usize, TypeId>,
+    constants: FxHashMap<usize, i128>,
+    enumerators: FxHashMap<usize, i128>,
+    static_assertions: FxHashMap<usize, bool>,
+    tree: PhantomData<&'a TranslationUnit>,
+}
+
+impl<'a> ResolvedTypes<'a> {
+    /// The type declared by the declarator `d` of the unit, e.g. of a
+    /// variable, function, typedef name, member or parameter.
+    pub fn declarator(&self, d: &'a Declarator) -> Option<TypeId> {
+        self.declarators.get(&(d as *const _ as usize)).copied()
+    }
+
+    /// The type named by the type name `tn` of the unit, e.g. of a cast or a
+    /// `sizeof`.
+    pub fn type_name(&self, tn: &'a TypeName) -> Option<TypeId> {
+        self.type_names.get(&(tn as *const _ as usize)).copied()
+    }
+
+    /// The value of the integer constant expression `e` of the unit, if it
+    /// was evaluated, e.g. as the size of an array, the value of an
+    /// enumerator or the width of a bit-field.
+    pub fn constant(&self, e: &'a Expression) -> Option<i128> {
+        self.constants.get(&(e as *const _ as usize)).copied()
+    }
+
+    /// The value of the enumeration constant declared by `e`.
+    pub fn enumerator(&self, e: &'a Enumerator) -> Option<i128> {
+        self.enumerators.get(&(e as *const _ as usize)).copied()
+    }
+
+    /// Whether the static assertion `s` of the unit holds, if its condition
+    /// could be evaluated.
+    pub fn static_assertion(&self, s: &'a StaticAssertDeclaration) -> Option<bool> {
+        self.static_assertions.get(&(s as *const _ as usize)).copied()
+    }
+
+    /// Number of declarators and type names resolved.
+    pub fn len(&self) -> usize {
+        self.declarators.len() + self.type_names.len()
+    }
+
+    /// Whether nothing was resolved.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+/// Resolves the declarations and type names of a unit with one walk of the
+/// tree, entering a scope for each block.
+struct UnitResolver<'r, 't>(&'r mut TypeResolver<'t>);
+
+impl<'a> Visitor<'a> for UnitResolver<'_, '_> {
+    type Result = ();
+
+    fn visit_function_definition(&mut self, f: &'a FunctionDefinition) {
+        self.0.function_definition(f);
+        walk_function_definition(self, f)
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        self.0.declaration(d);
+        walk_declaration(self, d)
+    }
+
+    fn visit_type_name(&mut self, tn: &'a TypeName) {
+        self.0.type_name(tn);
+        walk_type_name(self, tn)
+    }
+
+    fn visit_compound_statement(&mut self, c: &'a CompoundStatement) {
+        self.0.enter_scope();
+        walk_compound_statement(self, c);
+        self.0.exit_scope();
+    }
+
+    fn visit_iteration_statement(&mut self, i: &'a IterationStatement) {
+        // The declarations of a `for` are in a scope of their own
+        self.0.enter_scope();
+        walk_iteration_statement(self, i);
+        self.0.exit_scope();
+    }
+}
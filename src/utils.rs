@@ -1,25 +1,18 @@
-use std::{
-    any::{Any, TypeId},
-    cell::{OnceCell, RefCell},
-    marker::PhantomData,
-    rc::{Rc, Weak},
-};
+#[cfg(feature = "sync")]
+use std::sync::{Arc, Mutex, OnceLock, PoisonError};
+use std::{cell::Cell, marker::PhantomData, ptr::NonNull};
+#[cfg(not(feature = "sync"))]
+use std::{cell::OnceCell, rc::Rc, thread::LocalKey};
 
 use chumsky::{
+    container::Container,
     extension::v1::{Ext, ExtParser},
     input::InputRef,
     prelude::*,
 };
 use derive_more::{Index, IndexMut};
-use rustc_hash::FxHashMap;
 
-macro_rules! re {
-    ($re:literal) => {{
-        static RE: once_cell::sync::Lazy<regex_automata::meta::Regex> =
-            once_cell::sync::Lazy::new(|| regex_automata::meta::Regex::new($re).unwrap());
-        &*RE
-    }};
-}
+use crate::parser::Dialect;
 
 #[derive(Debug, Clone, PartialEq, Eq)]
 pub struct Brand<T, B>(T, PhantomData<B>);
@@ -40,6 +33,7 @@ impl<T, B> Brand<T, B> {
 
 /// A simple grow-only slab.
 #[derive(Clone, Index, IndexMut)]
+#[cfg_attr(feature = "serde", derive(serde::Serialize, serde::Deserialize))]
 pub struct Slab<T>(Vec<T>);
 
 impl<T> Slab<T> {
@@ -58,74 +52,217 @@ impl<T> Slab<T> {
     }
 }
 
+/// The number of items a [`ShortList`] holds before it spills into a `Vec`.
+const SHORT: usize = 3;
+
+/// A container for parsers of lists that are usually short, such as
+/// specifiers, qualifiers and declarators.
+///
+/// Up to three items are kept inline, and [`ShortList::into_vec`] allocates
+/// them once, at their length, where collecting into a `Vec` rounds the
+/// first allocation up to four items. Longer lists spill into a `Vec` that
+/// grows as usual.
+pub struct ShortList<T> {
+    head: [Option<T>; SHORT],
+    len: usize,
+    spilled: Vec<T>,
+}
+
+impl<T> Default for ShortList<T> {
+    fn default() -> Self {
+        ShortList {
+            head: [const { None }; SHORT],
+            len: 0,
+            spilled: Vec::new(),
+        }
+    }
+}
+
+impl<T> Container<T> for ShortList<T> {
+    fn push(&mut self, item: T) {
+        if self.len < SHORT {
+            self.head[self.len] = Some(item);
+        } else {
+            if self.len == SHORT {
+                self.spilled = Vec::with_capacity(2 * SHORT);
+                self.spilled.extend(self.head.iter_mut().filter_map(Option::take));
+            }
+            self.spilled.push(item);
+        }
+        self.len += 1;
+    }
+}
+
+impl<T> ShortList<T> {
+    /// The items, in a `Vec` of exactly their number if the list is short.
+    pub fn into_vec(self) -> Vec<T> {
+        if self.len > SHORT {
+            return self.spilled;
+        }
+        let mut items = Vec::with_capacity(self.len);
+        items.extend(self.head.into_iter().flatten());
+        items
+    }
+}
+
 pub trait Cacher {
     type Parser<'src>;
     fn make_parser<'src>() -> Self::Parser<'src>;
 }
 
-pub struct Cached<P>(OnceCell<P>);
+/// Reference counted pointer to a cached parser.
+#[cfg(not(feature = "sync"))]
+type RefC<T> = Rc<T>;
+/// Reference counted pointer to a cached parser.
+#[cfg(feature = "sync")]
+type RefC<T> = Arc<T>;
+
+/// Cell holding a cached parser once it is built.
+#[cfg(not(feature = "sync"))]
+type Once<T> = OnceCell<T>;
+/// Cell holding a cached parser once it is built.
+#[cfg(feature = "sync")]
+type Once<T> = OnceLock<T>;
+
+pub struct Cached<P>(Once<P>);
 
+/// A reference to a cached parser, which parses through it without touching
+/// its reference count.
 pub enum Shared<T> {
-    Strong(Rc<T>),
-    Weak(Weak<T>),
+    /// A reference returned to a caller, which keeps the parser alive.
+    Strong(RefC<T>),
+    /// A reference from a cached parser to a cached parser, possibly itself.
+    /// Such references only live in the parsers held by the cache slots of
+    /// the thread, which are dropped together when the thread exits, or with
+    /// the `sync` feature in the static cache slots, which are never dropped.
+    Borrowed(NonNull<T>),
 }
 
+// SAFETY: Borrowed references point into the static cache slots, which are
+// never dropped, and the parsers are only read once they are built
+#[cfg(feature = "sync")]
+unsafe impl<T: Send + Sync> Send for Shared<T> {}
+#[cfg(feature = "sync")]
+unsafe impl<T: Send + Sync> Sync for Shared<T> {}
+
 impl<T> Clone for Shared<T> {
     fn clone(&self) -> Self {
         match self {
             Shared::Strong(p) => Shared::Strong(p.clone()),
-            Shared::Weak(weak) => Shared::Weak(weak.clone()),
+            Shared::Borrowed(p) => Shared::Borrowed(*p),
         }
     }
 }
 
-pub fn cached_recursive<'src, C>(cacher: C) -> Ext<Shared<Cached<C::Parser<'src>>>>
+/// The parser of a [`Cacher`], one slot per rule, so that references to the
+/// rule find it without a lookup or a downcast.
+///
+/// The slots are thread-local, so each thread builds its own parsers. With
+/// the `sync` feature, they are static instead, and one parser graph built by
+/// the first thread to use it serves all threads.
+pub type CacheSlot<C> = Once<RefC<Cached<<C as Cacher>::Parser<'static>>>>;
+
+/// The slots of a rule, one per [`Dialect`], each holding the rule as built
+/// for its dialect.
+pub type CacheSlots<C> = [CacheSlot<C>; Dialect::COUNT];
+
+/// Where the [`CacheSlots`] of a rule are declared.
+#[cfg(not(feature = "sync"))]
+pub type SlotKey<C> = LocalKey<CacheSlots<C>>;
+/// Where the [`CacheSlots`] of a rule are declared.
+#[cfg(feature = "sync")]
+pub type SlotKey<C> = CacheSlots<C>;
+
+/// Call `f` with the slot of the rule for the dialect being built.
+#[cfg(not(feature = "sync"))]
+fn with_slot<C: Cacher + 'static, R>(key: &'static SlotKey<C>, f: impl FnOnce(&CacheSlot<C>) -> R) -> R {
+    key.with(|slots| f(&slots[Dialect::current() as usize]))
+}
+
+/// Call `f` with the slot of the rule for the dialect being built.
+#[cfg(feature = "sync")]
+fn with_slot<C: Cacher + 'static, R>(key: &'static SlotKey<C>, f: impl FnOnce(&CacheSlot<C>) -> R) -> R {
+    f(&key[Dialect::current() as usize])
+}
+
+thread_local! {
+    /// Number of cached parsers being built on the current thread.
+    static BUILDING: Cell<usize> = const { Cell::new(0) };
+}
+
+/// Held by the thread building the cached parsers, so that other threads wait
+/// for them to be built rather than find them half-built.
+#[cfg(feature = "sync")]
+static BUILD_LOCK: Mutex<()> = Mutex::new(());
+
+/// The cached parser in `key`, if it is built or being built by this thread.
+fn lookup<'src, C>(key: &'static SlotKey<C>) -> Option<Ext<Shared<Cached<C::Parser<'src>>>>>
 where
     C: Cacher + 'static,
 {
-    thread_local! {
-        static CACHE: RefCell<FxHashMap<TypeId, Rc<dyn Any>>> = RefCell::new(FxHashMap::default());
+    macro_rules! P {
+        ($l:lifetime) => { Cached<C::Parser<$l>> };
+    }
+
+    let parser = with_slot::<C, _>(key, |slot| slot.get().cloned())?;
+    if BUILDING.get() > 0 {
+        // References while building end up in the cached parsers, which
+        // would keep each other alive if they were strong
+        return Some(Ext(Shared::Borrowed(NonNull::from(&*parser).cast::<P!['src]>())));
     }
+    // Only set once no thread is building it, as the builder holds the lock
+    parser.0.get()?;
+    // SAFETY: The parser created by `C` is guaranteed to be valid for any
+    // lifetime, so we can safely transmute it to the desired lifetime.
+    let parser = unsafe { std::mem::transmute::<RefC<P!['static]>, RefC<P!['src]>>(parser) };
+    Some(Ext(Shared::Strong(parser)))
+}
 
+pub fn cached_recursive<'src, C>(key: &'static SlotKey<C>) -> Ext<Shared<Cached<C::Parser<'src>>>>
+where
+    C: Cacher + 'static,
+{
     macro_rules! P {
         ($l:lifetime) => { Cached<C::Parser<$l>> };
     }
 
-    let key = cacher.type_id();
-
-    if let Some(parser) = CACHE.with(|cache| {
-        let cache = cache.borrow();
-        cache.get(&key).and_then(|b| b.clone().downcast::<P!['static]>().ok())
-    }) {
-        // SAFETY: The parser created by `cacher` is guaranteed to be valid for any
-        // lifetime, so we can safely transmute it to the desired lifetime.
-        let parser = unsafe { std::mem::transmute::<Rc<P!['static]>, Rc<P!['src]>>(parser) };
-        let parser = Rc::downgrade(&parser);
-        return Ext(Shared::Weak(parser));
-    }
-
-    let parser: Rc<P!['src]> = Rc::new(Cached(OnceCell::new()));
-    CACHE.with(|cache| {
-        let mut cache = cache.borrow_mut();
-        let parser = parser.clone();
-        // SAFETY: The parser created by `cacher` is guaranteed to be valid for any
-        // lifetime, so we can safely transmute it to the desired lifetime.
-        let parser = unsafe { std::mem::transmute::<Rc<P!['src]>, Rc<P!['static]>>(parser) };
-        cache.insert(key, parser as Rc<dyn Any>);
-    });
-    parser
-        .0
-        .set(C::make_parser())
+    if let Some(parser) = lookup::<C>(key) {
+        return parser;
+    }
+    // Wait for another thread building the parsers, then look again, as it
+    // may have built this one
+    #[cfg(feature = "sync")]
+    let _building = (BUILDING.get() == 0).then(|| BUILD_LOCK.lock().unwrap_or_else(PoisonError::into_inner));
+    #[cfg(feature = "sync")]
+    if let Some(parser) = lookup::<C>(key) {
+        return parser;
+    }
+
+    // Cache the parser before building it, so that recursive references to
+    // the rule while building it find it
+    let parser: RefC<P!['static]> = RefC::new(Cached(Once::new()));
+    with_slot::<C, _>(key, |slot| slot.set(parser.clone()))
         .ok()
-        .expect("Parser is already initalized");
+        .expect("Parser is already cached");
+    // SAFETY: The parser created by `C` is guaranteed to be valid for any
+    // lifetime, so we can safely transmute it to the desired lifetime.
+    let parser = unsafe { std::mem::transmute::<RefC<P!['static]>, RefC<P!['src]>>(parser) };
+    BUILDING.set(BUILDING.get() + 1);
+    let built = C::make_parser();
+    BUILDING.set(BUILDING.get() - 1);
+    parser.0.set(built).ok().expect("Parser is already initalized");
     Ext(Shared::Strong(parser))
 }
 
 impl<T> Shared<T> {
-    fn upgrade(&self) -> Option<Rc<T>> {
+    fn get(&self) -> &T {
         match self {
-            Shared::Strong(p) => Some(p.clone()),
-            Shared::Weak(weak) => weak.upgrade(),
+            Shared::Strong(p) => p,
+            // SAFETY: Borrowed references are only held by the cached parsers,
+            // and the parser they point to is dropped with its cache slot when
+            // the thread exits, after which no parser of the thread runs. With
+            // the `sync` feature, the cache slots are never dropped.
+            Shared::Borrowed(p) => unsafe { p.as_ref() },
         }
     }
 }
@@ -137,18 +274,48 @@ where
     E: extra::ParserExtra<'src, I>,
 {
     fn parse(&self, inp: &mut InputRef<'src, '_, I, E>) -> Result<O, E::Error> {
-        let parser = self.upgrade().expect("Parser dropped");
-        let parser = parser.0.get().expect("Parser not initialized");
+        let parser = self.get().0.get().expect("Parser not initialized");
         inp.parse(parser)
     }
 
     fn check(&self, inp: &mut InputRef<'src, '_, I, E>) -> Result<(), E::Error> {
-        let parser = self.upgrade().expect("Parser dropped");
-        let parser = parser.0.get().expect("Parser not initialized");
+        let parser = self.get().0.get().expect("Parser not initialized");
         inp.check(parser)
     }
 }
 
+/// A rule as built for a dialect without templates, or with the
+/// interpolation alternative of the `quasi-quote` feature, see `templated!`.
+#[cfg(feature = "quasi-quote")]
+#[derive(Clone)]
+pub enum Templated<P, T> {
+    Plain(P),
+    Interpolated(T),
+}
+
+#[cfg(feature = "quasi-quote")]
+impl<'src, P, T, I, O, E> ExtParser<'src, I, O, E> for Templated<P, T>
+where
+    P: Parser<'src, I, O, E>,
+    T: Parser<'src, I, O, E>,
+    I: Input<'src>,
+    E: extra::ParserExtra<'src, I>,
+{
+    fn parse(&self, inp: &mut InputRef<'src, '_, I, E>) -> Result<O, E::Error> {
+        match self {
+            Templated::Plain(parser) => inp.parse(parser),
+            Templated::Interpolated(parser) => inp.parse(parser),
+        }
+    }
+
+    fn check(&self, inp: &mut InputRef<'src, '_, I, E>) -> Result<(), E::Error> {
+        match self {
+            Templated::Plain(parser) => inp.check(parser),
+            Templated::Interpolated(parser) => inp.check(parser),
+        }
+    }
+}
+
 macro_rules! cached {
     (
         $( #[$attrs:meta] )*
@@ -164,7 +331,24 @@ macro_rules! cached {
                     ::chumsky::Parser::boxed($body)
                 }
             }
-            $crate::utils::cached_recursive(C)
+            #[cfg(not(feature = "sync"))]
+            ::std::thread_local! {
+                static SLOT: $crate::utils::CacheSlots<C> = const { [const { ::std::cell::OnceCell::new() }; $crate::parser::Dialect::COUNT] };
+            }
+            #[cfg(feature = "sync")]
+            static SLOT: $crate::utils::CacheSlots<C> = [const { ::std::sync::OnceLock::new() }; $crate::parser::Dialect::COUNT];
+            $crate::utils::cached_recursive::<C>(&SLOT)
         }
     };
 }
+
+/// Whether a space is needed between tokens ending with `last` and starting
+/// with `first` for the lexer to see them as two tokens.
+pub(crate) fn needs_space(last: u8, first: u8, number: bool) -> bool {
+    let word = |c: u8| c.is_ascii_alphanumeric() || c == b'_' || c >= 0x80;
+    let operator = |c: u8| b"!#%&*+-./:<=>?^|~".contains(&c);
+    (word(last) && (word(first) || first == b'"' || first == b'\''))
+        || (operator(last) && operator(first))
+        // A preprocessing number takes signs after an exponent, and dots
+        || (number && b"+-.".contains(&first))
+}
@@ -22,9 +22,13 @@
 //! }
 //! ```
 
-use std::ops::ControlFlow;
+use std::{ops::ControlFlow, sync::Arc};
 
-use crate::{Identifier, ast::*};
+use crate::{
+    Identifier,
+    ast::*,
+    index::{Node, NodeKind, NodeKinds},
+};
 
 /// A trait that represents the result type of visitor operations.
 ///
@@ -121,6 +125,25 @@ impl<T> VisitorResult for ControlFlow<T> {
     }
 }
 
+/// The kinds of nodes below an expression, a type name, specifiers, a
+/// declarator or an initializer: through a type name, a struct body can hold
+/// declarators, and through `typeof`, `_Alignas` or an array size, a
+/// declarator or specifier can hold expressions.
+const EXPRESSION_KINDS: NodeKinds = NodeKinds::of(NodeKind::Declarator)
+    .with(NodeKind::Expression)
+    .with(NodeKind::PostfixExpression)
+    .with(NodeKind::TypeName);
+
+/// The kinds of nodes below a function body.
+const BODY_KINDS: NodeKinds = EXPRESSION_KINDS.with(NodeKind::Declaration).with(NodeKind::Statement);
+
+/// Check whether the walkers of `V` descend into a subtree that can only hold
+/// nodes of the kinds in `below`. Attribute arguments hold no nodes, and are
+/// walked only when [`Visitor::INTERESTS`] has all kinds.
+const fn walks<'a, V: Visitor<'a> + ?Sized>(below: NodeKinds) -> bool {
+    V::INTERESTS.is_all() || V::INTERESTS.intersects(below)
+}
+
 /// The main visitor trait for traversing C AST nodes.
 ///
 /// Implementers of this trait can customize behavior for different AST node
@@ -140,10 +163,33 @@ impl<T> VisitorResult for ControlFlow<T> {
 /// `walk_*` function, which performs recursive traversal of child nodes.
 /// Override a visit method to insert custom logic before, after, or instead of
 /// the default traversal.
+///
+/// # Stack Usage
+///
+/// The walkers of the nodes that nest without bound, i.e. expressions,
+/// statements, initializers and declarators, move to a new stack segment on
+/// the heap when the stack runs low, so walking a very deep tree (a long
+/// `else if` chain or operator chain) does not overflow the stack. A visit
+/// method that recurses without calling the `walk_*` functions does not get
+/// this guarantee.
 pub trait Visitor<'a> {
     /// The result type produced by visitor operations.
     type Result: VisitorResult;
 
+    /// The kinds of nodes the visitor looks at.
+    ///
+    /// [`AstIndex::visit`](crate::AstIndex::visit) calls the visitor only on
+    /// the outermost nodes of these kinds, and skips the subtrees that contain
+    /// none of them. The `walk_*` functions skip such subtrees too: the set is
+    /// a constant, so the walkers of a visitor with fewer kinds are compiled
+    /// without them, and the hook at the root of a skipped subtree is still
+    /// called but its default does nothing. A visitor must therefore list the
+    /// kinds of all the nodes its hooks are reached in, e.g. a visitor of
+    /// variable names lists [`NodeKind::Expression`] and, for declared names,
+    /// [`NodeKind::Declarator`]. With all kinds, the default, everything is
+    /// walked, including attribute arguments.
+    const INTERESTS: NodeKinds = NodeKinds::ALL;
+
     /// Visits a variable name identifier.
     ///
     /// This is called when encountering an identifier in an expression context
@@ -312,6 +358,13 @@ pub trait Visitor<'a> {
         walk_braced_initializer(self, b)
     }
 
+    /// Visits a braced initializer of constants. Its constants are not
+    /// expressions, so nothing is visited inside it; visit
+    /// [`ConstantInitializer::to_braced`] for an expression per constant.
+    fn visit_constant_initializer(&mut self, _: &'a ConstantInitializer) -> Self::Result {
+        Self::Result::output()
+    }
+
     /// Visits a designated initializer.
     fn visit_designated_initializer(&mut self, d: &'a DesignatedInitializer) -> Self::Result {
         walk_designated_initializer(self, d)
@@ -602,6 +655,18 @@ macro_rules! tr {
     }};
 }
 
+/// Stack that must be left when entering a recursive walker.
+const RED_ZONE: usize = 128 * 1024;
+
+/// Size of the stack segments allocated when the stack runs low.
+const STACK_SEGMENT: usize = 2 * 1024 * 1024;
+
+/// Run `f`, moving to a new stack segment first if the stack is running low.
+#[inline]
+pub(crate) fn grow<R>(f: impl FnOnce() -> R) -> R {
+    stacker::maybe_grow(RED_ZONE, STACK_SEGMENT, f)
+}
+
 /// Walk a translation unit.
 pub fn walk_translation_unit<'a, V: Visitor<'a> + ?Sized>(v: &mut V, tu: &'a TranslationUnit) -> V::Result {
     for ed in &tu.external_declarations {
@@ -625,15 +690,18 @@ pub fn walk_function_definition<'a, V: Visitor<'a> + ?Sized>(v: &mut V, f: &'a F
     }
     tr!(v.visit_declaration_specifiers(&f.specifiers));
     tr!(v.visit_declarator(&f.declarator));
+    if !walks::<V>(BODY_KINDS) {
+        return V::Result::output();
+    }
     v.visit_compound_statement(&f.body)
 }
 
 /// Walk a statement.
 pub fn walk_statement<'a, V: Visitor<'a> + ?Sized>(v: &mut V, s: &'a Statement) -> V::Result {
-    match &s.kind {
+    grow(move || match &s.kind {
         StatementKind::Labeled(ls) => v.visit_labeled_statement(ls),
         StatementKind::Unlabeled(u) => v.visit_unlabeled_statement(u),
-    }
+    })
 }
 
 /// Walk a labeled statement.
@@ -668,7 +736,7 @@ pub fn walk_label<'a, V: Visitor<'a> + ?Sized>(v: &mut V, l: &'a Label) -> V::Re
 
 /// Walk an unlabeled statement.
 pub fn walk_unlabeled_statement<'a, V: Visitor<'a> + ?Sized>(v: &mut V, s: &'a UnlabeledStatement) -> V::Result {
-    match s {
+    grow(move || match s {
         UnlabeledStatement::Expression(es) => v.visit_expression_statement(es),
         UnlabeledStatement::Primary { attributes, block } => {
             for attribute in attributes {
@@ -682,7 +750,7 @@ pub fn walk_unlabeled_statement<'a, V: Visitor<'a> + ?Sized>(v: &mut V, s: &'a U
             }
             v.visit_jump_statement(statement)
         }
-    }
+    })
 }
 
 /// Walk an expression statement.
@@ -788,7 +856,10 @@ pub fn walk_jump_statement<'a, V: Visitor<'a> + ?Sized>(v: &mut V, j: &'a JumpSt
 
 /// Walk an expression.
 pub fn walk_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, e: &'a Expression) -> V::Result {
-    match &e.kind {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
+    grow(move || match &e.kind {
         ExpressionKind::Postfix(p) => v.visit_postfix_expression(p),
         ExpressionKind::Unary(u) => v.visit_unary_expression(u),
         ExpressionKind::Cast(c) => v.visit_cast_expression(c),
@@ -797,7 +868,7 @@ pub fn walk_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, e: &'a Expression
         ExpressionKind::Assignment(a) => v.visit_assignment_expression(a),
         ExpressionKind::Comma(c) => v.visit_comma_expression(c),
         ExpressionKind::Error => V::Result::output(),
-    }
+    })
 }
 
 /// Walk a binary expression.
@@ -831,7 +902,7 @@ pub fn walk_comma_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, c: &'a Comm
 
 /// Walk a postfix expression.
 pub fn walk_postfix_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, p: &'a PostfixExpression) -> V::Result {
-    match p {
+    grow(move || match p {
         PostfixExpression::Primary(pr) => v.visit_primary_expression(pr),
         PostfixExpression::ArrayAccess { array, index } => {
             tr!(v.visit_postfix_expression(array));
@@ -856,7 +927,7 @@ pub fn walk_postfix_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, p: &'a Po
             v.visit_postfix_expression(inner)
         }
         PostfixExpression::CompoundLiteral(cl) => v.visit_compound_literal(cl),
-    }
+    })
 }
 
 /// Walk a compound literal.
@@ -896,7 +967,7 @@ fn walk_generic_selection<'a, V: Visitor<'a> + ?Sized>(v: &mut V, g: &'a Generic
 
 /// Walk a unary expression.
 pub fn walk_unary_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, u: &'a UnaryExpression) -> V::Result {
-    match u {
+    grow(move || match u {
         UnaryExpression::Postfix(p) => v.visit_postfix_expression(p),
         UnaryExpression::PreIncrement(inner) | UnaryExpression::PreDecrement(inner) => v.visit_unary_expression(inner),
         UnaryExpression::Unary { operator, operand } => {
@@ -905,18 +976,18 @@ pub fn walk_unary_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, u: &'a Unar
         }
         UnaryExpression::Sizeof(inner) => v.visit_unary_expression(inner),
         UnaryExpression::SizeofType(tn) | UnaryExpression::Alignof(tn) => v.visit_type_name(tn),
-    }
+    })
 }
 
 /// Walk a cast expression.
 pub fn walk_cast_expression<'a, V: Visitor<'a> + ?Sized>(v: &mut V, c: &'a CastExpression) -> V::Result {
-    match c {
+    grow(move || match c {
         CastExpression::Unary(u) => v.visit_unary_expression(u),
         CastExpression::Cast { type_name, expression } => {
             tr!(v.visit_type_name(type_name));
             v.visit_cast_expression(expression)
         }
-    }
+    })
 }
 
 /// Walk a declaration.
@@ -976,6 +1047,9 @@ pub fn walk_static_assert_declaration<'a, V: Visitor<'a> + ?Sized>(
 
 /// Walk declaration specifiers.
 pub fn walk_declaration_specifiers<'a, V: Visitor<'a> + ?Sized>(v: &mut V, s: &'a DeclarationSpecifiers) -> V::Result {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
     for it in &s.specifiers {
         tr!(v.visit_declaration_specifier(it));
     }
@@ -1060,7 +1134,7 @@ pub fn walk_struct_union_specifier<'a, V: Visitor<'a> + ?Sized>(v: &mut V, s: &'
 /// Walk a member declaration.
 pub fn walk_member_declaration<'a, V: Visitor<'a> + ?Sized>(v: &mut V, md: &'a MemberDeclaration) -> V::Result {
     match md {
-        MemberDeclaration::Normal { attributes, specifiers, declarators } => {
+        MemberDeclaration::Normal { attributes, specifiers, declarators, .. } => {
             for attr in attributes {
                 tr!(v.visit_attribute_specifier(attr));
             }
@@ -1140,6 +1214,9 @@ pub fn walk_specifier_qualifier_list<'a, V: Visitor<'a> + ?Sized>(
     v: &mut V,
     s: &'a SpecifierQualifierList,
 ) -> V::Result {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
     for item in &s.items {
         tr!(v.visit_type_specifier_qualifier(item));
     }
@@ -1151,6 +1228,9 @@ pub fn walk_specifier_qualifier_list<'a, V: Visitor<'a> + ?Sized>(
 
 /// Walk a declarator.
 pub fn walk_declarator<'a, V: Visitor<'a> + ?Sized>(v: &mut V, d: &'a Declarator) -> V::Result {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
     match d {
         Declarator::Direct(dd) => v.visit_direct_declarator(dd),
         Declarator::Pointer { pointer, declarator } => {
@@ -1175,7 +1255,7 @@ pub fn walk_pointer<'a, V: Visitor<'a> + ?Sized>(v: &mut V, p: &'a Pointer) -> V
 
 /// Walk a direct declarator.
 pub fn walk_direct_declarator<'a, V: Visitor<'a> + ?Sized>(v: &mut V, d: &'a DirectDeclarator) -> V::Result {
-    match d {
+    grow(move || match d {
         DirectDeclarator::Identifier { identifier, attributes } => {
             tr!(v.visit_variable_name(identifier));
             for attr in attributes {
@@ -1198,7 +1278,7 @@ pub fn walk_direct_declarator<'a, V: Visitor<'a> + ?Sized>(v: &mut V, d: &'a Dir
             }
             v.visit_parameter_type_list(parameters)
         }
-    }
+    })
 }
 
 /// Walk an array declarator.
@@ -1267,10 +1347,14 @@ pub fn walk_parameter_declaration_kind<'a, V: Visitor<'a> + ?Sized>(
 
 /// Walk an initializer.
 pub fn walk_initializer<'a, V: Visitor<'a> + ?Sized>(v: &mut V, i: &'a Initializer) -> V::Result {
-    match i {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
+    grow(move || match i {
         Initializer::Expression(e) => v.visit_expression(e),
         Initializer::Braced(b) => v.visit_braced_initializer(b),
-    }
+        Initializer::Constants(c) => v.visit_constant_initializer(c),
+    })
 }
 
 /// Walk a braced initializer.
@@ -1330,6 +1414,9 @@ pub fn walk_type_name<'a, V: Visitor<'a> + ?Sized>(v: &mut V, tn: &'a TypeName)
 
 /// Walk an abstract declarator.
 pub fn walk_abstract_declarator<'a, V: Visitor<'a> + ?Sized>(v: &mut V, a: &'a AbstractDeclarator) -> V::Result {
+    if !walks::<V>(EXPRESSION_KINDS) {
+        return V::Result::output();
+    }
     match a {
         AbstractDeclarator::Direct(d) => v.visit_direct_abstract_declarator(d),
         AbstractDeclarator::Pointer { pointer, abstract_declarator } => {
@@ -1348,7 +1435,7 @@ pub fn walk_direct_abstract_declarator<'a, V: Visitor<'a> + ?Sized>(
     v: &mut V,
     d: &'a DirectAbstractDeclarator,
 ) -> V::Result {
-    match d {
+    grow(move || match d {
         DirectAbstractDeclarator::Parenthesized(ad) => v.visit_abstract_declarator(ad),
         DirectAbstractDeclarator::Array { declarator, attributes, array_declarator } => {
             if let Some(dd) = declarator {
@@ -1368,11 +1455,14 @@ pub fn walk_direct_abstract_declarator<'a, V: Visitor<'a> + ?Sized>(
             }
             v.visit_parameter_type_list(parameters)
         }
-    }
+    })
 }
 
 /// Walk an attribute specifier.
 pub fn walk_attribute_specifier<'a, V: Visitor<'a> + ?Sized>(v: &mut V, a: &'a AttributeSpecifier) -> V::Result {
+    if !walks::<V>(NodeKinds::NONE) {
+        return V::Result::output();
+    }
     match a {
         AttributeSpecifier::Attributes(attributes) => {
             for attr in attributes {
@@ -1387,6 +1477,181 @@ pub fn walk_attribute_specifier<'a, V: Visitor<'a> + ?Sized>(v: &mut V, a: &'a A
     V::Result::output()
 }
 
+// ============================================================================
+// Fused Passes
+// ============================================================================
+
+/// A pass over the main nodes of a tree, called as a walk enters and leaves
+/// each node, without walking the node itself.
+///
+/// Since a pass does not drive the walk, many passes can share one walk of
+/// the tree with [`Fused`], instead of walking it once each as visitors do.
+pub trait Pass<'a> {
+    /// The result type of the hooks; a break stops calling the pass.
+    type Result: VisitorResult;
+
+    /// The kinds of nodes the pass looks at; the hooks are not called on
+    /// nodes of other kinds.
+    fn interests(&self) -> NodeKinds {
+        NodeKinds::ALL
+    }
+
+    /// Called before the subtree of `node` is walked.
+    fn enter(&mut self, _node: Node<'a>) -> Self::Result {
+        Self::Result::output()
+    }
+
+    /// Called after the subtree of `node` is walked.
+    fn leave(&mut self, _node: Node<'a>) -> Self::Result {
+        Self::Result::output()
+    }
+}
+
+/// Runs many [`Pass`]es in one walk of a tree.
+///
+/// At each node, the passes interested in its kind are called in the order
+/// they were added. A pass whose hook breaks is not called again, and keeps
+/// the residual of the break for [`Fused::into_results`], while the others
+/// go on; the walk stops early once every pass has broken:
+///
+/// ```ignore
+/// let (mut calls, mut gotos) = (CallCounter::default(), FirstGoto::default());
+/// let mut fused = Fused::new();
+/// fused.push(&mut calls);
+/// fused.push(&mut gotos);
+/// fused.visit_translation_unit(&unit);
+/// let results = fused.into_results();
+/// ```
+pub struct Fused<'p, 'a, R: VisitorResult> {
+    passes: Vec<FusedPass<'p, 'a, R>>,
+    /// Number of passes that have not broken.
+    running: usize,
+}
+
+struct FusedPass<'p, 'a, R: VisitorResult> {
+    pass: &'p mut dyn Pass<'a, Result = R>,
+    interests: NodeKinds,
+    residual: Option<R::Residual>,
+}
+
+impl<R: VisitorResult> Default for Fused<'_, '_, R> {
+    fn default() -> Self {
+        Self { passes: Vec::new(), running: 0 }
+    }
+}
+
+impl<'p, 'a, R: VisitorResult> Fused<'p, 'a, R> {
+    /// Create a traversal without passes.
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Add `pass`, called after the passes added before it.
+    pub fn push(&mut self, pass: &'p mut dyn Pass<'a, Result = R>) {
+        let interests = pass.interests();
+        self.passes.push(FusedPass { pass, interests, residual: None });
+        self.running += 1;
+    }
+
+    /// The number of passes.
+    pub fn len(&self) -> usize {
+        self.passes.len()
+    }
+
+    /// Check whether there are no passes.
+    pub fn is_empty(&self) -> bool {
+        self.passes.is_empty()
+    }
+
+    /// Check whether pass `i` has broken.
+    pub fn has_broken(&self, i: usize) -> bool {
+        self.passes[i].residual.is_some()
+    }
+
+    /// The result of each pass, in the order they were added: the residual
+    /// of its break, or the output if it did not break.
+    pub fn into_results(self) -> Vec<R> {
+        self.passes
+            .into_iter()
+            .map(|pass| pass.residual.map_or_else(R::output, R::from_residual))
+            .collect()
+    }
+
+    /// Call `hook` on `node` for every running pass interested in it.
+    fn each(
+        &mut self,
+        node: Node<'a>,
+        hook: fn(&mut (dyn Pass<'a, Result = R> + 'p), Node<'a>) -> R,
+    ) -> ControlFlow<()> {
+        let kind = node.kind();
+        for pass in &mut self.passes {
+            if pass.residual.is_some() || !pass.interests.contains(kind) {
+                continue;
+            }
+            if let ControlFlow::Break(residual) = hook(&mut *pass.pass, node).branch() {
+                pass.residual = Some(residual);
+                self.running -= 1;
+            }
+        }
+        if self.running == 0 {
+            ControlFlow::Break(())
+        } else {
+            ControlFlow::Continue(())
+        }
+    }
+
+    /// Enter `node`, walk its subtree with `walk` and leave it.
+    fn node(&mut self, node: Node<'a>, walk: impl FnOnce(&mut Self) -> ControlFlow<()>) -> ControlFlow<()> {
+        self.each(node, |pass, node| pass.enter(node))?;
+        walk(self)?;
+        self.each(node, |pass, node| pass.leave(node))
+    }
+}
+
+impl<'a, R: VisitorResult> Visitor<'a> for Fused<'_, 'a, R> {
+    /// Breaks once every pass has broken.
+    type Result = ControlFlow<()>;
+
+    fn visit_translation_unit(&mut self, tu: &'a TranslationUnit) -> ControlFlow<()> {
+        if self.running == 0 {
+            return ControlFlow::Break(());
+        }
+        walk_translation_unit(self, tu)
+    }
+
+    fn visit_external_declaration(&mut self, d: &'a ExternalDeclaration) -> ControlFlow<()> {
+        self.node(Node::ExternalDeclaration(d), |v| walk_external_declaration(v, d))
+    }
+
+    fn visit_function_definition(&mut self, f: &'a FunctionDefinition) -> ControlFlow<()> {
+        self.node(Node::FunctionDefinition(f), |v| walk_function_definition(v, f))
+    }
+
+    fn visit_declaration(&mut self, d: &'a Declaration) -> ControlFlow<()> {
+        self.node(Node::Declaration(d), |v| walk_declaration(v, d))
+    }
+
+    fn visit_declarator(&mut self, d: &'a Declarator) -> ControlFlow<()> {
+        self.node(Node::Declarator(d), |v| walk_declarator(v, d))
+    }
+
+    fn visit_statement(&mut self, s: &'a Statement) -> ControlFlow<()> {
+        self.node(Node::Statement(s), |v| walk_statement(v, s))
+    }
+
+    fn visit_expression(&mut self, e: &'a Expression) -> ControlFlow<()> {
+        self.node(Node::Expression(e), |v| walk_expression(v, e))
+    }
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) -> ControlFlow<()> {
+        self.node(Node::PostfixExpression(p), |v| walk_postfix_expression(v, p))
+    }
+
+    fn visit_type_name(&mut self, tn: &'a TypeName) -> ControlFlow<()> {
+        self.node(Node::TypeName(tn), |v| walk_type_name(v, tn))
+    }
+}
+
 // ============================================================================
 // Mutable Visitor Trait
 // ============================================================================
@@ -1394,7 +1659,8 @@ pub fn walk_attribute_specifier<'a, V: Visitor<'a> + ?Sized>(v: &mut V, a: &'a A
 /// The mutable visitor trait for traversing and modifying C AST nodes.
 ///
 /// This trait is similar to [`Visitor`] but provides mutable access to AST
-/// nodes, allowing modifications during traversal.
+/// nodes, allowing modifications during traversal. Its walkers grow the stack
+/// in the same way, see [stack usage](Visitor#stack-usage).
 ///
 /// # Example
 ///
@@ -1489,6 +1755,17 @@ pub trait VisitorMut<'a> {
         Self::Result::output()
     }
 
+    /// Replaces a statement before it is walked, if this returns a
+    /// replacement.
+    ///
+    /// The replacement is not walked, so that one wrapping the statement does
+    /// not see it again. Move the parts of the statement into the replacement
+    /// with [`Statement::take`] and [`Expression::take`] instead of cloning
+    /// them.
+    fn replace_statement_mut(&mut self, _: &mut Statement) -> Option<Statement> {
+        None
+    }
+
     /// Visits a statement with mutable access.
     fn visit_statement_mut(&mut self, s: &'a mut Statement) -> Self::Result {
         walk_statement_mut(self, s)
@@ -1499,6 +1776,16 @@ pub trait VisitorMut<'a> {
         walk_unlabeled_statement_mut(self, s)
     }
 
+    /// Replaces an expression before it is walked, if this returns a
+    /// replacement.
+    ///
+    /// The replacement is not walked, so that one wrapping the expression does
+    /// not see it again. Move the subexpressions into the replacement with
+    /// [`Expression::take`] instead of cloning them.
+    fn replace_expression_mut(&mut self, _: &mut Expression) -> Option<Expression> {
+        None
+    }
+
     /// Visits an expression with mutable access.
     fn visit_expression_mut(&mut self, e: &'a mut Expression) -> Self::Result {
         walk_expression_mut(self, e)
@@ -1529,6 +1816,13 @@ pub trait VisitorMut<'a> {
         walk_braced_initializer_mut(self, b)
     }
 
+    /// Visits a braced initializer of constants with mutable access. Nothing
+    /// is visited inside it; replace the initializer with
+    /// [`ConstantInitializer::to_braced`] to visit its constants as expressions.
+    fn visit_constant_initializer_mut(&mut self, _: &'a mut ConstantInitializer) -> Self::Result {
+        Self::Result::output()
+    }
+
     /// Visits a designated initializer with mutable access.
     fn visit_designated_initializer_mut(&mut self, d: &'a mut DesignatedInitializer) -> Self::Result {
         walk_designated_initializer_mut(self, d)
@@ -1579,6 +1873,13 @@ pub trait VisitorMut<'a> {
         walk_compound_statement_mut(self, c)
     }
 
+    /// Replaces a block item before it is walked, if this returns a
+    /// replacement, which is not walked. See
+    /// [`replace_statement_mut`](VisitorMut::replace_statement_mut).
+    fn replace_block_item_mut(&mut self, _: &mut BlockItem) -> Option<BlockItem> {
+        None
+    }
+
     /// Visits a block item with mutable access.
     fn visit_block_item_mut(&mut self, b: &'a mut BlockItem) -> Self::Result {
         walk_block_item_mut(self, b)
@@ -1848,10 +2149,14 @@ pub fn walk_function_definition_mut<'a, V: VisitorMut<'a> + ?Sized>(
 
 /// Walk a statement with mutable access.
 pub fn walk_statement_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, s: &'a mut Statement) -> V::Result {
-    match &mut s.kind {
+    if let Some(replacement) = v.replace_statement_mut(s) {
+        *s = replacement;
+        return V::Result::output();
+    }
+    grow(move || match &mut s.kind {
         StatementKind::Labeled(ls) => v.visit_labeled_statement_mut(ls),
         StatementKind::Unlabeled(u) => v.visit_unlabeled_statement_mut(u),
-    }
+    })
 }
 
 /// Walk a labeled statement with mutable access.
@@ -1892,7 +2197,7 @@ pub fn walk_unlabeled_statement_mut<'a, V: VisitorMut<'a> + ?Sized>(
     v: &mut V,
     s: &'a mut UnlabeledStatement,
 ) -> V::Result {
-    match s {
+    grow(move || match s {
         UnlabeledStatement::Expression(es) => v.visit_expression_statement_mut(es),
         UnlabeledStatement::Primary { attributes, block } => {
             for attribute in attributes {
@@ -1906,7 +2211,7 @@ pub fn walk_unlabeled_statement_mut<'a, V: VisitorMut<'a> + ?Sized>(
             }
             v.visit_jump_statement_mut(statement)
         }
-    }
+    })
 }
 
 /// Walk an expression statement with mutable access.
@@ -1942,6 +2247,10 @@ pub fn walk_compound_statement_mut<'a, V: VisitorMut<'a> + ?Sized>(
 
 /// Walk a block item with mutable access.
 pub fn walk_block_item_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, b: &'a mut BlockItem) -> V::Result {
+    if let Some(replacement) = v.replace_block_item_mut(b) {
+        *b = replacement;
+        return V::Result::output();
+    }
     match b {
         BlockItem::Declaration(d) => v.visit_declaration_mut(d),
         BlockItem::Statement(u) => v.visit_unlabeled_statement_mut(u),
@@ -2024,7 +2333,11 @@ pub fn walk_jump_statement_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, j: &'a
 
 /// Walk an expression with mutable access.
 pub fn walk_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, e: &'a mut Expression) -> V::Result {
-    match &mut e.kind {
+    if let Some(replacement) = v.replace_expression_mut(e) {
+        *e = replacement;
+        return V::Result::output();
+    }
+    grow(move || match &mut e.kind {
         ExpressionKind::Postfix(p) => v.visit_postfix_expression_mut(p),
         ExpressionKind::Unary(u) => v.visit_unary_expression_mut(u),
         ExpressionKind::Cast(c) => v.visit_cast_expression_mut(c),
@@ -2033,7 +2346,7 @@ pub fn walk_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, e: &'a mut
         ExpressionKind::Assignment(a) => v.visit_assignment_expression_mut(a),
         ExpressionKind::Comma(c) => v.visit_comma_expression_mut(c),
         ExpressionKind::Error => V::Result::output(),
-    }
+    })
 }
 
 /// Walk a binary expression with mutable access.
@@ -2076,7 +2389,7 @@ pub fn walk_postfix_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(
     v: &mut V,
     p: &'a mut PostfixExpression,
 ) -> V::Result {
-    match p {
+    grow(move || match p {
         PostfixExpression::Primary(pr) => v.visit_primary_expression_mut(pr),
         PostfixExpression::ArrayAccess { array, index } => {
             tr!(v.visit_postfix_expression_mut(array));
@@ -2101,7 +2414,7 @@ pub fn walk_postfix_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(
             v.visit_postfix_expression_mut(inner)
         }
         PostfixExpression::CompoundLiteral(cl) => v.visit_compound_literal_mut(cl),
-    }
+    })
 }
 
 /// Walk a compound literal with mutable access.
@@ -2144,7 +2457,7 @@ pub fn walk_generic_selection_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, g:
 
 /// Walk a unary expression with mutable access.
 pub fn walk_unary_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, u: &'a mut UnaryExpression) -> V::Result {
-    match u {
+    grow(move || match u {
         UnaryExpression::Postfix(p) => v.visit_postfix_expression_mut(p),
         UnaryExpression::PreIncrement(inner) | UnaryExpression::PreDecrement(inner) => {
             v.visit_unary_expression_mut(inner)
@@ -2155,18 +2468,18 @@ pub fn walk_unary_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, u: &
         }
         UnaryExpression::Sizeof(inner) => v.visit_unary_expression_mut(inner),
         UnaryExpression::SizeofType(tn) | UnaryExpression::Alignof(tn) => v.visit_type_name_mut(tn),
-    }
+    })
 }
 
 /// Walk a cast expression with mutable access.
 pub fn walk_cast_expression_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, c: &'a mut CastExpression) -> V::Result {
-    match c {
+    grow(move || match c {
         CastExpression::Unary(u) => v.visit_unary_expression_mut(u),
         CastExpression::Cast { type_name, expression } => {
             tr!(v.visit_type_name_mut(type_name));
             v.visit_cast_expression_mut(expression)
         }
-    }
+    })
 }
 
 /// Walk a declaration with mutable access.
@@ -2325,7 +2638,7 @@ pub fn walk_member_declaration_mut<'a, V: VisitorMut<'a> + ?Sized>(
     md: &'a mut MemberDeclaration,
 ) -> V::Result {
     match md {
-        MemberDeclaration::Normal { attributes, specifiers, declarators } => {
+        MemberDeclaration::Normal { attributes, specifiers, declarators, .. } => {
             for attr in attributes {
                 tr!(v.visit_attribute_specifier_mut(attr));
             }
@@ -2446,7 +2759,7 @@ pub fn walk_pointer_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, p: &'a mut Po
 
 /// Walk a direct declarator with mutable access.
 pub fn walk_direct_declarator_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, d: &'a mut DirectDeclarator) -> V::Result {
-    match d {
+    grow(move || match d {
         DirectDeclarator::Identifier { identifier, attributes } => {
             tr!(v.visit_variable_name_mut(identifier));
             for attr in attributes {
@@ -2469,7 +2782,7 @@ pub fn walk_direct_declarator_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, d:
             }
             v.visit_parameter_type_list_mut(parameters)
         }
-    }
+    })
 }
 
 /// Walk an array declarator with mutable access.
@@ -2544,10 +2857,11 @@ pub fn walk_parameter_declaration_kind_mut<'a, V: VisitorMut<'a> + ?Sized>(
 
 /// Walk an initializer with mutable access.
 pub fn walk_initializer_mut<'a, V: VisitorMut<'a> + ?Sized>(v: &mut V, i: &'a mut Initializer) -> V::Result {
-    match i {
+    grow(move || match i {
         Initializer::Expression(e) => v.visit_expression_mut(e),
         Initializer::Braced(b) => v.visit_braced_initializer_mut(b),
-    }
+        Initializer::Constants(c) => v.visit_constant_initializer_mut(c),
+    })
 }
 
 /// Walk a braced initializer with mutable access.
@@ -2637,7 +2951,7 @@ pub fn walk_direct_abstract_declarator_mut<'a, V: VisitorMut<'a> + ?Sized>(
     v: &mut V,
     d: &'a mut DirectAbstractDeclarator,
 ) -> V::Result {
-    match d {
+    grow(move || match d {
         DirectAbstractDeclarator::Parenthesized(ad) => v.visit_abstract_declarator_mut(ad),
         DirectAbstractDeclarator::Array { declarator, attributes, array_declarator } => {
             if let Some(dd) = declarator {
@@ -2657,7 +2971,7 @@ pub fn walk_direct_abstract_declarator_mut<'a, V: VisitorMut<'a> + ?Sized>(
             }
             v.visit_parameter_type_list_mut(parameters)
         }
-    }
+    })
 }
 
 /// Walk an attribute specifier with mutable access.
@@ -2672,7 +2986,7 @@ pub fn walk_attribute_specifier_mut<'a, V: VisitorMut<'a> + ?Sized>(
             }
         }
         AttributeSpecifier::Asm(string_literals) => {
-            tr!(v.visit_asm_attribute_specifier_mut(string_literals));
+            tr!(v.visit_asm_attribute_specifier_mut(Arc::make_mut(string_literals)));
         }
         AttributeSpecifier::Error => {}
     }
@@ -0,0 +1,160 @@
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+    fmt::Write,
+};
+
+use cgrammar::*;
+
+/// Counts the allocations of each thread.
+struct CountingAllocator;
+
+thread_local! {
+    static ALLOCATIONS: Cell<u64> = const { Cell::new(0) };
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let _ = ALLOCATIONS.try_with(|count| count.set(count.get() + 1));
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+fn count_allocations<T>(f: impl FnOnce() -> T) -> (T, u64) {
+    let before = ALLOCATIONS.with(Cell::get);
+    let output = f();
+    (output, ALLOCATIONS.with(Cell::get) - before)
+}
+
+fn count_tokens(tokens: &BalancedTokenSequence) -> u64 {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| match &token.value {
+            BalancedToken::Parenthesized(inner) | BalancedToken::Bracketed(inner) | BalancedToken::Braced(inner) => {
+                1 + count_tokens(inner)
+            }
+            _ => 1,
+        })
+        .sum()
+}
+
+/// Declarations, statements and expressions in roughly the proportions of
+/// real preprocessed code.
+fn reference_corpus() -> String {
+    let mut source = String::new();
+    for i in 0..64 {
+        write!(
+            source,
+            r#"
+typedef struct node_{i} {{ int key; struct node_{i} *next; unsigned long flags[4]; }} node_{i}_t;
+enum color_{i} {{ RED_{i}, GREEN_{i} = 2, BLUE_{i} = GREEN_{i} << 1 }};
+static const char *name_{i} = "node";
+static int lookup_{i}(node_{i}_t *head, int key) {{
+    for (node_{i}_t *n = head; n != 0; n = n->next) {{
+        if (n->key == key && (n->flags[0] & 0x1u) != 0)
+            return n->key * 3 + BLUE_{i};
+    }}
+    switch (key) {{
+    case RED_{i}:
+        return -1;
+    default:
+        break;
+    }}
+    return (int)(sizeof(node_{i}_t) / sizeof(int));
+}}
+"#
+        )
+        .unwrap();
+    }
+    source
+}
+
+/// A visitor that only walks the tree.
+struct NoopVisitor;
+
+impl<'a> Visitor<'a> for NoopVisitor {
+    type Result = ();
+}
+
+// Budgets in allocations per token. They are upper bounds to catch changes
+// that allocate much more per token, e.g. per token copies; lower them as
+// allocations are removed. `benches/allocations.rs` reports the counts.
+const LEX_BUDGET: f64 = 1.0;
+const PARSE_BUDGET: f64 = 20.0;
+// Once the pool is warm, lexing the same source again reuses its buffers.
+const POOLED_LEX_BUDGET: f64 = 0.01;
+
+#[test]
+fn test_allocation_budget() {
+    let source = reference_corpus();
+    let ((tokens, _), lex_allocations) = count_allocations(|| lex(&source, None));
+    let token_count = count_tokens(&tokens) as f64;
+    let per_token = lex_allocations as f64 / token_count;
+    assert!(
+        per_token <= LEX_BUDGET,
+        "lexing allocates {per_token:.3} times per token"
+    );
+
+    let parser = translation_unit();
+    let (unit, parse_allocations) = count_allocations(|| parser.parse(tokens.as_input()).into_output());
+    let unit = unit.unwrap();
+    let per_token = parse_allocations as f64 / token_count;
+    assert!(
+        per_token <= PARSE_BUDGET,
+        "parsing allocates {per_token:.3} times per token"
+    );
+
+    let ((), visit_allocations) = count_allocations(|| NoopVisitor.visit_translation_unit(&unit));
+    assert_eq!(visit_allocations, 0, "walking the tree allocates");
+}
+
+#[test]
+fn test_pooled_lexing() {
+    let source = reference_corpus();
+    let (expected, _) = lex(&source, None);
+    let token_count = count_tokens(&expected) as f64;
+
+    let mut pool = TokenPool::new();
+    for _ in 0..2 {
+        let (tokens, _) = pool.lex(&source, None);
+        assert_eq!(tokens, expected);
+        pool.recycle(tokens);
+    }
+    assert!(!pool.is_empty());
+
+    let ((tokens, _), allocations) = count_allocations(|| pool.lex(&source, None));
+    assert_eq!(tokens, expected);
+    let per_token = allocations as f64 / token_count;
+    assert!(
+        per_token <= POOLED_LEX_BUDGET,
+        "lexing with a warm pool allocates {per_token:.3} times per token"
+    );
+}
+
+// The sizes of the types stored in the largest vectors of tokens and trees,
+// to catch a variant that makes every value larger; update them as the types
+// shrink. `benches/allocations.rs` reports the sizes.
+#[cfg(target_pointer_width = "64")]
+#[test]
+fn test_node_sizes() {
+    assert_eq!(size_of::<IntegerConstant>(), 24);
+    assert_eq!(size_of::<Constant>(), 32);
+    assert_eq!(align_of::<BalancedToken>(), 8);
+    assert_eq!(size_of::<span::Spanned<BalancedToken>>(), 40);
+    assert_eq!(size_of::<TypeSpecifier>(), 16);
+    assert_eq!(size_of::<DeclarationSpecifier>(), 24);
+    assert_eq!(size_of::<Expression>(), 56);
+}
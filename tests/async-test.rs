@@ -0,0 +1,64 @@
+#![cfg(feature = "async")]
+
+use std::{
+    io,
+    pin::Pin,
+    task::{Context, Poll},
+};
+
+use cgrammar::*;
+use futures::{AsyncRead, executor::block_on_stream};
+use rstest::rstest;
+
+/// A reader returning at most `len` bytes at a time.
+struct Trickle<'a> {
+    data: &'a [u8],
+    len: usize,
+}
+
+impl AsyncRead for Trickle<'_> {
+    fn poll_read(mut self: Pin<&mut Self>, _cx: &mut Context<'_>, buf: &mut [u8]) -> Poll<io::Result<usize>> {
+        let len = self.len.min(buf.len()).min(self.data.len());
+        buf[..len].copy_from_slice(&self.data[..len]);
+        self.data = &self.data[len..];
+        Poll::Ready(Ok(len))
+    }
+}
+
+#[rstest]
+#[case("typedef int T;\nT f(T x) {\n    return x;\n}\nenum E { A, B };\nint g(void) { T y = A; return y * B; }\n")]
+#[case(
+    "# 1 \"a.h\"\nint old(a)\nint a;\n{ return a; }\n/* a comment\nspanning lines */\nchar *s = \"\u{e9}t\u{e9}\";\n"
+)]
+#[case("int a = (1 1);\nint b;\n")]
+#[case("")]
+fn test_parse_async(#[case] source: &str, #[values(1, 5, 1 << 20)] len: usize) {
+    // Enough copies that the source is handed over in more than one chunk
+    let source = source.repeat(2000);
+    let (tokens, _) = lex(&source, Some("input.c"));
+    let mut expected_state = State::new();
+    let expected: Vec<_> = (parse_iter(&tokens, &mut expected_state))
+        .map(|result| result.map_err(|errors| errors.len()))
+        .collect();
+
+    let reader = Trickle { data: source.as_bytes(), len };
+    let mut stream = parse_async(reader, Some("input.c"), State::new());
+    let results: Vec<_> = block_on_stream(&mut stream)
+        .map(|result| result.unwrap().map_err(|errors| errors.len()))
+        .collect();
+    assert_eq!(results, expected);
+    assert_eq!(stream.source(), Some(source.as_str()));
+    let name = Identifier::from("T");
+    assert_eq!(
+        stream.state().unwrap().ctx().is_typedef_name(&name),
+        expected_state.ctx().is_typedef_name(&name)
+    );
+}
+
+#[test]
+fn test_parse_async_invalid_utf8() {
+    let reader = Trickle { data: b"int a;\nint \xff;\n", len: 3 };
+    let results: Vec<_> = block_on_stream(parse_async(reader, None, State::new())).collect();
+    let error = results.last().unwrap().as_ref().unwrap_err();
+    assert_eq!(error.kind(), io::ErrorKind::InvalidData);
+}
@@ -0,0 +1,201 @@
+use cgrammar::*;
+
+fn attributes(unit: &TranslationUnit) -> impl Iterator<Item = &Attribute> {
+    unit.external_declarations
+        .iter()
+        .filter_map(|decl| match decl {
+            ExternalDeclaration::Declaration(decl) => match &decl.kind {
+                DeclarationKind::Attribute(attrs) => Some(attrs),
+                _ => None,
+            },
+            _ => None,
+        })
+        .flatten()
+        .filter_map(|attr| match attr {
+            AttributeSpecifier::Attributes(attrs) => Some(attrs),
+            _ => None,
+        })
+        .flatten()
+}
+
+fn gl_state() -> State {
+    let mut parsers = AttributeParsers::new();
+    parsers.register(Some("cst"), "gl", |tokens, state| {
+        statement().parse_with_state(tokens, state)
+    });
+    parsers.register(None, "count", |tokens, state| {
+        expression().parse_with_state(tokens, state)
+    });
+    let mut state = State::new();
+    state.set_attribute_parsers(Some(parsers));
+    state
+}
+
+#[test]
+fn test_attribute_parsers() {
+    let source = "typedef int term;\n[[cst::gl((term) -1;), count(2 + 3), other(a b c)]];";
+    let (tokens, _) = lex(source, None);
+    let mut state = gl_state();
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(errors.is_empty(), "{errors:?}");
+    let unit = unit.unwrap();
+
+    let attrs: Vec<_> = attributes(&unit).collect();
+    assert_eq!(attrs.len(), 3);
+    // The arguments were parsed with the names declared before them
+    let gl = attrs[0].value.as_ref().unwrap().downcast_ref::<Statement>().unwrap();
+    let StatementKind::Unlabeled(UnlabeledStatement::Expression(ExpressionStatement { expression, .. })) = &gl.kind
+    else {
+        panic!("not an expression statement: {gl:?}");
+    };
+    assert!(matches!(
+        expression.as_deref().map(|e| &e.kind),
+        Some(ExpressionKind::Cast(_))
+    ));
+    assert!(attrs[1].value.as_ref().unwrap().downcast_ref::<Expression>().is_some());
+    assert!(attrs[2].value.is_none());
+    assert!(attrs[2].arguments.is_some());
+    // Values are shared by clones and compare by contents
+    assert_eq!(unit.clone(), unit);
+}
+
+#[test]
+fn test_attribute_parser_errors() {
+    let (tokens, _) = lex("[[count(1 +)]];\nint x;", None);
+    let mut state = gl_state();
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    // An error in the arguments is reported, and the rest of the unit parsed
+    assert!(!errors.is_empty());
+    let unit = unit.unwrap();
+    assert_eq!(unit.external_declarations.len(), 2);
+    assert!(attributes(&unit).next().unwrap().value.is_none());
+
+    // Without parsers the arguments are only kept as tokens
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut State::new())
+        .into_output_errors();
+    assert!(errors.is_empty());
+    assert!(attributes(&unit.unwrap()).next().unwrap().value.is_none());
+}
+
+#[test]
+fn test_attribute_arguments_shared() {
+    let mut state = State::new();
+    for source in ["[[other(a b c)]];", "int x;\n[[other(d), more(e f)]];"] {
+        let (tokens, _) = lex(source, None);
+        let unit = translation_unit()
+            .parse_with_state(tokens.as_input(), &mut state)
+            .into_output()
+            .unwrap();
+
+        // The arguments are the groups of the input, also when the state was
+        // used for another input before
+        let groups = tokens.tokens.iter().filter_map(|token| match &token.value {
+            BalancedToken::Bracketed(outer) => match &outer.tokens[0].value {
+                BalancedToken::Bracketed(inner) => Some(inner),
+                _ => None,
+            },
+            _ => None,
+        });
+        let groups: Vec<_> = groups
+            .flat_map(|inner| &inner.tokens)
+            .filter_map(|token| match &token.value {
+                BalancedToken::Parenthesized(group) => Some(group),
+                _ => None,
+            })
+            .collect();
+        let arguments: Vec<_> = attributes(&unit).map(|attr| attr.arguments.as_ref().unwrap()).collect();
+        assert_eq!(arguments.len(), groups.len());
+        assert!((arguments.iter().zip(&groups)).all(|(arguments, group)| std::sync::Arc::ptr_eq(arguments, group)));
+    }
+}
+
+#[test]
+fn test_asm_labels() {
+    struct Labels<'a>(Vec<&'a std::sync::Arc<StringLiterals>>);
+
+    impl<'a> visitor::Visitor<'a> for Labels<'a> {
+        type Result = ();
+
+        fn visit_attribute_specifier(&mut self, a: &'a AttributeSpecifier) {
+            if let AttributeSpecifier::Asm(label) = a {
+                self.0.push(label);
+            }
+        }
+    }
+
+    let (tokens, _) = lex(r#"int f(int) __asm__("_f" "_impl"); int g(void) __asm("_g");"#, None);
+    let unit = translation_unit().parse(tokens.as_input()).unwrap();
+    let copy = unit.clone();
+    let mut labels = Labels(Vec::new());
+    visitor::Visitor::visit_translation_unit(&mut labels, &unit);
+    let mut copies = Labels(Vec::new());
+    visitor::Visitor::visit_translation_unit(&mut copies, &copy);
+
+    let values: Vec<_> = labels.0.iter().map(|label| label.to_joined()).collect();
+    assert_eq!(values, ["_f_impl", "_g"]);
+    // Cloning the tree shares the strings rather than copying them
+    assert_eq!(copies.0.len(), 2);
+    assert!((labels.0.iter().zip(&copies.0)).all(|(label, copy)| std::sync::Arc::ptr_eq(label, copy)));
+    // Nor from the tokens, for a state used before on another input
+    let mut state = State::new();
+    translation_unit()
+        .parse_with_state(lex(r#"int h(void) __asm__("_h");"#, None).0.as_input(), &mut state)
+        .unwrap();
+    let unit = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .unwrap();
+    let strings: Vec<_> = (tokens.tokens.iter())
+        .filter_map(|token| match &token.value {
+            BalancedToken::Parenthesized(group) => match &group.tokens[0].value {
+                BalancedToken::StringLiteral(string) => Some(string),
+                _ => None,
+            },
+            _ => None,
+        })
+        .collect();
+    let mut labels = Labels(Vec::new());
+    visitor::Visitor::visit_translation_unit(&mut labels, &unit);
+    assert_eq!(labels.0.len(), strings.len());
+    assert!((labels.0.iter().zip(&strings)).all(|(label, string)| std::sync::Arc::ptr_eq(label, string)));
+}
+
+#[test]
+fn test_dialects() {
+    let (gnu, _) = lex("int f(void) __attribute__((noreturn)) __asm__(\"_f\");", None);
+    let (standard, _) = lex("[[noreturn]] void g(void);", None);
+
+    let parser = with_dialect(Dialect::Gnu, translation_unit);
+    assert!(!parser.parse(gnu.as_input()).has_errors());
+    assert!(!parser.parse(standard.as_input()).has_errors());
+
+    // The GNU specifiers are not alternatives of the C23 grammar
+    let parser = with_dialect(Dialect::C23, translation_unit);
+    assert!(parser.parse(gnu.as_input()).has_errors());
+    assert!(!parser.parse(standard.as_input()).has_errors());
+
+    // Building for a dialect leaves the default one in place
+    assert_eq!(Dialect::current(), Dialect::default());
+    assert!(!translation_unit().parse(gnu.as_input()).has_errors());
+}
+
+#[test]
+fn test_dialects_in_workers() {
+    let source = "int a; int f(void) __attribute__((noreturn)); int b;";
+    let (tokens, _) = lex(source, None);
+
+    // The workers build their parsers in the dialect of the caller
+    let (_, errors) = with_dialect(Dialect::C23, || parse_parallel(&tokens, &mut State::new()));
+    assert!(!errors.is_empty());
+    let (_, errors) = with_dialect(Dialect::Gnu, || parse_parallel(&tokens, &mut State::new()));
+    assert!(errors.is_empty());
+
+    let units = with_dialect(Dialect::C23, || parse_many(&[(source, None)], &State::new()));
+    assert!(units[0].has_errors());
+    let units = with_dialect(Dialect::Gnu, || parse_many(&[(source, None)], &State::new()));
+    assert!(!units[0].has_errors());
+}
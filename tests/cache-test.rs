@@ -0,0 +1,73 @@
+#![cfg(all(feature = "serde", feature = "mmap"))]
+
+use std::path::PathBuf;
+
+use cgrammar::*;
+
+fn cache_dir(name: &str) -> PathBuf {
+    let dir = std::env::temp_dir().join(format!("cgrammar-{name}-{}", std::process::id()));
+    let _ = std::fs::remove_dir_all(&dir);
+    dir
+}
+
+#[test]
+fn test_cache_hit() {
+    let dir = cache_dir("cache-hit");
+    let cache = ParseCache::open(&dir, u64::MAX).unwrap();
+    let source = "typedef int T;\nT f(T x) { return (T)x * 2; }\n";
+
+    let parsed = cache.parse(source, Some("a.c"), &State::new());
+    assert!(!parsed.has_errors());
+    assert_eq!(
+        cache.stats(),
+        CacheStats {
+            hits: 0,
+            misses: 1,
+            stores: 1,
+            evictions: 0
+        }
+    );
+
+    let cached = cache.parse(source, Some("a.c"), &State::new());
+    assert_eq!(cached.output, parsed.output);
+    assert_eq!(cache.stats().hits, 1);
+
+    // The filename and initial typedef names are part of the key
+    cache.parse(source, Some("b.c"), &State::new());
+    let mut state = State::new();
+    state.ctx_mut().add_typedef_names([Identifier::from("U")]);
+    cache.parse(source, Some("a.c"), &state);
+    assert_eq!(
+        cache.stats(),
+        CacheStats {
+            hits: 1,
+            misses: 3,
+            stores: 3,
+            evictions: 0
+        }
+    );
+
+    // Units with errors are not stored
+    cache.parse("int x = ;", None, &State::new());
+    cache.parse("int x = ;", None, &State::new());
+    assert_eq!(cache.stats().stores, 3);
+    std::fs::remove_dir_all(&dir).unwrap();
+}
+
+#[test]
+fn test_cache_eviction() {
+    let dir = cache_dir("cache-eviction");
+    let cache = ParseCache::open(&dir, 1).unwrap();
+    cache.parse("int a;", None, &State::new());
+    cache.parse("int b;", None, &State::new());
+    let stats = cache.stats();
+    assert_eq!(stats.stores, 2);
+    assert_eq!(stats.evictions, 2);
+    assert!(cache.get("int b;", None, &State::new()).is_none());
+
+    // A new cache counts the files already in the directory
+    let cache = ParseCache::open(&dir, u64::MAX).unwrap();
+    cache.parse("int c;", None, &State::new());
+    assert!(cache.get("int c;", None, &State::new()).is_some());
+    std::fs::remove_dir_all(&dir).unwrap();
+}
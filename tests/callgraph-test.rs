@@ -0,0 +1,69 @@
+use cgrammar::{
+    callgraph::{CallGraph, FunctionId},
+    *,
+};
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+fn id(graph: &CallGraph, name: &str) -> FunctionId {
+    graph.id(Symbol::from(name)).unwrap()
+}
+
+/// The names of the callees of `name`, sorted by id.
+fn callees(graph: &CallGraph, name: &str) -> Vec<String> {
+    (graph.callees(id(graph, name)).iter())
+        .map(|&callee| graph.name(callee).to_string())
+        .collect()
+}
+
+#[test]
+fn test_calls() {
+    let unit = parse_c(
+        "int g(int);\nint f(int x) { return g(x) + (g)(x) + h(g(1)); }\nint h(int x) { int (*p)(int) = g; return p(x) + f(x); }\nint k(int (*cb)(int)) { return cb(1) + (*cb)(2); }",
+    );
+    let graph = CallGraph::from_unit(&unit);
+    assert_eq!(callees(&graph, "f"), ["g", "h"]);
+    assert_eq!(callees(&graph, "h"), ["f"]);
+    assert!(callees(&graph, "k").is_empty());
+    assert_eq!(graph.edges(), 3);
+
+    // Calls of locals and parameters are unresolved
+    assert_eq!(graph.indirect_calls(id(&graph, "f")), 0);
+    assert_eq!(graph.indirect_calls(id(&graph, "h")), 1);
+    assert_eq!(graph.indirect_calls(id(&graph, "k")), 2);
+
+    assert!(graph.is_defined(id(&graph, "f")));
+    assert!(!graph.is_defined(id(&graph, "g")));
+    assert_eq!(graph.len(), 4);
+}
+
+#[test]
+fn test_merge() {
+    let first = parse_c("void helper(void);\nint main(void) { helper(); return 0; }\nvoid unused(void) { helper(); }");
+    let second = parse_c("void log(void);\nvoid helper(void) { log(); }\nvoid other(void) { }");
+    let mut graph = CallGraph::from_unit(&first);
+    let main = id(&graph, "main");
+    graph.merge(&CallGraph::from_unit(&second));
+
+    // Functions of the first graph keep their ids
+    assert_eq!(id(&graph, "main"), main);
+    assert!(graph.is_defined(id(&graph, "helper")));
+    assert!(!graph.is_defined(id(&graph, "log")));
+    assert_eq!(callees(&graph, "helper"), ["log"]);
+    assert_eq!(graph.edges(), 3);
+
+    let reachable = graph.reachable([main]);
+    let names: Vec<_> = (graph.functions())
+        .filter(|f| reachable[f.index()])
+        .map(|f| graph.name(f).to_string())
+        .collect();
+    assert_eq!(names, ["main", "helper", "log"]);
+
+    // Merging is the same as building from both units at once
+    let mut empty = CallGraph::new();
+    empty.merge(&graph);
+    assert_eq!(empty, graph);
+}
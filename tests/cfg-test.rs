@@ -0,0 +1,112 @@
+use cgrammar::{
+    cfg::{BlockId, Cfg, EdgeKind, Element, build_all},
+    *,
+};
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+fn function(unit: &TranslationUnit) -> &FunctionDefinition {
+    match &unit.external_declarations[0] {
+        ExternalDeclaration::Function(f) => f,
+        _ => unreachable!(),
+    }
+}
+
+/// The kinds of the edges from `block`, in order.
+fn kinds(cfg: &Cfg, block: BlockId) -> Vec<EdgeKind> {
+    cfg.successors(block).iter().map(|edge| edge.kind).collect()
+}
+
+#[test]
+fn test_if_else() {
+    let unit = parse_c("int f(int x) { int y = 0; if (x) y = 1; else y = 2; return y; }");
+    let cfg = Cfg::new(function(&unit));
+    let entry = cfg.elements(Cfg::ENTRY);
+    assert!(matches!(entry, [Element::Declaration(_), Element::Expression(_)]));
+    assert_eq!(kinds(&cfg, Cfg::ENTRY), [EdgeKind::True, EdgeKind::False]);
+
+    // Both branches join before the return, and the end of the body after it
+    // is unreachable
+    let reachable = cfg.reachable();
+    let returns: Vec<_> = (cfg.predecessors(Cfg::EXIT).iter())
+        .filter(|edge| reachable[edge.block.index()])
+        .collect();
+    assert_eq!(returns.len(), 1);
+    assert_eq!(cfg.predecessors(returns[0].block).len(), 2);
+    assert_eq!(reachable.iter().filter(|&&reachable| !reachable).count(), 1);
+}
+
+#[test]
+fn test_loops() {
+    let unit = parse_c("void f(int a, int b) { while (a) { if (b) break; if (b > 1) continue; a--; } for (;;) { } }");
+    let cfg = Cfg::new(function(&unit));
+    // The head of the `while` is entered from the entry, a `continue` and
+    // the end of the body
+    let head = cfg.successors(Cfg::ENTRY)[0].block;
+    assert_eq!(kinds(&cfg, head), [EdgeKind::False, EdgeKind::True]);
+    assert_eq!(cfg.predecessors(head).len(), 3);
+
+    // A `for` without a condition never exits
+    let reachable = cfg.reachable();
+    assert!(!reachable[Cfg::EXIT.index()]);
+}
+
+#[test]
+fn test_do_while() {
+    let unit = parse_c("void f(int a) { do { a--; } while (a); }");
+    let cfg = Cfg::new(function(&unit));
+    let body = cfg.successors(Cfg::ENTRY)[0].block;
+    let tail = cfg.successors(body)[0].block;
+    assert_eq!(kinds(&cfg, tail), [EdgeKind::True, EdgeKind::False]);
+    assert_eq!(cfg.successors(tail)[0].block, body);
+    assert!(cfg.reachable()[Cfg::EXIT.index()]);
+}
+
+#[test]
+fn test_switch() {
+    let unit = parse_c("void f(int x) { switch (x) { case 1: a(); case 2: b(); break; default: c(); } d(); }");
+    let cfg = Cfg::new(function(&unit));
+    assert_eq!(
+        kinds(&cfg, Cfg::ENTRY),
+        [EdgeKind::Case, EdgeKind::Case, EdgeKind::Default]
+    );
+    // `case 1` falls through to `case 2`
+    let case_2 = cfg.successors(Cfg::ENTRY)[1].block;
+    assert_eq!(cfg.predecessors(case_2).len(), 2);
+
+    let unit = parse_c("void f(int x) { switch (x) { case 1: a(); } }");
+    let cfg = Cfg::new(function(&unit));
+    assert_eq!(kinds(&cfg, Cfg::ENTRY), [EdgeKind::Case, EdgeKind::Default]);
+}
+
+#[test]
+fn test_goto() {
+    let unit = parse_c("void f(void) { goto end; again: f(); end: goto again; goto missing; }");
+    let cfg = Cfg::new(function(&unit));
+    let end = cfg.label(Symbol::from("end")).unwrap();
+    let again = cfg.label(Symbol::from("again")).unwrap();
+    assert_eq!(cfg.successors(Cfg::ENTRY)[0].block, end);
+    assert!(cfg.successors(end).iter().any(|edge| edge.block == again));
+    let unresolved: Vec<_> = cfg
+        .unresolved_gotos()
+        .iter()
+        .map(|(_, label)| label.to_string())
+        .collect();
+    assert_eq!(unresolved, ["missing"]);
+}
+
+#[test]
+fn test_build_all() {
+    let unit = parse_c("int a(void) { return 1; }\nint x;\nint b(int y) { return y; }\nint c(void) { }");
+    let cfgs = build_all(&unit);
+    let names: Vec<_> = (cfgs.iter())
+        .map(|(f, _)| f.declarator.identifier().unwrap().to_string())
+        .collect();
+    assert_eq!(names, ["a", "b", "c"]);
+    for (f, cfg) in &cfgs {
+        assert_eq!(*cfg, Cfg::new(f));
+    }
+}
@@ -0,0 +1,44 @@
+use cgrammar::{clones::CloneIndex, *};
+
+const ORIGINAL: &str = "int sum(int *values, int n) { int total = 0; for (int i = 0; i < n; i++) { if (values[i] > 0) \
+                        total += values[i] * 2; else total -= 1; } return total; }";
+
+/// `ORIGINAL` with other names and constants.
+const RENAMED: &str = "int add_up(int *xs, int len) { int acc = 1; for (int j = 3; j < len; j++) { if (xs[j] > 7) \
+                       acc += xs[j] * 5; else acc -= 9; } return acc; }";
+
+const UNRELATED: &str = "struct point { double x, y; }; static double norm(struct point p) { while (p.x < p.y) \
+                         { p.x = p.x * p.x + p.y; } switch ((int) p.y) { case 1: return p.x; default: return -p.y; } }";
+
+#[test]
+fn test_clone_pairs() {
+    let index = CloneIndex::from_sources(&[(ORIGINAL, None), (UNRELATED, None), (RENAMED, None)]);
+    assert_eq!(index.units(), 3);
+    let pairs = index.clone_pairs(0.9);
+    assert_eq!(pairs.len(), 1);
+    let pair = pairs[0];
+    assert_eq!((pair.first.unit, pair.second.unit), (0, 2));
+    assert_eq!(pair.similarity, 1.0);
+    assert_eq!(pair.first.span.range(), 0..ORIGINAL.len());
+}
+
+#[test]
+fn test_clone_pairs_of_tokens() {
+    let third = format!("int before; {ORIGINAL}");
+    let units: Vec<_> = [ORIGINAL, UNRELATED, third.as_str()]
+        .iter()
+        .map(|source| lex(source, None).0)
+        .collect();
+    let mut index = CloneIndex::default();
+    index.add_units(&units.iter().collect::<Vec<_>>());
+    let pairs = index.clone_pairs(0.9);
+    assert_eq!(pairs.len(), 1);
+    assert_eq!((pairs[0].first.unit, pairs[0].second.unit), (0, 2));
+    // Each top-level declaration is fingerprinted on its own
+    assert_eq!(pairs[0].second.span.range().start, "int before; ".len());
+
+    // Short declarations have no fingerprints
+    let mut index = CloneIndex::new(32, 4);
+    assert_eq!(index.add_unit(&lex("int a; int b;", None).0), 0);
+    assert_eq!(index.declarations(), 0);
+}
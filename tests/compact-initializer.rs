@@ -0,0 +1,60 @@
+use cgrammar::*;
+
+fn parse(code: &str, compact: bool) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_compact_initializers(compact);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    assert!(!result.has_errors(), "{:?}", result.errors().collect::<Vec<_>>());
+    result.into_output().unwrap()
+}
+
+fn initializers(unit: &TranslationUnit) -> Vec<&Initializer> {
+    let mut initializers = Vec::new();
+    for d in &unit.external_declarations {
+        if let ExternalDeclaration::Declaration(Declaration {
+            kind: DeclarationKind::Normal { declarators, .. },
+            ..
+        }) = d
+        {
+            initializers.extend(declarators.iter().filter_map(|d| d.initializer.as_ref()));
+        }
+    }
+    initializers
+}
+
+#[test]
+fn test_compact_initializer() {
+    let code = "unsigned char t[] = { 0x12, 0x34, 'a', 1.5f, true, };";
+    let eager = parse(code, false);
+    let compact = parse(code, true);
+
+    let (eager, compact) = (initializers(&eager), initializers(&compact));
+    let [Initializer::Braced(braced)] = eager[..] else {
+        panic!("expected a braced initializer");
+    };
+    let [Initializer::Constants(constants)] = compact[..] else {
+        panic!("expected a constant initializer");
+    };
+    assert_eq!(constants.constants.len(), 5);
+    // Expanding the constants gives the tree of the eager parse, spans included
+    assert_eq!(&constants.to_braced(), braced);
+}
+
+#[test]
+fn test_compact_initializer_mixed() {
+    let code = "int a[] = { 1, x }; int b[][2] = { { 1, 2 }, { 3 } }; int c[] = {};";
+    let compact = parse(code, true);
+    let initializers = initializers(&compact);
+    assert!(matches!(initializers[0], Initializer::Braced(_)));
+    let Initializer::Braced(nested) = initializers[1] else {
+        panic!("expected a braced initializer");
+    };
+    assert!(
+        nested
+            .initializers
+            .iter()
+            .all(|d| matches!(d.initializer, Initializer::Constants(_)))
+    );
+    assert!(matches!(initializers[2], Initializer::Braced(_)));
+}
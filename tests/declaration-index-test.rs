@@ -0,0 +1,121 @@
+use cgrammar::{index::DeclaredKind::*, *};
+
+const SOURCE: &str = "
+typedef int T;
+struct S { int m, *n; };
+enum E { A, B = 2 };
+int f(int p) { int x; { T y; } return p; }
+int (*fp)(void), *g(void);
+";
+
+fn declarations(code: &str, memoize: bool) -> Vec<(String, index::DeclaredKind, u32)> {
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_memoize(memoize);
+    state.set_declaration_index(true);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    assert!(!result.has_errors());
+    let index = state.declaration_index().unwrap();
+    for declared in index.iter() {
+        assert_eq!(&code[declared.span.range()], declared.name.as_str());
+    }
+    index
+        .iter()
+        .map(|declared| (declared.name.to_string(), declared.kind, declared.depth))
+        .collect()
+}
+
+#[test]
+fn test_declaration_index() {
+    let expected = [
+        ("T", Typedef, 0),
+        ("m", Member, 0),
+        ("n", Member, 0),
+        ("S", Tag, 0),
+        ("A", Enumerator, 0),
+        ("B", Enumerator, 0),
+        ("E", Tag, 0),
+        ("f", Function, 0),
+        ("p", Object, 1),
+        ("x", Object, 1),
+        ("y", Object, 2),
+        ("fp", Object, 0),
+        ("g", Function, 0),
+    ]
+    .map(|(name, kind, depth)| (name.to_string(), kind, depth));
+    for memoize in [false, true] {
+        assert_eq!(declarations(SOURCE, memoize), expected, "memoize: {memoize}");
+    }
+}
+
+#[test]
+fn test_declaration_index_lookup() {
+    let (tokens, _) = lex(SOURCE, None);
+    let mut state = State::new();
+    state.set_declaration_index(true);
+    translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    let index = state.take_declaration_index().unwrap();
+    assert_eq!(index.len(), 13);
+    assert_eq!(
+        index
+            .lookup("f".into())
+            .map(|declared| declared.kind)
+            .collect::<Vec<_>>(),
+        [Function]
+    );
+    assert_eq!(
+        index
+            .of_kind(Tag)
+            .map(|declared| declared.name.as_str())
+            .collect::<Vec<_>>(),
+        ["S", "E"]
+    );
+    assert!(state.declaration_index().unwrap().is_empty());
+}
+
+#[test]
+fn test_dependency_graph() {
+    const SOURCE: &str = "
+typedef int T;
+typedef T U;
+enum E { A, B };
+int f(U u) { return (T) B; }
+int x;
+";
+    let (tokens, _) = lex(SOURCE, None);
+    for memoize in [false, true] {
+        let mut state = State::new();
+        state.set_memoize(memoize);
+        state.set_dependency_graph(true);
+        let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+        assert!(!result.has_errors());
+        let graph = state.take_dependency_graph().unwrap();
+        assert_eq!(graph.len(), 5);
+
+        let names = |names: &[Symbol]| names.iter().map(|name| name.to_string()).collect::<Vec<_>>();
+        let bound: Vec<_> = (graph.iter())
+            .map(|d| (names(&d.typedef_names), names(&d.enum_constants)))
+            .collect();
+        let none = Vec::new;
+        assert_eq!(
+            bound,
+            [
+                (vec!["T".to_string()], none()),
+                (vec!["U".to_string()], none()),
+                (none(), vec!["A".to_string(), "B".to_string()]),
+                (none(), none()),
+                (none(), none()),
+            ]
+        );
+        let consumed = |i: usize, name: &str| graph.get(i).unwrap().consumed.contains(&name.into());
+        assert!(consumed(1, "T") && consumed(3, "U") && consumed(3, "T") && consumed(3, "B"));
+        assert!(!consumed(4, "T") && !consumed(2, "T"));
+        assert!(graph.consumers("U".into()).any(|i| i == 3));
+
+        // Declarations of `T` change the parse of `U`, and so of `f`
+        let affected = graph.affected(["T".into()]);
+        assert!(affected.contains(&1) && affected.contains(&3), "{affected:?}");
+        assert!(!affected.contains(&2) && !affected.contains(&4), "{affected:?}");
+        assert!(!graph.affected(["A".into()]).contains(&3));
+    }
+}
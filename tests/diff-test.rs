@@ -0,0 +1,56 @@
+use cgrammar::{diff::*, *};
+use rstest::rstest;
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    let parser = translation_unit();
+    let result = parser.parse(tokens.as_input());
+    result.output().unwrap().clone()
+}
+
+/// A compact form of an edit script, e.g. `-1 +2 f1:1[+1]`.
+fn describe(edits: &[Edit]) -> String {
+    let described: Vec<_> = (edits.iter())
+        .map(|edit| match edit {
+            Edit::Delete { index, .. } => format!("-{index}"),
+            Edit::Insert { index, .. } => format!("+{index}"),
+            Edit::Body { old_index, new_index, edits, .. } => {
+                format!("f{old_index}:{new_index}[{}]", describe(edits))
+            }
+        })
+        .collect();
+    described.join(" ")
+}
+
+#[rstest]
+#[case("int a; int b;", "int a; int b;", "")]
+#[case("int a;\nint b;", "int   a;   int b;", "")]
+#[case("int a; int b;", "int a; int c; int b;", "+1")]
+#[case("int a; int b; int c;", "int a; int c;", "-1")]
+#[case("int a; int b;", "int c; int d;", "-0 -1 +0 +1")]
+#[case(
+    "int a; int f(int x) { int y = x; return y; } int b;",
+    "int a; int f(int x) { int y = x; y++; return y; } int c;",
+    "f1:1[+1] -2 +2"
+)]
+#[case(
+    "int f(void) { return 1; } int g(void) { return 2; }",
+    "int g(void) { return 3; } int f(void) { return 1; }",
+    "f1:0[-0 +0]"
+)]
+#[case("int f(void) { return 1; }", "long f(void) { return 1; }", "-0 +0")]
+fn test_diff_units(#[case] old: &str, #[case] new: &str, #[case] expected: &str) {
+    let (old, new) = (parse_c(old), parse_c(new));
+    assert_eq!(describe(&diff_units(&old, &new)), expected);
+}
+
+#[test]
+fn test_diff_spans() {
+    let (old, new) = (parse_c("int a; int b;"), parse_c("int a; int bb;"));
+    let edits = diff_units(&old, &new);
+    let [Edit::Delete { item: deleted, .. }, Edit::Insert { item: inserted, .. }] = &edits[..] else {
+        panic!("unexpected edits: {edits:?}");
+    };
+    assert_eq!(deleted.span().unwrap().range(), 7..13);
+    assert_eq!(inserted.span().unwrap().range(), 7..14);
+}
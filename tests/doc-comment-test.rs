@@ -0,0 +1,94 @@
+use cgrammar::{
+    visitor::{Visitor, walk_member_declaration},
+    *,
+};
+
+const SOURCE: &str = "
+/** The answer. */
+int answer = 42;
+
+/* Not a doc comment. */
+int plain;
+
+/// A point,
+/// in two dimensions.
+struct point {
+    /** Abscissa. */
+    int x;
+    // Not documented either.
+    int y;
+    /// Depth, for later. /* not the end */
+    [[deprecated]] int z;
+};
+
+/** Unused. */
+/// Adds one.
+int inc(int x) { /** Stray. */ return x + 1; }
+/**/ int undocumented;
+/********/ int banner;
+";
+
+struct Members<'a>(Vec<&'a MemberDeclaration>);
+
+impl<'a> Visitor<'a> for Members<'a> {
+    type Result = ();
+
+    fn visit_member_declaration(&mut self, md: &'a MemberDeclaration) {
+        self.0.push(md);
+        walk_member_declaration(self, md)
+    }
+}
+
+#[test]
+fn test_doc_comments() {
+    let (tokens, ctx_map, docs) = lex_doc_comments(SOURCE, None);
+    assert_eq!(tokens, lex(SOURCE, None).0);
+    let unit = translation_unit().parse(tokens.as_input()).into_result().unwrap();
+
+    let external: Vec<_> = (unit.external_declarations.iter())
+        .map(|declaration| docs.external_declaration(&ctx_map, declaration))
+        .collect();
+    assert_eq!(
+        external,
+        [
+            Some("/** The answer. */"),
+            None,
+            Some("/// A point,\n/// in two dimensions."),
+            Some("/// Adds one."),
+            None,
+            None,
+        ]
+    );
+
+    let mut members = Members(Vec::new());
+    members.visit_translation_unit(&unit);
+    let members: Vec<_> = (members.0.into_iter())
+        .map(|declaration| docs.member_declaration(&ctx_map, declaration))
+        .collect();
+    assert_eq!(
+        members,
+        [
+            Some("/** Abscissa. */"),
+            None,
+            Some("/// Depth, for later. /* not the end */")
+        ]
+    );
+
+    // The doc comments are slices of the source
+    let comment = docs.before(SOURCE.find("int answer").unwrap()).unwrap();
+    assert_eq!(&SOURCE[comment.range()], "/** The answer. */");
+    assert_eq!(docs.len(), docs.iter().count());
+}
+
+#[test]
+fn test_member_spans() {
+    let source = "struct s { int a; _Static_assert(1, \"\"); long b, c; };";
+    let (tokens, _) = lex(source, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_result().unwrap();
+    let mut members = Members(Vec::new());
+    members.visit_translation_unit(&unit);
+    let spans: Vec<_> = (members.0.into_iter())
+        .map(|declaration| declaration.span().map(|span| &source[span.range()]))
+        .collect();
+    assert_eq!(spans, [Some("int a;"), None, Some("long b, c;")]);
+}
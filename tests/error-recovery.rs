@@ -23,3 +23,159 @@ fn test_error_recovery(#[case] input: String) {
     assert!(result.has_output());
     assert!(result.has_errors());
 }
+
+#[rstest]
+#[case("int a = 1; int f(void) { return a; }", 0)]
+#[case("int a = (1 1); int b;", 1)]
+#[case("int a; int f(void) { return (*int)1; } int b;", 1)]
+fn test_two_pass(#[case] input: &str, #[case] recovered: usize) {
+    let (tokens, _) = lex(input, None);
+    let expected = translation_unit().parse(tokens.as_input());
+
+    let mut state = State::new();
+    state.set_two_pass(true);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    assert_eq!(result.output(), expected.output());
+    assert_eq!(result.errors().count(), expected.errors().count());
+
+    let stats = state.two_pass_stats();
+    assert_eq!(stats.recovered_declarations, recovered);
+    let declarations = result.output().unwrap().external_declarations.len();
+    assert_eq!(stats.fast_declarations, declarations - recovered);
+}
+
+#[rstest]
+#[case("int a = (1 1); int b;", 1)]
+#[case("int a; int f(void) { return (*int)1; } int b;", 1)]
+#[case("struct s { int ? a; }; int b;", 1)]
+#[case("int a = 1 +; int b = (); int c;", 2)]
+#[case("int a; int b = 1 1", 1)]
+fn test_resynchronize(#[case] input: &str, #[case] skipped: usize) {
+    let (tokens, _) = lex(input, None);
+    let mut state = State::new();
+    state.set_resynchronize(true);
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    let unit = unit.unwrap();
+    let erroneous = (unit.external_declarations.iter())
+        .filter(|d| matches!(d, ExternalDeclaration::Declaration(d) if matches!(d.kind, DeclarationKind::Error)))
+        .count();
+    assert_eq!(erroneous, skipped);
+    assert_eq!(errors.len(), skipped);
+    assert_eq!(state.recoveries(), skipped as u64);
+}
+
+#[cfg(feature = "report")]
+#[test]
+fn test_report_all() {
+    let code = "int a = (1 1);\n# 10 \"foo.h\"\nint b = (*int)1;";
+    let (tokens, mut ctx_map) = lex(code, Some("main.c"));
+    let errors = translation_unit().parse(tokens.as_input()).into_errors();
+    assert_eq!(errors.len(), 2);
+    let mut output = Vec::new();
+    report_all(errors, &mut ctx_map, &mut output).unwrap();
+    let output = String::from_utf8(output).unwrap();
+    assert!(output.contains("main.c") && output.contains("foo.h"));
+}
+
+#[rstest]
+#[case::max_errors(|state: &mut State| state.set_max_errors(Some(3)))]
+#[case::max_token_work(|state: &mut State| state.set_max_token_work(Some(500)))]
+#[case::deadline(|state: &mut State| state.set_deadline(Some(std::time::Instant::now())))]
+fn test_budget(#[case] limit: fn(&mut State)) {
+    let code = "int a = (1 1);\n".repeat(1000);
+    let (tokens, _) = lex(&code, None);
+    let mut state = State::new();
+    limit(&mut state);
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(state.budget_exceeded());
+    assert!(unit.unwrap().external_declarations.len() < 100);
+    assert!(errors.len() < 100);
+    let reason = errors.last().unwrap().reason();
+    assert!(matches!(reason, chumsky::error::RichReason::Custom(msg) if msg == "parse budget exceeded"));
+
+    let mut state = State::new();
+    limit(&mut state);
+    state.set_deadline(None);
+    let (tokens, _) = lex("int a; int f(void) { return 1; }", None);
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(!state.budget_exceeded() && errors.is_empty());
+    assert_eq!(unit.unwrap().external_declarations.len(), 2);
+}
+
+#[rstest]
+#[case("int a = 1;\n")]
+#[case("int a = (1 1);\n")]
+fn test_max_memory(#[case] line: &str) {
+    let code = line.repeat(1000);
+    let (tokens, _) = lex(&code, None);
+    let mut state = State::new();
+    state.set_max_memory(Some(4096));
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(state.memory_exceeded() && state.budget_exceeded());
+    // The declarations parsed so far are kept
+    let unit = unit.unwrap();
+    assert!(!unit.external_declarations.is_empty() && unit.external_declarations.len() < 100);
+    assert!(state.memory() > 4096);
+    let reason = errors.last().unwrap().reason();
+    assert!(matches!(reason, chumsky::error::RichReason::Custom(msg) if msg == "resource limit exceeded"));
+
+    let mut state = State::new();
+    state.set_max_memory(Some(1 << 20));
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(!state.memory_exceeded());
+    assert_eq!(unit.unwrap().external_declarations.len(), 1000);
+    assert_eq!(errors.is_empty(), line == "int a = 1;\n");
+}
+
+#[test]
+fn test_cancellation() {
+    let code = "int a = 1;\n".repeat(100);
+    let (tokens, _) = lex(&code, None);
+    let token = CancellationToken::new();
+    let mut state = State::new();
+    state.set_cancellation(Some(token.clone()));
+    token.cancel();
+    let (unit, errors) = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output_errors();
+    assert!(state.cancelled() && state.budget_exceeded());
+    assert!(unit.unwrap().external_declarations.is_empty());
+    let reason = errors.last().unwrap().reason();
+    assert!(matches!(reason, chumsky::error::RichReason::Custom(msg) if msg == "parse cancelled"));
+
+    // Other budgets keep their own error
+    let mut state = State::new();
+    state.set_cancellation(Some(CancellationToken::new()));
+    state.set_max_errors(Some(3));
+    let (tokens, _) = lex(&"int a = (1 1);\n".repeat(1000), None);
+    let errors = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_errors();
+    assert!(!state.cancelled() && state.budget_exceeded());
+    let reason = errors.last().unwrap().reason();
+    assert!(matches!(reason, chumsky::error::RichReason::Custom(msg) if msg == "parse budget exceeded"));
+}
+
+#[rstest]
+#[case("int a = 1; int f(void) { return a; }")]
+#[case("int a = (1 1); int b;")]
+fn test_unlabelled(#[case] input: &str) {
+    let (tokens, _) = lex(input, None);
+    let expected = translation_unit().parse(tokens.as_input());
+
+    let mut state = State::new();
+    state.set_rule_labels(false);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    assert_eq!(result.output(), expected.output());
+    assert_eq!(result.has_errors(), expected.has_errors());
+}
@@ -0,0 +1,65 @@
+#![cfg(feature = "export")]
+
+use cgrammar::{serialize::*, *};
+use serde_json::{Value, json};
+
+const SOURCE: &str = "int x = 1;\nint y = (1 1);\nint f(void) { x = (1 1); { int z = (1 1); } return x; }\n";
+
+fn parse(source: &str) -> TranslationUnit {
+    let (tokens, _) = lex(source, None);
+    translation_unit().parse(tokens.as_input()).into_output().unwrap()
+}
+
+fn export(unit: &TranslationUnit, options: ExportOptions) -> Value {
+    let mut bytes = Vec::new();
+    export_json(unit, &mut bytes, options).unwrap();
+    serde_json::from_slice(&bytes).unwrap()
+}
+
+#[test]
+fn test_export_json() {
+    let unit = parse("int x;");
+    let value = export(&unit, ExportOptions::default());
+    let declaration = &value["external_declarations"][0]["Declaration"];
+    assert_eq!(declaration["span"], json!([0, 6]));
+
+    let value = export(&unit, ExportOptions { spans: false, errors: true });
+    let declaration = &value["external_declarations"][0]["Declaration"];
+    assert!(declaration.get("span").is_none());
+    assert!(!value.to_string().contains("span"));
+    assert!(value.to_string().contains(r#""x""#));
+}
+
+#[test]
+fn test_export_errors() {
+    let unit = parse(SOURCE);
+    let value = export(&unit, ExportOptions::default());
+    assert_eq!(value["external_declarations"].as_array().unwrap().len(), 3);
+    assert!(value.to_string().contains("Error"));
+
+    let value = export(&unit, ExportOptions { spans: true, errors: false });
+    assert!(!value.to_string().contains("Error"));
+    let declarations = value["external_declarations"].as_array().unwrap();
+    assert_eq!(declarations.len(), 2);
+    // The statement with an error is left out, and so is the declaration in
+    // the nested block, but not the block itself
+    let items = declarations[1]["Function"]["body"]["items"].as_array().unwrap();
+    assert_eq!(items.len(), 2);
+    let nested = items[0]["Statement"].to_string();
+    assert!(nested.contains(r#""items":[]"#), "{nested}");
+}
+
+#[test]
+fn test_export_msgpack() {
+    let unit = parse(SOURCE);
+    let mut bytes = Vec::new();
+    export_msgpack(&unit, &mut bytes, ExportOptions::default()).unwrap();
+    let value: Value = rmp_serde::from_slice(&bytes).unwrap();
+    assert_eq!(value["external_declarations"].as_array().unwrap().len(), 3);
+
+    // The binary format is unchanged by exports
+    let (tokens, ctx_map) = lex(SOURCE, None);
+    let encoded = encode(&tokens, &unit, &ctx_map).unwrap();
+    let (_, decoded, _) = decode(&encoded, SOURCE).unwrap();
+    assert_eq!(decoded, unit);
+}
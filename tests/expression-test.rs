@@ -0,0 +1,110 @@
+use cgrammar::{visitor::*, *};
+use rstest::rstest;
+
+/// Render binary expressions with explicit parentheses, and everything else
+/// as its source text.
+fn render(expression: &Expression, source: &str) -> String {
+    match &expression.kind {
+        ExpressionKind::Binary(binary) => format!(
+            "({} {:?} {})",
+            render(&binary.left, source),
+            binary.operator,
+            render(&binary.right, source)
+        ),
+        _ => source[expression.span.range()].to_string(),
+    }
+}
+
+#[rstest]
+#[case("a - b - c", "((a Subtract b) Subtract c)")]
+#[case("a + b * c", "(a Add (b Multiply c))")]
+#[case("a * b + c << d", "(((a Multiply b) Add c) LeftShift d)")]
+#[case(
+    "a < b == c & d ^ e | f",
+    "(((((a Less b) Equal c) BitwiseAnd d) BitwiseXor e) BitwiseOr f)"
+)]
+#[case("a || b && c | d", "(a LogicalOr (b LogicalAnd (c BitwiseOr d)))")]
+#[case("(int)a * -b % c[1]", "(((int)a Multiply -b) Modulo c[1])")]
+fn test_binary_precedence(#[case] code: &str, #[case] expected: &str) {
+    let (tokens, _) = lex(code, None);
+    let expression = expression()
+        .parse_with_state(tokens.as_input(), &mut State::new())
+        .into_result()
+        .unwrap();
+    assert_eq!(render(&expression, code), expected);
+    assert_eq!(&code[expression.span.range()], code);
+}
+
+#[test]
+fn test_binary_trailing_operator() {
+    let (tokens, _) = lex("int a = b + ;", None);
+    let result = translation_unit().parse(tokens.as_input());
+    assert!(result.has_errors());
+}
+
+/// Counts casts and compound literals.
+#[derive(Default)]
+struct CastCounter {
+    casts: usize,
+    compound_literals: usize,
+}
+
+impl<'a> Visitor<'a> for CastCounter {
+    type Result = ();
+
+    fn visit_cast_expression(&mut self, c: &'a CastExpression) {
+        self.casts += usize::from(matches!(c, CastExpression::Cast { .. }));
+        walk_cast_expression(self, c)
+    }
+
+    fn visit_compound_literal(&mut self, cl: &'a CompoundLiteral) {
+        self.compound_literals += 1;
+        walk_compound_literal(self, cl)
+    }
+}
+
+#[rstest]
+#[case("typedef int T; int f(int x) { return (T)x + (x) + (f)(1); }", (1, 0))]
+#[case("typedef struct { int a; } T; int f(void) { return (T){1}.a; }", (0, 1))]
+#[case("int f(int x) { return (unsigned long)(x) + (__typeof__(x))x + (const int){1}; }", (2, 1))]
+#[case("struct s { int a; }; int f(void) { return (static struct s){0}.a + ((struct s *)0)->a; }", (1, 1))]
+fn test_parenthesized_type_names(#[case] code: &str, #[case] expected: (usize, usize)) {
+    let (tokens, _) = lex(code, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_result().unwrap();
+    let mut counter = CastCounter::default();
+    counter.visit_translation_unit(&unit);
+    assert_eq!((counter.casts, counter.compound_literals), expected);
+}
+
+#[rstest]
+#[case("a + 1", Some("a"), None)]
+#[case("a = b", Some("a"), Some("b"))]
+#[case("-a * 1", None, None)]
+#[case("(int)a - 1", None, None)]
+#[case("f(a) + 1", None, None)]
+#[case("2 * a", None, Some("a"))]
+fn test_flat_operands(#[case] code: &str, #[case] left: Option<&str>, #[case] right: Option<&str>) {
+    let (tokens, _) = lex(code, None);
+    let expression = expression()
+        .parse_with_state(tokens.as_input(), &mut State::new())
+        .into_result()
+        .unwrap();
+    let (l, r) = match &expression.kind {
+        ExpressionKind::Binary(b) => (&b.left, &b.right),
+        ExpressionKind::Assignment(a) => (&a.left, &a.right),
+        _ => unreachable!(),
+    };
+    // Operands without an operator are a single postfix expression
+    for operand in [l, r] {
+        assert!(!matches!(
+            operand.kind,
+            ExpressionKind::Cast(CastExpression::Unary(_)) | ExpressionKind::Unary(UnaryExpression::Postfix(_))
+        ));
+    }
+    assert_eq!(l.as_identifier().map(|id| id.0.as_str()), left);
+    assert_eq!(
+        l.as_constant().is_some() || r.as_constant().is_some(),
+        code.contains(char::is_numeric)
+    );
+    assert_eq!(r.as_identifier().map(|id| id.0.as_str()), right);
+}
@@ -0,0 +1,42 @@
+#[path = "../benches/common/generate.rs"]
+mod generate;
+
+use cgrammar::*;
+use generate::{Config, generate};
+use rstest::rstest;
+
+#[rstest]
+fn test_generated_programs_parse(#[values(0, 1, 2, 3, 4, 5, 6, 7)] seed: u64, #[values(0.0, 0.2, 0.8)] typedefs: f64) {
+    let config = Config {
+        seed,
+        declarations: 40,
+        typedef_density: typedefs,
+        ..Default::default()
+    };
+    let source = generate(&config);
+    let (tokens, _) = lex(&source, None);
+    let result = translation_unit().parse(tokens.as_input());
+    assert!(
+        !result.has_errors(),
+        "{:#?}\n{source}",
+        result.errors().collect::<Vec<_>>()
+    );
+}
+
+#[test]
+fn test_generated_shapes() {
+    let config = Config {
+        seed: 42,
+        declarations: 4,
+        statements: 2,
+        expression_terms: 2000,
+        declarator_depth: 40,
+        ..Default::default()
+    };
+    let source = generate(&config);
+    assert_eq!(source, generate(&config));
+    assert_ne!(source, generate(&Config { seed: 43, ..config }));
+
+    let (tokens, _) = lex(&source, None);
+    assert!(!translation_unit().parse(tokens.as_input()).has_errors());
+}
@@ -0,0 +1,114 @@
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    cell::Cell,
+};
+
+use cgrammar::*;
+use rstest::rstest;
+
+/// Counts the bytes allocated and not freed by each thread.
+struct CountingAllocator;
+
+thread_local! {
+    static LIVE_BYTES: Cell<isize> = const { Cell::new(0) };
+}
+
+fn add_live_bytes(delta: isize) {
+    let _ = LIVE_BYTES.try_with(|bytes| bytes.set(bytes.get() + delta));
+}
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        add_live_bytes(layout.size() as isize);
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        add_live_bytes(-(layout.size() as isize));
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        add_live_bytes(new_size as isize - layout.size() as isize);
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: CountingAllocator = CountingAllocator;
+
+fn live_bytes<T>(f: impl FnOnce() -> T) -> (T, usize) {
+    let before = LIVE_BYTES.with(Cell::get);
+    let output = f();
+    (output, (LIVE_BYTES.with(Cell::get) - before) as usize)
+}
+
+#[rstest]
+#[case("int x = 1, y[3] = { 1, 2, 3 };")]
+#[case("struct S { int a : 3; char *b; } s = { .a = 1, .b = \"str\" \"ing\" };")]
+#[case("typedef int T; int f(T x) { if (x) return sizeof(T); for (;;) x++; [[deprecated]] int y = (T) 1.5f; }")]
+fn test_heap_size(#[case] source: &str) {
+    let (tokens, _) = lex(source, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    // Clones of the tokens share their groups, and count a share of each
+    let (copy, bytes) = live_bytes(|| tokens.clone());
+    assert!(copy.heap_size() > bytes);
+    // Clones of the tree allocate exactly their length, so they hold what
+    // they allocated
+    let (copy, bytes) = live_bytes(|| unit.clone());
+    assert_eq!(copy.heap_size(), bytes);
+    assert_eq!(copy.deep_size(), bytes + size_of::<TranslationUnit>());
+    // Vectors count their capacity, not their length
+    assert!(unit.heap_size() >= copy.heap_size());
+}
+
+#[rstest]
+#[case("int x;")]
+#[case("static const unsigned long n, *const volatile p;")]
+#[case("typedef const char *S, *T;")]
+fn test_heap_size_short_lists(#[case] source: &str) {
+    let (tokens, _) = lex(source, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    // Short lists of specifiers, qualifiers and declarators are allocated at
+    // their length, as their clones are
+    let declaration = &unit.external_declarations[0];
+    let (copy, bytes) = live_bytes(|| declaration.clone());
+    assert_eq!(copy.heap_size(), bytes);
+    assert_eq!(declaration.heap_size(), bytes);
+}
+
+#[test]
+fn test_heap_size_lazy_body() {
+    let (tokens, _) = lex("int f(void) { return 1 + 2; }", None);
+    let mut state = State::new();
+    state.set_lazy_function_bodies(true);
+    let unit = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output()
+        .unwrap();
+    let alone = unit.heap_size();
+
+    // The tokens and state of the body are shared with the clones
+    let copy = unit.clone();
+    let other = copy.clone();
+    assert!(unit.heap_size() < alone);
+    assert_eq!(copy.heap_size(), other.heap_size());
+}
+
+#[test]
+fn test_heap_size_attribute_arguments() {
+    let (tokens, _) = lex(
+        "__attribute__((format(printf, 1, 2), aligned(16))) int f(const char *, ...);",
+        None,
+    );
+    let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+    let alone = unit.heap_size();
+
+    // The argument tokens are shared with the clones
+    let (copy, bytes) = live_bytes(|| unit.clone());
+    assert!(copy.heap_size() > bytes);
+    assert!(unit.heap_size() < alone);
+    assert_eq!(unit.heap_size(), copy.heap_size());
+}
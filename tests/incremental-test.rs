@@ -0,0 +1,152 @@
+use cgrammar::*;
+use rstest::rstest;
+
+const SOURCE: &str = "typedef int T; int f(void) { T * p; return 0; } int g(int x) { return x + 1; } int h;";
+
+fn parse_fresh(source: &str) -> (BalancedTokenSequence, Option<TranslationUnit>) {
+    let (tokens, _) = lex(source, None);
+    let output = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut State::new())
+        .into_output();
+    (tokens, output)
+}
+
+#[rstest]
+// Inside one function body
+#[case(SOURCE.find("x + 1").unwrap()..SOURCE.find("x + 1").unwrap() + 5, "x * 2 + 1", 1)]
+// Between two declarations
+#[case(SOURCE.find("int g").unwrap()..SOURCE.find("int g").unwrap(), "int y; ", 2)]
+// Deleting a whole declaration
+#[case(SOURCE.find("int g").unwrap()..SOURCE.find("int h").unwrap(), "", 1)]
+// A typedef that is no longer one: `T * p;` becomes an expression
+#[case(0..SOURCE.find("T;").unwrap() + 2, "int T;", 2)]
+// Unbalanced brackets are parsed from scratch
+#[case(SOURCE.find("{ T").unwrap()..SOURCE.find("{ T").unwrap() + 1, "(", 2)]
+fn test_edit(#[case] range: std::ops::Range<usize>, #[case] text: &str, #[case] reparsed: usize) {
+    let mut unit = IncrementalUnit::new(SOURCE, None, State::new());
+    let edit = TextEdit::new(range, text);
+    let mut source = SOURCE.to_string();
+    edit.apply(&mut source);
+
+    let count = unit.edit(&edit);
+    assert_eq!(unit.source(), source);
+    let fresh = IncrementalUnit::new(source.as_str(), None, State::new());
+    assert_eq!(unit.tokens(), fresh.tokens());
+    assert_eq!(unit.translation_unit(), fresh.translation_unit());
+    assert_eq!(unit.has_errors(), fresh.has_errors());
+
+    if !unit.has_errors() {
+        let (tokens, output) = parse_fresh(&source);
+        assert_eq!(unit.tokens(), &tokens);
+        assert_eq!(Some(unit.translation_unit()), output);
+        assert_eq!(count, reparsed);
+    }
+}
+
+#[test]
+fn test_knr_definition() {
+    // The parameter declarations end pieces that do not parse on their own
+    const KNR: &str = "int old(a, b) int a; long b; { return a + b; } int c;";
+    let mut unit = IncrementalUnit::new(KNR, None, State::new());
+    assert!(!unit.has_errors());
+    assert_eq!(Some(unit.translation_unit()), parse_fresh(KNR).1);
+
+    let edits = [
+        ("return a + b;", "return a * b;"),
+        ("int c;", "int d; int c;"),
+        ("long b;", "short b;"),
+        ("int old(a, b)", "int x;\nint old(a, b)"),
+    ];
+    for (old, new) in edits {
+        let start = unit.source().find(old).unwrap();
+        unit.edit(&TextEdit::new(start..start + old.len(), new));
+        assert!(!unit.has_errors());
+        assert_eq!(Some(unit.translation_unit()), parse_fresh(unit.source()).1);
+    }
+}
+
+#[test]
+fn test_edit_sequence() {
+    let mut unit = IncrementalUnit::new("int a; int b;", Some("input.c"), State::new());
+    let edits = [
+        TextEdit::new(0..0, "typedef long L;\n"),
+        TextEdit::new(23..29, "L b = 1;"),
+        TextEdit::new(16..16, "L z(L v) { return v; }\n"),
+        TextEdit::new(0..15, "int L;"),
+    ];
+    for edit in &edits {
+        unit.edit(edit);
+        let fresh = IncrementalUnit::new(unit.source(), Some("input.c"), State::new());
+        assert_eq!(unit.tokens(), fresh.tokens());
+        assert_eq!(unit.translation_unit(), fresh.translation_unit());
+        assert_eq!(unit.has_errors(), fresh.has_errors());
+    }
+    assert_eq!(unit.source(), "int L;\nL z(L v) { return v; }\nint a; L b = 1;");
+    assert!(unit.has_errors());
+}
+
+#[test]
+fn test_edit_before_line_directive() {
+    let mut unit = IncrementalUnit::new("int a;\nint c;\n# 5 \"h.h\"\nint b;", Some("input.c"), State::new());
+    unit.edit(&TextEdit::new(0..0, "int x;\n\n"));
+    let fresh = IncrementalUnit::new(unit.source(), Some("input.c"), State::new());
+
+    let contexts = |unit: &IncrementalUnit| {
+        let ctx_map = unit.ctx_map();
+        let contexts: Vec<_> = unit
+            .tokens()
+            .tokens
+            .iter()
+            .map(|token| token.span.at_context(&ctx_map).0.cloned())
+            .collect();
+        contexts
+    };
+    assert_eq!(unit.tokens(), fresh.tokens());
+    assert_eq!(contexts(&unit), contexts(&fresh));
+}
+
+#[test]
+fn test_edit_compact_initializers() {
+    let mut state = State::new();
+    state.set_compact_initializers(true);
+    let mut unit = IncrementalUnit::new("int a; int t[] = { 1, 2, 3 };", None, state.clone());
+    // The constants of the reused declaration move with the edit before it
+    unit.edit(&TextEdit::new(0..6, "long a, b;"));
+    let (tokens, _) = lex(unit.source(), None);
+    let fresh = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut state)
+        .into_output();
+    assert_eq!(Some(unit.translation_unit()), fresh);
+}
+
+#[test]
+fn test_edit_declaration_index() {
+    let mut state = State::new();
+    state.set_declaration_index(true);
+    let mut unit = IncrementalUnit::new(SOURCE, None, state.clone());
+    // Each edit replaces the first occurrence of a text in the current source
+    let edits = [
+        ("int h;", "struct s { int m; } h;"),
+        ("typedef", "enum { E } e;\ntypedef"),
+        ("return x + 1;", "int y = E; return x + y;"),
+    ];
+    for (old, new) in edits {
+        let start = unit.source().find(old).unwrap();
+        unit.edit(&TextEdit::new(start..start + old.len(), new));
+        let (tokens, _) = lex(unit.source(), None);
+        let mut fresh = state.clone();
+        translation_unit().parse_with_state(tokens.as_input(), &mut fresh);
+        // Names of reused declarations are moved with them
+        assert_eq!(unit.declaration_index().as_ref(), fresh.declaration_index());
+    }
+    let names: Vec<_> = (unit.declaration_index().unwrap().iter())
+        .filter(|declared| declared.kind == DeclaredKind::Member)
+        .map(|declared| (declared.name.as_str(), &unit.source()[declared.span.range()]))
+        .collect();
+    assert_eq!(names, [("m", "m")]);
+    assert!(
+        IncrementalUnit::new(SOURCE, None, State::new())
+            .declaration_index()
+            .is_none()
+    );
+}
@@ -0,0 +1,74 @@
+use cgrammar::*;
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+/// The declaration specifiers of each external declaration.
+fn specifiers(unit: &TranslationUnit) -> Vec<&DeclarationSpecifiers> {
+    unit.external_declarations
+        .iter()
+        .map(|d| match d {
+            ExternalDeclaration::Declaration(Declaration {
+                kind: DeclarationKind::Normal { specifiers, .. },
+                ..
+            }) => specifiers,
+            ExternalDeclaration::FunctionDefinition(f) => &f.specifiers,
+            _ => unreachable!(),
+        })
+        .collect()
+}
+
+#[test]
+fn test_intern_unit() {
+    let unit =
+        parse_c("const char *a;\nconst  char *b, *c;\nunsigned long n;\nconst char *f(const char *p) { return p; }");
+    let mut interner = TypeInterner::new();
+    let types = interner.intern_unit(&unit);
+    let shared: Vec<_> = specifiers(&unit)
+        .into_iter()
+        .map(|s| types.specifiers(s).unwrap().clone())
+        .collect();
+    assert_eq!(shared[0], shared[1]);
+    assert_eq!(shared[0], shared[3]);
+    assert_ne!(shared[0], shared[2]);
+    // The interner's own, the three declarations and the parameter, and the
+    // copies above
+    assert_eq!(Interned::handles(&shared[0]), 1 + 4 + 3);
+    assert_eq!(*shared[0], *specifiers(&unit)[0]);
+
+    // Other units share the same copies
+    let other = parse_c("const char *s = 0;");
+    let other_types = interner.intern_unit(&other);
+    assert_eq!(other_types.specifiers(specifiers(&other)[0]), Some(&shared[0]));
+    drop((types, other_types, shared));
+    interner.shrink();
+    assert!(interner.is_empty());
+}
+
+#[test]
+fn test_intern_without_spans() {
+    let unit = parse_c(
+        "int a[sizeof(int)];\n\n  _Alignas(8) int b[2];\nint c = sizeof(int[1 + 1]);\nint d = sizeof(int[1+1]);",
+    );
+    let mut interner = TypeInterner::new();
+    let types = interner.intern_unit(&unit);
+    let mut names = Vec::new();
+    for d in &unit.external_declarations {
+        let ExternalDeclaration::Declaration(Declaration {
+            kind: DeclarationKind::Normal { declarators, .. },
+            ..
+        }) = d
+        else {
+            continue;
+        };
+        if let Some(Initializer::Expression(e)) = &declarators[0].initializer
+            && let ExpressionKind::Unary(UnaryExpression::SizeofType(tn)) = &e.kind
+        {
+            names.push(types.type_name(tn).unwrap().clone());
+        }
+    }
+    assert_eq!(names.len(), 2);
+    assert_eq!(names[0], names[1]);
+}
@@ -0,0 +1,128 @@
+use cgrammar::{layout::RecordLayout, *};
+use rstest::rstest;
+
+const SOURCE: &str = "
+struct mixed { char c; int i; short s; };
+struct wide { char c; double d; };
+struct bits { unsigned a : 3; unsigned b : 30; char c; };
+struct units { char a : 4; int b : 4; };
+union u { char c[5]; int i; };
+struct flexible { int n; char data[]; };
+struct outer { int x; union { int y; double z; }; struct mixed m; };
+struct aligned { char c; _Alignas(16) char d; };
+enum big { A, B = 0x100000000 };
+struct list { struct list *next; struct incomplete *data; };
+
+struct mixed mixed;
+struct wide wide;
+struct bits bits;
+struct units units;
+union u u;
+struct flexible flexible;
+struct outer outer;
+struct aligned aligned;
+enum big big;
+struct list list;
+char *pointer;
+long double ld;
+unsigned _BitInt(100) huge;
+int matrix[3][5];
+";
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+/// The types of the variables declared at file scope, by name.
+fn variables(unit: &TranslationUnit, table: &mut TypeTable) -> Vec<(String, TypeId)> {
+    let types = table.resolve_unit(unit);
+    let mut variables = Vec::new();
+    for d in &unit.external_declarations {
+        if let ExternalDeclaration::Declaration(Declaration {
+            kind: DeclarationKind::Normal { declarators, .. },
+            ..
+        }) = d
+        {
+            for init in declarators {
+                let name = init.declarator.identifier().unwrap().to_string();
+                variables.push((name, types.declarator(&init.declarator).unwrap()));
+            }
+        }
+    }
+    variables
+}
+
+fn type_of(variables: &[(String, TypeId)], name: &str) -> TypeId {
+    variables.iter().find(|(n, _)| n == name).unwrap().1
+}
+
+#[rstest]
+#[case(Target::LP64, "mixed", 12, 4)]
+#[case(Target::LP64, "wide", 16, 8)]
+#[case(Target::ILP32, "wide", 12, 4)]
+#[case(Target::LP64, "bits", 12, 4)]
+#[case(Target::LP64, "units", 4, 4)]
+#[case(Target::LLP64, "units", 8, 4)]
+#[case(Target::LP64, "u", 8, 4)]
+#[case(Target::LP64, "flexible", 4, 4)]
+#[case(Target::LP64, "outer", 32, 8)]
+#[case(Target::ILP32, "outer", 24, 4)]
+#[case(Target::LP64, "aligned", 32, 16)]
+#[case(Target::LP64, "big", 8, 8)]
+#[case(Target::LP64, "list", 16, 8)]
+#[case(Target::ILP32, "pointer", 4, 4)]
+#[case(Target::LLP64, "ld", 8, 8)]
+#[case(Target::LP64, "huge", 16, 8)]
+#[case(Target::LP64, "matrix", 60, 4)]
+fn test_layout(#[case] target: Target, #[case] name: &str, #[case] size: u64, #[case] align: u64) {
+    let unit = parse_c(SOURCE);
+    let mut table = TypeTable::new();
+    let variables = variables(&unit, &mut table);
+    let engine = LayoutEngine::new(&table, target);
+    assert_eq!(engine.layout(type_of(&variables, name)), Some(Layout::new(size, align)));
+}
+
+#[test]
+fn test_offsets() {
+    let unit = parse_c(SOURCE);
+    let mut table = TypeTable::new();
+    let variables = variables(&unit, &mut table);
+    let engine = LayoutEngine::new(&table, Target::LP64);
+    let offset = |name, path: &[&str]| {
+        let path: Vec<_> = path.iter().map(|&member| Symbol::from(member)).collect();
+        engine.offset_of(type_of(&variables, name), &path)
+    };
+    assert_eq!(offset("mixed", &["i"]), Some(4));
+    assert_eq!(offset("mixed", &["s"]), Some(8));
+    assert_eq!(offset("outer", &["z"]), Some(8));
+    assert_eq!(offset("outer", &["m", "s"]), Some(16 + 8));
+    assert_eq!(offset("aligned", &["d"]), Some(16));
+    assert_eq!(offset("flexible", &["data"]), Some(4));
+    // Bit-fields and missing members have no offset
+    assert_eq!(offset("bits", &["b"]), None);
+    assert_eq!(offset("mixed", &["missing"]), None);
+
+    let bits: std::sync::Arc<RecordLayout> = engine.record_layout(type_of(&variables, "bits")).unwrap();
+    assert_eq!(bits.bit_offsets, [0, 32, 64]);
+}
+
+#[test]
+fn test_layout_all() {
+    let unit = parse_c(SOURCE);
+    let mut table = TypeTable::new();
+    let variables = variables(&unit, &mut table);
+    let ids: Vec<_> = table.iter().map(|(id, _)| id).collect();
+
+    let engine = LayoutEngine::new(&table, Target::LP64);
+    let layouts = engine.layout_all(&ids);
+    let serial = LayoutEngine::new(&table, Target::LP64);
+    assert_eq!(layouts, ids.iter().map(|&id| serial.layout(id)).collect::<Vec<_>>());
+
+    // Incomplete types have no layout
+    let incomplete = table
+        .iter()
+        .find(|(_, ty)| matches!(ty, types::Type::Struct(record) if !table.record(*record).complete));
+    assert_eq!(engine.layout(incomplete.unwrap().0), None);
+    assert!(engine.layout(type_of(&variables, "list")).is_some());
+}
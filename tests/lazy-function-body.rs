@@ -0,0 +1,116 @@
+use cgrammar::*;
+
+fn parse(code: &str, lazy: bool) -> (TranslationUnit, bool) {
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_lazy_function_bodies(lazy);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    (result.output().unwrap().clone(), result.has_errors())
+}
+
+fn bodies(unit: &TranslationUnit) -> Vec<&FunctionBody> {
+    unit.external_declarations
+        .iter()
+        .filter_map(|decl| match decl {
+            ExternalDeclaration::Function(f) => Some(&f.body),
+            _ => None,
+        })
+        .collect()
+}
+
+#[test]
+fn test_lazy_matches_eager() {
+    let code = r#"
+        typedef int T;
+        T f(T x) { T y = x * 2; return y; }
+        int g(void) { for (int i = 0; i < 10; i++) { f(i); } return 0; }
+    "#;
+    let (eager, eager_errors) = parse(code, false);
+    let (lazy, lazy_errors) = parse(code, true);
+    assert!(!eager_errors && !lazy_errors);
+
+    assert!(bodies(&lazy).iter().all(|body| !body.is_parsed()));
+    assert_eq!(lazy, eager);
+    assert!(
+        bodies(&lazy)
+            .iter()
+            .all(|body| body.is_parsed() && body.errors().is_empty())
+    );
+}
+
+#[test]
+fn test_lazy_body_errors() {
+    let code = "int f(void) { return ; ; + } int g(void) { return 0; }";
+    let (lazy, has_errors) = parse(code, true);
+    assert!(!has_errors);
+
+    let bodies = bodies(&lazy);
+    assert!(!bodies[0].errors().is_empty());
+    assert!(bodies[1].errors().is_empty());
+}
+
+#[test]
+fn test_lazy_body_uses_snapshot() {
+    // `T` is declared after `f`, so it must not be a typedef name inside `f`
+    let code = "int f(void) { T * x; return 0; } typedef int T;";
+    let (eager, _) = parse(code, false);
+    let (lazy, _) = parse(code, true);
+    assert_eq!(lazy, eager);
+}
+
+/// The blocks of the primary blocks of `items`, not descending into them.
+fn blocks(items: &[BlockItem]) -> Vec<&Block> {
+    fn of(s: &UnlabeledStatement) -> Option<&Block> {
+        let UnlabeledStatement::Primary { block, .. } = s else {
+            return None;
+        };
+        let body = match block {
+            PrimaryBlock::Compound(b) => return Some(b),
+            PrimaryBlock::Selection(SelectionStatement::Switch { statement, .. }) => statement,
+            PrimaryBlock::Iteration(IterationStatement::While { body, .. }) => body,
+            _ => return None,
+        };
+        match &body.kind {
+            StatementKind::Unlabeled(s) => of(s),
+            StatementKind::Labeled(_) => None,
+        }
+    }
+    (items.iter())
+        .filter_map(|item| match item {
+            BlockItem::Statement(s) => of(s),
+            _ => None,
+        })
+        .collect()
+}
+
+#[test]
+fn test_lazy_blocks() {
+    let code = r#"
+        typedef int T;
+        int f(T x) {
+            switch (x) { case 1: { T y = x; return y; } default: break; }
+            while (x) { x--; { T z; } }
+            return 0;
+        }
+    "#;
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_lazy_blocks(true);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    assert!(!result.has_errors());
+    let lazy = result.into_output().unwrap();
+    let (eager, _) = parse(code, false);
+
+    // The body is parsed, and the blocks in it are not
+    let outer = blocks(&bodies(&lazy)[0].items);
+    assert_eq!(outer.len(), 2);
+    assert!(outer.iter().all(|block| !block.is_parsed()));
+    // Parsing a block leaves the blocks nested in it unparsed
+    let inner = blocks(&outer[1].items);
+    assert_eq!(inner.len(), 1);
+    assert!(!inner[0].is_parsed());
+    assert!(!outer[0].is_parsed());
+
+    assert_eq!(lazy, eager);
+    assert!(outer.iter().chain(&inner).all(|block| block.errors().is_empty()));
+}
@@ -0,0 +1,469 @@
+use cgrammar::{span::LineCol, *};
+use rstest::rstest;
+
+fn lex_values(code: &str) -> Vec<BalancedToken> {
+    let (tokens, _) = lex(code, None);
+    tokens.tokens.into_iter().map(|token| token.value).collect()
+}
+
+fn ident(name: &str) -> BalancedToken {
+    BalancedToken::Identifier(name.into())
+}
+
+fn int(value: i128) -> BalancedToken {
+    BalancedToken::Constant(Constant::Integer(value.into()))
+}
+
+fn wide(text: &str, suffix: Option<IntegerSuffix>) -> BalancedToken {
+    let value = IntegerValue::Wide(text.into());
+    BalancedToken::Constant(Constant::Integer(IntegerConstant { value, suffix }))
+}
+
+#[rstest]
+#[case("foo _bar baz9", vec![ident("foo"), ident("_bar"), ident("baz9")])]
+#[case("café ünï", vec![ident("café"), ident("ünï")])]
+// Identifiers longer than a block, ending at, before and after a non-ASCII character
+#[case("abcdefghijklmnopqrstuvwxyz_0123456789 abcdefghijklmnopé abcdefghijklmnopqé+x", vec![
+    ident("abcdefghijklmnopqrstuvwxyz_0123456789"),
+    ident("abcdefghijklmnopé"),
+    ident("abcdefghijklmnopqé"),
+    BalancedToken::Punctuator(Punctuator::Plus),
+    ident("x"),
+])]
+#[case("true falsey nullptr", vec![
+    BalancedToken::Constant(Constant::Predefined(PredefinedConstant::True)),
+    ident("falsey"),
+    BalancedToken::Constant(Constant::Predefined(PredefinedConstant::Nullptr)),
+])]
+#[case("0 017 0x1F 0b101 1'000", vec![int(0), int(0o17), int(0x1f), int(0b101), int(1000)])]
+#[case("0o1'7 0B1'1 0Xf'F", vec![int(0o17), int(0b11), int(0xff)])]
+// Constants wider than a `u64` keep their text
+#[case("18446744073709551615 18446744073709551616", vec![int(u64::MAX.into()), wide("18446744073709551616", None)])]
+#[case("0x1'0000'0000'0000'0000uwb 0777777777777777777777777wb", vec![
+    wide("0x1'0000'0000'0000'0000", Some(IntegerSuffix::UnsignedBitPrecise)),
+    wide("0777777777777777777777777", Some(IntegerSuffix::BitPrecise)),
+])]
+#[case("u8 L x", vec![ident("u8"), ident("L"), ident("x")])]
+#[case("a->b", vec![ident("a"), BalancedToken::Punctuator(Punctuator::Arrow), ident("b")])]
+#[case("x <<= 1", vec![ident("x"), BalancedToken::Punctuator(Punctuator::LeftShiftAssign), int(1)])]
+#[case("<<>>=...--->..:: ## !", [
+    Punctuator::LeftShift,
+    Punctuator::RightShiftAssign,
+    Punctuator::Ellipsis,
+    Punctuator::Decrement,
+    Punctuator::Arrow,
+    Punctuator::Dot,
+    Punctuator::Dot,
+    Punctuator::Scope,
+    Punctuator::HashHash,
+    Punctuator::Bang,
+].map(BalancedToken::Punctuator).to_vec())]
+#[case("a /* x * / y */ b // c\n\x0bd", vec![ident("a"), ident("b"), ident("d")])]
+#[case("a\u{a0}b\u{2003}\tc", vec![ident("a"), ident("b"), ident("c")])]
+#[case("a /* unterminated", vec![ident("a")])]
+#[case("$", vec![BalancedToken::Unknown])]
+#[case("$\u{1}€\\ x $+", vec![BalancedToken::Unknown, ident("x"), BalancedToken::Unknown, BalancedToken::Punctuator(Punctuator::Plus)])]
+fn test_tokens(#[case] code: &str, #[case] expected: Vec<BalancedToken>) {
+    assert_eq!(lex_values(code), expected);
+}
+
+#[test]
+fn test_unknown_runs() {
+    let (tokens, _) = lex("a $$\\$b\u{1}\u{1}€ é", None);
+    let spans: Vec<_> = tokens
+        .tokens
+        .iter()
+        .map(|token| (token.value.clone(), token.span.range()))
+        .collect();
+    assert_eq!(
+        spans,
+        [
+            (ident("a"), 0..1),
+            (BalancedToken::Unknown, 2..6),
+            (ident("b"), 6..7),
+            (BalancedToken::Unknown, 7..12),
+            (ident("é"), 13..15),
+        ]
+    );
+}
+
+#[rstest]
+#[case(".5", 0.5)]
+#[case("1.", 1.0)]
+#[case("1e3", 1000.0)]
+#[case("0x1p4", 16.0)]
+#[case("1'000.2'5", 1000.25)]
+#[case("0x1'0p0", 16.0)]
+fn test_floating(#[case] code: &str, #[case] expected: f64) {
+    assert_eq!(
+        lex_values(code),
+        vec![BalancedToken::Constant(Constant::Floating(expected.into()))]
+    );
+}
+
+#[rstest]
+#[case(r#"u8"a" "b""#, "ab", Some(EncodingPrefix::U8))]
+#[case(r#"L"wide""#, "wide", Some(EncodingPrefix::L))]
+#[case(r#""tab\t""#, "tab\t", None)]
+#[case(r#""q\"uote\x41\101\u00e9 ok""#, "q\"uoteAAé ok", None)]
+#[case("\"a\\\nb\"", "a\nb", None)]
+#[case("\"café", "café", None)]
+#[case(r#""\\\"\\" "\\""#, "\\\"\\\\", None)]
+fn test_string_literal(#[case] code: &str, #[case] joined: &str, #[case] prefix: Option<EncodingPrefix>) {
+    let tokens = lex_values(code);
+    let [BalancedToken::StringLiteral(literals)] = tokens.as_slice() else {
+        panic!("expected a single string literal, got {tokens:?}");
+    };
+    assert_eq!(literals.to_joined(), joined);
+    assert_eq!(literals.0[0].encoding_prefix, prefix);
+
+    let concatenated = literals.concatenated();
+    assert_eq!(concatenated.as_str(), joined);
+    assert_eq!(concatenated.encoding_prefix(), prefix);
+    assert_eq!(concatenated.pieces().len(), literals.0.len());
+    assert!((concatenated.pieces()).eq(literals.0.iter().map(|literal| literal.value.as_str())));
+}
+
+#[test]
+fn test_lex_bytes() {
+    let mut buffer = String::new();
+    let (tokens, ctx_map) = lex_bytes("int café;".as_bytes(), None, &mut buffer);
+    assert_eq!(tokens, lex("int café;", None).0);
+    assert!(buffer.is_empty());
+    assert_eq!(ctx_map.source, "int café;");
+
+    // Latin-1 `é`, and a truncated sequence in a string literal
+    let bytes = b"int caf\xe9 = \"a\xc3\";";
+    let (tokens, ctx_map) = lex_bytes(bytes, None, &mut buffer);
+    assert_eq!(ctx_map.source.len(), bytes.len());
+    let values: Vec<_> = tokens.tokens.iter().map(|token| token.value.clone()).collect();
+    assert_eq!(values[2], BalancedToken::Unknown);
+    assert_eq!(tokens.tokens[2].span.range(), 7..8);
+    let BalancedToken::StringLiteral(literal) = &values[4] else {
+        panic!("expected a string literal, got {:?}", values[4]);
+    };
+    assert_eq!(literal.to_joined(), "a\x1a");
+}
+
+#[test]
+fn test_unescape() {
+    assert!(matches!(
+        StringLiteral::unescape("plain"),
+        std::borrow::Cow::Borrowed("plain")
+    ));
+    assert_eq!(StringLiteral::unescape(r"a\nb\\"), "a\nb\\");
+}
+
+#[rstest]
+#[case("'a'", "a", None)]
+#[case("u'b'", "b", Some(EncodingPrefix::U))]
+#[case("L'\\n'", "\n", Some(EncodingPrefix::L))]
+#[case(r"'\x41\'\101b'", "A'Ab", None)]
+fn test_character_constant(#[case] code: &str, #[case] value: &str, #[case] prefix: Option<EncodingPrefix>) {
+    let tokens = lex_values(code);
+    let [BalancedToken::Constant(Constant::Character(cc))] = tokens.as_slice() else {
+        panic!("expected a single character constant, got {tokens:?}");
+    };
+    assert_eq!(cc.value, value);
+    assert_eq!(cc.encoding_prefix, prefix);
+}
+
+#[test]
+fn test_line_directive_context() {
+    let code = "int a;\n# 10 \"foo.h\"\nint b;\n# 3 \"bar.h\"\nint c;";
+    let (tokens, ctx_map) = lex(code, Some("input.c"));
+    let filenames: Vec<_> = tokens
+        .tokens
+        .iter()
+        .filter(|token| matches!(token.value, BalancedToken::Identifier(_)))
+        .map(|token| token.span.at_context(&ctx_map).0.map(|ctx| &*ctx.filename))
+        .collect();
+    let expected = ["input.c", "input.c", "foo.h", "foo.h", "bar.h", "bar.h"].map(Some);
+    assert_eq!(filenames, expected);
+    assert_eq!(size_of::<span::Span>(), 8);
+}
+
+#[test]
+fn test_line_markers_share_contexts() {
+    let code = "# 2 \"a.h\"\nint a;\n# 4 \"a.h\"\nint b;\n# 9 \"a.h\"\nint c;";
+    let (tokens, ctx_map) = lex(code, None);
+    let ids: Vec<_> = tokens
+        .tokens
+        .iter()
+        .map(|token| token.span.context_id(&ctx_map))
+        .collect();
+    // Both first markers keep the lines of `a.h` equal to those of the input
+    assert_eq!(ids[0], ids[3]);
+    assert_ne!(ids[3], ids[6]);
+    let filename = |id| ctx_map.context(id).unwrap().filename.clone();
+    assert!(std::sync::Arc::ptr_eq(&filename(ids[0]), &filename(ids[6])));
+}
+
+#[test]
+fn test_line_col() {
+    let code = "int a;\n# 10 \"foo.h\"\nint b;\n  /* é */ int c;";
+    let (tokens, ctx_map) = lex(code, Some("main.c"));
+    let positions: Vec<_> = tokens
+        .tokens
+        .iter()
+        .map(|token| token.span.line_col(&ctx_map))
+        .collect();
+    let lines: Vec<_> = positions.iter().map(|position| position.line).collect();
+    assert_eq!(lines, [1, 1, 1, 10, 10, 10, 11, 11, 11]);
+    let columns: Vec<_> = positions.iter().map(|position| position.column).collect();
+    assert_eq!(columns, [1, 5, 6, 1, 5, 6, 11, 15, 16]);
+    assert_eq!(ctx_map.line_col(code.len()), LineCol { line: 11, column: 17 });
+}
+
+#[cfg(feature = "mmap")]
+#[test]
+fn test_source_file() {
+    let path = std::env::temp_dir().join(format!("cgrammar-source-file-{}.c", std::process::id()));
+    std::fs::write(&path, "int a;\n# 10 \"foo.h\"\nint b;").unwrap();
+    {
+        let file = SourceFile::open(&path).unwrap();
+        let (tokens, ctx_map) = file.lex();
+        let (expected, _) = lex(&std::fs::read_to_string(&path).unwrap(), path.to_str());
+        assert_eq!(tokens, expected);
+        let last = tokens.tokens.last().unwrap();
+        assert_eq!(&*last.span.at_context(&ctx_map).0.unwrap().filename, "foo.h");
+    }
+
+    std::fs::write(&path, b"int \xff;").unwrap();
+    let err = SourceFile::open(&path).unwrap_err();
+    assert_eq!(err.kind(), std::io::ErrorKind::InvalidData);
+    std::fs::remove_file(&path).unwrap();
+}
+
+const HEADER: &str = "# 1 \"h.h\"\ntypedef int T;\nstruct s { T x; };\n# 3 \"a.c\"\n";
+
+fn contexts(
+    tokens: &BalancedTokenSequence,
+    ctx_map: &span::ContextMapping,
+) -> Vec<(Option<span::SourceContext>, usize)> {
+    tokens
+        .tokens
+        .iter()
+        .map(|token| token.span)
+        .chain([tokens.eoi])
+        .map(|span| {
+            let (ctx, range) = span.at_context(ctx_map);
+            (ctx.cloned(), range.start)
+        })
+        .collect()
+}
+
+#[rstest]
+#[case("int a;")]
+#[case("int f(void) { return 0; }\n")]
+// A function body spanning line markers
+#[case("int f(void) {\n# 10 \"b.h\"\nreturn 0;\n# 5 \"a.c\"\n}\n")]
+// A comment spanning a line marker
+#[case("/*\n# 10 \"b.h\"\n*/ int a;\n# 12 \"b.h\"\nint b;")]
+// A stray closing bracket ends the tokens
+#[case("int a; }\n# 10 \"b.h\"\nint b;")]
+fn test_lex_cached(#[case] code: &str) {
+    let cache = TokenCache::new();
+    for prefix in ["", HEADER, "int x;\n\n"] {
+        let source = format!("{prefix}{HEADER}{code}");
+        for _ in 0..2 {
+            let (tokens, ctx_map) = lex_cached(&source, Some("a.c"), &cache);
+            let (expected, expected_ctx_map) = lex(&source, Some("a.c"));
+            assert_eq!(tokens, expected);
+            assert_eq!(contexts(&tokens, &ctx_map), contexts(&expected, &expected_ctx_map));
+        }
+    }
+}
+
+#[test]
+fn test_lex_cached_reuses_regions() {
+    let cache = TokenCache::new();
+    lex_cached(&format!("{HEADER}int a;"), Some("a.c"), &cache);
+    let regions = cache.len();
+    lex_cached(&format!("{HEADER}int b;"), Some("b.c"), &cache);
+    assert_eq!(cache.len(), regions + 1);
+}
+
+#[rstest]
+#[case("int a;\nint f(void) { return a; }\n")]
+// Lines starting in the first column inside a function body
+#[case("int f(void) {\nreturn 0;\n}\n")]
+// ... a comment, and a string literal continued on the next line
+#[case("/*\nint a;\n*/\nconst char *s = \"\\\nint b;\";\n")]
+// Line markers
+#[case("# 10 \"b.h\"\nint a;\n# 3 \"a.c\"\n  int b;\n")]
+// A stray closing bracket ends the tokens
+#[case("int a;\n}\nint b;\n")]
+fn test_lex_parallel(#[case] code: &str) {
+    let source = format!("{HEADER}{}", code.repeat((1 << 17) / code.len()));
+    let (tokens, ctx_map) = lex_parallel(&source, Some("a.c"));
+    let (expected, expected_ctx_map) = lex(&source, Some("a.c"));
+    assert_eq!(tokens, expected);
+    assert_eq!(contexts(&tokens, &ctx_map), contexts(&expected, &expected_ctx_map));
+}
+
+#[rstest]
+#[case("int a; int f(void) { return (a[0]); }")]
+#[case("int a;\n# 10 \"b.h\"\nint b; /* trailing */ ")]
+// A stray closing bracket ends the tokens
+#[case("int a; ) int b;")]
+#[case("")]
+fn test_lex_iter(#[case] code: &str) {
+    let mut stream = lex_iter(code, Some("a.c"));
+    let tokens: Vec<_> = stream.by_ref().collect();
+    assert_eq!(stream.next(), None);
+    // Only a stray closing bracket stops the tokens before the end
+    let rest = code[stream.offset()..].trim_start();
+    assert!(rest.is_empty() || rest.starts_with(')'));
+    let (eoi, ctx_map) = stream.finish();
+    let tokens = BalancedTokenSequence { tokens, closed: true, eoi };
+
+    let (expected, expected_ctx_map) = lex(code, Some("a.c"));
+    assert_eq!(tokens, expected);
+    assert_eq!(contexts(&tokens, &ctx_map), contexts(&expected, &expected_ctx_map));
+}
+
+#[rstest]
+#[case("int a;", "int a;")]
+#[case("f(a+b,\n  c[1]) {x++;}", "f(a+b, c[1]) {x++;}")]
+#[case(
+    "x = 1.5e+3f + 0x10u - 'a' ; s = u8\"s\\n\" \"t\";",
+    "x = 1.5e+3f + 0x10u - 'a' ; s = u8\"s\\n\" \"t\";"
+)]
+#[case("a - -b; c+ +d; s . x", "a - -b; c+ +d; s . x")]
+fn test_write_tokens(#[case] code: &str, #[case] expected: &str) {
+    let (tokens, _) = lex(code, None);
+    assert_eq!(tokens.display(Some(code)).to_string(), expected);
+
+    // Without the source, the tokens are written from their values
+    let written = tokens.display(None).to_string();
+    assert_eq!(lex_values(&written), lex_values(code), "{written}");
+}
+
+#[rstest]
+#[case("")]
+#[case("  \n// only a comment\n")]
+#[case("int a; /* b */ int f(int b) {\n\treturn (a[ b ] + a) ; // c\n}\n")]
+#[case("# 3 \"a.h\"\nchar *s = \"a\"  /* x */ u8\"b\"\n\"c\" ;\n#pragma once\nint x\t;  ")]
+#[case("f( ( ) ) [\n] {  {}}")]
+fn test_lex_trivia(#[case] code: &str) {
+    let (tokens, _, trivia) = lex_trivia(code, Some("a.c"));
+    assert_eq!(tokens, lex(code, Some("a.c")).0);
+
+    let mut written = String::new();
+    tokens.write_with_trivia(code, &trivia, &mut written).unwrap();
+    assert_eq!(written, code);
+
+    // The runs are the text outside the tokens, and nothing else
+    let runs: usize = trivia.iter().map(|run| run.len()).sum();
+    let mut spans = 0;
+    let mut stack = vec![&tokens];
+    while let Some(sequence) = stack.pop() {
+        for token in &sequence.tokens {
+            match &token.value {
+                BalancedToken::Parenthesized(inner)
+                | BalancedToken::Bracketed(inner)
+                | BalancedToken::Braced(inner) => {
+                    spans += 2;
+                    stack.push(inner);
+                }
+                BalancedToken::StringLiteral(_) => {
+                    spans += token.span.range().len();
+                    let inside = trivia.iter().filter(|run| token.span.range().contains(&run.start));
+                    spans -= inside.map(|run| run.len()).sum::<usize>();
+                }
+                _ => spans += token.span.range().len(),
+            }
+        }
+    }
+    assert_eq!(runs + spans, code.len());
+}
+
+#[test]
+fn test_trivia_after_edit() {
+    let code = "int a; // first\nint b; /* second */ int c;\n";
+    let (mut tokens, _, trivia) = lex_trivia(code, None);
+    assert_eq!(trivia.before(code.find("int b").unwrap()), Some(6..16));
+    assert_eq!(trivia.before(code.find("b;").unwrap()), Some(20..21));
+    assert_eq!(trivia.before(1), None);
+
+    // Each comment goes with the token after it
+    tokens.tokens.drain(3..6);
+    let mut written = String::new();
+    tokens.write_with_trivia(code, &trivia, &mut written).unwrap();
+    assert_eq!(written, "int a; /* second */ int c;\n");
+}
+
+#[test]
+fn test_lex_occurrences() {
+    let code = "int a; int f(int b) { return (a[b] + a) ? true : f(b); }\n/* a */ struct s { int a; };";
+    let (tokens, _, index) = lex_occurrences(code, None);
+    assert_eq!(tokens, lex(code, None).0);
+
+    let offsets = |name: &str| index.offsets(Symbol::intern(name)).to_vec();
+    assert_eq!(offsets("f"), [11, 49]);
+    assert_eq!(offsets("b"), [17, 32, 51]);
+    // Not in the comment
+    assert_eq!(offsets("a"), [4, 30, 37, 80]);
+    // Keywords and constants are left out
+    assert!(offsets("int").is_empty() && offsets("true").is_empty() && offsets("struct").is_empty());
+    assert!(offsets("missing").is_empty());
+
+    let spans: Vec<_> = index
+        .spans(Symbol::intern("f"))
+        .map(|span| &code[span.range()])
+        .collect();
+    assert_eq!(spans, ["f", "f"]);
+    assert_eq!(index.len(), index.names().len());
+    assert_eq!(
+        index.iter().map(|(_, offsets)| offsets.len()).sum::<usize>(),
+        4 + 2 + 3 + 1
+    );
+}
+
+#[rstest]
+#[case("int x = memcpy(a, b);", Some(8))]
+#[case("// memcpy\n/* memcpy */ char *s = \"memcpy\", c = 'm'; int memcpy_2;", None)]
+#[case("# 1 \"memcpy.h\"\nchar *s = u8\"\\\"memcpy\"; f(L'\\'') + memmove;", Some(50))]
+#[case("int a[] = { 0x1e+memcpy, (1) }", Some(17))]
+// The tokens end at a stray closing bracket, but not at a mismatched one
+#[case("int a; } memcpy;", None)]
+#[case("f(a[1); memcpy;", Some(8))]
+fn test_token_search(#[case] code: &str, #[case] expected: Option<usize>) {
+    let search = TokenSearch::new(["memcpy", "memmove"]);
+    let found = search.find(code);
+    assert_eq!(found.map(|span| span.range().start), expected);
+    assert_eq!(search.is_match(code), expected.is_some());
+    if let Some(span) = found {
+        assert!(search.is_match(&code[span.range()]));
+    }
+
+    // The same as the first occurrence among the tokens
+    let (_, _, index) = lex_occurrences(code, None);
+    let first = ["memcpy", "memmove"]
+        .iter()
+        .filter_map(|name| index.offsets(Symbol::intern(name)).first())
+        .min();
+    assert_eq!(first.map(|&offset| offset as usize), expected);
+}
+
+#[test]
+fn test_wide_integer_values() {
+    let values: Vec<_> =
+        lex_values("0x1'0000'0000'0000'0000uwb 0o2000000000000000000000wb 340282366920938463463374607431768211456wb")
+            .into_iter()
+            .map(|token| match token {
+                BalancedToken::Constant(Constant::Integer(integer)) => integer.value,
+                token => panic!("expected an integer constant, got {token:?}"),
+            })
+            .collect();
+    assert_eq!(values[0].to_u128(), Some(1 << 64));
+    assert_eq!(values[1].to_u128(), Some(1 << 64));
+    // Wider than a `u128`, and printed as written
+    assert_eq!(values[2].to_u128(), None);
+    assert_eq!(values[2].to_string(), "340282366920938463463374607431768211456");
+
+    let wide = IntegerConstant::from(i128::MAX);
+    assert_eq!(wide.value.to_u128(), Some(i128::MAX as u128));
+    assert_eq!(IntegerConstant::from(-1).value, IntegerValue::Narrow(0));
+}
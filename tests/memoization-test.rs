@@ -0,0 +1,44 @@
+use cgrammar::*;
+
+const SOURCE: &str = "
+typedef unsigned long size_t;
+static inline const size_t len(const char *s) { return sizeof(size_t) + (size_t)s[0]; }
+enum E { A, B } e = B;
+struct S { int x; enum { C } y; } s;
+int g = C, h = (int)A;
+extern int f(int), i;
+";
+
+fn parse(code: &str, memoize: bool) -> (TranslationUnit, bool, MemoStats) {
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_memoize(memoize);
+    let result = translation_unit().parse_with_state(tokens.as_input(), &mut state);
+    (
+        result.output().unwrap().clone(),
+        result.has_errors(),
+        state.memo_stats(),
+    )
+}
+
+#[test]
+fn test_memoized_parse_is_unchanged() {
+    let (expected, expected_errors, stats) = parse(SOURCE, false);
+    assert_eq!(stats, MemoStats::default());
+
+    let (unit, errors, stats) = parse(SOURCE, true);
+    assert_eq!(unit, expected);
+    assert_eq!(errors, expected_errors);
+    assert!(!errors);
+    assert!(stats.hits > 0);
+    assert!(stats.hit_rate() > 0.0 && stats.hit_rate() < 1.0);
+}
+
+#[test]
+fn test_memoized_parse_with_errors() {
+    let code = "struct S { int x y; } s; int f(void) { return (size_t)1; }";
+    let (expected, expected_errors, _) = parse(code, false);
+    let (unit, errors, _) = parse(code, true);
+    assert_eq!(unit, expected);
+    assert_eq!(errors, expected_errors);
+}
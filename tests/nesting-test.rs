@@ -0,0 +1,162 @@
+use cgrammar::{span::Span, *};
+
+/// Parse `code`, returning the output and whether there were errors.
+fn parse(code: &str, state: &mut State) -> (Option<TranslationUnit>, bool) {
+    let (tokens, _) = lex(code, None);
+    let result = translation_unit().parse_with_state(tokens.as_input(), state);
+    let has_errors = result.has_errors();
+    (result.into_output(), has_errors)
+}
+
+#[test]
+fn test_deeply_nested_tokens() {
+    let depth = 100_000;
+    let code = format!("{}{}", "(".repeat(depth), ")".repeat(depth));
+    let (tokens, _) = lex(&code, None);
+    let mut group = &tokens;
+    for _ in 0..depth {
+        let [token] = group.tokens.as_slice() else {
+            panic!("expected a single group");
+        };
+        let BalancedToken::Parenthesized(inner) = &token.value else {
+            panic!("expected a parenthesized group");
+        };
+        assert!(inner.closed);
+        group = inner;
+    }
+    assert!(group.tokens.is_empty());
+    // Dropping the tokens recurses once per level
+    std::mem::forget(tokens);
+}
+
+#[test]
+fn test_else_if_chain() {
+    let code = "void f(void) { if (a) x; else if (b) y; else z; }";
+    let (unit, has_errors) = parse(code, &mut State::new());
+    assert!(!has_errors);
+    let unit = unit.unwrap();
+    let ExternalDeclaration::Function(function) = &unit.external_declarations[0] else {
+        panic!("expected a function definition");
+    };
+    let BlockItem::Statement(UnlabeledStatement::Primary {
+        block: PrimaryBlock::Selection(selection),
+        ..
+    }) = &function.body.items[0]
+    else {
+        panic!("expected a selection statement");
+    };
+    let SelectionStatement::If { else_stmt: Some(else_stmt), .. } = selection else {
+        panic!("expected an else branch");
+    };
+    assert_eq!(&code[else_stmt.span.range()], "if (b) y; else z;");
+}
+
+/// Counts binary operators.
+struct CountOperators(usize);
+
+impl<'a> Visitor<'a> for CountOperators {
+    type Result = ();
+
+    fn visit_binary_operator(&mut self, _: &'a BinaryOperator) {
+        self.0 += 1;
+    }
+}
+
+#[test]
+fn test_long_else_if_chain() {
+    let mut code = String::from("void f(int x) { if (x == 0) { x = 1; }");
+    for i in 1..10_000 {
+        code.push_str(&format!(" else if (x == {i}) {{ x = {i}; }}"));
+    }
+    code.push_str(" else { x = -1; } }");
+    let (unit, has_errors) = parse(&code, &mut State::new());
+    assert!(!has_errors);
+    let unit = unit.unwrap();
+    let mut count = CountOperators(0);
+    count.visit_translation_unit(&unit);
+    assert_eq!(count.0, 10_000);
+}
+
+#[test]
+fn test_long_operator_chain() {
+    let code = format!("int a = 1{};", " + 1".repeat(100_000));
+    let (unit, has_errors) = parse(&code, &mut State::new());
+    assert!(!has_errors);
+    let unit = unit.unwrap();
+    let mut count = CountOperators(0);
+    count.visit_translation_unit(&unit);
+    assert_eq!(count.0, 100_000);
+}
+
+#[test]
+fn test_drop_long_operand_chains() {
+    // Operand chains this long cannot be parsed, so they are built directly
+    let length = 1_000_000;
+    let leaf = || PostfixExpression::Primary(PrimaryExpression::Identifier("x".into()));
+
+    let mut unary = UnaryExpression::Postfix(leaf());
+    for _ in 0..length {
+        unary = UnaryExpression::Unary {
+            operator: UnaryOperator::Minus,
+            operand: Box::new(CastExpression::Unary(unary)),
+        };
+    }
+    drop(Expression::new(ExpressionKind::Unary(unary), Span::default()));
+
+    let mut postfix = leaf();
+    for i in 0..length {
+        postfix = if i % 2 == 0 {
+            PostfixExpression::MemberAccess {
+                object: Box::new(postfix),
+                member: "b".into(),
+            }
+        } else {
+            PostfixExpression::FunctionCall {
+                function: Box::new(postfix),
+                arguments: Vec::new(),
+            }
+        };
+    }
+    drop(Expression::new(ExpressionKind::Postfix(postfix), Span::default()));
+}
+
+#[test]
+fn test_max_nesting_depth() {
+    let depth = 2000;
+    let code = format!("int a = {}1{};", "(".repeat(depth), ")".repeat(depth));
+    let mut state = State::new();
+    state.set_max_nesting_depth(Some(64));
+    let (_, has_errors) = parse(&code, &mut state);
+    assert!(has_errors);
+    assert!(state.nesting_depth_exceeded());
+
+    let mut state = State::new();
+    state.set_max_nesting_depth(Some(64));
+    let (_, has_errors) = parse("int a = ((1)); void f(void) { { { return; } } }", &mut state);
+    assert!(!has_errors);
+    assert!(!state.nesting_depth_exceeded());
+}
+
+#[test]
+fn test_max_nesting_depth_reused_state() {
+    let depth = 2000;
+    let deep = format!("int a = {}1{};", "(".repeat(depth), ")".repeat(depth));
+    let shallow = "int a = ((1)); void f(void) { { { return; } } }";
+    let mut state = State::new();
+    state.set_max_nesting_depth(Some(64));
+    let (_, has_errors) = parse(&deep, &mut state);
+    assert!(has_errors && state.nesting_depth_exceeded());
+
+    // A later parse with the same state is not failed by the earlier one
+    let (_, has_errors) = parse(shallow, &mut state);
+    assert!(!has_errors);
+    assert!(!state.nesting_depth_exceeded());
+
+    let (_, has_errors) = parse(&deep, &mut state);
+    assert!(has_errors);
+    state.set_max_nesting_depth(Some(64));
+    assert!(!state.nesting_depth_exceeded());
+    let mut fresh = State::new();
+    fresh.reset_from(&state);
+    assert!(!parse(shallow, &mut fresh).1);
+}
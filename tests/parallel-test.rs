@@ -0,0 +1,260 @@
+use std::ops::ControlFlow;
+
+use cgrammar::*;
+use rstest::rstest;
+
+#[test]
+fn test_parse_many() {
+    let sources = [
+        "typedef int term; term x;",
+        "int main(void) { return 0; }",
+        "int f(void) { return ; ",
+        "thm y;",
+    ];
+    let files: Vec<_> = sources.iter().map(|source| (*source, Some("input.c"))).collect();
+
+    let mut init_state = State::new();
+    init_state.ctx_mut().add_typedef_name("thm".into());
+    let parsed = parse_many(&files, &init_state);
+
+    assert_eq!(parsed.len(), sources.len());
+    for (source, unit) in sources.iter().zip(&parsed) {
+        let (tokens, _) = lex(source, Some("input.c"));
+        let expected = translation_unit().parse_with_state(tokens.as_input(), &mut init_state.clone());
+        assert_eq!(unit.output.as_ref(), expected.output());
+        assert_eq!(unit.has_errors(), expected.has_errors());
+    }
+    assert!(parsed[2].has_errors());
+    assert!(!parsed[3].has_errors());
+}
+
+#[test]
+fn test_parse_many_split() {
+    // Large enough to be split, with names declared along the way
+    let mut large = String::new();
+    for i in 0.. {
+        large.push_str(&format!("typedef int t{i}; enum {{ E{i} = {i} }}; t{i} v{i} = E{i}; "));
+        large.push_str(&format!("int f{i}(t{i} x) {{ return (t{i})x * E{i}; }} "));
+        if large.len() > 1 << 20 {
+            break;
+        }
+    }
+    let broken = large.clone() + "int g(void) { return ; ";
+    let sources = [large.as_str(), "int small(void) { return 1; }", broken.as_str()];
+    let files: Vec<_> = sources.iter().map(|source| (*source, None)).collect();
+
+    let parsed = parse_many(&files, &State::new());
+    assert_eq!(parsed.len(), sources.len());
+    for (source, unit) in sources.iter().zip(&parsed) {
+        let (tokens, _) = lex(source, None);
+        let expected = translation_unit().parse(tokens.as_input());
+        assert_eq!(unit.output.as_ref(), expected.output());
+        assert_eq!(unit.has_errors(), expected.has_errors());
+    }
+    assert!(!parsed[0].has_errors());
+    assert!(parsed[2].has_errors());
+}
+
+#[rstest]
+#[case("typedef int T; T f(T x) { return x; } enum E { A, B }; int g(void) { T y = A; return y * B; }")]
+#[case("struct S { int a; } s; int (*h(void))(int) { return 0; } int x = (int){1}, *p = &(int){2};")]
+#[case("int old(a) int a; { return a; } typedef struct { int v; } V; V v;")]
+#[case("int ok(void) { return 0; } int broken(void) { return ; ")]
+// Pending declarations between typedefs, each parsed with the names before it
+#[case("typedef int T; T a; typedef T U; U b, *c = (U *)0; int d = (T)1 + sizeof(U); enum E { A }; int e = A;")]
+#[case("")]
+fn test_parse_parallel(#[case] source: &str) {
+    let (tokens, _) = lex(source, None);
+
+    let mut expected_state = State::new();
+    let expected = translation_unit().parse_with_state(tokens.as_input(), &mut expected_state);
+
+    let mut state = State::new();
+    let (output, errors) = parse_parallel(&tokens, &mut state);
+    assert_eq!(output.as_ref(), expected.output());
+    assert_eq!(errors.is_empty(), !expected.has_errors());
+    for name in ["T", "V", "A", "B"] {
+        let name = Identifier::from(name);
+        assert_eq!(
+            state.ctx().is_typedef_name(&name),
+            expected_state.ctx().is_typedef_name(&name)
+        );
+        assert_eq!(
+            state.ctx().is_enum_constant(&name),
+            expected_state.ctx().is_enum_constant(&name)
+        );
+    }
+}
+
+/// A unit of many declarations, declaring typedef names and enumeration
+/// constants at the start and after declaration `middle`, if any.
+fn speculative_source(middle: Option<usize>) -> String {
+    let mut source = String::from("typedef int T; enum { A = 1 };\n");
+    for i in 0..300 {
+        if middle == Some(i) {
+            source.push_str("typedef long U; enum { B = 2 };\n");
+        }
+        let (ty, constant) = match middle {
+            Some(middle) if i > middle => ("U", "B"),
+            _ => ("T", "A"),
+        };
+        source.push_str(&format!("{ty} f{i}({ty} x) {{ return ({ty})x * {constant}; }}\n"));
+    }
+    source
+}
+
+#[rstest]
+#[case(speculative_source(None), 5)]
+#[case(speculative_source(Some(150)), 5)]
+#[case("int ok(void) { return 0; } int broken(void) { return ; ".to_string(), 1)]
+#[case(String::new(), 0)]
+fn test_parse_speculative(#[case] source: String, #[case] chunks: usize) {
+    let (tokens, _) = lex(&source, None);
+    let mut expected_state = State::new();
+    let expected = translation_unit().parse_with_state(tokens.as_input(), &mut expected_state);
+
+    let mut state = State::new();
+    let (output, errors, stats) = parse_speculative(&tokens, &mut state);
+    assert_eq!(output.as_ref(), expected.output());
+    assert_eq!(errors.is_empty(), !expected.has_errors());
+    for name in ["T", "U", "A", "B"] {
+        let name = Identifier::from(name);
+        assert_eq!(
+            state.ctx().is_typedef_name(&name),
+            expected_state.ctx().is_typedef_name(&name)
+        );
+        assert_eq!(
+            state.ctx().is_enum_constant(&name),
+            expected_state.ctx().is_enum_constant(&name)
+        );
+    }
+    if !expected.has_errors() {
+        // Only the chunks after the declarations of names are parsed again
+        assert_eq!(stats.chunks, chunks);
+        assert_eq!(stats.reparsed, chunks.saturating_sub(1));
+        assert_eq!(stats.sequential, 0);
+    }
+}
+
+#[rstest]
+#[case("typedef int T; T f(T x) { return x; } enum E { A, B }; int g(void) { T y = A; return y * B; }")]
+#[case("int old(a) int a; { return a; } typedef struct { int v; } V; V v;")]
+#[case("int a;\n# 10 \"b.h\"\nint f(void) { return 0; } int broken(void) { return ; ")]
+#[case("")]
+fn test_parse_pipelined(#[case] source: &str) {
+    let (tokens, _) = lex(source, Some("input.c"));
+    let mut expected_state = State::new();
+    let expected = translation_unit().parse_with_state(tokens.as_input(), &mut expected_state);
+
+    let (unit, stats) = parse_pipelined(source, Some("input.c"), &mut State::new());
+    assert_eq!(unit.output.as_ref(), expected.output());
+    assert_eq!(unit.has_errors(), expected.has_errors());
+    assert_eq!((stats.bytes, stats.tokens), (source.len(), tokens.tokens.len()));
+    assert!(stats.groups <= tokens.tokens.len());
+    if let Some(last) = tokens.tokens.last() {
+        let filename = last.span.at_context(&unit.ctx_map).0.map(|ctx| &*ctx.filename);
+        assert_eq!(filename, Some(if source.contains("b.h") { "b.h" } else { "input.c" }));
+    }
+}
+
+/// Collects the names of declared and referenced variables.
+#[derive(Default)]
+struct Names(Vec<String>);
+
+impl<'a> Visitor<'a> for Names {
+    type Result = ();
+
+    fn visit_variable_name(&mut self, id: &'a Identifier) {
+        self.0.push(id.to_string());
+    }
+}
+
+#[test]
+fn test_par_visit() {
+    let source: String = (0..1000)
+        .map(|i| format!("int v{i} = {i}; int f{i}(void) {{ return v{i}; }}\n"))
+        .collect();
+    let (tokens, _) = lex(&source, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    let mut expected = Names::default();
+    expected.visit_translation_unit(&unit);
+    let ControlFlow::Continue(Names(mut names)) = par_visit(&unit, Names::default, |mut a, b| {
+        a.0.extend(b.0);
+        a
+    });
+    expected.0.sort();
+    names.sort();
+    assert_eq!(names, expected.0);
+
+    let empty = TranslationUnit::default();
+    let ControlFlow::Continue(Names(names)) = par_visit(&empty, Names::default, |a, _| a);
+    assert!(names.is_empty());
+}
+
+/// Stops at the first variable with the given name.
+struct Find(&'static str);
+
+impl<'a> Visitor<'a> for Find {
+    type Result = ControlFlow<&'a Identifier>;
+
+    fn visit_variable_name(&mut self, id: &'a Identifier) -> Self::Result {
+        if id.to_string() == self.0 {
+            ControlFlow::Break(id)
+        } else {
+            ControlFlow::Continue(())
+        }
+    }
+}
+
+#[test]
+fn test_par_visit_break() {
+    let source: String = (0..1000).map(|i| format!("int v{i};\n")).collect();
+    let (tokens, _) = lex(&source, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    let result = par_visit(&unit, || Find("v500"), |a, _| a);
+    assert!(matches!(result, ControlFlow::Break(id) if id.to_string() == "v500"));
+    assert!(par_visit(&unit, || Find("missing"), |a, _| a).is_continue());
+}
+
+/// Prefixes every variable name with `w_`, noting the names it renamed.
+#[derive(Default)]
+struct Prefix(Vec<String>);
+
+impl<'a> VisitorMut<'a> for Prefix {
+    type Result = ();
+
+    fn visit_variable_name_mut(&mut self, id: &'a mut Identifier) {
+        self.0.push(id.to_string());
+        *id = Identifier::from(format!("w_{id}").as_str());
+    }
+}
+
+#[test]
+fn test_par_visit_mut() {
+    let source: String = (0..1000)
+        .map(|i| format!("int v{i} = {i}; int f{i}(void) {{ return v{i}; }}\n"))
+        .collect();
+    let (tokens, _) = lex(&source, None);
+    let mut unit = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    let mut expected = unit.clone();
+    let mut expected_outputs = Vec::new();
+    for declaration in &mut expected.external_declarations {
+        let mut visitor = Prefix::default();
+        visitor.visit_external_declaration_mut(declaration);
+        expected_outputs.push(visitor.0);
+    }
+
+    // The outputs come in the order of the declarations
+    let ControlFlow::Continue(outputs) =
+        par_visit_mut(&mut unit, Prefix::default, |visitor| std::mem::take(&mut visitor.0));
+    assert_eq!(outputs, expected_outputs);
+    assert!(outputs[1].contains(&"v0".to_string()));
+    assert_eq!(unit, expected);
+
+    let mut empty = TranslationUnit::default();
+    let ControlFlow::Continue(outputs) = par_visit_mut(&mut empty, Prefix::default, |_| ());
+    assert!(outputs.is_empty());
+}
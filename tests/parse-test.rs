@@ -1,14 +1,88 @@
 use std::{
+    hash::{DefaultHasher, Hash, Hasher},
     io::Write,
     path::{Path, PathBuf},
+    process::{Command, Stdio},
+    sync::{
+        OnceLock,
+        atomic::{AtomicUsize, Ordering},
+    },
+    time::{Duration, Instant},
 };
 
 use cgrammar::*;
 use rstest::rstest;
 
+const FAILED_TESTS: &str = "tests/failed-tests.txt";
+
+const CC_FLAGS: &[&str] = &[
+    "-E",
+    "-C",
+    "-x",
+    "c",
+    "--std=c2x",
+    "-D__extension__=",
+    "-U__GNUC__",
+    "-",
+];
+
+/// Preprocess `input` with `cc`, or take its output from an earlier run.
+///
+/// Outputs are kept as `.i` files in the target directory, named by a hash of
+/// the version of `cc`, its flags and the input, so that only new or changed
+/// test cases start a preprocessor. The headers they include are not part of
+/// the name: clean the target directory after updating the system headers.
+fn preprocess(input: &str) -> Vec<u8> {
+    static VERSION: OnceLock<Vec<u8>> = OnceLock::new();
+    static TEMPORARY: AtomicUsize = AtomicUsize::new(0);
+
+    let version = VERSION.get_or_init(|| {
+        let output = Command::new("cc").arg("--version").output().unwrap();
+        output.stdout
+    });
+    let mut hasher = DefaultHasher::new();
+    (version, CC_FLAGS, input).hash(&mut hasher);
+    let dir = Path::new(env!("CARGO_TARGET_TMPDIR")).join("preprocessed");
+    let path = dir.join(format!("{:016x}.i", hasher.finish()));
+    if let Ok(output) = std::fs::read(&path) {
+        return output;
+    }
+
+    let mut preprocessor = Command::new("cc")
+        .args(CC_FLAGS)
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .spawn()
+        .unwrap();
+    preprocessor
+        .stdin
+        .as_mut()
+        .unwrap()
+        .write_all(input.as_bytes())
+        .unwrap();
+    let output = preprocessor.wait_with_output().unwrap().stdout;
+
+    // Written aside and renamed, as tests run in parallel
+    std::fs::create_dir_all(&dir).unwrap();
+    let temporary = path.with_extension(format!("{}.tmp", TEMPORARY.fetch_add(1, Ordering::Relaxed)));
+    std::fs::write(&temporary, &output).unwrap();
+    std::fs::rename(&temporary, &path).unwrap();
+    output
+}
+
+fn collect_c_files(dir: &Path, files: &mut Vec<PathBuf>) {
+    for entry in std::fs::read_dir(dir).unwrap().flatten() {
+        let path = entry.path();
+        if path.is_dir() {
+            collect_c_files(&path, files);
+        } else if path.extension().is_some_and(|ext| ext == "c") {
+            files.push(path);
+        }
+    }
+}
+
 #[rstest]
 fn test_parser(#[files("tests/test-cases/**/*.c")] path: PathBuf) {
-    const FAILED_TESTS: &str = "tests/failed-tests.txt";
     let path = pathdiff::diff_paths(path, Path::new(".").canonicalize().unwrap()).unwrap();
     if std::fs::read_to_string(FAILED_TESTS)
         .unwrap_or_default()
@@ -18,27 +92,10 @@ fn test_parser(#[files("tests/test-cases/**/*.c")] path: PathBuf) {
         return;
     }
 
-    let input = std::fs::read_to_string(&path).unwrap();
-    let mut prepocessor = std::process::Command::new("cc")
-        .args([
-            "-E",
-            "-C",
-            "-x",
-            "c",
-            "--std=c2x",
-            "-D__extension__=",
-            "-U__GNUC__",
-            "-",
-        ])
-        .stdin(std::process::Stdio::piped())
-        .stdout(std::process::Stdio::piped())
-        .spawn()
-        .unwrap();
-    prepocessor.stdin.as_mut().unwrap().write_all(input.as_bytes()).unwrap();
-    let output = prepocessor.wait_with_output().unwrap();
-    let input = String::from_utf8(output.stdout).unwrap();
+    let input = preprocess(&std::fs::read_to_string(&path).unwrap());
 
-    let (tokens, _) = lex(&input, None);
+    let mut buffer = String::new();
+    let (tokens, _) = lex_bytes(&input, None, &mut buffer);
 
     let parser = translation_unit();
     let result = parser.parse(tokens.as_input());
@@ -52,7 +109,7 @@ fn test_parser(#[files("tests/test-cases/**/*.c")] path: PathBuf) {
 
         if std::env::var("GITHUB_ACTIONS").is_ok() {
             println!("::group::{}", path.to_string_lossy());
-            println!("{}", input);
+            println!("{}", String::from_utf8_lossy(&input));
             println!("::endgroup::");
         }
 
@@ -62,3 +119,75 @@ fn test_parser(#[files("tests/test-cases/**/*.c")] path: PathBuf) {
         panic!("Parsing failed with errors");
     }
 }
+
+/// Validate each test case, which must succeed like the full parse.
+#[rstest]
+fn test_validate(#[files("tests/test-cases/**/*.c")] path: PathBuf) {
+    let path = pathdiff::diff_paths(path, Path::new(".").canonicalize().unwrap()).unwrap();
+    if std::fs::read_to_string(FAILED_TESTS)
+        .unwrap_or_default()
+        .contains(path.to_string_lossy().as_ref())
+    {
+        return;
+    }
+
+    let input = preprocess(&std::fs::read_to_string(&path).unwrap());
+    let mut buffer = String::new();
+    let (tokens, _) = lex_bytes(&input, None, &mut buffer);
+
+    let result = validate(&tokens, &mut State::new());
+    assert!(result.is_ok(), "{:?}", result.unwrap_err());
+}
+
+#[rstest]
+#[case("typedef int T; T x; int f(T t) { T * p = &t; return *p; }", true)]
+#[case("int f(void) { T * x; return 0; } typedef int T;", true)]
+#[case("typedef int T; T x = ;", false)]
+#[case("int x = (1 1); int y;", false)]
+fn test_validate_declares_names(#[case] input: &str, #[case] valid: bool) {
+    let (tokens, _) = lex(input, None);
+    let mut state = State::new();
+    assert_eq!(validate(&tokens, &mut state).is_ok(), valid);
+    assert_eq!(translation_unit().parse(tokens.as_input()).has_errors(), !valid);
+    if valid {
+        assert!(state.is_typedef_name(&"T".into()));
+    }
+}
+
+/// Parse the whole corpus in-process and report the throughput, so that the
+/// suite doubles as a benchmark of the lexer and parser. Run it alone, e.g.
+/// with `cargo test --release --test parse-test corpus -- --nocapture`, for
+/// a steady figure.
+#[test]
+fn test_corpus_throughput() {
+    let failed = std::fs::read_to_string(FAILED_TESTS).unwrap_or_default();
+    let mut files = Vec::new();
+    collect_c_files(Path::new("tests/test-cases"), &mut files);
+    files.sort();
+    let sources: Vec<_> = files
+        .iter()
+        .filter(|path| !failed.contains(path.to_string_lossy().as_ref()))
+        .map(|path| preprocess(&std::fs::read_to_string(path).unwrap()))
+        .collect();
+
+    let parser = translation_unit();
+    let (mut lexing, mut parsing) = (Duration::ZERO, Duration::ZERO);
+    let mut buffer = String::new();
+    for source in &sources {
+        let start = Instant::now();
+        let (tokens, _) = lex_bytes(source, None, &mut buffer);
+        lexing += start.elapsed();
+        let start = Instant::now();
+        std::hint::black_box(parser.parse(tokens.as_input()));
+        parsing += start.elapsed();
+    }
+
+    let bytes: usize = sources.iter().map(Vec::len).sum();
+    let throughput = |time: Duration| bytes as f64 / (1 << 20) as f64 / time.as_secs_f64();
+    println!(
+        "Parsed {} files, {bytes} bytes: lexing {lexing:.3?} ({:.1} MiB/s), parsing {parsing:.3?} ({:.1} MiB/s)",
+        sources.len(),
+        throughput(lexing),
+        throughput(parsing),
+    );
+}
@@ -0,0 +1,58 @@
+use cgrammar::*;
+
+fn parse(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+/// Renames every variable `x` to `y`.
+struct Rename;
+
+impl<'a> VisitorMut<'a> for Rename {
+    type Result = ();
+
+    fn visit_variable_name_mut(&mut self, id: &'a mut Identifier) {
+        if id.0.as_ref() == "x" {
+            *id = Identifier::from("y");
+        }
+    }
+}
+
+fn is_function(declaration: &ExternalDeclaration, name: &str) -> bool {
+    let ExternalDeclaration::Function(function) = declaration else {
+        return false;
+    };
+    function.declarator.identifier() == Some(&Identifier::from(name))
+}
+
+#[test]
+fn test_copy_on_write() {
+    let code = "int x; int f(int x) { return x; } int g(int x) { return x * 2; }";
+    let base = SharedUnit::from(parse(code));
+    assert_eq!(base.len(), 3);
+
+    let mut variant = base.clone();
+    assert_eq!(variant.shared_with(&base), 3);
+    variant.transform(|declaration| is_function(declaration, "g"), &mut Rename);
+    // Only the rewritten declaration is copied
+    assert_eq!(variant.shared_with(&base), 2);
+    assert_ne!(variant, base);
+    assert_eq!(base.clone().into_unit(), parse(code));
+
+    let mut expected = parse(code);
+    Rename.visit_external_declaration_mut(&mut expected.external_declarations[2]);
+    assert_eq!(variant.clone().into_unit(), expected);
+
+    // Selecting nothing leaves everything shared
+    let mut unchanged = base.clone();
+    unchanged.transform(|_| false, &mut Rename);
+    assert_eq!(unchanged.shared_with(&base), 3);
+    unchanged.retain(|_| true);
+    assert_eq!(unchanged.shared_with(&base), 3);
+
+    unchanged.retain(|declaration| !matches!(declaration, ExternalDeclaration::Declaration(_)));
+    assert_eq!(unchanged.len(), 2);
+    assert_eq!(unchanged.get(0), base.get(1));
+    unchanged.make_mut(0).unwrap();
+    assert_eq!(unchanged.get(0), base.get(1));
+}
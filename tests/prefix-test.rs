@@ -0,0 +1,47 @@
+use cgrammar::*;
+use rstest::rstest;
+
+const PREFIX: &str = "typedef unsigned long size_t;\nenum { EOF = -1 };\nint putchar(int c) { return c; }\n";
+
+#[rstest]
+// Starts with the prefix
+#[case(&format!("{PREFIX}size_t n = EOF;\nint main(void) {{ size_t * p; return putchar(n); }}"), true)]
+// Only the prefix
+#[case(PREFIX, true)]
+// Another prefix of the same length
+#[case(&format!("int size_t;{}size_t * p;", &PREFIX[11..]), false)]
+// The same tokens and length, but one byte differs
+#[case(&PREFIX.replace("putchar(int c)", "putchar(int d)").replace("return c", "return d"), false)]
+// Shorter than the prefix
+#[case(&PREFIX[..PREFIX.len() - 2], false)]
+fn test_parse(#[case] source: &str, #[case] matches: bool) {
+    let snapshot = PrefixSnapshot::new(PREFIX, &State::new()).unwrap();
+    let (tokens, _) = lex(source, None);
+    assert_eq!(snapshot.matches(source, &tokens), matches);
+
+    let mut expected_state = State::new();
+    let expected = translation_unit().parse_with_state(tokens.as_input(), &mut expected_state);
+    let mut state = State::new();
+    let (output, errors) = snapshot.parse(source, &tokens, &mut state);
+    assert_eq!(output.as_ref(), expected.output());
+    assert_eq!(errors.is_empty(), !expected.has_errors());
+    for name in ["size_t", "EOF"] {
+        let name = Identifier::from(name);
+        assert_eq!(
+            state.ctx().is_typedef_name(&name),
+            expected_state.ctx().is_typedef_name(&name)
+        );
+        assert_eq!(
+            state.ctx().is_enum_constant(&name),
+            expected_state.ctx().is_enum_constant(&name)
+        );
+    }
+}
+
+#[rstest]
+#[case("int f(void) {")]
+#[case("typedef int T")]
+#[case("int a = (1 1);")]
+fn test_incomplete_prefix(#[case] prefix: &str) {
+    assert!(PrefixSnapshot::new(prefix, &State::new()).is_none());
+}
@@ -0,0 +1,228 @@
+use std::{cell::Cell, collections::HashMap, io, path::Path, rc::Rc, sync::Arc};
+
+use cgrammar::*;
+use rstest::rstest;
+
+/// A preprocessor reading the given files, with `sys` as an include path.
+fn preprocessor(files: &[(&'static str, &'static str)]) -> Preprocessor {
+    let files: HashMap<_, _> = files.iter().copied().collect();
+    let mut preprocessor = Preprocessor::new();
+    preprocessor.add_include_path("sys");
+    preprocessor.set_loader(move |path: &Path| {
+        let path = path.to_str().unwrap();
+        files
+            .get(path)
+            .map(|text| text.as_bytes().to_vec())
+            .ok_or_else(|| io::ErrorKind::NotFound.into())
+    });
+    preprocessor
+}
+
+/// The tokens lexed from `code`, written back without their spans.
+fn normalize(tokens: &BalancedTokenSequence) -> String {
+    lex(&tokens.display(None).to_string(), None).0.display(None).to_string()
+}
+
+#[rstest]
+#[case("#define N 1 + 2\nint x = N;", "int x = 1 + 2;")]
+#[case("#define F(a, b) ((a) * (b))\nF(1 + 1, 2)", "((1 + 1) * (2))")]
+#[case("#define S(x) #x\nS( a  +  \"b\\n\" )", r#""a + \"b\\n\"""#)]
+#[case(
+    "#define C(a, b) a ## b\nint C(foo, bar) = C(1, 2) + C(, x) + C(y, );",
+    "int foobar = 12 + x + y;"
+)]
+#[case("#define R R + 1\nR", "R + 1")]
+#[case("#define f(a) a*g\n#define g(a) f(a)\nf(2)(9)", "2*9*g")]
+#[case(
+    "#define V(...) f(0 __VA_OPT__(,) __VA_ARGS__)\n#define E\nV(a, b) V() V(E)",
+    "f(0, a, b) f(0) f(0)"
+)]
+#[case("#define H4(X, ...) __VA_OPT__(a X ## X) ## b\nH4(, 1)", "a b")]
+#[case("#define F(x, y) x y\nF(1,\n2)", "1 2")]
+#[case("#define F(x) [x]\nF\n(\n1\n)", "[1]")]
+#[case("#if defined(A) || 1 + 2 * 3 == 7\nyes\n#else\nno\n#endif", "yes")]
+#[case("#ifdef A\n#if 1/0\n#endif\nno\n#elifndef A\nyes\n#endif", "yes")]
+#[case("#if 0 && 1/0\nno\n#elif 1 ? 0 : 1\nno\n#else\nyes\n#endif", "yes")]
+#[case("#define T true\n#if T && __STDC_VERSION__ >= 202311L\nyes\n#endif", "yes")]
+#[case("int a = __LINE__;\n#line 10\nint b = __LINE__;", "int a = 1; int b = 10;")]
+#[case("\"a\" \"b\" _Pragma(\"x\") c", "\"a\" \"b\" c")]
+#[case("#define L __LINE__\nL\nL", "2 3")]
+#[case("#define F(x) [x]\n#define G F\nG(1) G", "[1] F")]
+#[case("#define M N\n#define N 1\nM\n#undef N\n#define N 2\nM M", "1 2 2")]
+#[case("#define P P + M\n#define M 1\nP P", "P + 1 P + 1")]
+fn test_preprocess(#[case] code: &str, #[case] expected: &str) {
+    let output = preprocessor(&[]).preprocess(code, "main.c");
+    assert!(output.errors.is_empty(), "{:?}", output.errors);
+    assert_eq!(normalize(&output.tokens), normalize(&lex(expected, None).0));
+}
+
+#[test]
+fn test_preprocess_include() {
+    let mut preprocessor = preprocessor(&[
+        ("inc/once.h", "#pragma once\nint once;\n"),
+        ("sys/types.h", "#include_next <types.h>\ntypedef int a_t;"),
+        ("types.h", "typedef int b_t;\n"),
+        ("inc/data.bin", "AB"),
+        ("inc/empty.bin", ""),
+    ]);
+    preprocessor.add_include_path("");
+    let code = "#include \"once.h\"\n#include \"once.h\"\n#include <types.h>\n\
+                #if __has_include(<types.h>) && !__has_include(\"missing.h\")\n\
+                char d[] = {\n#embed \"data.bin\" prefix(0,) suffix(, 9)\n};\n\
+                int e[] = {\n#embed \"empty.bin\" if_empty(-1)\n};\n#endif\n";
+    let output = preprocessor.preprocess(code, "inc/main.c");
+    assert!(output.errors.is_empty(), "{:?}", output.errors);
+    let expected = "int once; typedef int b_t; typedef int a_t; char d[] = { 0, 65, 66, 9 }; int e[] = { -1 };";
+    assert_eq!(normalize(&output.tokens), normalize(&lex(expected, None).0));
+
+    // Spans point into the included files, at their own lines
+    let ctx_map = output.ctx_map();
+    let place = |name: &str| {
+        let token = output
+            .tokens
+            .tokens
+            .iter()
+            .find(|token| matches!(&token.value, BalancedToken::Identifier(id) if id.0.as_str() == name))
+            .unwrap();
+        let (context, _) = token.span.at_context(&ctx_map);
+        (
+            context.unwrap().filename.to_string(),
+            token.span.line_col(&ctx_map).line,
+        )
+    };
+    assert_eq!(place("once"), ("inc/once.h".to_string(), 2));
+    assert_eq!(place("a_t"), ("sys/types.h".to_string(), 2));
+    assert_eq!(place("b_t"), ("types.h".to_string(), 1));
+    assert_eq!(place("e"), ("inc/main.c".to_string(), 8));
+
+    // The text of spans is read from the files, without joining them
+    assert!(ctx_map.source.is_empty());
+    let a_t = (output.tokens.tokens.iter())
+        .find(|token| matches!(&token.value, BalancedToken::Identifier(id) if id.0.as_str() == "a_t"))
+        .unwrap();
+    assert_eq!(ctx_map.text(a_t.span), Some("a_t"));
+    assert_eq!(ctx_map.line_text(a_t.span.range().start), Some("typedef int a_t;"));
+    assert_eq!(&output.source()[a_t.span.range()], "a_t");
+
+    let unit = translation_unit().parse(output.tokens.as_input());
+    assert!(!unit.has_errors());
+}
+
+#[test]
+fn test_preprocess_header_cache() {
+    const FILES: &[(&str, &str)] = &[
+        (
+            "mem/guard.h",
+            "// guarded\n#ifndef GUARD_H\n#define GUARD_H\nint g;\n#endif\n",
+        ),
+        ("mem/once.h", "#pragma once\nint o;\n"),
+        ("mem/plain.h", "int p;\n"),
+    ];
+    let cache = Arc::new(HeaderCache::new());
+    let reads = Rc::new(Cell::new(0));
+    let preprocessor = || {
+        let mut preprocessor = Preprocessor::new();
+        let reads = reads.clone();
+        preprocessor.set_loader(move |path: &Path| {
+            reads.set(reads.get() + 1);
+            let text = FILES.iter().find(|(name, _)| Path::new(name) == path).unwrap().1;
+            Ok(text.as_bytes().to_vec())
+        });
+        preprocessor.set_header_cache(cache.clone());
+        preprocessor
+    };
+
+    let code = "#include \"guard.h\"\n#include \"once.h\"\n#include \"plain.h\"\n\
+                #include \"guard.h\"\n#include \"once.h\"\n#include \"plain.h\"\n\
+                #undef GUARD_H\n#include \"guard.h\"\n";
+    let expected = normalize(&lex("int g; int o; int p; int p; int g;", None).0);
+    let first = preprocessor().preprocess(code, "mem/main.c");
+    assert!(first.errors.is_empty(), "{:?}", first.errors);
+    assert_eq!(normalize(&first.tokens), expected);
+    assert_eq!((reads.get(), cache.len()), (3, 3));
+
+    // Other units take the headers from the cache
+    let second = preprocessor().preprocess(code, "mem/main.c");
+    assert_eq!(normalize(&second.tokens), expected);
+    assert_eq!(second.source(), first.source());
+    assert_eq!(reads.get(), 3);
+
+    cache.clear();
+    preprocessor().preprocess(code, "mem/main.c");
+    assert_eq!(reads.get(), 6);
+}
+
+#[test]
+fn test_preprocess_freestanding_headers() {
+    let mut preprocessor = preprocessor(&[("sys/stdbool.h", "#define OWN_STDBOOL 1\n")]);
+    preprocessor.add_freestanding_headers();
+    let code = "#include <stddef.h>\n#include <stdint.h>\n#include <stdbool.h>\n#include <stdarg.h>\n\
+                #include <limits.h>\n#include <iso646.h>\n#include <stddef.h>\n\
+                #if INT32_MAX == INT_MAX && SIZE_MAX == UINT64_MAX && OWN_STDBOOL\n\
+                struct s { int a; uint8_t b; };\n\
+                size_t f(int n, ...) { va_list ap; va_start(ap, n); int32_t x = va_arg(ap, int32_t); va_end(ap);\n\
+                return offsetof(struct s, b) + x not_eq 0; }\nptrdiff_t d = NULL == nullptr;\n#endif\n";
+    let output = preprocessor.preprocess(code, "main.c");
+    assert!(output.errors.is_empty(), "{:?}", output.errors);
+    let unit = translation_unit().parse(output.tokens.as_input());
+    assert!(!unit.has_errors());
+
+    // Headers on the include paths are found first, and the built-in ones are
+    // read from no file
+    let ctx_map = output.ctx_map();
+    let (context, _) = output.tokens.tokens[0].span.at_context(&ctx_map);
+    assert_eq!(&*context.unwrap().filename, "<freestanding>/stddef.h");
+}
+
+#[test]
+fn test_preprocess_provenance() {
+    let code =
+        "#define INNER(x) x + 1\n#define OUTER(y) INNER(y) * 2\n#define N M\n#define M 1\nint a = OUTER(3) + (N, N);";
+    let output = preprocessor(&[]).preprocess(code, "main.c");
+    assert!(output.errors.is_empty(), "{:?}", output.errors);
+    let ctx_map = output.ctx_map();
+    // The macros each token comes from, innermost first, and where they were
+    // expanded
+    let stack = |index| {
+        (ctx_map.macro_stack(index))
+            .map(|(_, expansion)| (expansion.name.to_string(), ctx_map.text(expansion.site).unwrap()))
+            .collect::<Vec<_>>()
+    };
+    let stack_of = |names: &[&str]| names.iter().map(|&name| (name.to_string(), name)).collect::<Vec<_>>();
+
+    // int a = 3 + 1 * 2 + (1, 1);
+    assert!(stack(0).is_empty());
+    // Arguments keep the expansion of their tokens
+    assert!(stack(3).is_empty());
+    assert_eq!(stack(4), stack_of(&["INNER", "OUTER"]));
+    assert_eq!(stack(5), stack_of(&["INNER", "OUTER"]));
+    assert_eq!(stack(6), stack_of(&["OUTER"]));
+    assert!(stack(8).is_empty());
+
+    // Both uses of a memoized expansion have their own sites
+    let sites = |index| {
+        (ctx_map.macro_stack(index))
+            .map(|(_, expansion)| expansion.site.range().start)
+            .collect::<Vec<_>>()
+    };
+    let (first, second) = (sites(10), sites(12));
+    assert_eq!(first.len(), 2);
+    assert_eq!(first[0], second[0]);
+    assert_eq!(first[1], code.rfind("(N").unwrap() + 1);
+    assert_eq!(second[1], code.rfind("N)").unwrap());
+    assert!(ctx_map.expansion_at(13).is_none());
+}
+
+#[rstest]
+#[case("#error stop here", "#error stop here")]
+#[case("#include \"missing.h\"", "cannot find `missing.h`")]
+#[case("#if 1\nint x;", "unterminated conditional directive")]
+#[case("#endif", "#endif without #if")]
+#[case("#define F(x) x\nF(1, 2)", "macro `F` takes 1 arguments, but 2 were given")]
+#[case("#define F(x) #y", "`#` is not followed by a macro parameter")]
+#[case("#if 1 +\n#endif", "missing operand in `#if`")]
+fn test_preprocess_errors(#[case] code: &str, #[case] message: &str) {
+    let output = preprocessor(&[]).preprocess(code, "main.c");
+    let messages: Vec<_> = output.errors.iter().map(ToString::to_string).collect();
+    assert_eq!(messages, [message]);
+}
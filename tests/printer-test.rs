@@ -1,6 +1,6 @@
 #![cfg(feature = "printer")]
 
-use std::{io::Write, path::PathBuf};
+use std::{io::Write, path::PathBuf, sync::Arc};
 
 use cgrammar::{
     printer::Context,
@@ -35,7 +35,7 @@ fn remove_spans(tokens: &mut BalancedTokenSequence) {
         token.span = Default::default();
         match &mut token.value {
             BalancedToken::Parenthesized(tokens) | BalancedToken::Bracketed(tokens) | BalancedToken::Braced(tokens) => {
-                remove_spans(tokens);
+                remove_spans(Arc::make_mut(tokens));
             }
             _ => {}
         }
@@ -49,7 +49,7 @@ impl VisitorMut<'_> for RemoveSpans {
 
     fn visit_attribute_mut(&mut self, attr: &'_ mut Attribute) -> Self::Result {
         if let Some(tokens) = attr.arguments.as_mut() {
-            remove_spans(tokens);
+            remove_spans(Arc::make_mut(tokens));
         }
     }
 
@@ -164,3 +164,160 @@ fn test_printer(#[files("tests/test-cases/unit-tests/**/*.c")] path: PathBuf) {
 
     verify_roundtrip(&input);
 }
+
+#[test]
+fn test_write_translation_unit() {
+    let ast = parse_c("typedef int T; T f(T x) { return x * 2 + 1; } struct S { int a; } s;");
+    let mut output = Vec::new();
+    printer::write_translation_unit(&ast, &mut output, 80).unwrap();
+    assert_eq!(String::from_utf8(output).unwrap(), print_ast(&ast));
+}
+
+#[test]
+fn test_print_parallel() {
+    let code: String = (0..500)
+        .map(|i| format!("typedef int T{i}; static T{i} f{i}(T{i} x) {{ return x * {i} + 1; }}\n"))
+        .collect();
+    let ast = parse_c(&code);
+    assert_eq!(printer::print_parallel(&ast, 80), print_ast(&ast));
+}
+
+fn print_compact(ast: &TranslationUnit) -> String {
+    let mut printer = printer::CompactPrinter::new(Vec::new());
+    printer.visit_translation_unit(ast).unwrap();
+    String::from_utf8(printer.finish()).unwrap()
+}
+
+#[rstest]
+#[case("int f(int a, int b) { return a - -b + (a + b) * 2 - +a; }")]
+#[case("unsigned long x = 0x1Eu + 1, y = 1.5e3 - 2.;")]
+#[case("const char *s = u8\"x\" \"y\"; int c = L'a';")]
+#[case("struct S { int a : 3; } s = { .a = 1 }; int *p = &s.a, **q = &p;")]
+#[case("void g(void) { for (int i = 0; i < 10; i++) if (i & 1) continue; else break; }")]
+fn test_compact_printer(#[case] code: &str) {
+    let ast = parse_c(code);
+    let compact = print_compact(&ast);
+    assert_eq!(print_ast(&parse_c(&compact)), print_ast(&ast));
+    assert!(compact.len() <= print_ast(&ast).len());
+    assert_eq!(compact.lines().count(), ast.external_declarations.len());
+}
+
+#[test]
+fn test_compact_printer_line_markers() {
+    let code = "# 10 \"gen.c\"\nint a;\nint f(void) {\n  return 1;\n\n  return 2;\n}\n";
+    let (tokens, ctx_map) = lex(code, None);
+    let ast = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+    let mut printer = printer::CompactPrinter::with_line_markers(Vec::new(), &ctx_map);
+    printer.visit_translation_unit(&ast).unwrap();
+    let output = String::from_utf8(printer.finish()).unwrap();
+    assert!(output.starts_with("#line 10 \"gen.c\"\nint a;\n"));
+    assert!(output.contains("\nreturn 1;\n#line 14 \"gen.c\"\nreturn 2;"));
+    assert_eq!(print_ast(&parse_c(&output)), print_ast(&ast));
+}
+
+/// Renames the variable `x` to `y`.
+struct RenameX;
+
+impl VisitorMut<'_> for RenameX {
+    type Result = ();
+
+    fn visit_expression_mut(&mut self, e: &mut Expression) {
+        if let ExpressionKind::Postfix(PostfixExpression::Primary(PrimaryExpression::Identifier(name))) = &mut e.kind
+            && &*name.0 == "x"
+        {
+            *name = "y".into();
+        }
+        walk_expression_mut(self, e)
+    }
+}
+
+#[test]
+fn test_print_rewritten() {
+    let code = "int   a ; /* dropped */\nint f(void) {\n    return   1;\n}\nint g(int x, int y) { return x; }\n";
+    let original = parse_c(code);
+    let mut unit = original.clone();
+    RenameX.visit_translation_unit_mut(&mut unit);
+    let output = printer::print_rewritten(&unit, &original, code, 80);
+    assert!(output.starts_with("int   a ;\nint f(void) {\n    return   1;\n}\n"));
+    assert!(!output.contains("return x"));
+    assert_eq!(print_ast(&parse_c(&output)), print_ast(&parse_c(&print_ast(&unit))));
+}
+
+#[test]
+fn test_format_range() {
+    let code = "int   a ;\nint f(int x) {\n    if (x) {\n        x  =  x+1 ;\n    }\n    return x;\n}\n";
+    let unit = parse_c(code);
+
+    let at = code.find("x  =").unwrap();
+    let edits = printer::format_range(&unit, code, at..at, 80);
+    assert_eq!(edits.len(), 1);
+    assert_eq!(&code[edits[0].range.clone()], "{\n        x  =  x+1 ;\n    }");
+    assert_eq!(edits[0].text, "{ x = x + 1; }");
+
+    let edits = printer::format_range(&unit, code, 2..5, 80);
+    assert_eq!(edits, [printer::TextEdit { range: 0..9, text: "int a;".to_string() }]);
+
+    let edits = printer::format_range(&unit, code, 0..code.len(), 80);
+    assert_eq!(edits.len(), 2);
+    let mut formatted = code.to_string();
+    for edit in edits.iter().rev() {
+        formatted.replace_range(edit.range.clone(), &edit.text);
+    }
+    assert_eq!(print_ast(&parse_c(&formatted)), print_ast(&unit));
+}
+
+#[test]
+fn test_print_flat_specifiers() {
+    let code = "static const unsigned long long x; typedef int T; extern const T y, z; static inline T f(void);";
+    let printed = print_ast(&parse_c(code));
+    for expected in [
+        "static const unsigned long long x",
+        "extern const T y",
+        "static inline T f",
+    ] {
+        assert!(printed.contains(expected), "{printed}");
+    }
+    assert_eq!(print_ast(&parse_c(&printed)), printed);
+}
+
+/// Adds one to every integer constant.
+struct Increment;
+
+impl VisitorMut<'_> for Increment {
+    type Result = ();
+
+    fn visit_expression_mut(&mut self, e: &mut Expression) {
+        if let ExpressionKind::Postfix(PostfixExpression::Primary(PrimaryExpression::Constant(Constant::Integer(c)))) =
+            &mut e.kind
+        {
+            c.value = (c.value.as_u64().unwrap() + 1).into();
+        }
+        walk_expression_mut(self, e)
+    }
+}
+
+#[test]
+fn test_print_constants_from_source() {
+    let code = "double d = 0x1.8p1; unsigned long n = 1'000'000ul; char c = '\\x41'; int m = 0X1F;";
+    let print = |unit: &TranslationUnit| {
+        let mut printer = Printer::new_extra(String::new(), 80, Context::with_source(code));
+        printer.visit_translation_unit(unit).unwrap();
+        printer.finish().unwrap()
+    };
+    let mut unit = parse_c(code);
+    let printed = print(&unit);
+    for spelling in ["0x1.8p1", "1'000'000ul", "'\\x41'", "0X1F"] {
+        assert!(printed.contains(spelling), "{printed}");
+        assert!(!print_ast(&unit).contains(spelling));
+    }
+    assert_eq!(print_ast(&parse_c(&printed)), print_ast(&unit));
+
+    // Constants changed in place keep their spans, but not their spelling
+    Increment.visit_translation_unit_mut(&mut unit);
+    let printed = print(&unit);
+    assert!(printed.contains("0x1.8p1") && !printed.contains("1'000'000ul") && !printed.contains("0X1F"));
+    assert_eq!(
+        printed,
+        print_ast(&unit).replace("3.0", "0x1.8p1").replace("'A'", "'\\x41'")
+    );
+}
@@ -1,6 +1,6 @@
 #![cfg(feature = "quasi-quote")]
 
-use std::collections::HashMap;
+use std::{collections::HashMap, sync::Arc};
 
 use cgrammar::{
     quasi_quote::Interpolate,
@@ -15,7 +15,7 @@ fn remove_spans(tokens: &mut BalancedTokenSequence) {
         token.span = Default::default();
         match &mut token.value {
             BalancedToken::Parenthesized(tokens) | BalancedToken::Bracketed(tokens) | BalancedToken::Braced(tokens) => {
-                remove_spans(tokens);
+                remove_spans(Arc::make_mut(tokens));
             }
             _ => {}
         }
@@ -29,7 +29,7 @@ impl VisitorMut<'_> for RemoveSpans {
 
     fn visit_attribute_mut(&mut self, attr: &'_ mut Attribute) -> Self::Result {
         if let Some(tokens) = attr.arguments.as_mut() {
-            remove_spans(tokens);
+            remove_spans(Arc::make_mut(tokens));
         }
     }
 
@@ -67,3 +67,55 @@ fn test_interpolation(
 
     assert_eq!(ast1, ast2);
 }
+
+#[test]
+fn test_compiled_template() {
+    let template =
+        quasi_quote::CompiledTemplate::compile("int @var = @v + @v; int g(void) { return @var; }", |tokens| {
+            translation_unit()
+                .parse(tokens.as_input())
+                .into_result()
+                .map_err(|errors| format!("{errors:?}"))
+        })
+        .unwrap();
+
+    for value in 0..3i128 {
+        let mut ast1 = template
+            .instantiate(interpolate! { var => Identifier("x".into()), v => Constant::Integer(value.into()) })
+            .unwrap();
+        RemoveSpans.visit_translation_unit_mut(&mut ast1);
+
+        let (tokens, _) = lex(&format!("int x = {value} + {value}; int g(void) {{ return x; }}"), None);
+        let mut ast2 = translation_unit().parse(tokens.as_input()).unwrap();
+        RemoveSpans.visit_translation_unit_mut(&mut ast2);
+
+        assert_eq!(ast1, ast2);
+    }
+
+    assert!(
+        template
+            .instantiate(interpolate! { var => Identifier("x".into()) })
+            .is_err()
+    );
+    assert!(
+        template
+            .instantiate(interpolate! { var => Constant::Integer(1.into()), v => Constant::Integer(1.into()) })
+            .is_err()
+    );
+}
+
+#[rstest]
+#[case("int x = @v + (@v * @w);")]
+#[case("int x = 1; int y = @w;")]
+#[case("int x = 1;")]
+fn test_interpolate_owned(#[case] code: &str) {
+    let mapping = || interpolate! { v => Constant::Integer(1.into()), w => Constant::Integer(2.into()) };
+    let (mut borrowed, _) = lex(code, None);
+    borrowed.interpolate(&mapping()).unwrap();
+    let (mut owned, _) = lex(code, None);
+    owned.interpolate_owned(mapping()).unwrap();
+    assert_eq!(owned, borrowed);
+
+    let (mut missing, _) = lex(code, None);
+    assert_eq!(missing.interpolate_owned(HashMap::new()).is_err(), code.contains('@'));
+}
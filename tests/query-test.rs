@@ -0,0 +1,79 @@
+use cgrammar::{query::*, *};
+use rstest::rstest;
+
+const CODE: &str = r#"
+void f(char *dst, char *src, struct node *p) {
+    memcpy(dst, src, sizeof(*src));
+    memcpy(dst, src, 16);
+    (memset)(dst, 0, sizeof dst);
+    p->next = 0;
+    x = (a * b) + c;
+    puts("hello" " world");
+}
+"#;
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    let parser = translation_unit();
+    let result = parser.parse(tokens.as_input());
+    result.output().unwrap().clone()
+}
+
+#[rstest]
+#[case(r#"(call "memcpy" _ _ (sizeof _) @size)"#, &[("memcpy(dst, src, sizeof(*src))", &["sizeof(*src)"])])]
+#[case(r#"(call "memcpy" _ ..)"#, &[("memcpy(dst, src, sizeof(*src))", &[]), ("memcpy(dst, src, 16)", &[])])]
+#[case(r#"(call "memset" _ (int 0) _)"#, &[("(memset)(dst, 0, sizeof dst)", &[])])]
+#[case(r#"(assign "=" (arrow "next" _ @object) (int) @value)"#, &[("p->next = 0", &["p->next", "0"])])]
+#[case(r#"(binary "*" _ _)"#, &[("a * b", &[])])]
+#[case(r#"(binary "+" (binary _ _) @product "c")"#, &[("(a * b) + c", &["a * b"])])]
+#[case(r#"(call _ (string "hello world"))"#, &[(r#"puts("hello" " world")"#, &[])])]
+#[case(r#"(call "puts" (string "hello"))"#, &[])]
+fn test_query_matches(#[case] query: &str, #[case] expected: &[(&str, &[&str])]) {
+    let unit = parse_c(CODE);
+    let query = Query::new(query).unwrap();
+    let text = |span: span::Span| &CODE[span.range()];
+    let found: Vec<_> = (query.matches(&unit).into_iter())
+        .map(|m| (text(m.span), m.captures.into_iter().map(text).collect::<Vec<_>>()))
+        .collect();
+    let expected: Vec<_> = (expected.iter())
+        .map(|&(span, captures)| (span, captures.to_vec()))
+        .collect();
+    assert_eq!(found, expected);
+}
+
+#[test]
+fn test_query_set() {
+    let unit = parse_c(CODE);
+    let set = QuerySet::new([
+        r#"(call "memcpy" ..)"#.parse().unwrap(),
+        r#"(sizeof _ @operand)"#.parse().unwrap(),
+        r#"(ident "dst")"#.parse().unwrap(),
+    ]);
+    assert_eq!(set.len(), 3);
+    assert_eq!(set.queries()[1].capture_index("operand"), Some(0));
+
+    let matches = set.matches(&unit);
+    let count = |query| matches.iter().filter(|m| m.query == query).count();
+    assert_eq!(count(0), 2);
+    assert_eq!(count(1), 2);
+    assert_eq!(count(2), 4);
+    // Matches are in the order of the tree
+    assert!(
+        matches
+            .windows(2)
+            .all(|w| w[0].span.range().start <= w[1].span.range().start)
+    );
+}
+
+#[rstest]
+#[case("(call", 5)]
+#[case("(foo _)", 1)]
+#[case(r#"(binary "+" _)"#, 1)]
+#[case(r#"(binary "**" _ _)"#, 8)]
+#[case("(comma _ @x _ @x)", 15)]
+#[case(r#"(string "abc)"#, 8)]
+#[case("_ _", 2)]
+fn test_query_errors(#[case] query: &str, #[case] offset: usize) {
+    let error = Query::new(query).unwrap_err();
+    assert_eq!(error.offset, offset, "{error}");
+}
@@ -0,0 +1,117 @@
+use cgrammar::{
+    index::{AstIndex, Node, NodeId, NodeKind},
+    resolve::{Resolution, ScopeId, ScopeKind},
+    *,
+};
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+/// Each name used, in order, with the kind of the scope of its declaration.
+fn uses(code: &str) -> Vec<(String, Option<ScopeKind>)> {
+    let unit = parse_c(code);
+    let index = AstIndex::new(&unit);
+    let resolution = Resolution::new(&index);
+    (index.of_kind(NodeKind::PostfixExpression))
+        .filter_map(|(id, node)| match node {
+            Node::PostfixExpression(PostfixExpression::Primary(PrimaryExpression::Identifier(name))) => {
+                let scope = (resolution.definition(id.into())).map(|def| {
+                    let scope = resolution.scope_of(def).unwrap();
+                    resolution.scope(scope).kind()
+                });
+                Some((name.0.to_string(), scope))
+            }
+            _ => None,
+        })
+        .collect()
+}
+
+fn expected(uses: &[(&str, Option<ScopeKind>)]) -> Vec<(String, Option<ScopeKind>)> {
+    uses.iter().map(|&(name, scope)| (name.to_string(), scope)).collect()
+}
+
+#[test]
+fn test_resolve_scopes() {
+    use ScopeKind::*;
+    let code = "int x;\nint f(int x) { return x; }\nint g(void) { int y = x; { int x = y; x; } return x; }\nint h(int n, int a[n]) { for (int i = 0; i < n; i++) a[i] = k(i); return i; }";
+    assert_eq!(
+        uses(code),
+        expected(&[
+            ("x", Some(Function)),
+            ("x", Some(File)),
+            ("y", Some(Block)),
+            ("x", Some(Block)),
+            ("x", Some(File)),
+            ("n", Some(Function)),
+            ("i", Some(Block)),
+            ("n", Some(Function)),
+            ("i", Some(Block)),
+            ("a", Some(Function)),
+            ("i", Some(Block)),
+            ("k", None),
+            ("i", Some(Block)),
+            ("i", None),
+        ])
+    );
+}
+
+#[test]
+fn test_resolve_file_scope_order() {
+    use ScopeKind::*;
+    // A file-scope name is visible after its declaration, a function in its own body
+    let code = "int f(void) { return z + f(); }\nint z;\nint g(void) { return z; }";
+    assert_eq!(
+        uses(code),
+        expected(&[("z", None), ("f", Some(File)), ("z", Some(File))])
+    );
+}
+
+#[test]
+fn test_resolve_not_variables() {
+    use ScopeKind::*;
+    // Members, typedef names and prototype parameters declare no variables
+    let code = "typedef int t;\nstruct s { int m; };\nint (*p)(int q);\nint f(struct s v) { t w = 0; int (*c)(int m) = p; return v.m + m + q + w; }";
+    assert_eq!(
+        uses(code),
+        expected(&[
+            ("p", Some(File)),
+            ("v", Some(Function)),
+            ("m", None),
+            ("q", None),
+            ("w", Some(Block))
+        ])
+    );
+}
+
+#[test]
+fn test_resolve_definitions() {
+    let unit = parse_c("int f(int a) { int b = a; { int a = b; return a; } }");
+    let index = AstIndex::new(&unit);
+    let resolution = Resolution::new(&index);
+
+    // The uses of the inner `a` are its own, not those of the parameter
+    let [parameter, inner] = [0, 1].map(|i| {
+        (index.of_kind(NodeKind::Declarator))
+            .filter(|(_, node)| matches!(node, Node::Declarator(d) if d.identifier().is_some_and(|name| name.0 == Symbol::from("a"))))
+            .nth(i)
+            .map(|(id, _)| NodeId::from(id))
+            .unwrap()
+    });
+    assert_eq!(resolution.uses_of(parameter).count(), 1);
+    assert_eq!(resolution.uses_of(inner).count(), 1);
+    assert_eq!(resolution.uses().count(), 3);
+    assert!(resolution.unresolved().is_empty());
+
+    // The scope tree nests the blocks in the function scope
+    let scope = resolution.scope_of(inner).unwrap();
+    let kinds: Vec<_> = std::iter::successors(Some(scope), |&scope| resolution.scope(scope).parent())
+        .map(|scope| resolution.scope(scope).kind())
+        .collect();
+    assert_eq!(
+        kinds,
+        [ScopeKind::Block, ScopeKind::Block, ScopeKind::Function, ScopeKind::File]
+    );
+    assert_eq!(resolution.scope(ScopeId::FILE).names().len(), 1);
+}
@@ -0,0 +1,77 @@
+use cgrammar::{
+    rewrite::{Rewriter, Rule, apply_edits},
+    *,
+};
+
+fn rewrite(rules: &[(&str, &str)], code: &str) -> String {
+    let rewriter = Rewriter::new(
+        rules
+            .iter()
+            .map(|(query, replacement)| Rule::new(query, replacement).unwrap()),
+    );
+    let (tokens, _) = lex(code, None);
+    let unit = translation_unit().parse(tokens.as_input()).into_result().unwrap();
+    apply_edits(code, &rewriter.edits(&unit, code))
+}
+
+const SQUARE: (&str, &str) = (r#"(call "square" _ @x)"#, "@x * @x");
+
+#[test]
+fn test_rewrite_calls() {
+    let bzero = (r#"(call "bzero" _ @buf _ @len)"#, "memset(@buf, 0, @len)");
+    assert_eq!(
+        rewrite(
+            &[bzero],
+            "void f(char *p, int n) {\n  bzero(p, n); // clear\n  bzero(p+1,  n * 2);\n}"
+        ),
+        "void f(char *p, int n) {\n  memset(p, 0, n); // clear\n  memset(p+1, 0, n * 2);\n}"
+    );
+}
+
+#[test]
+fn test_rewrite_parentheses() {
+    assert_eq!(
+        rewrite(
+            &[SQUARE],
+            "int f(int a, int b) { int y = square(b); return a / square(a + 1); }"
+        ),
+        "int f(int a, int b) { int y = b * b; return a / ((a + 1) * (a + 1)); }"
+    );
+    let swap = (r#"(call "old" _ @a _ @b)"#, "new(@b, @a)");
+    assert_eq!(
+        rewrite(&[swap], "int f(int x) { return old(x, (1, 2)) + old(x + 1, x); }"),
+        "int f(int x) { return new((1, 2), x) + new(x, x + 1); }"
+    );
+}
+
+#[test]
+fn test_rewrite_nested() {
+    assert_eq!(
+        rewrite(&[SQUARE], "int f(int y) { return square(square(y)); }"),
+        "int f(int y) { return (y * y) * (y * y); }"
+    );
+}
+
+#[test]
+fn test_rewrite_errors() {
+    assert!(Rule::new(r#"(call "f" _ @a)"#, "g(@b)").is_err());
+    assert!(Rule::new(r#"(call "f" _ @a)"#, "g(@a-1)").is_ok());
+}
+
+#[test]
+fn test_rewrite_sources() {
+    let rewriter = Rewriter::new([Rule::new(SQUARE.0, SQUARE.1).unwrap()]);
+    let files = [
+        ("int f(int x) { return square(x); }", Some("a.c")),
+        ("int g(int x) { return x; }", Some("b.c")),
+        ("int h(int x) { return square(x) }", Some("c.c")),
+    ];
+    assert!(!rewriter.may_match(files[1].0));
+    let rewrites = rewriter.rewrite_sources(&files, &State::new());
+    assert_eq!(
+        apply_edits(files[0].0, &rewrites[0].edits),
+        "int f(int x) { return x * x; }"
+    );
+    assert!(rewrites[1].edits.is_empty());
+    assert!(rewrites[2].edits.is_empty() && rewrites[2].errors > 0);
+}
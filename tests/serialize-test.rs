@@ -0,0 +1,65 @@
+#![cfg(feature = "serde")]
+
+use cgrammar::{serialize::*, *};
+
+const SOURCE: &str = "typedef int T;\n# 10 \"header.h\"\nT f(T x) { return x * 2.5 + 'a'; }\nchar *s = u8\"str\";\n";
+
+fn parse(source: &str, state: &mut State) -> (BalancedTokenSequence, TranslationUnit, span::ContextMapping<'_>) {
+    let (tokens, ctx_map) = lex(source, Some("input.c"));
+    let unit = translation_unit()
+        .parse_with_state(tokens.as_input(), state)
+        .into_output()
+        .unwrap();
+    (tokens, unit, ctx_map)
+}
+
+#[test]
+fn test_round_trip() {
+    let (tokens, unit, ctx_map) = parse(SOURCE, &mut State::new());
+    let bytes = encode(&tokens, &unit, &ctx_map).unwrap();
+
+    let (decoded_tokens, decoded_unit, decoded_ctx_map) = decode(&bytes, SOURCE).unwrap();
+    assert_eq!(decoded_tokens, tokens);
+    assert_eq!(decoded_unit, unit);
+    for offset in [0, SOURCE.find("T f").unwrap()] {
+        let id = ctx_map.context_at(offset);
+        assert_eq!(decoded_ctx_map.context_at(offset), id);
+        assert_eq!(decoded_ctx_map.context(id), ctx_map.context(id));
+    }
+}
+
+#[test]
+fn test_lazy_function_bodies() {
+    let mut state = State::new();
+    state.set_lazy_function_bodies(true);
+    let (tokens, unit, ctx_map) = parse(SOURCE, &mut state);
+    let bytes = encode(&tokens, &unit, &ctx_map).unwrap();
+    let (_, decoded_unit, _) = decode(&bytes, SOURCE).unwrap();
+    assert_eq!(decoded_unit, unit);
+}
+
+#[test]
+fn test_rejected() {
+    let (tokens, unit, ctx_map) = parse(SOURCE, &mut State::new());
+    let bytes = encode(&tokens, &unit, &ctx_map).unwrap();
+
+    assert!(matches!(decode(&bytes, "int x;"), Err(Error::SourceMismatch)));
+    assert!(matches!(decode(b"int x;", SOURCE), Err(Error::NotEncoded)));
+    let mut other_version = bytes.clone();
+    other_version[4..8].copy_from_slice(&(FORMAT_VERSION + 1).to_le_bytes());
+    assert!(matches!(decode(&other_version, SOURCE), Err(Error::Version(_))));
+    assert!(matches!(
+        decode(&bytes[..bytes.len() - 1], SOURCE),
+        Err(Error::Format(_))
+    ));
+}
+
+#[test]
+fn test_declaration_index() {
+    let mut state = State::new();
+    state.set_declaration_index(true);
+    parse(SOURCE, &mut state);
+    let index = state.take_declaration_index().unwrap();
+    let bytes = encode_tree(&index).unwrap();
+    assert_eq!(decode_tree::<index::DeclarationIndex>(&bytes).unwrap(), index);
+}
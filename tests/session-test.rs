@@ -0,0 +1,169 @@
+use cgrammar::*;
+use chumsky::Parser;
+
+#[test]
+fn test_session_inputs_are_independent() {
+    let mut session = ParseSession::with_typedef_names(["term"]);
+    session.template_mut().set_declaration_index(true);
+
+    // Names declared by one input are not typedef names in the next
+    let first = session.parse("typedef int thm; term t; thm u;", None);
+    assert!(!first.has_errors(), "{:?}", first.errors);
+    assert_eq!(first.output.unwrap().external_declarations.len(), 3);
+    assert_eq!(first.declarations.unwrap().len(), 3);
+
+    let second = session.parse("term t; int thm;", None);
+    assert!(!second.has_errors(), "{:?}", second.errors);
+    let names: Vec<_> = second
+        .declarations
+        .unwrap()
+        .names()
+        .iter()
+        .map(|name| name.as_str())
+        .collect();
+    assert_eq!(names, ["t", "thm"]);
+    // The working state keeps its index, whose buffers the next input reuses
+    assert_eq!(session.state().declaration_index().map(|index| index.len()), Some(2));
+}
+
+#[test]
+fn test_session_matches_fresh_state() {
+    const INPUTS: &[&str] = &[
+        "int f(int x) { return x * (x + 1); }",
+        "typedef struct { int a; } S; S s = { .a = 1 };",
+        "int g(void) { T * p; return 0; }",
+        "enum { A, B } e = B;",
+    ];
+    let mut template = State::new();
+    template.set_memoize(true);
+    let mut session = ParseSession::new(template.clone());
+    for _ in 0..2 {
+        for input in INPUTS {
+            let (tokens, _) = lex(input, None);
+            let expected = translation_unit().parse_with_state(tokens.as_input(), &mut template.clone());
+            let (output, errors) = session.parse_tokens(&tokens);
+            assert_eq!(output.as_ref(), expected.output());
+            assert_eq!(errors.len(), expected.errors().len());
+            assert!(session.state().memo_stats().misses > 0);
+        }
+    }
+}
+
+#[test]
+fn test_session_snippet_batches() {
+    let mut session = ParseSession::with_typedef_names(["term"]);
+    let snippets = ["(term)x + 1", "sizeof(term) * (y", "f(a, b)[2]", "1 +", "/* open"];
+    let parsed = session.parse_expressions(snippets);
+    assert_eq!(parsed.len(), snippets.len());
+    for i in [0, 2, 3] {
+        let (tokens, _) = lex(snippets[i], None);
+        let expected = expression().parse_with_state(tokens.as_input(), &mut session.template().clone());
+        // Spans index the snippets joined by newlines
+        let shifted = parsed[i]
+            .output
+            .as_ref()
+            .map(|e| e.span.range().start - parsed[i].offset);
+        assert_eq!(
+            shifted,
+            expected.output().map(|e| e.span.range().start),
+            "{}",
+            snippets[i]
+        );
+        assert_eq!(parsed[i].has_errors(), expected.has_errors(), "{}", snippets[i]);
+    }
+    assert_eq!(
+        parsed[2].offset,
+        snippets[..2].iter().map(|s| s.len() + 1).sum::<usize>()
+    );
+    // Snippets that do not lex on their own are errors
+    assert!(parsed[1].output.is_none() && parsed[1].has_errors());
+    assert!(parsed[4].output.is_none() && parsed[4].has_errors());
+
+    // Each snippet starts from the template
+    let parsed = session.parse_statements(["{ typedef int u; u * p; }", "u * p;", "return (term)0;"]);
+    assert!(!parsed[0].has_errors() && !parsed[1].has_errors());
+    let Some(StatementKind::Unlabeled(UnlabeledStatement::Expression(e))) = parsed[1].output.as_ref().map(|s| &s.kind)
+    else {
+        panic!("not an expression statement: {:?}", parsed[1].output);
+    };
+    assert!(e.expression.is_some());
+    assert!(parsed[2].output.is_some() && !parsed[2].has_errors());
+
+    let parsed = session.parse_type_names(["term *", "const int[3]", "int (*)(term)"]);
+    assert!(
+        parsed
+            .iter()
+            .all(|parsed| parsed.output.is_some() && !parsed.has_errors())
+    );
+}
+
+#[test]
+fn test_parse_with_stats() {
+    let source = "typedef int T; enum { A, B };\nT f(T x) { if (x) { return ((x + 1) * A); } return (T)x; }\nint g(;";
+    let (unit, stats) = parse_with_stats(source, None, &State::new());
+    let (tokens, _) = lex(source, None);
+    let expected = translation_unit().parse(tokens.as_input());
+    assert_eq!(unit.output.as_ref(), expected.output());
+
+    let output = unit.output.as_ref().unwrap();
+    assert_eq!(stats.bytes, source.len());
+    assert!(stats.tokens > tokens.tokens.len());
+    assert_eq!(stats.external_declarations, output.external_declarations.len());
+    assert_eq!(stats.nodes, AstIndex::new(output).len());
+    assert_eq!(stats.errors, unit.errors.len());
+    assert!(stats.errors > 0 && stats.recoveries > 0);
+    assert!(stats.max_depth > 3);
+    assert!(stats.peak_bindings >= State::new().peak_bindings() + 3);
+    assert!(stats.rewinds > 0 && stats.token_work > 0);
+    assert!(stats.backtracking_ratio() > 0.0);
+}
+
+#[test]
+fn test_slow_input_capture() {
+    use std::{
+        sync::{Arc, Mutex},
+        time::Duration,
+    };
+
+    let source = "int f(int x) { return x * 2; }";
+    let captured = Arc::new(Mutex::new(Vec::new()));
+    let mut capture = {
+        let captured = captured.clone();
+        SlowInputCapture::callback(move |parse| {
+            captured
+                .lock()
+                .unwrap()
+                .push((parse.source.to_string(), parse.stats, parse.heap_size));
+        })
+    };
+    // Without bounds, or within them, nothing is captured
+    capture.parse(source, None, &State::new());
+    capture.set_max_time(Some(Duration::from_secs(3600)));
+    capture.set_max_heap_size(Some(usize::MAX));
+    capture.parse(source, None, &State::new());
+    assert!(captured.lock().unwrap().is_empty());
+
+    capture.set_max_heap_size(Some(0));
+    let (unit, stats) = capture.parse(source, Some("a.c"), &State::new());
+    assert!(!unit.has_errors());
+    let captured = captured.lock().unwrap();
+    assert_eq!(captured.len(), 1);
+    assert_eq!(captured[0].0, source);
+    assert_eq!(captured[0].1, stats);
+    assert!(captured[0].2.is_some_and(|size| size > 0));
+
+    // Spooled inputs are a source and a report
+    let dir = std::env::temp_dir().join(format!("cgrammar-spool-{}", std::process::id()));
+    let mut spool = SlowInputCapture::spool(&dir);
+    spool.set_max_time(Some(Duration::ZERO));
+    spool.parse(source, Some("a.c"), &State::new());
+    let mut files: Vec<_> = std::fs::read_dir(&dir)
+        .unwrap()
+        .map(|entry| entry.unwrap().path())
+        .collect();
+    files.sort();
+    assert_eq!(files.len(), 2);
+    assert_eq!(std::fs::read_to_string(&files[0]).unwrap(), source);
+    assert!(std::fs::read_to_string(&files[1]).unwrap().contains("filename: a.c"));
+    std::fs::remove_dir_all(&dir).unwrap();
+}
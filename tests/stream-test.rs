@@ -0,0 +1,133 @@
+use cgrammar::*;
+use rstest::rstest;
+
+#[rstest]
+#[case("typedef int T; T f(T x) { return x; } enum E { A, B }; int g(void) { T y = A; return y * B; }")]
+#[case("struct S { int a; } s; int (*h(void))(int) { return 0; } int x = (int){1}, *p = &(int){2};")]
+// A K&R definition, split at the declaration of its parameter
+#[case("int old(a) int a; { return a; } typedef struct { int v; } V; V v;")]
+#[case("")]
+fn test_parse_iter(#[case] source: &str) {
+    let (tokens, _) = lex(source, None);
+
+    let mut expected_state = State::new();
+    let expected = translation_unit()
+        .parse_with_state(tokens.as_input(), &mut expected_state)
+        .into_output()
+        .unwrap();
+
+    let mut state = State::new();
+    let external_declarations: Result<Vec<_>, _> = parse_iter(&tokens, &mut state).collect();
+    assert_eq!(external_declarations.unwrap(), expected.external_declarations);
+    for name in ["T", "V", "A", "B"] {
+        let name = Identifier::from(name);
+        assert_eq!(
+            state.ctx().is_typedef_name(&name),
+            expected_state.ctx().is_typedef_name(&name)
+        );
+        assert_eq!(
+            state.ctx().is_enum_constant(&name),
+            expected_state.ctx().is_enum_constant(&name)
+        );
+    }
+}
+
+#[test]
+fn test_parse_iter_on_another_thread() {
+    let (tokens, _) = lex(
+        "typedef int T; T a; enum E { A }; T f(void) { return A; } T b = A;",
+        None,
+    );
+    let mut state = State::new();
+    let mut iter = parse_iter(&tokens, &mut state);
+    let first: Vec<_> = iter.by_ref().take(2).collect::<Result<_, _>>().unwrap();
+
+    // The rest of the parse moves to another thread, with the names bound so far
+    let rest: Vec<_> = std::thread::scope(|scope| scope.spawn(move || iter.collect::<Result<Vec<_>, _>>()).join())
+        .unwrap()
+        .unwrap();
+    assert_eq!(first.len() + rest.len(), 5);
+    assert!(state.ctx().is_typedef_name(&Identifier::from("T")));
+    assert!(state.ctx().is_enum_constant(&Identifier::from("A")));
+}
+
+#[test]
+fn test_parse_iter_errors() {
+    let (tokens, _) = lex("int a; int b int c; int d;", None);
+    let mut state = State::new();
+    let mut iter = parse_iter(&tokens, &mut state);
+    assert!(matches!(iter.next(), Some(Ok(ExternalDeclaration::Declaration(_)))));
+    assert!(matches!(iter.next(), Some(Err(errors)) if !errors.is_empty()));
+    assert!(iter.all(|item| item.is_ok()));
+}
+
+#[test]
+fn test_parse_iter_partial() {
+    let (tokens, _) = lex("typedef int T; T x; int y;", None);
+    let mut state = State::new();
+    let mut iter = parse_iter(&tokens, &mut state);
+    iter.next().unwrap().unwrap();
+    drop(iter);
+    assert!(state.ctx().is_typedef_name(&Identifier::from("T")));
+}
+
+#[test]
+fn test_parse_iter_slices() {
+    let source = "int a; int f(void) { return a; }\n".repeat(100);
+    let (tokens, _) = lex(&source, None);
+    let mut state = State::new();
+    let mut iter = parse_iter(&tokens, &mut state);
+
+    // Each slice parses at least one declaration, until none are left
+    let first = iter.next_slice(std::time::Duration::ZERO);
+    assert_eq!(first.len(), 1);
+    let mut count = first.len();
+    loop {
+        let slice = iter.next_slice(std::time::Duration::from_millis(1));
+        if slice.is_empty() {
+            break;
+        }
+        assert!(slice.iter().all(Result::is_ok));
+        count += slice.len();
+    }
+    assert_eq!(count, 200);
+
+    // A cancelled parse skips the rest of the input
+    let token = CancellationToken::new();
+    let mut state = State::new();
+    state.set_cancellation(Some(token.clone()));
+    let mut iter = parse_iter(&tokens, &mut state);
+    assert!(matches!(iter.next(), Some(Ok(_))));
+    token.cancel();
+    let Some(Err(errors)) = iter.next() else {
+        panic!("expected the cancellation error");
+    };
+    assert_eq!(errors.last().unwrap().to_string(), "parse cancelled");
+    assert!(iter.next().is_none());
+    assert!(state.cancelled());
+}
+
+#[test]
+fn test_parse_matching() {
+    let source = "typedef int T; enum { A = 2 }; int other(void) { return foo(1); }\n\
+                  T (*foo)(T x); struct S { int foo; }; int bar, baz = sizeof(T);";
+    let (tokens, _) = lex(source, None);
+    let expected = translation_unit().parse(tokens.as_input()).into_output().unwrap();
+
+    let mut state = State::new();
+    let names = [Symbol::intern("foo"), Symbol::intern("baz")];
+    let matching: Result<Vec<_>, _> = parse_matching(&tokens, &mut state, names).collect();
+    let matching = matching.unwrap();
+    // Not in the function body nor in the struct members
+    assert_eq!(matching.len(), 2);
+    assert_eq!(matching[0], expected.external_declarations[3]);
+    assert_eq!(matching[1], expected.external_declarations[5]);
+    assert!(state.ctx().is_typedef_name(&Identifier::from("T")));
+    assert!(state.ctx().is_enum_constant(&Identifier::from("A")));
+
+    let mut state = State::new();
+    assert_eq!(
+        parse_matching(&tokens, &mut state, [Symbol::intern("missing")]).count(),
+        0
+    );
+}
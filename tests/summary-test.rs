@@ -0,0 +1,81 @@
+use cgrammar::*;
+
+const HEADER: &str =
+    "typedef unsigned long size_t;\nstruct point { int x, y; };\nextern int counter;\nint area(struct point *p);\n";
+
+fn parse_c(code: &str, lazy: bool) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    let mut state = State::new();
+    state.set_lazy_function_bodies(lazy);
+    (translation_unit().parse_with_state(tokens.as_input(), &mut state))
+        .into_output()
+        .unwrap()
+}
+
+fn summarize(code: &str) -> UnitSummary {
+    let (tokens, _) = lex(code, None);
+    UnitSummary::parse(&tokens, &State::new()).unwrap()
+}
+
+#[test]
+fn test_summary() {
+    let source = format!(
+        "{HEADER}int counter = 1;\nstatic int hidden(void) {{ return 0; }}\nint area(struct point *p) {{ return p->x * p->y; }}\n_Static_assert(1, \"\");\nint table[] = {{ 1, 2, 3 }};"
+    );
+    let unit = parse_c(&source, true);
+    let summary = UnitSummary::new(&unit);
+    // Bodies are never parsed
+    for d in &unit.external_declarations {
+        if let ExternalDeclaration::Function(f) = d {
+            assert!(!f.body.is_parsed());
+        }
+    }
+
+    assert_eq!(summary.declarations().len(), 7);
+    assert!(summary.get("hidden".into()).next().is_none());
+    assert_eq!(summary.get("area".into()).count(), 2);
+    assert_eq!(summary.get("size_t".into()).count(), 1);
+    assert!(summary.tag("point".into()).is_some());
+    assert!(summary.is_defined("counter".into()));
+    assert!(summary.is_defined("area".into()));
+    assert!(!summary.is_defined("hidden".into()));
+    assert_eq!(
+        summary.definitions(),
+        [Symbol::from("counter"), Symbol::from("area"), Symbol::from("table")]
+    );
+
+    // Initializers are left out
+    let Some(Declaration {
+        kind: DeclarationKind::Normal { declarators, .. },
+        ..
+    }) = summary.get("table".into()).next()
+    else {
+        unreachable!()
+    };
+    assert!(declarators[0].initializer.is_none());
+}
+
+#[test]
+fn test_merge() {
+    let mut project = summarize(&format!("{HEADER}int area(struct point *p) {{ return p->x * p->y; }}"));
+    let other = summarize(&format!("{HEADER}int counter;\nint main(void) {{ return area(0); }}"));
+    project.merge(&other);
+
+    // The header is kept once, though its spans differ between the units
+    assert_eq!(project.get("size_t".into()).count(), 1);
+    assert_eq!(project.get("area".into()).count(), 2);
+    assert_eq!(
+        project.definitions(),
+        [Symbol::from("area"), Symbol::from("counter"), Symbol::from("main")]
+    );
+}
+
+#[cfg(feature = "serde")]
+#[test]
+fn test_round_trip() {
+    let summary = summarize(&format!("{HEADER}int area(struct point *p) {{ return p->x * p->y; }}"));
+    let bytes = serialize::encode_tree(&summary).unwrap();
+    let decoded: UnitSummary = serialize::decode_tree(&bytes).unwrap();
+    assert_eq!(decoded.declarations().len(), summary.declarations().len());
+    assert_eq!(decoded.definitions(), summary.definitions());
+}
@@ -0,0 +1,66 @@
+use cgrammar::{database::SymbolSite, *};
+
+const FILES: &[(&str, Option<&str>)] = &[
+    (
+        "int counter = 0; int add(int a, int b) { return a + b; }\n\
+         static int helper(void) { return 1; } extern int shared; struct S { int x; } s;",
+        Some("a.c"),
+    ),
+    (
+        "extern int counter; int add(int x, int y); long shared; static int helper;\n\
+         struct S s; int *(*table[2])(const char *name);",
+        Some("b.c"),
+    ),
+    (
+        "int add(int, int); int counter; int *(*table[2])(char const *);",
+        Some("c.c"),
+    ),
+];
+
+fn database() -> (Vec<ParsedUnit<'static>>, SymbolDatabase) {
+    let mut state = State::new();
+    state.set_declaration_index(true);
+    let parsed = parse_many(FILES, &state);
+    let units: Vec<_> = parsed
+        .iter()
+        .map(|unit| {
+            assert!(!unit.has_errors());
+            UnitSymbols::new(unit.output.as_ref().unwrap(), unit.declarations.as_ref().unwrap())
+        })
+        .collect();
+    (parsed, SymbolDatabase::merge(&units))
+}
+
+#[test]
+fn test_symbol_database() {
+    let (parsed, database) = database();
+    let names: Vec<_> = database.symbols().iter().map(|symbol| symbol.name.as_str()).collect();
+    assert_eq!(names, ["counter", "add", "shared", "s", "table"]);
+    assert!(database.get("helper".into()).is_none());
+
+    let add = database.get("add".into()).unwrap();
+    let sites: Vec<_> = database
+        .sites(add)
+        .iter()
+        .map(|site| (site.unit, site.defined))
+        .collect();
+    assert_eq!(sites, [(0, true), (1, false), (2, false)]);
+    assert!(!add.conflicting);
+
+    let counter = database.get("counter".into()).unwrap();
+    assert_eq!(counter.definitions, 2);
+    assert!(!counter.conflicting);
+    assert!(!database.get("s".into()).unwrap().conflicting);
+    assert!(!database.get("table".into()).unwrap().conflicting);
+
+    let conflicts: Vec<_> = database.conflicts().map(|symbol| symbol.name.as_str()).collect();
+    assert_eq!(conflicts, ["shared"]);
+
+    // Each site points at the name in its own unit
+    for symbol in database.symbols() {
+        for &SymbolSite { unit, span, .. } in database.sites(symbol) {
+            let source = parsed[unit as usize].ctx_map.source;
+            assert_eq!(&source[span.range()], symbol.name.as_str());
+        }
+    }
+}
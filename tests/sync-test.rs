@@ -0,0 +1,51 @@
+#![cfg(feature = "sync")]
+
+use std::thread;
+
+use cgrammar::*;
+
+fn assert_send_sync<T: Send + Sync>(_: &T) {}
+
+#[test]
+fn test_shared_parser() {
+    let parser = translation_unit();
+    assert_send_sync(&parser);
+
+    let sources = [
+        "typedef int T; T x = (T) 1;",
+        "int f(int a, int b) { return a * (b + 1); }",
+        "struct S { int a : 3; char *b; } s = { .a = 1, .b = \"str\" };",
+        "enum E { A, B = A + 1 }; int g(void) { switch (B) { case A: return 1; default: return sizeof(enum E); } }",
+    ];
+    thread::scope(|scope| {
+        for source in sources {
+            let parser = &parser;
+            scope.spawn(move || {
+                let (tokens, _) = lex(source, None);
+                let result = parser.parse(tokens.as_input());
+                assert!(
+                    !result.has_errors(),
+                    "{source}: {:?}",
+                    result.errors().collect::<Vec<_>>()
+                );
+            });
+        }
+    });
+}
+
+#[test]
+fn test_first_use_on_many_threads() {
+    // The threads race to build the rules, and all wait for the same graph
+    let handles: Vec<_> = (0..8)
+        .map(|i| {
+            thread::spawn(move || {
+                let source = format!("int x{i} = {i}; int f{i}(int a) {{ return a + x{i}; }}");
+                let (tokens, _) = lex(&source, None);
+                !translation_unit().parse(tokens.as_input()).has_errors()
+            })
+        })
+        .collect();
+    for handle in handles {
+        assert!(handle.join().unwrap());
+    }
+}
@@ -0,0 +1,48 @@
+use cgrammar::{
+    token_format::{Error, decode, encode},
+    *,
+};
+use rstest::rstest;
+
+#[rstest]
+#[case("")]
+#[case("int main(void) { return 0; }")]
+#[case("typedef unsigned long T; T x[3] = { 1ul, 0x10ULL, 2wb };\nfloat f = 1.5f + .25e-3 + 0x1p4L;")]
+// A bit-precise constant wider than a `u64`
+#[case("unsigned _BitInt(80) w = 0xffff'ffff'ffff'ffff'ffffuwb;")]
+#[case(r#"char *s = u8"a\n" L"b" "\"c\""; int c = L'x' + '\'' + U'é';"#)]
+#[case("# 10 \"header.h\"\nbool b = true && !nullptr; a->b ... <<= %: ## ::")]
+#[case("void f(int a[static 1]) { g(a, (b)); h[{ 1 }]")]
+fn test_round_trip(#[case] source: &str) {
+    let (tokens, _) = lex(source, Some("input.c"));
+    let bytes = encode(&tokens).unwrap();
+    assert_eq!(decode(&bytes).unwrap(), tokens);
+}
+
+#[test]
+fn test_compact() {
+    let source = "static int table[] = { 1, 2, 3, 4 };\n".repeat(256) + "int f(int x) { return table[x] + x * 2; }";
+    let (tokens, _) = lex(&source, None);
+    let bytes = encode(&tokens).unwrap();
+    // Identifiers are written once, and most tokens take three to five bytes
+    assert!(
+        bytes.len() < 2 * source.len(),
+        "{} bytes for {}",
+        bytes.len(),
+        source.len()
+    );
+    assert!(bytes.len() * 4 < tokens.heap_size());
+}
+
+#[test]
+fn test_invalid() {
+    let (tokens, _) = lex("int x = (1 + 2) * y;", None);
+    let bytes = encode(&tokens).unwrap();
+    assert_eq!(decode(b"int x;"), Err(Error::NotEncoded));
+    let mut other = bytes.clone();
+    other[4] = 0xff;
+    assert!(matches!(decode(&other), Err(Error::Version(_))));
+    for len in 8..bytes.len() {
+        assert_eq!(decode(&bytes[..len]), Err(Error::Invalid));
+    }
+}
@@ -0,0 +1,205 @@
+use cgrammar::{
+    types::{ArrayLength, Type},
+    visitor::{Visitor, walk_declarator},
+    *,
+};
+use rstest::rstest;
+
+fn parse_c(code: &str) -> TranslationUnit {
+    let (tokens, _) = lex(code, None);
+    translation_unit().parse(tokens.as_input()).into_result().unwrap()
+}
+
+/// The types of the named declarators of `unit`, by name.
+fn resolve<'a>(unit: &'a TranslationUnit, table: &mut TypeTable) -> Vec<(String, TypeId)> {
+    struct Collect<'a, 'r>(&'r types::ResolvedTypes<'a>, Vec<(String, TypeId)>);
+
+    impl<'a> Visitor<'a> for Collect<'a, '_> {
+        type Result = ();
+
+        fn visit_declarator(&mut self, d: &'a Declarator) {
+            // Only the outermost declarator of a declaration has a type
+            if let Some(ty) = self.0.declarator(d)
+                && let Some(name) = d.identifier()
+            {
+                self.1.push((name.to_string(), ty));
+            }
+            walk_declarator(self, d)
+        }
+    }
+
+    let types = table.resolve_unit(unit);
+    let mut collect = Collect(&types, Vec::new());
+    collect.visit_translation_unit(unit);
+    collect.1
+}
+
+fn type_of(declared: &[(String, TypeId)], name: &str) -> TypeId {
+    declared.iter().find(|(n, _)| n == name).unwrap().1
+}
+
+#[test]
+fn test_typedef_chain() {
+    let unit = parse_c(
+        "typedef unsigned long size;\ntypedef size length;\nlength x;\nunsigned long y;\nconst length *p;\nunsigned long const *q;",
+    );
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    assert_eq!(type_of(&declared, "x"), type_of(&declared, "y"));
+    assert_eq!(type_of(&declared, "size"), type_of(&declared, "length"));
+    assert_eq!(type_of(&declared, "p"), type_of(&declared, "q"));
+    assert_eq!(table.display(type_of(&declared, "x")).to_string(), "unsigned long");
+
+    // Another unit resolved with the same table shares its types
+    let other = parse_c("long unsigned z;");
+    let other = resolve(&other, &mut table);
+    assert_eq!(type_of(&other, "z"), type_of(&declared, "y"));
+}
+
+#[rstest]
+#[case("const char *x;", "const char *")]
+#[case("char *const x;", "char *const")]
+#[case("int (*x)[3];", "int (*)[3]")]
+#[case("int *x[3];", "int *[3]")]
+#[case("const int x[2][4];", "const int[2][4]")]
+#[case("void (*x)(void);", "void (*)(void)")]
+#[case("int (*x)(const char *, ...);", "int (*)(const char *, ...)")]
+#[case("_Complex double x;", "_Complex double")]
+#[case("unsigned _BitInt(7) x;", "unsigned _BitInt(7)")]
+fn test_display(#[case] code: &str, #[case] expected: &str) {
+    let unit = parse_c(code);
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    assert_eq!(table.display(type_of(&declared, "x")).to_string(), expected);
+}
+
+#[test]
+fn test_parameter_adjustment() {
+    let unit = parse_c(
+        "int f(const int a[]);\nint g(int *);\nint h();\nint k(void);\nint m(int (int));\nint n(int (*)(int));\nconst int r(void);",
+    );
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    assert_eq!(type_of(&declared, "f"), type_of(&declared, "g"));
+    assert_eq!(type_of(&declared, "h"), type_of(&declared, "k"));
+    assert_eq!(type_of(&declared, "m"), type_of(&declared, "n"));
+    assert_eq!(type_of(&declared, "r"), type_of(&declared, "k"));
+    assert_eq!(table.display(type_of(&declared, "f")).to_string(), "int(int *)");
+}
+
+#[test]
+fn test_records() {
+    let unit = parse_c(
+        "struct node { struct node *next; unsigned value : 4; };\nstruct node n;\nstruct a { int x; } s;\nstruct b { int x; } t;\nstruct a u;",
+    );
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    let n = type_of(&declared, "n");
+    let Type::Struct(node) = *table.get(n) else {
+        panic!("not a structure: {:?}", table.get(n));
+    };
+    let record = table.record(node);
+    assert!(record.complete);
+    assert_eq!(record.fields.len(), 2);
+    assert_eq!(*table.get(record.fields[0].ty), Type::Pointer(n));
+    assert_eq!(record.fields[1].bit_width, Some(4));
+
+    // Records are nominal
+    assert_ne!(type_of(&declared, "s"), type_of(&declared, "t"));
+    assert_eq!(type_of(&declared, "s"), type_of(&declared, "u"));
+}
+
+#[test]
+fn test_constant_lengths() {
+    let unit = parse_c(
+        "enum { A = 2, B, C = B * 2 };\nint a[C];\nint b[6];\nint c[1 << 2 | 2];\nint d[sizeof(int)];\nint e[];",
+    );
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    assert_eq!(type_of(&declared, "a"), type_of(&declared, "b"));
+    assert_eq!(type_of(&declared, "c"), type_of(&declared, "b"));
+    let length = |name| match *table.get(type_of(&declared, name)) {
+        Type::Array { length, .. } => length,
+        ref ty => panic!("not an array: {ty:?}"),
+    };
+    assert_eq!(length("d"), ArrayLength::Variable);
+    assert_eq!(length("e"), ArrayLength::Unspecified);
+}
+
+#[test]
+fn test_scopes() {
+    let unit = parse_c("typedef int t;\nvoid f(void) { typedef char t; t inner; }\nt outer;");
+    let mut table = TypeTable::new();
+    let declared = resolve(&unit, &mut table);
+    assert_eq!(*table.get(type_of(&declared, "inner")), Type::Char);
+    assert_eq!(table.display(type_of(&declared, "outer")).to_string(), "int");
+}
+
+/// The static assertions of `unit`, in order.
+fn static_assertions(unit: &TranslationUnit) -> Vec<&StaticAssertDeclaration> {
+    (unit.external_declarations.iter())
+        .filter_map(|d| match d {
+            ExternalDeclaration::Declaration(Declaration {
+                kind: DeclarationKind::StaticAssert(s), ..
+            }) => Some(s),
+            _ => None,
+        })
+        .collect()
+}
+
+#[test]
+fn test_static_assertions() {
+    let unit = parse_c(
+        "struct s { int x; char c; };\nint a[sizeof(struct s)];\n_Static_assert(sizeof(int) == 4, \"int\");\n_Static_assert(sizeof(long) == 4);\n_Static_assert((unsigned char)300 == 44 && (signed char)255 == -1);\n_Static_assert(_Alignof(struct s) * 2 == sizeof a / 4);",
+    );
+    let mut table = TypeTable::new();
+    let types = table.resolve_unit_for(&unit, Target::LP64);
+    let holds: Vec<_> = (static_assertions(&unit).into_iter())
+        .map(|s| types.static_assertion(s))
+        .collect();
+    assert_eq!(holds, [Some(true), Some(false), Some(true), None]);
+
+    let declared = resolve(&unit, &mut table);
+    let a = type_of(&declared, "a");
+    // Without a target, `sizeof` has no value
+    assert_eq!(table.display(a).to_string(), "int[*]");
+    let types = table.resolve_unit_for(&unit, Target::LP64);
+    let ExternalDeclaration::Declaration(Declaration {
+        kind: DeclarationKind::Normal { declarators, .. },
+        ..
+    }) = &unit.external_declarations[1]
+    else {
+        unreachable!()
+    };
+    let a = types.declarator(&declarators[0].declarator).unwrap();
+    assert_eq!(table.display(a).to_string(), "int[8]");
+}
+
+#[test]
+fn test_enumerator_chain() {
+    let names: Vec<_> = (0..10_000).map(|i| format!("E{i}")).collect();
+    let unit = parse_c(&format!(
+        "enum big {{ {} = 5, {}, LAST = E9999 + 1 }};",
+        names[0],
+        names[1..].join(", ")
+    ));
+    let mut table = TypeTable::new();
+    let types = table.resolve_unit(&unit);
+    let ExternalDeclaration::Declaration(Declaration {
+        kind: DeclarationKind::Normal { specifiers, .. },
+        ..
+    }) = &unit.external_declarations[0]
+    else {
+        unreachable!()
+    };
+    let Some(DeclarationSpecifier::TypeSpecifierQualifier(TypeSpecifierQualifier::TypeSpecifier(TypeSpecifier::Enum(
+        e,
+    )))) = specifiers.specifiers.first()
+    else {
+        unreachable!()
+    };
+    let enumerators = e.enumerators.as_ref().unwrap();
+    assert_eq!(types.enumerator(&enumerators[0]), Some(5));
+    assert_eq!(types.enumerator(&enumerators[9_999]), Some(10_004));
+    assert_eq!(types.enumerator(&enumerators[10_000]), Some(10_005));
+}
@@ -40,6 +40,65 @@ fn test_variable_counter(#[case] code: &str, #[case] expected: usize) {
     assert_eq!(visitor.count, expected, "Failed for code: {}", code);
 }
 
+// ============================================================================
+// Pruned Walks
+// ============================================================================
+
+/// A visitor that counts variable names, walking only the subtrees that can
+/// hold expressions or declarators.
+struct PrunedVariableCounter {
+    count: usize,
+}
+
+impl<'a> Visitor<'a> for PrunedVariableCounter {
+    type Result = ();
+
+    const INTERESTS: NodeKinds = NodeKinds::of(NodeKind::Expression).with(NodeKind::Declarator);
+
+    fn visit_variable_name(&mut self, _: &'a Identifier) {
+        self.count += 1;
+    }
+}
+
+/// A visitor that counts variable names, while looking only at declarations.
+struct DeclarationsOnly {
+    count: usize,
+}
+
+impl<'a> Visitor<'a> for DeclarationsOnly {
+    type Result = ();
+
+    const INTERESTS: NodeKinds = NodeKinds::of(NodeKind::Declaration);
+
+    fn visit_variable_name(&mut self, _: &'a Identifier) {
+        self.count += 1;
+    }
+}
+
+#[rstest]
+#[case("int x;", 1)]
+#[case("int add(int a, int b) { return a + b; }", 5)]
+#[case(
+    "int n; int f(int m) { typeof(n) a[m]; _Alignas(n) char b; return sizeof(int[m]); }",
+    9
+)]
+#[case("[[deprecated]] int g(void) { struct { int k : sizeof(g); } s; return s.k; }", 5)]
+fn test_pruned_walks(#[case] code: &str, #[case] expected: usize) {
+    let ast = parse_c(code);
+    let mut full = VariableCounter { count: 0 };
+    full.visit_translation_unit(&ast);
+    let mut pruned = PrunedVariableCounter { count: 0 };
+    pruned.visit_translation_unit(&ast);
+    assert_eq!(full.count, expected, "Failed for code: {}", code);
+    assert_eq!(pruned.count, full.count, "Failed for code: {}", code);
+
+    // Declarators and expressions hold no declarations, so a visitor of
+    // declarations skips them
+    let mut skipped = DeclarationsOnly { count: 0 };
+    skipped.visit_translation_unit(&ast);
+    assert_eq!(skipped.count, 0, "Failed for code: {}", code);
+}
+
 // ============================================================================
 // Collecting Identifiers by Type
 // ============================================================================
@@ -1026,3 +1085,401 @@ fn test_fallible_renamer_failure() {
     assert!(result.is_err());
     assert_eq!(visitor.rename_count, 2);
 }
+
+// ============================================================================
+// Flattened Index Tests
+// ============================================================================
+
+/// A visitor that counts function calls
+struct CallCounter {
+    count: usize,
+}
+
+impl<'a> Visitor<'a> for CallCounter {
+    type Result = ();
+
+    fn visit_postfix_expression(&mut self, p: &'a PostfixExpression) {
+        if matches!(p, PostfixExpression::FunctionCall { .. }) {
+            self.count += 1;
+        }
+        walk_postfix_expression(self, p)
+    }
+}
+
+#[rstest]
+#[case("int x;")]
+#[case("int f(int); int g(int a) { return f(f(a) + 1) * f(2); }")]
+#[case("struct s { int (*op)(int); } v; int h(void) { if (v.op(1)) return v.op(v.op(2)); return sizeof(int); }")]
+fn test_ast_index(#[case] code: &str) {
+    let ast = parse_c(code);
+    let index = AstIndex::new(&ast);
+
+    let mut counter = CallCounter { count: 0 };
+    counter.visit_translation_unit(&ast);
+    assert_eq!(index.function_calls().count(), counter.count);
+
+    // Subtrees nest: each one is either inside or after the ones before it
+    let mut open: Vec<usize> = Vec::new();
+    for i in 0..index.len() {
+        let subtree = index.subtree(i);
+        assert!(subtree.start < subtree.end && subtree.end <= index.len());
+        while open.last().is_some_and(|&end| end <= i) {
+            open.pop();
+        }
+        assert!(open.last().is_none_or(|&end| subtree.end <= end));
+        open.push(subtree.end);
+    }
+    let declarations = index.of_kind(cgrammar::index::NodeKind::ExternalDeclaration).count();
+    assert_eq!(declarations, ast.external_declarations.len());
+}
+
+/// A visitor that counts declarations, and only looks at them
+struct DeclarationCounter {
+    count: usize,
+}
+
+impl<'a> Visitor<'a> for DeclarationCounter {
+    type Result = ();
+
+    const INTERESTS: NodeKinds = NodeKinds::of(NodeKind::Declaration);
+
+    fn visit_declaration(&mut self, d: &'a Declaration) {
+        self.count += 1;
+        walk_declaration(self, d)
+    }
+}
+
+#[rstest]
+#[case("int x;")]
+#[case("int f(int a) { int b = a; for (int i = 0; i < b; i++) { int c = i * f(i); } return b; }")]
+#[case("int g(void) { return 1 + 2 * 3; }")]
+fn test_ast_index_interests(#[case] code: &str) {
+    let ast = parse_c(code);
+    let index = AstIndex::new(&ast);
+
+    let mut walked = DeclarationCounter { count: 0 };
+    walked.visit_translation_unit(&ast);
+    let mut pruned = DeclarationCounter { count: 0 };
+    index.visit(&mut pruned);
+    assert_eq!(pruned.count, walked.count);
+
+    for i in 0..index.len() {
+        let kind = index.get(i).unwrap().kind();
+        assert!(index.subtree_kinds(i).contains(kind));
+    }
+}
+
+#[rstest]
+#[case("int x;")]
+#[case("int f(int a) { int b = a; for (int i = 0; i < b; i++) { b += (i * f(i)); } return b; }")]
+#[case("struct s { int (*op)(int); } v;\nint h(void) { if (v.op(1)) return v.op(v.op(2)); return sizeof(int); }")]
+fn test_span_index(#[case] code: &str) {
+    let ast = parse_c(code);
+    let spans = SpanIndex::new(&ast);
+    let index = AstIndex::new(&ast);
+    let key = |node: index::Node| (node.kind(), node.span().unwrap().range());
+
+    // The innermost node is the shortest one containing the offset, and the
+    // last one in pre-order among those of the same span
+    let spanned: Vec<_> = index
+        .nodes()
+        .iter()
+        .filter(|node| node.span().is_some())
+        .copied()
+        .collect();
+    assert_eq!(spans.len(), spanned.len());
+    for offset in 0..code.len() {
+        let expected = (spanned.iter().rev())
+            .filter(|node| node.span().unwrap().range().contains(&offset))
+            .min_by_key(|node| node.span().unwrap().range().len());
+        assert_eq!(
+            spans.node_at(offset).map(key),
+            expected.copied().map(key),
+            "at {offset}"
+        );
+
+        for node in spans.nodes_at(offset) {
+            assert!(node.span().unwrap().range().contains(&offset));
+        }
+    }
+
+    let all = 0..code.len();
+    assert_eq!(spans.within(all.clone()).count(), spans.len());
+    for node in spans.nodes() {
+        let range = node.span().unwrap().range();
+        assert_eq!(
+            spans.enclosing(range.clone()).map(|node| node.span().unwrap().range()),
+            Some(range)
+        );
+    }
+}
+
+#[test]
+fn test_structural_hashes() {
+    let ast =
+        parse_c("int x = 1 + 2;\nint f(int a) { return a + 1; }\nint x  =  1+2;\nint g(int a) {\n    return a + 2;\n}");
+    let hashes = StructuralHashes::new(&ast);
+    let index = AstIndex::new(&ast);
+    let returns: Vec<_> = index
+        .of_kind(NodeKind::Statement)
+        .map(|(_, node)| match node {
+            index::Node::Statement(s) => hashes.statement(s).unwrap(),
+            _ => unreachable!(),
+        })
+        .collect();
+    assert_eq!(returns.len(), 2);
+    assert_ne!(returns[0], returns[1]);
+
+    // The same code hashes the same at other spans and in other units
+    let declarations: Vec<_> = ast
+        .external_declarations
+        .iter()
+        .map(|d| hashes.external_declaration(d).unwrap())
+        .collect();
+    assert_eq!(declarations[0], declarations[2]);
+    assert_ne!(declarations[0], declarations[1]);
+    let other = parse_c("int g(int a) { return a + 2; }");
+    assert_eq!(
+        StructuralHashes::new(&other).external_declaration(&other.external_declarations[0]),
+        Some(declarations[3])
+    );
+    let expressions = index.of_kind(NodeKind::Expression).count();
+    assert_eq!(hashes.len(), expressions + returns.len() + declarations.len());
+}
+
+/// A pass that counts the nodes of one kind, breaking at the `limit`th.
+struct KindCounter {
+    kind: NodeKind,
+    limit: usize,
+    entered: usize,
+    left: usize,
+}
+
+impl KindCounter {
+    fn new(kind: NodeKind, limit: usize) -> Self {
+        Self { kind, limit, entered: 0, left: 0 }
+    }
+}
+
+impl<'a> Pass<'a> for KindCounter {
+    type Result = ControlFlow<usize>;
+
+    fn interests(&self) -> NodeKinds {
+        self.kind.into()
+    }
+
+    fn enter(&mut self, node: index::Node<'a>) -> ControlFlow<usize> {
+        assert_eq!(node.kind(), self.kind);
+        self.entered += 1;
+        if self.entered == self.limit {
+            return ControlFlow::Break(self.entered);
+        }
+        ControlFlow::Continue(())
+    }
+
+    fn leave(&mut self, _: index::Node<'a>) -> ControlFlow<usize> {
+        self.left += 1;
+        ControlFlow::Continue(())
+    }
+}
+
+#[test]
+fn test_fused_passes() {
+    let ast = parse_c("int f(int a) { int b = a; for (int i = 0; i < b; i++) { b += f(i); } return b; }\nint x = 1;");
+    let index = AstIndex::new(&ast);
+    let count = |kind| index.of_kind(kind).count();
+
+    let mut declarations = KindCounter::new(NodeKind::Declaration, usize::MAX);
+    let mut expressions = KindCounter::new(NodeKind::Expression, usize::MAX);
+    let mut statements = KindCounter::new(NodeKind::Statement, 2);
+    let mut fused = Fused::<ControlFlow<usize>>::new();
+    fused.push(&mut declarations);
+    fused.push(&mut expressions);
+    fused.push(&mut statements);
+    assert_eq!(fused.visit_translation_unit(&ast), ControlFlow::Continue(()));
+    assert!(!fused.has_broken(0) && fused.has_broken(2));
+    let results = fused.into_results();
+    assert_eq!(
+        results,
+        [
+            ControlFlow::Continue(()),
+            ControlFlow::Continue(()),
+            ControlFlow::Break(2)
+        ]
+    );
+
+    assert_eq!(declarations.entered, count(NodeKind::Declaration));
+    assert_eq!(declarations.left, declarations.entered);
+    assert_eq!(expressions.entered, count(NodeKind::Expression));
+    assert_eq!(statements.entered, 2);
+
+    // The walk stops once every pass has broken
+    let mut first = KindCounter::new(NodeKind::Expression, 1);
+    let mut fused = Fused::<ControlFlow<usize>>::new();
+    fused.push(&mut first);
+    assert_eq!(fused.visit_translation_unit(&ast), ControlFlow::Break(()));
+    assert_eq!(first.left, 0);
+}
+
+#[rstest]
+#[case("int x;")]
+#[case("int f(int a) { int b = a; for (int i = 0; i < b; i++) { b += (i * f(i)); } return b; }")]
+fn test_node_ids(#[case] code: &str) {
+    let ast = parse_c(code);
+    let index = AstIndex::new(&ast);
+    for (i, node) in index.nodes().iter().enumerate() {
+        assert_eq!(index.id(*node), Some(NodeId::new(i)));
+        assert_eq!(index.node(NodeId::new(i)).kind(), node.kind());
+    }
+    let unrelated = Expression::dummy(ExpressionKind::Error);
+    assert_eq!(index.expression_id(&unrelated), None);
+
+    // Side tables by id: the depth of each node, and the expressions only
+    let mut depths = NodeVec::new(&index, 0);
+    for i in 0..index.len() {
+        for j in index.subtree(i).skip(1) {
+            depths[NodeId::new(j)] += 1;
+        }
+    }
+    assert!(
+        depths
+            .iter()
+            .all(|(id, depth)| (*depth == 0) == (index.node(id).kind() == NodeKind::ExternalDeclaration))
+    );
+    let mut expressions = NodeMap::new(&index);
+    for (i, node) in index.of_kind(NodeKind::Expression) {
+        assert_eq!(expressions.insert(i.into(), node.span()), None);
+    }
+    assert_eq!(expressions.len(), index.of_kind(NodeKind::Expression).count());
+    assert!(
+        expressions
+            .iter()
+            .all(|(id, _)| index.node(id).kind() == NodeKind::Expression)
+    );
+    if let Some((id, _)) = index.of_kind(NodeKind::Expression).next() {
+        assert!(expressions.remove(id.into()).is_some());
+        assert!(!expressions.contains(id.into()));
+    }
+}
+
+#[test]
+fn test_ast_index_parents() {
+    let ast = parse_c("int f(int a) { if (a) { return a * 2; } return 0; }");
+    let index = AstIndex::new(&ast);
+    for i in 0..index.len() {
+        let id = NodeId::new(i);
+        match index.parent(id) {
+            Some(parent) => assert!(index.subtree(parent.index()).contains(&i) && parent.index() < i),
+            None => assert_eq!(index.node(id).kind(), NodeKind::ExternalDeclaration),
+        }
+    }
+
+    // The multiplication is in a return statement of the function, and its
+    // ancestors go up to the external declaration
+    let (i, _) = (index.of_kind(NodeKind::Expression))
+        .find(|(_, node)| matches!(node, index::Node::Expression(e) if matches!(e.kind, ExpressionKind::Binary(_))))
+        .unwrap();
+    let id = NodeId::new(i);
+    let function = index.enclosing(id, NodeKind::FunctionDefinition).unwrap();
+    let statement = index.enclosing(id, NodeKind::Statement).unwrap();
+    assert!(matches!(
+        index.node(statement),
+        index::Node::Statement(Statement { kind: StatementKind::Jump { .. }, .. })
+    ));
+    assert_eq!(index.ancestors(id).last(), index.ancestors(function).last());
+    assert_eq!(index.enclosing(id, NodeKind::TypeName), None);
+}
+
+/// Collects binary operators.
+#[derive(Default)]
+struct Operators(Vec<BinaryOperator>);
+
+impl<'a> Visitor<'a> for Operators {
+    type Result = ();
+
+    fn visit_binary_operator(&mut self, operator: &'a BinaryOperator) {
+        self.0.push(*operator);
+    }
+}
+
+/// Rewrites `e * 2` into `e << 1`, moving `e`.
+struct StrengthReduction(usize);
+
+impl<'a> VisitorMut<'a> for StrengthReduction {
+    type Result = ();
+
+    fn replace_expression_mut(&mut self, e: &mut Expression) -> Option<Expression> {
+        let ExpressionKind::Binary(binary) = &mut e.kind else {
+            return None;
+        };
+        let two = binary.right.as_constant() == Some(&Constant::Integer(IntegerConstant::from(2)));
+        if binary.operator != BinaryOperator::Multiply || !two {
+            return None;
+        }
+        self.0 += 1;
+        let one = ExpressionKind::Postfix(PostfixExpression::Primary(PrimaryExpression::Constant(
+            Constant::Integer(IntegerConstant::from(1)),
+        )));
+        let shift = BinaryExpression {
+            left: Box::new(binary.left.take()),
+            operator: BinaryOperator::LeftShift,
+            right: Box::new(Expression::dummy(one)),
+        };
+        Some(Expression::new(ExpressionKind::Binary(shift), e.span))
+    }
+}
+
+#[test]
+fn test_replace_expression() {
+    let mut ast = parse_c("int f(int a) { return a * 2 + (a * 3); }");
+    let mut visitor = StrengthReduction(0);
+    visitor.visit_translation_unit_mut(&mut ast);
+    assert_eq!(visitor.0, 1);
+
+    let expected = parse_c("int f(int a) { return (a << 1) + (a * 3); }");
+    let operators = |unit: &TranslationUnit| {
+        let mut operators = Operators::default();
+        operators.visit_translation_unit(unit);
+        operators.0
+    };
+    assert_eq!(operators(&ast), operators(&expected));
+
+    let mut e = Expression::dummy(ExpressionKind::Error);
+    e.replace_with(|e| e);
+    assert!(matches!(e.take().kind, ExpressionKind::Error));
+}
+
+/// Wraps every return statement in a block, which is not walked again.
+struct WrapReturns(usize);
+
+impl<'a> VisitorMut<'a> for WrapReturns {
+    type Result = ();
+
+    fn replace_block_item_mut(&mut self, b: &mut BlockItem) -> Option<BlockItem> {
+        if !matches!(b, BlockItem::Statement(UnlabeledStatement::Jump { .. })) {
+            return None;
+        }
+        self.0 += 1;
+        let block = PrimaryBlock::Compound(CompoundStatement { items: vec![b.take()] }.into());
+        Some(BlockItem::Statement(UnlabeledStatement::Primary {
+            attributes: Vec::new(),
+            block,
+        }))
+    }
+}
+
+#[test]
+fn test_replace_block_item() {
+    let mut ast = parse_c("int f(int a) { if (a) return 1; return 0; }");
+    let mut visitor = WrapReturns(0);
+    visitor.visit_translation_unit_mut(&mut ast);
+    // The return of the `if` is a statement, not a block item
+    assert_eq!(visitor.0, 1);
+    let ExternalDeclaration::Function(function) = &ast.external_declarations[0] else {
+        panic!("expected a function definition");
+    };
+    assert!(matches!(
+        &function.body.items[1],
+        BlockItem::Statement(UnlabeledStatement::Primary { block: PrimaryBlock::Compound(_), .. })
+    ));
+}